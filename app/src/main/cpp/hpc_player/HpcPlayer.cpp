@@ -5,20 +5,68 @@
 #include "HpcPlayer.h"
 #include "HpcPlayerInternal.h"
 #include "Log.h"
+#include "Looper.h"
+#include "MediaClock.h"
+#include "Surface.h"
+#include "decoder/DecoderPool.h"
+#include "render/AudioSink.h"
+#ifdef __ANDROID__
+#include "render/OpenSLAudioSink.h"
+#endif
 
 #define LOG_TAG "HpcPlayer"
 
 namespace hpc {
+
+// ComponentCallbacks2.TRIM_MEMORY_RUNNING_CRITICAL, the levels above it
+// (UI hidden, background, moderate, complete) all free what they can.
+static const int kTrimMemoryRunningCritical = 15;
+
+HpcPlayer::HpcPlayer()
+    : mState(STATE_IDLE),
+      mIsAsyncPrepare(false),
+      mAsyncResult(UNKNOWN_ERROR),
+      mDurationUs(-1),
+      mPositionUs(-1),
+      mPlayingTimeUs(0),
+      mLooper(std::make_shared<Looper>()),
+      mMediaClock(std::make_shared<MediaClock>()),
+      mPlayer(std::make_shared<HpcPlayerInternal>(mMediaClock)),
+      mPlayerFlags(0),
+      mAtEOS(false),
+      mAutoLoop(false) {
+  ALOGV("HpcPlayer(%p)", this);
+  mLooper->setName("HpcPlayer");
+  mLooper->start();
+  mMediaClock->init();
+  mLooper->registerHandler(mPlayer);
+}
+
+std::shared_ptr<HpcPlayer> HpcPlayer::Create() {
+  std::shared_ptr<HpcPlayer> player(new HpcPlayer());
+  player->mPlayer->init(player);
+#ifdef __ANDROID__
+  player->mPlayer->setAudioSink(std::make_shared<OpenSLAudioSink>());
+#endif
+  return player;
+}
+
 HpcPlayer::~HpcPlayer() {
-  ALOGV("~NuPlayerDriver(%p)", this);
+  ALOGV("~HpcPlayer(%p)", this);
+  mLooper->unregisterHandler(mPlayer->id());
   mLooper->stop();
 }
 
+void HpcPlayer::setListener(const Listener &listener) {
+  std::lock_guard autoLock(mLock);
+  mListener = listener;
+}
+
 status_t HpcPlayer::setDataSource(const char *url) {
+  std::unique_lock lck(mLock);
   if (mState != STATE_IDLE) {
     return INVALID_OPERATION;
   }
-  std::unique_lock lck(mLock);
   mState = STATE_SET_DATASOURCE_PENDING;
 
   mPlayer->setDataSourceAsync(url);
@@ -28,8 +76,25 @@ status_t HpcPlayer::setDataSource(const char *url) {
   return mAsyncResult;
 }
 
-status_t HpcPlayer::setSurface(Surface* surface) {
-  ALOGV("setVideoSurfaceTexture(%p)", this);
+status_t HpcPlayer::setDataSource(const std::vector<std::string> &urls) {
+  if (urls.empty()) {
+    return BAD_VALUE;
+  }
+  std::unique_lock lck(mLock);
+  if (mState != STATE_IDLE) {
+    return INVALID_OPERATION;
+  }
+  mState = STATE_SET_DATASOURCE_PENDING;
+
+  mPlayer->setDataSourceAsync(urls);
+
+  mCondition.wait(lck,[this](){return mState != STATE_SET_DATASOURCE_PENDING;});
+
+  return mAsyncResult;
+}
+
+status_t HpcPlayer::setSurface(const std::shared_ptr<Surface> &surface) {
+  ALOGV("setSurface(%p)", this);
   std::lock_guard autoLock(mLock);
 
   switch (mState) {
@@ -45,15 +110,31 @@ status_t HpcPlayer::setSurface(Surface* surface) {
   return OK;
 }
 
-status_t HpcPlayer::prepare() {
-  ALOGV("prepare(%p)", this);
+status_t HpcPlayer::setAudioSink(const std::shared_ptr<AudioSink> &sink) {
+  std::lock_guard autoLock(mLock);
+  if (mState != STATE_IDLE) {
+    return INVALID_OPERATION;
+  }
+  mPlayer->setAudioSink(sink);
+  return OK;
+}
+
+status_t HpcPlayer::setFreeRunning(bool freeRunning) {
   std::lock_guard autoLock(mLock);
-  status_t ret = prepare_l();
-  return ret;
+  if (mState != STATE_IDLE) {
+    return INVALID_OPERATION;
+  }
+  mPlayer->setFreeRunning(freeRunning);
+  return OK;
 }
 
-status_t HpcPlayer::prepare_l() {
+status_t HpcPlayer::prepare() {
+  ALOGV("prepare(%p)", this);
   std::unique_lock lck(mLock);
+  return prepare_l(lck);
+}
+
+status_t HpcPlayer::prepare_l(std::unique_lock<std::mutex> &lck) {
   switch (mState) {
     case STATE_UNPREPARED:
       mState = STATE_PREPARING;
@@ -63,15 +144,15 @@ status_t HpcPlayer::prepare_l() {
       // code.
       mIsAsyncPrepare = false;
       mPlayer->prepareAsync();
-      mCondition.wait(lck,[this](){return mState == STATE_SET_DATASOURCE_PENDING;});
+      mCondition.wait(lck,[this](){return mState != STATE_PREPARING;});
       return (mState == STATE_PREPARED) ? OK : UNKNOWN_ERROR;
     case STATE_STOPPED:
       // this is really just paused. handle as seek to start
       mAtEOS = false;
       mState = STATE_STOPPED_AND_PREPARING;
       mIsAsyncPrepare = false;
-      mPlayer->seekTo(0);
-      mCondition.wait(lck,[this](){return mState == STATE_STOPPED_AND_PREPARING;});
+      mPlayer->seekTo(0, SEEK_PREVIOUS_SYNC, true /* needNotify */);
+      mCondition.wait(lck,[this](){return mState != STATE_STOPPED_AND_PREPARING;});
       return (mState == STATE_STOPPED_AND_PREPARED) ? OK : UNKNOWN_ERROR;
     default:
       return INVALID_OPERATION;
@@ -80,16 +161,15 @@ status_t HpcPlayer::prepare_l() {
 
 status_t HpcPlayer::start() {
   ALOGV("start(%p), state is %d, eos is %d", this, mState, mAtEOS);
-  std::lock_guard autoLock(mLock);
-  status_t ret = start_l();
-  return ret;
+  std::unique_lock lck(mLock);
+  return start_l(lck);
 }
 
-status_t HpcPlayer::start_l() {
+status_t HpcPlayer::start_l(std::unique_lock<std::mutex> &lck) {
   switch (mState) {
     case STATE_UNPREPARED:
     {
-      status_t err = prepare_l();
+      status_t err = prepare_l(lck);
 
       if (err != OK) {
         return err;
@@ -99,11 +179,13 @@ status_t HpcPlayer::start_l() {
         return UNKNOWN_ERROR;
       }
     }
+    [[fallthrough]];
 
     case STATE_PAUSED:
     case STATE_STOPPED_AND_PREPARED:
     case STATE_PREPARED:
     {
+      mAtEOS = false;
       mPlayer->start();
 
       break;
@@ -164,7 +246,7 @@ status_t HpcPlayer::stop() {
   switch (mState) {
     case STATE_RUNNING:
       mPlayer->pause();
-      break;
+      [[fallthrough]];
 
     case STATE_PAUSED:
       mState = STATE_STOPPED;
@@ -188,7 +270,7 @@ status_t HpcPlayer::stop() {
 status_t HpcPlayer::seekTo(int64_t seekTimeUs,
                            SeekMode mode,
                            bool needNotify) {
-  ALOGV("seekTo(%p) (%d ms, %d) at state %d", this, seekTimeUs, mode, mState);
+  ALOGV("seekTo(%p) (%lld us, %d) at state %d", this, (long long)seekTimeUs, mode, mState);
   std::lock_guard autoLock(mLock);
 
   switch (mState) {
@@ -200,7 +282,7 @@ status_t HpcPlayer::seekTo(int64_t seekTimeUs,
       mAtEOS = false;
       // seeks can take a while, so we essentially paused
       notifyListener_l(MEDIA_PAUSED);
-      mPlayer->seekTo(seekTimeUs);
+      mPlayer->seekTo(seekTimeUs, mode, needNotify);
       break;
     }
 
@@ -250,6 +332,164 @@ status_t HpcPlayer::getDuration(int64_t *durationMs) {
   return OK;
 }
 
+status_t HpcPlayer::getThumbnail(int64_t timeUs, PreviewEngine::Thumbnail *thumbnail) {
+  {
+    std::lock_guard autoLock(mLock);
+    if (mState == STATE_IDLE || mState == STATE_SET_DATASOURCE_PENDING) {
+      return INVALID_OPERATION;
+    }
+  }
+  return mPlayer->getThumbnail(timeUs, thumbnail);
+}
+
+status_t HpcPlayer::stepForward() {
+  std::lock_guard autoLock(mLock);
+  return step_l(true /* forward */);
+}
+
+status_t HpcPlayer::stepBackward() {
+  std::lock_guard autoLock(mLock);
+  return step_l(false /* forward */);
+}
+
+status_t HpcPlayer::step_l(bool forward) {
+  switch (mState) {
+    case STATE_RUNNING:
+      mState = STATE_PAUSED;
+      notifyListener_l(MEDIA_PAUSED);
+      break;
+
+    case STATE_PREPARED:
+    case STATE_STOPPED_AND_PREPARED:
+    case STATE_PAUSED:
+      break;
+
+    default:
+      return INVALID_OPERATION;
+  }
+
+  mAtEOS = false;
+  mPlayer->stepFrame(forward);
+  return OK;
+}
+
+status_t HpcPlayer::setPlaybackDirection(PlaybackDirection direction, bool reverseAudio) {
+  std::lock_guard autoLock(mLock);
+  if (mState == STATE_IDLE || mState == STATE_SET_DATASOURCE_PENDING
+      || mState == STATE_UNPREPARED || mState == STATE_PREPARING) {
+    return INVALID_OPERATION;
+  }
+  if (direction == mDirection && direction == PLAYBACK_FORWARD) {
+    return OK;
+  }
+  mDirection = direction;
+  mAtEOS = false;
+  mPlayer->setPlaybackDirection(direction == PLAYBACK_REVERSE, reverseAudio);
+  return OK;
+}
+
+status_t HpcPlayer::setTrickPlay(float speed) {
+  if (speed != 0 && (speed < 2.0f || speed > 32.0f)) {
+    return BAD_VALUE;
+  }
+  std::lock_guard autoLock(mLock);
+  if (mState == STATE_IDLE || mState == STATE_SET_DATASOURCE_PENDING
+      || mState == STATE_UNPREPARED || mState == STATE_PREPARING) {
+    return INVALID_OPERATION;
+  }
+  if (mDirection == PLAYBACK_REVERSE) {
+    return INVALID_OPERATION;
+  }
+  mAtEOS = false;
+  mPlayer->setTrickPlay(speed);
+  return OK;
+}
+
+status_t HpcPlayer::getTrackInfo(std::vector<Extractor::TrackInfo> *tracks) {
+  {
+    std::lock_guard autoLock(mLock);
+    if (mState == STATE_IDLE || mState == STATE_SET_DATASOURCE_PENDING
+        || mState == STATE_UNPREPARED || mState == STATE_PREPARING) {
+      return INVALID_OPERATION;
+    }
+  }
+  return mPlayer->getTrackInfo(tracks);
+}
+
+ssize_t HpcPlayer::getSelectedTrack(media_track_type type) {
+  return mPlayer->getSelectedTrack(type);
+}
+
+status_t HpcPlayer::selectTrack(size_t trackIndex, bool select) {
+  {
+    std::lock_guard autoLock(mLock);
+    if (mState == STATE_IDLE || mState == STATE_SET_DATASOURCE_PENDING
+        || mState == STATE_UNPREPARED || mState == STATE_PREPARING) {
+      return INVALID_OPERATION;
+    }
+  }
+  return mPlayer->selectTrack(trackIndex, select);
+}
+
+status_t HpcPlayer::setLooping(bool loop) {
+  return setLoopRange(loop ? 0 : -1, -1);
+}
+
+status_t HpcPlayer::setLoopRange(int64_t startUs, int64_t endUs) {
+  {
+    std::lock_guard autoLock(mLock);
+    if (mState == STATE_IDLE || mState == STATE_SET_DATASOURCE_PENDING
+        || mState == STATE_UNPREPARED || mState == STATE_PREPARING) {
+      return INVALID_OPERATION;
+    }
+  }
+  status_t err = mPlayer->setLoopRange(startUs, endUs);
+  if (err == OK) {
+    std::lock_guard autoLock(mLock);
+    mLooping = startUs >= 0;
+  }
+  return err;
+}
+
+std::shared_ptr<const StartupTimeline> HpcPlayer::getStartupTimeline() const {
+  return mPlayer->getStartupTimeline();
+}
+
+status_t HpcPlayer::setBufferingSettings(const BufferingSettings &settings) {
+  if (!settings.isValid()) {
+    return BAD_VALUE;
+  }
+  return mPlayer->setBufferingSettings(settings);
+}
+
+BufferingSettings HpcPlayer::getBufferingSettings() const {
+  return mPlayer->getBufferingSettings();
+}
+
+status_t HpcPlayer::setCacheDirectory(const char *dir) {
+  if (dir == nullptr) {
+    return BAD_VALUE;
+  }
+  mPlayer->setCacheDirectory(dir);
+  return OK;
+}
+
+status_t HpcPlayer::setTargetBitrate(int64_t bps) {
+  if (bps < 0 || bps > INT32_MAX) {
+    return BAD_VALUE;
+  }
+  mPlayer->setTargetBitrate((int)bps);
+  return OK;
+}
+
+status_t HpcPlayer::getStats(PlaybackStats::Snapshot *stats) const {
+  if (stats == nullptr) {
+    return BAD_VALUE;
+  }
+  mPlayer->getStats(stats);
+  return OK;
+}
+
 bool HpcPlayer::isPlaying() {
   return mState == STATE_RUNNING && !mAtEOS;
 }
@@ -258,10 +498,44 @@ std::string HpcPlayer::stateString(HpcPlayer::State state) {
   return std::string();
 }
 
+void HpcPlayer::release() {
+  ALOGV("release(%p)", this);
+  std::unique_lock lck(mLock);
+  // A setDataSource() or prepare() in progress reports back first.
+  mCondition.wait(lck, [this]() {
+    return mState != STATE_SET_DATASOURCE_PENDING && mState != STATE_RESET_IN_PROGRESS;
+  });
+  if (mState != STATE_IDLE) {
+    const bool preparing = mState == STATE_PREPARING;
+    mState = STATE_RESET_IN_PROGRESS;
+    if (preparing) {
+      // prepare() waits for the state to leave STATE_PREPARING.
+      mCondition.notify_all();
+    }
+    mPlayer->resetAsync();
+    mCondition.wait(lck, [this]() { return mState != STATE_RESET_IN_PROGRESS; });
+  }
+  mDurationUs = -1;
+  mPositionUs = -1;
+  mAtEOS = false;
+  mLooping = false;
+  mDirection = PLAYBACK_FORWARD;
+}
+
+// static
+void HpcPlayer::TrimMemory(int level) {
+  ALOGV("TrimMemory(%d)", level);
+  if (level >= kTrimMemoryRunningCritical) {
+    DecoderPool::Instance().clear();
+  } else {
+    DecoderPool::Instance().trim();
+  }
+}
+
 void HpcPlayer::notifySetDataSourceCompleted(status_t err) {
   std::lock_guard autoLock(mLock);
 
-  if(mState == STATE_SET_DATASOURCE_PENDING) {
+  if (mState != STATE_SET_DATASOURCE_PENDING) {
     return;
   }
 
@@ -271,10 +545,97 @@ void HpcPlayer::notifySetDataSourceCompleted(status_t err) {
 }
 
 void HpcPlayer::notifyDuration(int64_t durationUs) {
+  std::lock_guard autoLock(mLock);
+  mDurationUs = durationUs;
+}
 
+void HpcPlayer::notifyPlayingTimeUs(int64_t playingUs) {
+  std::lock_guard autoLock(mLock);
+  mPlayingTimeUs += playingUs;
 }
+
 void HpcPlayer::notifyPrepareCompleted(status_t err) {
+  ALOGV("notifyPrepareCompleted %d", err);
+  std::lock_guard autoLock(mLock);
+
+  if (mState != STATE_PREPARING) {
+    // A release() while preparing, the reset takes it from here.
+    return;
+  }
+
+  mAsyncResult = err;
+  if (err == OK) {
+    mState = STATE_PREPARED;
+    if (mIsAsyncPrepare) {
+      notifyListener_l(MEDIA_PREPARED);
+    }
+  } else {
+    mState = STATE_UNPREPARED;
+    if (mIsAsyncPrepare) {
+      notifyListener_l(MEDIA_ERROR, MEDIA_ERROR_UNKNOWN, err);
+    }
+  }
+  mCondition.notify_all();
+}
+
+void HpcPlayer::notifyResetComplete() {
+  ALOGV("notifyResetComplete(%p)", this);
+  std::lock_guard autoLock(mLock);
+  if (mState != STATE_RESET_IN_PROGRESS) {
+    ALOGW("reset completed in state %d", mState);
+  }
+  mState = STATE_IDLE;
+  mCondition.notify_all();
+}
+
+void HpcPlayer::notifySeekComplete() {
+  std::lock_guard autoLock(mLock);
+  notifySeekComplete_l();
+}
+
+void HpcPlayer::notifySeekComplete_l() {
+  bool wasSeeking = true;
+  if (mState == STATE_STOPPED_AND_PREPARING) {
+    wasSeeking = false;
+    mState = STATE_STOPPED_AND_PREPARED;
+    mCondition.notify_all();
+    if (!mIsAsyncPrepare) {
+      // if we are preparing synchronously, no need to notify listener
+      return;
+    }
+  } else if (mState == STATE_STOPPED) {
+    // no need to notify listener
+    return;
+  }
+  notifyListener_l(wasSeeking ? MEDIA_SEEK_COMPLETE : MEDIA_PREPARED);
+}
 
+void HpcPlayer::notifyListener(int msg, int ext1, int ext2) {
+  std::lock_guard autoLock(mLock);
+  notifyListener_l(msg, ext1, ext2);
+}
+
+void HpcPlayer::notifyListener_l(int msg, int ext1, int ext2) {
+  ALOGV("notifyListener_l(%p), (%d, %d, %d)", this, msg, ext1, ext2);
+  switch (msg) {
+    case MEDIA_PLAYBACK_COMPLETE:
+    case MEDIA_ERROR:
+      if (mState != STATE_RESET_IN_PROGRESS) {
+        mAtEOS = true;
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  Listener listener = mListener;
+  if (listener) {
+    // The listener may call back into the player.
+    mLock.unlock();
+    listener(msg, ext1, ext2);
+    mLock.lock();
+  }
 }
 
-} // hpc
\ No newline at end of file
+} // hpc
@@ -9,17 +9,49 @@
 #include "Handler.h"
 #include "Error.h"
 #include "foundation/BaseType.h"
+#include "foundation/StartupTimeline.h"
+#include "foundation/PlaybackStats.h"
+#include "foundation/BufferingSettings.h"
+#include "preview/PreviewEngine.h"
+#include "extractor/Extractor.h"
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 namespace hpc {
-class ANativeWindow;
+class AudioSink;
 class HpcPlayerInternal;
-class MediaClock;
+struct MediaClock;
 class Surface;
 
-class HpcPlayer{
+class HpcPlayer : public std::enable_shared_from_this<HpcPlayer> {
  public:
+  // Gets the media_event_type, e.g. MEDIA_INFO, and its extras; called on
+  // the player looper without the player lock held.
+  typedef std::function<void(int msg, int ext1, int ext2)> Listener;
+
+  // The player runs on a looper of its own and reports back through a weak
+  // reference, so it is only ever held by shared_ptr. On Android audio goes
+  // to OpenSL ES unless setAudioSink() says otherwise.
+  static std::shared_ptr<HpcPlayer> Create();
+  ~HpcPlayer();
+
+  void setListener(const Listener &listener);
   status_t setDataSource(const char* url);
-  status_t setSurface(Surface* surface);
+  // Independently encoded files, e.g. ad pods or chapters, played back to
+  // back as one timeline, see ConcatExtractor.
+  status_t setDataSource(const std::vector<std::string> &urls);
+  status_t setSurface(const std::shared_ptr<Surface> &surface);
+  // Before setDataSource(), e.g. a sink that does not play for benchmarks;
+  // nullptr plays video only.
+  status_t setAudioSink(const std::shared_ptr<AudioSink> &sink);
+  // Before setDataSource(): present frames and write audio as soon as they
+  // are decoded instead of in real time, for benchmarks of throughput.
+  status_t setFreeRunning(bool freeRunning);
   status_t prepare();
   status_t start();
   status_t pause();
@@ -29,24 +61,72 @@ class HpcPlayer{
       SeekMode mode = SEEK_PREVIOUS_SYNC,
       bool needNotify = false);
   status_t getCurrentPosition(int64_t *postion);
+  // Seamless looping of the whole stream, or of [startUs, endUs) (A-B
+  // repeat). The loop start is demuxed and decoded ahead of the end and
+  // spliced in without a flush, the position wraps while MediaClock keeps
+  // running. Needs a prepared player.
+  status_t setLooping(bool loop);
+  status_t setLoopRange(int64_t startUs, int64_t endUs);
   status_t getDuration(int64_t *duration);
+  // Non-blocking seekbar preview. Returns the nearest cached thumbnail and
+  // posts MEDIA_INFO_PREVIEW_AVAILABLE once a closer one has been decoded.
+  // The first call starts the preview engine and returns WOULD_BLOCK.
+  status_t getThumbnail(int64_t timeUs, PreviewEngine::Thumbnail *thumbnail);
+  // Frame accurate stepping, pauses playback if needed. The new position is
+  // reported with MEDIA_INFO_FRAME_STEPPED.
+  status_t stepForward();
+  status_t stepBackward();
+  // Reverse playback, e.g. for editing previews. Video is decoded a GOP at a
+  // time into a bounded stack and shown backwards, see ReverseDecoder. Audio
+  // is muted unless |reverseAudio|, then it plays reversed chunk by chunk.
+  // start(), pause() and seekTo() keep working; switching back to forward
+  // resumes the regular pipeline at the reverse position.
+  status_t setPlaybackDirection(PlaybackDirection direction, bool reverseAudio = false);
+  // Keyframe-only fast forward at |speed|, 2x to 32x: only sync samples are
+  // demuxed and decoded, MediaClock paces them at |speed| and audio is
+  // muted. 0 goes back to normal playback at the current position.
+  status_t setTrickPlay(float speed);
+  // Tracks of the prepared source; the index is what selectTrack() takes.
+  status_t getTrackInfo(std::vector<Extractor::TrackInfo> *tracks);
+  ssize_t getSelectedTrack(media_track_type type);
+  // Switches the audio track without interrupting video, e.g. for another
+  // language. MEDIA_INFO_TRACK_SWITCHED reports when the new track plays.
+  status_t selectTrack(size_t trackIndex, bool select = true);
+  // open/probe/first packet/first decoded/first rendered of the last prepare.
+  std::shared_ptr<const StartupTimeline> getStartupTimeline() const;
+  // Read-ahead watermarks of the source, see BufferingSettings. Applies at
+  // the next prepare and right away to a prepared source.
+  status_t setBufferingSettings(const BufferingSettings &settings);
+  BufferingSettings getBufferingSettings() const;
+  // Directory of the persistent HTTP cache, e.g. the app's cache dir: later
+  // plays and seeks of a url read what was fetched before from there.
+  // Applies from the next setDataSource(), an empty one turns it off.
+  status_t setCacheDirectory(const char *dir);
+  // Highest bitrate an HLS stream may pick, in bits per second; 0, the
+  // default, follows the measured bandwidth alone.
+  status_t setTargetBitrate(int64_t bps);
+  // Playback counters, see HpcPlayerInternal::getStats().
+  status_t getStats(PlaybackStats::Snapshot *stats) const;
   bool isPlaying();
   void release();
 
+  // From ComponentCallbacks2.onTrimMemory(), with its |level|: releases the
+  // decoders idle in DecoderPool past their timeout, or all of them once
+  // memory runs critical or the app goes to the background.
+  static void TrimMemory(int level);
+
   void notifySetDataSourceCompleted(status_t err);
   void notifyPrepareCompleted(status_t err);
   void notifyResetComplete();
-  void notifySetSurfaceComplete();
   void notifyDuration(int64_t durationUs);
   void notifyPlayingTimeUs(int64_t timeUs);
   void notifySeekComplete();
   void notifySeekComplete_l();
   void notifyListener(int msg, int ext1 = 0, int ext2 = 0);
 
- protected:
-  virtual ~HpcPlayer();
-
  private:
+  HpcPlayer();
+
   enum State {
     STATE_IDLE,
     STATE_SET_DATASOURCE_PENDING,
@@ -64,6 +144,7 @@ class HpcPlayer{
 
   mutable std::mutex mLock;
   std::condition_variable mCondition;
+  Listener mListener;
 
   State mState;
 
@@ -80,11 +161,13 @@ class HpcPlayer{
   uint32_t mPlayerFlags;
   
   bool mAtEOS;
-  bool mLooping;
+  bool mLooping {false};
+  PlaybackDirection mDirection {PLAYBACK_FORWARD};
   bool mAutoLoop;
 
-  status_t prepare_l();
-  status_t start_l();
+  status_t prepare_l(std::unique_lock<std::mutex> &lock);
+  status_t start_l(std::unique_lock<std::mutex> &lock);
+  status_t step_l(bool forward);
   void notifyListener_l(int msg, int ext1 = 0, int ext2 = 0);
 };
 
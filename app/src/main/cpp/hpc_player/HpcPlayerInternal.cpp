@@ -2,15 +2,24 @@
 #include "foundation/Message.h"
 #include "foundation/Log.h"
 #include "foundation/MetaData.h"
+#include "foundation/MediaClock.h"
+#include "foundation/Looper.h"
 #include "foundation/Surface.h"
 #include "source/Source.h"
+#include "source/DashSource.h"
 #include "source/DefaultSource.h"
-#include "DecoderBase.h"
+#include "source/HlsSource.h"
+#include "decoder/DecoderBase.h"
+#include "decoder/DecoderPool.h"
+#include "decoder/FFmpegVideoDecoder.h"
+#include "render/AudioSink.h"
+#include "render/Renderer.h"
 #include "HpcPlayer.h"
-#include <android/native_window.h>
-#include "HpcPlayer.h"
-#include <android/native_window.h>
-#include <android/native_window_jni.h>
+
+extern "C" {
+#include "libavutil/frame.h"
+}
+
 #define LOG_TAG "HpcPlayerInternal"
 
 namespace hpc {
@@ -88,6 +97,23 @@ struct HpcPlayerInternal::FlushDecoderAction : public Action {
   DISALLOW_EVIL_CONSTRUCTORS(FlushDecoderAction);
 };
 
+struct HpcPlayerInternal::SelectTrackAction : public Action {
+  SelectTrackAction(size_t trackIndex, int64_t timeUs)
+      : mTrackIndex(trackIndex),
+        mTimeUs(timeUs) {
+  }
+
+  void execute(HpcPlayerInternal *player) override {
+    player->performSelectTrack(mTrackIndex, mTimeUs);
+  }
+
+ private:
+  size_t mTrackIndex;
+  int64_t mTimeUs;
+
+  DISALLOW_EVIL_CONSTRUCTORS(SelectTrackAction);
+};
+
 struct HpcPlayerInternal::PostMessageAction : public Action {
   explicit PostMessageAction(const std::shared_ptr<Message> &msg)
       : mMessage(msg) {
@@ -122,33 +148,140 @@ struct HpcPlayerInternal::SimpleAction : public Action {
   DISALLOW_EVIL_CONSTRUCTORS(SimpleAction);
 };
 
-HpcPlayerInternal::HpcPlayerInternal(const std::shared_ptr<MediaClock> &mediaClock) {
+// Runs the stepping and reverse playback decodes on mFrameLooper.
+struct HpcPlayerInternal::FrameHandler : public Handler {
+  explicit FrameHandler(const std::weak_ptr<Handler> &player)
+      : mPlayer(player) {
+  }
+
+ protected:
+  void onMessageReceived(const std::shared_ptr<Message> &msg) override {
+    std::shared_ptr<Handler> player = mPlayer.lock();
+    if (player != nullptr) {
+      std::static_pointer_cast<HpcPlayerInternal>(player)->onFrameMessage(msg);
+    }
+  }
+
+ private:
+  std::weak_ptr<Handler> mPlayer;
+
+  DISALLOW_EVIL_CONSTRUCTORS(FrameHandler);
+};
+
+// The renderer takes reverse audio as a MediaBuffer sharing the samples.
+static std::shared_ptr<MediaBuffer> ReverseAudioBuffer(ReverseDecoder::AudioChunk *chunk) {
+  std::shared_ptr<std::vector<int16_t>> samples =
+      std::make_shared<std::vector<int16_t>>(std::move(chunk->samples));
+  std::shared_ptr<MediaBuffer> buffer = std::make_shared<MediaBuffer>();
+  buffer->data = std::shared_ptr<uint8_t>(samples, reinterpret_cast<uint8_t *>(samples->data()));
+  buffer->size = samples->size() * sizeof(int16_t);
+  buffer->ptsUs = chunk->endUs;
+  buffer->sampleRate = chunk->sampleRate;
+  buffer->channelCount = chunk->channels;
+  return buffer;
+}
+
+HpcPlayerInternal::HpcPlayerInternal(const std::shared_ptr<MediaClock> &mediaClock)
+    : mMediaClock(mediaClock),
+      mStartupTimeline(std::make_shared<StartupTimeline>()),
+      mPlaybackStats(std::make_shared<PlaybackStats>()),
+      mTrackSwitchStartUs(-1),
+      mTrackSwitchIndex(0) {
 
 }
 
 HpcPlayerInternal::~HpcPlayerInternal() {
-
+  if (mRendererLooper != nullptr) {
+    mRendererLooper->stop();
+  }
+  if (mFrameLooper != nullptr) {
+    mFrameLooper->stop();
+  }
 }
 
 void HpcPlayerInternal::setDataSourceAsync(const char *url) {
-  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatSetDataSource, shared_from_this());
   std::shared_ptr<Message> notify = std::make_shared<Message>(kWhatSourceNotify, shared_from_this());
 
-  auto* source = new DefaultSource(notify, mUIDValid, mUID, mMediaClock);
-  status_t err = source->setDataSource(url);
+  std::shared_ptr<Source> source;
+  status_t err;
+  if (HlsSource::IsHlsUrl(url)) {
+    std::shared_ptr<HlsSource> hlsSource = std::make_shared<HlsSource>(notify);
+    err = hlsSource->setDataSource(url);
+    source = hlsSource;
+  } else if (DashSource::IsDashUrl(url)) {
+    std::shared_ptr<DashSource> dashSource = std::make_shared<DashSource>(notify);
+    err = dashSource->setDataSource(url);
+    source = dashSource;
+  } else {
+    std::shared_ptr<DefaultSource> genericSource =
+        std::make_shared<DefaultSource>(notify, mUIDValid, mUID, mMediaClock);
+    {
+      std::lock_guard<std::mutex> autoLock(mSourceLock);
+      genericSource->setCacheDirectory(mCacheDirectory);
+    }
+    err = genericSource->setDataSource(url);
+    source = genericSource;
+  }
+  {
+    std::lock_guard<std::mutex> autoLock(mPreviewLock);
+    mDataSourceUrl = url;
+  }
+  onSourceCreated(source, err);
+}
+
+// Segments are always demuxed by DefaultSource. Previews, stepping and
+// reverse playback open the first one.
+void HpcPlayerInternal::setDataSourceAsync(const std::vector<std::string> &urls) {
+  std::shared_ptr<Message> notify = std::make_shared<Message>(kWhatSourceNotify, shared_from_this());
+  std::shared_ptr<DefaultSource> source =
+      std::make_shared<DefaultSource>(notify, mUIDValid, mUID, mMediaClock);
+  {
+    std::lock_guard<std::mutex> autoLock(mSourceLock);
+    source->setCacheDirectory(mCacheDirectory);
+  }
+  status_t err = source->setDataSource(urls);
+  {
+    std::lock_guard<std::mutex> autoLock(mPreviewLock);
+    mDataSourceUrl = urls.empty() ? std::string() : urls.front();
+  }
+  onSourceCreated(source, err);
+}
 
+void HpcPlayerInternal::onSourceCreated(std::shared_ptr<Source> source, status_t err) {
   if (err != OK) {
     ALOGE("Failed to set data source!");
-    source = nullptr;
+    source.reset();
   }
 
-  msg->setObject("source", source);
+  // A message cannot carry the source, it is in place before the looper
+  // reports back.
+  {
+    std::lock_guard<std::mutex> autoLock(mSourceLock);
+    mSource = source;
+  }
+  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatSetDataSource, shared_from_this());
+  msg->mArg1 = err;
   msg->post();
 }
 
+void HpcPlayerInternal::setVideoSurface(const std::shared_ptr<Surface> &surface) {
+  {
+    std::lock_guard<std::mutex> autoLock(mPendingLock);
+    mPendingSurface = surface;
+  }
+  std::make_shared<Message>(kWhatSetVideoSurface, shared_from_this())->post();
+}
 
-status_t HpcPlayerInternal::setVideoSurface(Surface *surface) {
-  return 0;
+void HpcPlayerInternal::setAudioSink(const std::shared_ptr<AudioSink> &sink) {
+  {
+    std::lock_guard<std::mutex> autoLock(mPendingLock);
+    mPendingAudioSink = sink;
+  }
+  std::make_shared<Message>(kWhatSetAudioSink, shared_from_this())->post();
+}
+
+void HpcPlayerInternal::setFreeRunning(bool freeRunning) {
+  mFreeRunning = freeRunning;
 }
 
 void HpcPlayerInternal::flushDecoder(bool audio, bool needShutdown) {
@@ -177,17 +310,64 @@ void HpcPlayerInternal::flushDecoder(bool audio, bool needShutdown) {
   FlushStatus newStatus =
       needShutdown ? FLUSHING_DECODER_SHUTDOWN : FLUSHING_DECODER;
 
-  mFlushComplete[audio][false /* isDecoder */] = (mRenderer == NULL);
+  // The decoder flushes its queue in the renderer, both report back.
+  mFlushComplete[audio][false /* isDecoder */] = (mRenderer == nullptr);
   mFlushComplete[audio][true /* isDecoder */] = false;
-  if (audio) {
-    ALOGE_IF(mFlushingAudio != NONE,
-             "audio flushDecoder() is called in state %d", mFlushingAudio);
-    mFlushingAudio = newStatus;
-  } else {
-    ALOGE_IF(mFlushingVideo != NONE,
-             "video flushDecoder() is called in state %d", mFlushingVideo);
-    mFlushingVideo = newStatus;
+  FlushStatus *state = audio ? &mFlushingAudio : &mFlushingVideo;
+  if (*state != NONE) {
+    ALOGE("%s flushDecoder() is called in state %d", audio ? "audio" : "video", *state);
+  }
+  *state = newStatus;
+}
+
+void HpcPlayerInternal::handleFlushComplete(bool audio, bool isDecoder) {
+  // We wait for both the decoder flush and the renderer flush to complete
+  // before entering either the FLUSHED or the SHUTTING_DOWN_DECODER state.
+  mFlushComplete[audio][isDecoder] = true;
+  if (!mFlushComplete[audio][!isDecoder]) {
+    return;
+  }
+
+  FlushStatus *state = audio ? &mFlushingAudio : &mFlushingVideo;
+  switch (*state) {
+    case FLUSHING_DECODER:
+      *state = FLUSHED;
+      break;
+
+    case FLUSHING_DECODER_SHUTDOWN:
+      *state = SHUTTING_DOWN_DECODER;
+      ALOGV("initiating %s decoder shutdown", audio ? "audio" : "video");
+      getDecoder(audio)->initiateShutdown();
+      break;
+
+    default:
+      // decoder flush completes only occur in a flushing state.
+      if (isDecoder) {
+        ALOGE("decoder flush in invalid state %d", *state);
+      }
+      break;
+  }
+}
+
+void HpcPlayerInternal::finishFlushIfPossible() {
+  if (mFlushingAudio != NONE && mFlushingAudio != FLUSHED
+      && mFlushingAudio != SHUT_DOWN) {
+    return;
+  }
+
+  if (mFlushingVideo != NONE && mFlushingVideo != FLUSHED
+      && mFlushingVideo != SHUT_DOWN) {
+    return;
   }
+
+  ALOGV("both audio and video are flushed now.");
+
+  mFlushingAudio = NONE;
+  mFlushingVideo = NONE;
+  mFlushComplete[0][0] = mFlushComplete[0][1] = false;
+  mFlushComplete[1][0] = mFlushComplete[1][1] = false;
+
+  processDeferredActions();
 }
 
 void HpcPlayerInternal::processDeferredActions() {
@@ -253,12 +433,25 @@ void HpcPlayerInternal::performDecoderFlush(FlushCommand audio, FlushCommand vid
 void HpcPlayerInternal::performReset() {
   ALOGV("performReset");
 
-  if(mVideoDecoder == nullptr || mAudioDecoder == nullptr) {
+  if (mVideoDecoder != nullptr) {
+    // Flushed, not shut down: detach it from this player before the next
+    // one takes it out of the pool.
+    std::lock_guard<std::mutex> autoLock(mDecoderLock);
+    mVideoDecoder->configure(nullptr, nullptr, nullptr, false /* audio */);
+    MetaData format = mVideoDecoder->getFormat();
+    mVideoDecoderKey = DecoderPool::MakeKey(format.mime, format.width, format.height,
+                                            format.pixelFormat);
+    DecoderPool::Instance().recycle(mVideoDecoderKey, mVideoDecoder);
+    mVideoDecoder.reset();
+    ++mVideoDecoderGeneration;
+  }
+
+  if (mVideoDecoder != nullptr || mAudioDecoder != nullptr) {
+    ALOGE("performReset with decoders still present");
     return;
   }
 
   updatePlaybackTimer(true /* stopping */, "performReset");
-  updateRebufferingTimer(true /* stopping */, true /* exiting */);
 
   cancelPollDuration();
 
@@ -270,39 +463,142 @@ void HpcPlayerInternal::performReset() {
       mRendererLooper->unregisterHandler(mRenderer->id());
     }
     mRendererLooper->stop();
-    mRendererLooper.clear();
+    mRendererLooper.reset();
   }
-  mRenderer.clear();
+  mRenderer.reset();
   ++mRendererGeneration;
 
   if (mSource != nullptr) {
     mSource->stop();
 
     std::lock_guard<std::mutex> autoLock(mSourceLock);
-    mSource.clear();
+    mSource.reset();
   }
 
-  if (!mPlayer.expired()) {
-    std::shared_ptr<HpcPlayer> driver = mPlayer.lock();
-    if (driver != nullptr) {
-      driver->notifyResetComplete();
+  // Previews, stepping and reverse playback opened the old url a second
+  // time. Stopping the frame looper first leaves nobody else using them.
+  if (mFrameLooper != nullptr) {
+    mFrameLooper->unregisterHandler(mFrameHandler->id());
+    mFrameLooper->stop();
+    mFrameLooper.reset();
+    mFrameHandler.reset();
+  }
+  if (mFrameStepper != nullptr) {
+    mFrameStepper->release();
+    mFrameStepper.reset();
+  }
+  if (mReverseDecoder != nullptr) {
+    mReverseDecoder->release();
+    mReverseDecoder.reset();
+  }
+  mReverseDecoderAudio = false;
+  mReverseAudioEndUs = -1;
+  stopReverse();
+  {
+    std::lock_guard<std::mutex> autoLock(mReverseLock);
+    mReverseResult = OK;
+    mReverseFillPending = false;
+  }
+  mReverseWaitingGeneration = -1;
+  mReverseShownUs = -1;
+  cancelSteps();
+  {
+    std::lock_guard<std::mutex> autoLock(mStepLock);
+    mSteppedFrames.clear();
+  }
+  mSteppedFrame = FrameStepper::Frame();
+  {
+    std::lock_guard<std::mutex> autoLock(mPreviewLock);
+    if (mPreviewEngine != nullptr) {
+      mPreviewEngine->release();
+      mPreviewEngine.reset();
     }
+    mDataSourceUrl.clear();
   }
 
   mStarted = false;
   mPrepared = false;
   mResetting = false;
   mSourceStarted = false;
+  mPaused = false;
+  mPausedByClient = true;
+  mAudioEOS = false;
+  mVideoEOS = false;
+
+  std::shared_ptr<HpcPlayer> driver = mPlayer.lock();
+  if (driver != nullptr) {
+    driver->notifyResetComplete();
+  }
+}
+
+status_t HpcPlayerInternal::instantiateDecoder(bool audio, std::shared_ptr<Decoder> *decoder) {
+  if (*decoder != nullptr) {
+    return OK;
+  }
+
+  std::shared_ptr<MetaData> meta = mSource->getFormatMeta(audio);
+  if (meta == nullptr) {
+    return -EWOULDBLOCK;
+  }
+
+  std::shared_ptr<Message> notify = std::make_shared<Message>(
+      audio ? kWhatAudioNotify : kWhatVideoNotify, shared_from_this());
+
+  if (audio) {
+    std::shared_ptr<FFmpegAudioDecoder> audioDecoder = std::make_shared<FFmpegAudioDecoder>();
+    audioDecoder->setPlaybackStats(mPlaybackStats);
+    status_t err = audioDecoder->init(*meta);
+    if (err != OK) {
+      return err;
+    }
+    // From here the decoder pulls access units from the source on its own
+    // looper and queues what they decode to the renderer.
+    audioDecoder->configure(notify, mSource, mRenderer, true /* audio */);
+    *decoder = audioDecoder;
+    return OK;
+  }
+
+  // A decoder left behind by a previous player skips avcodec_open2().
+  int64_t startUs = Looper::GetNowUs();
+  mVideoDecoderKey = DecoderPool::MakeKey(meta->mime, meta->width, meta->height, meta->pixelFormat);
+  std::shared_ptr<FFmpegVideoDecoder> videoDecoder =
+      std::dynamic_pointer_cast<FFmpegVideoDecoder>(DecoderPool::Instance().acquire(mVideoDecoderKey));
+  const bool pooled = videoDecoder != nullptr;
+  if (!pooled) {
+    videoDecoder = std::make_shared<FFmpegVideoDecoder>();
+  }
+  videoDecoder->setStartupTimeline(mStartupTimeline);
+  videoDecoder->setPlaybackStats(mPlaybackStats);
+  videoDecoder->setKeyFramesOnly(mTrickPlaySpeed > 0);
+  status_t err = videoDecoder->init(*meta);
+  if (err != OK) {
+    return err;
+  }
+  ALOGD("video decoder %s ready in %lld us (%s)", meta->mime.c_str(),
+        (long long)(Looper::GetNowUs() - startUs), pooled ? "pooled" : "new");
+
+  videoDecoder->configure(notify, mSource, mRenderer, false /* audio */);
+  *decoder = videoDecoder;
+  return OK;
+}
 
-  // Modular DRM
-  if (mCrypto != nullptr) {
-    // decoders will be flushed before this so their mCrypto would go away on their own
-    // TODO change to ALOGV
-    ALOGD("performReset mCrypto: %p (%d)", mCrypto.get(),
-          (mCrypto != nullptr ? mCrypto->getStrongCount() : 0));
-    mCrypto.clear();
+void HpcPlayerInternal::instantiateRenderer() {
+  if (mRenderer != nullptr) {
+    return;
+  }
+  std::shared_ptr<Message> notify =
+      std::make_shared<Message>(kWhatRendererNotify, shared_from_this());
+  mRenderer = std::make_shared<Renderer>(mAudioSink, mMediaClock, notify, mFreeRunning);
+  mRenderer->setSurface(mSurface);
+  mRenderer->setPlaybackStats(mPlaybackStats);
+  if (mTrickPlaySpeed > 0) {
+    mRenderer->setPlaybackRate(mTrickPlaySpeed);
   }
-  mIsDrmProtected = false;
+
+  mRendererLooper = std::make_shared<Looper>();
+  mRendererLooper->setName("HpcPlayerRenderer");
+  mRendererLooper->start(Looper::PRIORITY_AUDIO);
+  mRendererLooper->registerHandler(mRenderer);
 }
 
 void HpcPlayerInternal::performScanSources() {
@@ -321,17 +617,8 @@ void HpcPlayerInternal::performSetSurface(const std::shared_ptr<Surface> &surfac
   ALOGV("performSetSurface");
 
   mSurface = surface;
-
-
-  native_window_set_scaling_mode();
-  // XXX - ignore error from setVideoScalingMode for now
-  setVideoScalingMode(mVideoScalingMode);
-
-  if (mDriver != nullptr) {
-    std::shared_ptr<HpcPlayerDriver> driver = mDriver.promote();
-    if (driver != nullptr) {
-      driver->notifySetSurfaceComplete();
-    }
+  if (mRenderer != nullptr) {
+    mRenderer->setSurface(surface);
   }
 }
 
@@ -367,11 +654,16 @@ void HpcPlayerInternal::finishResume() {
 }
 
 void HpcPlayerInternal::notifyDriverSeekComplete() {
-  if (mDriver != nullptr) {
-    std::shared_ptr<HpcPlayerDriver> driver = mDriver.promote();
-    if (driver != nullptr) {
-      driver->notifySeekComplete();
-    }
+  std::shared_ptr<HpcPlayer> driver = mPlayer.lock();
+  if (driver != nullptr) {
+    driver->notifySeekComplete();
+  }
+}
+
+void HpcPlayerInternal::notifyListener(int msg, int ext1, int ext2) {
+  std::shared_ptr<HpcPlayer> driver = mPlayer.lock();
+  if (driver != nullptr) {
+    driver->notifyListener(msg, ext1, ext2);
   }
 }
 
@@ -381,22 +673,11 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
     {
       ALOGV("kWhatSetDataSource");
 
-      if (mSource == nullptr) {
-        ALOGE("source is null");
-        break;
-      }
-
-      status_t err = OK;
-      void *obj;
-      if(!msg->findObject("source",&obj)) {
-        err = UNKNOWN_ERROR;
-      } else {
-        std::lock_guard autoLock(mSourceLock);
-        mSource.reset(static_cast<hpc::Source *>(obj));
-      }
-
-      if(!mPlayer.expired()){
-        mPlayer.lock()->notifySetDataSourceCompleted(err);
+      // setDataSourceAsync() has put the source in place already.
+      status_t err = (status_t)msg->mArg1;
+      std::shared_ptr<HpcPlayer> driver = mPlayer.lock();
+      if (driver != nullptr) {
+        driver->notifySetDataSourceCompleted(err);
       }
       break;
     }
@@ -405,6 +686,22 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
     {
       ALOGV("onMessageReceived kWhatPrepare");
 
+      if (mSource == nullptr) {
+        std::shared_ptr<HpcPlayer> driver = mPlayer.lock();
+        if (driver != nullptr) {
+          driver->notifyPrepareCompleted(NO_INIT);
+        }
+        break;
+      }
+      mStartupTimeline->start();
+      mSource->setStartupTimeline(mStartupTimeline);
+      mPlaybackStats->reset();
+      mSource->setPlaybackStats(mPlaybackStats);
+      {
+        std::lock_guard autoLock(mSourceLock);
+        mSource->setBufferingSettings(mBufferingSettings);
+        mSource->setTargetBitrate(mTargetBitrate);
+      }
       mSource->prepareAsync();
       break;
     }
@@ -431,23 +728,19 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
 
     case kWhatSetVideoSurface:
     {
-
-      void* obj;
-      if(!msg->findObject("surface", &obj)) {
-        break;
+      std::shared_ptr<Surface> surface;
+      {
+        std::lock_guard<std::mutex> autoLock(mPendingLock);
+        surface = mPendingSurface;
       }
 
-      std::shared_ptr<Surface> surface((Surface*)obj);
-
       ALOGD("onSetVideoSurface(%p, %s video decoder)",
-            surface.get(),
-            (mSource != nullptr && mStarted && mSource->getFormat(false /* audio */) != nullptr
-                && mVideoDecoder != nullptr) ? "have" : "no");
+            surface.get(), mVideoDecoder != nullptr ? "have" : "no");
 
-      // Need to check mStarted before calling mSource->getFormat because HpcPlayerInternal might
-      // be in preparing state and it could take long time.
+      // Need to check mStarted before calling mSource->getFormatMeta because HpcPlayerInternal
+      // might be in preparing state and it could take long time.
       // When mStarted is true, mSource must have been set.
-      if (mSource == nullptr || !mStarted || mSource->getFormat(false /* audio */) == nullptr
+      if (mSource == nullptr || !mStarted || mSource->getFormatMeta(false /* audio */) == nullptr
           // NOTE: mVideoDecoder's mSurface is always non-null
           || (mVideoDecoder != nullptr && mVideoDecoder->setVideoSurface(surface) == OK)) {
         performSetSurface(surface);
@@ -456,12 +749,12 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
 
       mDeferredActions.push_back(
           std::make_shared<FlushDecoderAction>(
-              (obj != nullptr ? FLUSH_CMD_FLUSH : FLUSH_CMD_NONE) /* audio */,
+              (surface != nullptr ? FLUSH_CMD_FLUSH : FLUSH_CMD_NONE) /* audio */,
               FLUSH_CMD_SHUTDOWN /* video */));
 
       mDeferredActions.push_back(std::make_shared<SetSurfaceAction>(surface));
 
-      if (obj != nullptr) {
+      if (surface != nullptr) {
         if (mStarted) {
           // Issue a seek to refresh the video screen only if started otherwise
           // the extractor may not yet be started and will assert.
@@ -491,9 +784,34 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
       break;
     }
 
+    case kWhatSetAudioSink:
+    {
+      ALOGV("kWhatSetAudioSink");
+      // The renderer keeps the sink it was created with, i.e. a new one
+      // applies from the next data source on.
+      std::lock_guard<std::mutex> autoLock(mPendingLock);
+      mAudioSink = mPendingAudioSink;
+      break;
+    }
+
     case kWhatStart:
     {
       ALOGV("kWhatStart");
+      if (mReversing) {
+        if (mSteppedFrame.timeUs >= 0 && mSteppedFrame.timeUs != mReverseShownUs) {
+          // stepped away while paused, go on from the frame on screen.
+          restartReverseDecode(mSteppedFrame.timeUs);
+        }
+        mPausedByClient = false;
+        cancelSteps();
+        ++mReverseGeneration;
+        mReverseAnchorRealUs = -1;
+        if (mRenderer != nullptr) {
+          mRenderer->setReverseAudio(true, true /* playing */);
+        }
+        postReverseTick(0);
+        break;
+      }
       if (mStarted) {
         // do not resume yet if the source is still buffering
         if (!mPausedForBuffering) {
@@ -503,141 +821,30 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
         onStart();
       }
       mPausedByClient = false;
-      break;
-    }
-
-    case kWhatConfigPlayback:
-    {
-      std::shared_ptr<AReplyToken> replyID;
-      if(msg->senderAwaitsResponse(&replyID)) {
-        ALOGE("kWhatConfigPlayback: senderAwaitsResponse is false");
-        break;
-      }
-      float rate /* sanitized */;
-       (msg, &rate);
-      status_t err = OK;
-      if (mRenderer != nullptr) {
-        err = mRenderer->setPlaybackSettings(rate);
-      }
-      if (err == OK) {
-        if (rate.mSpeed == 0.f) {
-          onPause();
-          mPausedByClient = true;
-          // save all other settings (using non-paused speed)
-          // so we can restore them on start
-          AudioPlaybackRate newRate = rate;
-          newRate.mSpeed = mPlaybackRate.mSpeed;
-          mPlaybackRate = newRate;
-        } else { /* rate.mSpeed != 0.f */
-          mPlaybackRate = rate;
-          if (mStarted) {
-            // do not resume yet if the source is still buffering
-            if (!mPausedForBuffering) {
-              onResume();
-            }
-          } else if (mPrepared) {
-            onStart();
-          }
-
-          mPausedByClient = false;
-        }
-      }
-
-      if (mVideoDecoder != nullptr) {
-        std::shared_ptr<Message> params = new Message();
-        params->setFloat("playback-speed", mPlaybackRate.mSpeed);
-        mVideoDecoder->setParameters(params);
-      }
-
-      std::shared_ptr<Message> response = new Message;
-      response->setInt32("err", err);
-      response->postReply(replyID);
-      break;
-    }
-
-    case kWhatGetPlaybackSettings:
-    {
-      std::shared_ptr<AReplyToken> replyID;
-      CHECK(msg->senderAwaitsResponse(&replyID));
-      float rate = mPlaybackRate;
-      status_t err = OK;
-      if (mRenderer != nullptr) {
-        err = mRenderer->getPlaybackSettings(&rate);
-      }
-      if (err == OK) {
-        // get playback settings used by renderer, as it may be
-        // slightly off due to audiosink not taking small changes.
-        mPlaybackRate = rate;
-        if (mPaused) {
-          rate.mSpeed = 0.f;
-        }
-      }
-      std::shared_ptr<Message> response = new Message;
-      if (err == OK) {
-        writeToMessage(response, rate);
-      }
-      response->setInt32("err", err);
-      response->postReply(replyID);
-      break;
-    }
-
-    case kWhatConfigSync:
-    {
-      std::shared_ptr<AReplyToken> replyID;
-      CHECK(msg->senderAwaitsResponse(&replyID));
-
-      ALOGV("kWhatConfigSync");
-      AVSyncSettings sync;
-      float videoFpsHint;
-      readFromMessage(msg, &sync, &videoFpsHint);
-      status_t err = OK;
-      if (mRenderer != nullptr) {
-        err = mRenderer->setSyncSettings(sync, videoFpsHint);
-      }
-      if (err == OK) {
-        mSyncSettings = sync;
-        mVideoFpsHint = videoFpsHint;
-      }
-      std::shared_ptr<Message> response = new Message;
-      response->setInt32("err", err);
-      response->postReply(replyID);
-      break;
-    }
-
-    case kWhatGetSyncSettings:
-    {
-      std::shared_ptr<AReplyToken> replyID;
-      CHECK(msg->senderAwaitsResponse(&replyID));
-      AVSyncSettings sync = mSyncSettings;
-      float videoFps = mVideoFpsHint;
-      status_t err = OK;
-      if (mRenderer != nullptr) {
-        err = mRenderer->getSyncSettings(&sync, &videoFps);
-        if (err == OK) {
-          mSyncSettings = sync;
-          mVideoFpsHint = videoFps;
-        }
-      }
-      std::shared_ptr<Message> response = new Message;
-      if (err == OK) {
-        writeToMessage(response, sync, videoFps);
-      }
-      response->setInt32("err", err);
-      response->postReply(replyID);
+      // playback moves the position away from the last stepped frame.
+      mSteppedFrame = FrameStepper::Frame();
+      cancelSteps();
       break;
     }
 
     case kWhatScanSources:
     {
-      int32_t generation;
-      CHECK(msg->findInt32("generation", &generation));
-      if (generation != mScanSourcesGeneration) {
+      if (msg->mArg1 != mScanSourcesGeneration) {
         // Drop obsolete msg.
         break;
       }
 
       mScanSourcesPending = false;
 
+      // The decoders queue their output to it as soon as they are up, and
+      // pull from the source, which may be before start() for the first
+      // frame.
+      instantiateRenderer();
+      if (!mSourceStarted) {
+        mSourceStarted = true;
+        mSource->start();
+      }
+
       ALOGV("scanning sources haveAudio=%d, haveVideo=%d",
             mAudioDecoder != nullptr, mVideoDecoder != nullptr);
 
@@ -654,9 +861,15 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
       }
 
       // Don't try to re-open audio sink if there's an existing decoder.
-      if (mAudioSink != nullptr && mAudioDecoder == nullptr) {
+      // Before start only video is brought up (see onSourceNotify), so the
+      // first frame never waits for the audio sink to open.
+      if (mStarted && mAudioSink != nullptr && mAudioDecoder == nullptr) {
         if (instantiateDecoder(true, &mAudioDecoder) == -EWOULDBLOCK) {
           rescan = true;
+        } else if (mAudioDecoder != nullptr && mTrackSwitchStartUs >= 0) {
+          // A track switch that needed a new decoder, have it report its
+          // first output like a flushed one does.
+          mAudioDecoder->signalResume(true /* needNotify */);
         }
       }
 
@@ -669,21 +882,6 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
         }
       }
 
-      status_t err;
-      if ((err = mSource->feedMoreTSData()) != OK) {
-        if (mAudioDecoder == nullptr && mVideoDecoder == nullptr) {
-          // We're not currently decoding anything (no audio or
-          // video tracks found) and we just ran out of input data.
-
-          if (err == ERROR_END_OF_STREAM) {
-            notifyListener(MEDIA_PLAYBACK_COMPLETE, 0, 0);
-          } else {
-            notifyListener(MEDIA_ERROR, MEDIA_ERROR_UNKNOWN, err);
-          }
-        }
-        break;
-      }
-
       if (rescan) {
         msg->post(100000LL);
         mScanSourcesPending = true;
@@ -695,116 +893,64 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
     case kWhatAudioNotify:
     {
       bool audio = msg->what() == kWhatAudioNotify;
-
-      int32_t currentDecoderGeneration =
-          (audio? mAudioDecoderGeneration : mVideoDecoderGeneration);
-      int32_t requesterGeneration = currentDecoderGeneration - 1;
-      CHECK(msg->findInt32("generation", &requesterGeneration));
-
-      if (requesterGeneration != currentDecoderGeneration) {
-        ALOGV("got message from old %s decoder, generation(%d:%d)",
-              audio ? "audio" : "video", requesterGeneration,
-              currentDecoderGeneration);
-        std::shared_ptr<Message> reply;
-        if (!(msg->findMessage("reply", &reply))) {
-          return;
-        }
-
-        reply->setInt32("err", INFO_DISCONTINUITY);
-        reply->post();
-        return;
+      if (getDecoder(audio) == nullptr) {
+        // A decoder that was shut down, or went back to the DecoderPool,
+        // sends nothing after that; this was posted before.
+        ALOGV("got message from old %s decoder", audio ? "audio" : "video");
+        break;
       }
 
-      int32_t what;
-      CHECK(msg->findInt32("what", &what));
-
-      if (what == DecoderBase::kWhatInputDiscontinuity) {
-        int32_t formatChange;
-        CHECK(msg->findInt32("formatChange", &formatChange));
-
-        ALOGV("%s discontinuity: formatChange %d",
-              audio ? "audio" : "video", formatChange);
-
-        if (formatChange) {
-          mDeferredActions.push_back(
-              new FlushDecoderAction(
-                  audio ? FLUSH_CMD_SHUTDOWN : FLUSH_CMD_NONE,
-                  audio ? FLUSH_CMD_NONE : FLUSH_CMD_SHUTDOWN));
-        }
-
-        mDeferredActions.push_back(
-            new SimpleAction(
-                &HpcPlayerInternal::performScanSources));
-
-        processDeferredActions();
-      } else if (what == DecoderBase::kWhatEOS) {
-        int32_t err;
-        CHECK(msg->findInt32("err", &err));
-
-        if (err == ERROR_END_OF_STREAM) {
-          ALOGV("got %s decoder EOS", audio ? "audio" : "video");
-        } else {
-          ALOGV("got %s decoder EOS w/ error %d",
-                audio ? "audio" : "video",
-                err);
-        }
-
-        mRenderer->queueEOS(audio, err);
-      } else if (what == DecoderBase::kWhatFlushCompleted) {
+      int32_t what = (int32_t)msg->mArg1;
+      if (what == DecoderBase::kWhatFlushCompleted) {
         ALOGV("decoder %s flush completed", audio ? "audio" : "video");
 
         handleFlushComplete(audio, true /* isDecoder */);
         finishFlushIfPossible();
       } else if (what == DecoderBase::kWhatVideoSizeChanged) {
-        std::shared_ptr<Message> format;
-        CHECK(msg->findMessage("format", &format));
-
-        std::shared_ptr<Message> inputFormat =
-            mSource->getFormat(false /* audio */);
-
-        setVideoScalingMode(mVideoScalingMode);
-        updateVideoSize(inputFormat, format);
+        int32_t width = (int32_t)(msg->mArg2 >> 32);
+        int32_t height = (int32_t)(msg->mArg2 & 0xffffffff);
+        ALOGV("video size %dx%d", width, height);
+        notifyListener(MEDIA_SET_VIDEO_SIZE, width, height);
       } else if (what == DecoderBase::kWhatShutdownCompleted) {
         ALOGV("%s shutdown completed", audio ? "audio" : "video");
         if (audio) {
           std::lock_guard<std::mutex> autoLock(mDecoderLock);
-          mAudioDecoder.clear();
+          mAudioDecoder.reset();
           mAudioDecoderError = false;
           ++mAudioDecoderGeneration;
 
-          CHECK_EQ((int)mFlushingAudio, (int)SHUTTING_DOWN_DECODER);
+          if (mFlushingAudio != SHUTTING_DOWN_DECODER) {
+            ALOGE("audio shutdown completed in state %d", mFlushingAudio);
+          }
           mFlushingAudio = SHUT_DOWN;
         } else {
           std::lock_guard<std::mutex> autoLock(mDecoderLock);
-          mVideoDecoder.clear();
+          mVideoDecoder.reset();
           mVideoDecoderError = false;
           ++mVideoDecoderGeneration;
 
-          CHECK_EQ((int)mFlushingVideo, (int)SHUTTING_DOWN_DECODER);
+          if (mFlushingVideo != SHUTTING_DOWN_DECODER) {
+            ALOGE("video shutdown completed in state %d", mFlushingVideo);
+          }
           mFlushingVideo = SHUT_DOWN;
         }
 
         finishFlushIfPossible();
       } else if (what == DecoderBase::kWhatResumeCompleted) {
-        finishResume();
+        if (audio) {
+          finishTrackSwitch();
+        } else {
+          finishResume();
+        }
       } else if (what == DecoderBase::kWhatError) {
-        status_t err;
-        if (!msg->findInt32("err", &err) || err == OK) {
+        status_t err = (status_t)msg->mArg2;
+        if (err == OK) {
           err = UNKNOWN_ERROR;
         }
 
-        // Decoder errors can be due to Source (e.g. from streaming),
-        // or from decoding corrupted bitstreams, or from other decoder
-        // MediaCodec operations (e.g. from an ongoing reset or seek).
-        // They may also be due to openAudioSink failure at
-        // decoder start or after a format change.
-        //
-        // We try to gracefully shut down the affected decoder if possible,
-        // rather than trying to force the shutdown with something
-        // similar to performReset(). This method can lead to a hang
-        // if MediaCodec functions block after an error, but they should
-        // typically return INVALID_OPERATION instead of blocking.
-
+        // Decoder errors can be due to Source (e.g. from streaming), or from
+        // decoding corrupted bitstreams. The decoder stopped pulling; shut it
+        // down gracefully rather than with something like performReset().
         FlushStatus *flushing = audio ? &mFlushingAudio : &mFlushingVideo;
         ALOGE("received error(%#x) from %s decoder, flushing(%d), now shutting down",
               err, audio ? "audio" : "video", *flushing);
@@ -812,7 +958,7 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
         switch (*flushing) {
           case NONE:
             mDeferredActions.push_back(
-                new FlushDecoderAction(
+                std::make_shared<FlushDecoderAction>(
                     audio ? FLUSH_CMD_SHUTDOWN : FLUSH_CMD_NONE,
                     audio ? FLUSH_CMD_NONE : FLUSH_CMD_SHUTDOWN));
             processDeferredActions();
@@ -834,7 +980,7 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
         }
         if (mSource != nullptr) {
           if (audio) {
-            if (mVideoDecoderError || mSource->getFormat(false /* audio */) == nullptr
+            if (mVideoDecoderError || mSource->getFormatMeta(false /* audio */) == nullptr
                 || mSurface == nullptr || mVideoDecoder == nullptr) {
               // When both audio and video have error, or this stream has only audio
               // which has error, notify client of error.
@@ -849,7 +995,7 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
             }
             mAudioDecoderError = true;
           } else {
-            if (mAudioDecoderError || mSource->getFormat(true /* audio */) == nullptr
+            if (mAudioDecoderError || mSource->getFormatMeta(true /* audio */) == nullptr
                 || mAudioSink == nullptr || mAudioDecoder == nullptr) {
               // When both audio and video have error, or this stream has only video
               // which has error, notify client of error.
@@ -879,23 +1025,16 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
 
     case kWhatRendererNotify:
     {
-      int32_t requesterGeneration = mRendererGeneration - 1;
-      CHECK(msg->findInt32("generation", &requesterGeneration));
-      if (requesterGeneration != mRendererGeneration) {
-        ALOGV("got message from old renderer, generation(%d:%d)",
-              requesterGeneration, mRendererGeneration);
-        return;
+      if (mRenderer == nullptr) {
+        ALOGV("got message from old renderer");
+        break;
       }
 
-      int32_t what;
-      CHECK(msg->findInt32("what", &what));
+      int32_t what = (int32_t)msg->mArg1;
+      bool audio = (msg->mArg2 & 1) != 0;
 
       if (what == Renderer::kWhatEOS) {
-        int32_t audio;
-        CHECK(msg->findInt32("audio", &audio));
-
-        int32_t finalResult;
-        CHECK(msg->findInt32("finalResult", &finalResult));
+        status_t finalResult = (status_t)(msg->mArg2 >> 32);
 
         if (audio) {
           mAudioEOS = true;
@@ -918,9 +1057,6 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
           notifyListener(MEDIA_PLAYBACK_COMPLETE, 0, 0);
         }
       } else if (what == Renderer::kWhatFlushComplete) {
-        int32_t audio;
-        CHECK(msg->findInt32("audio", &audio));
-
         if (audio) {
           mAudioEOS = false;
         } else {
@@ -928,36 +1064,15 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
         }
 
         ALOGV("renderer %s flush completed.", audio ? "audio" : "video");
-        if (audio && (mFlushingAudio == NONE || mFlushingAudio == FLUSHED
-            || mFlushingAudio == SHUT_DOWN)) {
-          // Flush has been handled by tear down.
-          break;
-        }
         handleFlushComplete(audio, false /* isDecoder */);
         finishFlushIfPossible();
       } else if (what == Renderer::kWhatVideoRenderingStart) {
+        mStartupTimeline->mark(StartupTimeline::kFirstRenderedFrame);
+        mStartupTimeline->dump();
         notifyListener(MEDIA_INFO, MEDIA_INFO_RENDERING_START, 0);
       } else if (what == Renderer::kWhatMediaRenderingStart) {
         ALOGV("media rendering started");
         notifyListener(MEDIA_STARTED, 0, 0);
-      } else if (what == Renderer::kWhatAudioTearDown) {
-        int32_t reason;
-        CHECK(msg->findInt32("reason", &reason));
-        ALOGV("Tear down audio with reason %d.", reason);
-        if (reason == Renderer::kDueToTimeout && !(mPaused && mOffloadAudio)) {
-          // TimeoutWhenPaused is only for offload mode.
-          ALOGW("Received a stale message for teardown, mPaused(%d), mOffloadAudio(%d)",
-                mPaused, mOffloadAudio);
-          break;
-        }
-        int64_t positionUs;
-        if (!msg->findInt64("positionUs", &positionUs)) {
-          positionUs = mPreviousSeekTimeUs;
-        }
-
-        restartAudio(
-            positionUs, reason == Renderer::kForceNonOffload /* forceNonOffload */,
-            reason != Renderer::kDueToTimeout /* needsToCreateAudioDecoder */);
       }
       break;
     }
@@ -973,15 +1088,19 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
 
       mResetting = true;
       updatePlaybackTimer(true /* stopping */, "kWhatReset");
-      updateRebufferingTimer(true /* stopping */, true /* exiting */);
+      if (mReversing) {
+        stopReverse();
+      }
 
+      // The video decoder is only flushed, performReset() hands it to the
+      // DecoderPool for the next player.
       mDeferredActions.push_back(
-          new FlushDecoderAction(
+          std::make_shared<FlushDecoderAction>(
               FLUSH_CMD_SHUTDOWN /* audio */,
-              FLUSH_CMD_SHUTDOWN /* video */));
+              FLUSH_CMD_FLUSH /* video */));
 
       mDeferredActions.push_back(
-          new SimpleAction(&HpcPlayerInternal::performReset));
+          std::make_shared<SimpleAction>(&HpcPlayerInternal::performReset));
 
       processDeferredActions();
       break;
@@ -990,24 +1109,34 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
     case kWhatNotifyTime:
     {
       ALOGV("kWhatNotifyTime");
-      int64_t timerUs;
-      CHECK(msg->findInt64("timerUs", &timerUs));
-
-      notifyListener(MEDIA_NOTIFY_TIME, timerUs, 0);
+      // mArg1 is the TIMER_REASON, mArg2 the media time asked for.
+      if (msg->mArg1 == MediaClock::TIMER_REASON_REACHED) {
+        notifyListener(MEDIA_NOTIFY_TIME, (int)(msg->mArg2 / 1000), 0);
+      }
       break;
     }
 
     case kWhatSeek:
     {
-      int64_t seekTimeUs;
-      int32_t mode;
-      int32_t needNotify;
-      CHECK(msg->findInt64("seekTimeUs", &seekTimeUs));
-      CHECK(msg->findInt32("mode", &mode));
-      CHECK(msg->findInt32("needNotify", &needNotify));
+      int64_t seekTimeUs = msg->mArg1;
+      SeekMode mode = (SeekMode)(msg->mArg2 & 0xff);
+      bool needNotify = (msg->mArg2 >> 8) != 0;
 
       ALOGV("kWhatSeek seekTimeUs=%lld us, mode=%d, needNotify=%d",
             (long long)seekTimeUs, mode, needNotify);
+      mSteppedFrame = FrameStepper::Frame();
+      cancelSteps();
+
+      if (mReversing) {
+        // Paused or not, the tick shows the frame at the new position.
+        restartReverseDecode(seekTimeUs);
+        ++mReverseGeneration;
+        postReverseTick(0);
+        if (needNotify) {
+          notifyDriverSeekComplete();
+        }
+        break;
+      }
 
       if (!mStarted) {
         // Seek before the player is started. In order to preview video,
@@ -1015,7 +1144,7 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
         // only once if needed. After the player is started, any seek
         // operation will go through normal path.
         // Audio-only cases are handled separately.
-        onStart(seekTimeUs, (MediaPlayerSeekMode)mode);
+        onStart(seekTimeUs, mode);
         if (mStarted) {
           onPause();
           mPausedByClient = true;
@@ -1027,17 +1156,15 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
       }
 
       mDeferredActions.push_back(
-          new FlushDecoderAction(FLUSH_CMD_FLUSH /* audio */,
-                                 FLUSH_CMD_FLUSH /* video */));
+          std::make_shared<FlushDecoderAction>(FLUSH_CMD_FLUSH /* audio */,
+                                               FLUSH_CMD_FLUSH /* video */));
 
-      mDeferredActions.push_back(
-          new SeekAction(seekTimeUs, (MediaPlayerSeekMode)mode));
+      mDeferredActions.push_back(std::make_shared<SeekAction>(seekTimeUs, mode));
 
       // After a flush without shutdown, decoder is paused.
       // Don't resume it until source seek is done, otherwise it could
       // start pulling stale data too soon.
-      mDeferredActions.push_back(
-          new ResumeDecoderAction(needNotify));
+      mDeferredActions.push_back(std::make_shared<ResumeDecoderAction>(needNotify));
 
       processDeferredActions();
       break;
@@ -1045,7 +1172,14 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
 
     case kWhatPause:
     {
-      onPause();
+      if (mReversing) {
+        ++mReverseGeneration;
+        if (mRenderer != nullptr) {
+          mRenderer->setReverseAudio(true, false /* playing */);
+        }
+      } else {
+        onPause();
+      }
       mPausedByClient = true;
       break;
     }
@@ -1056,148 +1190,988 @@ void HpcPlayerInternal::onMessageReceived(const std::shared_ptr<Message> &msg) {
       break;
     }
 
-    case kWhatClosedCaptionNotify:
+    case kWhatPreviewNotify:
     {
-      onClosedCaptionNotify(msg);
+      if (msg->mArg1 == PreviewEngine::kWhatThumbnailAvailable) {
+        notifyListener(MEDIA_INFO, MEDIA_INFO_PREVIEW_AVAILABLE, (int)(msg->mArg2 / 1000));
+      }
       break;
     }
 
-    case kWhatMediaClockNotify:
+    case kWhatStepFrame:
     {
-      ALOGV("kWhatMediaClockNotify");
-      int64_t anchorMediaUs, anchorRealUs;
-      float playbackRate;
-      CHECK(msg->findInt64("anchor-media-us", &anchorMediaUs));
-      CHECK(msg->findInt64("anchor-real-us", &anchorRealUs));
-      CHECK(msg->findFloat("playback-rate", &playbackRate));
-
-      Parcel in;
-      in.writeInt64(anchorMediaUs);
-      in.writeInt64(anchorRealUs);
-      in.writeFloat(playbackRate);
-
-      notifyListener(MEDIA_TIME_DISCONTINUITY, 0, 0, &in);
+      onStepFrame(msg->mArg1 != 0);
       break;
     }
-    default:
-      break;
-  }
-}
 
-status_t HpcPlayerInternal::prepareAsync() {
-  return 0;
-}
+    case kWhatFrameStepped:
+    {
+      onFrameStepped((int32_t)msg->mArg1, (status_t)msg->mArg2);
+      break;
+    }
 
-void HpcPlayerInternal::start() {
+    case kWhatSetDirection:
+    {
+      onSetDirection(msg->mArg1 != 0, msg->mArg2 != 0);
+      break;
+    }
 
+    case kWhatReverseTick:
+    {
+      onReverseTick((int32_t)msg->mArg1);
+      break;
+    }
+
+    case kWhatReverseDecoded:
+    {
+      // A tick found nothing decoded yet and waits for this.
+      if (mReverseWaitingGeneration == mReverseGeneration) {
+        mReverseWaitingGeneration = -1;
+        onReverseTick(mReverseGeneration);
+      }
+      break;
+    }
+
+    case kWhatSetTrickPlay:
+    {
+      onSetTrickPlay(msg->mArg1 / 1000.0f);
+      break;
+    }
+
+    case kWhatSelectTrack:
+    {
+      onSelectTrack((size_t)msg->mArg1);
+      break;
+    }
+
+    case kWhatMediaClockNotify:
+    {
+      ALOGV("kWhatMediaClockNotify");
+      // mArg1 is the anchor media time, mArg2 the anchor real time.
+      notifyListener(MEDIA_TIME_DISCONTINUITY, (int)(msg->mArg1 / 1000), 0);
+      break;
+    }
+    default:
+      break;
+  }
 }
-void HpcPlayerInternal::pause() {
 
+void HpcPlayerInternal::prepareAsync() {
+  std::make_shared<Message>(kWhatPrepare, shared_from_this())->post();
 }
-void HpcPlayerInternal::init(const std::weak_ptr<HpcPlayer> &driver) {
 
+void HpcPlayerInternal::start() {
+  std::make_shared<Message>(kWhatStart, shared_from_this())->post();
+}
+
+void HpcPlayerInternal::pause() {
+  std::make_shared<Message>(kWhatPause, shared_from_this())->post();
+}
+
+void HpcPlayerInternal::init(const std::weak_ptr<HpcPlayer> &driver) {
+  mPlayer = driver;
 }
 void HpcPlayerInternal::updateVideoSize(const std::shared_ptr<Message> &inputFormat,
                                         const std::shared_ptr<Message> &outputFormat) {
 
 }
 void HpcPlayerInternal::onStart(int64_t startPositionUs, SeekMode mode) {
+  if (mSource == nullptr) {
+    return;
+  }
+  if (!mSourceStarted) {
+    mSourceStarted = true;
+    mSource->start();
+  }
+  if (startPositionUs >= 0) {
+    if (mAudioDecoder != nullptr || mVideoDecoder != nullptr) {
+      // Brought up at prepare, the decoder holds frames of the old position.
+      mDeferredActions.push_back(
+          std::make_shared<FlushDecoderAction>(FLUSH_CMD_FLUSH /* audio */,
+                                               FLUSH_CMD_FLUSH /* video */));
+      mDeferredActions.push_back(std::make_shared<SeekAction>(startPositionUs, mode));
+      mDeferredActions.push_back(std::make_shared<ResumeDecoderAction>(false /* needNotify */));
+      processDeferredActions();
+    } else {
+      performSeek(startPositionUs, mode);
+    }
+  }
+
+  mStarted = true;
+  mPaused = false;
+  mAudioEOS = false;
+  mVideoEOS = false;
+  instantiateRenderer();
+  mRenderer->resume();
+  startPlaybackTimer("onStart");
+  // The video decoder may already be running since prepare, this brings up
+  // audio.
+  postScanSources();
+}
 
+void HpcPlayerInternal::onResume() {
+  if (!mPaused) {
+    return;
+  }
+  mPaused = false;
+  if (mRenderer != nullptr) {
+    mRenderer->resume();
+  }
+  startPlaybackTimer("onResume");
+}
+
+void HpcPlayerInternal::onPause() {
+  if (mPaused) {
+    return;
+  }
+  mPaused = true;
+  if (mRenderer != nullptr) {
+    mRenderer->pause();
+  }
+  updatePlaybackTimer(true /* stopping */, "onPause");
 }
 
 void HpcPlayerInternal::startPlaybackTimer(const char *where) {
   std::lock_guard<std::mutex> autoLock(mPlayingTimeLock);
-  if (mLastStartedPlayingTimeNs == 0) {
-    mLastStartedPlayingTimeNs = systemTime();
-    ALOGV("startPlaybackTimer() time %20" PRId64 " (%s)",  mLastStartedPlayingTimeNs, where);
+  if (mLastStartedPlayingTimeUs == 0) {
+    mLastStartedPlayingTimeUs = Looper::GetNowUs();
+    ALOGV("startPlaybackTimer() time %lld (%s)", (long long)mLastStartedPlayingTimeUs, where);
   }
 }
 
 void HpcPlayerInternal::updatePlaybackTimer(bool stopping, const char *where) {
   std::lock_guard<std::mutex> autoLock(mPlayingTimeLock);
 
-  ALOGV("updatePlaybackTimer(%s)  time %20" PRId64 " (%s)",
-        stopping ? "stop" : "snap", mLastStartedPlayingTimeNs, where);
-
-  if (mLastStartedPlayingTimeNs != 0) {
-    sp<NuPlayerDriver> driver = mDriver.promote();
-    int64_t now = systemTime();
-    if (driver != NULL) {
-      int64_t played = now - mLastStartedPlayingTimeNs;
-      ALOGV("updatePlaybackTimer()  log  %20" PRId64 "", played);
+  ALOGV("updatePlaybackTimer(%s) time %lld (%s)",
+        stopping ? "stop" : "snap", (long long)mLastStartedPlayingTimeUs, where);
 
+  if (mLastStartedPlayingTimeUs != 0) {
+    std::shared_ptr<HpcPlayer> driver = mPlayer.lock();
+    int64_t nowUs = Looper::GetNowUs();
+    if (driver != nullptr) {
+      int64_t played = nowUs - mLastStartedPlayingTimeUs;
       if (played > 0) {
-        driver->notifyMorePlayingTimeUs((played+500)/1000);
+        driver->notifyPlayingTimeUs(played);
       }
     }
     if (stopping) {
-      mLastStartedPlayingTimeNs = 0;
+      mLastStartedPlayingTimeUs = 0;
     } else {
-      mLastStartedPlayingTimeNs = now;
+      mLastStartedPlayingTimeUs = nowUs;
     }
   }
 }
 
-void HpcPlayerInternal::startRebufferingTimer() {
-  std::lock_guard<std::mutex> autoLock(mPlayingTimeLock);
-  if (mLastStartedRebufferingTimeNs == 0) {
-    mLastStartedRebufferingTimeNs = systemTime();
-    ALOGV("startRebufferingTimer() time %20" PRId64 "",  mLastStartedRebufferingTimeNs);
+void HpcPlayerInternal::updateInternalTimers() {
+  // update values, but ticking clocks keep ticking
+  ALOGV("updateInternalTimers()");
+  updatePlaybackTimer(false /* stopping */, "updateInternalTimers");
+}
+
+void HpcPlayerInternal::seekTo(int64_t seekTimeUs, SeekMode mode, bool needNotify) {
+  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatSeek, shared_from_this());
+  msg->mArg1 = seekTimeUs;
+  msg->mArg2 = (int64_t)mode | ((int64_t)needNotify << 8);
+  msg->post();
+}
+status_t HpcPlayerInternal::getThumbnail(int64_t timeUs, PreviewEngine::Thumbnail *thumbnail) {
+  std::lock_guard<std::mutex> autoLock(mPreviewLock);
+  if (mPreviewEngine == nullptr) {
+    if (mDataSourceUrl.empty()) {
+      return NO_INIT;
+    }
+    // The preview engine opens the url a second time so that scrubbing never
+    // seeks or flushes the playback extractor and decoders. It does so on
+    // its own looper, this returns WOULD_BLOCK until then.
+    std::shared_ptr<Message> notify =
+        std::make_shared<Message>(kWhatPreviewNotify, shared_from_this());
+    std::shared_ptr<PreviewEngine> engine = std::make_shared<PreviewEngine>(notify);
+    status_t err = engine->initAsync(mDataSourceUrl.c_str());
+    if (err != OK) {
+      return err;
+    }
+    mPreviewEngine = engine;
   }
+  return mPreviewEngine->getThumbnail(timeUs, thumbnail);
 }
 
-void HpcPlayerInternal::updateRebufferingTimer(bool stopping, bool exitingPlayback) {
-  std::lock_guard<std::mutex> autoLock(mPlayingTimeLock);
+void HpcPlayerInternal::onSourceNotify(const std::shared_ptr<Message> &msg) {
+  switch (msg->mArg1) {
+    case kWhatPrepared:
+    {
+      status_t err = (status_t)msg->mArg2;
+      ALOGV("source prepared: %d", err);
+      mPrepared = err == OK;
+      auto driver = mPlayer.lock();
+      if (driver != nullptr) {
+        int64_t durationUs;
+        if (err == OK && mSource != nullptr && mSource->getDuration(&durationUs) == OK) {
+          driver->notifyDuration(durationUs);
+        }
+        driver->notifyPrepareCompleted(err);
+      }
+      break;
+    }
+
+    case kWhatFlagsChanged:
+    {
+      mSourceFlags = (uint32_t)msg->mArg2;
+      break;
+    }
+
+    case kWhatPauseOnBufferingStart:
+    {
+      mPlaybackStats->onRebufferingStart();
+      break;
+    }
+
+    case kWhatResumeOnBufferingEnd:
+    {
+      mPlaybackStats->onRebufferingEnd();
+      break;
+    }
+
+    case kWhatVideoSizeChanged:
+    {
+      // Codec parameters are known, which is all the video decoder needs.
+      // Bringing it up now instead of in start() lets the first keyframe be
+      // decoded and shown while the source is still buffering.
+      if (mSurface != nullptr && mVideoDecoder == nullptr) {
+        postScanSources();
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+std::shared_ptr<const StartupTimeline> HpcPlayerInternal::getStartupTimeline() const {
+  return mStartupTimeline;
+}
+
+status_t HpcPlayerInternal::getCurrentPosition(int64_t *mediaUs) {
+  int64_t nowMediaUs;
+  status_t err = mMediaClock->getMediaTime(Looper::GetNowUs(), &nowMediaUs);
+  if (err != OK) {
+    return err;
+  }
+  if (mReversing) {
+    // anchored on every reverse frame, never looped.
+    *mediaUs = nowMediaUs;
+    return OK;
+  }
+  std::lock_guard<std::mutex> autoLock(mSourceLock);
+  *mediaUs = mSource != nullptr ? mSource->getStreamTimeUs(nowMediaUs) : nowMediaUs;
+  return OK;
+}
+
+// Timestamps keep increasing across the loop end, so neither the decoders
+// nor MediaClock are flushed or re-anchored when playback wraps.
+status_t HpcPlayerInternal::setLoopRange(int64_t startUs, int64_t endUs) {
+  std::lock_guard<std::mutex> autoLock(mSourceLock);
+  if (mSource == nullptr) {
+    return NO_INIT;
+  }
+  return mSource->setLoopRange(startUs, endUs);
+}
+
+status_t HpcPlayerInternal::setBufferingSettings(const BufferingSettings &settings) {
+  std::lock_guard<std::mutex> autoLock(mSourceLock);
+  mBufferingSettings = settings;
+  if (mSource != nullptr) {
+    status_t err = mSource->setBufferingSettings(settings);
+    if (err != OK && err != INVALID_OPERATION) {
+      return err;
+    }
+  }
+  return OK;
+}
+
+BufferingSettings HpcPlayerInternal::getBufferingSettings() const {
+  std::lock_guard<std::mutex> autoLock(mSourceLock);
+  return mBufferingSettings;
+}
+
+void HpcPlayerInternal::setCacheDirectory(const std::string &dir) {
+  std::lock_guard<std::mutex> autoLock(mSourceLock);
+  mCacheDirectory = dir;
+}
+
+void HpcPlayerInternal::setTargetBitrate(int bitrate) {
+  std::lock_guard<std::mutex> autoLock(mSourceLock);
+  mTargetBitrate = bitrate;
+  if (mSource != nullptr) {
+    mSource->setTargetBitrate(bitrate);
+  }
+}
+
+void HpcPlayerInternal::getStats(PlaybackStats::Snapshot *stats) const {
+  *stats = mPlaybackStats->getSnapshot();
+
+  std::shared_ptr<Source> source;
+  {
+    std::lock_guard<std::mutex> autoLock(mSourceLock);
+    source = mSource;
+  }
+  if (source == nullptr) {
+    return;
+  }
+  size_t bytes = 0;
+  stats->videoQueueUs = source->getBufferedDurationUs(false /* audio */, &bytes);
+  stats->videoQueueBytes = (int64_t)bytes;
+  stats->audioQueueUs = source->getBufferedDurationUs(true /* audio */, &bytes);
+  stats->audioQueueBytes = (int64_t)bytes;
+}
+
+void HpcPlayerInternal::stepFrame(bool forward) {
+  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatStepFrame, shared_from_this());
+  msg->mArg1 = forward ? 1 : 0;
+  msg->post();
+}
+
+void HpcPlayerInternal::onStepFrame(bool forward) {
+  if (mReversing) {
+    ++mReverseGeneration;
+    if (mRenderer != nullptr) {
+      mRenderer->setReverseAudio(true, false /* playing */);
+    }
+  } else if (mStarted && !mPaused) {
+    onPause();
+  }
+  mPausedByClient = true;
+
+  if (mDataSourceUrl.empty()) {
+    return;
+  }
+  int64_t fromUs = -1;  // on from the stepper's frame
+  if (!mStepContinues) {
+    // First step since a seek or playback: start from the frame on screen.
+    fromUs = mPreviousSeekTimeUs;
+    int64_t mediaUs;
+    if (mMediaClock->getMediaTime(Looper::GetNowUs(), &mediaUs) == OK) {
+      fromUs = mediaUs;
+    }
+    mStepContinues = true;
+  }
+  std::shared_ptr<Message> msg = newFrameMessage(kWhatStepDecode);
+  msg->mArg1 = fromUs;
+  msg->mArg2 = ((int64_t)mStepGeneration << 1) | (forward ? 1 : 0);
+  msg->post();
+}
+
+void HpcPlayerInternal::onFrameStepped(int32_t generation, status_t err) {
+  FrameStepper::Frame frame;
+  if (err == OK) {
+    std::lock_guard<std::mutex> autoLock(mStepLock);
+    if (!mSteppedFrames.empty() && mSteppedFrames.front().generation == generation) {
+      frame = std::move(mSteppedFrames.front().frame);
+      mSteppedFrames.pop_front();
+    }
+  }
+  if (generation != mStepGeneration) {
+    return;  // played or sought meanwhile
+  }
+  if (frame.timeUs < 0) {
+    // failed, e.g. at either end of the stream: the next step starts over.
+    mStepContinues = false;
+    return;
+  }
+
+  mSteppedFrame = frame;
+  mPreviousSeekTimeUs = frame.timeUs;
+  mMediaClock->updateAnchor(frame.timeUs, Looper::GetNowUs());
+  renderStill(frame.timeUs, frame.frame);
+  notifyListener(MEDIA_INFO, MEDIA_INFO_FRAME_STEPPED, (int)(frame.timeUs / 1000));
+}
+
+// Steps still decoding are dropped, the next one starts from the frame on
+// screen.
+void HpcPlayerInternal::cancelSteps() {
+  ++mStepGeneration;
+  mStepContinues = false;
+}
+
+// The stepper's and the reverse decoder's frames keep the stream time base,
+// the surface gets them in microseconds like the decoders' output. The
+// cached frame is shared, a new reference carries the timestamps.
+void HpcPlayerInternal::renderStill(int64_t timeUs, const std::shared_ptr<AVFrame> &frame) {
+  if (mRenderer == nullptr || frame == nullptr) {
+    return;
+  }
+  AVFrame *ref = av_frame_clone(frame.get());
+  if (ref == nullptr) {
+    ALOGE("no memory for a frame reference");
+    return;
+  }
+  ref->pts = timeUs;
+  ref->best_effort_timestamp = timeUs;
+  std::shared_ptr<MediaBuffer> buffer = std::make_shared<MediaBuffer>();
+  buffer->ptsUs = timeUs;
+  buffer->frame = std::shared_ptr<AVFrame>(ref, [](AVFrame* f) { av_frame_free(&f); });
+  mRenderer->renderStill(buffer);
+}
+
+void HpcPlayerInternal::setPlaybackDirection(bool reverse, bool reverseAudio) {
+  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatSetDirection, shared_from_this());
+  msg->mArg1 = reverse ? 1 : 0;
+  msg->mArg2 = reverseAudio ? 1 : 0;
+  msg->post();
+}
+
+void HpcPlayerInternal::setTrickPlay(float speed) {
+  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatSetTrickPlay, shared_from_this());
+  msg->mArg1 = (int64_t)(speed * 1000);
+  msg->post();
+}
+
+// Entering or leaving trick play flushes both decoders and seeks the source
+// to the current position, so the queues switch between keyframe-only and
+// regular reads in one step.
+void HpcPlayerInternal::onSetTrickPlay(float speed) {
+  if (speed == mTrickPlaySpeed) {
+    return;
+  }
+  std::shared_ptr<Source> source;
+  {
+    std::lock_guard<std::mutex> autoLock(mSourceLock);
+    source = mSource;
+  }
+  if (source == nullptr) {
+    return;
+  }
+  status_t err = source->setTrickPlaySpeed(speed);
+  if (err != OK) {
+    ALOGW("source cannot do trick play: %d", err);
+    return;
+  }
+
+  int64_t positionUs = mPreviousSeekTimeUs;
+  int64_t mediaUs;
+  if (getCurrentPosition(&mediaUs) == OK) {
+    positionUs = mediaUs;
+  }
+  mTrickPlaySpeed = speed;
+  std::shared_ptr<FFmpegVideoDecoder> videoDecoder =
+      std::dynamic_pointer_cast<FFmpegVideoDecoder>(mVideoDecoder);
+  if (videoDecoder != nullptr) {
+    videoDecoder->setKeyFramesOnly(speed > 0);
+  }
+  mPlaybackRate = speed > 0 ? speed : 1.0f;
+  // The renderer drops audio at any rate but 1x and runs the clock on video.
+  if (mRenderer != nullptr) {
+    mRenderer->setPlaybackRate(mPlaybackRate);
+  }
+
+  mDeferredActions.push_back(
+      std::make_shared<FlushDecoderAction>(FLUSH_CMD_FLUSH /* audio */,
+                                           FLUSH_CMD_FLUSH /* video */));
+  mDeferredActions.push_back(std::make_shared<SeekAction>(positionUs, SEEK_PREVIOUS_SYNC));
+  mDeferredActions.push_back(std::make_shared<ResumeDecoderAction>(false /* needNotify */));
+  processDeferredActions();
+}
+
+void HpcPlayerInternal::postReverseTick(int64_t delayUs) {
+  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatReverseTick, shared_from_this());
+  msg->mArg1 = mReverseGeneration;
+  msg->post(delayUs);
+}
 
-  ALOGV("updateRebufferingTimer(%s)  time %20" PRId64 " (exiting %d)",
-        stopping ? "stop" : "snap", mLastStartedRebufferingTimeNs, exitingPlayback);
+void HpcPlayerInternal::stopReverse() {
+  ++mReverseGeneration;
+  mReversing = false;
+  mReversePending = ReverseDecoder::Frame();
+  mReverseAnchorRealUs = -1;
+  std::lock_guard<std::mutex> autoLock(mReverseLock);
+  ++mReverseDecodeGeneration;
+  mReverseFrames.clear();
+  mReverseChunks.clear();
+}
 
-  if (mLastStartedRebufferingTimeNs != 0) {
-    sp<HpcPlayer> driver = mDriver.promote();
-    int64_t now = systemTime();
-    if (driver != NULL) {
-      int64_t rebuffered = now - mLastStartedRebufferingTimeNs;
-      ALOGV("updateRebufferingTimer()  log  %20" PRId64 "", rebuffered);
+std::shared_ptr<Message> HpcPlayerInternal::newFrameMessage(int32_t what) {
+  if (mFrameLooper == nullptr) {
+    mFrameHandler = std::make_shared<FrameHandler>(shared_from_this());
+    mFrameLooper = std::make_shared<Looper>();
+    mFrameLooper->setName("HpcPlayerFrames");
+    mFrameLooper->start(Looper::PRIORITY_DEFAULT);
+    mFrameLooper->registerHandler(mFrameHandler);
+  }
+  return std::make_shared<Message>(what, mFrameHandler);
+}
+
+// Drops what was decoded ahead and has the frame looper go backwards from
+// |timeUs|, opening the reverse decoder there first if need be.
+void HpcPlayerInternal::restartReverseDecode(int64_t timeUs) {
+  std::shared_ptr<Message> msg = newFrameMessage(kWhatReverseStart);
+  {
+    std::lock_guard<std::mutex> autoLock(mReverseLock);
+    ++mReverseDecodeGeneration;
+    mReverseFrames.clear();
+    mReverseChunks.clear();
+    mReverseResult = OK;
+    mReverseFillPending = true;
+    msg->mArg2 = ((int64_t)mReverseDecodeGeneration << 1) | (mReverseAudio ? 1 : 0);
+  }
+  mReversePending = ReverseDecoder::Frame();
+  mReverseAnchorRealUs = -1;
+  if (mRenderer != nullptr) {
+    mRenderer->flushReverseAudio();
+  }
+  msg->mArg1 = timeUs;
+  msg->post();
+}
 
-      if (rebuffered > 0) {
-        driver->notifyMoreRebufferingTimeUs((rebuffered+500)/1000);
-        if (exitingPlayback) {
-          driver->notifyRebufferingWhenExit(true);
+// Has the frame looper decode further ahead, unless it already does.
+void HpcPlayerInternal::postReverseFill_l() {
+  if (mReverseFillPending || mReverseResult != OK
+      || mReverseFrames.size() >= kReverseFramesAhead) {
+    return;
+  }
+  mReverseFillPending = true;
+  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatReverseFill, mFrameHandler);
+  msg->mArg1 = mReverseDecodeGeneration;
+  msg->post();
+}
+
+void HpcPlayerInternal::onSetDirection(bool reverse, bool reverseAudio) {
+  const bool playing = mReversing ? !mPausedByClient : (mStarted && !mPaused);
+  int64_t positionUs = mPreviousSeekTimeUs;
+  int64_t mediaUs;
+  if (getCurrentPosition(&mediaUs) == OK) {
+    positionUs = mediaUs;
+  }
+
+  if (!reverse) {
+    if (!mReversing) {
+      return;
+    }
+    stopReverse();
+    cancelSteps();
+    if (mRenderer != nullptr) {
+      // drops the reverse audio, forward audio comes with the seek below.
+      mRenderer->setReverseAudio(false, false /* playing */);
+    }
+    // The forward pipeline sat paused where reverse playback started, move
+    // it to where it ended.
+    mDeferredActions.push_back(
+        std::make_shared<FlushDecoderAction>(FLUSH_CMD_FLUSH /* audio */,
+                                             FLUSH_CMD_FLUSH /* video */));
+    mDeferredActions.push_back(std::make_shared<SeekAction>(positionUs, SEEK_CLOSEST));
+    mDeferredActions.push_back(std::make_shared<ResumeDecoderAction>(false /* needNotify */));
+    processDeferredActions();
+    if (playing) {
+      onResume();
+      mPausedByClient = false;
+    }
+    return;
+  }
+
+  if (mTrickPlaySpeed > 0) {
+    onSetTrickPlay(0);
+  }
+  if (mDataSourceUrl.empty()) {
+    return;
+  }
+  if (mStarted && !mPaused) {
+    onPause();
+  }
+  mSteppedFrame = FrameStepper::Frame();
+  cancelSteps();
+  stopReverse();
+  mReversing = true;
+  mReverseAudio = reverseAudio;
+  mPausedByClient = !playing;
+  if (mRenderer != nullptr) {
+    // Drops the forward audio the renderer holds and takes no more of it
+    // until playback goes forward again.
+    mRenderer->setReverseAudio(true, playing);
+  }
+  restartReverseDecode(positionUs);
+  // Nothing would play what the audio decoder decodes meanwhile, it sits
+  // flushed instead.
+  mDeferredActions.push_back(
+      std::make_shared<FlushDecoderAction>(FLUSH_CMD_FLUSH /* audio */,
+                                           FLUSH_CMD_NONE /* video */));
+  processDeferredActions();
+  if (playing) {
+    postReverseTick(0);
+  }
+}
+
+// Each tick shows the pending frame once it is due and then takes the next
+// one the frame looper decoded ahead, along with the audio decoded down to
+// a bit below it. Frames are due at the anchor minus their distance to it,
+// scaled by the playback rate; a frame that is late by more than a frame
+// interval is dropped, so slow fills cost smoothness but not sync with
+// audio.
+void HpcPlayerInternal::onReverseTick(int32_t generation) {
+  if (generation != mReverseGeneration || !mReversing) {
+    return;
+  }
+  static const int64_t kLateThresholdUs = 40000;
+
+  int64_t nowUs = Looper::GetNowUs();
+  if (mReversePending.timeUs < 0) {
+    std::deque<ReverseDecoder::AudioChunk> chunks;
+    status_t err;
+    {
+      std::lock_guard<std::mutex> autoLock(mReverseLock);
+      err = mReverseResult;
+      if (!mReverseFrames.empty()) {
+        mReversePending = std::move(mReverseFrames.front());
+        mReverseFrames.pop_front();
+        chunks.swap(mReverseChunks);
+        err = OK;
+        postReverseFill_l();
+      }
+    }
+    if (err == ERROR_END_OF_STREAM) {
+      ++mReverseGeneration;
+      mPausedByClient = true;
+      if (mRenderer != nullptr) {
+        mRenderer->setReverseAudio(true, false /* playing */);
+      }
+      notifyListener(MEDIA_PLAYBACK_COMPLETE, 0, 0);
+      return;
+    } else if (err != OK) {
+      ALOGE("reverse decode failed: %d", err);
+      ++mReverseGeneration;
+      notifyListener(MEDIA_ERROR, MEDIA_ERROR_UNKNOWN, err);
+      return;
+    } else if (mReversePending.timeUs < 0) {
+      // kWhatReverseDecoded ticks again.
+      mReverseWaitingGeneration = generation;
+      return;
+    }
+    if (mRenderer != nullptr) {
+      for (ReverseDecoder::AudioChunk &chunk : chunks) {
+        mRenderer->queueReverseAudio(ReverseAudioBuffer(&chunk));
+      }
+    }
+    nowUs = Looper::GetNowUs();
+    if (mReverseAnchorRealUs < 0) {
+      mReverseAnchorRealUs = nowUs;
+      mReverseAnchorMediaUs = mReversePending.timeUs;
+    }
+  }
+
+  const float rate = mPlaybackRate > 0 ? mPlaybackRate : 1.0f;
+  const int64_t dueUs = mReverseAnchorRealUs
+      + (int64_t)((mReverseAnchorMediaUs - mReversePending.timeUs) / rate);
+  if (dueUs > nowUs) {
+    postReverseTick(dueUs - nowUs);
+    return;
+  }
+
+  const int64_t timeUs = mReversePending.timeUs;
+  if (mPausedByClient || nowUs - dueUs <= kLateThresholdUs) {
+    mSteppedFrame.timeUs = timeUs;
+    mSteppedFrame.frame = mReversePending.frame;
+    mReverseShownUs = timeUs;
+    mPreviousSeekTimeUs = timeUs;
+    mMediaClock->updateAnchor(timeUs, nowUs);
+    renderStill(timeUs, mReversePending.frame);
+  } else {
+    mPlaybackStats->onFrameDroppedLate();
+  }
+  mReversePending = ReverseDecoder::Frame();
+
+  if (mPausedByClient) {
+    // a seek while paused, one frame is all it shows.
+    return;
+  }
+  postReverseTick(0);
+}
+
+void HpcPlayerInternal::onFrameMessage(const std::shared_ptr<Message> &msg) {
+  switch (msg->what()) {
+    case kWhatStepDecode:
+    {
+      onStepDecode(msg->mArg1, (int32_t)(msg->mArg2 >> 1), (msg->mArg2 & 1) != 0);
+      break;
+    }
+
+    case kWhatReverseStart:
+    {
+      onReverseStart(msg->mArg1, (int32_t)(msg->mArg2 >> 1), (msg->mArg2 & 1) != 0);
+      break;
+    }
+
+    case kWhatReverseFill:
+    {
+      onReverseFill((int32_t)msg->mArg1);
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+// Like the seekbar previews, stepping decodes on its own extractor and
+// decoder, so the paused pipeline is not flushed and re-primed per step.
+// The frame goes back to the player with kWhatFrameStepped.
+void HpcPlayerInternal::onStepDecode(int64_t fromUs, int32_t generation, bool forward) {
+  status_t err = OK;
+  if (mFrameStepper == nullptr) {
+    std::unique_ptr<FrameStepper> stepper = std::make_unique<FrameStepper>();
+    err = stepper->init(mDataSourceUrl.c_str());
+    if (err != OK) {
+      ALOGE("failed to set up frame stepping: %d", err);
+    } else {
+      mFrameStepper = std::move(stepper);
+    }
+  }
+
+  FrameStepper::Frame frame;
+  if (err == OK && fromUs >= 0) {
+    err = mFrameStepper->seekTo(fromUs, &frame);
+  }
+  if (err == OK) {
+    err = forward ? mFrameStepper->stepForward(&frame) : mFrameStepper->stepBackward(&frame);
+  }
+  if (err == OK) {
+    FrameStepper::Stats stats = mFrameStepper->getStats();
+    ALOGV("stepped to %lld us in %lld us, %zu frames / %zu bytes cached",
+          (long long)frame.timeUs, (long long)stats.lastStepUs,
+          stats.cachedFrames, stats.cachedBytes);
+    std::lock_guard<std::mutex> autoLock(mStepLock);
+    mSteppedFrames.push_back(SteppedFrame{generation, std::move(frame)});
+  } else {
+    ALOGW("step %s failed: %d", forward ? "forward" : "backward", err);
+  }
+  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatFrameStepped, shared_from_this());
+  msg->mArg1 = generation;
+  msg->mArg2 = err;
+  msg->post();
+}
+
+void HpcPlayerInternal::onReverseStart(int64_t timeUs, int32_t generation, bool reverseAudio) {
+  if (mReverseDecoder == nullptr || reverseAudio != mReverseDecoderAudio) {
+    // Own extractor and decoder like frame stepping, the forward pipeline
+    // stays paused for the switch back.
+    mReverseDecoder.reset();
+    std::unique_ptr<ReverseDecoder> decoder = std::make_unique<ReverseDecoder>();
+    status_t err = decoder->init(mDataSourceUrl.c_str(), reverseAudio);
+    if (err != OK) {
+      ALOGE("failed to set up reverse playback: %d", err);
+      {
+        std::lock_guard<std::mutex> autoLock(mReverseLock);
+        if (generation == mReverseDecodeGeneration) {
+          mReverseResult = err;
+          mReverseFillPending = false;
         }
       }
+      std::make_shared<Message>(kWhatReverseDecoded, shared_from_this())->post();
+      return;
     }
-    if (stopping) {
-      mLastStartedRebufferingTimeNs = 0;
+    mReverseDecoder = std::move(decoder);
+    mReverseDecoderAudio = reverseAudio;
+  }
+  mReverseDecoder->seekTo(timeUs);
+  mReverseAudioEndUs = reverseAudio ? timeUs : -1;
+  onReverseFill(generation);
+}
+
+// Decodes the next frame, a whole stack fill at GOP boundaries, and the
+// audio down to a bit below it, then goes on until kReverseFramesAhead are
+// waiting for the player.
+void HpcPlayerInternal::onReverseFill(int32_t generation) {
+  {
+    std::lock_guard<std::mutex> autoLock(mReverseLock);
+    if (generation != mReverseDecodeGeneration) {
+      return;  // restarted, a start message of the new generation follows
+    }
+    mReverseFillPending = false;
+    if (mReverseResult != OK || mReverseFrames.size() >= kReverseFramesAhead) {
+      return;
+    }
+  }
+
+  ReverseDecoder::Frame frame;
+  status_t err = mReverseDecoder->nextFrame(&frame);
+  std::deque<ReverseDecoder::AudioChunk> chunks;
+  while (err == OK && mReverseAudioEndUs > 0
+         && mReverseAudioEndUs > frame.timeUs - kReverseAudioLeadUs) {
+    ReverseDecoder::AudioChunk chunk;
+    if (mReverseDecoder->nextAudioChunk(&chunk) != OK) {
+      mReverseAudioEndUs = -1;
+      break;
+    }
+    mReverseAudioEndUs = chunk.startUs;
+    chunks.push_back(std::move(chunk));
+  }
+
+  {
+    std::lock_guard<std::mutex> autoLock(mReverseLock);
+    if (generation != mReverseDecodeGeneration) {
+      return;
+    }
+    if (err == OK) {
+      mReverseFrames.push_back(std::move(frame));
+      for (ReverseDecoder::AudioChunk &chunk : chunks) {
+        mReverseChunks.push_back(std::move(chunk));
+      }
     } else {
-      mLastStartedRebufferingTimeNs = now;
+      mReverseResult = err;
     }
+    postReverseFill_l();
   }
+  std::make_shared<Message>(kWhatReverseDecoded, shared_from_this())->post();
 }
 
-void HpcPlayerInternal::updateInternalTimers() {
-  // update values, but ticking clocks keep ticking
-  ALOGV("updateInternalTimers()");
-  updatePlaybackTimer(false /* stopping */, "updateInternalTimers");
-  updateRebufferingTimer(false /* stopping */, false /* exiting */);
+status_t HpcPlayerInternal::getTrackInfo(std::vector<Extractor::TrackInfo> *tracks) const {
+  std::lock_guard<std::mutex> autoLock(mSourceLock);
+  if (mSource == nullptr) {
+    return NO_INIT;
+  }
+  tracks->resize(mSource->getTrackCount());
+  for (size_t i = 0; i < tracks->size(); ++i) {
+    mSource->getTrackInfo(i, &(*tracks)[i]);
+  }
+  return OK;
+}
+
+ssize_t HpcPlayerInternal::getSelectedTrack(media_track_type type) const {
+  std::lock_guard<std::mutex> autoLock(mSourceLock);
+  if (mSource == nullptr) {
+    return NO_INIT;
+  }
+  return mSource->getSelectedTrack(type);
+}
+
+status_t HpcPlayerInternal::selectTrack(size_t trackIndex, bool select) {
+  Extractor::TrackInfo info;
+  {
+    std::lock_guard<std::mutex> autoLock(mSourceLock);
+    if (mSource == nullptr) {
+      return NO_INIT;
+    }
+    status_t err = mSource->getTrackInfo(trackIndex, &info);
+    if (err != OK) {
+      return err;
+    }
+  }
+  if (info.type != MEDIA_TRACK_TYPE_AUDIO || !select) {
+    return INVALID_OPERATION;
+  }
+
+  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatSelectTrack, shared_from_this());
+  msg->mArg1 = (int64_t)trackIndex;
+  msg->post();
+  return OK;
 }
 
-void HpcPlayerInternal::seekTo(int64_t seekTimeUs) {
+void HpcPlayerInternal::onSelectTrack(size_t trackIndex) {
+  if (mSource == nullptr) {
+    return;
+  }
+  ssize_t currentIndex = mSource->getSelectedTrack(MEDIA_TRACK_TYPE_AUDIO);
+  if (currentIndex == (ssize_t)trackIndex) {
+    return;
+  }
+
+  mTrackSwitchStartUs = Looper::GetNowUs();
+  mTrackSwitchIndex = trackIndex;
+
+  // Resume the new track where the listener is, not where the old one was
+  // demuxed or decoded up to.
+  int64_t positionUs = mPreviousSeekTimeUs;
+  int64_t mediaUs;
+  if (mMediaClock->getMediaTime(Looper::GetNowUs(), &mediaUs) == OK) {
+    positionUs = mSource->getStreamTimeUs(mediaUs);
+  }
+
+  // The decoder is kept when the new track has the same format, e.g. another
+  // language of the same AAC stereo mix, otherwise the scan creates one.
+  Extractor::TrackInfo from, to;
+  bool sameFormat = currentIndex >= 0
+      && mSource->getTrackInfo(currentIndex, &from) == OK
+      && mSource->getTrackInfo(trackIndex, &to) == OK
+      && from.mime_type == to.mime_type
+      && from.sample_rate == to.sample_rate
+      && from.channel_count == to.channel_count;
+  ALOGV("selectTrack %zu at %lld us, %s audio decoder", trackIndex,
+        (long long)positionUs, sameFormat ? "flushing" : "replacing");
+
+  // Flushing the decoder also flushes the renderer's audio, video is not
+  // touched.
+  mDeferredActions.push_back(
+      std::make_shared<FlushDecoderAction>(
+          sameFormat ? FLUSH_CMD_FLUSH : FLUSH_CMD_SHUTDOWN /* audio */,
+          FLUSH_CMD_NONE /* video */));
+
+  mDeferredActions.push_back(
+      std::make_shared<SelectTrackAction>(trackIndex, positionUs));
+
+  processDeferredActions();
+}
+
+void HpcPlayerInternal::performSelectTrack(size_t trackIndex, int64_t timeUs) {
+  if (mSource == nullptr) {
+    return;
+  }
+  status_t err = mSource->selectTrack(trackIndex, true /* select */, timeUs);
+  if (err != OK) {
+    ALOGE("failed to select track %zu: %d", trackIndex, err);
+    mTrackSwitchStartUs = -1;
+  }
+
+  if (mAudioDecoder != nullptr) {
+    // After a flush without shutdown the decoder is paused, the first
+    // output after resuming completes the switch.
+    mAudioDecoder->signalResume(mTrackSwitchStartUs >= 0 /* needNotify */);
+  } else {
+    performScanSources();
+  }
+}
 
+void HpcPlayerInternal::finishTrackSwitch() {
+  if (mTrackSwitchStartUs < 0) {
+    return;
+  }
+  int64_t latencyUs = Looper::GetNowUs() - mTrackSwitchStartUs;
+  mTrackSwitchStartUs = -1;
+  ALOGI("switched to audio track %zu in %lld us", mTrackSwitchIndex, (long long)latencyUs);
+  notifyListener(MEDIA_INFO, MEDIA_INFO_TRACK_SWITCHED, (int)(latencyUs / 1000));
 }
+
 status_t HpcPlayerInternal::setVideoScalingMode(int32_t mode) {
   return 0;
 }
 void HpcPlayerInternal::resetAsync() {
-
+  std::shared_ptr<Source> source;
+  {
+    std::lock_guard<std::mutex> autoLock(mSourceLock);
+    source = mSource;
+  }
+  if (source != nullptr) {
+    // Wakes a prepare or read blocked on the network, the reset would wait
+    // for it otherwise.
+    source->disconnect();
+  }
+  std::make_shared<Message>(kWhatReset, shared_from_this())->post();
 }
 
 status_t HpcPlayerInternal::notifyAt(int64_t mediaTimeUs) {
   std::shared_ptr<Message> notify = std::make_shared<Message>(kWhatNotifyTime, shared_from_this());
-  notify->setInt(mediaTimeUs);
+  // mArg1 carries the TIMER_REASON.
+  notify->mArg2 = mediaTimeUs;
   mMediaClock->addTimer(notify, mediaTimeUs);
   return OK;
 }
 
+void HpcPlayerInternal::schedulePollDuration() {
+  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatPollDuration, shared_from_this());
+  msg->setInt(mPollDurationGeneration);
+  msg->post();
+}
+
+void HpcPlayerInternal::cancelPollDuration() {
+  ++mPollDurationGeneration;
+}
+
 void HpcPlayerInternal::postScanSources() {
   if (mScanSourcesPending) {
     return;
@@ -1210,4 +2184,4 @@ void HpcPlayerInternal::postScanSources() {
   mScanSourcesPending = true;
 }
 
-}
\ No newline at end of file
+} // hpc
@@ -2,13 +2,28 @@
 #include "Error.h"
 #include "Handler.h"
 #include "BaseType.h"
+#include "StartupTimeline.h"
+#include "PlaybackStats.h"
+#include "BufferingSettings.h"
+#include "preview/PreviewEngine.h"
+#include "preview/FrameStepper.h"
+#include "preview/ReverseDecoder.h"
+#include "decoder/DecoderPool.h"
+#include "extractor/Extractor.h"
+
+#include <atomic>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <vector>
 
 namespace hpc {
 
 struct Looper;
 class Source;
 class HpcPlayer;
-class MediaClock;
+struct MediaClock;
 class Decoder;
 class Renderer;
 class AudioSink;
@@ -17,19 +32,23 @@ class Surface;
 class HpcPlayerInternal : public Handler{
  public:
   explicit HpcPlayerInternal(const std::shared_ptr<MediaClock> &mediaClock);
-
+  ~HpcPlayerInternal();
 
   void init(const std::weak_ptr<HpcPlayer> &driver);
 
+  // Reports through HpcPlayer::notifySetDataSourceCompleted().
   void setDataSourceAsync(const char* url);
+  void setDataSourceAsync(const std::vector<std::string> &urls);
 
+  // Reports through HpcPlayer::notifyPrepareCompleted().
   void prepareAsync();
 
-  status_t setVideoSurface(Surface* surface);
-
-//  void setAudioSink(const std::shared_ptr<MediaPlayerBase::AudioSink> &sink);
-//  status_t setPlaybackSettings(const AudioPlaybackRate &rate);
-//  status_t getPlaybackSettings(AudioPlaybackRate *rate /* nonnull */);
+  // Both are taken on the looper; nullptr detaches. Without an audio sink
+  // audio is not decoded, without a surface video is not.
+  void setVideoSurface(const std::shared_ptr<Surface> &surface);
+  void setAudioSink(const std::shared_ptr<AudioSink> &sink);
+  // Applies to the next renderer, see Renderer's |freeRunning|.
+  void setFreeRunning(bool freeRunning);
 
   void start();
 
@@ -43,24 +62,57 @@ class HpcPlayerInternal : public Handler{
 
   // Will notify the driver through "notifySeekComplete" once finished
   // and needNotify is true.
-  void seekTo(int64_t seekTimeUs);
+  void seekTo(int64_t seekTimeUs, SeekMode mode = SEEK_PREVIOUS_SYNC, bool needNotify = false);
 
   status_t setVideoScalingMode(int32_t mode);
-  //status_t getTrackInfo(Parcel* reply) const;
-  //status_t getSelectedTrack(int32_t type, Parcel* reply) const;
-  //status_t selectTrack(size_t trackIndex, bool select, int64_t timeUs);
+  status_t getTrackInfo(std::vector<Extractor::TrackInfo> *tracks) const;
+  ssize_t getSelectedTrack(media_track_type type) const;
+  // Audio tracks only. Video keeps playing while the audio packets, decoder
+  // and sink are flushed and the new track starts at the current position.
+  // Completion is reported with MEDIA_INFO_TRACK_SWITCHED.
+  status_t selectTrack(size_t trackIndex, bool select);
+  // Stream position, i.e. it goes back at every loop while MediaClock keeps
+  // running.
   status_t getCurrentPosition(int64_t *mediaUs);
-  //void getStats(Vector<std::shared_ptr<AMessage> > *trackStats);
-
-  float getFrameRate();
+  // Seamless looping, see Source::setLoopRange().
+  status_t setLoopRange(int64_t startUs, int64_t endUs);
+  // Kept for the sources of later data sources too.
+  status_t setBufferingSettings(const BufferingSettings &settings);
+  BufferingSettings getBufferingSettings() const;
+  void setCacheDirectory(const std::string &dir);
+  // Frame, decode, queue, rebuffering and A/V sync counters of the current
+  // data source. Never blocks the pipeline, polling it every second is fine.
+  void getStats(PlaybackStats::Snapshot *stats) const;
+
+  // Seekbar thumbnail for |timeUs|, see PreviewEngine::getThumbnail().
+  status_t getThumbnail(int64_t timeUs, PreviewEngine::Thumbnail *thumbnail);
+
+  // Pauses playback and moves one frame forward or backward. Reports the
+  // new position with MEDIA_INFO_FRAME_STEPPED.
+  void stepFrame(bool forward);
+
+  // Plays backwards from the current position, or goes back to the regular
+  // pipeline. Reverse frames come from a ReverseDecoder on the frame looper
+  // and are paced on this one, reverse audio plays through the renderer;
+  // MEDIA_PLAYBACK_COMPLETE is posted at the start of the stream.
+  void setPlaybackDirection(bool reverse, bool reverseAudio);
+
+  // Keyframe-only playback at |speed|, 0 leaves it. The source reads sync
+  // samples only, the video decoder discards non-key frames and MediaClock
+  // runs at |speed|; audio is paused meanwhile.
+  void setTrickPlay(float speed);
+
+  // Milestones of the last prepare/start, for time-to-first-frame tracking.
+  std::shared_ptr<const StartupTimeline> getStartupTimeline() const;
 
   void updateInternalTimers();
 
+  // Caps the bitrate of adaptive streams, 0 leaves it to the bandwidth
+  // estimate. Applies at the next prepare and right away to a prepared
+  // source.
   void setTargetBitrate(int bitrate /* bps */);
 
  protected:
-  virtual ~HpcPlayerInternal();
-
   void onMessageReceived(const std::shared_ptr<Message> &msg) override;
 
  private:
@@ -71,6 +123,13 @@ class HpcPlayerInternal : public Handler{
   struct FlushDecoderAction;
   struct PostMessageAction;
   struct SimpleAction;
+  struct SelectTrackAction;
+  struct FrameHandler;
+
+  struct SteppedFrame {
+    int32_t generation;
+    FrameStepper::Frame frame;
+  };
 
   enum {
     kWhatSetDataSource              = '=DaS',
@@ -78,16 +137,11 @@ class HpcPlayerInternal : public Handler{
     kWhatSetVideoSurface            = '=VSu',
     kWhatSetAudioSink               = '=AuS',
     kWhatMoreDataQueued             = 'more',
-    kWhatConfigPlayback             = 'cfPB',
-    kWhatConfigSync                 = 'cfSy',
-    kWhatGetPlaybackSettings        = 'gPbS',
-    kWhatGetSyncSettings            = 'gSyS',
     kWhatStart                      = 'strt',
     kWhatStop                       = 'stop',
     kWhatScanSources                = 'scan',
     kWhatVideoNotify                = 'vidN',
     kWhatAudioNotify                = 'audN',
-    kWhatClosedCaptionNotify        = 'capN',
     kWhatRendererNotify             = 'renN',
     kWhatReset                      = 'rset',
     kWhatNotifyTime                 = 'nfyT',
@@ -100,8 +154,23 @@ class HpcPlayerInternal : public Handler{
     kWhatGetSelectedTrack           = 'gSel',
     kWhatSelectTrack                = 'selT',
     kWhatMediaClockNotify           = 'mckN',
+    kWhatPreviewNotify              = 'prvN',
+    kWhatStepFrame                  = 'step',
+    kWhatStepDecode                 = 'stpD',
+    kWhatFrameStepped               = 'stpd',
+    kWhatSetDirection               = 'sDir',
+    kWhatReverseTick                = 'rvsT',
+    kWhatReverseDecoded             = 'rvsD',
+    kWhatReverseStart               = 'rvsS',
+    kWhatReverseFill                = 'rvsF',
+    kWhatSetTrickPlay               = 'tPly',
   };
 
+  // Reverse playback decodes this many frames ahead of the one due, and
+  // audio this far ahead of the last frame decoded.
+  static const size_t kReverseFramesAhead = 2;
+  static const int64_t kReverseAudioLeadUs = 200000;
+
   enum FlushStatus {
     NONE,
     FLUSHING_DECODER,
@@ -117,6 +186,9 @@ class HpcPlayerInternal : public Handler{
     FLUSH_CMD_SHUTDOWN,
   };
 
+  // Installs |source|, nullptr on |err|, and reports |err| on the looper.
+  void onSourceCreated(std::shared_ptr<Source> source, status_t err);
+
   void updateVideoSize(
       const std::shared_ptr<Message> &inputFormat,
       const std::shared_ptr<Message> &outputFormat = nullptr);
@@ -142,15 +214,39 @@ class HpcPlayerInternal : public Handler{
   void schedulePollDuration();
   void cancelPollDuration();
 
+  // Wall time played is reported to HpcPlayer::notifyPlayingTimeUs(),
+  // rebuffering is counted in PlaybackStats.
   void updatePlaybackTimer(bool stopping, const char *where);
   void startPlaybackTimer(const char *where);
 
-  int64_t mLastStartedRebufferingTimeNs;
-  void startRebufferingTimer();
-  void updateRebufferingTimer(bool stopping, bool exitingPlayback);
-
   void processDeferredActions();
 
+  void onStepFrame(bool forward);
+  void onFrameStepped(int32_t generation, status_t err);
+  void cancelSteps();
+  // Hands a stepped or reverse played frame to the renderer, which counts it
+  // once it is on the surface.
+  void renderStill(int64_t timeUs, const std::shared_ptr<AVFrame> &frame);
+  void onSetDirection(bool reverse, bool reverseAudio);
+  void onReverseTick(int32_t generation);
+  void postReverseTick(int64_t delayUs);
+  void stopReverse();
+  void restartReverseDecode(int64_t timeUs);
+  void postReverseFill_l();
+  // Starts the frame looper on first use.
+  std::shared_ptr<Message> newFrameMessage(int32_t what);
+  // On the frame looper.
+  void onFrameMessage(const std::shared_ptr<Message> &msg);
+  void onStepDecode(int64_t fromUs, int32_t generation, bool forward);
+  void onReverseStart(int64_t timeUs, int32_t generation, bool reverseAudio);
+  void onReverseFill(int32_t generation);
+  void onSetTrickPlay(float speed);
+  void onSelectTrack(size_t trackIndex);
+  void finishTrackSwitch();
+  void onSourceNotify(const std::shared_ptr<Message> &msg);
+  status_t instantiateDecoder(bool audio, std::shared_ptr<Decoder> *decoder);
+  void instantiateRenderer();
+
   void flushDecoder(bool audio, bool needShutdown);
   void performSeek(int64_t seekTimeUs, SeekMode mode);
   void performDecoderFlush(FlushCommand audio, FlushCommand video);
@@ -158,56 +254,111 @@ class HpcPlayerInternal : public Handler{
   void performScanSources();
   void performSetSurface(const std::shared_ptr<Surface> &wrapper);
   void performResumeDecoders(bool needNotify);
+  void performSelectTrack(size_t trackIndex, int64_t timeUs);
 
   inline std::shared_ptr<Decoder> getDecoder(bool audio) {
     return audio ? mAudioDecoder : mVideoDecoder;
   }
 
   std::weak_ptr<HpcPlayer> mPlayer;
-  bool mUIDValid;
-  uid_t mUID;
+  bool mUIDValid {false};
+  uid_t mUID {0};
   const std::shared_ptr<MediaClock> mMediaClock;
-  std::mutex mSourceLock;  // guard |mSource|.
+  mutable std::mutex mSourceLock;  // guard |mSource|.
   std::shared_ptr<Source> mSource;
-  uint32_t mSourceFlags;
+  BufferingSettings mBufferingSettings;  // guarded by |mSourceLock| too
+  std::string mCacheDirectory;           // guarded by |mSourceLock| too
+  int64_t mTargetBitrate {0};           // guarded by |mSourceLock| too
+  uint32_t mSourceFlags {0};
+  std::string mDataSourceUrl;
+  std::mutex mPreviewLock;  // guard |mPreviewEngine| and writes of |mDataSourceUrl|.
+  std::shared_ptr<PreviewEngine> mPreviewEngine;
+  FrameStepper::Frame mSteppedFrame;  // last frame a step landed on
+  // Stepping and reverse playback decode on a looper of their own, a GOP
+  // decode must not hold up this one. Created on first use.
+  std::shared_ptr<Looper> mFrameLooper;
+  std::shared_ptr<FrameHandler> mFrameHandler;
+  // Steps of an older generation are stale. Once a step is asked for, the
+  // next ones go on from the stepper's frame until playback moves.
+  int32_t mStepGeneration {0};
+  bool mStepContinues {false};
+  std::mutex mStepLock;  // guard |mSteppedFrames|.
+  std::deque<SteppedFrame> mSteppedFrames;  // one per kWhatFrameStepped with OK
+  std::unique_ptr<FrameStepper> mFrameStepper;  // frame looper only
+  // Reverse playback. A tick shows the pending frame and takes the next one
+  // the frame looper decoded ahead; ticks of an older generation are stale.
+  std::atomic<bool> mReversing {false};
+  bool mReverseAudio {false};
+  int32_t mReverseGeneration {0};
+  int32_t mReverseWaitingGeneration {-1};  // of a tick waiting for a frame
+  ReverseDecoder::Frame mReversePending;
+  int64_t mReverseShownUs {-1};  // the last reverse frame on screen
+  // wall clock time media time mReverseAnchorMediaUs is due at.
+  int64_t mReverseAnchorRealUs {-1};
+  int64_t mReverseAnchorMediaUs {-1};
+  std::mutex mReverseLock;  // guard the members up to mReverseFillPending.
+  int32_t mReverseDecodeGeneration {0};  // of the last restart
+  std::deque<ReverseDecoder::Frame> mReverseFrames;  // decoded ahead, next first
+  std::deque<ReverseDecoder::AudioChunk> mReverseChunks;
+  status_t mReverseResult {OK};  // why no more frames come
+  bool mReverseFillPending {false};
+  // Frame looper only.
+  std::unique_ptr<ReverseDecoder> mReverseDecoder;
+  bool mReverseDecoderAudio {false};
+  int64_t mReverseAudioEndUs {-1};  // audio before this is still to be decoded
+  float mTrickPlaySpeed {0.0f};  // 0 unless in keyframe-only trick play
+  const std::shared_ptr<StartupTimeline> mStartupTimeline;
+  const std::shared_ptr<PlaybackStats> mPlaybackStats;
+  std::mutex mPendingLock;  // guard |mPendingSurface| and |mPendingAudioSink|.
+  std::shared_ptr<Surface> mPendingSurface;  // taken by kWhatSetVideoSurface
+  std::shared_ptr<AudioSink> mPendingAudioSink;  // taken by kWhatSetAudioSink
   std::shared_ptr<Surface> mSurface;
   std::shared_ptr<AudioSink> mAudioSink;
+  std::atomic<bool> mFreeRunning {false};
   std::shared_ptr<Decoder> mVideoDecoder;
   std::shared_ptr<Decoder> mAudioDecoder;
   std::mutex mDecoderLock;  // guard |mAudioDecoder| and |mVideoDecoder|.
-  std::mutex mPlayingTimeLock;
-  std::shared_ptr<Decoder> mCCDecoder;
+  DecoderPool::Key mVideoDecoderKey;  // where mVideoDecoder goes on reset
+  std::mutex mPlayingTimeLock;  // guard |mLastStartedPlayingTimeUs|.
+  int64_t mLastStartedPlayingTimeUs {0};
   std::shared_ptr<Renderer> mRenderer;
   std::shared_ptr<Looper> mRendererLooper;
-  int32_t mAudioDecoderGeneration;
-  int32_t mVideoDecoderGeneration;
-  int32_t mRendererGeneration;
-  int64_t mPreviousSeekTimeUs;
+  int32_t mAudioDecoderGeneration {0};
+  int32_t mVideoDecoderGeneration {0};
+  int32_t mRendererGeneration {0};
+  bool mAudioDecoderError {false};
+  bool mVideoDecoderError {false};
+  int64_t mPreviousSeekTimeUs {0};
+  int64_t mTrackSwitchStartUs;  // -1 unless an audio track switch is pending
+  size_t mTrackSwitchIndex;
   std::list<std::shared_ptr<Action> > mDeferredActions;
 
-  int32_t mPollDurationGeneration;
-  int32_t mTimedTextGeneration;
-  float mPlaybackRate;
-
-  bool mFlushComplete[2][2];
+  int32_t mPollDurationGeneration {0};
+  int32_t mTimedTextGeneration {0};
+  float mPlaybackRate {1.0f};
 
-  FlushStatus mFlushingAudio;
-  FlushStatus mFlushingVideo;
-  bool mAudioEOS;
-  bool mVideoEOS;
-  bool mStarted;
+  bool mFlushComplete[2][2] {{false, false}, {false, false}};
 
-  bool mPaused;
-  bool mPausedByClient;
-  bool mPausedForBuffering;
+  FlushStatus mFlushingAudio {NONE};
+  FlushStatus mFlushingVideo {NONE};
+  bool mAudioEOS {false};
+  bool mVideoEOS {false};
+  bool mStarted {false};
+  bool mPrepared {false};
+  bool mResetting {false};
+  bool mSourceStarted {false};
+  bool mResumePending {false};  // a seek that reports once video is out
 
-  bool mScanSourcesPending;
-  int32_t mScanSourcesGeneration;
+  bool mPaused {false};
+  bool mPausedByClient {true};
+  bool mPausedForBuffering {false};
 
+  bool mScanSourcesPending {false};
+  int32_t mScanSourcesGeneration {0};
 
 };
 
-}  // namespace android
+} // hpc
 
 
 
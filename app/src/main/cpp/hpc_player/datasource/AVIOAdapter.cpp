@@ -0,0 +1,81 @@
+#include "AVIOAdapter.h"
+#include "Log.h"
+
+#include <cstdio>
+
+extern "C" {
+#include "libavformat/avio.h"
+#include "libavutil/error.h"
+#include "libavutil/mem.h"
+}
+
+#define LOG_TAG "AVIOAdapter"
+
+namespace hpc {
+
+AVIOAdapter::AVIOAdapter(const std::shared_ptr<DataSource> &source)
+    : mSource(source) {
+  const int bufferSize = (source->flags() & DataSource::kIsMemoryMapped) != 0
+      ? kMappedBufferSize : kBufferSize;
+  uint8_t *buffer = (uint8_t *)av_malloc(bufferSize);
+  if (buffer == nullptr) {
+    return;
+  }
+  mContext = avio_alloc_context(buffer, bufferSize, 0 /* write_flag */, this,
+                                ReadPacket, nullptr, Seek);
+  if (mContext == nullptr) {
+    av_free(buffer);
+  }
+}
+
+AVIOAdapter::~AVIOAdapter() {
+  if (mContext != nullptr) {
+    // libavformat may have swapped the buffer for one of its own.
+    av_freep(&mContext->buffer);
+    avio_context_free(&mContext);
+  }
+}
+
+int AVIOAdapter::ReadPacket(void *opaque, uint8_t *buffer, int size) {
+  AVIOAdapter *me = static_cast<AVIOAdapter *>(opaque);
+  ssize_t n = me->mSource->readAt(me->mOffset, buffer, size);
+  if (n == 0) {
+    return AVERROR_EOF;
+  } else if (n < 0) {
+    return AVERROR(EIO);
+  }
+  me->mOffset += n;
+  return (int)n;
+}
+
+int64_t AVIOAdapter::Seek(void *opaque, int64_t offset, int whence) {
+  AVIOAdapter *me = static_cast<AVIOAdapter *>(opaque);
+  int64_t size = -1;
+  if (me->mSource->getSize(&size) != OK) {
+    size = -1;
+  }
+  switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+      return size >= 0 ? size : AVERROR(ENOSYS);
+    case SEEK_SET:
+      break;
+    case SEEK_CUR:
+      offset += me->mOffset;
+      break;
+    case SEEK_END:
+      if (size < 0) {
+        return AVERROR(ENOSYS);
+      }
+      offset += size;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  if (offset < 0) {
+    return AVERROR(EINVAL);
+  }
+  me->mOffset = offset;
+  return offset;
+}
+
+} // hpc
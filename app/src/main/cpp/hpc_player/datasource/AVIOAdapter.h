@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory>
+
+#include "DataSource.h"
+
+struct AVIOContext;
+
+namespace hpc {
+
+// Hands a DataSource to libavformat as a custom AVIOContext. Set context()
+// as AVFormatContext::pb, with AVFMT_FLAG_CUSTOM_IO, before
+// avformat_open_input(); it has to outlive the format context.
+class AVIOAdapter {
+ public:
+  static const int kBufferSize = 64 * 1024;
+  // For a memory mapped source. Reads larger than the buffer bypass it and
+  // go straight from the mapping into the caller's memory, a packet's
+  // payload in one copy; the buffer then only serves headers and small
+  // packets, where refilling less after each seek pays.
+  static const int kMappedBufferSize = 4 * 1024;
+
+  explicit AVIOAdapter(const std::shared_ptr<DataSource> &source);
+  ~AVIOAdapter();
+
+  AVIOAdapter(const AVIOAdapter &) = delete;
+  AVIOAdapter &operator=(const AVIOAdapter &) = delete;
+
+  // nullptr if it could not be allocated.
+  AVIOContext *context() const { return mContext; }
+
+ private:
+  std::shared_ptr<DataSource> mSource;
+  AVIOContext *mContext {nullptr};
+  int64_t mOffset {0};
+
+  static int ReadPacket(void *opaque, uint8_t *buffer, int size);
+  static int64_t Seek(void *opaque, int64_t offset, int whence);
+};
+
+} // hpc
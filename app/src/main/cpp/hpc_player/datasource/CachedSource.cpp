@@ -0,0 +1,178 @@
+#include "CachedSource.h"
+#include "Log.h"
+#include "Looper.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define LOG_TAG "CachedSource"
+
+namespace hpc {
+
+CachedSource::CachedSource(const std::shared_ptr<DataSource> &source)
+    : CachedSource(source, Config()) {}
+
+CachedSource::CachedSource(const std::shared_ptr<DataSource> &source, const Config &config)
+    : mSource(source),
+      mConfig(config) {
+  // The watermarks have to leave room for what is kept behind the reader.
+  mConfig.chunkSize = std::min(std::max<size_t>(mConfig.chunkSize, 4096), mConfig.capacity / 4);
+  mConfig.keepBehind = std::min(mConfig.keepBehind, mConfig.capacity / 2);
+  mConfig.highWatermark = std::min(mConfig.highWatermark, mConfig.capacity - mConfig.keepBehind);
+  mConfig.lowWatermark = std::min(mConfig.lowWatermark, mConfig.highWatermark);
+  mRing.resize(mConfig.capacity);
+  mThread = std::thread(&CachedSource::prefetchLoop, this);
+}
+
+CachedSource::~CachedSource() {
+  close();
+  mThread.join();
+}
+
+status_t CachedSource::initCheck() const {
+  return mSource->initCheck();
+}
+
+status_t CachedSource::getSize(int64_t *size) {
+  return mSource->getSize(size);
+}
+
+uint32_t CachedSource::flags() {
+  return (mSource->flags() & ~kWantsPrefetching) | kIsCachingDataSource;
+}
+
+void CachedSource::close() {
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    mClosed = true;
+  }
+  mFetchCondition.notify_all();
+  mDataCondition.notify_all();
+  mSource->close();
+}
+
+void CachedSource::moveWindow_l(int64_t offset) {
+  ALOGV("window moves from [%lld, %lld) to %lld",
+        (long long)mWindowStart, (long long)mWindowEnd, (long long)offset);
+  mWindowStart = mWindowEnd = offset;
+  mFinalStatus = OK;
+  ++mGeneration;
+  ++mStats.windowMoves;
+}
+
+ssize_t CachedSource::readAt(int64_t offset, void *data, size_t size) {
+  std::unique_lock<std::mutex> lock(mLock);
+  ++mStats.reads;
+  int64_t waitStartUs = -1;
+  while (offset < mWindowStart || offset >= mWindowEnd) {
+    if (mClosed) {
+      return DEAD_OBJECT;
+    }
+    // A little ahead of the window the prefetcher gets there soon, further
+    // away it would fetch everything in between first.
+    if (offset < mWindowStart || offset > mWindowEnd + (int64_t)mConfig.lowWatermark) {
+      moveWindow_l(offset);
+    } else if (mFinalStatus != OK) {
+      return mFinalStatus == ERROR_END_OF_STREAM ? 0 : mFinalStatus;
+    }
+    if (waitStartUs < 0) {
+      waitStartUs = Looper::GetNowUs();
+    }
+    mReadOffset = offset;
+    mFetching = true;
+    mFetchCondition.notify_one();
+    mDataCondition.wait(lock);
+  }
+
+  const size_t capacity = mRing.size();
+  const size_t n = (size_t)std::min<int64_t>(size, mWindowEnd - offset);
+  const size_t pos = offset % capacity;
+  const size_t first = std::min(n, capacity - pos);
+  memcpy(data, &mRing[pos], first);
+  memcpy((uint8_t *)data + first, &mRing[0], n - first);
+  mReadOffset = offset + n;
+
+  if (waitStartUs >= 0) {
+    const int64_t waitUs = Looper::GetNowUs() - waitStartUs;
+    ++mStats.misses;
+    mStats.waitUs += waitUs;
+    mStats.maxWaitUs = std::max(mStats.maxWaitUs, waitUs);
+  } else {
+    ++mStats.hits;
+  }
+  mStats.bytesRead += n;
+
+  if (!mFetching && mFinalStatus == OK
+      && mWindowEnd - mReadOffset < (int64_t)mConfig.lowWatermark) {
+    mFetching = true;
+    mFetchCondition.notify_one();
+  }
+  return n;
+}
+
+void CachedSource::prefetchLoop() {
+  const size_t capacity = mRing.size();
+  std::unique_lock<std::mutex> lock(mLock);
+  while (!mClosed) {
+    if (mFetching && mWindowEnd - mReadOffset >= (int64_t)mConfig.highWatermark) {
+      mFetching = false;
+    }
+    if (!mFetching || mFinalStatus != OK) {
+      mFetchCondition.wait(lock);
+      continue;
+    }
+
+    // Room for the next chunk, dropping what is further behind the reader
+    // than keepBehind.
+    const int64_t keepFrom = std::min(mReadOffset, mWindowEnd) - (int64_t)mConfig.keepBehind;
+    size_t room = capacity - (size_t)(mWindowEnd - mWindowStart);
+    if (room < mConfig.chunkSize && keepFrom > mWindowStart) {
+      mWindowStart += std::min<int64_t>(keepFrom - mWindowStart, mConfig.chunkSize - room);
+      room = capacity - (size_t)(mWindowEnd - mWindowStart);
+    }
+    if (room == 0) {
+      mFetching = false;
+      continue;
+    }
+    const int64_t offset = mWindowEnd;
+    const size_t pos = offset % capacity;
+    const size_t size = std::min({mConfig.chunkSize, room, capacity - pos});
+    const int32_t generation = mGeneration;
+
+    // Straight into the ring: the reader does not look past mWindowEnd, and
+    // only this thread moves it.
+    lock.unlock();
+    ssize_t n = mSource->readAt(offset, &mRing[pos], size);
+    lock.lock();
+
+    if (generation != mGeneration) {
+      continue;
+    }
+    ++mStats.fetches;
+    if (n > 0) {
+      mWindowEnd += n;
+      mStats.bytesFetched += n;
+    } else {
+      mFinalStatus = n == 0 ? ERROR_END_OF_STREAM : (status_t)n;
+      if (n < 0) {
+        ALOGE("read at %lld failed: %d", (long long)offset, (int)n);
+      }
+    }
+    mDataCondition.notify_all();
+  }
+}
+
+size_t CachedSource::getCachedBytes(status_t *finalStatus) const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  *finalStatus = mFinalStatus;
+  return (size_t)std::max<int64_t>(mWindowEnd - mReadOffset, 0);
+}
+
+CachedSource::Stats CachedSource::getStats() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  Stats stats = mStats;
+  stats.cachedBytes = (size_t)std::max<int64_t>(mWindowEnd - mReadOffset, 0);
+  return stats;
+}
+
+} // hpc
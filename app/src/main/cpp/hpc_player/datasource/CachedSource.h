@@ -0,0 +1,90 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "DataSource.h"
+
+namespace hpc {
+
+// Read cache in front of a slow DataSource, slow storage or a network. A
+// prefetch thread reads the upstream ahead of the demuxer into a ring
+// buffer: it pauses once highWatermark bytes are cached ahead of the last
+// read and resumes when the demuxer has eaten into them down to
+// lowWatermark, so the upstream sees large sequential reads in bursts
+// instead of libavformat's small synchronous ones.
+//
+// The ring keeps up to keepBehind bytes behind the reader. A read anywhere
+// in the cached window, e.g. a short seek back or the demuxer going back to
+// an index, is served from memory. A read a little ahead of it waits for the
+// prefetcher, anything further away moves the window there.
+class CachedSource : public DataSource {
+ public:
+  struct Config {
+    size_t capacity {16 * 1024 * 1024};
+    size_t highWatermark {12 * 1024 * 1024};
+    size_t lowWatermark {4 * 1024 * 1024};
+    size_t keepBehind {2 * 1024 * 1024};
+    size_t chunkSize {256 * 1024};  // upstream read size
+  };
+
+  struct Stats {
+    int64_t reads {0};
+    int64_t hits {0};            // served from the ring without waiting
+    int64_t misses {0};          // waited for the prefetcher
+    int64_t windowMoves {0};     // reads outside the window, the cache is dropped
+    int64_t bytesRead {0};       // handed to the reader
+    int64_t bytesFetched {0};    // read from upstream
+    int64_t fetches {0};
+    int64_t waitUs {0};
+    int64_t maxWaitUs {0};
+    size_t cachedBytes {0};      // ahead of the last read
+
+    double hitRate() const { return reads > 0 ? (double)hits / reads : 0.0; }
+  };
+
+  explicit CachedSource(const std::shared_ptr<DataSource> &source);
+  CachedSource(const std::shared_ptr<DataSource> &source, const Config &config);
+  ~CachedSource() override;
+
+  status_t initCheck() const override;
+  ssize_t readAt(int64_t offset, void *data, size_t size) override;
+  status_t getSize(int64_t *size) override;
+  // The upstream's flags and kIsCachingDataSource.
+  uint32_t flags() override;
+  void close() override;
+
+  // Bytes cached ahead of the last read, |finalStatus| is OK until the
+  // upstream ended or failed.
+  size_t getCachedBytes(status_t *finalStatus) const;
+  Stats getStats() const;
+
+ private:
+  const std::shared_ptr<DataSource> mSource;
+  Config mConfig;
+  std::vector<uint8_t> mRing;  // offset x is at mRing[x % capacity]
+
+  mutable std::mutex mLock;
+  std::condition_variable mFetchCondition;  // wakes the prefetcher
+  std::condition_variable mDataCondition;   // wakes a reader waiting for data
+  // [mWindowStart, mWindowEnd) is in the ring.
+  int64_t mWindowStart {0};
+  int64_t mWindowEnd {0};
+  int64_t mReadOffset {0};  // end of the last read
+  bool mFetching {true};
+  // ERROR_END_OF_STREAM once the upstream is read to the end, or its error.
+  status_t mFinalStatus {OK};
+  // Moves of the window, a fetch in flight across one is dropped.
+  int32_t mGeneration {0};
+  bool mClosed {false};
+  Stats mStats;
+  std::thread mThread;
+
+  void prefetchLoop();
+  void moveWindow_l(int64_t offset);
+};
+
+} // hpc
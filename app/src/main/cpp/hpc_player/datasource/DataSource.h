@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+
+#include "Error.h"
+
+namespace hpc {
+
+// Random access byte source under the demuxer, e.g. a local file, an HTTP
+// resource or a cache in front of either. FFmpeg reads it through
+// AVIOAdapter. readAt() may be called from one thread at a time; flags(),
+// getSize() and close() from any.
+class DataSource {
+ public:
+  enum Flags {
+    kWantsPrefetching    = 1,
+    kIsCachingDataSource = 4,
+    kIsHTTPBasedSource   = 8,
+    kIsLocalFileSource   = 16,
+    kIsMemoryMapped      = 32,
+  };
+
+  DataSource() = default;
+  virtual ~DataSource() = default;
+
+  DataSource(const DataSource &) = delete;
+  DataSource &operator=(const DataSource &) = delete;
+
+  virtual status_t initCheck() const = 0;
+
+  // Up to |size| bytes at |offset|: the count read, 0 at the end, or an
+  // error. Short reads are fine, callers read again.
+  virtual ssize_t readAt(int64_t offset, void *data, size_t size) = 0;
+
+  // ERROR_UNSUPPORTED while the size is not known, e.g. chunked HTTP.
+  virtual status_t getSize(int64_t * /* size */) {
+    return ERROR_UNSUPPORTED;
+  }
+
+  virtual uint32_t flags() {
+    return 0;
+  }
+
+  // Opaque version of the resource, e.g. its HTTP ETag or Last-Modified,
+  // once a read or getSize() saw it; empty if there is none.
+  virtual std::string getValidator() {
+    return std::string();
+  }
+
+  // Later reads want the version |validator| of the resource. Should it have
+  // changed, they get the new one and getValidator() tells, like HTTP
+  // If-Range. Empty asks for whatever version there is.
+  virtual void setIfRange(const std::string & /* validator */) {}
+
+  // Makes a readAt() blocked on I/O return, for disconnect.
+  virtual void close() {}
+};
+
+} // hpc
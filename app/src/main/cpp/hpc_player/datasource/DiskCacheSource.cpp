@@ -0,0 +1,423 @@
+#include "DiskCacheSource.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOG_TAG "DiskCacheSource"
+
+namespace hpc {
+
+namespace {
+
+const uint32_t kIndexMagic = 'HPCI';
+const uint32_t kIndexVersion = 2;
+const int64_t kMaxValidatorBytes = 1024;
+
+struct IndexHeader {
+  uint32_t magic;
+  uint32_t version;
+  int64_t size;            // of the resource, -1 if unknown
+  int64_t count;           // of the ranges that follow, start and end each
+  int64_t validatorBytes;  // after the ranges
+};
+
+bool readFully(int fd, void *data, size_t size, int64_t offset) {
+  uint8_t *p = static_cast<uint8_t *>(data);
+  while (size > 0) {
+    ssize_t n = pread(fd, p, size, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+bool writeFully(int fd, const void *data, size_t size, int64_t offset) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  while (size > 0) {
+    ssize_t n = pwrite(fd, p, size, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+} // namespace
+
+std::string DiskCacheSource::PathFor(const std::string &directory, const std::string &url) {
+  // FNV-1a, stable across runs unlike std::hash.
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : url) {
+    hash = (hash ^ c) * 1099511628211ULL;
+  }
+  char name[32];
+  snprintf(name, sizeof(name), "%016" PRIx64 ".cache", hash);
+  return directory + "/" + name;
+}
+
+DiskCacheSource::DiskCacheSource(const std::shared_ptr<DataSource> &source,
+                                 const std::string &path, int64_t maxBytes)
+    : mSource(source),
+      mPath(path),
+      mMaxBytes(maxBytes) {
+  mFd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (mFd < 0) {
+    ALOGE("cannot open %s: %s", path.c_str(), strerror(errno));
+    return;
+  }
+  // Opening is a use, the caches trimmed first are those used least recently.
+  futimens(mFd, nullptr);
+  const size_t slash = path.rfind('/');
+  Trim(slash == std::string::npos ? std::string(".") : path.substr(0, slash), maxBytes, path);
+
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (!loadIndex_l()) {
+    reset_l();
+  }
+  mSource->setIfRange(mValidator);
+}
+
+DiskCacheSource::~DiskCacheSource() {
+  if (mFd >= 0) {
+    Index index;
+    bool unsaved;
+    {
+      std::lock_guard<std::mutex> autoLock(mLock);
+      unsaved = takeIndex_l(&index);
+    }
+    if (unsaved) {
+      saveIndex(index);
+    }
+    ::close(mFd);
+  }
+}
+
+// Deletes the least recently modified caches in |directory| but |keep| until
+// they take |maxBytes| at most. Another player may still have one open, it
+// writes on into the unlinked file and its index no longer matches.
+void DiskCacheSource::Trim(const std::string &directory, int64_t maxBytes,
+                           const std::string &keep) {
+  DIR *dir = opendir(directory.c_str());
+  if (dir == nullptr) {
+    return;
+  }
+  struct Entry {
+    int64_t modifiedNs;
+    int64_t bytes;
+    std::string path;
+  };
+  std::vector<Entry> entries;
+  int64_t totalBytes = 0;
+  static const char kSuffix[] = ".cache";
+  const size_t suffixLength = sizeof(kSuffix) - 1;
+  while (struct dirent *entry = readdir(dir)) {
+    const std::string name = entry->d_name;
+    if (name.size() <= suffixLength
+        || name.compare(name.size() - suffixLength, suffixLength, kSuffix) != 0) {
+      continue;
+    }
+    const std::string path = directory + "/" + name;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+      continue;
+    }
+    // Sparse, a cache takes the blocks of its ranges only.
+    const int64_t bytes = (int64_t)st.st_blocks * 512;
+    totalBytes += bytes;
+    if (path != keep) {
+      entries.push_back({st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec, bytes, path});
+    }
+  }
+  closedir(dir);
+
+  std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+    return a.modifiedNs < b.modifiedNs;
+  });
+  for (const Entry &entry : entries) {
+    if (totalBytes <= maxBytes) {
+      break;
+    }
+    ALOGV("evicting %s, %lld bytes", entry.path.c_str(), (long long)entry.bytes);
+    unlink(entry.path.c_str());
+    unlink((entry.path + ".idx").c_str());
+    totalBytes -= entry.bytes;
+  }
+}
+
+status_t DiskCacheSource::initCheck() const {
+  return mFd >= 0 ? mSource->initCheck() : NO_INIT;
+}
+
+uint32_t DiskCacheSource::flags() {
+  return mSource->flags();
+}
+
+void DiskCacheSource::close() {
+  mSource->close();
+}
+
+status_t DiskCacheSource::getSize(int64_t *size) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (mSize < 0) {
+    status_t err = checkSize_l();
+    if (err != OK) {
+      return err;
+    }
+  }
+  if (mSize < 0) {
+    return ERROR_UNSUPPORTED;
+  }
+  *size = mSize;
+  return OK;
+}
+
+// Asks the upstream for the size, which connects it. Done once, before the
+// first upstream read.
+status_t DiskCacheSource::checkSize_l() {
+  int64_t size = -1;
+  status_t err = mSource->getSize(&size);
+  if (err != OK && err != ERROR_UNSUPPORTED) {
+    return err;
+  }
+  checkValidator_l(mSource->getValidator());
+  if (size >= 0 && mSize >= 0 && size != mSize) {
+    ALOGI("%s changed size %lld -> %lld, dropping the cache",
+          mPath.c_str(), (long long)mSize, (long long)size);
+    reset_l();
+  }
+  if (size >= 0 && mSize < 0) {
+    mSize = size;
+    // Sparse, holes take no space until a range lands in them.
+    if (ftruncate(mFd, size) != 0) {
+      ALOGW("cannot size %s: %s", mPath.c_str(), strerror(errno));
+    }
+  }
+  mSizeChecked = true;
+  return OK;
+}
+
+// The version the upstream answered with against the cached one. Another
+// one drops the cache, the holes are asked for with the new one from then.
+void DiskCacheSource::checkValidator_l(const std::string &validator) {
+  if (validator.empty() || validator == mValidator) {
+    return;
+  }
+  if (!mRanges.empty()) {
+    ALOGI("%s changed version, dropping the cache", mPath.c_str());
+    reset_l();
+  }
+  mValidator = validator;
+  mSource->setIfRange(validator);
+}
+
+ssize_t DiskCacheSource::readAt(int64_t offset, void *data, size_t size) {
+  std::unique_lock<std::mutex> lock(mLock);
+  if (mSize >= 0 && offset >= mSize) {
+    return 0;
+  }
+
+  auto next = mRanges.upper_bound(offset);
+  if (next != mRanges.begin()) {
+    auto range = std::prev(next);
+    if (offset < range->second) {
+      const size_t n = (size_t)std::min<int64_t>(size, range->second - offset);
+      if (readFully(mFd, data, n, offset)) {
+        ++mStats.diskReads;
+        mStats.diskBytes += n;
+        return n;
+      }
+      ALOGW("cache read at %lld failed, dropping the cache", (long long)offset);
+      reset_l();
+      next = mRanges.end();
+    }
+  }
+
+  // A hole: the upstream fills it up to the next cached range.
+  if (!mSizeChecked) {
+    status_t err = checkSize_l();
+    if (err != OK) {
+      return err;
+    }
+    next = mRanges.upper_bound(offset);
+  }
+  if (next != mRanges.end()) {
+    size = (size_t)std::min<int64_t>(size, next->first - offset);
+  }
+  ++mStats.upstreamReads;
+  // Only this thread reads and changes the ranges, the lock is for stats.
+  lock.unlock();
+  ssize_t n = mSource->readAt(offset, data, size);
+  const std::string validator = n > 0 ? mSource->getValidator() : std::string();
+  lock.lock();
+  if (n <= 0) {
+    return n;
+  }
+  mStats.upstreamBytes += n;
+  checkValidator_l(validator);
+  if (mCachedBytes + n > mMaxBytes) {
+    return n;  // full, the rest is read through
+  }
+  if (!writeFully(mFd, data, n, offset)) {
+    ALOGW("cache write at %lld failed: %s", (long long)offset, strerror(errno));
+    return n;
+  }
+  addRange_l(offset, offset + n);
+  mUnsavedBytes += n;
+  if (mUnsavedBytes >= kIndexFlushBytes) {
+    Index index;
+    takeIndex_l(&index);
+    lock.unlock();
+    saveIndex(index);
+  }
+  return n;
+}
+
+void DiskCacheSource::addRange_l(int64_t start, int64_t end) {
+  // Merge with whatever overlaps or touches [start, end).
+  auto it = mRanges.upper_bound(start);
+  if (it != mRanges.begin() && std::prev(it)->second >= start) {
+    --it;
+    start = it->first;
+  }
+  while (it != mRanges.end() && it->first <= end) {
+    end = std::max(end, it->second);
+    mCachedBytes -= it->second - it->first;
+    it = mRanges.erase(it);
+  }
+  mRanges[start] = end;
+  mCachedBytes += end - start;
+}
+
+void DiskCacheSource::reset_l() {
+  mRanges.clear();
+  mCachedBytes = 0;
+  mSize = -1;
+  mValidator.clear();
+  mSizeChecked = false;
+  mUnsavedBytes = 0;
+  ++mIndexGeneration;
+  mSource->setIfRange(std::string());
+  if (ftruncate(mFd, 0) != 0) {
+    ALOGW("cannot truncate %s: %s", mPath.c_str(), strerror(errno));
+  }
+  unlink((mPath + ".idx").c_str());
+}
+
+bool DiskCacheSource::loadIndex_l() {
+  int fd = open((mPath + ".idx").c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  IndexHeader header;
+  bool ok = readFully(fd, &header, sizeof(header), 0)
+      && header.magic == kIndexMagic && header.version == kIndexVersion
+      && header.count >= 0 && header.count < (1 << 20)
+      && header.validatorBytes >= 0 && header.validatorBytes <= kMaxValidatorBytes;
+  std::vector<int64_t> ranges;
+  std::string validator;
+  if (ok) {
+    ranges.resize(header.count * 2);
+    validator.resize(header.validatorBytes);
+    const int64_t rangesBytes = ranges.size() * sizeof(int64_t);
+    ok = readFully(fd, ranges.data(), rangesBytes, sizeof(header))
+        && readFully(fd, &validator[0], validator.size(), sizeof(header) + rangesBytes);
+  }
+  ::close(fd);
+
+  struct stat st;
+  if (!ok || fstat(mFd, &st) != 0) {
+    return false;
+  }
+  for (size_t i = 0; i < ranges.size(); i += 2) {
+    // Ranges past the end of the file did not make it to disk.
+    if (ranges[i] < 0 || ranges[i] >= ranges[i + 1] || ranges[i + 1] > st.st_size) {
+      return false;
+    }
+    addRange_l(ranges[i], ranges[i + 1]);
+  }
+  mSize = header.size;
+  mValidator = validator;
+  ALOGV("%s: %zu ranges of %lld bytes", mPath.c_str(), mRanges.size(), (long long)mSize);
+  return true;
+}
+
+// Taken under the lock and written without it: the fdatasync() of the data
+// may take a while, getSize() and getStats() do not wait for it.
+bool DiskCacheSource::takeIndex_l(Index *index) {
+  index->size = mSize;
+  index->validator = mValidator;
+  index->ranges.clear();
+  index->ranges.reserve(mRanges.size() * 2);
+  for (const auto &range : mRanges) {
+    index->ranges.push_back(range.first);
+    index->ranges.push_back(range.second);
+  }
+  index->unsavedBytes = mUnsavedBytes;
+  index->generation = mIndexGeneration;
+  mUnsavedBytes = 0;
+  return index->unsavedBytes > 0;
+}
+
+// Written aside and renamed over, a crash leaves the old index or the new.
+void DiskCacheSource::saveIndex(const Index &index) {
+  IndexHeader header = {kIndexMagic, kIndexVersion, index.size,
+                        (int64_t)index.ranges.size() / 2, (int64_t)index.validator.size()};
+  const int64_t rangesBytes = index.ranges.size() * sizeof(int64_t);
+
+  const std::string path = mPath + ".idx";
+  const std::string tmpPath = path + ".tmp";
+  int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  bool ok = fd >= 0
+      && writeFully(fd, &header, sizeof(header), 0)
+      && writeFully(fd, index.ranges.data(), rangesBytes, sizeof(header))
+      && writeFully(fd, index.validator.data(), index.validator.size(),
+                    sizeof(header) + rangesBytes)
+      // The data first, an index must not claim ranges that are not on disk.
+      && fdatasync(mFd) == 0;
+  if (fd >= 0) {
+    ::close(fd);
+  }
+
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (index.generation != mIndexGeneration) {
+    // reset_l() dropped what it describes meanwhile.
+    unlink(tmpPath.c_str());
+    return;
+  }
+  if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+    ALOGW("cannot write %s: %s", path.c_str(), strerror(errno));
+    unlink(tmpPath.c_str());
+    mUnsavedBytes += index.unsavedBytes;  // tried again later
+  }
+}
+
+DiskCacheSource::Stats DiskCacheSource::getStats() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  Stats stats = mStats;
+  stats.cachedBytes = mCachedBytes;
+  return stats;
+}
+
+} // hpc
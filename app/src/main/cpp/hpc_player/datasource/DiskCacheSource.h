@@ -0,0 +1,96 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "DataSource.h"
+
+namespace hpc {
+
+// Persistent cache of a network DataSource in a sparse file. Every range
+// read from the upstream is written at its offset in the file and recorded
+// in a range index kept next to it, |path|.idx; later reads inside a cached
+// range, in this playback or the next one, come from disk. The upstream is
+// only asked for the holes, so a fully cached resource plays without
+// network access.
+//
+// The index holds the resource size and its validator, see
+// DataSource::getValidator(); the holes are asked for with it as If-Range.
+// An upstream that turns out to have another version or size is taken as
+// changed and the cache is dropped.
+//
+// The caches in one directory are kept under a size together, the least
+// recently used are deleted first.
+class DiskCacheSource : public DataSource {
+ public:
+  struct Stats {
+    int64_t diskReads {0};
+    int64_t diskBytes {0};
+    int64_t upstreamReads {0};
+    int64_t upstreamBytes {0};
+    int64_t cachedBytes {0};  // of the resource, in the index
+  };
+
+  static const int64_t kDefaultMaxBytes = 512 * 1024 * 1024;
+
+  // Where |url| is cached under |directory|.
+  static std::string PathFor(const std::string &directory, const std::string &url);
+
+  // The other caches next to |path| are trimmed to |maxBytes| on open, this
+  // one stops growing there.
+  DiskCacheSource(const std::shared_ptr<DataSource> &source, const std::string &path,
+                  int64_t maxBytes = kDefaultMaxBytes);
+  ~DiskCacheSource() override;
+
+  status_t initCheck() const override;
+  ssize_t readAt(int64_t offset, void *data, size_t size) override;
+  status_t getSize(int64_t *size) override;
+  // The upstream's.
+  uint32_t flags() override;
+  void close() override;
+
+  Stats getStats() const;
+
+ private:
+  // The index is written back after this many new bytes, and at the end.
+  static const int64_t kIndexFlushBytes = 1024 * 1024;
+
+  // The index as taken under the lock, written without it.
+  struct Index {
+    int64_t size {-1};
+    std::string validator;
+    std::vector<int64_t> ranges;  // start and end each
+    int64_t unsavedBytes {0};
+    int32_t generation {0};
+  };
+
+  const std::shared_ptr<DataSource> mSource;
+  const std::string mPath;
+  const int64_t mMaxBytes;
+  int mFd {-1};
+
+  mutable std::mutex mLock;
+  int64_t mSize {-1};
+  std::string mValidator;     // of the cached version
+  bool mSizeChecked {false};  // against the upstream's
+  // Cached ranges, start -> end, disjoint and not adjacent.
+  std::map<int64_t, int64_t> mRanges;
+  int64_t mCachedBytes {0};  // in mRanges
+  int64_t mUnsavedBytes {0};
+  int32_t mIndexGeneration {0};  // reset_l() makes an index taken before stale
+  Stats mStats;
+
+  status_t checkSize_l();
+  void checkValidator_l(const std::string &validator);
+  void addRange_l(int64_t start, int64_t end);
+  void reset_l();
+  bool loadIndex_l();
+  bool takeIndex_l(Index *index);
+  void saveIndex(const Index &index);
+  static void Trim(const std::string &directory, int64_t maxBytes, const std::string &keep);
+};
+
+} // hpc
@@ -0,0 +1,75 @@
+#include "FileSource.h"
+#include "Log.h"
+
+#include <cerrno>
+#include <cstring>
+#include <strings.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOG_TAG "FileSource"
+
+namespace hpc {
+
+std::shared_ptr<FileSource> FileSource::Create(const char *uri) {
+  if (strncasecmp(uri, "file://", 7) == 0) {
+    return std::make_shared<FileSource>(uri + 7);
+  }
+  if (uri[0] == '/') {
+    return std::make_shared<FileSource>(uri);
+  }
+  return nullptr;
+}
+
+FileSource::FileSource(const char *path) {
+  mFd = open(path, O_RDONLY | O_CLOEXEC);
+  if (mFd < 0) {
+    ALOGE("failed to open %s: %s", path, strerror(errno));
+    return;
+  }
+  struct stat st;
+  if (fstat(mFd, &st) == 0) {
+    mSize = st.st_size;
+  }
+}
+
+FileSource::~FileSource() {
+  if (mFd >= 0) {
+    ::close(mFd);
+  }
+}
+
+status_t FileSource::initCheck() const {
+  return mFd >= 0 ? OK : NO_INIT;
+}
+
+ssize_t FileSource::readAt(int64_t offset, void *data, size_t size) {
+  if (mFd < 0) {
+    return NO_INIT;
+  }
+  for (;;) {
+    ssize_t n = pread(mFd, data, size, offset);
+    if (n >= 0) {
+      return n;
+    }
+    if (errno != EINTR) {
+      ALOGE("read at %lld failed: %s", (long long)offset, strerror(errno));
+      return ERROR_IO;
+    }
+  }
+}
+
+status_t FileSource::getSize(int64_t *size) {
+  if (mSize < 0) {
+    return ERROR_UNSUPPORTED;
+  }
+  *size = mSize;
+  return OK;
+}
+
+uint32_t FileSource::flags() {
+  return kIsLocalFileSource;
+}
+
+} // hpc
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "DataSource.h"
+
+namespace hpc {
+
+// A local file, read with pread() so that no file position is shared.
+class FileSource : public DataSource {
+ public:
+  // A source for |uri| if it names a local file, a path or file://,
+  // nullptr for any other scheme. initCheck() tells whether it opened.
+  static std::shared_ptr<FileSource> Create(const char *uri);
+
+  explicit FileSource(const char *path);
+  ~FileSource() override;
+
+  status_t initCheck() const override;
+  ssize_t readAt(int64_t offset, void *data, size_t size) override;
+  status_t getSize(int64_t *size) override;
+  uint32_t flags() override;
+
+ private:
+  int mFd {-1};
+  int64_t mSize {-1};
+};
+
+} // hpc
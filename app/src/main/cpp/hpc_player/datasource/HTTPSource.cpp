@@ -0,0 +1,467 @@
+#include "HTTPSource.h"
+#include "Log.h"
+#include "Looper.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define LOG_TAG "HTTPSource"
+
+namespace hpc {
+
+namespace {
+
+const int kMaxRedirects = 5;
+const size_t kMaxHeaderBytes = 64 * 1024;
+const int kSocketTimeoutS = 15;
+
+// Value of header |name| in |headers|, empty if there is none.
+std::string headerValue(const std::string &headers, const char *name) {
+  const size_t length = strlen(name);
+  size_t pos = headers.find("\r\n");
+  while (pos != std::string::npos && pos + 2 < headers.size()) {
+    const size_t line = pos + 2;
+    pos = headers.find("\r\n", line);
+    if (strncasecmp(headers.c_str() + line, name, length) != 0
+        || headers[line + length] != ':') {
+      continue;
+    }
+    size_t value = line + length + 1;
+    while (value < headers.size() && headers[value] == ' ') {
+      ++value;
+    }
+    return headers.substr(value, (pos == std::string::npos ? headers.size() : pos) - value);
+  }
+  return std::string();
+}
+
+} // namespace
+
+HTTPSource::HTTPSource(const char *url) {
+  if (!parseUrl(url)) {
+    ALOGE("unsupported url %s", url);
+    mInitCheck = ERROR_UNSUPPORTED;
+  }
+}
+
+HTTPSource::~HTTPSource() {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  disconnect_l();
+}
+
+bool HTTPSource::IsSupported(const char *url) {
+  return strncasecmp(url, "http://", 7) == 0;
+}
+
+status_t HTTPSource::setUrl(const char *url) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  const int64_t remaining = mBodyEnd - mBodyOffset;
+  if (mSocket >= 0 && (!mKeepAlive
+      || (remaining > 0 && (remaining > kDrainBytes || skip_l(remaining) != OK)))) {
+    disconnect_l();
+  }
+  const std::string host = mHost;
+  const std::string port = mPort;
+  mInitCheck = parseUrl(url) ? (status_t)OK : ERROR_UNSUPPORTED;
+  if (mHost != host || mPort != port) {
+    disconnect_l();
+  }
+  mSize = -1;
+  mValidator.clear();
+  mIfRange.clear();
+  mBodyOffset = mBodyEnd = 0;
+  return mInitCheck;
+}
+
+bool HTTPSource::parseUrl(const std::string &url) {
+  if (!IsSupported(url.c_str())) {
+    return false;
+  }
+  const size_t hostStart = 7;
+  size_t pathStart = url.find('/', hostStart);
+  if (pathStart == std::string::npos) {
+    pathStart = url.size();
+  }
+  std::string authority = url.substr(hostStart, pathStart - hostStart);
+  authority = authority.substr(authority.find('@') + 1);  // no credentials
+  mPath = pathStart < url.size() ? url.substr(pathStart) : "/";
+  mPath = mPath.substr(0, mPath.find('#'));
+
+  size_t portStart = authority.rfind(':');
+  if (portStart != std::string::npos && authority.find(']', portStart) == std::string::npos) {
+    mPort = authority.substr(portStart + 1);
+    authority.resize(portStart);
+  } else {
+    mPort = "80";
+  }
+  if (authority.size() > 2 && authority.front() == '[' && authority.back() == ']') {
+    authority = authority.substr(1, authority.size() - 2);
+  }
+  mHost = authority;
+  return !mHost.empty();
+}
+
+status_t HTTPSource::connect_l() {
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *addresses = nullptr;
+  int ret = getaddrinfo(mHost.c_str(), mPort.c_str(), &hints, &addresses);
+  if (ret != 0) {
+    ALOGE("cannot resolve %s: %s", mHost.c_str(), gai_strerror(ret));
+    return ERROR_IO;
+  }
+
+  int fd = -1;
+  for (struct addrinfo *address = addresses; address != nullptr && !mClosed;
+       address = address->ai_next) {
+    fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    struct timeval timeout = {kSocketTimeoutS, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (::connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+      break;
+    }
+    ::close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addresses);
+  if (fd < 0) {
+    ALOGE("cannot connect to %s:%s: %s", mHost.c_str(), mPort.c_str(), strerror(errno));
+    return ioError();
+  }
+
+  mSocket = fd;
+  if (mClosed) {
+    // close() came in while connecting and did not see the socket.
+    disconnect_l();
+    return DEAD_OBJECT;
+  }
+  mBuffer.clear();
+  mBufferPos = 0;
+  std::lock_guard<std::mutex> autoLock(mStatsLock);
+  ++mStats.connects;
+  return OK;
+}
+
+void HTTPSource::disconnect_l() {
+  const int fd = mSocket.exchange(-1);
+  if (fd >= 0) {
+    ::close(fd);
+  }
+  mBodyOffset = mBodyEnd = 0;
+  mBuffer.clear();
+  mBufferPos = 0;
+}
+
+ssize_t HTTPSource::receive_l(void *data, size_t size) {
+  if (mBufferPos < mBuffer.size()) {
+    const size_t n = std::min(size, mBuffer.size() - mBufferPos);
+    memcpy(data, &mBuffer[mBufferPos], n);
+    mBufferPos += n;
+    return n;
+  }
+  for (;;) {
+    ssize_t n = recv(mSocket, data, size, 0);
+    if (n >= 0) {
+      return n;
+    }
+    if (errno != EINTR) {
+      return ioError();
+    }
+  }
+}
+
+status_t HTTPSource::readHeaders_l(std::string *headers) {
+  mBuffer.erase(mBuffer.begin(), mBuffer.begin() + mBufferPos);
+  mBufferPos = 0;
+  static const char kEnd[] = "\r\n\r\n";
+  for (;;) {
+    auto end = std::search(mBuffer.begin(), mBuffer.end(), kEnd, kEnd + 4);
+    if (end != mBuffer.end()) {
+      headers->assign(mBuffer.begin(), end + 2);
+      mBufferPos = end + 4 - mBuffer.begin();
+      return OK;
+    }
+    if (mBuffer.size() >= kMaxHeaderBytes) {
+      return ERROR_MALFORMED;
+    }
+    const size_t size = mBuffer.size();
+    mBuffer.resize(size + 4096);
+    ssize_t n = recv(mSocket, &mBuffer[size], 4096, 0);
+    if (n < 0 && errno == EINTR) {
+      n = 0;
+    } else if (n <= 0) {
+      mBuffer.resize(size);
+      return ioError();
+    }
+    mBuffer.resize(size + n);
+  }
+}
+
+status_t HTTPSource::skip_l(int64_t bytes) {
+  uint8_t scratch[16 * 1024];
+  while (bytes > 0) {
+    ssize_t n = receive_l(scratch, (size_t)std::min<int64_t>(bytes, sizeof(scratch)));
+    if (n <= 0) {
+      return n < 0 ? (status_t)n : ERROR_IO;
+    }
+    bytes -= n;
+    mBodyOffset += n;
+    std::lock_guard<std::mutex> autoLock(mStatsLock);
+    mStats.bytesFetched += n;
+  }
+  return OK;
+}
+
+// Sends a request for the range at |offset| and reads the response headers,
+// the body is left for readAt().
+status_t HTTPSource::request_l(int64_t offset) {
+  const int64_t startUs = Looper::GetNowUs();
+  for (int redirects = 0; redirects <= kMaxRedirects;) {
+    // An idle keep-alive connection may have been closed by the server in
+    // the meantime, a reused one gets a second chance on a new connection.
+    const bool reused = mSocket >= 0;
+    if (!reused) {
+      status_t err = connect_l();
+      if (err != OK) {
+        return err;
+      }
+    }
+
+    char range[64];
+    snprintf(range, sizeof(range), "bytes=%lld-%lld",
+             (long long)offset, (long long)(offset + kRangeBytes - 1));
+    std::string request = "GET " + mPath + " HTTP/1.1\r\n"
+        + "Host: " + mHost + (mPort == "80" ? "" : ":" + mPort) + "\r\n"
+        + "Range: " + range + "\r\n"
+        + (mIfRange.empty() ? "" : "If-Range: " + mIfRange + "\r\n")
+        + "Connection: keep-alive\r\n"
+        + "Accept-Encoding: identity\r\n"
+        + "User-Agent: HpcPlayer\r\n\r\n";
+    std::string headers;
+    status_t err = send(mSocket, request.data(), request.size(), MSG_NOSIGNAL)
+        == (ssize_t)request.size() ? readHeaders_l(&headers) : ERROR_IO;
+    if (err != OK) {
+      disconnect_l();
+      if (reused && !mClosed) {
+        continue;
+      }
+      return mClosed ? DEAD_OBJECT : err;
+    }
+
+    int major = 0, minor = 0, status = 0;
+    if (sscanf(headers.c_str(), "HTTP/%d.%d %d", &major, &minor, &status) != 3) {
+      disconnect_l();
+      return ERROR_MALFORMED;
+    }
+    const std::string connection = headerValue(headers, "Connection");
+    mKeepAlive = (major == 1 && minor >= 1)
+        ? strcasecmp(connection.c_str(), "close") != 0
+        : strcasecmp(connection.c_str(), "keep-alive") == 0;
+    const std::string contentLength = headerValue(headers, "Content-Length");
+    const int64_t length = contentLength.empty() ? -1 : strtoll(contentLength.c_str(), nullptr, 10);
+    if (strcasecmp(headerValue(headers, "Transfer-Encoding").c_str(), "chunked") == 0) {
+      ALOGE("chunked responses are not supported");
+      disconnect_l();
+      return ERROR_UNSUPPORTED;
+    }
+    {
+      std::lock_guard<std::mutex> autoLock(mStatsLock);
+      if (mStats.requests++ == 0) {
+        mStats.connectUs = Looper::GetNowUs() - startUs;
+      }
+    }
+
+    const std::string location = headerValue(headers, "Location");
+    if (status >= 300 && status < 400 && !location.empty()) {
+      ++redirects;
+      const std::string host = mHost, port = mPort;
+      if (location[0] == '/') {
+        mPath = location;
+      } else if (!parseUrl(location)) {
+        ALOGE("unsupported redirect to %s", location.c_str());
+        disconnect_l();
+        return ERROR_UNSUPPORTED;
+      }
+      mBodyOffset = 0;
+      mBodyEnd = std::max<int64_t>(length, 0);
+      if (host != mHost || port != mPort || !mKeepAlive || length < 0
+          || skip_l(mBodyEnd) != OK) {
+        disconnect_l();
+      }
+      continue;
+    }
+
+    if (status == 200 || status == 206) {
+      // Weak ETags cannot validate a range.
+      const std::string etag = headerValue(headers, "ETag");
+      mValidator = !etag.empty() && etag.compare(0, 2, "W/") != 0
+          ? etag : headerValue(headers, "Last-Modified");
+    }
+    if (status == 206) {
+      long long first = 0, last = 0;
+      char total[32] = {};
+      if (sscanf(headerValue(headers, "Content-Range").c_str(), "bytes %lld-%lld/%31s",
+                 &first, &last, total) < 2) {
+        disconnect_l();
+        return ERROR_MALFORMED;
+      }
+      mBodyOffset = first;
+      mBodyEnd = last + 1;
+      if (total[0] != '*' && total[0] != '\0') {
+        mSize = strtoll(total, nullptr, 10);
+      }
+      return OK;
+    }
+    if (status == 200) {
+      // No range support, or another version than If-Range asked for: the
+      // whole resource comes.
+      mBodyOffset = 0;
+      mBodyEnd = length >= 0 ? length : INT64_MAX;
+      if (length >= 0) {
+        mSize = length;
+      } else {
+        mKeepAlive = false;
+      }
+      return offset > 0 ? skip_l(offset) : OK;
+    }
+    if (status == 416) {
+      long long total = -1;
+      if (sscanf(headerValue(headers, "Content-Range").c_str(), "bytes */%lld", &total) == 1) {
+        mSize = total;
+      }
+      mBodyOffset = 0;
+      mBodyEnd = std::max<int64_t>(length, 0);
+      if (!mKeepAlive || skip_l(mBodyEnd) != OK) {
+        disconnect_l();
+      }
+      return ERROR_END_OF_STREAM;
+    }
+    ALOGE("%s:%s%s: HTTP %d", mHost.c_str(), mPort.c_str(), mPath.c_str(), status);
+    disconnect_l();
+    return ERROR_IO;
+  }
+  ALOGE("too many redirects");
+  return ERROR_IO;
+}
+
+status_t HTTPSource::initCheck() const {
+  // Connecting is left to the first read.
+  return mInitCheck;
+}
+
+ssize_t HTTPSource::readAt(int64_t offset, void *data, size_t size) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (mInitCheck != OK) {
+    return mInitCheck;
+  }
+  if (mSize >= 0 && offset >= mSize) {
+    return 0;
+  }
+
+  // A dropped connection is opened again once, anything else is an error.
+  for (int attempt = 0; attempt < 2 && !mClosed; ++attempt) {
+    const bool inFlight = mSocket >= 0 && mBodyOffset < mBodyEnd;
+    const int64_t remaining = mBodyEnd - mBodyOffset;
+    status_t err = OK;
+    if (inFlight && offset >= mBodyOffset && offset < mBodyEnd
+        && offset - mBodyOffset <= kDrainBytes) {
+      err = skip_l(offset - mBodyOffset);
+    } else {
+      if (inFlight && (!mKeepAlive || remaining > kDrainBytes || skip_l(remaining) != OK)) {
+        disconnect_l();
+      } else if (!mKeepAlive) {
+        disconnect_l();
+      }
+      err = request_l(offset);
+    }
+    if (err == ERROR_END_OF_STREAM) {
+      return 0;
+    }
+    if (err != OK) {
+      disconnect_l();
+      if (err == ERROR_IO) {
+        continue;
+      }
+      return err;
+    }
+
+    ssize_t n = receive_l(data, (size_t)std::min<int64_t>(size, mBodyEnd - mBodyOffset));
+    if (n > 0) {
+      mBodyOffset += n;
+      if (mBodyOffset == mBodyEnd && !mKeepAlive) {
+        disconnect_l();
+      }
+      std::lock_guard<std::mutex> statsLock(mStatsLock);
+      mStats.bytesFetched += n;
+      return n;
+    }
+    ALOGW("read at %lld failed: %zd, reconnecting", (long long)offset, n);
+    disconnect_l();
+  }
+  return ioError();
+}
+
+status_t HTTPSource::getSize(int64_t *size) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (mInitCheck != OK) {
+    return mInitCheck;
+  }
+  if (mSize < 0 && (mSocket < 0 || mBodyOffset >= mBodyEnd)) {
+    // The first range of the resource, readAt(0) picks its body up.
+    status_t err = request_l(0);
+    if (err != OK && err != ERROR_END_OF_STREAM) {
+      return err;
+    }
+  }
+  if (mSize < 0) {
+    return ERROR_UNSUPPORTED;
+  }
+  *size = mSize;
+  return OK;
+}
+
+uint32_t HTTPSource::flags() {
+  return kWantsPrefetching | kIsHTTPBasedSource;
+}
+
+std::string HTTPSource::getValidator() {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  return mValidator;
+}
+
+void HTTPSource::setIfRange(const std::string &validator) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mIfRange = validator;
+}
+
+void HTTPSource::close() {
+  mClosed = true;
+  const int fd = mSocket;
+  if (fd >= 0) {
+    shutdown(fd, SHUT_RDWR);
+  }
+}
+
+HTTPSource::Stats HTTPSource::getStats() const {
+  std::lock_guard<std::mutex> autoLock(mStatsLock);
+  return mStats;
+}
+
+} // hpc
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "DataSource.h"
+
+namespace hpc {
+
+// An http:// resource read with range requests over one keep-alive
+// connection. Reads ask for bounded ranges, kRangeBytes at a time, so a
+// response can be read or drained to its end and the next request goes out
+// on the same connection; a seek far into a response in flight is the only
+// thing that reconnects. Redirects are followed.
+//
+// Nothing is sent before the first read or getSize(), so a source that is
+// fully served from a cache never touches the network.
+class HTTPSource : public DataSource {
+ public:
+  struct Stats {
+    int64_t connects {0};
+    int64_t requests {0};
+    int64_t bytesFetched {0};  // response bodies, drained bytes included
+    int64_t connectUs {0};     // until the first response headers
+  };
+
+  // Bytes asked for by one request.
+  static const int64_t kRangeBytes = 2 * 1024 * 1024;
+  // What is left of a response is read and dropped rather than closing the
+  // connection, up to this much. A seek forward within it skips ahead.
+  static const int64_t kDrainBytes = 256 * 1024;
+
+  explicit HTTPSource(const char *url);
+  ~HTTPSource() override;
+
+  // Whether |url| is one HTTPSource reads.
+  static bool IsSupported(const char *url);
+
+  // Reads |url| from now on. The connection is kept for another url on the
+  // same server, e.g. the next segment of a stream.
+  status_t setUrl(const char *url);
+
+  status_t initCheck() const override;
+  ssize_t readAt(int64_t offset, void *data, size_t size) override;
+  status_t getSize(int64_t *size) override;
+  uint32_t flags() override;
+  // The strong ETag of the last response, else its Last-Modified.
+  std::string getValidator() override;
+  void setIfRange(const std::string &validator) override;
+  void close() override;
+
+  Stats getStats() const;
+
+ private:
+  std::string mHost;
+  std::string mPort;
+  std::string mPath;
+  status_t mInitCheck {OK};
+  // A blocked read returns once close() shut the socket down.
+  std::atomic<int> mSocket {-1};
+  std::atomic<bool> mClosed {false};
+
+  // Held across network I/O: getSize() may come from another thread than
+  // readAt() and waits for it.
+  mutable std::mutex mLock;
+  int64_t mSize {-1};
+  std::string mValidator;
+  std::string mIfRange;  // sent with every request unless empty
+  bool mKeepAlive {false};
+  // The body of the response in flight, [mBodyOffset, mBodyEnd) of the
+  // resource; mBodyOffset moves on as it is read.
+  int64_t mBodyOffset {0};
+  int64_t mBodyEnd {0};
+  // Received but not consumed, the headers end in it.
+  std::vector<uint8_t> mBuffer;
+  size_t mBufferPos {0};
+
+  mutable std::mutex mStatsLock;
+  Stats mStats;
+
+  bool parseUrl(const std::string &url);
+  status_t connect_l();
+  void disconnect_l();
+  status_t request_l(int64_t offset);
+  status_t readHeaders_l(std::string *headers);
+  ssize_t receive_l(void *data, size_t size);
+  status_t skip_l(int64_t bytes);
+  // A failed socket call was close() or the network.
+  status_t ioError() const { return mClosed ? (status_t)DEAD_OBJECT : (status_t)ERROR_IO; }
+};
+
+} // hpc
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "DataSource.h"
+
+namespace hpc {
+
+// Bytes already in memory, e.g. a downloaded HLS segment handed to the
+// demuxer.
+class MemorySource : public DataSource {
+ public:
+  explicit MemorySource(std::vector<uint8_t> data) : mData(std::move(data)) {}
+
+  status_t initCheck() const override { return OK; }
+
+  ssize_t readAt(int64_t offset, void *data, size_t size) override {
+    if (offset < 0) {
+      return ERROR_IO;
+    }
+    if (offset >= (int64_t)mData.size()) {
+      return 0;
+    }
+    const size_t n = std::min(size, mData.size() - (size_t)offset);
+    memcpy(data, &mData[offset], n);
+    return n;
+  }
+
+  status_t getSize(int64_t *size) override {
+    *size = mData.size();
+    return OK;
+  }
+
+ private:
+  const std::vector<uint8_t> mData;
+};
+
+} // hpc
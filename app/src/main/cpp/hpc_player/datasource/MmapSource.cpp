@@ -0,0 +1,174 @@
+#include "MmapSource.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <strings.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern "C" {
+#include "libavutil/buffer.h"
+}
+
+#define LOG_TAG "MmapSource"
+
+namespace hpc {
+
+// Beyond this a 32-bit process is unlikely to find the address space in
+// one piece; FileSource reads such files.
+static const uint64_t kMaxMapBytes32 = 1024ULL * 1024 * 1024;
+
+MmapSource::Mapping::~Mapping() {
+  if (data != nullptr) {
+    munmap(data, size);
+  }
+}
+
+std::shared_ptr<MmapSource> MmapSource::Create(const char *uri) {
+  if (strncasecmp(uri, "file://", 7) == 0) {
+    return std::make_shared<MmapSource>(uri + 7);
+  }
+  if (uri[0] == '/') {
+    return std::make_shared<MmapSource>(uri);
+  }
+  return nullptr;
+}
+
+MmapSource::MmapSource(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    ALOGE("failed to open %s: %s", path, strerror(errno));
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0
+      || (sizeof(void *) < 8 && (uint64_t)st.st_size > kMaxMapBytes32)) {
+    ALOGW("not mapping %s", path);
+    ::close(fd);
+    return;
+  }
+  void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping holds its own reference to the file.
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    ALOGW("failed to map %s: %s", path, strerror(errno));
+    return;
+  }
+  mMapping = std::make_shared<Mapping>();
+  mMapping->data = (uint8_t *)data;
+  mMapping->size = st.st_size;
+  if (madvise(data, st.st_size, MADV_SEQUENTIAL) != 0) {
+    ALOGW("madvise(MADV_SEQUENTIAL) failed: %s", strerror(errno));
+  }
+}
+
+MmapSource::~MmapSource() = default;
+
+status_t MmapSource::initCheck() const {
+  return mMapping != nullptr ? OK : NO_INIT;
+}
+
+ssize_t MmapSource::readAt(int64_t offset, void *data, size_t size) {
+  if (mMapping == nullptr) {
+    return NO_INIT;
+  }
+  if (offset < 0) {
+    return BAD_VALUE;
+  }
+  if ((uint64_t)offset >= mMapping->size) {
+    return 0;
+  }
+  size = std::min<uint64_t>(size, mMapping->size - offset);
+  adviseReadAhead(offset, size);
+  memcpy(data, mMapping->data + offset, size);
+
+  std::lock_guard<std::mutex> autoLock(mLock);
+  ++mStats.reads;
+  mStats.bytesCopied += size;
+  return size;
+}
+
+// MADV_SEQUENTIAL alone does not survive a seek well; the window the
+// reader is in, and the one after it, are asked for explicitly whenever
+// it leaves the last one asked for or gets close to its end.
+void MmapSource::adviseReadAhead(int64_t offset, size_t size) {
+  const int64_t end = offset + size;
+  if (offset >= mAdviseStart && end + kReadAheadBytes / 2 <= mAdviseEnd) {
+    return;
+  }
+  // madvise() wants a page aligned start; the window is kept in whole
+  // pages, the mapping covers the last one of the file whole too.
+  static const int64_t pageSize = sysconf(_SC_PAGESIZE);
+  const int64_t pageStart = offset / pageSize * pageSize;
+  // pages before the reader may have been dropped, a read back there
+  // starts a window of its own.
+  const int64_t start = offset >= mAdviseStart && offset < mAdviseEnd ? mAdviseEnd : pageStart;
+  const int64_t adviseEnd =
+      (std::min<int64_t>(end + kReadAheadBytes, mMapping->size) + pageSize - 1) / pageSize * pageSize;
+  if (adviseEnd <= start) {
+    return;
+  }
+  if (madvise(mMapping->data + start, adviseEnd - start, MADV_WILLNEED) != 0) {
+    ALOGW("madvise(MADV_WILLNEED) failed: %s", strerror(errno));
+  }
+  mAdviseStart = pageStart;
+  mAdviseEnd = adviseEnd;
+
+  std::lock_guard<std::mutex> autoLock(mLock);
+  ++mStats.readAheads;
+}
+
+status_t MmapSource::getSize(int64_t *size) {
+  if (mMapping == nullptr) {
+    return NO_INIT;
+  }
+  *size = mMapping->size;
+  return OK;
+}
+
+uint32_t MmapSource::flags() {
+  return kIsLocalFileSource | kIsMemoryMapped;
+}
+
+const uint8_t *MmapSource::data() const {
+  return mMapping != nullptr ? mMapping->data : nullptr;
+}
+
+int64_t MmapSource::size() const {
+  return mMapping != nullptr ? mMapping->size : 0;
+}
+
+AVBufferRef *MmapSource::acquire(int64_t offset, size_t size) {
+  if (mMapping == nullptr || offset < 0 || (uint64_t)offset > mMapping->size
+      || size > mMapping->size - offset || size > INT_MAX) {
+    return nullptr;
+  }
+  // every buffer holds a reference to the mapping of its own.
+  std::shared_ptr<Mapping> *owner = new std::shared_ptr<Mapping>(mMapping);
+  AVBufferRef *buffer = av_buffer_create(mMapping->data + offset, size, ReleaseBuffer,
+                                         owner, AV_BUFFER_FLAG_READONLY);
+  if (buffer == nullptr) {
+    delete owner;
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> autoLock(mLock);
+  ++mStats.buffersAcquired;
+  mStats.bytesAcquired += size;
+  return buffer;
+}
+
+void MmapSource::ReleaseBuffer(void *opaque, uint8_t * /* data */) {
+  delete static_cast<std::shared_ptr<Mapping> *>(opaque);
+}
+
+MmapSource::Stats MmapSource::getStats() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  return mStats;
+}
+
+} // hpc
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+
+#include "DataSource.h"
+
+struct AVBufferRef;
+
+namespace hpc {
+
+// A local file mapped read-only into memory. A read is a memcpy out of the
+// page cache instead of a read() into a buffer of the caller's, and
+// acquire() hands out a range of the file as an AVBufferRef without
+// copying at all, for demuxers that find their samples themselves.
+//
+// The kernel is told that the file is read sequentially and, a window at a
+// time, which pages are about to be read, so it reads ahead like for
+// read() and drops what is behind. A file truncated while mapped faults
+// the reader with SIGBUS; media files being played are not expected to
+// change.
+class MmapSource : public DataSource {
+ public:
+  struct Stats {
+    int64_t reads {0};
+    int64_t bytesCopied {0};     // by readAt()
+    int64_t buffersAcquired {0};
+    int64_t bytesAcquired {0};   // referenced, not copied
+    int64_t readAheads {0};      // MADV_WILLNEED windows
+  };
+
+  // Pages asked for ahead of the reader at a time.
+  static const int64_t kReadAheadBytes = 4 * 1024 * 1024;
+
+  // A source for |uri| if it names a local file, a path or file://,
+  // nullptr for any other scheme. initCheck() tells whether it mapped; it
+  // fails where FileSource works, e.g. for a file larger than the address
+  // space of a 32-bit process, so have that to fall back to.
+  static std::shared_ptr<MmapSource> Create(const char *uri);
+
+  explicit MmapSource(const char *path);
+  ~MmapSource() override;
+
+  status_t initCheck() const override;
+  ssize_t readAt(int64_t offset, void *data, size_t size) override;
+  status_t getSize(int64_t *size) override;
+  uint32_t flags() override;
+
+  // The whole file, valid as long as the source.
+  const uint8_t *data() const;
+  int64_t size() const;
+
+  // A read-only reference to [offset, offset + size), which keeps the
+  // mapping alive after the source is gone. nullptr if the range is not in
+  // the file or no reference could be allocated.
+  AVBufferRef *acquire(int64_t offset, size_t size);
+
+  Stats getStats() const;
+
+ private:
+  // Unmapped by whoever lets go of it last, the source or a buffer.
+  struct Mapping {
+    uint8_t *data {nullptr};
+    size_t size {0};
+    ~Mapping();
+  };
+
+  std::shared_ptr<Mapping> mMapping;
+  // [mAdviseStart, mAdviseEnd) is the read-ahead window last asked for.
+  int64_t mAdviseStart {0};
+  int64_t mAdviseEnd {0};
+
+  mutable std::mutex mLock;  // for mStats
+  Stats mStats;
+
+  void adviseReadAhead(int64_t offset, size_t size);
+  static void ReleaseBuffer(void *opaque, uint8_t *data);
+};
+
+} // hpc
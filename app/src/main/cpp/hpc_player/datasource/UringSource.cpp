@@ -0,0 +1,430 @@
+#include "UringSource.h"
+#include "Log.h"
+#include "Looper.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <strings.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define LOG_TAG "UringSource"
+
+namespace hpc {
+
+// liburing is not part of the NDK, the two system calls are all it takes.
+static int ioUringSetup(unsigned entries, struct io_uring_params *params) {
+#ifdef __NR_io_uring_setup
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+static int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+#ifdef __NR_io_uring_enter
+  int ret;
+  do {
+    ret = (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+  } while (ret < 0 && errno == EINTR);
+  return ret;
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+// user_data of the poll on mWakeFd, that of a read is its chunk's index.
+static const uint64_t kWakeUserData = ~0ULL;
+
+// The submission and completion queues shared with the kernel.
+struct UringSource::Ring {
+  int fd {-1};
+  void *sqMap {MAP_FAILED};
+  size_t sqMapSize {0};
+  void *cqMap {MAP_FAILED};
+  size_t cqMapSize {0};
+  struct io_uring_sqe *sqes {(struct io_uring_sqe *)MAP_FAILED};
+  size_t sqesSize {0};
+  unsigned *sqTail {nullptr};
+  unsigned *sqMask {nullptr};
+  unsigned *sqArray {nullptr};
+  unsigned *cqHead {nullptr};
+  unsigned *cqTail {nullptr};
+  unsigned *cqMask {nullptr};
+  struct io_uring_cqe *cqes {nullptr};
+
+  // The next entry, cleared; submit() hands it to the kernel.
+  struct io_uring_sqe *nextSqe() {
+    struct io_uring_sqe *sqe = &sqes[*sqTail & *sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+  }
+
+  // Only the reader moves the tail; at most depth reads and the poll are in
+  // flight, and the kernel takes each entry as it is submitted.
+  bool submit() {
+    const unsigned tail = *sqTail;
+    const unsigned index = tail & *sqMask;
+    sqArray[index] = index;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    if (ioUringEnter(fd, 1, 0, 0) != 1) {
+      ALOGW("io_uring_enter failed: %s", strerror(errno));
+      return false;
+    }
+    return true;
+  }
+
+  ~Ring() {
+    if (sqes != MAP_FAILED) {
+      munmap(sqes, sqesSize);
+    }
+    if (cqMap != MAP_FAILED && cqMap != sqMap) {
+      munmap(cqMap, cqMapSize);
+    }
+    if (sqMap != MAP_FAILED) {
+      munmap(sqMap, sqMapSize);
+    }
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+};
+
+std::shared_ptr<UringSource> UringSource::Create(const char *uri) {
+  if (strncasecmp(uri, "file://", 7) == 0) {
+    return std::make_shared<UringSource>(uri + 7);
+  }
+  if (uri[0] == '/') {
+    return std::make_shared<UringSource>(uri);
+  }
+  return nullptr;
+}
+
+UringSource::UringSource(const char *path)
+    : UringSource(path, Config()) {}
+
+UringSource::UringSource(const char *path, const Config &config)
+    : mConfig(config) {
+  mConfig.chunkSize = std::max<size_t>(mConfig.chunkSize, 4096);
+  mConfig.depth = std::max<size_t>(mConfig.depth, 1);
+  mFd = open(path, O_RDONLY | O_CLOEXEC);
+  if (mFd < 0) {
+    ALOGE("failed to open %s: %s", path, strerror(errno));
+    return;
+  }
+  struct stat st;
+  if (fstat(mFd, &st) == 0) {
+    mSize = st.st_size;
+  }
+  setUpRing();
+}
+
+UringSource::~UringSource() {
+  // The kernel may still be writing into the chunks.
+  drain();
+  mRing.reset();
+  if (mWakeFd >= 0) {
+    ::close(mWakeFd);
+  }
+  if (mFd >= 0) {
+    ::close(mFd);
+  }
+}
+
+void UringSource::setUpRing() {
+  if (mSize < 0) {
+    return;
+  }
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  const int fd = ioUringSetup(mConfig.depth, &params);
+  if (fd < 0) {
+    ALOGI("no io_uring (%s), reading with pread", strerror(errno));
+    return;
+  }
+  std::unique_ptr<Ring> ring = std::make_unique<Ring>();
+  ring->fd = fd;
+  ring->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (singleMap) {
+    ring->sqMapSize = ring->cqMapSize = std::max(ring->sqMapSize, ring->cqMapSize);
+  }
+  ring->sqMap = mmap(nullptr, ring->sqMapSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (ring->sqMap == MAP_FAILED) {
+    ALOGW("failed to map the submission queue: %s", strerror(errno));
+    return;
+  }
+  ring->cqMap = singleMap ? ring->sqMap
+      : mmap(nullptr, ring->cqMapSize, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe *)mmap(nullptr, ring->sqesSize, PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (ring->cqMap == MAP_FAILED || ring->sqes == MAP_FAILED) {
+    ALOGW("failed to map the completion queue: %s", strerror(errno));
+    return;
+  }
+  uint8_t *sq = (uint8_t *)ring->sqMap;
+  ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+  uint8_t *cq = (uint8_t *)ring->cqMap;
+  ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+  ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  mChunks.resize(mConfig.depth);
+  for (Chunk &chunk : mChunks) {
+    chunk.data.resize(mConfig.chunkSize);
+  }
+  mRing = std::move(ring);
+
+  mWakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (mWakeFd < 0 || !armWake()) {
+    ALOGW("close() cannot wake a read: %s", strerror(errno));
+  }
+}
+
+bool UringSource::armWake() {
+  struct io_uring_sqe *sqe = mRing->nextSqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = mWakeFd;
+  sqe->poll_events = POLLIN;
+  sqe->user_data = kWakeUserData;
+  return mRing->submit();
+}
+
+status_t UringSource::initCheck() const {
+  return mFd >= 0 ? OK : NO_INIT;
+}
+
+status_t UringSource::getSize(int64_t *size) {
+  if (mSize < 0) {
+    return ERROR_UNSUPPORTED;
+  }
+  *size = mSize;
+  return OK;
+}
+
+uint32_t UringSource::flags() {
+  return kIsLocalFileSource;
+}
+
+// A readAt() waiting for a read in flight returns DEAD_OBJECT.
+void UringSource::close() {
+  mClosed = true;
+  if (mWakeFd >= 0) {
+    eventfd_write(mWakeFd, 1);
+  }
+}
+
+UringSource::Chunk *UringSource::findChunk(int64_t offset) {
+  for (Chunk &chunk : mChunks) {
+    if (chunk.offset >= 0 && !chunk.stale && offset >= chunk.offset
+        && offset < chunk.offset + (int64_t)mConfig.chunkSize) {
+      return &chunk;
+    }
+  }
+  return nullptr;
+}
+
+bool UringSource::submit(Chunk *chunk) {
+  struct io_uring_sqe *sqe = mRing->nextSqe();
+  chunk->iov.iov_base = chunk->data.data();
+  chunk->iov.iov_len = std::min<int64_t>(mConfig.chunkSize, mSize - chunk->offset);
+  // READV rather than READ, which needs 5.6.
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = mFd;
+  sqe->off = chunk->offset;
+  sqe->addr = (uint64_t)(uintptr_t)&chunk->iov;
+  sqe->len = 1;
+  sqe->user_data = chunk - mChunks.data();
+  if (!mRing->submit()) {
+    return false;
+  }
+  chunk->inFlight = true;
+  chunk->stale = false;
+  std::lock_guard<std::mutex> autoLock(mLock);
+  ++mStats.submitted;
+  return true;
+}
+
+status_t UringSource::reap(bool wait) {
+  Ring &ring = *mRing;
+  if (wait && ioUringEnter(ring.fd, 0, 1, IORING_ENTER_GETEVENTS) < 0) {
+    ALOGW("waiting for a read failed: %s", strerror(errno));
+    return ERROR_IO;
+  }
+  unsigned head = *ring.cqHead;
+  const unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+  int64_t dropped = 0;
+  for (; head != tail; ++head) {
+    const struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cqMask];
+    if (cqe->user_data == kWakeUserData) {
+      continue;  // close(), the reader checks mClosed
+    }
+    Chunk &chunk = mChunks[cqe->user_data];
+    chunk.inFlight = false;
+    chunk.result = cqe->res;
+    if (chunk.stale) {
+      chunk.offset = -1;
+      chunk.stale = false;
+      ++dropped;
+    }
+  }
+  __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+  if (dropped > 0) {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    mStats.dropped += dropped;
+  }
+  return OK;
+}
+
+void UringSource::drain() {
+  if (mRing == nullptr) {
+    return;
+  }
+  for (;;) {
+    const bool inFlight = std::any_of(mChunks.begin(), mChunks.end(),
+                                      [](const Chunk &chunk) { return chunk.inFlight; });
+    if (!inFlight || reap(true /* wait */) != OK) {
+      return;
+    }
+  }
+}
+
+void UringSource::readAhead() {
+  for (Chunk &chunk : mChunks) {
+    if (mNextOffset >= mSize) {
+      return;
+    }
+    if (chunk.offset >= 0) {
+      continue;
+    }
+    chunk.offset = mNextOffset;
+    if (!submit(&chunk)) {
+      // Reads go through pread() from now on.
+      chunk.offset = -1;
+      drain();
+      mRing.reset();
+      return;
+    }
+    mNextOffset += mConfig.chunkSize;
+  }
+}
+
+ssize_t UringSource::readAt(int64_t offset, void *data, size_t size) {
+  if (mFd < 0) {
+    return NO_INIT;
+  }
+  if (mClosed) {
+    return DEAD_OBJECT;
+  }
+  if (offset >= mSize || size == 0) {
+    return 0;
+  }
+  if (mRing == nullptr) {
+    return readSync(offset, data, size);
+  }
+  reap(false /* wait */);
+
+  Chunk *chunk = findChunk(offset);
+  if (chunk == nullptr) {
+    // A seek, or the first read: what is read ahead is for somewhere else.
+    for (Chunk &other : mChunks) {
+      if (other.inFlight) {
+        other.stale = true;
+      } else {
+        other.offset = -1;
+      }
+    }
+    mNextOffset = offset / mConfig.chunkSize * mConfig.chunkSize;
+    readAhead();
+    chunk = mRing != nullptr ? findChunk(offset) : nullptr;
+    if (chunk == nullptr) {
+      // every chunk is still busy with the old position.
+      return readSync(offset, data, size);
+    }
+  }
+
+  int64_t waitStartUs = -1;
+  while (chunk->inFlight) {
+    if (mClosed) {
+      return DEAD_OBJECT;  // the read completes into the chunk, drained later
+    }
+    if (waitStartUs < 0) {
+      waitStartUs = Looper::GetNowUs();
+    }
+    if (reap(true /* wait */) != OK) {
+      return readSync(offset, data, size);
+    }
+  }
+  const int64_t available = chunk->result - (offset - chunk->offset);
+  if (available <= 0) {
+    // an error, or a short read of a file that shrank.
+    if (chunk->result < 0) {
+      ALOGW("read at %lld failed: %s", (long long)chunk->offset, strerror(-chunk->result));
+    }
+    chunk->offset = -1;
+    return readSync(offset, data, size);
+  }
+  const size_t n = std::min<int64_t>(size, available);
+  memcpy(data, chunk->data.data() + (offset - chunk->offset), n);
+
+  // Chunks the reader is past make room for more ahead of it.
+  const int64_t chunkOffset = chunk->offset;
+  for (Chunk &other : mChunks) {
+    if (other.offset >= 0 && !other.inFlight && other.offset < chunkOffset) {
+      other.offset = -1;
+    }
+  }
+  readAhead();
+
+  std::lock_guard<std::mutex> autoLock(mLock);
+  ++mStats.reads;
+  mStats.bytesRead += n;
+  if (waitStartUs < 0) {
+    ++mStats.hits;
+  } else {
+    const int64_t waitUs = Looper::GetNowUs() - waitStartUs;
+    ++mStats.waits;
+    mStats.waitUs += waitUs;
+    mStats.maxWaitUs = std::max(mStats.maxWaitUs, waitUs);
+  }
+  return n;
+}
+
+ssize_t UringSource::readSync(int64_t offset, void *data, size_t size) {
+  ssize_t n;
+  do {
+    n = pread(mFd, data, size, offset);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) {
+    ALOGE("read at %lld failed: %s", (long long)offset, strerror(errno));
+    return ERROR_IO;
+  }
+  std::lock_guard<std::mutex> autoLock(mLock);
+  ++mStats.reads;
+  ++mStats.syncReads;
+  mStats.bytesRead += n;
+  return n;
+}
+
+UringSource::Stats UringSource::getStats() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  return mStats;
+}
+
+} // hpc
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <sys/uio.h>
+
+#include "DataSource.h"
+
+namespace hpc {
+
+// A local file read ahead asynchronously with io_uring. Up to depth reads
+// of chunkSize bytes after the reader's position are in flight at a time
+// and complete straight into the chunks, so the demuxer only waits when
+// storage falls behind it, not on every read like with pread(). There is
+// no thread of its own: the kernel does the reads, readAt() collects them.
+// A read outside the chunks being read, a seek, starts over from there;
+// reads still in flight for the old position are dropped as they complete.
+//
+// Where io_uring is missing or not allowed, kernels before 5.1 and a
+// seccomp policy that filters it, every read is a pread() instead, see
+// isAsync(). readAt() is called from one thread at a time.
+class UringSource : public DataSource {
+ public:
+  struct Config {
+    size_t chunkSize {256 * 1024};
+    size_t depth {8};  // reads in flight at most
+  };
+
+  struct Stats {
+    int64_t reads {0};
+    int64_t hits {0};           // the chunk had arrived
+    int64_t waits {0};          // for a read in flight
+    int64_t waitUs {0};
+    int64_t maxWaitUs {0};
+    int64_t submitted {0};      // chunk reads
+    int64_t dropped {0};        // completed for a position left by a seek
+    int64_t syncReads {0};      // pread(), without io_uring or after an error
+    int64_t bytesRead {0};      // handed to the reader
+  };
+
+  // A source for |uri| if it names a local file, a path or file://,
+  // nullptr for any other scheme. initCheck() tells whether it opened.
+  static std::shared_ptr<UringSource> Create(const char *uri);
+
+  explicit UringSource(const char *path);
+  UringSource(const char *path, const Config &config);
+  ~UringSource() override;
+
+  status_t initCheck() const override;
+  ssize_t readAt(int64_t offset, void *data, size_t size) override;
+  status_t getSize(int64_t *size) override;
+  uint32_t flags() override;
+  void close() override;
+
+  // False if the reads fell back to pread().
+  bool isAsync() const { return mRing != nullptr; }
+
+  Stats getStats() const;
+
+ private:
+  struct Ring;
+
+  struct Chunk {
+    int64_t offset {-1};        // -1 while free
+    std::vector<uint8_t> data;
+    struct iovec iov;
+    bool inFlight {false};
+    bool stale {false};         // freed once its read completes
+    ssize_t result {0};         // bytes read, or -errno
+  };
+
+  Config mConfig;
+  int mFd {-1};
+  int64_t mSize {-1};
+  std::unique_ptr<Ring> mRing;
+  std::vector<Chunk> mChunks;
+  int64_t mNextOffset {0};      // where the next chunk read starts
+  std::atomic<bool> mClosed {false};
+  // Signalled by close(), a poll on it ends a wait for a read.
+  int mWakeFd {-1};
+
+  mutable std::mutex mLock;     // for mStats
+  Stats mStats;
+
+  void setUpRing();
+  Chunk *findChunk(int64_t offset);
+  // Starts reads for free chunks from mNextOffset on.
+  void readAhead();
+  bool submit(Chunk *chunk);
+  bool armWake();
+  // Collects the completed reads, waiting for one first if |wait|.
+  status_t reap(bool wait);
+  void drain();
+  ssize_t readSync(int64_t offset, void *data, size_t size);
+};
+
+} // hpc
@@ -0,0 +1,299 @@
+#include "BitstreamConverter.h"
+#include "Log.h"
+#include "MediaPacket.h"
+
+#include <cstring>
+
+#define LOG_TAG "BitstreamConverter"
+
+namespace hpc {
+
+namespace {
+
+const uint8_t kStartCode[4] = {0, 0, 0, 1};
+
+uint32_t readLength(const uint8_t *p, size_t lengthSize) {
+  uint32_t length = 0;
+  for (size_t i = 0; i < lengthSize; ++i) {
+    length = (length << 8) | p[i];
+  }
+  return length;
+}
+
+void appendNal(std::vector<uint8_t> *csd, const uint8_t *nal, size_t size) {
+  csd->insert(csd->end(), kStartCode, kStartCode + sizeof(kStartCode));
+  csd->insert(csd->end(), nal, nal + size);
+}
+
+bool isAnnexB(const uint8_t *data, size_t size) {
+  return (size >= 3 && data[0] == 0 && data[1] == 0 && data[2] == 1)
+      || (size >= 4 && data[0] == 0 && data[1] == 0 && data[2] == 0 && data[3] == 1);
+}
+
+} // namespace
+
+status_t BitstreamConverter::configure(const std::string &mime, const uint8_t *config,
+                                       size_t size) {
+  if (mime == mMime && size == mConfig.size()
+      && (size == 0 || memcmp(config, mConfig.data(), size) == 0)) {
+    return OK;
+  }
+  mMime = mime;
+  mConfig.assign(config, config + size);
+  mLengthSize = 0;
+  mCsd0.clear();
+  mCsd1.clear();
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    ++mStats.configures;
+  }
+
+  const bool avc = mime == "video/avc";
+  const bool hevc = mime == "video/hevc";
+  status_t err = OK;
+  if (!avc && !hevc) {
+    mCsd0 = mConfig;
+  } else if (size == 0) {
+    // parameter sets in band, packets are Annex-B already
+  } else if (isAnnexB(config, size)) {
+    splitAnnexB(config, size);
+  } else {
+    err = avc ? parseAvcC(config, size) : parseHvcC(config, size);
+  }
+  if (err != OK) {
+    ALOGE("malformed %s configuration, %zu bytes", mime.c_str(), size);
+    mLengthSize = 0;
+    mCsd0.clear();
+    mCsd1.clear();
+    return err;
+  }
+  ALOGV("%s: %zu byte lengths, csd-0 %zu bytes, csd-1 %zu bytes", mime.c_str(), mLengthSize,
+        mCsd0.size(), mCsd1.size());
+  return OK;
+}
+
+// ISO/IEC 14496-15 5.3.3.1 AVCDecoderConfigurationRecord
+status_t BitstreamConverter::parseAvcC(const uint8_t *data, size_t size) {
+  if (size < 7 || data[0] != 1) {
+    return ERROR_MALFORMED;
+  }
+  const size_t lengthSize = (data[4] & 3) + 1;
+  if (lengthSize == 3) {
+    return ERROR_MALFORMED;
+  }
+  size_t offset = 5;
+  for (int set = 0; set < 2; ++set) {
+    if (offset >= size) {
+      return ERROR_MALFORMED;
+    }
+    // five bits of SPS count, a full byte of PPS count
+    const int count = set == 0 ? data[offset] & 0x1f : data[offset];
+    ++offset;
+    for (int i = 0; i < count; ++i) {
+      if (size - offset < 2) {
+        return ERROR_MALFORMED;
+      }
+      const size_t nalSize = readLength(data + offset, 2);
+      offset += 2;
+      if (size - offset < nalSize) {
+        return ERROR_MALFORMED;
+      }
+      appendNal(set == 0 ? &mCsd0 : &mCsd1, data + offset, nalSize);
+      offset += nalSize;
+    }
+  }
+  mLengthSize = lengthSize;
+  return OK;
+}
+
+// ISO/IEC 14496-15 8.3.3.1 HEVCDecoderConfigurationRecord
+status_t BitstreamConverter::parseHvcC(const uint8_t *data, size_t size) {
+  if (size < 23 || data[0] != 1) {
+    return ERROR_MALFORMED;
+  }
+  const size_t lengthSize = (data[21] & 3) + 1;
+  if (lengthSize == 3) {
+    return ERROR_MALFORMED;
+  }
+  const int arrays = data[22];
+  size_t offset = 23;
+  for (int a = 0; a < arrays; ++a) {
+    if (size - offset < 3) {
+      return ERROR_MALFORMED;
+    }
+    const int count = (int)readLength(data + offset + 1, 2);
+    offset += 3;
+    for (int i = 0; i < count; ++i) {
+      if (size - offset < 2) {
+        return ERROR_MALFORMED;
+      }
+      const size_t nalSize = readLength(data + offset, 2);
+      offset += 2;
+      if (size - offset < nalSize) {
+        return ERROR_MALFORMED;
+      }
+      // VPS, SPS, PPS and SEI in the order they came, all in csd-0
+      appendNal(&mCsd0, data + offset, nalSize);
+      offset += nalSize;
+    }
+  }
+  mLengthSize = lengthSize;
+  return OK;
+}
+
+// Extradata in Annex-B, as TS and raw streams have it: packets pass through.
+// For H.264 the PPS go to csd-1, as MediaExtractor hands them out.
+void BitstreamConverter::splitAnnexB(const uint8_t *data, size_t size) {
+  const bool avc = mMime == "video/avc";
+  size_t start = 0;
+  while (start < size) {
+    // skip the start code, then find the next one
+    while (start < size && data[start] == 0) {
+      ++start;
+    }
+    if (start >= size) {
+      break;
+    }
+    ++start;  // the 0x01
+    size_t end = start;
+    while (end + 2 < size && !(data[end] == 0 && data[end + 1] == 0 && data[end + 2] <= 1)) {
+      ++end;
+    }
+    if (end + 2 >= size) {
+      end = size;
+    }
+    if (end > start) {
+      const bool pps = avc && (data[start] & 0x1f) == 8;
+      appendNal(pps ? &mCsd1 : &mCsd0, data + start, end - start);
+    }
+    start = end;
+  }
+}
+
+size_t BitstreamConverter::convertedSize(const uint8_t *data, size_t size) const {
+  if (mLengthSize == 0) {
+    return size;
+  }
+  size_t converted = 0;
+  size_t offset = 0;
+  while (offset < size) {
+    if (size - offset < mLengthSize) {
+      return 0;
+    }
+    const size_t nalSize = readLength(data + offset, mLengthSize);
+    offset += mLengthSize;
+    if (size - offset < nalSize) {
+      return 0;
+    }
+    offset += nalSize;
+    converted += sizeof(kStartCode) + nalSize;
+  }
+  return converted;
+}
+
+status_t BitstreamConverter::convertInPlace(uint8_t *data, size_t size) {
+  if (mLengthSize == 0 || size == 0) {
+    return OK;
+  }
+  if (mLengthSize != sizeof(kStartCode)) {
+    return INVALID_OPERATION;
+  }
+  // All lengths are checked first, a malformed packet is left as it was.
+  if (convertedSize(data, size) != size) {
+    return ERROR_MALFORMED;
+  }
+  size_t offset = 0;
+  while (offset < size) {
+    const size_t nalSize = readLength(data + offset, sizeof(kStartCode));
+    memcpy(data + offset, kStartCode, sizeof(kStartCode));
+    offset += sizeof(kStartCode) + nalSize;
+  }
+  count(size, true);
+  return OK;
+}
+
+status_t BitstreamConverter::convert(const uint8_t *data, size_t size, uint8_t *out,
+                                     size_t capacity, size_t *outSize) {
+  const size_t converted = convertedSize(data, size);
+  if (converted == 0 && size > 0) {
+    return ERROR_MALFORMED;
+  }
+  if (converted > capacity) {
+    return ERROR_BUFFER_FULL;
+  }
+  if (mLengthSize == 0) {
+    memcpy(out, data, size);
+    *outSize = size;
+    return OK;
+  }
+  size_t offset = 0;
+  uint8_t *dst = out;
+  while (offset < size) {
+    const size_t nalSize = readLength(data + offset, mLengthSize);
+    offset += mLengthSize;
+    memcpy(dst, kStartCode, sizeof(kStartCode));
+    memcpy(dst + sizeof(kStartCode), data + offset, nalSize);
+    dst += sizeof(kStartCode) + nalSize;
+    offset += nalSize;
+  }
+  *outSize = converted;
+  count(size, false);
+  return OK;
+}
+
+status_t BitstreamConverter::convert(MediaPacket *packet) {
+  int extradataSize = 0;
+  const uint8_t *extradata = packet->sideData(AV_PKT_DATA_NEW_EXTRADATA, &extradataSize);
+  if (extradata != nullptr && extradataSize > 0) {
+    status_t err = configure(mMime, extradata, extradataSize);
+    if (err != OK) {
+      return err;
+    }
+  }
+  if (mLengthSize == 0 || packet->size() <= 0) {
+    return OK;
+  }
+
+  AVPacket *pkt = packet->avPacket();
+  if (mLengthSize == sizeof(kStartCode) && pkt->buf != nullptr
+      && av_buffer_is_writable(pkt->buf)) {
+    return convertInPlace(pkt->data, pkt->size);
+  }
+
+  // Shorter lengths, or a payload shared with someone else or mapped read
+  // only: into a buffer of its own. Side data, flags and timestamps stay.
+  const size_t converted = convertedSize(pkt->data, pkt->size);
+  if (converted == 0) {
+    return ERROR_MALFORMED;
+  }
+  AVBufferRef *buffer = av_buffer_alloc(converted + AV_INPUT_BUFFER_PADDING_SIZE);
+  if (buffer == nullptr) {
+    return NO_MEMORY;
+  }
+  size_t outSize = 0;
+  status_t err = convert(pkt->data, pkt->size, buffer->data, converted, &outSize);
+  if (err != OK) {
+    av_buffer_unref(&buffer);
+    return err;
+  }
+  memset(buffer->data + outSize, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+  av_buffer_unref(&pkt->buf);
+  pkt->buf = buffer;
+  pkt->data = buffer->data;
+  pkt->size = (int)outSize;
+  return OK;
+}
+
+void BitstreamConverter::count(size_t bytes, bool inPlace) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  ++mStats.packets;
+  mStats.bytes += bytes;
+  ++(inPlace ? mStats.inPlace : mStats.copied);
+}
+
+BitstreamConverter::Stats BitstreamConverter::getStats() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  return mStats;
+}
+
+} // hpc
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Error.h"
+
+namespace hpc {
+
+class MediaPacket;
+
+// Rewrites H.264 and HEVC from the length-prefixed form of MP4 and Matroska
+// (AVCC, HVCC) to the start-code form MediaCodec takes (Annex-B), and takes
+// the parameter sets out of the configuration record for csd-0 and csd-1.
+// Streams in Annex-B already, e.g. from TS, pass through.
+//
+// A start code is as long as a four byte length, the length every muxer
+// but a few old ones writes, so those packets are rewritten in place, only
+// the NAL headers are touched. Shorter lengths make a packet grow, it is
+// converted into a new buffer or straight into the codec's input buffer.
+//
+// The configuration record is parsed once per format: configure() with the
+// record it has is a no-op, a packet carrying new extradata reconfigures.
+class BitstreamConverter {
+ public:
+  struct Stats {
+    int64_t packets {0};
+    int64_t bytes {0};
+    int64_t inPlace {0};      // packets rewritten in their own buffer
+    int64_t copied {0};       // packets converted into another buffer
+    int64_t configures {0};   // configuration records parsed
+  };
+
+  // |config| is Format::csd, i.e. the extradata of the codec parameters:
+  // an avcC or hvcC record, Annex-B parameter sets, or nothing. For other
+  // codecs it goes to csd-0 as it is, e.g. an AudioSpecificConfig.
+  status_t configure(const std::string &mime, const uint8_t *config, size_t size);
+
+  // True if packets go to the codec as they are.
+  bool isPassThrough() const { return mLengthSize == 0; }
+
+  // Annex-B parameter sets. H.264 has its SPS in csd-0 and PPS in csd-1,
+  // HEVC VPS, SPS and PPS all in csd-0. Empty if there are none.
+  const std::vector<uint8_t> &getCsd0() const { return mCsd0; }
+  const std::vector<uint8_t> &getCsd1() const { return mCsd1; }
+
+  // Converts |packet| to Annex-B, in place if it has four byte lengths and
+  // nobody else references its buffer.
+  status_t convert(MediaPacket *packet);
+
+  // Converts |size| bytes at |data| into |out|, e.g. a codec input buffer,
+  // |*outSize| bytes of it. ERROR_BUFFER_FULL if |capacity| is short.
+  status_t convert(const uint8_t *data, size_t size, uint8_t *out, size_t capacity,
+                   size_t *outSize);
+
+  // Rewrites |size| bytes at |data| with four byte lengths in place.
+  status_t convertInPlace(uint8_t *data, size_t size);
+
+  // Bytes |size| bytes at |data| take in Annex-B, 0 if malformed.
+  size_t convertedSize(const uint8_t *data, size_t size) const;
+
+  Stats getStats() const;
+
+ private:
+  std::string mMime;
+  std::vector<uint8_t> mConfig;  // as configured, to tell a new one
+  size_t mLengthSize {0};        // 0 passes through
+  std::vector<uint8_t> mCsd0;
+  std::vector<uint8_t> mCsd1;
+
+  mutable std::mutex mLock;  // for mStats
+  Stats mStats;
+
+  status_t parseAvcC(const uint8_t *data, size_t size);
+  status_t parseHvcC(const uint8_t *data, size_t size);
+  void splitAnnexB(const uint8_t *data, size_t size);
+  void count(size_t bytes, bool inPlace);
+};
+
+} // hpc
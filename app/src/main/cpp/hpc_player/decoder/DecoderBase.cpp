@@ -1,95 +1,68 @@
-
-#define LOG_TAG "DecoderBase"
-
 #include "DecoderBase.h"
 
-#include "NuPlayerRenderer.h"
+#include "Looper.h"
+#include "Log.h"
+#include "MediaPacket.h"
+#include "render/Renderer.h"
+#include "source/Source.h"
 
-#include <foundation/ADebug.h>
-#include <foundation/Message.h>
+extern "C" {
+#include <libavutil/frame.h>
+}
 
+#define LOG_TAG "DecoderBase"
 
 namespace hpc {
 
-DecoderBase::DecoderBase(const std::shared_ptr<Message> &notify)
-    :  mNotify(notify),
-       mBufferGeneration(0),
-       mPaused(false),
-       mStats(std::make_shared<Message>()),
-       mRequestInputBuffersPending(false) {
-  // Every decoder has its own looper because MediaCodec operations
-  // are blocking, but NuPlayer needs asynchronous operations.
-  mDecoderLooper = new Looper;
-  mDecoderLooper->setName("NPDecoder");
-  mDecoderLooper->start(false, false, ANDROID_PRIORITY_AUDIO);
-}
+DecoderBase::DecoderBase() = default;
 
 DecoderBase::~DecoderBase() {
   stopLooper();
 }
 
-static
-status_t PostAndAwaitResponse(
-    const std::shared_ptr<Message> &msg, std::shared_ptr<Message> *response) {
-  status_t err = msg->postAndAwaitResponse(response);
-
-  if (err != OK) {
-    return err;
-  }
-
-  if (!(*response)->findInt32("err", &err)) {
-    err = OK;
+void DecoderBase::configure(const std::shared_ptr<Message> &notify,
+                            const std::shared_ptr<Source> &source,
+                            const std::shared_ptr<Renderer> &renderer,
+                            bool audio) {
+  {
+    std::lock_guard<std::mutex> autoLock(mBindingLock);
+    mBinding.notify = notify;
+    mBinding.source = source;
+    mBinding.renderer = renderer;
+    mBinding.audio = audio;
+    if (mDecoderLooper == nullptr) {
+      // Every decoder has its own looper: a codec call may take a frame
+      // time and must not hold up the player or the other track.
+      mDecoderLooper = std::make_shared<Looper>();
+      mDecoderLooper->setName(audio ? "AudioDecoder" : "VideoDecoder");
+      mDecoderLooper->start(audio ? Looper::PRIORITY_AUDIO : Looper::PRIORITY_DEFAULT);
+      mDecoderLooper->registerHandler(shared_from_this());
+    }
   }
-
-  return err;
-}
-
-void DecoderBase::configure(const std::shared_ptr<Message> &format) {
-  std::shared_ptr<Message> msg = new Message(kWhatConfigure, this);
-  msg->setMessage("format", format);
-  msg->post();
-}
-
-void DecoderBase::init() {
-  mDecoderLooper->registerHandler(this);
+  std::make_shared<Message>(kWhatConfigure, shared_from_this())->post();
 }
 
 void DecoderBase::stopLooper() {
-  mDecoderLooper->unregisterHandler(id());
-  mDecoderLooper->stop();
-}
-
-void DecoderBase::setParameters(const std::shared_ptr<Message> &params) {
-  std::shared_ptr<Message> msg = new Message(kWhatSetParameters, this);
-  msg->setMessage("params", params);
-  msg->post();
-}
-
-void DecoderBase::setRenderer(const sp<Renderer> &renderer) {
-  std::shared_ptr<Message> msg = new Message(kWhatSetRenderer, this);
-  msg->setObject("renderer", renderer);
-  msg->post();
-}
-
-void DecoderBase::pause() {
-  std::shared_ptr<Message> msg = new Message(kWhatPause, this);
-
-  std::shared_ptr<Message> response;
-  PostAndAwaitResponse(msg, &response);
+  std::lock_guard<std::mutex> autoLock(mBindingLock);
+  if (mDecoderLooper != nullptr) {
+    mDecoderLooper->unregisterHandler(id());
+    mDecoderLooper->stop();
+    mDecoderLooper.reset();
+  }
 }
 
 void DecoderBase::signalFlush() {
-  (new Message(kWhatFlush, this))->post();
+  std::make_shared<Message>(kWhatFlush, shared_from_this())->post();
 }
 
 void DecoderBase::signalResume(bool notifyComplete) {
-  std::shared_ptr<Message> msg = new Message(kWhatResume, this);
-  msg->setInt32("notifyComplete", notifyComplete);
+  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatResume, shared_from_this());
+  msg->setInt(notifyComplete ? 1 : 0);
   msg->post();
 }
 
 void DecoderBase::initiateShutdown() {
-  (new Message(kWhatShutdown, this))->post();
+  std::make_shared<Message>(kWhatShutdown, shared_from_this())->post();
 }
 
 void DecoderBase::onRequestInputBuffers() {
@@ -101,51 +74,37 @@ void DecoderBase::onRequestInputBuffers() {
   if (doRequestBuffers()) {
     mRequestInputBuffersPending = true;
 
-    std::shared_ptr<Message> msg = new Message(kWhatRequestInputBuffers, this);
+    std::shared_ptr<Message> msg =
+        std::make_shared<Message>(kWhatRequestInputBuffers, shared_from_this());
+    msg->setInt(mBufferGeneration);
     msg->post(10 * 1000LL);
   }
 }
 
 void DecoderBase::onMessageReceived(const std::shared_ptr<Message> &msg) {
-
   switch (msg->what()) {
     case kWhatConfigure:
     {
-      std::shared_ptr<Message> format;
-      CHECK(msg->findMessage("format", &format));
-        (format);
-      break;
-    }
-
-    case kWhatSetParameters:
-    {
-      std::shared_ptr<Message> params;
-      CHECK(msg->findMessage("params", &params));
-      onSetParameters(params);
-      break;
-    }
-
-    case kWhatSetRenderer:
-    {
-      sp<RefBase> obj;
-      CHECK(msg->findObject("renderer", &obj));
-      onSetRenderer(static_cast<Renderer *>(obj.get()));
-      break;
-    }
-
-    case kWhatPause:
-    {
-      std::shared_ptr<ReplyToken> replyID;
-      CHECK(msg->senderAwaitsResponse(&replyID));
-
-      mPaused = true;
-
-      (new Message)->postReply(replyID);
+      Binding binding;
+      {
+        std::lock_guard<std::mutex> autoLock(mBindingLock);
+        binding = mBinding;
+      }
+      mNotify = binding.notify;
+      mSource = binding.source;
+      mRenderer = binding.renderer;
+      mAudio = binding.audio;
+      ++mBufferGeneration;
+      mRequestInputBuffersPending = false;
+      onConfigure();
       break;
     }
 
     case kWhatRequestInputBuffers:
     {
+      if (msg->mArg1 != mBufferGeneration) {
+        break;
+      }
       mRequestInputBuffersPending = false;
       onRequestInputBuffers();
       break;
@@ -153,21 +112,22 @@ void DecoderBase::onMessageReceived(const std::shared_ptr<Message> &msg) {
 
     case kWhatFlush:
     {
+      ++mBufferGeneration;
+      mRequestInputBuffersPending = false;
       onFlush();
       break;
     }
 
     case kWhatResume:
     {
-      int32_t notifyComplete;
-      CHECK(msg->findInt32("notifyComplete", &notifyComplete));
-
-      onResume(notifyComplete);
+      onResume(msg->mArg1 != 0);
       break;
     }
 
     case kWhatShutdown:
     {
+      ++mBufferGeneration;
+      mRequestInputBuffersPending = false;
       onShutdown(true);
       break;
     }
@@ -177,19 +137,276 @@ void DecoderBase::onMessageReceived(const std::shared_ptr<Message> &msg) {
   }
 }
 
-void DecoderBase::handleError(int32_t err)
-{
-  // We cannot immediately release the codec due to buffers still outstanding
-  // in the renderer.  We signal to the player the error so it can shutdown/release the
-  // decoder after flushing and increment the generation to discard unnecessary messages.
+void DecoderBase::notify(int32_t what, int64_t arg) {
+  if (mNotify == nullptr) {
+    return;
+  }
+  std::shared_ptr<Message> msg = mNotify->dup();
+  msg->mArg1 = what;
+  msg->mArg2 = arg;
+  msg->post();
+}
 
+void DecoderBase::handleError(status_t err) {
+  // The codec stays open until the player shuts the decoder down, buffers
+  // of it may still be queued in the renderer. Stop pulling meanwhile.
   ++mBufferGeneration;
+  mPaused = true;
+  notify(kWhatError, err);
+}
 
-  std::shared_ptr<Message> notify = mNotify->dup();
-  notify->setInt32("what", kWhatError);
-  notify->setInt32("err", err);
-  notify->post();
+Decoder::Decoder(bool asyncMode) : mAsyncMode(asyncMode) {}
+
+Decoder::~Decoder() = default;
+
+DecoderStatus Decoder::getStatus() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mStatus;
+}
+
+MetaData Decoder::getFormat() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mMeta;
+}
+
+void Decoder::resetPullState() {
+  mPendingPacket.reset();
+  mDecodeOnlyUs.clear();
+  mPendingFormat.reset();
+  mInputEOS = false;
+  mOutputEOS = false;
+  mFinalResult = OK;
+}
+
+void Decoder::onConfigure() {
+  resetPullState();
+  mResumePending = false;
+  mWidth = 0;
+  mHeight = 0;
+  mPaused = mSource == nullptr;
+  onRequestInputBuffers();
+}
+
+void Decoder::onResume(bool notifyComplete) {
+  mPaused = false;
+  mResumePending = notifyComplete;
+  onRequestInputBuffers();
+}
+
+void Decoder::onFlush() {
+  mPaused = true;
+  resetPullState();
+  status_t err = flush();
+  if (mRenderer != nullptr) {
+    mRenderer->flush(mAudio);
+  }
+  if (err != OK) {
+    // stopped pulling until the player shuts the decoder down, which it
+    // does once the flush completed.
+    handleError(err);
+  }
+  notify(kWhatFlushCompleted);
 }
 
-}  // namespace android
+void Decoder::onShutdown(bool notifyComplete) {
+  mPaused = true;
+  resetPullState();
+  release();
+  if (notifyComplete) {
+    notify(kWhatShutdownCompleted);
+  }
+}
+
+bool Decoder::isDecodeOnly(int64_t ptsUs) {
+  auto it = mDecodeOnlyUs.lower_bound(ptsUs - kDecodeOnlyToleranceUs);
+  bool found = it != mDecodeOnlyUs.end() && *it <= ptsUs + kDecodeOnlyToleranceUs;
+  if (found) {
+    mDecodeOnlyUs.erase(it);
+  }
+  // Entries whose frames never came out, e.g. dropped by the codec.
+  while (!mDecodeOnlyUs.empty() && *mDecodeOnlyUs.begin() < ptsUs - 1000000LL) {
+    mDecodeOnlyUs.erase(mDecodeOnlyUs.begin());
+  }
+  return found;
+}
+
+// Hands what the codec decoded to the renderer while it takes more.
+// WOULD_BLOCK once the renderer is full, OK once the codec has nothing
+// more for now, ERROR_END_OF_STREAM when the EOS input came out.
+status_t Decoder::drainOutput(bool *progress) {
+  while (mRenderer->needsMoreData(mAudio)) {
+    std::shared_ptr<MediaBuffer> buffer;
+    status_t err = output(buffer);
+    if (err == WOULD_BLOCK || err == ERROR_BUFFER_FULL) {
+      return OK;
+    }
+    if (err != OK && err != ERROR_END_OF_STREAM) {
+      return err;
+    }
+    const bool eos = err == ERROR_END_OF_STREAM;
+    if (buffer != nullptr && !(eos && buffer->size == 0 && buffer->frame == nullptr)) {
+      *progress = true;
+      if (isDecodeOnly(buffer->ptsUs)) {
+        if (mStats != nullptr) {
+          mStats->onFrameSkippedByDecoder();
+        }
+      } else {
+        if (!mAudio) {
+          MetaData format = getFormat();
+          int32_t width = format.width;
+          int32_t height = format.height;
+          if (buffer->frame != nullptr) {
+            width = buffer->frame->width;
+            height = buffer->frame->height;
+          }
+          if (width != mWidth || height != mHeight) {
+            mWidth = width;
+            mHeight = height;
+            notify(kWhatVideoSizeChanged, ((int64_t)width << 32) | (uint32_t)height);
+          }
+        }
+        mRenderer->queueBuffer(mAudio, buffer);
+        if (mResumePending) {
+          mResumePending = false;
+          notify(kWhatResumeCompleted);
+        }
+      }
+    }
+    if (eos) {
+      return ERROR_END_OF_STREAM;
+    }
+  }
+  return WOULD_BLOCK;
+}
+
+status_t Decoder::queueInputEOS() {
+  std::shared_ptr<MediaBuffer> eos = std::make_shared<MediaBuffer>();
+  eos->isEOS = true;
+  status_t err = input(eos);
+  if (err == OK) {
+    mInputEOS = true;
+  }
+  return err;
+}
+
+// A discontinuity that comes with a new format drains the codec and reopens
+// it once the last frame of the old format is out. One that only moved the
+// clock needs nothing here, the source rebased the timestamps.
+void Decoder::onInputDiscontinuity() {
+  if (!changeFormat(mSource->getFormatMeta(mAudio))) {
+    ALOGV("[%s] discontinuity", mAudio ? "audio" : "video");
+  }
+}
+
+// False if |format| is what the codec is open with already.
+bool Decoder::changeFormat(const std::shared_ptr<MetaData> &format) {
+  MetaData current = getFormat();
+  if (format == nullptr
+      || (format->mime == current.mime
+          && format->width == current.width
+          && format->height == current.height
+          && format->sampleRate == current.sampleRate
+          && format->channelCount == current.channelCount
+          && format->csd == current.csd)) {
+    return false;
+  }
+  ALOGI("[%s] format changed to %s, draining", mAudio ? "audio" : "video",
+        format->mime.c_str());
+  mPendingFormat = format;
+  return true;
+}
+
+// Moves decoded frames to the renderer and access units from the source to
+// the codec until one side has to wait: the renderer is full, the source
+// starved or the codec wants its output taken first.
+bool Decoder::doRequestBuffers() {
+  if (mPaused || mSource == nullptr || mRenderer == nullptr || mOutputEOS) {
+    return false;
+  }
+
+  for (;;) {
+    bool progress = false;
+    status_t err = drainOutput(&progress);
+    if (err == WOULD_BLOCK) {
+      return true;  // the renderer is full
+    } else if (err == ERROR_END_OF_STREAM) {
+      if (mPendingFormat != nullptr) {
+        // drained for a format change, not the end of the track
+        std::shared_ptr<MetaData> format = std::move(mPendingFormat);
+        mInputEOS = false;
+        err = onFormatChanged(*format);
+        if (err != OK) {
+          ALOGE("[%s] failed to reopen codec for %s: %d", mAudio ? "audio" : "video",
+                format->mime.c_str(), err);
+          handleError(err);
+          return false;
+        }
+        continue;
+      }
+      mOutputEOS = true;
+      mRenderer->queueEOS(mAudio, mFinalResult);
+      return false;
+    } else if (err != OK) {
+      handleError(err);
+      return false;
+    }
+
+    if (mInputEOS) {
+      // waiting for the codec to drain
+      return true;
+    }
+    if (mPendingFormat != nullptr || mFinalResult != OK) {
+      err = queueInputEOS();
+      if (err == OK) {
+        continue;
+      } else if (err == WOULD_BLOCK || err == ERROR_BUFFER_FULL) {
+        if (progress) {
+          continue;
+        }
+        return true;
+      }
+      handleError(err);
+      return false;
+    }
+
+    if (mPendingPacket == nullptr) {
+      err = mSource->dequeueAccessUnit(mAudio, &mPendingPacket);
+      if (err == WOULD_BLOCK) {
+        return true;
+      } else if (err == INFO_DISCONTINUITY) {
+        mPendingPacket.reset();
+        onInputDiscontinuity();
+        continue;
+      } else if (err != OK) {
+        // the end of the track, or an error of the source: drain either way
+        mPendingPacket.reset();
+        mFinalResult = err;
+        continue;
+      }
+      if (mPendingPacket->decodeOnly) {
+        mDecodeOnlyUs.insert(mPendingPacket->ptsUs);
+      }
+      // The packet waits for the codec reopened with its format.
+      std::shared_ptr<MetaData> format = std::move(mPendingPacket->format);
+      if (changeFormat(format)) {
+        continue;
+      }
+    }
+
+    err = input(*mPendingPacket);
+    if (err == OK || err == ERROR_MALFORMED || err == ERROR_BUFFER_TOO_SMALL) {
+      // a dropped packet was counted by the codec, carry on with the next
+      mPendingPacket.reset();
+      continue;
+    } else if (err == WOULD_BLOCK || err == ERROR_BUFFER_FULL) {
+      if (progress) {
+        continue;
+      }
+      return true;
+    }
+    handleError(err);
+    return false;
+  }
+}
 
+} // hpc
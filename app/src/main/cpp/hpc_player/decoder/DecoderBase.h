@@ -1,92 +1,205 @@
 #pragma once
 
-#include "../HpcPlayer.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+
+#include "../foundation/Error.h"
 #include "../foundation/Handler.h"
 #include "../foundation/Message.h"
+#include "../foundation/MetaData.h"
+#include "../foundation/PlaybackStats.h"
+
+struct AVFrame;
 
 namespace hpc {
 
-struct ABuffer;
-struct MediaCodec;
-class MediaBuffer;
-class MediaCodecBuffer;
+struct Looper;
+class MediaPacket;
+class Renderer;
+class Source;
 class Surface;
 
-struct DecoderBase : public Handler {
-  explicit DecoderBase(const std::shared_ptr<Message> &notify);
+// A decoded frame, or an access unit handed to Decoder::input() by copy.
+struct MediaBuffer {
+  std::shared_ptr<uint8_t> data;
+  size_t size {0};
+  int64_t ptsUs {-1};
+  bool isKeyFrame {false};
+  bool isEOS {false};
+  // Out of libavcodec: the decoded frame itself, by reference. Audio frames
+  // are 16 bit interleaved and |data| points into them.
+  std::shared_ptr<AVFrame> frame;
+  // Audio: the PCM in |data|, always 16 bit interleaved.
+  int32_t sampleRate {0};
+  int32_t channelCount {0};
+};
+
+struct DecoderStatus {
+  size_t bufferedBytes {0};  // input not yet decoded
+  bool isDecoding {false};
+  int64_t currentTimeUs {-1};  // of the last frame out
+};
 
-  void configure(const std::shared_ptr<Message> &format);
-  void init();
-  void setParameters(const std::shared_ptr<Message> &params);
+// The message loop of a decoder. configure() binds it to a track of a
+// Source and to the Renderer, after which it pulls access units from the
+// source and pushes what they decode to the renderer on its own looper,
+// for as long as the renderer takes them. Flush, resume and shutdown are
+// asynchronous and reported through the notify message: the what of it,
+// the event in mArg1 and its argument in mArg2.
+struct DecoderBase : public Handler {
+  DecoderBase();
 
-  // Synchronous call to ensure decoder will not request or send out data.
-  void pause();
+  // Binds the decoder to the |audio| track of |source| and to |renderer|
+  // and starts pulling. A decoder taken from DecoderPool is configured
+  // again for its new player; all nullptr detaches it, e.g. before it goes
+  // back to the pool.
+  void configure(const std::shared_ptr<Message> &notify,
+                 const std::shared_ptr<Source> &source,
+                 const std::shared_ptr<Renderer> &renderer,
+                 bool audio);
 
-  void setRenderer(const std::shared_ptr<Renderer> &renderer);
   virtual status_t setVideoSurface(const std::shared_ptr<Surface> &) { return INVALID_OPERATION; }
 
+  // Drops what the codec holds and stops pulling, kWhatFlushCompleted
+  // once done. signalResume() pulls again; with |notifyComplete| the
+  // first buffer queued to the renderer reports kWhatResumeCompleted.
   void signalFlush();
   void signalResume(bool notifyComplete);
+  // Stops pulling and releases the codec, kWhatShutdownCompleted.
   void initiateShutdown();
 
-  virtual std::shared_ptr<Message> getStats() {
-    return mStats;
+  // Set before configure(). Decoded and skipped frames and decode times go
+  // to |stats|, which the player shares with the source and the renderer.
+  virtual void setPlaybackStats(const std::shared_ptr<PlaybackStats> &stats) {
+    mStats = stats;
   }
-
-  virtual status_t releaseCrypto() {
-    return INVALID_OPERATION;
+  std::shared_ptr<PlaybackStats> getStats() const {
+    return mStats;
   }
 
   enum {
-    kWhatInputDiscontinuity  = 'inDi',
-    kWhatVideoSizeChanged    = 'viSC',
+    kWhatVideoSizeChanged    = 'viSC',  // mArg2: width << 32 | height
     kWhatFlushCompleted      = 'flsC',
     kWhatShutdownCompleted   = 'shDC',
     kWhatResumeCompleted     = 'resC',
-    kWhatEOS                 = 'eos ',
-    kWhatError               = 'err ',
+    kWhatError               = 'err ',  // mArg2: the error
   };
 
  protected:
-
   virtual ~DecoderBase();
 
   void stopLooper();
 
   void onMessageReceived(const std::shared_ptr<Message> &msg) override;
 
-  virtual void onConfigure(const std::shared_ptr<Message> &format) = 0;
-  virtual void onSetParameters(const std::shared_ptr<Message> &params) = 0;
-  virtual void onSetRenderer(const std::shared_ptr<Renderer> &renderer) = 0;
+  virtual void onConfigure() = 0;
   virtual void onResume(bool notifyComplete) = 0;
   virtual void onFlush() = 0;
   virtual void onShutdown(bool notifyComplete) = 0;
 
   void onRequestInputBuffers();
+  // True to be called again in a bit, e.g. while the source is starved.
   virtual bool doRequestBuffers() = 0;
-  virtual void handleError(int32_t err);
+  virtual void handleError(status_t err);
+
+  void notify(int32_t what, int64_t arg = 0);
 
   std::shared_ptr<Message> mNotify;
-  int32_t mBufferGeneration;
-  bool mPaused;
-  std::shared_ptr<Message> mStats;
-  std::mutex mStatsLock;
+  std::shared_ptr<Source> mSource;
+  std::shared_ptr<Renderer> mRenderer;
+  bool mAudio {false};
+  int32_t mBufferGeneration {0};
+  bool mPaused {false};
+  std::shared_ptr<PlaybackStats> mStats;
 
  private:
   enum {
     kWhatConfigure           = 'conf',
-    kWhatSetParameters       = 'setP',
-    kWhatSetRenderer         = 'setR',
-    kWhatPause               = 'paus',
     kWhatRequestInputBuffers = 'reqB',
+    kWhatResume              = 'resm',
     kWhatFlush               = 'flus',
     kWhatShutdown            = 'shuD',
   };
 
-  std::shared_ptr<Looper> mDecoderLooper;
-  bool mRequestInputBuffersPending;
+  struct Binding {
+    std::shared_ptr<Message> notify;
+    std::shared_ptr<Source> source;
+    std::shared_ptr<Renderer> renderer;
+    bool audio {false};
+  };
 
+  std::mutex mBindingLock;  // guard |mBinding| and |mDecoderLooper|.
+  Binding mBinding;         // the last configure(), taken by kWhatConfigure
+  std::shared_ptr<Looper> mDecoderLooper;
+  bool mRequestInputBuffersPending {false};
 };
 
-}
+// A codec behind DecoderBase's message loop. init() opens it for a track,
+// input() takes access units and output() hands back what they decoded.
+// Neither blocks: WOULD_BLOCK or ERROR_BUFFER_FULL asks to come back once
+// the other side moved. Implementations guard the codec with mMutex.
+class Decoder : public DecoderBase {
+ public:
+  explicit Decoder(bool asyncMode);
+
+  virtual status_t init(const MetaData &meta) = 0;
+  virtual status_t input(const std::shared_ptr<MediaBuffer> &buffer) = 0;
+  // A packet as the source queued it. ERROR_MALFORMED and
+  // ERROR_BUFFER_TOO_SMALL drop it, WOULD_BLOCK and ERROR_BUFFER_FULL keep
+  // it for the next call.
+  virtual status_t input(const MediaPacket &packet) = 0;
+  // OK with a buffer, or without one after an output format change;
+  // ERROR_END_OF_STREAM after an EOS input came out.
+  virtual status_t output(std::shared_ptr<MediaBuffer> &buffer) = 0;
+  virtual status_t seek(int64_t timeUs) = 0;
+  virtual status_t flush() = 0;
+  virtual void release() = 0;
+
+  DecoderStatus getStatus() const;
+  // The format init() last opened the codec with.
+  MetaData getFormat() const;
+
+ protected:
+  ~Decoder() override;
+
+  // Reopens the codec for a track whose format changed.
+  virtual status_t onFormatChanged(const MetaData &newMeta) = 0;
+
+  // DecoderBase
+  void onConfigure() override;
+  void onResume(bool notifyComplete) override;
+  void onFlush() override;
+  void onShutdown(bool notifyComplete) override;
+  bool doRequestBuffers() override;
+
+  mutable std::mutex mMutex;
+  MetaData mMeta;
+  DecoderStatus mStatus;
+  bool mInitialized {false};
+  const bool mAsyncMode;
+
+ private:
+  // Output within this of a decode-only input is dropped with it.
+  static const int64_t kDecodeOnlyToleranceUs = 1000;
+
+  status_t drainOutput(bool *progress);
+  status_t queueInputEOS();
+  void onInputDiscontinuity();
+  bool changeFormat(const std::shared_ptr<MetaData> &format);
+  bool isDecodeOnly(int64_t ptsUs);
+  void resetPullState();
+
+  std::unique_ptr<MediaPacket> mPendingPacket;  // refused by input() last time
+  std::multiset<int64_t> mDecodeOnlyUs;
+  std::shared_ptr<MetaData> mPendingFormat;  // reopen with it once drained
+  bool mInputEOS {false};
+  bool mOutputEOS {false};
+  status_t mFinalResult {OK};
+  bool mResumePending {false};
+  int32_t mWidth {0};
+  int32_t mHeight {0};
+};
 
+} // hpc
@@ -0,0 +1,176 @@
+#include "DecoderPool.h"
+#include "DecoderBase.h"
+#include "Looper.h"
+#include "Log.h"
+
+#include <algorithm>
+
+#define LOG_TAG "DecoderPool"
+
+namespace hpc {
+
+// Enough for a short-video feed to keep the previous and the next item's
+// decoders around without holding on to memory for long.
+static const size_t kDefaultMaxBytes = 96 * 1024 * 1024;
+static const int64_t kDefaultMaxIdleUs = 30000000LL;
+
+// Frames an idle software decoder typically keeps allocated: references,
+// reorder delay and the per-thread frames of frame threading.
+static const size_t kPooledFramesPerDecoder = 8;
+
+static const struct {
+  int32_t longSide;
+  int32_t shortSide;
+} kResolutionClasses[] = {
+  {  640,  360 },  // kResolution360p
+  {  854,  480 },  // kResolution480p
+  { 1280,  720 },  // kResolution720p
+  { 1920, 1080 },  // kResolution1080p
+  { 3840, 2160 },  // kResolution2160p
+  { 7680, 4320 },  // kResolutionAbove, used for the estimate only
+};
+
+// static
+DecoderPool &DecoderPool::Instance() {
+  static DecoderPool sInstance;
+  return sInstance;
+}
+
+DecoderPool::DecoderPool()
+    : mMaxBytes(kDefaultMaxBytes),
+      mMaxIdleUs(kDefaultMaxIdleUs) {
+}
+
+// static
+DecoderPool::Key DecoderPool::MakeKey(
+    const std::string &mime, int32_t width, int32_t height, int32_t pixelFormat) {
+  const int32_t longSide = std::max(width, height);
+  const int32_t shortSide = std::min(width, height);
+  int32_t resolutionClass = kResolution360p;
+  while (resolutionClass < kResolutionAbove
+      && (longSide > kResolutionClasses[resolutionClass].longSide
+          || shortSide > kResolutionClasses[resolutionClass].shortSide)) {
+    ++resolutionClass;
+  }
+
+  Key key;
+  key.mime = mime;
+  key.resolutionClass = resolutionClass;
+  key.pixelFormat = pixelFormat;
+  return key;
+}
+
+// static
+size_t DecoderPool::EstimateBytes(const Key &key) {
+  int32_t resolutionClass = std::min<int32_t>(std::max(key.resolutionClass, 0), kResolutionAbove);
+  size_t pixels = (size_t)kResolutionClasses[resolutionClass].longSide
+      * kResolutionClasses[resolutionClass].shortSide;
+  // 4:2:0, 8 bit. Higher bit depths are still in the same ballpark.
+  return pixels * 3 / 2 * kPooledFramesPerDecoder;
+}
+
+void DecoderPool::setLimits(size_t maxBytes, int64_t maxIdleUs) {
+  EntryList evicted;
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    mMaxBytes = maxBytes;
+    mMaxIdleUs = maxIdleUs;
+    evict_l(Looper::GetNowUs(), &evicted);
+  }
+  releaseAll(&evicted);
+}
+
+std::shared_ptr<Decoder> DecoderPool::acquire(const Key &key) {
+  EntryList evicted;
+  std::shared_ptr<Decoder> decoder;
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    evict_l(Looper::GetNowUs(), &evicted);
+
+    auto it = std::find_if(mEntries.begin(), mEntries.end(),
+                           [&key](const Entry &entry) { return entry.key == key; });
+    if (it != mEntries.end()) {
+      decoder = it->decoder;
+      mPooledBytes -= it->bytes;
+      mEntries.erase(it);
+      ++mStats.hits;
+    } else {
+      ++mStats.misses;
+    }
+  }
+  releaseAll(&evicted);
+
+  ALOGV("acquire %s class %d fmt %d: %s",
+        key.mime.c_str(), key.resolutionClass, key.pixelFormat, decoder != nullptr ? "hit" : "miss");
+  return decoder;
+}
+
+void DecoderPool::recycle(const Key &key, const std::shared_ptr<Decoder> &decoder) {
+  if (decoder == nullptr) {
+    return;
+  }
+
+  EntryList evicted;
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    const int64_t nowUs = Looper::GetNowUs();
+    mEntries.push_front(Entry{key, decoder, EstimateBytes(key), nowUs});
+    mPooledBytes += mEntries.front().bytes;
+    ++mStats.recycled;
+    evict_l(nowUs, &evicted);
+  }
+  releaseAll(&evicted);
+}
+
+void DecoderPool::trim() {
+  EntryList evicted;
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    evict_l(Looper::GetNowUs(), &evicted);
+  }
+  releaseAll(&evicted);
+}
+
+void DecoderPool::clear() {
+  EntryList evicted;
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    mStats.evicted += mEntries.size();
+    evicted.swap(mEntries);
+    mPooledBytes = 0;
+  }
+  releaseAll(&evicted);
+}
+
+DecoderPool::Stats DecoderPool::getStats() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  Stats stats = mStats;
+  stats.pooledDecoders = mEntries.size();
+  stats.pooledBytes = mPooledBytes;
+  return stats;
+}
+
+// Moves idle and over-budget entries to |evicted|. They are released by the
+// caller outside of the lock, closing a codec can take a while.
+void DecoderPool::evict_l(int64_t nowUs, EntryList *evicted) {
+  while (!mEntries.empty()) {
+    const Entry &oldest = mEntries.back();
+    if (mPooledBytes <= mMaxBytes && nowUs - oldest.idleSinceUs <= mMaxIdleUs) {
+      break;
+    }
+    mPooledBytes -= oldest.bytes;
+    evicted->splice(evicted->begin(), mEntries, std::prev(mEntries.end()));
+    ++mStats.evicted;
+  }
+}
+
+// static
+void DecoderPool::releaseAll(EntryList *entries) {
+  for (Entry &entry : *entries) {
+    ALOGV("evicting %s class %d", entry.key.mime.c_str(), entry.key.resolutionClass);
+    entry.decoder->release();
+  }
+  entries->clear();
+}
+
+} // hpc
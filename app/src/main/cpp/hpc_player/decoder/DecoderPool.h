@@ -0,0 +1,105 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace hpc {
+
+class Decoder;
+
+// Process wide pool of configured video decoders. Opening a codec (avcodec_open2,
+// MediaCodec creation and configuration) dominates player creation in a feed
+// where every swipe creates a new HpcPlayer, so a released player returns its
+// flushed decoder here and the next player with a compatible stream takes it.
+//
+// Decoders are matched by mime, resolution class and pixel format; the exact
+// resolution may differ inside a class, decoders handle that like an in-band
+// resolution change. Idle decoders are released once they exceed the memory
+// budget (oldest first) or the idle timeout. Eviction is lazy, it runs on
+// every acquire/recycle and on trim().
+class DecoderPool {
+ public:
+  enum ResolutionClass {
+    kResolution360p = 0,
+    kResolution480p,
+    kResolution720p,
+    kResolution1080p,
+    kResolution2160p,
+    kResolutionAbove,
+  };
+
+  struct Key {
+    std::string mime;
+    int32_t resolutionClass {kResolution360p};
+    int32_t pixelFormat {-1};
+
+    bool operator==(const Key &other) const {
+      return mime == other.mime
+          && resolutionClass == other.resolutionClass
+          && pixelFormat == other.pixelFormat;
+    }
+  };
+
+  struct Stats {
+    int64_t hits {0};
+    int64_t misses {0};
+    int64_t recycled {0};
+    int64_t evicted {0};
+    size_t pooledDecoders {0};
+    size_t pooledBytes {0};
+  };
+
+  static DecoderPool &Instance();
+
+  // Orientation independent, portrait feeds share decoders with landscape.
+  static Key MakeKey(const std::string &mime, int32_t width, int32_t height, int32_t pixelFormat);
+
+  // Rough footprint of an idle decoder of |key|: the frame pool of the
+  // largest resolution in its class.
+  static size_t EstimateBytes(const Key &key);
+
+  void setLimits(size_t maxBytes, int64_t maxIdleUs);
+
+  // Returns a flushed decoder configured for |key|, nullptr if none is pooled.
+  // The caller re-inits it with the new stream's format before use.
+  std::shared_ptr<Decoder> acquire(const Key &key);
+
+  // Takes a flushed decoder back. It is released right away if it alone
+  // exceeds the memory budget.
+  void recycle(const Key &key, const std::shared_ptr<Decoder> &decoder);
+
+  // Releases decoders idle for longer than the timeout.
+  void trim();
+
+  // Releases everything, e.g. on memory pressure.
+  void clear();
+
+  Stats getStats() const;
+
+ private:
+  struct Entry {
+    Key key;
+    std::shared_ptr<Decoder> decoder;
+    size_t bytes;
+    int64_t idleSinceUs;
+  };
+  typedef std::list<Entry> EntryList;
+
+  mutable std::mutex mLock;
+  EntryList mEntries;  // most recently recycled first
+  size_t mPooledBytes {0};
+  size_t mMaxBytes;
+  int64_t mMaxIdleUs;
+  Stats mStats;
+
+  DecoderPool();
+  DecoderPool(const DecoderPool &) = delete;
+  DecoderPool &operator=(const DecoderPool &) = delete;
+
+  void evict_l(int64_t nowUs, EntryList *evicted);
+  static void releaseAll(EntryList *entries);
+};
+
+} // hpc
@@ -1,13 +1,19 @@
 #include "FFmpegVideoDecoder.h"
+#include "MediaPacket.h"
 
+#include <algorithm>
 #include <cstring>
 #include <vector>
 
+extern "C" {
+#include <libavutil/time.h>
+}
+
 namespace hpc {
 
 namespace {
 
-AVCodec* FindCodecByMime(const std::string& mime_type, bool is_video) {
+const AVCodec* FindCodecByMime(const std::string& mime_type, bool is_video) {
   if (is_video) {
     if (mime_type == "video/avc") return avcodec_find_decoder(AV_CODEC_ID_H264);
     if (mime_type == "video/hevc") return avcodec_find_decoder(AV_CODEC_ID_HEVC);
@@ -21,6 +27,44 @@ AVCodec* FindCodecByMime(const std::string& mime_type, bool is_video) {
   }
 }
 
+// Points |dst| at the payload and side data of |packet| by reference, with
+// the microsecond timestamps the decoders work in.
+int RefPacket(AVPacket* dst, const MediaPacket& packet) {
+  av_packet_unref(dst);
+  int ret = av_packet_ref(dst, packet.avPacket());
+  if (ret < 0) {
+    return ret;
+  }
+  dst->pts = packet.ptsUs < 0 ? AV_NOPTS_VALUE : packet.ptsUs;
+  dst->dts = packet.dtsUs < 0 ? AV_NOPTS_VALUE : packet.dtsUs;
+  dst->duration = packet.durationUs;
+  return 0;
+}
+
+// Codec configuration of the track, e.g. an avcC record or an
+// AudioSpecificConfig, copied into |context| before it is opened.
+int SetExtradata(AVCodecContext* context, const std::vector<uint8_t>& csd) {
+  av_freep(&context->extradata);
+  context->extradata_size = 0;
+  if (csd.empty()) {
+    return 0;
+  }
+  context->extradata = static_cast<uint8_t*>(av_mallocz(csd.size() + AV_INPUT_BUFFER_PADDING_SIZE));
+  if (context->extradata == nullptr) {
+    return AVERROR(ENOMEM);
+  }
+  std::memcpy(context->extradata, csd.data(), csd.size());
+  context->extradata_size = (int)csd.size();
+  return 0;
+}
+
+// Packets carry microseconds, so do the frames.
+const AVRational kMicrosecondBase = {1, 1000000};
+
+int64_t FrameTimeUs(const AVFrame* frame) {
+  return frame->best_effort_timestamp != AV_NOPTS_VALUE ? frame->best_effort_timestamp : frame->pts;
+}
+
 }  // namespace
 
 // FFmpegVideoDecoder implementation
@@ -30,15 +74,31 @@ FFmpegVideoDecoder::FFmpegVideoDecoder(bool async_mode)
 
 FFmpegVideoDecoder::~FFmpegVideoDecoder() {
   FreeResources();
+  av_frame_free(&frame_);
+  av_packet_free(&packet_);
 }
 
 status_t FFmpegVideoDecoder::init(const MetaData& meta) {
   std::lock_guard<std::mutex> lock(mMutex);
   if (initialized_) {
-    return OK;
+    if (meta.mime != mMeta.mime) {
+      return INVALID_OPERATION;
+    }
+    if (meta.csd == mMeta.csd) {
+      // A decoder taken from DecoderPool: keep the open codec, only drop
+      // what the previous stream left behind. A different resolution is
+      // picked up from the new stream's parameter sets.
+      FlushLocked();
+      mMeta = meta;
+      return OK;
+    }
+    // Parameter sets only in extradata, e.g. an avcC, never reach an open
+    // codec: reopen it with the new ones.
+    FreeResources();
+    initialized_ = false;
   }
 
-  codec_ = FindCodecByMime(meta.mimeType, true);
+  codec_ = FindCodecByMime(meta.mime, true);
   if (!codec_) {
     return ERROR_INVALID_FORMAT;
   }
@@ -50,7 +110,13 @@ status_t FFmpegVideoDecoder::init(const MetaData& meta) {
 
   codec_context_->width = meta.width;
   codec_context_->height = meta.height;
-  codec_context_->bit_rate = meta.bitrate;
+  codec_context_->bit_rate = meta.BitRate;
+  codec_context_->pkt_timebase = kMicrosecondBase;
+  codec_context_->skip_frame = key_frames_only_ ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+  if (SetExtradata(codec_context_, meta.csd) < 0) {
+    avcodec_free_context(&codec_context_);
+    return NO_MEMORY;
+  }
 
   if (avcodec_open2(codec_context_, codec_, nullptr) < 0) {
     avcodec_free_context(&codec_context_);
@@ -70,16 +136,54 @@ status_t FFmpegVideoDecoder::input(const std::shared_ptr<MediaBuffer>& buffer) {
   }
 
   av_packet_unref(packet_);
+  if (buffer->isEOS) {
+    // an empty packet drains the codec
+    return SendPacket(0);
+  }
   packet_->data = buffer->data.get();
   packet_->size = buffer->size;
   packet_->pts = buffer->ptsUs;
   packet_->flags = buffer->isKeyFrame ? AV_PKT_FLAG_KEY : 0;
+  // without a buffer reference avcodec_send_packet() copies the payload.
+  if (playback_stats_ != nullptr) {
+    playback_stats_->onPayloadCopied(buffer->size);
+  }
+  return SendPacket(buffer->size);
+}
 
-  int ret = avcodec_send_packet(codec_context_, packet_);
-  if (ret < 0) {
-    return ERROR_UNKNOWN;
+status_t FFmpegVideoDecoder::input(const MediaPacket& packet) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (!initialized_) {
+    return ERROR_INVALID_FORMAT;
+  }
+
+  if (RefPacket(packet_, packet) < 0) {
+    return NO_MEMORY;
+  }
+  if (!packet.isRefCounted() && playback_stats_ != nullptr) {
+    playback_stats_->onPayloadCopied(packet.size());
+  }
+  return SendPacket(packet.size());
+}
+
+status_t FFmpegVideoDecoder::SendPacket(size_t size) {
+  int64_t start_us = av_gettime_relative();
+  int ret = avcodec_send_packet(codec_context_, size > 0 ? packet_ : nullptr);
+  pending_decode_us_ += av_gettime_relative() - start_us;
+  // the codec holds its own reference now.
+  av_packet_unref(packet_);
+  if (ret == AVERROR(EAGAIN)) {
+    // its output has to be taken first, the caller keeps the packet
+    return WOULD_BLOCK;
+  } else if (ret == AVERROR_EOF) {
+    return ERROR_END_OF_STREAM;
+  } else if (ret < 0) {
+    if (playback_stats_ != nullptr) {
+      playback_stats_->onFrameSkippedByDecoder();
+    }
+    return ERROR_MALFORMED;
   }
-  mStatus.bufferedBytes += buffer->size;
+  mStatus.bufferedBytes += size;
   mStatus.isDecoding = true;
   return OK;
 }
@@ -90,33 +194,40 @@ status_t FFmpegVideoDecoder::output(std::shared_ptr<MediaBuffer>& buffer) {
     return ERROR_INVALID_FORMAT;
   }
 
+  int64_t start_us = av_gettime_relative();
   int ret = avcodec_receive_frame(codec_context_, frame_);
+  pending_decode_us_ += av_gettime_relative() - start_us;
   if (ret == AVERROR_EOF) {
     buffer = std::make_shared<MediaBuffer>();
     buffer->isEOS = true;
     mStatus.isDecoding = false;
     return ERROR_END_OF_STREAM;
+  } else if (ret == AVERROR(EAGAIN)) {
+    return WOULD_BLOCK;
   } else if (ret < 0) {
     return ERROR_UNKNOWN;
   }
+  if (playback_stats_ != nullptr) {
+    playback_stats_->onFrameDecoded(pending_decode_us_);
+  }
+  pending_decode_us_ = 0;
 
-  size_t frame_size = frame_->width * frame_->height * 3 / 2;  // Assuming YUV420P
+  // The frame moves into the buffer, frame_ takes the next one.
+  AVFrame* frame = av_frame_alloc();
+  if (frame == nullptr) {
+    av_frame_unref(frame_);
+    return NO_MEMORY;
+  }
+  av_frame_move_ref(frame, frame_);
   buffer = std::make_shared<MediaBuffer>();
-  buffer->data = std::shared_ptr<uint8_t>(static_cast<uint8_t*>(av_malloc(frame_size)), av_free);
-  buffer->size = frame_size;
-  buffer->ptsUs = frame_->pts;
-
-  // Copy YUV data (simplified, assumes YUV420P)
-  size_t offset = 0;
-  for (int i = 0; i < 3; ++i) {
-    size_t plane_size = frame_->linesize[i] * (i == 0 ? frame_->height : frame_->height / 2);
-    std::memcpy(buffer->data.get() + offset, frame_->data[i], plane_size);
-    offset += plane_size;
+  buffer->frame = std::shared_ptr<AVFrame>(frame, [](AVFrame* f) { av_frame_free(&f); });
+  buffer->ptsUs = FrameTimeUs(frame);
+  buffer->isKeyFrame = frame->key_frame;
+  if (startup_timeline_ != nullptr) {
+    startup_timeline_->mark(StartupTimeline::kFirstDecodedFrame);
   }
-
-  buffer->isKeyFrame = frame_->key_frame;
-  mStatus.currentTimeUs = frame_->pts;
-  mStatus.bufferedBytes = std::max(static_cast<ssize_t>(0), static_cast<ssize_t>(mStatus.bufferedBytes) - frame_size);
+  mStatus.currentTimeUs = buffer->ptsUs;
+  mStatus.bufferedBytes -= std::min(mStatus.bufferedBytes, (size_t)std::max(frame->pkt_size, 0));
   return OK;
 }
 
@@ -126,13 +237,17 @@ status_t FFmpegVideoDecoder::seek(int64_t time_us) {
     return ERROR_INVALID_FORMAT;
   }
 
-  flush();
+  FlushLocked();
   mStatus.currentTimeUs = time_us;
   return OK;
 }
 
 status_t FFmpegVideoDecoder::flush() {
   std::lock_guard<std::mutex> lock(mMutex);
+  return FlushLocked();
+}
+
+status_t FFmpegVideoDecoder::FlushLocked() {
   if (!initialized_) {
     return OK;
   }
@@ -140,6 +255,7 @@ status_t FFmpegVideoDecoder::flush() {
   avcodec_flush_buffers(codec_context_);
   mStatus.bufferedBytes = 0;
   mStatus.isDecoding = false;
+  pending_decode_us_ = 0;
   return OK;
 }
 
@@ -155,13 +271,10 @@ status_t FFmpegVideoDecoder::onFormatChanged(const MetaData& new_meta) {
   return init(new_meta);
 }
 
+// frame_ and packet_ stay for the next init().
 void FFmpegVideoDecoder::FreeResources() {
-  if (frame_) {
-    av_frame_free(&frame_);
-  }
-  if (packet_) {
-    av_packet_free(&packet_);
-  }
+  av_frame_unref(frame_);
+  av_packet_unref(packet_);
   if (codec_context_) {
     avcodec_free_context(&codec_context_);
   }
@@ -172,6 +285,25 @@ bool FFmpegVideoDecoder::isSupportedMime(const std::string& mime_type) {
   return FindCodecByMime(mime_type, true) != nullptr;
 }
 
+void FFmpegVideoDecoder::setStartupTimeline(const std::shared_ptr<StartupTimeline>& timeline) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  startup_timeline_ = timeline;
+}
+
+void FFmpegVideoDecoder::setPlaybackStats(const std::shared_ptr<PlaybackStats>& stats) {
+  Decoder::setPlaybackStats(stats);
+  std::lock_guard<std::mutex> lock(mMutex);
+  playback_stats_ = stats;
+}
+
+void FFmpegVideoDecoder::setKeyFramesOnly(bool key_frames_only) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  key_frames_only_ = key_frames_only;
+  if (codec_context_) {
+    codec_context_->skip_frame = key_frames_only ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+  }
+}
+
 // FFmpegAudioDecoder implementation
 FFmpegAudioDecoder::FFmpegAudioDecoder(bool async_mode)
     : Decoder(async_mode), frame_(av_frame_alloc()), packet_(av_packet_alloc()) {
@@ -179,6 +311,8 @@ FFmpegAudioDecoder::FFmpegAudioDecoder(bool async_mode)
 
 FFmpegAudioDecoder::~FFmpegAudioDecoder() {
   FreeResources();
+  av_frame_free(&frame_);
+  av_packet_free(&packet_);
 }
 
 status_t FFmpegAudioDecoder::init(const MetaData& meta) {
@@ -187,7 +321,7 @@ status_t FFmpegAudioDecoder::init(const MetaData& meta) {
     return OK;
   }
 
-  codec_ = FindCodecByMime(meta.mimeType, false);
+  codec_ = FindCodecByMime(meta.mime, false);
   if (!codec_) {
     return ERROR_INVALID_FORMAT;
   }
@@ -198,8 +332,13 @@ status_t FFmpegAudioDecoder::init(const MetaData& meta) {
   }
 
   codec_context_->sample_rate = meta.sampleRate;
-  codec_context_->channels = meta.channels;
-  codec_context_->bit_rate = meta.bitrate;
+  codec_context_->channels = meta.channelCount;
+  codec_context_->bit_rate = meta.BitRate;
+  codec_context_->pkt_timebase = kMicrosecondBase;
+  if (SetExtradata(codec_context_, meta.csd) < 0) {
+    avcodec_free_context(&codec_context_);
+    return NO_MEMORY;
+  }
 
   if (avcodec_open2(codec_context_, codec_, nullptr) < 0) {
     avcodec_free_context(&codec_context_);
@@ -219,16 +358,47 @@ status_t FFmpegAudioDecoder::input(const std::shared_ptr<MediaBuffer>& buffer) {
   }
 
   av_packet_unref(packet_);
+  if (buffer->isEOS) {
+    // an empty packet drains the codec
+    return SendPacket(0);
+  }
   packet_->data = buffer->data.get();
   packet_->size = buffer->size;
   packet_->pts = buffer->ptsUs;
   packet_->flags = buffer->isKeyFrame ? AV_PKT_FLAG_KEY : 0;
+  // without a buffer reference avcodec_send_packet() copies the payload.
+  if (playback_stats_ != nullptr) {
+    playback_stats_->onPayloadCopied(buffer->size);
+  }
+  return SendPacket(buffer->size);
+}
 
-  int ret = avcodec_send_packet(codec_context_, packet_);
-  if (ret < 0) {
-    return ERROR_UNKNOWN;
+status_t FFmpegAudioDecoder::input(const MediaPacket& packet) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (!initialized_) {
+    return ERROR_INVALID_FORMAT;
+  }
+
+  if (RefPacket(packet_, packet) < 0) {
+    return NO_MEMORY;
   }
-  mStatus.bufferedBytes += buffer->size;
+  if (!packet.isRefCounted() && playback_stats_ != nullptr) {
+    playback_stats_->onPayloadCopied(packet.size());
+  }
+  return SendPacket(packet.size());
+}
+
+status_t FFmpegAudioDecoder::SendPacket(size_t size) {
+  int ret = avcodec_send_packet(codec_context_, size > 0 ? packet_ : nullptr);
+  av_packet_unref(packet_);
+  if (ret == AVERROR(EAGAIN)) {
+    return WOULD_BLOCK;
+  } else if (ret == AVERROR_EOF) {
+    return ERROR_END_OF_STREAM;
+  } else if (ret < 0) {
+    return ERROR_MALFORMED;
+  }
+  mStatus.bufferedBytes += size;
   mStatus.isDecoding = true;
   return OK;
 }
@@ -245,22 +415,68 @@ status_t FFmpegAudioDecoder::output(std::shared_ptr<MediaBuffer>& buffer) {
     buffer->isEOS = true;
     mStatus.isDecoding = false;
     return ERROR_END_OF_STREAM;
+  } else if (ret == AVERROR(EAGAIN)) {
+    return WOULD_BLOCK;
   } else if (ret < 0) {
     return ERROR_UNKNOWN;
   }
 
-  size_t frame_size = av_samples_get_buffer_size(nullptr, frame_->channels, frame_->nb_samples,
-                                                 static_cast<AVSampleFormat>(frame_->format), 1);
-  buffer = std::make_shared<MediaBuffer>();
-  buffer->data = std::shared_ptr<uint8_t>(static_cast<uint8_t*>(av_malloc(frame_size)), av_free);
-  buffer->size = frame_size;
-  buffer->ptsUs = frame_->pts;
+  const int channels = frame_->channels;
+  const int64_t layout = frame_->channel_layout != 0
+      ? (int64_t)frame_->channel_layout : av_get_default_channel_layout(channels);
+  if (swr_ == nullptr || frame_->format != swr_format_ || layout != swr_layout_
+      || frame_->sample_rate != swr_rate_) {
+    swr_free(&swr_);
+    swr_ = swr_alloc_set_opts(nullptr, layout, AV_SAMPLE_FMT_S16, frame_->sample_rate,
+                              layout, static_cast<AVSampleFormat>(frame_->format),
+                              frame_->sample_rate, 0, nullptr);
+    if (swr_ == nullptr || swr_init(swr_) < 0) {
+      swr_free(&swr_);
+      av_frame_unref(frame_);
+      return ERROR_UNSUPPORTED;
+    }
+    swr_format_ = frame_->format;
+    swr_layout_ = layout;
+    swr_rate_ = frame_->sample_rate;
+  }
 
-  std::memcpy(buffer->data.get(), frame_->data[0], frame_size);
+  // Converted into a frame of its own, the buffer references the PCM in it.
+  AVFrame* pcm = av_frame_alloc();
+  if (pcm == nullptr) {
+    av_frame_unref(frame_);
+    return NO_MEMORY;
+  }
+  std::shared_ptr<AVFrame> out(pcm, [](AVFrame* f) { av_frame_free(&f); });
+  pcm->format = AV_SAMPLE_FMT_S16;
+  pcm->channel_layout = layout;
+  pcm->channels = channels;
+  pcm->sample_rate = frame_->sample_rate;
+  pcm->nb_samples = frame_->nb_samples;
+  if (av_frame_get_buffer(pcm, 0) < 0) {
+    av_frame_unref(frame_);
+    return NO_MEMORY;
+  }
+  int converted = swr_convert(swr_, pcm->data, pcm->nb_samples,
+                              const_cast<const uint8_t**>(frame_->extended_data),
+                              frame_->nb_samples);
+  const int64_t pts_us = FrameTimeUs(frame_);
+  const size_t pkt_size = (size_t)std::max(frame_->pkt_size, 0);
+  av_frame_unref(frame_);
+  if (converted < 0) {
+    return ERROR_MALFORMED;
+  }
+  pcm->nb_samples = converted;
 
+  buffer = std::make_shared<MediaBuffer>();
+  buffer->frame = out;
+  buffer->data = std::shared_ptr<uint8_t>(out, pcm->data[0]);
+  buffer->size = (size_t)converted * channels * sizeof(int16_t);
+  buffer->ptsUs = pts_us;
+  buffer->sampleRate = pcm->sample_rate;
+  buffer->channelCount = channels;
   buffer->isKeyFrame = false;  // Audio typically doesn't have keyframes
-  mStatus.currentTimeUs = frame_->pts;
-  mStatus.bufferedBytes = std::max(static_cast<ssize_t>(0), static_cast<ssize_t>(mStatus.bufferedBytes) - frame_size);
+  mStatus.currentTimeUs = pts_us;
+  mStatus.bufferedBytes -= std::min(mStatus.bufferedBytes, pkt_size);
   return OK;
 }
 
@@ -270,13 +486,17 @@ status_t FFmpegAudioDecoder::seek(int64_t time_us) {
     return ERROR_INVALID_FORMAT;
   }
 
-  flush();
+  FlushLocked();
   mStatus.currentTimeUs = time_us;
   return OK;
 }
 
 status_t FFmpegAudioDecoder::flush() {
   std::lock_guard<std::mutex> lock(mMutex);
+  return FlushLocked();
+}
+
+status_t FFmpegAudioDecoder::FlushLocked() {
   if (!initialized_) {
     return OK;
   }
@@ -299,13 +519,12 @@ status_t FFmpegAudioDecoder::onFormatChanged(const MetaData& new_meta) {
   return init(new_meta);
 }
 
+// frame_ and packet_ stay for the next init().
 void FFmpegAudioDecoder::FreeResources() {
-  if (frame_) {
-    av_frame_free(&frame_);
-  }
-  if (packet_) {
-    av_packet_free(&packet_);
-  }
+  av_frame_unref(frame_);
+  av_packet_unref(packet_);
+  swr_free(&swr_);
+  swr_format_ = -1;
   if (codec_context_) {
     avcodec_free_context(&codec_context_);
   }
@@ -316,4 +535,10 @@ bool FFmpegAudioDecoder::isSupportedMime(const std::string& mime_type) {
   return FindCodecByMime(mime_type, false) != nullptr;
 }
 
+void FFmpegAudioDecoder::setPlaybackStats(const std::shared_ptr<PlaybackStats>& stats) {
+  Decoder::setPlaybackStats(stats);
+  std::lock_guard<std::mutex> lock(mMutex);
+  playback_stats_ = stats;
+}
+
 }  // namespace hpc
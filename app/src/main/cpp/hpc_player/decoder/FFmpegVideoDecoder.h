@@ -5,23 +5,34 @@
 #include <string>
 
 #include "DecoderBase.h"
+#include "StartupTimeline.h"
+#include "PlaybackStats.h"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavutil/frame.h>
 #include <libavutil/mem.h>
+#include <libswresample/swresample.h>
 }
 
 namespace hpc {
 
+class MediaPacket;
+
 class FFmpegVideoDecoder : public Decoder {
  public:
   explicit FFmpegVideoDecoder(bool async_mode = true);
   ~FFmpegVideoDecoder() override;
 
   status_t init(const MetaData& meta) override;
+  // Copies the payload: libavcodec cannot reference a MediaBuffer.
   status_t input(const std::shared_ptr<MediaBuffer>& buffer) override;
+  // The codec takes another reference to the demuxer's buffer, side data
+  // included, nothing is copied.
+  status_t input(const MediaPacket& packet) override;
+  // The decoded frame by reference, MediaBuffer::frame, pts in
+  // microseconds. Nothing is copied out of the codec's frame pool.
   status_t output(std::shared_ptr<MediaBuffer>& buffer) override;
   status_t seek(int64_t time_us) override;
   status_t flush() override;
@@ -29,15 +40,34 @@ class FFmpegVideoDecoder : public Decoder {
 
   static bool isSupportedMime(const std::string& mime_type);
 
+  // Marks the first decoded frame on |timeline|.
+  void setStartupTimeline(const std::shared_ptr<StartupTimeline>& timeline);
+
+  // Reports decoded frames with their codec time, packets the codec
+  // refused as skipped frames and payload bytes copied on input.
+  void setPlaybackStats(const std::shared_ptr<PlaybackStats>& stats) override;
+
+  // Trick play: the codec skips everything but sync samples
+  // (AVDISCARD_NONKEY), so stray non-key packets cost no decode time.
+  void setKeyFramesOnly(bool key_frames_only);
+
  private:
   status_t onFormatChanged(const MetaData& new_meta) override;
+  status_t SendPacket(size_t size);
+  status_t FlushLocked();
   void FreeResources();
 
-  AVCodec* codec_ = nullptr;
+  const AVCodec* codec_ = nullptr;
   AVCodecContext* codec_context_ = nullptr;
   AVFrame* frame_ = nullptr;
   AVPacket* packet_ = nullptr;
   bool initialized_ = false;
+  bool key_frames_only_ = false;
+  std::shared_ptr<StartupTimeline> startup_timeline_;
+  std::shared_ptr<PlaybackStats> playback_stats_;
+  // codec time spent on input since the last frame came out, that frame is
+  // charged with it.
+  int64_t pending_decode_us_ = 0;
 };
 
 class FFmpegAudioDecoder : public Decoder {
@@ -46,7 +76,13 @@ class FFmpegAudioDecoder : public Decoder {
   ~FFmpegAudioDecoder() override;
 
   status_t init(const MetaData& meta) override;
+  // Copies the payload: libavcodec cannot reference a MediaBuffer.
   status_t input(const std::shared_ptr<MediaBuffer>& buffer) override;
+  // The codec takes another reference to the demuxer's buffer, side data
+  // included, nothing is copied.
+  status_t input(const MediaPacket& packet) override;
+  // 16 bit interleaved PCM, converted by libswresample when the codec
+  // decodes to another sample format, pts in microseconds.
   status_t output(std::shared_ptr<MediaBuffer>& buffer) override;
   status_t seek(int64_t time_us) override;
   status_t flush() override;
@@ -54,15 +90,25 @@ class FFmpegAudioDecoder : public Decoder {
 
   static bool isSupportedMime(const std::string& mime_type);
 
+  // Reports payload bytes copied on input.
+  void setPlaybackStats(const std::shared_ptr<PlaybackStats>& stats) override;
+
  private:
   status_t onFormatChanged(const MetaData& new_meta) override;
+  status_t SendPacket(size_t size);
+  status_t FlushLocked();
   void FreeResources();
 
-  AVCodec* codec_ = nullptr;
+  const AVCodec* codec_ = nullptr;
   AVCodecContext* codec_context_ = nullptr;
   AVFrame* frame_ = nullptr;
   AVPacket* packet_ = nullptr;
+  SwrContext* swr_ = nullptr;  // to S16, for the input format below
+  int swr_format_ = -1;
+  int64_t swr_layout_ = 0;
+  int swr_rate_ = 0;
   bool initialized_ = false;
+  std::shared_ptr<PlaybackStats> playback_stats_;
 };
 
 }  // namespace hpc
@@ -9,19 +9,28 @@ MediaCodecAudioDecoder::MediaCodecAudioDecoder() : MediaCodecDecoder() {}
 status_t MediaCodecAudioDecoder::configureCodec(AMediaFormat* format, const MetaData& meta) {
   // Set audio-specific parameters
   AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_SAMPLE_RATE, meta.sampleRate);
-  AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_CHANNEL_COUNT, meta.channels);
+  AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_CHANNEL_COUNT, meta.channelCount);
   // Add other audio-specific parameters (e.g., pcm-encoding) as needed
   return OK;
 }
 
 status_t MediaCodecAudioDecoder::processOutputBuffer(AMediaCodecBufferInfo& info, size_t bufferIndex,
                                                      std::shared_ptr<MediaBuffer>& buffer) {
-  size_t outSize;
-  uint8_t* outData = AMediaCodec_getOutputBuffer(mCodec, bufferIndex, &outSize);
-  if (!outData || outSize == 0) {
+  const bool eos = (info.flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM) != 0;
+  size_t capacity;
+  uint8_t* outData = AMediaCodec_getOutputBuffer(mCodec, bufferIndex, &capacity);
+  const size_t outSize = info.size > 0 ? (size_t)info.size : 0;
+  if (!outData || outSize == 0 || (size_t)info.offset + outSize > capacity) {
+    // the EOS flag usually comes on an empty buffer
     AMediaCodec_releaseOutputBuffer(mCodec, bufferIndex, false);
+    if (eos) {
+      buffer = std::make_shared<MediaBuffer>();
+      buffer->isEOS = true;
+      return ERROR_END_OF_STREAM;
+    }
     return ERROR_UNKNOWN;
   }
+  outData += info.offset;
 
   // Create output buffer (PCM data for audio)
   buffer = std::make_shared<MediaBuffer>();
@@ -29,7 +38,9 @@ status_t MediaCodecAudioDecoder::processOutputBuffer(AMediaCodecBufferInfo& info
   buffer->size = outSize;
   buffer->ptsUs = info.presentationTimeUs;
   buffer->isKeyFrame = false;  // Audio typically doesn't have keyframes
-  buffer->isEOS = (info.flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM) != 0;
+  buffer->sampleRate = mMeta.sampleRate;
+  buffer->channelCount = mMeta.channelCount;
+  buffer->isEOS = eos;
   memcpy(buffer->data.get(), outData, outSize);
 
   // Release codec buffer
@@ -43,7 +54,7 @@ status_t MediaCodecAudioDecoder::seek(int64_t timeUs) {
   if (!mInitialized) return ERROR_UNKNOWN;
 
   // Flush codec and reset state
-  status_t status = flush();
+  status_t status = flushLocked();
   if (status != OK) return status;
 
   mStatus.currentTimeUs = timeUs;
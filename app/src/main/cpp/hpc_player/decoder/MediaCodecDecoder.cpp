@@ -1,4 +1,5 @@
 #include "MediaCodecDecoder.h"
+#include "MediaPacket.h"
 #include <android/log.h>
 #include <string.h>
 
@@ -15,17 +16,26 @@ status_t MediaCodecDecoder::init(const MetaData& meta) {
   if (mInitialized) return OK;
 
   mMeta = meta;
-  mCodec = AMediaCodec_createDecoderByType(meta.mimeType.c_str());
+  mCodec = AMediaCodec_createDecoderByType(meta.mime.c_str());
   if (!mCodec) {
     __android_log_print(ANDROID_LOG_ERROR, "MediaCodecDecoder", "Failed to create codec for %s",
-                        meta.mimeType.c_str());
+                        meta.mime.c_str());
     return ERROR_INVALID_FORMAT;
   }
 
   // Create and configure MediaFormat
   AMediaFormat* format = AMediaFormat_new();
-  AMediaFormat_setString(format, AMEDIAFORMAT_KEY_MIME, meta.mimeType.c_str());
-  AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_BIT_RATE, meta.bitrate);
+  AMediaFormat_setString(format, AMEDIAFORMAT_KEY_MIME, meta.mime.c_str());
+  AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_BIT_RATE, meta.BitRate);
+
+  // Parameter sets once per format, not in every key frame
+  const std::vector<uint8_t>& csd = mCsd.empty() ? meta.csd : mCsd;
+  if (mConverter.configure(meta.mime, csd.data(), csd.size()) == OK) {
+    const std::vector<uint8_t>& csd0 = mConverter.getCsd0();
+    const std::vector<uint8_t>& csd1 = mConverter.getCsd1();
+    if (!csd0.empty()) AMediaFormat_setBuffer(format, "csd-0", csd0.data(), csd0.size());
+    if (!csd1.empty()) AMediaFormat_setBuffer(format, "csd-1", csd1.data(), csd1.size());
+  }
 
   // Let subclass configure specific parameters
   status_t status = configureCodec(format, meta);
@@ -38,7 +48,7 @@ status_t MediaCodecDecoder::init(const MetaData& meta) {
 
   // Configure codec in async decode mode
   media_status_t codecStatus = AMediaCodec_configure(mCodec, format, nullptr /* surface */,
-                                                     nullptr /* crypto */, AMEDIACODEC_CONFIGURE_FLAG_ENCODE);
+                                                     nullptr /* crypto */, 0 /* flags */);
   AMediaFormat_delete(format);
   if (codecStatus != AMEDIA_OK) {
     __android_log_print(ANDROID_LOG_ERROR, "MediaCodecDecoder", "Failed to configure codec");
@@ -77,8 +87,10 @@ status_t MediaCodecDecoder::input(const std::shared_ptr<MediaBuffer>& buffer) {
     return ERROR_BUFFER_FULL;
   }
 
-  // Copy data to codec input buffer
-  memcpy(inputData, buffer->data.get(), buffer->size);
+  // Copy data to codec input buffer, an EOS buffer may come empty
+  if (buffer->size > 0) {
+    memcpy(inputData, buffer->data.get(), buffer->size);
+  }
   uint32_t flags = buffer->isEOS ? AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM : 0;
   media_status_t status = AMediaCodec_queueInputBuffer(mCodec, inputIndex, 0 /* offset */, buffer->size,
                                                        buffer->ptsUs, flags);
@@ -91,6 +103,83 @@ status_t MediaCodecDecoder::input(const std::shared_ptr<MediaBuffer>& buffer) {
   return OK;
 }
 
+status_t MediaCodecDecoder::input(const MediaPacket& packet) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (!mInitialized) return ERROR_UNKNOWN;
+
+  ssize_t inputIndex = AMediaCodec_dequeueInputBuffer(mCodec, 10000 /* timeoutUs */);
+  if (inputIndex < 0) {
+    __android_log_print(ANDROID_LOG_WARN, "MediaCodecDecoder", "No input buffer available: %zd", inputIndex);
+    return ERROR_BUFFER_FULL;
+  }
+
+  size_t bufferSize;
+  uint8_t* inputData = AMediaCodec_getInputBuffer(mCodec, inputIndex, &bufferSize);
+  int64_t ptsUs = packet.ptsUs >= 0 ? packet.ptsUs : packet.dtsUs;
+  ptsUs = ptsUs >= 0 ? ptsUs : 0;
+
+  // The dequeued buffer belongs to us until it is queued, a packet that is
+  // not going in still has to hand it back, empty, or the slot is lost.
+  if (!inputData) {
+    AMediaCodec_queueInputBuffer(mCodec, inputIndex, 0 /* offset */, 0, ptsUs, 0 /* flags */);
+    return ERROR_BUFFER_FULL;
+  }
+
+  // New parameter sets mid-stream go in band, ahead of their key frame
+  size_t offset = 0;
+  int extradataSize = 0;
+  const uint8_t* extradata = packet.sideData(AV_PKT_DATA_NEW_EXTRADATA, &extradataSize);
+  if (extradata && extradataSize > 0
+      && mConverter.configure(mMeta.mime, extradata, extradataSize) == OK
+      && !mConverter.isPassThrough()) {
+    const std::vector<uint8_t>& csd0 = mConverter.getCsd0();
+    const std::vector<uint8_t>& csd1 = mConverter.getCsd1();
+    if (bufferSize >= csd0.size() + csd1.size()) {
+      memcpy(inputData, csd0.data(), csd0.size());
+      memcpy(inputData + csd0.size(), csd1.data(), csd1.size());
+      offset = csd0.size() + csd1.size();
+    }
+  }
+
+  size_t size = mConverter.convertedSize(packet.data(), packet.size());
+  if (bufferSize - offset < size) {
+    __android_log_print(ANDROID_LOG_WARN, "MediaCodecDecoder",
+                        "Dropping packet of %zu bytes, input buffer holds %zu", size,
+                        bufferSize - offset);
+    AMediaCodec_queueInputBuffer(mCodec, inputIndex, 0 /* offset */, 0, ptsUs, 0 /* flags */);
+    return ERROR_BUFFER_TOO_SMALL;
+  }
+
+  // A start code is as long as a four byte length: that case is the copy
+  // the codec needs anyway, rewritten in place. Other lengths convert
+  // straight into the input buffer.
+  status_t err;
+  if (size == (size_t)packet.size()) {
+    memcpy(inputData + offset, packet.data(), packet.size());
+    err = mConverter.convertInPlace(inputData + offset, size);
+  } else {
+    err = mConverter.convert(packet.data(), packet.size(), inputData + offset,
+                             bufferSize - offset, &size);
+  }
+  if (err != OK) {
+    __android_log_print(ANDROID_LOG_WARN, "MediaCodecDecoder", "Dropping malformed packet: %d", err);
+    // hand the buffer back, empty
+    AMediaCodec_queueInputBuffer(mCodec, inputIndex, 0 /* offset */, 0, ptsUs, 0 /* flags */);
+    return err;
+  }
+
+  uint32_t flags = packet.isKeyFrame() ? AMEDIACODEC_BUFFER_FLAG_KEY_FRAME : 0;
+  media_status_t status = AMediaCodec_queueInputBuffer(mCodec, inputIndex, 0 /* offset */, offset + size,
+                                                       ptsUs, flags);
+  if (status != AMEDIA_OK) {
+    __android_log_print(ANDROID_LOG_ERROR, "MediaCodecDecoder", "Failed to queue input buffer");
+    return ERROR_UNKNOWN;
+  }
+
+  mStatus.bufferedBytes += offset + size;
+  return OK;
+}
+
 status_t MediaCodecDecoder::output(std::shared_ptr<MediaBuffer>& buffer) {
   std::lock_guard<std::mutex> lock(mMutex);
   if (!mInitialized) return ERROR_UNKNOWN;
@@ -101,22 +190,20 @@ status_t MediaCodecDecoder::output(std::shared_ptr<MediaBuffer>& buffer) {
     // Valid output buffer
     return processOutputBuffer(info, outputIndex, buffer);
   } else if (outputIndex == AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED) {
-    // Handle format change
+    // The output format, e.g. the decoded size or the PCM layout; the codec
+    // stays as it is. No buffer this time.
     AMediaFormat* format = AMediaCodec_getOutputFormat(mCodec);
-    MetaData newMeta;
-    char* mime;
-    AMediaFormat_getString(format, AMEDIAFORMAT_KEY_MIME, &mime);
-    newMeta.mimeType = mime;
-    AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_WIDTH, &newMeta.width);
-    AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_HEIGHT, &newMeta.height);
-    AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_BIT_RATE, &newMeta.bitrate);
+    AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_WIDTH, &mMeta.width);
+    AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_HEIGHT, &mMeta.height);
+    AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_SAMPLE_RATE, &mMeta.sampleRate);
+    AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_CHANNEL_COUNT, &mMeta.channelCount);
     AMediaFormat_delete(format);
-    return onFormatChanged(newMeta);
+    return OK;
   } else if (outputIndex == AMEDIACODEC_INFO_OUTPUT_BUFFERS_CHANGED) {
     // Deprecated in NDK, ignore
     return OK;
   } else if (outputIndex == AMEDIACODEC_INFO_TRY_AGAIN_LATER) {
-    return ERROR_BUFFER_FULL;
+    return WOULD_BLOCK;
   }
 
   __android_log_print(ANDROID_LOG_ERROR, "MediaCodecDecoder", "Unexpected output status: %zd", outputIndex);
@@ -125,6 +212,10 @@ status_t MediaCodecDecoder::output(std::shared_ptr<MediaBuffer>& buffer) {
 
 status_t MediaCodecDecoder::flush() {
   std::lock_guard<std::mutex> lock(mMutex);
+  return flushLocked();
+}
+
+status_t MediaCodecDecoder::flushLocked() {
   if (!mInitialized) return OK;
 
   media_status_t status = AMediaCodec_flush(mCodec);
@@ -150,9 +241,8 @@ void MediaCodecDecoder::release() {
 }
 
 status_t MediaCodecDecoder::onFormatChanged(const MetaData& newMeta) {
-  // Default implementation: update metadata
-  mMeta = newMeta;
-  return OK;
+  release();
+  return init(newMeta);
 }
 
 }  // namespace hpc
\ No newline at end of file
@@ -1,23 +1,36 @@
 #pragma once
 
+#include "BitstreamConverter.h"
 #include "DecoderBase.h"
 #include <media/NdkMediaCodec.h>  // MediaCodec NDK API
 #include <media/NdkMediaFormat.h>
 
 namespace hpc {
 
+class MediaPacket;
+
 class MediaCodecDecoder : public Decoder {
  public:
   // Constructor: enable async mode by default
   MediaCodecDecoder();
   ~MediaCodecDecoder() override;
 
+  // The codec configuration of the track before init(), MetaData::csd if
+  // not set. An avcC or hvcC record goes to csd-0 and csd-1 as Annex-B
+  // parameter sets and packets are converted to Annex-B on their way in.
+  void setCodecSpecificData(const std::vector<uint8_t>& csd) { mCsd = csd; }
+
   // Initialize the decoder with metadata
   status_t init(const MetaData& meta) override;
 
   // Feed input buffer to codec
   status_t input(const std::shared_ptr<MediaBuffer>& buffer) override;
 
+  // Feed a demuxed packet to codec. The codec owns its input buffers, so
+  // the payload is copied once, straight out of the demuxer's buffer, and
+  // converted to Annex-B there.
+  status_t input(const MediaPacket& packet) override;
+
   // Retrieve decoded frame
   status_t output(std::shared_ptr<MediaBuffer>& buffer) override;
 
@@ -28,9 +41,12 @@ class MediaCodecDecoder : public Decoder {
   void release() override;
 
  protected:
-  // Handle format change (virtual for subclasses to override)
+  // Reopens the codec for the new format of the track.
   status_t onFormatChanged(const MetaData& newMeta) override;
 
+  // Flushes with mMutex held, for seek().
+  status_t flushLocked();
+
   // Configure MediaCodec with metadata (to be specialized by subclasses)
   virtual status_t configureCodec(AMediaFormat* format, const MetaData& meta) = 0;
 
@@ -39,6 +55,8 @@ class MediaCodecDecoder : public Decoder {
                                        std::shared_ptr<MediaBuffer>& buffer) = 0;
 
   AMediaCodec* mCodec;  // MediaCodec instance
+  std::vector<uint8_t> mCsd;
+  BitstreamConverter mConverter;
 };
 
 }  // namespace hpc
\ No newline at end of file
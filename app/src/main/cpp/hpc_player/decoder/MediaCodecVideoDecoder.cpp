@@ -16,12 +16,21 @@ status_t MediaCodecVideoDecoder::configureCodec(AMediaFormat* format, const Meta
 
 status_t MediaCodecVideoDecoder::processOutputBuffer(AMediaCodecBufferInfo& info, size_t bufferIndex,
                                                      std::shared_ptr<MediaBuffer>& buffer) {
-  size_t outSize;
-  uint8_t* outData = AMediaCodec_getOutputBuffer(mCodec, bufferIndex, &outSize);
-  if (!outData || outSize == 0) {
+  const bool eos = (info.flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM) != 0;
+  size_t capacity;
+  uint8_t* outData = AMediaCodec_getOutputBuffer(mCodec, bufferIndex, &capacity);
+  const size_t outSize = info.size > 0 ? (size_t)info.size : 0;
+  if (!outData || outSize == 0 || (size_t)info.offset + outSize > capacity) {
+    // the EOS flag usually comes on an empty buffer
     AMediaCodec_releaseOutputBuffer(mCodec, bufferIndex, false);
+    if (eos) {
+      buffer = std::make_shared<MediaBuffer>();
+      buffer->isEOS = true;
+      return ERROR_END_OF_STREAM;
+    }
     return ERROR_UNKNOWN;
   }
+  outData += info.offset;
 
   // Create output buffer
   buffer = std::make_shared<MediaBuffer>();
@@ -29,7 +38,7 @@ status_t MediaCodecVideoDecoder::processOutputBuffer(AMediaCodecBufferInfo& info
   buffer->size = outSize;
   buffer->ptsUs = info.presentationTimeUs;
   buffer->isKeyFrame = (info.flags & AMEDIACODEC_BUFFER_FLAG_KEY_FRAME) != 0;
-  buffer->isEOS = (info.flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM) != 0;
+  buffer->isEOS = eos;
   memcpy(buffer->data.get(), outData, outSize);
 
   // Release codec buffer (render=false, as output is copied to MediaBuffer)
@@ -43,7 +52,7 @@ status_t MediaCodecVideoDecoder::seek(int64_t timeUs) {
   if (!mInitialized) return ERROR_UNKNOWN;
 
   // Flush codec and reset state
-  status_t status = flush();
+  status_t status = flushLocked();
   if (status != OK) return status;
 
   mStatus.currentTimeUs = timeUs;
@@ -0,0 +1,535 @@
+#include "ConcatExtractor.h"
+#include "FFmpegExtractor.h"
+#include "Log.h"
+#include "Looper.h"
+#include "MediaPacket.h"
+#include "MetaData.h"
+#include "MmapSource.h"
+#include "Mp4Extractor.h"
+#include "TsExtractor.h"
+
+#include <algorithm>
+#include <cstring>
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+}
+
+#define LOG_TAG "ConcatExtractor"
+
+namespace hpc {
+
+namespace {
+
+// Local files are mapped and demuxed natively where DefaultSource would,
+// everything else goes to FFmpeg.
+std::shared_ptr<Extractor> openSegment(const std::string &url) {
+  std::shared_ptr<MmapSource> mapped = MmapSource::Create(url.c_str());
+  if (mapped != nullptr && mapped->initCheck() != OK) {
+    mapped.reset();
+  }
+  if (mapped != nullptr && Mp4Extractor::Sniff(mapped.get())) {
+    std::shared_ptr<Mp4Extractor> mp4 = std::make_shared<Mp4Extractor>();
+    mp4->setDataSource(mapped);
+    if (mp4->init(url.c_str()) == OK) {
+      return mp4;
+    }
+  } else if (mapped != nullptr && TsExtractor::Sniff(mapped.get())) {
+    std::shared_ptr<TsExtractor> ts = std::make_shared<TsExtractor>();
+    ts->setDataSource(mapped);
+    if (ts->init(url.c_str()) == OK) {
+      return ts;
+    }
+  }
+  std::shared_ptr<FFmpegExtractor> ffmpeg = std::make_shared<FFmpegExtractor>();
+  if (mapped != nullptr) {
+    ffmpeg->setDataSource(mapped);
+  }
+  return ffmpeg->init(url.c_str()) == OK ? ffmpeg : nullptr;
+}
+
+bool sameExtradata(const AVCodecParameters *a, const AVCodecParameters *b) {
+  return a->extradata_size == b->extradata_size
+      && (a->extradata_size == 0 || memcmp(a->extradata, b->extradata, a->extradata_size) == 0);
+}
+
+} // namespace
+
+ConcatExtractor::ConcatExtractor(const std::vector<std::string> &urls)
+    : mFactory(openSegment) {
+  for (const std::string &url : urls) {
+    mSegments.push_back(Segment{url});
+  }
+}
+
+ConcatExtractor::~ConcatExtractor() {
+  release();
+}
+
+void ConcatExtractor::setExtractorFactory(const Factory &factory) {
+  mFactory = factory;
+}
+
+void ConcatExtractor::setOpenAhead(bool openAhead) {
+  mOpenAhead = openAhead;
+}
+
+status_t ConcatExtractor::init(const char *url) {
+  if (mSegments.empty()) {
+    return BAD_VALUE;
+  }
+  std::unique_ptr<Opened> first = open(0, mSelected);
+  if (first->err != OK) {
+    ALOGE("cannot open the first segment of %s: %d", url, first->err);
+    return first->err;
+  }
+  mTrackInfos.resize(first->extractor->getTrackCount());
+  for (size_t i = 0; i < mTrackInfos.size(); ++i) {
+    first->extractor->getTrackInfo(i, &mTrackInfos[i]);
+  }
+  mTrack[kVideo] = first->track[kVideo];
+  mTrack[kAudio] = first->track[kAudio];
+  mOffsetUs = 0;
+  mEndUs = 0;
+  switchTo(std::move(first));
+  ALOGD("%zu segments for %s", mSegments.size(), url);
+  return OK;
+}
+
+std::unique_ptr<ConcatExtractor::Opened> ConcatExtractor::open(
+    size_t index, const bool selected[kNumTypes]) const {
+  const int64_t startUs = Looper::GetNowUs();
+  std::unique_ptr<Opened> opened = std::make_unique<Opened>();
+  opened->index = index;
+  opened->extractor = mFactory(mSegments[index].url);
+  if (opened->extractor == nullptr) {
+    opened->err = ERROR_UNSUPPORTED;
+    return opened;
+  }
+  Extractor *extractor = opened->extractor.get();
+  opened->track[kVideo] = extractor->getVideoStreamIndex();
+  opened->track[kAudio] = extractor->getAudioStreamIndex();
+  for (int type = 0; type < kNumTypes; ++type) {
+    if (!selected[type] && opened->track[type] >= 0) {
+      extractor->selectTrack(opened->track[type], false);
+    }
+  }
+  opened->containerDurationUs = extractor->getDurationUs();
+
+  // Where its timestamps start, the earlier of the first packet's pts and
+  // dts so that decode order carries on across the boundary.
+  status_t err = extractor->read(opened->first, -1);
+  if (err == OK) {
+    const MediaPacket &first = *opened->first;
+    opened->startUs = first.dtsUs != -1 && (first.ptsUs == -1 || first.dtsUs < first.ptsUs)
+        ? first.dtsUs : std::max<int64_t>(first.ptsUs, 0);
+  } else if (err != ERROR_END_OF_STREAM) {
+    opened->err = err;
+  }
+  ALOGV("segment %zu open in %lld us, starts at %lld us", index,
+        (long long)(Looper::GetNowUs() - startUs), (long long)opened->startUs);
+  return opened;
+}
+
+void ConcatExtractor::openAhead() {
+  if (!mOpenAhead || mCurrent == nullptr || mOpenThread.joinable() || mNext != nullptr) {
+    return;
+  }
+  const size_t index = mCurrent->index + 1;
+  if (index >= mSegments.size()) {
+    return;
+  }
+  const int64_t durationUs = mCurrent->containerDurationUs;
+  if (durationUs > 0 && mEndUs - mOffsetUs < durationUs - kOpenAheadUs) {
+    return;
+  }
+  const bool selected[kNumTypes] = {mSelected[kVideo], mSelected[kAudio]};
+  mOpenThread = std::thread([this, index, selected]() {
+    mNext = open(index, selected);
+  });
+}
+
+void ConcatExtractor::joinOpen() {
+  if (mOpenThread.joinable()) {
+    mOpenThread.join();
+  }
+}
+
+std::unique_ptr<ConcatExtractor::Opened> ConcatExtractor::take(size_t index) {
+  joinOpen();
+  std::unique_ptr<Opened> next = std::move(mNext);
+  if (next != nullptr && next->index != index) {
+    if (next->extractor != nullptr) {
+      next->extractor->release();
+    }
+    next.reset();
+  }
+  return next != nullptr ? std::move(next) : open(index, mSelected);
+}
+
+void ConcatExtractor::switchTo(std::unique_ptr<Opened> opened) {
+  if (mCurrent != nullptr && mCurrent->extractor != nullptr) {
+    mCurrent->extractor->release();
+  }
+  mCurrent = std::move(opened);
+
+  for (int type = 0; type < kNumTypes; ++type) {
+    const int track = mCurrent->track[type];
+    if (mTrack[type] < 0 || track < 0) {
+      continue;
+    }
+    Format format;
+    format.valid = true;
+    mCurrent->extractor->getTrackInfo(track, &format.info);
+    format.params = avcodec_parameters_alloc();
+    if (format.params != nullptr
+        && mCurrent->extractor->getCodecParameters(track, format.params) != OK) {
+      avcodec_parameters_free(&format.params);
+    }
+
+    Format &last = mFormat[type];
+    Change change = kSame;
+    if (!last.valid) {
+      // what the decoder is opened with
+    } else if (format.info.mime_type != last.info.mime_type
+        || format.info.width != last.info.width || format.info.height != last.info.height
+        || format.info.sample_rate != last.info.sample_rate
+        || format.info.channel_count != last.info.channel_count
+        || (format.params == nullptr) != (last.params == nullptr)) {
+      change = kReconfigure;
+    } else if (format.params != nullptr) {
+      const AVCodecParameters *a = format.params;
+      const AVCodecParameters *b = last.params;
+      if (a->codec_id != b->codec_id || a->profile != b->profile
+          || a->width != b->width || a->height != b->height
+          || a->sample_rate != b->sample_rate || a->channels != b->channels) {
+        change = kReconfigure;
+      } else if (!sameExtradata(a, b)) {
+        // New SPS and PPS of the same size and profile are taken in band;
+        // an audio decoder has to be opened with its config.
+        change = type == kVideo && a->extradata_size > 0 && b->extradata_size > 0
+            ? kNewExtradata : kReconfigure;
+      }
+    }
+    // A seek over several segments tells the decoder the most it has to do.
+    mPending[type] = std::max(mPending[type], change);
+    avcodec_parameters_free(&last.params);
+    last = format;
+  }
+}
+
+status_t ConcatExtractor::advance(bool *ahead) {
+  // Read through: the timeline goes by what was played from here on.
+  Segment &segment = mSegments[mCurrent->index];
+  if (mEndUs > mOffsetUs) {
+    segment.durationUs = mEndUs - mOffsetUs;
+  } else if (segment.durationUs < 0) {
+    segment.durationUs = std::max<int64_t>(mCurrent->containerDurationUs, 0);
+  }
+  const int64_t offsetUs = mOffsetUs + segment.durationUs;
+
+  *ahead = mOpenThread.joinable() || mNext != nullptr;
+  for (size_t index = mCurrent->index + 1; index < mSegments.size(); ++index) {
+    std::unique_ptr<Opened> next = take(index);
+    if (next->err == OK) {
+      ALOGD("segment %zu at %lld us%s", index, (long long)offsetUs,
+            *ahead ? "" : ", opened late");
+      mOffsetUs = offsetUs;
+      mEndUs = offsetUs;
+      switchTo(std::move(next));
+      std::lock_guard<std::mutex> autoLock(mLock);
+      ++mStats.boundaries;
+      mStats.openedAhead += *ahead ? 1 : 0;
+      return OK;
+    }
+    ALOGW("skipping segment %zu, %s: %d", index, mSegments[index].url.c_str(), next->err);
+    mSegments[index].durationUs = 0;
+    *ahead = false;
+    std::lock_guard<std::mutex> autoLock(mLock);
+    ++mStats.failed;
+  }
+  return ERROR_END_OF_STREAM;
+}
+
+int ConcatExtractor::typeOf(int segmentTrack) const {
+  for (int type = 0; type < kNumTypes; ++type) {
+    if (mTrack[type] >= 0 && mSelected[type] && mCurrent->track[type] == segmentTrack) {
+      return type;
+    }
+  }
+  return -1;
+}
+
+// The current segment's format of |type|, as DefaultSource describes a
+// track to the decoders.
+std::shared_ptr<MetaData> ConcatExtractor::formatOf(int type) const {
+  std::shared_ptr<MetaData> meta = std::make_shared<MetaData>();
+  const Format &format = mFormat[type];
+  if (type == kVideo) {
+    mCurrent->extractor->getMetaData(*meta);
+  }
+  meta->mime = format.info.mime_type;
+  if (type == kVideo) {
+    meta->width = format.info.width;
+    meta->height = format.info.height;
+  } else {
+    meta->sampleRate = format.info.sample_rate;
+    meta->channelCount = format.info.channel_count;
+  }
+  if (format.params != nullptr && format.params->extradata_size > 0) {
+    meta->csd.assign(format.params->extradata,
+                     format.params->extradata + format.params->extradata_size);
+  }
+  return meta;
+}
+
+void ConcatExtractor::deliver(MediaPacket *packet, int type) {
+  packet->trackIndex = mTrack[type];
+  const int64_t shiftUs = mOffsetUs - mCurrent->startUs;
+  if (packet->ptsUs != -1) {
+    packet->ptsUs += shiftUs;
+    mEndUs = std::max(mEndUs, packet->ptsUs + packet->durationUs);
+  }
+  if (packet->dtsUs != -1) {
+    packet->dtsUs += shiftUs;
+  }
+
+  const Change change = mPending[type];
+  mPending[type] = kSame;
+  if (change == kReconfigure) {
+    packet->format = formatOf(type);
+  } else if (change == kNewExtradata) {
+    const AVCodecParameters *params = mFormat[type].params;
+    uint8_t *data = av_packet_new_side_data(packet->avPacket(), AV_PKT_DATA_NEW_EXTRADATA,
+                                            params->extradata_size);
+    if (data != nullptr) {
+      memcpy(data, params->extradata, params->extradata_size);
+    }
+  }
+  if (change != kSame) {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    ++(change == kReconfigure ? mStats.reconfigures : mStats.newExtradata);
+  }
+}
+
+int ConcatExtractor::read(std::unique_ptr<MediaPacket> &packet, int index) {
+  if (mCurrent == nullptr) {
+    return NO_INIT;
+  }
+  int64_t stallStartUs = -1;
+  for (;;) {
+    int track = -1;
+    for (int type = 0; type < kNumTypes; ++type) {
+      if (index >= 0 && mTrack[type] == index) {
+        track = mCurrent->track[type];
+      }
+    }
+    status_t err;
+    if (mCurrent->first != nullptr) {
+      packet = std::move(mCurrent->first);
+      err = OK;
+    } else if (index >= 0 && track < 0) {
+      err = ERROR_END_OF_STREAM;
+    } else {
+      err = mCurrent->extractor->read(packet, index >= 0 ? track : -1);
+    }
+    if (err == ERROR_END_OF_STREAM && mCurrent->index + 1 < mSegments.size()) {
+      if (stallStartUs < 0) {
+        stallStartUs = Looper::GetNowUs();
+      }
+      bool ahead = false;
+      err = advance(&ahead);
+      if (err == OK) {
+        continue;
+      }
+    }
+    if (err != OK) {
+      return err;
+    }
+    const int type = typeOf(packet->trackIndex);
+    if (type < 0 || (index >= 0 && mTrack[type] != index)) {
+      continue;
+    }
+    deliver(packet.get(), type);
+    if (stallStartUs >= 0) {
+      std::lock_guard<std::mutex> autoLock(mLock);
+      mStats.stallsUs.push_back(Looper::GetNowUs() - stallStartUs);
+    }
+    openAhead();
+    return OK;
+  }
+}
+
+status_t ConcatExtractor::seek(int64_t position, SeekMode mode) {
+  if (mCurrent == nullptr) {
+    return NO_INIT;
+  }
+  joinOpen();
+  if (mNext != nullptr && mNext->extractor != nullptr) {
+    mNext->extractor->release();
+  }
+  mNext.reset();
+
+  // The segment |position| falls in. Those not played yet count with the
+  // container's duration, opened for it; that fixes where they start.
+  position = std::max<int64_t>(position, 0);
+  size_t index = 0;
+  int64_t offsetUs = 0;
+  std::unique_ptr<Opened> target;
+  for (; index < mSegments.size(); ++index) {
+    std::unique_ptr<Opened> opened;
+    int64_t durationUs = mSegments[index].durationUs;
+    if (durationUs < 0 && index == mCurrent->index) {
+      durationUs = mCurrent->containerDurationUs;
+    } else if (durationUs < 0) {
+      opened = open(index, mSelected);
+      durationUs = opened->err == OK ? opened->containerDurationUs : 0;
+      mSegments[index].durationUs = durationUs;
+    }
+    if (position < offsetUs + durationUs || index + 1 == mSegments.size()) {
+      target = std::move(opened);
+      break;
+    }
+    if (opened != nullptr && opened->extractor != nullptr) {
+      opened->extractor->release();
+    }
+    offsetUs += durationUs;
+  }
+
+  if (index != mCurrent->index) {
+    if (target == nullptr) {
+      target = open(index, mSelected);
+    }
+    if (target->err != OK) {
+      return target->err;
+    }
+    switchTo(std::move(target));
+  }
+  mOffsetUs = offsetUs;
+  mEndUs = offsetUs;
+  mCurrent->first.reset();
+  return mCurrent->extractor->seek(position - offsetUs + mCurrent->startUs, mode);
+}
+
+status_t ConcatExtractor::readSyncSample(std::unique_ptr<MediaPacket> &packet,
+                                         int64_t minTimeUs) {
+  if (mCurrent == nullptr) {
+    return NO_INIT;
+  }
+  mCurrent->first.reset();
+  for (;;) {
+    const int64_t segmentTimeUs = std::max<int64_t>(minTimeUs - mOffsetUs, 0) + mCurrent->startUs;
+    status_t err = mCurrent->extractor->readSyncSample(packet, segmentTimeUs);
+    if (err == ERROR_END_OF_STREAM && mCurrent->index + 1 < mSegments.size()) {
+      bool ahead = false;
+      err = advance(&ahead);
+      if (err == OK) {
+        mCurrent->first.reset();
+        continue;
+      }
+    }
+    if (err != OK) {
+      return err;
+    }
+    const int type = typeOf(packet->trackIndex);
+    if (type < 0) {
+      continue;
+    }
+    deliver(packet.get(), type);
+    return OK;
+  }
+}
+
+void ConcatExtractor::flush() {
+  if (mCurrent != nullptr) {
+    mCurrent->extractor->flush();
+  }
+}
+
+void ConcatExtractor::getMetaData(MetaData &meta) {
+  if (mCurrent != nullptr) {
+    mCurrent->extractor->getMetaData(meta);
+  }
+}
+
+void ConcatExtractor::release() {
+  joinOpen();
+  for (std::unique_ptr<Opened> *opened : {&mNext, &mCurrent}) {
+    if (*opened != nullptr && (*opened)->extractor != nullptr) {
+      (*opened)->extractor->release();
+    }
+    opened->reset();
+  }
+  for (Format &format : mFormat) {
+    avcodec_parameters_free(&format.params);
+    format.valid = false;
+  }
+}
+
+size_t ConcatExtractor::getTrackCount() const {
+  return mTrackInfos.size();
+}
+
+status_t ConcatExtractor::getTrackInfo(size_t index, TrackInfo *info) const {
+  if (index >= mTrackInfos.size()) {
+    return ERROR_OUT_OF_RANGE;
+  }
+  *info = mTrackInfos[index];
+  return OK;
+}
+
+status_t ConcatExtractor::selectTrack(size_t index, bool select) {
+  for (int type = 0; type < kNumTypes; ++type) {
+    if (mTrack[type] != (int)index) {
+      continue;
+    }
+    mSelected[type] = select;
+    // opened for the old selection
+    joinOpen();
+    if (mNext != nullptr && mNext->extractor != nullptr) {
+      mNext->extractor->release();
+    }
+    mNext.reset();
+    if (mCurrent != nullptr && mCurrent->track[type] >= 0) {
+      return mCurrent->extractor->selectTrack(mCurrent->track[type], select);
+    }
+    return OK;
+  }
+  return ERROR_UNSUPPORTED;
+}
+
+int ConcatExtractor::getVideoStreamIndex() const {
+  return mSelected[kVideo] ? mTrack[kVideo] : -1;
+}
+
+int ConcatExtractor::getAudioStreamIndex() const {
+  return mSelected[kAudio] ? mTrack[kAudio] : -1;
+}
+
+int64_t ConcatExtractor::getDurationUs() const {
+  int64_t durationUs = 0;
+  for (size_t i = 0; i < mSegments.size(); ++i) {
+    int64_t segmentUs = mSegments[i].durationUs;
+    if (segmentUs < 0 && mCurrent != nullptr && i == mCurrent->index) {
+      segmentUs = mCurrent->containerDurationUs;
+    }
+    durationUs += std::max<int64_t>(segmentUs, 0);
+  }
+  return durationUs;
+}
+
+status_t ConcatExtractor::getCodecParameters(size_t index, AVCodecParameters *params) const {
+  for (int type = 0; type < kNumTypes; ++type) {
+    if (mCurrent != nullptr && mTrack[type] == (int)index && mCurrent->track[type] >= 0) {
+      return mCurrent->extractor->getCodecParameters(mCurrent->track[type], params);
+    }
+  }
+  return ERROR_OUT_OF_RANGE;
+}
+
+ConcatExtractor::Stats ConcatExtractor::getStats() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  return mStats;
+}
+
+} // hpc
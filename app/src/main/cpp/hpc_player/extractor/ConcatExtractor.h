@@ -0,0 +1,153 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Extractor.h"
+
+namespace hpc {
+
+class MetaData;
+
+// Independently encoded files, ad pods or chapters, played back to back as
+// one timeline. Every segment gets an extractor of its own; timestamps are
+// rebased to continue where the previous segment ended, so decoders and
+// MediaClock see one stream. Tracks are those of the first segment, and
+// every segment is expected to carry its video and audio.
+//
+// Before the current segment ends the next one is opened on a thread of its
+// own and its first packet read, so the switch costs next to nothing on the
+// demuxer thread. At a switch the codec parameters of each track are
+// compared: a different codec, size or sample format puts the new format on
+// the track's first packet, MediaPacket::format, for the decoder to be
+// reconfigured; new parameter sets alone travel in band, as
+// AV_PKT_DATA_NEW_EXTRADATA side data; identical ones go through untouched.
+//
+// Not thread safe, like the extractors it wraps.
+class ConcatExtractor : public Extractor {
+ public:
+  struct Stats {
+    int64_t boundaries {0};    // segments switched to by reading through
+    int64_t openedAhead {0};   // of those, opened before they were needed
+    int64_t reconfigures {0};  // tracks given a new format
+    int64_t newExtradata {0};  // tracks given parameter sets in band
+    int64_t failed {0};        // segments skipped for failing to open
+    // For every boundary, the time read() spent between the end of one
+    // segment and the first packet of the next.
+    std::vector<int64_t> stallsUs;
+  };
+
+  // The extractor of a segment, initialized with |url|; nullptr if it
+  // cannot be opened. Called on the thread opening ahead too.
+  typedef std::function<std::shared_ptr<Extractor>(const std::string &url)> Factory;
+
+  explicit ConcatExtractor(const std::vector<std::string> &urls);
+  ~ConcatExtractor() override;
+
+  // By default local files go to the native MP4 or TS extractor through a
+  // mapping, everything else to FFmpeg. Set before init().
+  void setExtractorFactory(const Factory &factory);
+  // Opening the next segment ahead, on by default.
+  void setOpenAhead(bool openAhead);
+
+  // Opens the first segment; |url| is only logged.
+  status_t init(const char *url) override;
+  int read(std::unique_ptr<MediaPacket> &packet, int index) override;
+  status_t seek(int64_t position, SeekMode mode = SEEK_PREVIOUS_SYNC) override;
+  status_t readSyncSample(std::unique_ptr<MediaPacket> &packet, int64_t minTimeUs) override;
+  void flush() override;
+  void getMetaData(MetaData &meta) override;
+  void release() override;
+
+  size_t getTrackCount() const override;
+  status_t getTrackInfo(size_t index, TrackInfo *info) const override;
+  // The video and audio track only; there is no switching between tracks
+  // of one type across segments.
+  status_t selectTrack(size_t index, bool select) override;
+  int getVideoStreamIndex() const override;
+  int getAudioStreamIndex() const override;
+  // The segments with a known duration: those read through, seeked over
+  // or open.
+  int64_t getDurationUs() const override;
+  status_t getCodecParameters(size_t index, AVCodecParameters *params) const override;
+
+  Stats getStats() const;
+
+ private:
+  // The next segment is opened this long before the current one ends, or
+  // right away if its duration is not known.
+  static const int64_t kOpenAheadUs = 10000000LL;
+
+  enum {
+    kVideo,
+    kAudio,
+    kNumTypes,
+  };
+
+  enum Change {
+    kSame,
+    kNewExtradata,
+    kReconfigure,
+  };
+
+  struct Segment {
+    std::string url;
+    int64_t durationUs {-1};  // -1 until known
+  };
+
+  // An open segment.
+  struct Opened {
+    size_t index {0};
+    std::shared_ptr<Extractor> extractor;
+    status_t err {OK};
+    int track[kNumTypes] {-1, -1};  // the segment's own track numbers
+    std::unique_ptr<MediaPacket> first;  // read ahead for startUs
+    int64_t startUs {0};  // earliest timestamp of its first packet
+    int64_t containerDurationUs {0};
+  };
+
+  struct Format {
+    bool valid {false};
+    TrackInfo info;
+    AVCodecParameters *params {nullptr};
+  };
+
+  std::vector<Segment> mSegments;
+  Factory mFactory;
+  bool mOpenAhead {true};
+
+  std::unique_ptr<Opened> mCurrent;
+  // Written by mOpenThread, only touched here once it is joined.
+  std::unique_ptr<Opened> mNext;
+  std::thread mOpenThread;
+
+  std::vector<TrackInfo> mTrackInfos;  // of the first segment
+  int mTrack[kNumTypes] {-1, -1};
+  bool mSelected[kNumTypes] {true, true};
+  // What the decoders were last configured for, and what to tell them on
+  // the next packet of the track.
+  Format mFormat[kNumTypes];
+  Change mPending[kNumTypes] {kSame, kSame};
+
+  int64_t mOffsetUs {0};  // where the current segment starts in the timeline
+  int64_t mEndUs {0};     // furthest packet end of it so far, timeline
+
+  mutable std::mutex mLock;  // for mStats
+  Stats mStats;
+
+  std::unique_ptr<Opened> open(size_t index, const bool selected[kNumTypes]) const;
+  void openAhead();
+  std::unique_ptr<Opened> take(size_t index);
+  void joinOpen();
+  void switchTo(std::unique_ptr<Opened> opened);
+  status_t advance(bool *ahead);
+  int typeOf(int segmentTrack) const;
+  void deliver(MediaPacket *packet, int type);
+  std::shared_ptr<MetaData> formatOf(int type) const;
+};
+
+} // hpc
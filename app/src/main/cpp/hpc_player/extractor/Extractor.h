@@ -2,7 +2,11 @@
 
 #include <cstdint>
 #include <memory>
+#include <string>
 #include "Error.h"
+#include "BaseType.h"
+
+struct AVCodecParameters;
 
 namespace hpc {
 
@@ -12,10 +16,12 @@ class MetaData;
 class Extractor {
  public:
   struct TrackInfo {
+    media_track_type type = MEDIA_TRACK_TYPE_UNKNOWN;
     std::string mime_type;
     int width = 0;  // For video
     int height = 0; // For video
     int sample_rate = 0; // For audio
+    int channel_count = 0; // For audio
     std::string language; // For audio/subtitles
     // Add other relevant fields
   };
@@ -27,15 +33,40 @@ class Extractor {
   };
 
   virtual status_t init(const char* url) = 0;
+  // Reads the next packet of track |index|, or of any track if |index| is negative.
   virtual int read(std::unique_ptr<MediaPacket> &packet, int index) = 0;
-  virtual status_t seek(int64_t position) = 0;
+  virtual status_t seek(int64_t position, SeekMode mode = SEEK_PREVIOUS_SYNC) = 0;
+  // Keyframe-only reads for trick play: the first video sync sample at or
+  // after |minTimeUs|, jumping there through the container index when there
+  // is one. Packets of other tracks are skipped.
+  virtual status_t readSyncSample(std::unique_ptr<MediaPacket> & /* packet */,
+                                  int64_t /* minTimeUs */) {
+    return ERROR_UNSUPPORTED;
+  }
   virtual void flush() = 0;
   virtual void getMetaData(MetaData& meta) = 0;
   virtual void release() = 0;
 
-//  // Suggested additions
-//  virtual status_t getTrackCount(int& count) = 0;
-//  virtual status_t getTrackInfo(int index, TrackInfo& info) = 0;
+  // Tracks are numbered like the container's streams, packets carry the
+  // same number in MediaPacket::trackIndex.
+  virtual size_t getTrackCount() const { return 0; }
+  virtual status_t getTrackInfo(size_t /* index */, TrackInfo * /* info */) const {
+    return ERROR_UNSUPPORTED;
+  }
+  // Selected tracks are the ones read() returns packets of.
+  virtual status_t selectTrack(size_t /* index */, bool /* select */) {
+    return ERROR_UNSUPPORTED;
+  }
+  // The selected video and audio track, -1 if none.
+  virtual int getVideoStreamIndex() const { return -1; }
+  virtual int getAudioStreamIndex() const { return -1; }
+  // End of the longest track, 0 if unknown.
+  virtual int64_t getDurationUs() const { return 0; }
+  // Codec id, dimensions or sample rate and channels of track |index|, and
+  // its extradata if the container carries one.
+  virtual status_t getCodecParameters(size_t /* index */, AVCodecParameters * /* params */) const {
+    return ERROR_UNSUPPORTED;
+  }
 //  virtual status_t checkFormatChange(bool& formatChanged) = 0;
 
   virtual ~Extractor() = default;
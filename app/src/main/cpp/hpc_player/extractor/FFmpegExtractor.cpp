@@ -1,81 +1,543 @@
 #include "FFmpegExtractor.h"
 #include "Log.h"
 #include "MetaData.h"
+#include "MediaPacket.h"
+#include "AVIOAdapter.h"
+
+#include <algorithm>
+
+extern "C" {
+#include "libavutil/avstring.h"
+}
 
 #define LOG_TAG "FFmpegExtractor"
 
 namespace hpc {
-status_t FFmpegExtractor::init(const char *url) {
-  ALOGD("init");
 
-  int ret = avformat_open_input(&mFormatContext, url, NULL, NULL);
+static const AVRational kMicrosTimeBase = {1, 1000000};
 
-  if (ret < 0) {
-    release();
-  }
+// Probing budgets per container. Containers whose header carries complete
+// codec parameters need next to no probing, transport style containers have
+// to look at the payload but rarely need FFmpeg's 5 MB / 5 s defaults.
+struct ProbeLimits {
+  const char *format;          // matched against AVInputFormat::name
+  int64_t probeSize;           // bytes
+  int64_t analyzeDurationUs;
+  bool headerComplete;         // find_stream_info may be skipped
+};
 
-  avformat_find_stream_info(mFormatContext, NULL);
-  mVideoStream = av_find_best_stream(mFormatContext, AVMEDIA_TYPE_VIDEO, -1, -1, NULL,0);
-  mAudioStream = av_find_best_stream(mFormatContext, AVMEDIA_TYPE_AUDIO, -1, -1, NULL,0);
+static const ProbeLimits kProbeLimits[] = {
+  { "mp4",      64 * 1024,  100000, true  },
+  { "matroska", 64 * 1024,  100000, true  },
+  { "flv",     256 * 1024,  500000, false },
+  { "mpegts",  512 * 1024, 1000000, false },
+  { "hls",     512 * 1024, 1000000, false },
+  { "avi",     256 * 1024,  500000, false },
+};
+
+static const ProbeLimits *findProbeLimits(const AVInputFormat *format) {
+  if (format == nullptr || format->name == nullptr) {
+    return nullptr;
+  }
+  for (const ProbeLimits &limits : kProbeLimits) {
+    if (av_match_name(limits.format, format->name)) {
+      return &limits;
+    }
+  }
+  return nullptr;
+}
 
-  mCodecParam = mFormatContext->streams[mVideoStream]->codecpar;
-  switch (mCodecParam->codec_id) {
+static const char *MimeForCodec(AVCodecID codecId) {
+  switch (codecId) {
 //        case AV_CODEC_ID_WMV2:
 //        case AV_CODEC_ID_WMV1:
 //        case AV_CODEC_ID_WMV3:
 //          return FAILED;
     case AV_CODEC_ID_HEVC:
-      mMetaData->mime = "video/hevc";
-      break;
+      return "video/hevc";
     case AV_CODEC_ID_H264:
-      mMetaData->mime = "video/avc";
-      break;
+      return "video/avc";
     case AV_CODEC_ID_VP8:
-      mMetaData->mime = "video/x-vnd.on2.vp8";
-      break;
+      return "video/x-vnd.on2.vp8";
     case AV_CODEC_ID_VP9:
-      mMetaData->mime = "video/x-vnd.on2.vp9";
-      break;
+      return "video/x-vnd.on2.vp9";
     case AV_CODEC_ID_MPEG4:
-      mMetaData->mime = "video/mp4v-es";
-      break;
+      return "video/mp4v-es";
     case AV_CODEC_ID_MJPEG:
-      mMetaData->mime = "video/x-motion-jpeg";
-      break;
+      return "video/x-motion-jpeg";
     case AV_CODEC_ID_MPEG1VIDEO:
     case AV_CODEC_ID_MPEG2VIDEO:
-      mMetaData->mime = "video/mpeg2";
-      break;
+      return "video/mpeg2";
+    case AV_CODEC_ID_AAC:
+      return "audio/mp4a-latm";
+    case AV_CODEC_ID_MP3:
+      return "audio/mpeg";
+    case AV_CODEC_ID_OPUS:
+      return "audio/opus";
+    case AV_CODEC_ID_VORBIS:
+      return "audio/vorbis";
+    case AV_CODEC_ID_FLAC:
+      return "audio/flac";
+    case AV_CODEC_ID_AC3:
+      return "audio/ac3";
+    case AV_CODEC_ID_EAC3:
+      return "audio/eac3";
     default:
+      return "";
+  }
+}
+
+// True if the selected streams can be decoded from the header alone.
+static bool hasCodecParameters(const AVFormatContext *ctx, int videoStream, int audioStream) {
+  if (videoStream < 0) {
+    return false;
+  }
+  const AVCodecParameters *video = ctx->streams[videoStream]->codecpar;
+  if (video->codec_id == AV_CODEC_ID_NONE || video->width <= 0 || video->height <= 0) {
+    return false;
+  }
+  if (audioStream >= 0) {
+    const AVCodecParameters *audio = ctx->streams[audioStream]->codecpar;
+    if (audio->codec_id == AV_CODEC_ID_NONE || audio->sample_rate <= 0 || audio->channels <= 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static size_t countKeyFrames(const AVFormatContext *ctx) {
+  size_t count = 0;
+  for (unsigned i = 0; i < ctx->nb_streams; ++i) {
+    const AVStream *stream = ctx->streams[i];
+    for (int j = 0; j < stream->nb_index_entries; ++j) {
+      count += (stream->index_entries[j].flags & AVINDEX_KEYFRAME) != 0;
+    }
   }
+  return count;
+}
+
+FFmpegExtractor::FFmpegExtractor()
+    : mAVPacket(av_packet_alloc()),
+      mMetaData(std::make_shared<MetaData>()) {
+}
 
-  mMetaData->width = mCodecParam->width;
-  mMetaData->height = mCodecParam->height;
-  mMetaData->bitsPerSample = mFormatContext->streams[mAudioStream]->codecpar->sample_rate;
-  mMetaData->channelCount = mFormatContext->streams[mAudioStream]->codecpar->channels;
+FFmpegExtractor::~FFmpegExtractor() {
+  release();
+  av_packet_free(&mAVPacket);
+}
+
+status_t FFmpegExtractor::init(const char *url) {
+  ALOGD("init");
+  mBytesCopied = 0;
+
+  if (mDataSource != nullptr) {
+    mAVIO = std::make_unique<AVIOAdapter>(mDataSource);
+    mFormatContext = avformat_alloc_context();
+    if (mAVIO->context() == nullptr || mFormatContext == nullptr) {
+      release();
+      return NO_MEMORY;
+    }
+    mFormatContext->pb = mAVIO->context();
+    mFormatContext->flags |= AVFMT_FLAG_CUSTOM_IO;
+  }
+  int ret = avformat_open_input(&mFormatContext, url, NULL, NULL);
+
+  if (ret < 0) {
+    ALOGE("failed to open %s: %d", url, ret);
+    release();
+    return ERROR_IO;
+  }
+
+  markStartup(StartupTimeline::kOpen);
+  // Before the probe cache adds the key frames an earlier run indexed.
+  const bool containerIndexed = countKeyFrames(mFormatContext) > 0;
+
+  const ProbeLimits *limits = findProbeLimits(mFormatContext->iformat);
+  bool probe = true;
+  if (limits != nullptr) {
+    mFormatContext->probesize = limits->probeSize;
+    mFormatContext->max_analyze_duration = limits->analyzeDurationUs;
+    if (limits->headerComplete) {
+      probe = !hasCodecParameters(
+          mFormatContext,
+          av_find_best_stream(mFormatContext, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0),
+          av_find_best_stream(mFormatContext, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0));
+    }
+  }
+  const char *how = probe ? "probed" : "skipped";
+  if (probe && mProbeCache != nullptr) {
+    mProbeKey = ProbeCache::KeyFor(url, mDataSource.get());
+    if (!mProbeKey.empty() && mProbeCache->apply(mProbeKey, mFormatContext) == OK) {
+      probe = false;
+      how = "cached";
+    }
+  }
+  if (probe && avformat_find_stream_info(mFormatContext, NULL) < 0) {
+    ALOGW("could not find stream info");
+    mProbeKey.clear();
+  } else if (probe && !mProbeKey.empty()) {
+    mProbeCache->store(mProbeKey, mFormatContext);
+  }
+  mStoredKeyFrames = countKeyFrames(mFormatContext);
+  ALOGD("%s: %s stream info", mFormatContext->iformat->name, how);
+  mVideoStream = av_find_best_stream(mFormatContext, AVMEDIA_TYPE_VIDEO, -1, -1, NULL,0);
+  mAudioStream = av_find_best_stream(mFormatContext, AVMEDIA_TYPE_AUDIO, -1, -1, NULL,0);
+
+  if (mVideoStream < 0 && (mRequiresVideo || mAudioStream < 0)) {
+    ALOGE("no video stream");
+    release();
+    return ERROR_UNSUPPORTED;
+  }
+  // Alternate audio, subtitles and data streams are not demuxed until
+  // selected.
+  for (unsigned i = 0; i < mFormatContext->nb_streams; ++i) {
+    if ((int)i != mVideoStream && (int)i != mAudioStream) {
+      mFormatContext->streams[i]->discard = AVDISCARD_ALL;
+    }
+  }
+
+  if (mVideoStream >= 0) {
+    mCodecParam = mFormatContext->streams[mVideoStream]->codecpar;
+    mMetaData->mime = MimeForCodec(mCodecParam->codec_id);
+    mMetaData->width = mCodecParam->width;
+    mMetaData->height = mCodecParam->height;
+    mMetaData->pixelFormat = mCodecParam->format;
+  }
+  if (mAudioStream >= 0) {
+    mMetaData->sampleRate = mFormatContext->streams[mAudioStream]->codecpar->sample_rate;
+    mMetaData->channelCount = mFormatContext->streams[mAudioStream]->codecpar->channels;
+  }
+  if (mKeyframeIndex != nullptr && containerIndexed) {
+    mKeyframeIndex.reset();
+  } else if (mKeyframeIndex != nullptr) {
+    mIndexStream = mVideoStream >= 0 ? mVideoStream : mAudioStream;
+    const AVStream *stream = mFormatContext->streams[mIndexStream];
+    char layout[128];
+    snprintf(layout, sizeof(layout), "%s|%d|%d/%d", mFormatContext->iformat->name, mIndexStream,
+             stream->time_base.num, stream->time_base.den);
+    mKeyframeIndex->open(layout);
+    mIndexing = true;
+  }
+  markStartup(StartupTimeline::kProbe);
 
   ALOGD("init end");
+  return OK;
 }
 
 void FFmpegExtractor::release() {
+  // What was demuxed may have indexed keyframes a container without an
+  // index lacks, the next prepare can seek with them.
+  if (mFormatContext != nullptr && !mProbeKey.empty()
+      && countKeyFrames(mFormatContext) > mStoredKeyFrames) {
+    mProbeCache->store(mProbeKey, mFormatContext);
+  }
+  mProbeKey.clear();
+  if (mKeyframeIndex != nullptr) {
+    mKeyframeIndex->store();
+  }
+  mIndexStream = -1;
+  mIndexing = false;
   if (mFormatContext) {
+    // avformat_close_input() frees the context and resets the pointer.
     avformat_close_input(&mFormatContext);
-    avformat_free_context(mFormatContext);
-    mFormatContext = nullptr;
   }
+  mAVIO.reset();
+  mCodecParam = nullptr;
+  mVideoStream = -1;
+  mAudioStream = -1;
 }
 
 int FFmpegExtractor::read(std::unique_ptr<MediaPacket> &packet, int index) {
-  int ret = av_read_frame(mFormatContext,mAVPacket);
-  return ret;
+  if (mFormatContext == nullptr) {
+    return NO_INIT;
+  }
+
+  for (;;) {
+    int ret = av_read_frame(mFormatContext, mAVPacket);
+    if (ret == AVERROR_EOF) {
+      if (mIndexing) {
+        mKeyframeIndex->setComplete();
+      }
+      return ERROR_END_OF_STREAM;
+    } else if (ret < 0) {
+      return ERROR_IO;
+    }
+    if (mIndexing && mAVPacket->stream_index == mIndexStream
+        && (mAVPacket->flags & AV_PKT_FLAG_KEY)) {
+      addKeyFrame();
+    }
+    if (index >= 0 && mAVPacket->stream_index != index) {
+      av_packet_unref(mAVPacket);
+      continue;
+    }
+    break;
+  }
+  if (mAVPacket->buf == nullptr) {
+    // the payload lives in demuxer memory that the next read reuses.
+    if (av_packet_make_refcounted(mAVPacket) < 0) {
+      av_packet_unref(mAVPacket);
+      return NO_MEMORY;
+    }
+    mBytesCopied += mAVPacket->size;
+  }
+  if (mAVPacket->stream_index == mVideoStream) {
+    markStartup(StartupTimeline::kFirstPacket);
+  }
+
+  if (packet == nullptr) {
+    packet = std::make_unique<MediaPacket>();
+  } else {
+    av_packet_unref(packet->avPacket());
+  }
+  AVRational timeBase = mFormatContext->streams[mAVPacket->stream_index]->time_base;
+  packet->trackIndex = mAVPacket->stream_index;
+  packet->ptsUs = mAVPacket->pts == AV_NOPTS_VALUE
+      ? -1 : av_rescale_q(mAVPacket->pts, timeBase, kMicrosTimeBase);
+  packet->dtsUs = mAVPacket->dts == AV_NOPTS_VALUE
+      ? packet->ptsUs : av_rescale_q(mAVPacket->dts, timeBase, kMicrosTimeBase);
+  packet->durationUs = av_rescale_q(mAVPacket->duration, timeBase, kMicrosTimeBase);
+  // hand the demuxer's buffer reference over, the payload is not copied.
+  av_packet_move_ref(packet->avPacket(), mAVPacket);
+  return OK;
+}
+
+// The index keeps where the demuxer resumes for a key frame: its own entry
+// where it indexes as it goes, e.g. the cluster of a Matroska block, the
+// packet otherwise.
+void FFmpegExtractor::addKeyFrame() {
+  AVStream *stream = mFormatContext->streams[mIndexStream];
+  int64_t timestamp = mAVPacket->dts != AV_NOPTS_VALUE ? mAVPacket->dts : mAVPacket->pts;
+  int64_t offset = mAVPacket->pos;
+  for (int64_t ts : {mAVPacket->pts, mAVPacket->dts}) {
+    int i = ts != AV_NOPTS_VALUE ? av_index_search_timestamp(stream, ts, AVSEEK_FLAG_ANY) : -1;
+    if (i >= 0 && stream->index_entries[i].timestamp == ts) {
+      timestamp = ts;
+      offset = stream->index_entries[i].pos;
+      break;
+    }
+  }
+  if (timestamp == AV_NOPTS_VALUE || offset < 0) {
+    // a key frame left out would be a gap, nothing more goes in.
+    mIndexing = false;
+    return;
+  }
+  mKeyframeIndex->add(timestamp, offset);
+}
+
+void FFmpegExtractor::setRequiresVideo(bool requiresVideo) {
+  mRequiresVideo = requiresVideo;
+}
+
+void FFmpegExtractor::setDataSource(const std::shared_ptr<DataSource> &source) {
+  mDataSource = source;
+}
+
+void FFmpegExtractor::flush() {
+  // what is dropped is not indexed
+  mIndexing = false;
+  if (mFormatContext != nullptr) {
+    avformat_flush(mFormatContext);
+  }
+}
+
+AVStream* FFmpegExtractor::getStream(int index) const {
+  if (mFormatContext == nullptr || index < 0
+      || index >= (int)mFormatContext->nb_streams) {
+    return nullptr;
+  }
+  return mFormatContext->streams[index];
+}
+
+int64_t FFmpegExtractor::getDurationUs() const {
+  if (mFormatContext == nullptr || mFormatContext->duration == AV_NOPTS_VALUE) {
+    return 0;
+  }
+  return av_rescale_q(mFormatContext->duration, AV_TIME_BASE_Q, kMicrosTimeBase);
+}
+
+status_t FFmpegExtractor::getCodecParameters(size_t index, AVCodecParameters *params) const {
+  const AVStream *stream = getStream((int)index);
+  if (stream == nullptr) {
+    return ERROR_OUT_OF_RANGE;
+  }
+  return avcodec_parameters_copy(params, stream->codecpar) < 0 ? NO_MEMORY : OK;
+}
+
+status_t FFmpegExtractor::getSyncSampleTimeUs(int64_t timeUs, int64_t *syncTimeUs) const {
+  AVStream *stream = getStream(mVideoStream);
+  if (stream == nullptr || stream->nb_index_entries <= 0) {
+    return NAME_NOT_FOUND;
+  }
+  int64_t ts = av_rescale_q(timeUs, kMicrosTimeBase, stream->time_base);
+  int i = av_index_search_timestamp(stream, ts, AVSEEK_FLAG_BACKWARD);
+  if (i < 0) {
+    return NAME_NOT_FOUND;
+  }
+  *syncTimeUs = av_rescale_q(stream->index_entries[i].timestamp, stream->time_base, kMicrosTimeBase);
+  return OK;
+}
+
+// Seeking costs an index lookup, reading through a GOP would demux all of
+// it. Containers without an index, e.g. TS, are read through, dropping
+// everything but the sync samples.
+status_t FFmpegExtractor::readSyncSample(std::unique_ptr<MediaPacket> &packet, int64_t minTimeUs) {
+  AVStream *stream = getStream(mVideoStream);
+  if (stream == nullptr) {
+    return NO_INIT;
+  }
+  int64_t ts = av_rescale_q(std::max<int64_t>(minTimeUs, 0), kMicrosTimeBase, stream->time_base);
+  int i = stream->nb_index_entries > 0 ? av_index_search_timestamp(stream, ts, 0) : -1;
+  const bool indexed = i >= 0;
+  if (indexed && av_seek_frame(mFormatContext, mVideoStream,
+                               stream->index_entries[i].timestamp, AVSEEK_FLAG_BACKWARD) < 0) {
+    return ERROR;
+  }
+  mIndexing = mIndexing && !indexed;
+
+  for (;;) {
+    status_t err = read(packet, mVideoStream);
+    if (err != OK) {
+      return err;
+    }
+    if (packet->isKeyFrame() && (indexed || packet->ptsUs >= minTimeUs)) {
+      return OK;
+    }
+  }
+}
+
+int64_t FFmpegExtractor::getBytesRead() const {
+  return mFormatContext != nullptr && mFormatContext->pb != nullptr
+      ? mFormatContext->pb->bytes_read : 0;
+}
+
+int64_t FFmpegExtractor::getBytesCopied() const {
+  return mBytesCopied;
+}
+
+void FFmpegExtractor::setProbeCache(const std::shared_ptr<ProbeCache> &cache) {
+  mProbeCache = cache;
+}
+
+void FFmpegExtractor::setKeyframeIndex(const std::shared_ptr<KeyframeIndex> &index) {
+  mKeyframeIndex = index;
+}
+
+void FFmpegExtractor::setStartupTimeline(const std::shared_ptr<StartupTimeline> &timeline) {
+  mStartupTimeline = timeline;
+}
+
+void FFmpegExtractor::markStartup(StartupTimeline::Event event) {
+  if (mStartupTimeline != nullptr) {
+    mStartupTimeline->mark(event);
+  }
 }
 
 void FFmpegExtractor::getMetaData(MetaData &meta) {
   meta = *mMetaData;
 }
 
-status_t FFmpegExtractor::seek(int64_t position) {
-  int ret = avformat_seek_file(mFormatContext,-1,INT64_MIN,position,INT64_MAX,AVSEEK_FLAG_BACKWARD | AVSEEK_FLAG_FRAME);
+size_t FFmpegExtractor::getTrackCount() const {
+  return mFormatContext != nullptr ? mFormatContext->nb_streams : 0;
+}
+
+status_t FFmpegExtractor::getTrackInfo(size_t index, TrackInfo *info) const {
+  if (index >= getTrackCount()) {
+    return ERROR_OUT_OF_RANGE;
+  }
+  const AVStream *stream = mFormatContext->streams[index];
+  const AVCodecParameters *params = stream->codecpar;
+  switch (params->codec_type) {
+    case AVMEDIA_TYPE_VIDEO:
+      info->type = MEDIA_TRACK_TYPE_VIDEO;
+      break;
+    case AVMEDIA_TYPE_AUDIO:
+      info->type = MEDIA_TRACK_TYPE_AUDIO;
+      break;
+    case AVMEDIA_TYPE_SUBTITLE:
+      info->type = MEDIA_TRACK_TYPE_SUBTITLE;
+      break;
+    default:
+      info->type = MEDIA_TRACK_TYPE_UNKNOWN;
+      break;
+  }
+  info->mime_type = MimeForCodec(params->codec_id);
+  info->width = params->width;
+  info->height = params->height;
+  info->sample_rate = params->sample_rate;
+  info->channel_count = params->channels;
+  AVDictionaryEntry *language = av_dict_get(stream->metadata, "language", nullptr, 0);
+  // ISO 639-2, "und" like MediaExtractor when the container does not say.
+  info->language = language != nullptr ? language->value : "und";
+  return OK;
+}
+
+status_t FFmpegExtractor::selectTrack(size_t index, bool select) {
+  if (index >= getTrackCount()) {
+    return ERROR_OUT_OF_RANGE;
+  }
+  AVStream *stream = mFormatContext->streams[index];
+  int8_t *selected;
+  if (stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+    selected = &mVideoStream;
+  } else if (stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+    selected = &mAudioStream;
+  } else {
+    return ERROR_UNSUPPORTED;
+  }
+
+  if (!select) {
+    if (*selected == (int)index) {
+      *selected = -1;
+    }
+    stream->discard = AVDISCARD_ALL;
+    return OK;
+  }
+  if (*selected >= 0 && *selected != (int)index) {
+    mFormatContext->streams[*selected]->discard = AVDISCARD_ALL;
+  }
+  *selected = (int8_t)index;
+  stream->discard = AVDISCARD_DEFAULT;
+  if (selected == &mAudioStream) {
+    mMetaData->sampleRate = stream->codecpar->sample_rate;
+    mMetaData->channelCount = stream->codecpar->channels;
+  }
+  return OK;
+}
+
+status_t FFmpegExtractor::seek(int64_t position, SeekMode mode) {
+  if (mFormatContext == nullptr) {
+    return NO_INIT;
+  }
+  // A key frame the index knows is handed to the demuxer as its own index
+  // entry, it goes straight there instead of searching or estimating.
+  if (mKeyframeIndex != nullptr && mode != SEEK_NEXT_SYNC) {
+    AVStream *stream = mFormatContext->streams[mIndexStream];
+    KeyframeIndex::Entry entry;
+    if (mKeyframeIndex->find(av_rescale_q(position, kMicrosTimeBase, stream->time_base),
+                             &entry) == OK) {
+      av_add_index_entry(stream, entry.offset, entry.timestamp, 0, 0, AVINDEX_KEYFRAME);
+      if (av_seek_frame(mFormatContext, mIndexStream, entry.timestamp, AVSEEK_FLAG_BACKWARD) >= 0) {
+        mIndexing = true;
+        return OK;
+      }
+    }
+  }
+  mIndexing = false;
+
+  // with stream index -1 the timestamps are in AV_TIME_BASE, i.e. microseconds.
+  int64_t minTs = INT64_MIN;
+  int64_t maxTs = INT64_MAX;
+  switch (mode) {
+    case SEEK_PREVIOUS_SYNC:
+      maxTs = position;
+      break;
+    case SEEK_NEXT_SYNC:
+      minTs = position;
+      break;
+    default:
+      break;
+  }
+  int ret = avformat_seek_file(mFormatContext,-1,minTs,position,maxTs,0);
   if (ret < 0) {
     return ERROR;
   }
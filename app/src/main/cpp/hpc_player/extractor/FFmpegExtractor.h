@@ -1,6 +1,9 @@
 #pragma once
 
 #include "Extractor.h"
+#include "KeyframeIndex.h"
+#include "ProbeCache.h"
+#include "StartupTimeline.h"
 
 extern "C" {
 #include "libswscale/swscale.h"
@@ -11,20 +14,80 @@ extern "C" {
 
 namespace hpc {
 
+class AVIOAdapter;
+class DataSource;
 class MetaData;
 
 class FFmpegExtractor : public Extractor{
+ public:
+  FFmpegExtractor();
+  ~FFmpegExtractor() override;
 
   status_t init(const char *url) override;
 
   int read(std::unique_ptr<MediaPacket> &packet, int index) override;
 
-  status_t seek(int64_t position) override;
+  status_t seek(int64_t position, SeekMode mode = SEEK_PREVIOUS_SYNC) override;
+
+  status_t readSyncSample(std::unique_ptr<MediaPacket> &packet, int64_t minTimeUs) override;
+
+  void flush() override;
 
   void getMetaData(MetaData& meta) override;
 
   void release() override;
 
+  size_t getTrackCount() const override;
+  status_t getTrackInfo(size_t index, TrackInfo *info) const override;
+  // Makes |index| the video or audio track, or deselects it. The demuxer
+  // skips the payload of tracks that are not selected.
+  status_t selectTrack(size_t index, bool select) override;
+
+  int getVideoStreamIndex() const override { return mVideoStream; }
+  int getAudioStreamIndex() const override { return mAudioStream; }
+  AVStream* getStream(int index) const;
+  int64_t getDurationUs() const override;
+  status_t getCodecParameters(size_t index, AVCodecParameters *params) const override;
+
+  // Looks up the sync sample at or before |timeUs| in the container index.
+  // Returns NAME_NOT_FOUND if the container carries no usable index.
+  status_t getSyncSampleTimeUs(int64_t timeUs, int64_t *syncTimeUs) const;
+
+  // Reads through |source|, e.g. a CachedSource, instead of letting
+  // libavformat open the url itself; the url only hints the format then.
+  // Set before init().
+  void setDataSource(const std::shared_ptr<DataSource> &source);
+
+  // Bytes libavformat read from its I/O, through the DataSource or its own
+  // protocol, since init().
+  int64_t getBytesRead() const;
+
+  // Payload bytes read() had to copy because the demuxer handed out a
+  // packet it did not reference count, since init(). Zero for the
+  // demuxers of FFmpeg 4.4, which are all reference counted.
+  int64_t getBytesCopied() const;
+
+  // Lets init() take a stream without video, e.g. the audio of a DASH
+  // presentation, which is its own file. Set before init().
+  void setRequiresVideo(bool requiresVideo);
+
+  // Looks the stream info up in |cache| instead of probing, and stores it
+  // there after probing; again at release() if the demuxer indexed more
+  // keyframes by then. Set before init().
+  void setProbeCache(const std::shared_ptr<ProbeCache> &cache);
+
+  // Seeks with |index| if the container has no index of its own, e.g. TS,
+  // Matroska without Cues, ADTS or MP3, and adds the key frames of the video
+  // track, or the audio one of a file without video, as it reads through.
+  // Stored at release(). Set before init().
+  void setKeyframeIndex(const std::shared_ptr<KeyframeIndex> &index);
+
+  // The index set, if init() found the container needs it, else nullptr.
+  std::shared_ptr<KeyframeIndex> getKeyframeIndex() const { return mKeyframeIndex; }
+
+  // Marks open, probe and first video packet on |timeline|. Set before init().
+  void setStartupTimeline(const std::shared_ptr<StartupTimeline> &timeline);
+
  private:
   AVFormatContext* mFormatContext {nullptr};
   AVCodecParameters* mCodecParam {nullptr};
@@ -32,6 +95,20 @@ class FFmpegExtractor : public Extractor{
   std::shared_ptr<MetaData> mMetaData;
   int8_t mVideoStream {-1};
   int8_t mAudioStream {-1};
+  std::shared_ptr<StartupTimeline> mStartupTimeline;
+  std::shared_ptr<DataSource> mDataSource;
+  std::unique_ptr<AVIOAdapter> mAVIO;  // outlives mFormatContext
+  bool mRequiresVideo {true};
+  std::shared_ptr<ProbeCache> mProbeCache;
+  std::string mProbeKey;       // empty unless the entry is ours to update
+  size_t mStoredKeyFrames {0};
+  int64_t mBytesCopied {0};
+  std::shared_ptr<KeyframeIndex> mKeyframeIndex;
+  int mIndexStream {-1};
+  bool mIndexing {false};  // read on from an indexed key frame, nothing skipped
+
+  void addKeyFrame();
+  void markStartup(StartupTimeline::Event event);
 };
 
 } // hpc
@@ -0,0 +1,281 @@
+#include "KeyframeIndex.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOG_TAG "KeyframeIndex"
+
+namespace hpc {
+
+namespace {
+
+const uint32_t kSidecarMagic = 'HPCK';
+const uint32_t kSidecarVersion = 1;
+// A sidecar larger than this is not one of ours.
+const size_t kMaxSidecarBytes = 64 * 1024 * 1024;
+
+// FNV-1a, stable across runs unlike std::hash.
+uint64_t fnv1a(const void *data, size_t size) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ p[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Entries go out as zigzag varints of their difference to the one before:
+// key frames a GOP apart in a steady stream take two to four bytes each.
+void putVarint(std::string *data, uint64_t value) {
+  while (value >= 0x80) {
+    data->push_back((char)(value | 0x80));
+    value >>= 7;
+  }
+  data->push_back((char)value);
+}
+
+void putSigned(std::string *data, int64_t value) {
+  putVarint(data, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+void putString(std::string *data, const std::string &value) {
+  putVarint(data, value.size());
+  data->append(value);
+}
+
+// Reads what the put functions wrote; past the end or on a malformed
+// varint ok() turns false.
+class SidecarReader {
+ public:
+  explicit SidecarReader(const std::string &data)
+      : mData(data) {}
+
+  uint64_t getVarint() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (mOffset >= mData.size()) {
+        break;
+      }
+      const uint8_t byte = mData[mOffset++];
+      value |= (uint64_t)(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        return value;
+      }
+    }
+    mOk = false;
+    return 0;
+  }
+
+  int64_t getSigned() {
+    const uint64_t value = getVarint();
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+  }
+
+  std::string getString() {
+    const uint64_t size = getVarint();
+    if (!mOk || size > mData.size() - mOffset) {
+      mOk = false;
+      return std::string();
+    }
+    std::string value = mData.substr(mOffset, size);
+    mOffset += size;
+    return value;
+  }
+
+  bool ok() const { return mOk; }
+
+ private:
+  const std::string &mData;
+  size_t mOffset {0};
+  bool mOk {true};
+};
+
+bool readFile(const std::string &path, std::string *data) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  bool ok = fstat(fd, &st) == 0 && st.st_size > 0 && (size_t)st.st_size <= kMaxSidecarBytes;
+  if (ok) {
+    data->resize(st.st_size);
+    size_t done = 0;
+    while (ok && done < data->size()) {
+      ssize_t n = read(fd, &(*data)[done], data->size() - done);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      ok = n > 0;
+      done += ok ? n : 0;
+    }
+  }
+  ::close(fd);
+  return ok;
+}
+
+std::string pathFor(const std::string &directory, const std::string &key) {
+  char name[32];
+  snprintf(name, sizeof(name), "%016" PRIx64 ".kfi", fnv1a(key.data(), key.size()));
+  return directory + "/" + name;
+}
+
+} // namespace
+
+KeyframeIndex::KeyframeIndex(const std::string &directory, const std::string &key)
+    : mPath(pathFor(directory, key)),
+      mKey(key) {
+  if (mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST) {
+    ALOGW("cannot create %s: %s", directory.c_str(), strerror(errno));
+  }
+}
+
+void KeyframeIndex::open(const std::string &layout) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (layout == mLayout) {
+    return;
+  }
+  mLayout = layout;
+  mEntries.clear();
+  mComplete = false;
+  mDirty = false;
+
+  std::string data;
+  if (!readFile(mPath, &data)) {
+    return;
+  }
+  SidecarReader reader(data);
+  bool ok = reader.getVarint() == kSidecarMagic && reader.getVarint() == kSidecarVersion
+      && reader.getString() == mKey && reader.getString() == layout;
+  const bool complete = reader.getVarint() != 0;
+  const uint64_t count = reader.getVarint();
+  // every entry takes two bytes at least
+  ok = ok && reader.ok() && count <= data.size() / 2;
+  std::vector<Entry> entries;
+  entries.reserve(ok ? count : 0);
+  Entry entry {0, 0};
+  for (uint64_t i = 0; ok && i < count; ++i) {
+    entry.timestamp += reader.getSigned();
+    entry.offset += reader.getSigned();
+    ok = reader.ok() && (entries.empty() || entry.timestamp > entries.back().timestamp);
+    entries.push_back(entry);
+  }
+  if (!ok) {
+    ALOGW("ignoring %s, not stored for %s", mPath.c_str(), layout.c_str());
+    return;
+  }
+  mEntries.swap(entries);
+  mComplete = complete;
+  ++mStats.loads;
+  ALOGD("loaded %zu key frames%s", mEntries.size(), mComplete ? ", complete" : "");
+}
+
+status_t KeyframeIndex::store() {
+  std::string data;
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    if (!mDirty || mLayout.empty()) {
+      return OK;
+    }
+    putVarint(&data, kSidecarMagic);
+    putVarint(&data, kSidecarVersion);
+    putString(&data, mKey);
+    putString(&data, mLayout);
+    putVarint(&data, mComplete ? 1 : 0);
+    putVarint(&data, mEntries.size());
+    Entry last {0, 0};
+    for (const Entry &entry : mEntries) {
+      putSigned(&data, entry.timestamp - last.timestamp);
+      putSigned(&data, entry.offset - last.offset);
+      last = entry;
+    }
+    mDirty = false;
+  }
+
+  // Written aside and renamed, a reader never sees half a sidecar. Two
+  // extractors storing at once each write a whole one, the last one wins.
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%d.tmp", (int)gettid());
+  const std::string tmpPath = mPath + suffix;
+  int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    ALOGW("cannot create %s: %s", tmpPath.c_str(), strerror(errno));
+    return ERROR_IO;
+  }
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t n = write(fd, data.data() + done, data.size() - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    done += n;
+  }
+  ::close(fd);
+  if (done < data.size() || rename(tmpPath.c_str(), mPath.c_str()) != 0) {
+    ALOGW("cannot write %s: %s", mPath.c_str(), strerror(errno));
+    unlink(tmpPath.c_str());
+    return ERROR_IO;
+  }
+  ALOGV("stored %zu bytes for %s", data.size(), mKey.c_str());
+
+  std::lock_guard<std::mutex> autoLock(mLock);
+  ++mStats.stores;
+  return OK;
+}
+
+void KeyframeIndex::add(int64_t timestamp, int64_t offset) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (mComplete || (!mEntries.empty() && timestamp <= mEntries.back().timestamp)) {
+    return;
+  }
+  mEntries.push_back({timestamp, offset});
+  mDirty = true;
+}
+
+void KeyframeIndex::setComplete() {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (!mComplete) {
+    mComplete = true;
+    mDirty = true;
+  }
+}
+
+bool KeyframeIndex::isComplete() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  return mComplete;
+}
+
+status_t KeyframeIndex::find(int64_t timestamp, Entry *entry) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  // Past the last entry there may be key frames nobody has read yet.
+  auto it = std::upper_bound(mEntries.begin(), mEntries.end(), timestamp,
+                             [](int64_t value, const Entry &e) { return value < e.timestamp; });
+  if (it == mEntries.begin() || (!mComplete && timestamp > mEntries.back().timestamp)) {
+    ++mStats.misses;
+    return NAME_NOT_FOUND;
+  }
+  *entry = *(it - 1);
+  ++mStats.hits;
+  return OK;
+}
+
+size_t KeyframeIndex::size() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  return mEntries.size();
+}
+
+KeyframeIndex::Stats KeyframeIndex::getStats() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  return mStats;
+}
+
+} // hpc
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Error.h"
+
+namespace hpc {
+
+// Where the key frames of the lead track of a file are, for containers that
+// do not carry a seek table: MPEG-TS, Matroska without Cues, ADTS, MP3. The
+// extractor playing the file fills it as it reads through, a
+// KeyframeIndexer ahead of playback can fill it all, and it is kept as a
+// sidecar so later opens of the file seek with it from the start.
+//
+// A key frame only goes in when the extractor adding it read everything
+// since the last entry, so there are no gaps: up to the last entry, or to
+// the end of the file once complete, find() returns the key frame at or
+// before a position, not an estimate. Timestamps are in whatever time base
+// the extractor uses, the layout it was opened with tells them apart.
+//
+// Safe to share between the extractor playing and one indexing.
+class KeyframeIndex {
+ public:
+  struct Entry {
+    int64_t timestamp;
+    int64_t offset;  // where the extractor resumes reading for it
+  };
+
+  struct Stats {
+    int64_t hits {0};      // seeks find() answered
+    int64_t misses {0};    // outside the entries, left to the container
+    int64_t loads {0};
+    int64_t stores {0};
+  };
+
+  // The sidecar of |key|, as ProbeCache::KeyFor() makes it, goes to
+  // |directory|, created if missing.
+  KeyframeIndex(const std::string &directory, const std::string &key);
+
+  // Loads the sidecar if it was stored for |layout|, e.g. the demuxer and
+  // track the timestamps belong to, and starts empty otherwise. Later calls
+  // with the same layout, by a second extractor, keep what is there.
+  void open(const std::string &layout);
+
+  // Stores what was added since open() or the last store(), if anything.
+  status_t store();
+
+  // A key frame the caller read after the last entry with nothing skipped
+  // in between; ignored unless it is later than the last entry.
+  void add(int64_t timestamp, int64_t offset);
+
+  // The caller read through to the end of the file after the last entry.
+  void setComplete();
+  bool isComplete() const;
+
+  // The last key frame at or before |timestamp|. NAME_NOT_FOUND before
+  // the first entry, and past the last one of an index that is not
+  // complete yet.
+  status_t find(int64_t timestamp, Entry *entry);
+
+  size_t size() const;
+  Stats getStats() const;
+
+ private:
+  const std::string mPath;
+  const std::string mKey;
+  mutable std::mutex mLock;
+  std::string mLayout;
+  std::vector<Entry> mEntries;
+  bool mComplete {false};
+  bool mDirty {false};
+  Stats mStats;
+};
+
+} // hpc
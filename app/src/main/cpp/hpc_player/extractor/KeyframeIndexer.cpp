@@ -0,0 +1,76 @@
+#include "KeyframeIndexer.h"
+#include "Extractor.h"
+#include "Log.h"
+#include "Looper.h"
+#include "MediaPacket.h"
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#define LOG_TAG "KeyframeIndexer"
+
+namespace hpc {
+
+KeyframeIndexer::KeyframeIndexer(const std::shared_ptr<Extractor> &extractor,
+                                 const std::string &url)
+    : mExtractor(extractor),
+      mUrl(url) {
+}
+
+KeyframeIndexer::~KeyframeIndexer() {
+  stop();
+}
+
+void KeyframeIndexer::start() {
+  if (mThread.joinable()) {
+    return;
+  }
+  mStopped = false;
+  mThread = std::thread([this]() {
+    // Playback reads the same storage, the index is never in a hurry.
+    setpriority(PRIO_PROCESS, gettid(), Looper::PRIORITY_BACKGROUND);
+    run();
+  });
+}
+
+void KeyframeIndexer::stop() {
+  mStopped = true;
+  if (mThread.joinable()) {
+    mThread.join();
+  }
+}
+
+status_t KeyframeIndexer::run() {
+  const int64_t startUs = Looper::GetNowUs();
+  status_t err = mExtractor->init(mUrl.c_str());
+  int64_t packets = 0;
+  if (err == OK) {
+    const int lead = mExtractor->getVideoStreamIndex() >= 0
+        ? mExtractor->getVideoStreamIndex() : mExtractor->getAudioStreamIndex();
+    for (size_t i = 0; i < mExtractor->getTrackCount(); ++i) {
+      if ((int)i != lead) {
+        mExtractor->selectTrack(i, false);
+      }
+    }
+    std::unique_ptr<MediaPacket> packet;
+    while (!mStopped && (err = mExtractor->read(packet, lead)) == OK) {
+      ++packets;
+    }
+    mExtractor->release();
+  }
+  const int64_t scanUs = Looper::GetNowUs() - startUs;
+  ALOGD("%lld packets in %lld ms: %d", (long long)packets, (long long)scanUs / 1000, err);
+
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mStats.packets = packets;
+  mStats.scanUs = scanUs;
+  mStats.result = err;
+  return err;
+}
+
+KeyframeIndexer::Stats KeyframeIndexer::getStats() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  return mStats;
+}
+
+} // hpc
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "Error.h"
+
+namespace hpc {
+
+class Extractor;
+
+// Reads a file through with an extractor of its own, on a background thread
+// or on demand, for the KeyframeIndex that extractor shares with the one
+// playing to fill up ahead of playback. Only the lead track stays selected
+// and nothing is decoded; the extractor stores the index at release().
+class KeyframeIndexer {
+ public:
+  struct Stats {
+    int64_t packets {0};
+    int64_t scanUs {0};
+    status_t result {OK};    // of the last run, ERROR_END_OF_STREAM once through
+  };
+
+  // |extractor| has its index set but is not initialized yet, run() opens
+  // it with |url|.
+  KeyframeIndexer(const std::shared_ptr<Extractor> &extractor, const std::string &url);
+  ~KeyframeIndexer();
+
+  // Runs on a thread of background priority until through or stopped.
+  void start();
+  void stop();
+
+  // Indexes on the caller's thread instead.
+  status_t run();
+
+  Stats getStats() const;
+
+ private:
+  const std::shared_ptr<Extractor> mExtractor;
+  const std::string mUrl;
+  std::thread mThread;
+  std::atomic<bool> mStopped {false};
+  mutable std::mutex mLock;  // for mStats
+  Stats mStats;
+};
+
+} // hpc
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+}
+
+namespace hpc {
+
+class MetaData;
+
+// One demuxed access unit: a reference to the demuxer's AVBufferRef with the
+// flags and side data that came with it, timestamps already rescaled to
+// microseconds. The payload is never copied on its way to a codec; clone()
+// and avcodec_send_packet() only take another reference to it.
+class MediaPacket {
+ public:
+  MediaPacket() : mPacket(av_packet_alloc()) {}
+  ~MediaPacket() { av_packet_free(&mPacket); }
+
+  MediaPacket(const MediaPacket &) = delete;
+  MediaPacket &operator=(const MediaPacket &) = delete;
+
+  AVPacket *avPacket() const { return mPacket; }
+  const uint8_t *data() const { return mPacket->data; }
+  int size() const { return mPacket->size; }
+  int flags() const { return mPacket->flags; }
+  bool isKeyFrame() const { return (mPacket->flags & AV_PKT_FLAG_KEY) != 0; }
+  // False only for a payload nobody owns, which a codec would have to copy.
+  bool isRefCounted() const { return mPacket->buf != nullptr; }
+
+  // Side data of |type|, e.g. AV_PKT_DATA_NEW_EXTRADATA after a parameter
+  // change, nullptr if the packet has none.
+  const uint8_t *sideData(enum AVPacketSideDataType type, int *size) const {
+    return av_packet_get_side_data(mPacket, type, size);
+  }
+  int sideDataCount() const { return mPacket->side_data_elems; }
+
+  // Points the packet at |size| bytes at |data| inside |buffer|, whose
+  // reference it takes over, e.g. a sample of a mapped file. Codecs read up
+  // to AV_INPUT_BUFFER_PADDING_SIZE bytes past the end, |buffer| has to
+  // cover those.
+  void setPayload(AVBufferRef *buffer, const uint8_t *data, int size) {
+    av_packet_unref(mPacket);
+    mPacket->buf = buffer;
+    mPacket->data = const_cast<uint8_t *>(data);
+    mPacket->size = size;
+  }
+
+  // Another packet on the same payload and side data.
+  std::unique_ptr<MediaPacket> clone() const {
+    std::unique_ptr<MediaPacket> packet = std::make_unique<MediaPacket>();
+    if (av_packet_ref(packet->mPacket, mPacket) < 0) {
+      return nullptr;
+    }
+    packet->trackIndex = trackIndex;
+    packet->ptsUs = ptsUs;
+    packet->dtsUs = dtsUs;
+    packet->durationUs = durationUs;
+    packet->decodeOnly = decodeOnly;
+    packet->discontinuity = discontinuity;
+    packet->format = format;
+    return packet;
+  }
+
+  int32_t trackIndex {-1};
+  int64_t ptsUs {-1};
+  int64_t dtsUs {-1};
+  int64_t durationUs {0};
+  // Decode, but drop the frame: references and pre-roll around a loop splice.
+  bool decodeOnly {false};
+  // First packet of its track after the stream's clock jumped; the source
+  // queues a discontinuity ahead of it.
+  bool discontinuity {false};
+  // Set on the first packet coded with other parameters than the ones
+  // before it, e.g. the next segment of a ConcatExtractor: the decoder
+  // drains and reopens with them before it takes this packet.
+  std::shared_ptr<MetaData> format;
+
+ private:
+  AVPacket *mPacket;
+};
+
+} // hpc
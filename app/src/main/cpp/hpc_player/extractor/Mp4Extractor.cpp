@@ -0,0 +1,1283 @@
+#include "Mp4Extractor.h"
+#include "DataSource.h"
+#include "Log.h"
+#include "MediaPacket.h"
+#include "MetaData.h"
+#include "MmapSource.h"
+
+#include <algorithm>
+#include <cstring>
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavutil/mathematics.h"
+#include "libavutil/mem.h"
+}
+
+#define LOG_TAG "Mp4Extractor"
+
+namespace hpc {
+
+// sample_is_non_sync_sample of the sample flags in a fragment.
+static const uint32_t kSampleIsNonSync = 0x10000;
+
+// Big-endian reads over a box. Reading past the end yields zeros and fails
+// the reader, so parsers check once per box rather than per field.
+class BoxReader {
+ public:
+  BoxReader() = default;
+  BoxReader(const uint8_t *data, size_t size) : mData(data), mSize(size) {}
+
+  bool ok() const { return mOk; }
+  size_t remaining() const { return mSize - mPos; }
+  const uint8_t *current() const { return mData + mPos; }
+
+  uint8_t u8() { return (uint8_t)read(1); }
+  uint16_t u16() { return (uint16_t)read(2); }
+  uint32_t u24() { return (uint32_t)read(3); }
+  uint32_t u32() { return (uint32_t)read(4); }
+  uint64_t u64() { return read(8); }
+
+  void skip(size_t size) {
+    if (size > remaining()) {
+      fail();
+      return;
+    }
+    mPos += size;
+  }
+
+  // The next child box. False at the end, and for a box larger than what
+  // is left, which also fails the reader.
+  bool nextBox(uint32_t *type, BoxReader *box) {
+    if (!mOk || remaining() < 8) {
+      return false;
+    }
+    uint64_t size = u32();
+    *type = u32();
+    size_t headerSize = 8;
+    if (size == 1) {
+      size = u64();
+      headerSize = 16;
+    } else if (size == 0) {
+      size = remaining() + headerSize;
+    }
+    if (!mOk || size < headerSize || size - headerSize > remaining()) {
+      fail();
+      return false;
+    }
+    *box = BoxReader(current(), size - headerSize);
+    mPos += size - headerSize;
+    return true;
+  }
+
+  // The first child box of |type|, or an empty failed reader.
+  BoxReader findBox(uint32_t type) {
+    uint32_t childType;
+    BoxReader box;
+    while (nextBox(&childType, &box)) {
+      if (childType == type) {
+        return box;
+      }
+    }
+    BoxReader missing;
+    missing.fail();
+    return missing;
+  }
+
+  // An MPEG-4 descriptor (ISO 14496-1) of |tag|, its length in 7-bit groups.
+  bool nextDescriptor(uint8_t tag, BoxReader *descriptor) {
+    if (u8() != tag) {
+      return false;
+    }
+    size_t size = 0;
+    for (int i = 0; i < 4; ++i) {
+      uint8_t byte = u8();
+      size = (size << 7) | (byte & 0x7f);
+      if ((byte & 0x80) == 0) {
+        break;
+      }
+    }
+    if (!mOk || size > remaining()) {
+      return false;
+    }
+    *descriptor = BoxReader(current(), size);
+    mPos += size;
+    return true;
+  }
+
+ private:
+  const uint8_t *mData {nullptr};
+  size_t mSize {0};
+  size_t mPos {0};
+  bool mOk {true};
+
+  void fail() {
+    mOk = false;
+    mPos = mSize;
+  }
+
+  uint64_t read(size_t size) {
+    if (size > remaining()) {
+      fail();
+      return 0;
+    }
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; ++i) {
+      value = (value << 8) | mData[mPos++];
+    }
+    return value;
+  }
+};
+
+// The codec of the sample entry |format|; for MPEG-4 audio and video that
+// of the esds object type.
+static bool codecForSampleEntry(uint32_t format, uint8_t objectType,
+                                AVCodecID *codecId, const char **mime) {
+  switch (format) {
+    case 'avc1':
+    case 'avc3':
+      *codecId = AV_CODEC_ID_H264;
+      *mime = "video/avc";
+      return true;
+    case 'hvc1':
+    case 'hev1':
+      *codecId = AV_CODEC_ID_HEVC;
+      *mime = "video/hevc";
+      return true;
+    case 'vp09':
+      *codecId = AV_CODEC_ID_VP9;
+      *mime = "video/x-vnd.on2.vp9";
+      return true;
+    case 'av01':
+      *codecId = AV_CODEC_ID_AV1;
+      *mime = "video/av01";
+      return true;
+    case 'mp4v':
+      if (objectType != 0x20) {
+        return false;
+      }
+      *codecId = AV_CODEC_ID_MPEG4;
+      *mime = "video/mp4v-es";
+      return true;
+    case 'mp4a':
+      switch (objectType) {
+        case 0x40:  // MPEG-4 audio
+        case 0x66:  // MPEG-2 AAC, main, LC and SSR profiles
+        case 0x67:
+        case 0x68:
+          *codecId = AV_CODEC_ID_AAC;
+          *mime = "audio/mp4a-latm";
+          return true;
+        case 0x69:  // MPEG-2 and MPEG-1 audio
+        case 0x6b:
+          *codecId = AV_CODEC_ID_MP3;
+          *mime = "audio/mpeg";
+          return true;
+        default:
+          return false;
+      }
+    case '.mp3':
+      *codecId = AV_CODEC_ID_MP3;
+      *mime = "audio/mpeg";
+      return true;
+    case 'Opus':
+      *codecId = AV_CODEC_ID_OPUS;
+      *mime = "audio/opus";
+      return true;
+    case 'ac-3':
+      *codecId = AV_CODEC_ID_AC3;
+      *mime = "audio/ac3";
+      return true;
+    case 'ec-3':
+      *codecId = AV_CODEC_ID_EAC3;
+      *mime = "audio/eac3";
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool isZero(const uint8_t *data, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    if (data[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// libavcodec takes an Opus configuration as the OpusHead of Ogg, which
+// carries what dOps does, little-endian.
+static std::vector<uint8_t> opusHeadFromDOps(BoxReader dops) {
+  dops.skip(1);  // version
+  const uint8_t channels = dops.u8();
+  const uint16_t preSkip = dops.u16();
+  const uint32_t sampleRate = dops.u32();
+  const uint16_t gain = dops.u16();
+  const uint8_t mappingFamily = dops.u8();
+  if (!dops.ok()) {
+    return {};
+  }
+  std::vector<uint8_t> head = {'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1, channels,
+      (uint8_t)preSkip, (uint8_t)(preSkip >> 8),
+      (uint8_t)sampleRate, (uint8_t)(sampleRate >> 8),
+      (uint8_t)(sampleRate >> 16), (uint8_t)(sampleRate >> 24),
+      (uint8_t)gain, (uint8_t)(gain >> 8), mappingFamily};
+  // stream count, coupled count and the channel mapping are the same bytes.
+  head.insert(head.end(), dops.current(), dops.current() + dops.remaining());
+  return head;
+}
+
+void Mp4Extractor::SampleTable::append(int64_t sampleOffset, uint32_t sampleSize,
+                                       int64_t sampleDts, int32_t sampleCtsOffset, bool sync) {
+  if (sync) {
+    syncSamples.push_back((uint32_t)offset.size());
+  }
+  offset.push_back(sampleOffset);
+  size.push_back(sampleSize);
+  dts.push_back(sampleDts);
+  ctsOffset.push_back(sampleCtsOffset);
+  isSync.push_back(sync);
+}
+
+Mp4Extractor::Mp4Extractor()
+    : mMetaData(std::make_shared<MetaData>()) {
+}
+
+Mp4Extractor::~Mp4Extractor() {
+  release();
+}
+
+// static
+bool Mp4Extractor::Sniff(DataSource *source) {
+  uint8_t header[8];
+  if (source == nullptr || source->readAt(0, header, sizeof(header)) != sizeof(header)) {
+    return false;
+  }
+  BoxReader reader(header, sizeof(header));
+  reader.skip(4);
+  const uint32_t type = reader.u32();
+  return type == 'ftyp' || type == 'styp' || type == 'moov';
+}
+
+status_t Mp4Extractor::init(const char *url) {
+  ALOGD("init");
+  if (mDataSource == nullptr) {
+    std::shared_ptr<MmapSource> mapped = MmapSource::Create(url);
+    if (mapped == nullptr || mapped->initCheck() != OK) {
+      return ERROR_UNSUPPORTED;
+    }
+    mDataSource = mapped;
+  }
+  if ((mDataSource->flags() & DataSource::kIsMemoryMapped) != 0) {
+    mMapped = std::static_pointer_cast<MmapSource>(mDataSource);
+  }
+  if (mDataSource->getSize(&mFileSize) != OK) {
+    mFileSize = -1;
+  }
+
+  status_t err = parseTopLevel();
+  if (err == OK) {
+    err = finishTracks();
+  }
+  if (err != OK) {
+    ALOGW("cannot demux %s natively: %d", url, err);
+    release();
+    return err;
+  }
+  mInitialized = true;
+  markStartup(StartupTimeline::kProbe);
+  ALOGD("init end, %zu tracks, video %d, audio %d", mTracks.size(), mVideoTrack, mAudioTrack);
+  return OK;
+}
+
+ssize_t Mp4Extractor::readFully(int64_t offset, void *data, size_t size) {
+  size_t done = 0;
+  int64_t reads = 0;
+  while (done < size) {
+    ssize_t n = mDataSource->readAt(offset + done, (uint8_t *)data + done, size - done);
+    ++reads;
+    if (n < 0) {
+      return n;
+    } else if (n == 0) {
+      break;
+    }
+    done += n;
+  }
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mStats.reads += reads;
+  mStats.bytesRead += done;
+  return done;
+}
+
+// One header read per top level box; mdat is skipped, moov and every moof
+// are read whole and indexed.
+status_t Mp4Extractor::parseTopLevel() {
+  bool sawMoov = false;
+  int64_t offset = 0;
+  for (;;) {
+    uint8_t header[16];
+    ssize_t n = readFully(offset, header, sizeof(header));
+    if (n < 0) {
+      return ERROR_IO;
+    } else if (n < 8) {
+      break;
+    }
+    BoxReader reader(header, n);
+    uint64_t size = reader.u32();
+    const uint32_t type = reader.u32();
+    size_t headerSize = 8;
+    if (size == 1) {
+      size = reader.u64();
+      headerSize = 16;
+      if (!reader.ok()) {
+        return ERROR_MALFORMED;
+      }
+    } else if (size == 0) {
+      // to the end of the file, which only mdat does in practice.
+      if (type == 'mdat') {
+        break;
+      } else if (mFileSize < 0) {
+        return ERROR_UNSUPPORTED;
+      }
+      size = mFileSize - offset;
+    }
+    if (size < headerSize) {
+      return ERROR_MALFORMED;
+    }
+
+    if ((type == 'moov' && !sawMoov) || type == 'moof') {
+      if (type == 'moof' && !sawMoov) {
+        return ERROR_UNSUPPORTED;
+      }
+      const size_t limit = type == 'moov' ? kMaxMoovBytes : kMaxMoofBytes;
+      if (size - headerSize > limit) {
+        return ERROR_UNSUPPORTED;
+      }
+      std::vector<uint8_t> payload(size - headerSize);
+      if (readFully(offset + headerSize, payload.data(), payload.size())
+          != (ssize_t)payload.size()) {
+        return ERROR_MALFORMED;
+      }
+      BoxReader box(payload.data(), payload.size());
+      status_t err = type == 'moov' ? parseMoov(box) : parseMoof(box, offset);
+      if (err != OK) {
+        return err;
+      }
+      if (type == 'moov') {
+        sawMoov = true;
+        markStartup(StartupTimeline::kOpen);
+      }
+    }
+    if (mFileSize >= 0 && size >= (uint64_t)(mFileSize - offset)) {
+      break;
+    }
+    offset += size;
+  }
+  return sawMoov ? (status_t)OK : ERROR_UNSUPPORTED;
+}
+
+status_t Mp4Extractor::parseMoov(BoxReader moov) {
+  // trex refers to the tracks by id, mvex may come before them.
+  BoxReader mvex;
+  bool fragmented = false;
+  uint32_t type;
+  BoxReader box;
+  while (moov.nextBox(&type, &box)) {
+    if (type == 'mvhd') {
+      const uint8_t version = box.u8();
+      box.skip(3 + (version == 1 ? 16 : 8));
+      mMovieTimescale = box.u32();
+    } else if (type == 'trak') {
+      status_t err = parseTrak(box);
+      if (err != OK) {
+        return err;
+      }
+    } else if (type == 'mvex') {
+      mvex = box;
+      fragmented = true;
+    }
+  }
+  if (!moov.ok()) {
+    return ERROR_MALFORMED;
+  }
+  return fragmented ? parseMvex(mvex) : (status_t)OK;
+}
+
+status_t Mp4Extractor::parseTrak(BoxReader trak) {
+  Track track;
+  BoxReader stbl;
+  bool hasStbl = false;
+  uint32_t type;
+  BoxReader box;
+  while (trak.nextBox(&type, &box)) {
+    if (type == 'tkhd') {
+      const uint8_t version = box.u8();
+      box.skip(3 + (version == 1 ? 16 : 8));
+      track.id = box.u32();
+    } else if (type == 'edts') {
+      BoxReader elst = box.findBox('elst');
+      const uint8_t version = elst.u8();
+      elst.skip(3);
+      const uint32_t entries = elst.u32();
+      bool media = false;
+      for (uint32_t i = 0; i < entries && elst.ok(); ++i) {
+        const int64_t duration = version == 1 ? (int64_t)elst.u64() : elst.u32();
+        const int64_t mediaTime = version == 1 ? (int64_t)elst.u64() : (int32_t)elst.u32();
+        elst.skip(4);  // media rate
+        if (mediaTime == -1 && !media) {
+          track.editEmpty += duration;
+        } else if (!media) {
+          track.editMediaTime = mediaTime;
+          media = true;
+        } else {
+          // several media edits, FFmpeg plays those.
+          return ERROR_UNSUPPORTED;
+        }
+      }
+    } else if (type == 'mdia') {
+      uint32_t childType;
+      BoxReader child;
+      while (box.nextBox(&childType, &child)) {
+        if (childType == 'mdhd') {
+          const uint8_t version = child.u8();
+          child.skip(3 + (version == 1 ? 16 : 8));
+          track.timescale = child.u32();
+          child.skip(version == 1 ? 8 : 4);
+          const uint16_t language = child.u16();
+          // ISO 639-2 in three 5 bit letters, below 0x400 a Macintosh code.
+          if (language >= 0x400 && child.ok()) {
+            const char code[] = {(char)(((language >> 10) & 0x1f) + 0x60),
+                                 (char)(((language >> 5) & 0x1f) + 0x60),
+                                 (char)((language & 0x1f) + 0x60), 0};
+            track.language = code;
+          }
+        } else if (childType == 'hdlr') {
+          child.skip(8);
+          const uint32_t handler = child.u32();
+          track.type = handler == 'vide' ? MEDIA_TRACK_TYPE_VIDEO
+              : handler == 'soun' ? MEDIA_TRACK_TYPE_AUDIO
+              : handler == 'sbtl' || handler == 'subt' || handler == 'text'
+                  ? MEDIA_TRACK_TYPE_SUBTITLE : MEDIA_TRACK_TYPE_UNKNOWN;
+        } else if (childType == 'minf') {
+          stbl = child.findBox('stbl');
+          hasStbl = stbl.ok();
+        }
+      }
+    }
+  }
+  if (!trak.ok()) {
+    return ERROR_MALFORMED;
+  }
+  if (track.language.empty()) {
+    track.language = "und";
+  }
+  // Other tracks keep their number but are not indexed, they cannot be
+  // selected.
+  if (track.type == MEDIA_TRACK_TYPE_VIDEO || track.type == MEDIA_TRACK_TYPE_AUDIO) {
+    if (!hasStbl || track.timescale == 0) {
+      return ERROR_MALFORMED;
+    }
+    status_t err = parseStbl(stbl, &track);
+    if (err != OK) {
+      return err;
+    }
+  }
+  mTracks.push_back(std::move(track));
+  return OK;
+}
+
+status_t Mp4Extractor::parseSampleEntry(BoxReader stsd, Track *track) {
+  stsd.skip(4);
+  const uint32_t entries = stsd.u32();
+  uint32_t format;
+  BoxReader entry;
+  if (entries == 0 || !stsd.nextBox(&format, &entry)) {
+    return ERROR_MALFORMED;
+  }
+  track->sampleEntry = format;
+  entry.skip(8);  // reserved, data_reference_index
+  if (track->type == MEDIA_TRACK_TYPE_VIDEO) {
+    entry.skip(16);
+    track->width = entry.u16();
+    track->height = entry.u16();
+    entry.skip(50);
+  } else {
+    // QuickTime sound descriptions have versions 1 and 2, ISO only 0.
+    const uint16_t version = entry.u16();
+    entry.skip(6);
+    track->channelCount = entry.u16();
+    entry.skip(6);
+    track->sampleRate = entry.u32() >> 16;
+    if (version == 1) {
+      entry.skip(16);
+    } else if (version == 2) {
+      entry.skip(4);
+      const uint64_t bits = entry.u64();
+      double sampleRate;
+      memcpy(&sampleRate, &bits, sizeof(sampleRate));
+      track->sampleRate = (int)sampleRate;
+      track->channelCount = entry.u32();
+      entry.skip(20);
+    }
+  }
+  if (!entry.ok()) {
+    return ERROR_MALFORMED;
+  }
+
+  uint8_t objectType = 0;
+  uint32_t type;
+  BoxReader box;
+  while (entry.nextBox(&type, &box)) {
+    if (type == 'wave') {
+      // QuickTime wraps esds in a wave box.
+      box = box.findBox('esds');
+      type = box.ok() ? 'esds' : type;
+    }
+    switch (type) {
+      case 'avcC':
+      case 'hvcC':
+      case 'av1C':
+        track->codecConfig.assign(box.current(), box.current() + box.remaining());
+        break;
+      case 'esds': {
+        BoxReader es;
+        BoxReader decoderConfig;
+        box.skip(4);
+        if (!box.nextDescriptor(0x03, &es)) {
+          break;
+        }
+        es.skip(2);
+        const uint8_t flags = es.u8();
+        if (flags & 0x80) {
+          es.skip(2);  // depends on ES_ID
+        }
+        if (flags & 0x40) {
+          es.skip(es.u8());  // URL
+        }
+        if (flags & 0x20) {
+          es.skip(2);  // OCR_ES_ID
+        }
+        if (!es.nextDescriptor(0x04, &decoderConfig)) {
+          break;
+        }
+        objectType = decoderConfig.u8();
+        decoderConfig.skip(12);
+        BoxReader specificInfo;
+        if (decoderConfig.nextDescriptor(0x05, &specificInfo)) {
+          track->codecConfig.assign(specificInfo.current(),
+                                    specificInfo.current() + specificInfo.remaining());
+        }
+        break;
+      }
+      case 'dOps':
+        track->codecConfig = opusHeadFromDOps(box);
+        break;
+      case 'sinf':
+        track->encrypted = true;
+        break;
+      default:
+        break;
+    }
+  }
+
+  AVCodecID codecId;
+  const char *mime;
+  if (codecForSampleEntry(format, objectType, &codecId, &mime)) {
+    track->codecId = codecId;
+    track->mime = mime;
+  }
+  return OK;
+}
+
+status_t Mp4Extractor::parseStbl(BoxReader stbl, Track *track) {
+  BoxReader stsd, stts, ctts, stss, stsz, stsc, stco;
+  bool hasCtts = false;
+  bool hasStss = false;
+  bool compactSizes = false;
+  bool largeOffsets = false;
+  int found = 0;
+  uint32_t type;
+  BoxReader box;
+  while (stbl.nextBox(&type, &box)) {
+    switch (type) {
+      case 'stsd': stsd = box; found |= 1; break;
+      case 'stts': stts = box; found |= 2; break;
+      case 'ctts': ctts = box; hasCtts = true; break;
+      case 'stss': stss = box; hasStss = true; break;
+      case 'stz2': compactSizes = true; // fall through
+      case 'stsz': stsz = box; found |= 4; break;
+      case 'stsc': stsc = box; found |= 8; break;
+      case 'co64': largeOffsets = true; // fall through
+      case 'stco': stco = box; found |= 16; break;
+      default: break;
+    }
+  }
+  if (!stbl.ok() || found != 31) {
+    return ERROR_MALFORMED;
+  }
+  status_t err = parseSampleEntry(stsd, track);
+  if (err != OK) {
+    return err;
+  }
+
+  // sizes
+  stsz.skip(4);
+  uint32_t constantSize = 0;
+  uint8_t fieldBits = 32;
+  if (compactSizes) {
+    stsz.skip(3);
+    fieldBits = stsz.u8();
+    if (fieldBits != 4 && fieldBits != 8 && fieldBits != 16) {
+      return ERROR_MALFORMED;
+    }
+  } else {
+    constantSize = stsz.u32();
+  }
+  const uint32_t count = stsz.u32();
+  if (count > kMaxSamples) {
+    return ERROR_UNSUPPORTED;
+  }
+  if (constantSize == 0 && ((uint64_t)count * fieldBits + 7) / 8 > stsz.remaining()) {
+    return ERROR_MALFORMED;
+  }
+  SampleTable &table = track->samples;
+  table.offset.resize(count);
+  table.size.resize(count);
+  table.dts.resize(count);
+  table.ctsOffset.assign(count, 0);
+  table.isSync.assign(count, hasStss ? 0 : 1);
+  for (uint32_t i = 0; i < count; ++i) {
+    if (constantSize != 0) {
+      table.size[i] = constantSize;
+    } else if (fieldBits == 4) {
+      const uint8_t pair = i % 2 == 0 ? stsz.u8() : stsz.current()[-1];
+      table.size[i] = i % 2 == 0 ? pair >> 4 : pair & 0x0f;
+    } else {
+      table.size[i] = (uint32_t)(fieldBits == 8 ? stsz.u8() : fieldBits == 16 ? stsz.u16() : stsz.u32());
+    }
+  }
+
+  // offsets: chunks of consecutive samples, stsc runs of chunks alike.
+  stco.skip(4);
+  const uint32_t chunkCount = stco.u32();
+  if ((uint64_t)chunkCount * (largeOffsets ? 8 : 4) > stco.remaining()) {
+    return ERROR_MALFORMED;
+  }
+  stsc.skip(4);
+  const uint32_t runCount = stsc.u32();
+  if ((uint64_t)runCount * 12 > stsc.remaining() || (runCount == 0 && count > 0)) {
+    return ERROR_MALFORMED;
+  }
+  std::vector<std::pair<uint32_t, uint32_t>> runs(runCount);  // first chunk, samples
+  for (auto &run : runs) {
+    run.first = stsc.u32();
+    run.second = stsc.u32();
+    stsc.skip(4);  // sample description index
+  }
+  size_t sample = 0;
+  size_t run = 0;
+  for (uint32_t chunk = 1; chunk <= chunkCount && sample < count; ++chunk) {
+    while (run + 1 < runs.size() && runs[run + 1].first <= chunk) {
+      ++run;
+    }
+    int64_t offset = largeOffsets ? (int64_t)stco.u64() : stco.u32();
+    for (uint32_t i = 0; i < runs[run].second && sample < count; ++i) {
+      table.offset[sample] = offset;
+      offset += table.size[sample++];
+    }
+  }
+  if (sample < count) {
+    return ERROR_MALFORMED;
+  }
+
+  // decode times
+  stts.skip(4);
+  const uint32_t timeRuns = stts.u32();
+  if ((uint64_t)timeRuns * 8 > stts.remaining()) {
+    return ERROR_MALFORMED;
+  }
+  int64_t dts = 0;
+  sample = 0;
+  for (uint32_t i = 0; i < timeRuns; ++i) {
+    const uint32_t samples = stts.u32();
+    const uint32_t delta = stts.u32();
+    for (uint32_t j = 0; j < samples && sample < count; ++j) {
+      table.dts[sample++] = dts;
+      dts += delta;
+    }
+  }
+  if (sample < count) {
+    return ERROR_MALFORMED;
+  }
+  track->endDts = dts;
+
+  // composition offsets, signed in version 1 and in practice in version 0.
+  if (hasCtts) {
+    ctts.skip(4);
+    const uint32_t offsetRuns = ctts.u32();
+    if ((uint64_t)offsetRuns * 8 > ctts.remaining()) {
+      return ERROR_MALFORMED;
+    }
+    sample = 0;
+    for (uint32_t i = 0; i < offsetRuns; ++i) {
+      const uint32_t samples = ctts.u32();
+      const int32_t offset = (int32_t)ctts.u32();
+      for (uint32_t j = 0; j < samples && sample < count; ++j) {
+        table.ctsOffset[sample++] = offset;
+      }
+    }
+  }
+
+  // sync samples, every sample without stss.
+  if (hasStss) {
+    stss.skip(4);
+    const uint32_t syncCount = stss.u32();
+    if ((uint64_t)syncCount * 4 > stss.remaining()) {
+      return ERROR_MALFORMED;
+    }
+    for (uint32_t i = 0; i < syncCount; ++i) {
+      const uint32_t number = stss.u32();
+      if (number >= 1 && number <= count) {
+        table.isSync[number - 1] = 1;
+      }
+    }
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    if (table.isSync[i]) {
+      table.syncSamples.push_back(i);
+    }
+  }
+  return OK;
+}
+
+status_t Mp4Extractor::parseMvex(BoxReader mvex) {
+  uint32_t type;
+  BoxReader box;
+  while (mvex.nextBox(&type, &box)) {
+    if (type != 'trex') {
+      continue;
+    }
+    box.skip(4);
+    Track *track = findTrack(box.u32());
+    box.skip(4);  // sample description index
+    const uint32_t duration = box.u32();
+    const uint32_t size = box.u32();
+    const uint32_t flags = box.u32();
+    if (track != nullptr && box.ok()) {
+      track->defaultDuration = duration;
+      track->defaultSize = size;
+      track->defaultFlags = flags;
+    }
+  }
+  return mvex.ok() ? (status_t)OK : ERROR_MALFORMED;
+}
+
+status_t Mp4Extractor::parseMoof(BoxReader moof, int64_t moofOffset) {
+  // without a base offset, a track fragment's data follows the previous one's.
+  int64_t implicitOffset = moofOffset;
+  uint32_t type;
+  BoxReader traf;
+  while (moof.nextBox(&type, &traf)) {
+    if (type != 'traf') {
+      continue;
+    }
+    Track *track = nullptr;
+    int64_t dataOffset = 0;
+    bool firstTrun = true;
+    uint32_t duration = 0;
+    uint32_t size = 0;
+    uint32_t flags = 0;
+    uint32_t childType;
+    BoxReader box;
+    while (traf.nextBox(&childType, &box)) {
+      if (childType == 'tfhd') {
+        const uint32_t tfhdFlags = box.u32() & 0xffffff;
+        track = findTrack(box.u32());
+        if (track == nullptr || (track->type != MEDIA_TRACK_TYPE_VIDEO
+                                 && track->type != MEDIA_TRACK_TYPE_AUDIO)) {
+          // not indexed, like its moov samples.
+          track = nullptr;
+          break;
+        }
+        dataOffset = (tfhdFlags & 0x1) ? (int64_t)box.u64()
+            : (tfhdFlags & 0x20000) ? moofOffset : implicitOffset;
+        if (tfhdFlags & 0x2) {
+          box.skip(4);  // sample description index
+        }
+        duration = (tfhdFlags & 0x8) ? box.u32() : track->defaultDuration;
+        size = (tfhdFlags & 0x10) ? box.u32() : track->defaultSize;
+        flags = (tfhdFlags & 0x20) ? box.u32() : track->defaultFlags;
+      } else if (childType == 'tfdt' && track != nullptr) {
+        const uint8_t version = box.u8();
+        box.skip(3);
+        track->endDts = version == 1 ? (int64_t)box.u64() : box.u32();
+      } else if (childType == 'trun' && track != nullptr) {
+        const uint32_t trunFlags = box.u32() & 0xffffff;
+        const uint32_t count = box.u32();
+        // without a data offset, the first run starts at the base offset and
+        // the others follow the previous run.
+        int64_t offset = (trunFlags & 0x1) ? dataOffset + (int32_t)box.u32()
+            : firstTrun ? dataOffset : implicitOffset;
+        firstTrun = false;
+        const uint32_t firstFlags = (trunFlags & 0x4) ? box.u32() : flags;
+        const size_t fieldBytes = 4 * (((trunFlags >> 8) & 1) + ((trunFlags >> 9) & 1)
+                                       + ((trunFlags >> 10) & 1) + ((trunFlags >> 11) & 1));
+        if (!box.ok() || (uint64_t)count * fieldBytes > box.remaining()) {
+          return ERROR_MALFORMED;
+        }
+        if (track->samples.count() + count > kMaxSamples) {
+          return ERROR_UNSUPPORTED;
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+          const uint32_t sampleDuration = (trunFlags & 0x100) ? box.u32() : duration;
+          const uint32_t sampleSize = (trunFlags & 0x200) ? box.u32() : size;
+          uint32_t sampleFlags = (trunFlags & 0x400) ? box.u32() : flags;
+          if (i == 0 && (trunFlags & 0x4)) {
+            sampleFlags = firstFlags;
+          }
+          const int32_t ctsOffset = (trunFlags & 0x800) ? (int32_t)box.u32() : 0;
+          track->samples.append(offset, sampleSize, track->endDts, ctsOffset,
+                                (sampleFlags & kSampleIsNonSync) == 0);
+          offset += sampleSize;
+          track->endDts += sampleDuration;
+        }
+        implicitOffset = offset;
+      }
+    }
+    if (!traf.ok()) {
+      return ERROR_MALFORMED;
+    }
+  }
+  return moof.ok() ? (status_t)OK : ERROR_MALFORMED;
+}
+
+status_t Mp4Extractor::finishTracks() {
+  for (Track &track : mTracks) {
+    if (track.type != MEDIA_TRACK_TYPE_VIDEO && track.type != MEDIA_TRACK_TYPE_AUDIO) {
+      continue;
+    }
+    if (track.mime.empty() || track.encrypted) {
+      char format[5] = {(char)(track.sampleEntry >> 24), (char)(track.sampleEntry >> 16),
+                        (char)(track.sampleEntry >> 8), (char)track.sampleEntry, 0};
+      ALOGW("track %u: unsupported sample entry %s", track.id, format);
+      return ERROR_UNSUPPORTED;
+    }
+    track.timeOffset = -track.editMediaTime;
+    if (mMovieTimescale > 0) {
+      track.timeOffset += av_rescale(track.editEmpty, track.timescale, mMovieTimescale);
+    }
+    if (track.samples.count() == 0) {
+      continue;
+    }
+    const int index = (int)(&track - mTracks.data());
+    if (track.type == MEDIA_TRACK_TYPE_VIDEO && mVideoTrack < 0) {
+      mVideoTrack = index;
+    } else if (track.type == MEDIA_TRACK_TYPE_AUDIO && mAudioTrack < 0) {
+      mAudioTrack = index;
+    }
+  }
+  if (mVideoTrack < 0 && (mRequiresVideo || mAudioTrack < 0)) {
+    ALOGE("no video track");
+    return ERROR_UNSUPPORTED;
+  }
+
+  if (mVideoTrack >= 0) {
+    const Track &video = mTracks[mVideoTrack];
+    mTracks[mVideoTrack].selected = true;
+    mMetaData->mime = video.mime;
+    mMetaData->width = video.width;
+    mMetaData->height = video.height;
+  }
+  if (mAudioTrack >= 0) {
+    const Track &audio = mTracks[mAudioTrack];
+    mTracks[mAudioTrack].selected = true;
+    mMetaData->sampleRate = audio.sampleRate;
+    mMetaData->channelCount = audio.channelCount;
+  }
+  return OK;
+}
+
+Mp4Extractor::Track *Mp4Extractor::findTrack(uint32_t id) {
+  for (Track &track : mTracks) {
+    if (track.id == id) {
+      return &track;
+    }
+  }
+  return nullptr;
+}
+
+int64_t Mp4Extractor::ticksToUs(const Track &track, int64_t ticks) const {
+  return av_rescale(ticks + track.timeOffset, 1000000, track.timescale);
+}
+
+int64_t Mp4Extractor::usToTicks(const Track &track, int64_t timeUs) const {
+  return av_rescale(timeUs, track.timescale, 1000000) - track.timeOffset;
+}
+
+int64_t Mp4Extractor::sampleTimeUs(const Track &track, size_t i) const {
+  return ticksToUs(track, track.samples.dts[i] + track.samples.ctsOffset[i]);
+}
+
+// A binary search over the sync samples, whose presentation times ascend
+// even where those of the samples in between do not.
+size_t Mp4Extractor::findSyncSample(const Track &track, int64_t timeUs, SeekMode mode) const {
+  const SampleTable &table = track.samples;
+  const std::vector<uint32_t> &sync = table.syncSamples;
+  if (sync.empty()) {
+    return table.count();
+  }
+  const int64_t ticks = usToTicks(track, timeUs);
+  auto pts = [&table](uint32_t i) { return table.dts[i] + table.ctsOffset[i]; };
+  auto after = std::upper_bound(sync.begin(), sync.end(), ticks,
+                                [&pts](int64_t value, uint32_t i) { return value < pts(i); });
+  switch (mode) {
+    case SEEK_NEXT_SYNC: {
+      auto at = std::lower_bound(sync.begin(), sync.end(), ticks,
+                                 [&pts](uint32_t i, int64_t value) { return pts(i) < value; });
+      return at == sync.end() ? table.count() : *at;
+    }
+    case SEEK_CLOSEST_SYNC:
+      if (after == sync.begin()) {
+        return *after;
+      } else if (after == sync.end() || ticks - pts(*(after - 1)) <= pts(*after) - ticks) {
+        return *(after - 1);
+      }
+      return *after;
+    default:
+      // SEEK_CLOSEST decodes from the sync sample before.
+      return after == sync.begin() ? *after : *(after - 1);
+  }
+}
+
+// The sample playing at |timeUs|, for tracks whose samples all sync.
+size_t Mp4Extractor::findSampleAt(const Track &track, int64_t timeUs) const {
+  const std::vector<int64_t> &dts = track.samples.dts;
+  auto after = std::upper_bound(dts.begin(), dts.end(), usToTicks(track, timeUs));
+  return after == dts.begin() ? 0 : after - dts.begin() - 1;
+}
+
+int64_t Mp4Extractor::leadTimeUs() const {
+  const int lead = mVideoTrack >= 0 ? mVideoTrack : mAudioTrack;
+  if (lead < 0) {
+    return 0;
+  }
+  const Track &track = mTracks[lead];
+  return track.next < track.samples.count()
+      ? sampleTimeUs(track, track.next) : ticksToUs(track, track.endDts);
+}
+
+int Mp4Extractor::read(std::unique_ptr<MediaPacket> &packet, int index) {
+  if (!mInitialized) {
+    return NO_INIT;
+  }
+  Track *track = nullptr;
+  if (index >= 0) {
+    if ((size_t)index >= mTracks.size()) {
+      return ERROR_OUT_OF_RANGE;
+    }
+    track = &mTracks[index];
+    if (track->next >= track->samples.count()) {
+      return ERROR_END_OF_STREAM;
+    }
+  } else {
+    // the selected track furthest behind in decode time goes first.
+    int64_t earliestUs = INT64_MAX;
+    for (Track &candidate : mTracks) {
+      if (!candidate.selected || candidate.next >= candidate.samples.count()) {
+        continue;
+      }
+      const int64_t dtsUs = ticksToUs(candidate, candidate.samples.dts[candidate.next]);
+      if (dtsUs < earliestUs) {
+        earliestUs = dtsUs;
+        track = &candidate;
+      }
+    }
+    if (track == nullptr) {
+      return ERROR_END_OF_STREAM;
+    }
+  }
+  return readSample(track, packet);
+}
+
+status_t Mp4Extractor::readSample(Track *track, std::unique_ptr<MediaPacket> &packet) {
+  const SampleTable &table = track->samples;
+  const size_t i = track->next;
+  AVBufferRef *buffer = nullptr;
+  const uint8_t *data = nullptr;
+  status_t err = referencePayload(track, i, &buffer, &data);
+  if (err != OK) {
+    return err;
+  }
+
+  if (packet == nullptr) {
+    packet = std::make_unique<MediaPacket>();
+  }
+  packet->setPayload(buffer, data, table.size[i]);
+  const int64_t nextDts = i + 1 < table.count() ? table.dts[i + 1] : track->endDts;
+  packet->trackIndex = (int32_t)(track - mTracks.data());
+  packet->ptsUs = sampleTimeUs(*track, i);
+  packet->dtsUs = ticksToUs(*track, table.dts[i]);
+  packet->durationUs = av_rescale(nextDts - table.dts[i], 1000000, track->timescale);
+  AVPacket *avPacket = packet->avPacket();
+  avPacket->stream_index = packet->trackIndex;
+  avPacket->pts = packet->ptsUs;
+  avPacket->dts = packet->dtsUs;
+  avPacket->duration = packet->durationUs;
+  avPacket->flags = table.isSync[i] ? AV_PKT_FLAG_KEY : 0;
+  ++track->next;
+
+  if (packet->trackIndex == mVideoTrack) {
+    markStartup(StartupTimeline::kFirstPacket);
+  }
+  return OK;
+}
+
+status_t Mp4Extractor::referencePayload(Track *track, size_t i, AVBufferRef **buffer,
+                                        const uint8_t **data) {
+  const SampleTable &table = track->samples;
+  const int64_t offset = table.offset[i];
+  const size_t size = table.size[i];
+
+  // Codecs read up to AV_INPUT_BUFFER_PADDING_SIZE bytes past a sample and
+  // expect zeros there. In a file those are the next sample or box, so the
+  // mapping is only referenced where they happen to be zero, say filler or
+  // an mdat padded out; every other sample goes to a zero padded window.
+  if (mMapped != nullptr && offset >= 0 && mFileSize - offset >= (int64_t)size
+      + AV_INPUT_BUFFER_PADDING_SIZE
+      && isZero(mMapped->data() + offset + size, AV_INPUT_BUFFER_PADDING_SIZE)) {
+    *buffer = mMapped->acquire(offset, size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (*buffer != nullptr) {
+      *data = (*buffer)->data;
+      std::lock_guard<std::mutex> autoLock(mLock);
+      ++mStats.samplesReferenced;
+      return OK;
+    }
+  }
+
+  if (track->window == nullptr || offset < track->windowOffset
+      || offset + size > track->windowOffset + track->windowSize) {
+    // this sample and those of the track right after it, up to a window.
+    size_t span = size;
+    for (size_t j = i + 1; j < table.count()
+             && table.offset[j] == table.offset[j - 1] + table.size[j - 1]
+             && span + table.size[j] <= kWindowBytes; ++j) {
+      span += table.size[j];
+    }
+    av_buffer_unref(&track->window);
+    track->window = av_buffer_alloc(span + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (track->window == nullptr) {
+      return NO_MEMORY;
+    }
+    ssize_t n = readFully(offset, track->window->data, span);
+    if (n < (ssize_t)size) {
+      av_buffer_unref(&track->window);
+      // a sample past the end of a truncated file ends the stream.
+      return n < 0 ? ERROR_IO : ERROR_END_OF_STREAM;
+    }
+    memset(track->window->data + n, 0, span + AV_INPUT_BUFFER_PADDING_SIZE - n);
+    track->windowOffset = offset;
+    track->windowSize = n;
+  }
+  *buffer = av_buffer_ref(track->window);
+  if (*buffer == nullptr) {
+    return NO_MEMORY;
+  }
+  *data = track->window->data + (offset - track->windowOffset);
+  std::lock_guard<std::mutex> autoLock(mLock);
+  ++mStats.samplesRead;
+  return OK;
+}
+
+status_t Mp4Extractor::seek(int64_t position, SeekMode mode) {
+  if (!mInitialized) {
+    return NO_INIT;
+  }
+  const int lead = mVideoTrack >= 0 ? mVideoTrack : mAudioTrack;
+  if (lead < 0) {
+    return NO_INIT;
+  }
+  // the video track lands on a sync sample, the others where it does.
+  Track &leadTrack = mTracks[lead];
+  leadTrack.next = findSyncSample(leadTrack, position, mode);
+  const int64_t timeUs = leadTrack.next < leadTrack.samples.count()
+      ? sampleTimeUs(leadTrack, leadTrack.next) : position;
+  for (Track &track : mTracks) {
+    if (track.selected && &track != &leadTrack) {
+      track.next = findSampleAt(track, timeUs);
+    }
+  }
+  return OK;
+}
+
+status_t Mp4Extractor::readSyncSample(std::unique_ptr<MediaPacket> &packet, int64_t minTimeUs) {
+  if (!mInitialized || mVideoTrack < 0) {
+    return NO_INIT;
+  }
+  Track &video = mTracks[mVideoTrack];
+  video.next = findSyncSample(video, std::max<int64_t>(minTimeUs, 0), SEEK_NEXT_SYNC);
+  if (video.next >= video.samples.count()) {
+    return ERROR_END_OF_STREAM;
+  }
+  return readSample(&video, packet);
+}
+
+status_t Mp4Extractor::getSyncSampleTimeUs(int64_t timeUs, int64_t *syncTimeUs) const {
+  if (!mInitialized || mVideoTrack < 0) {
+    return NAME_NOT_FOUND;
+  }
+  const Track &video = mTracks[mVideoTrack];
+  const size_t i = findSyncSample(video, timeUs, SEEK_PREVIOUS_SYNC);
+  if (i >= video.samples.count()) {
+    return NAME_NOT_FOUND;
+  }
+  *syncTimeUs = sampleTimeUs(video, i);
+  return OK;
+}
+
+int64_t Mp4Extractor::getDurationUs() const {
+  int64_t durationUs = 0;
+  for (const Track &track : mTracks) {
+    if (track.samples.count() > 0) {
+      durationUs = std::max(durationUs, ticksToUs(track, track.endDts));
+    }
+  }
+  return durationUs;
+}
+
+void Mp4Extractor::flush() {
+  releaseWindows();
+}
+
+void Mp4Extractor::releaseWindows() {
+  for (Track &track : mTracks) {
+    av_buffer_unref(&track.window);
+  }
+}
+
+void Mp4Extractor::getMetaData(MetaData &meta) {
+  meta = *mMetaData;
+}
+
+void Mp4Extractor::release() {
+  releaseWindows();
+  mTracks.clear();
+  mMapped.reset();
+  mVideoTrack = -1;
+  mAudioTrack = -1;
+  mMovieTimescale = 0;
+  mInitialized = false;
+}
+
+size_t Mp4Extractor::getTrackCount() const {
+  return mTracks.size();
+}
+
+status_t Mp4Extractor::getTrackInfo(size_t index, TrackInfo *info) const {
+  if (index >= mTracks.size()) {
+    return ERROR_OUT_OF_RANGE;
+  }
+  const Track &track = mTracks[index];
+  info->type = track.type;
+  info->mime_type = track.mime;
+  info->width = track.width;
+  info->height = track.height;
+  info->sample_rate = track.sampleRate;
+  info->channel_count = track.channelCount;
+  info->language = track.language;
+  return OK;
+}
+
+status_t Mp4Extractor::selectTrack(size_t index, bool select) {
+  if (index >= mTracks.size()) {
+    return ERROR_OUT_OF_RANGE;
+  }
+  Track &track = mTracks[index];
+  int *selected;
+  if (track.type == MEDIA_TRACK_TYPE_VIDEO) {
+    selected = &mVideoTrack;
+  } else if (track.type == MEDIA_TRACK_TYPE_AUDIO) {
+    selected = &mAudioTrack;
+  } else {
+    return ERROR_UNSUPPORTED;
+  }
+
+  if (!select) {
+    if (*selected == (int)index) {
+      *selected = -1;
+    }
+    track.selected = false;
+    av_buffer_unref(&track.window);
+    return OK;
+  }
+  if (track.samples.count() == 0) {
+    return ERROR_UNSUPPORTED;
+  }
+  if (!track.selected) {
+    const int64_t timeUs = leadTimeUs();
+    track.next = track.type == MEDIA_TRACK_TYPE_VIDEO
+        ? findSyncSample(track, timeUs, SEEK_PREVIOUS_SYNC) : findSampleAt(track, timeUs);
+  }
+  if (*selected >= 0 && *selected != (int)index) {
+    mTracks[*selected].selected = false;
+    av_buffer_unref(&mTracks[*selected].window);
+  }
+  *selected = (int)index;
+  track.selected = true;
+  if (selected == &mAudioTrack) {
+    mMetaData->sampleRate = track.sampleRate;
+    mMetaData->channelCount = track.channelCount;
+  }
+  return OK;
+}
+
+status_t Mp4Extractor::getCodecParameters(size_t index, AVCodecParameters *params) const {
+  if (index >= mTracks.size()) {
+    return ERROR_OUT_OF_RANGE;
+  }
+  const Track &track = mTracks[index];
+  params->codec_type = track.type == MEDIA_TRACK_TYPE_VIDEO ? AVMEDIA_TYPE_VIDEO
+      : track.type == MEDIA_TRACK_TYPE_AUDIO ? AVMEDIA_TYPE_AUDIO : AVMEDIA_TYPE_UNKNOWN;
+  params->codec_id = (AVCodecID)track.codecId;
+  params->width = track.width;
+  params->height = track.height;
+  params->sample_rate = track.sampleRate;
+  params->channels = track.channelCount;
+  av_freep(&params->extradata);
+  params->extradata_size = 0;
+  if (!track.codecConfig.empty()) {
+    params->extradata = (uint8_t *)av_mallocz(track.codecConfig.size()
+                                              + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (params->extradata == nullptr) {
+      return NO_MEMORY;
+    }
+    memcpy(params->extradata, track.codecConfig.data(), track.codecConfig.size());
+    params->extradata_size = (int)track.codecConfig.size();
+  }
+  return OK;
+}
+
+void Mp4Extractor::setDataSource(const std::shared_ptr<DataSource> &source) {
+  mDataSource = source;
+}
+
+void Mp4Extractor::setRequiresVideo(bool requiresVideo) {
+  mRequiresVideo = requiresVideo;
+}
+
+void Mp4Extractor::setStartupTimeline(const std::shared_ptr<StartupTimeline> &timeline) {
+  mStartupTimeline = timeline;
+}
+
+void Mp4Extractor::markStartup(StartupTimeline::Event event) {
+  if (mStartupTimeline != nullptr) {
+    mStartupTimeline->mark(event);
+  }
+}
+
+Mp4Extractor::Stats Mp4Extractor::getStats() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  return mStats;
+}
+
+} // hpc
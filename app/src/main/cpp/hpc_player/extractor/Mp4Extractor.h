@@ -0,0 +1,189 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Extractor.h"
+#include "StartupTimeline.h"
+
+struct AVBufferRef;
+struct AVCodecParameters;
+
+namespace hpc {
+
+class BoxReader;
+class DataSource;
+class MetaData;
+class MmapSource;
+
+// Demuxes ISO-BMFF, plain and fragmented MP4, without libavformat. init()
+// reads the top level boxes, moov and every moof, and indexes every sample
+// of every track up front, so seeking is a binary search over the table and
+// lands on the exact sync sample, and reading a sample is a lookup.
+//
+// Payloads are referenced straight out of a MmapSource when the bytes after
+// them are zero, as codecs want their padding. Otherwise, and out of any
+// other source, the contiguous samples of a track, a chunk up to
+// kWindowBytes, are read with one readAt() into a zero padded window and
+// packets reference the window they are in.
+//
+// Tracks are numbered in trak order, like FFmpeg numbers the streams of the
+// same file. init() returns ERROR_UNSUPPORTED for anything it does not
+// know, an unknown or encrypted sample entry, a table that does not add
+// up, so the caller falls back to FFmpegExtractor.
+class Mp4Extractor : public Extractor {
+ public:
+  struct Stats {
+    int64_t reads {0};            // readAt() calls, header and payload
+    int64_t bytesRead {0};
+    int64_t samplesReferenced {0};  // zero copy, out of the mapping
+    int64_t samplesRead {0};        // out of a window
+  };
+
+  Mp4Extractor();
+  ~Mp4Extractor() override;
+
+  // True if |source| starts with an ftyp, styp or moov box.
+  static bool Sniff(DataSource *source);
+
+  status_t init(const char *url) override;
+  int read(std::unique_ptr<MediaPacket> &packet, int index) override;
+  status_t seek(int64_t position, SeekMode mode = SEEK_PREVIOUS_SYNC) override;
+  status_t readSyncSample(std::unique_ptr<MediaPacket> &packet, int64_t minTimeUs) override;
+  void flush() override;
+  void getMetaData(MetaData &meta) override;
+  void release() override;
+
+  size_t getTrackCount() const override;
+  status_t getTrackInfo(size_t index, TrackInfo *info) const override;
+  // A track selected again continues at the time of the video track.
+  status_t selectTrack(size_t index, bool select) override;
+
+  int getVideoStreamIndex() const override { return mVideoTrack; }
+  int getAudioStreamIndex() const override { return mAudioTrack; }
+
+  // The time of the sync sample at or before |timeUs| of the video track.
+  status_t getSyncSampleTimeUs(int64_t timeUs, int64_t *syncTimeUs) const;
+  // End of the longest track, 0 before init().
+  int64_t getDurationUs() const override;
+
+  // Codec id, dimensions or sample rate and channels, and the codec
+  // configuration record as extradata, to open a libavcodec decoder with.
+  // Packet timestamps are in microseconds.
+  status_t getCodecParameters(size_t index, AVCodecParameters *params) const override;
+
+  // Reads through |source|. Without one init() maps |url| if it is a local
+  // file. Set before init().
+  void setDataSource(const std::shared_ptr<DataSource> &source);
+
+  // Lets init() take a file without video. Set before init().
+  void setRequiresVideo(bool requiresVideo);
+
+  // Marks open, probe and first video packet on |timeline|. Set before init().
+  void setStartupTimeline(const std::shared_ptr<StartupTimeline> &timeline);
+
+  Stats getStats() const;
+
+ private:
+  // Every sample of a track in decode order, as parallel arrays: a seek
+  // only walks the times of the sync samples, a read loads one entry of
+  // each array.
+  struct SampleTable {
+    std::vector<int64_t> offset;
+    std::vector<uint32_t> size;
+    std::vector<int64_t> dts;          // track timescale
+    std::vector<int32_t> ctsOffset;    // pts - dts
+    std::vector<uint8_t> isSync;
+    std::vector<uint32_t> syncSamples; // indices, ascending
+
+    size_t count() const { return offset.size(); }
+    void append(int64_t sampleOffset, uint32_t sampleSize, int64_t sampleDts,
+                int32_t sampleCtsOffset, bool sync);
+  };
+
+  struct Track {
+    uint32_t id {0};
+    media_track_type type {MEDIA_TRACK_TYPE_UNKNOWN};
+    uint32_t sampleEntry {0};  // fourcc of the first sample description
+    std::string mime;
+    int codecId {0};           // AVCodecID
+    std::vector<uint8_t> codecConfig;
+    std::string language;
+    int width {0};
+    int height {0};
+    int sampleRate {0};
+    int channelCount {0};
+    uint32_t timescale {0};
+    // The edit list: leading empty edits, movie timescale, and where the
+    // media starts. Only a single media edit is supported.
+    int64_t editEmpty {0};
+    int64_t editMediaTime {0};
+    int64_t timeOffset {0};    // both, track timescale
+    bool encrypted {false};
+
+    // trex defaults for fragments
+    uint32_t defaultDuration {0};
+    uint32_t defaultSize {0};
+    uint32_t defaultFlags {0};
+    int64_t endDts {0};        // where a fragment without tfdt continues
+
+    SampleTable samples;
+    size_t next {0};           // the sample read() returns next
+    bool selected {false};
+
+    // Contiguous samples read at once, packets reference it.
+    AVBufferRef *window {nullptr};
+    int64_t windowOffset {0};
+    size_t windowSize {0};
+  };
+
+  // Most a window of contiguous samples holds, when not mapped.
+  static const size_t kWindowBytes = 256 * 1024;
+  // Largest moov and moof read into memory, samples of a track indexed.
+  static const size_t kMaxMoovBytes = 64 * 1024 * 1024;
+  static const size_t kMaxMoofBytes = 16 * 1024 * 1024;
+  static const size_t kMaxSamples = 16 * 1024 * 1024;
+
+  std::shared_ptr<DataSource> mDataSource;
+  std::shared_ptr<MmapSource> mMapped;  // mDataSource if it is mapped
+  int64_t mFileSize {-1};
+  std::shared_ptr<StartupTimeline> mStartupTimeline;
+  std::shared_ptr<MetaData> mMetaData;
+  bool mRequiresVideo {true};
+  bool mInitialized {false};
+
+  std::vector<Track> mTracks;
+  uint32_t mMovieTimescale {0};
+  int mVideoTrack {-1};
+  int mAudioTrack {-1};
+
+  mutable std::mutex mLock;  // for mStats
+  Stats mStats;
+
+  ssize_t readFully(int64_t offset, void *data, size_t size);
+  status_t parseTopLevel();
+  status_t parseMoov(BoxReader moov);
+  status_t parseTrak(BoxReader trak);
+  status_t parseSampleEntry(BoxReader stsd, Track *track);
+  status_t parseStbl(BoxReader stbl, Track *track);
+  status_t parseMvex(BoxReader mvex);
+  status_t parseMoof(BoxReader moof, int64_t moofOffset);
+  status_t finishTracks();
+
+  Track *findTrack(uint32_t id);
+  int64_t ticksToUs(const Track &track, int64_t ticks) const;
+  int64_t usToTicks(const Track &track, int64_t timeUs) const;
+  int64_t sampleTimeUs(const Track &track, size_t i) const;  // pts
+  size_t findSyncSample(const Track &track, int64_t timeUs, SeekMode mode) const;
+  size_t findSampleAt(const Track &track, int64_t timeUs) const;
+  int64_t leadTimeUs() const;
+  status_t readSample(Track *track, std::unique_ptr<MediaPacket> &packet);
+  status_t referencePayload(Track *track, size_t i, AVBufferRef **buffer,
+                            const uint8_t **data);
+  void releaseWindows();
+  void markStartup(StartupTimeline::Event event);
+};
+
+} // hpc
@@ -0,0 +1,407 @@
+#include "ProbeCache.h"
+#include "DataSource.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <strings.h>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+#define LOG_TAG "ProbeCache"
+
+namespace hpc {
+
+namespace {
+
+const uint32_t kEntryMagic = 'HPCP';
+const uint32_t kEntryVersion = 1;
+// An entry larger than this is not one of ours.
+const size_t kMaxEntryBytes = 16 * 1024 * 1024;
+
+// FNV-1a, stable across runs unlike std::hash.
+uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 14695981039346656037ULL) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ p[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+class EntryWriter {
+ public:
+  template <typename T>
+  void put(T value) {
+    mData.append(reinterpret_cast<const char *>(&value), sizeof(value));
+  }
+
+  void putBytes(const void *data, size_t size) {
+    put<uint32_t>(size);
+    mData.append(static_cast<const char *>(data), size);
+  }
+
+  void putString(const std::string &value) { putBytes(value.data(), value.size()); }
+
+  const std::string &data() const { return mData; }
+
+ private:
+  std::string mData;
+};
+
+// Reads what EntryWriter wrote; past the end everything reads as zero and
+// ok() turns false.
+class EntryReader {
+ public:
+  explicit EntryReader(const std::string &data)
+      : mData(data) {}
+
+  template <typename T>
+  T get() {
+    T value {};
+    if (mOffset + sizeof(T) > mData.size()) {
+      mOk = false;
+      return value;
+    }
+    memcpy(&value, mData.data() + mOffset, sizeof(T));
+    mOffset += sizeof(T);
+    return value;
+  }
+
+  std::string getString() {
+    const uint32_t size = get<uint32_t>();
+    if (!mOk || mOffset + size > mData.size()) {
+      mOk = false;
+      return std::string();
+    }
+    std::string value = mData.substr(mOffset, size);
+    mOffset += size;
+    return value;
+  }
+
+  bool ok() const { return mOk; }
+
+ private:
+  const std::string &mData;
+  size_t mOffset {0};
+  bool mOk {true};
+};
+
+void putRational(EntryWriter *writer, AVRational value) {
+  writer->put<int32_t>(value.num);
+  writer->put<int32_t>(value.den);
+}
+
+AVRational getRational(EntryReader *reader) {
+  AVRational value;
+  value.num = reader->get<int32_t>();
+  value.den = reader->get<int32_t>();
+  return value;
+}
+
+void putCodecParameters(EntryWriter *writer, const AVCodecParameters *par) {
+  writer->put<int32_t>(par->codec_id);
+  writer->put<uint32_t>(par->codec_tag);
+  writer->putBytes(par->extradata, par->extradata != nullptr ? par->extradata_size : 0);
+  writer->put<int32_t>(par->format);
+  writer->put<int64_t>(par->bit_rate);
+  writer->put<int32_t>(par->bits_per_coded_sample);
+  writer->put<int32_t>(par->bits_per_raw_sample);
+  writer->put<int32_t>(par->profile);
+  writer->put<int32_t>(par->level);
+  writer->put<int32_t>(par->width);
+  writer->put<int32_t>(par->height);
+  putRational(writer, par->sample_aspect_ratio);
+  writer->put<int32_t>(par->field_order);
+  writer->put<int32_t>(par->color_range);
+  writer->put<int32_t>(par->color_primaries);
+  writer->put<int32_t>(par->color_trc);
+  writer->put<int32_t>(par->color_space);
+  writer->put<int32_t>(par->chroma_location);
+  writer->put<int32_t>(par->video_delay);
+  writer->put<uint64_t>(par->channel_layout);
+  writer->put<int32_t>(par->channels);
+  writer->put<int32_t>(par->sample_rate);
+  writer->put<int32_t>(par->block_align);
+  writer->put<int32_t>(par->frame_size);
+  writer->put<int32_t>(par->initial_padding);
+  writer->put<int32_t>(par->trailing_padding);
+  writer->put<int32_t>(par->seek_preroll);
+}
+
+// Into |par|, freshly allocated.
+bool getCodecParameters(EntryReader *reader, AVCodecParameters *par) {
+  if (par == nullptr) {
+    return false;
+  }
+  par->codec_id = (AVCodecID)reader->get<int32_t>();
+  par->codec_tag = reader->get<uint32_t>();
+  const std::string extradata = reader->getString();
+  if (!reader->ok()) {
+    return false;
+  }
+  if (!extradata.empty()) {
+    par->extradata = (uint8_t *)av_mallocz(extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (par->extradata == nullptr) {
+      return false;
+    }
+    memcpy(par->extradata, extradata.data(), extradata.size());
+    par->extradata_size = extradata.size();
+  }
+  par->format = reader->get<int32_t>();
+  par->bit_rate = reader->get<int64_t>();
+  par->bits_per_coded_sample = reader->get<int32_t>();
+  par->bits_per_raw_sample = reader->get<int32_t>();
+  par->profile = reader->get<int32_t>();
+  par->level = reader->get<int32_t>();
+  par->width = reader->get<int32_t>();
+  par->height = reader->get<int32_t>();
+  par->sample_aspect_ratio = getRational(reader);
+  par->field_order = (AVFieldOrder)reader->get<int32_t>();
+  par->color_range = (AVColorRange)reader->get<int32_t>();
+  par->color_primaries = (AVColorPrimaries)reader->get<int32_t>();
+  par->color_trc = (AVColorTransferCharacteristic)reader->get<int32_t>();
+  par->color_space = (AVColorSpace)reader->get<int32_t>();
+  par->chroma_location = (AVChromaLocation)reader->get<int32_t>();
+  par->video_delay = reader->get<int32_t>();
+  par->channel_layout = reader->get<uint64_t>();
+  par->channels = reader->get<int32_t>();
+  par->sample_rate = reader->get<int32_t>();
+  par->block_align = reader->get<int32_t>();
+  par->frame_size = reader->get<int32_t>();
+  par->initial_padding = reader->get<int32_t>();
+  par->trailing_padding = reader->get<int32_t>();
+  par->seek_preroll = reader->get<int32_t>();
+  return reader->ok();
+}
+
+// A stream as stored.
+struct StreamEntry {
+  AVCodecParameters *par {nullptr};  // codec_type included
+  AVRational timeBase {0, 1};
+  int64_t startTime {AV_NOPTS_VALUE};
+  int64_t duration {AV_NOPTS_VALUE};
+  AVRational avgFrameRate {0, 1};
+  AVRational rFrameRate {0, 1};
+  std::vector<std::pair<int64_t, int64_t>> keyFrames;  // pos, timestamp
+
+  StreamEntry() = default;
+  StreamEntry(const StreamEntry &) = delete;
+  StreamEntry &operator=(const StreamEntry &) = delete;
+  ~StreamEntry() { avcodec_parameters_free(&par); }
+};
+
+bool readFile(const std::string &path, std::string *data) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  bool ok = fstat(fd, &st) == 0 && st.st_size > 0 && (size_t)st.st_size <= kMaxEntryBytes;
+  if (ok) {
+    data->resize(st.st_size);
+    size_t done = 0;
+    while (ok && done < data->size()) {
+      ssize_t n = read(fd, &(*data)[done], data->size() - done);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      ok = n > 0;
+      done += ok ? n : 0;
+    }
+  }
+  ::close(fd);
+  return ok;
+}
+
+} // namespace
+
+ProbeCache::ProbeCache(const std::string &directory)
+    : mDirectory(directory) {
+  if (mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST) {
+    ALOGW("cannot create %s: %s", directory.c_str(), strerror(errno));
+  }
+}
+
+std::string ProbeCache::KeyFor(const char *url, DataSource *source) {
+  char suffix[64];
+  const char *path = strncasecmp(url, "file://", 7) == 0 ? url + 7 : url;
+  if (path[0] == '/') {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+      return std::string();
+    }
+    snprintf(suffix, sizeof(suffix), "|%lld|%lld.%09ld", (long long)st.st_size,
+             (long long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec);
+    return std::string(path) + suffix;
+  }
+  int64_t size;
+  if (source == nullptr || source->getSize(&size) != OK) {
+    return std::string();
+  }
+  std::vector<uint8_t> head(std::min<int64_t>(kHashBytes, size));
+  size_t done = 0;
+  while (done < head.size()) {
+    ssize_t n = source->readAt(done, head.data() + done, head.size() - done);
+    if (n <= 0) {
+      return std::string();
+    }
+    done += n;
+  }
+  snprintf(suffix, sizeof(suffix), "|%lld|%016" PRIx64, (long long)size,
+           fnv1a(head.data(), head.size()));
+  return std::string(url) + suffix;
+}
+
+std::string ProbeCache::pathFor(const std::string &key) const {
+  char name[32];
+  snprintf(name, sizeof(name), "%016" PRIx64 ".probe", fnv1a(key.data(), key.size()));
+  return mDirectory + "/" + name;
+}
+
+status_t ProbeCache::apply(const std::string &key, AVFormatContext *context) {
+  std::string data;
+  bool ok = readFile(pathFor(key), &data);
+  EntryReader reader(data);
+  ok = ok && reader.get<uint32_t>() == kEntryMagic && reader.get<uint32_t>() == kEntryVersion
+      && reader.getString() == key && reader.getString() == context->iformat->name;
+  const int64_t startTime = reader.get<int64_t>();
+  const int64_t duration = reader.get<int64_t>();
+  const int64_t bitRate = reader.get<int64_t>();
+  ok = ok && reader.get<uint32_t>() == context->nb_streams;
+
+  // All of it is read and checked against the streams before any is touched.
+  std::vector<StreamEntry> entries(ok ? context->nb_streams : 0);
+  for (unsigned i = 0; ok && i < entries.size(); ++i) {
+    const AVStream *stream = context->streams[i];
+    StreamEntry &entry = entries[i];
+    entry.par = avcodec_parameters_alloc();
+    entry.par->codec_type = (AVMediaType)reader.get<int32_t>();
+    entry.timeBase = getRational(&reader);
+    ok = getCodecParameters(&reader, entry.par)
+        && av_cmp_q(entry.timeBase, stream->time_base) == 0
+        && (stream->codecpar->codec_type == AVMEDIA_TYPE_UNKNOWN
+            || stream->codecpar->codec_type == entry.par->codec_type);
+    entry.startTime = reader.get<int64_t>();
+    entry.duration = reader.get<int64_t>();
+    entry.avgFrameRate = getRational(&reader);
+    entry.rFrameRate = getRational(&reader);
+    const uint32_t keyFrames = reader.get<uint32_t>();
+    for (uint32_t j = 0; ok && reader.ok() && j < keyFrames; ++j) {
+      const int64_t pos = reader.get<int64_t>();
+      entry.keyFrames.emplace_back(pos, reader.get<int64_t>());
+    }
+  }
+  if (!ok || !reader.ok()) {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    ++mStats.misses;
+    return NAME_NOT_FOUND;
+  }
+
+  context->start_time = startTime;
+  context->duration = duration;
+  context->bit_rate = bitRate;
+  for (unsigned i = 0; i < context->nb_streams; ++i) {
+    AVStream *stream = context->streams[i];
+    const StreamEntry &entry = entries[i];
+    if (avcodec_parameters_copy(stream->codecpar, entry.par) < 0) {
+      return NO_MEMORY;
+    }
+    stream->start_time = entry.startTime;
+    stream->duration = entry.duration;
+    stream->avg_frame_rate = entry.avgFrameRate;
+    stream->r_frame_rate = entry.rFrameRate;
+    // A container index, e.g. of MP4, is complete already.
+    if (stream->nb_index_entries == 0) {
+      for (const std::pair<int64_t, int64_t> &keyFrame : entry.keyFrames) {
+        av_add_index_entry(stream, keyFrame.first, keyFrame.second, 0, 0, AVINDEX_KEYFRAME);
+      }
+    }
+  }
+
+  std::lock_guard<std::mutex> autoLock(mLock);
+  ++mStats.hits;
+  return OK;
+}
+
+status_t ProbeCache::store(const std::string &key, const AVFormatContext *context) {
+  EntryWriter writer;
+  writer.put<uint32_t>(kEntryMagic);
+  writer.put<uint32_t>(kEntryVersion);
+  writer.putString(key);
+  writer.putString(context->iformat->name);
+  writer.put<int64_t>(context->start_time);
+  writer.put<int64_t>(context->duration);
+  writer.put<int64_t>(context->bit_rate);
+  writer.put<uint32_t>(context->nb_streams);
+  for (unsigned i = 0; i < context->nb_streams; ++i) {
+    const AVStream *stream = context->streams[i];
+    writer.put<int32_t>(stream->codecpar->codec_type);
+    putRational(&writer, stream->time_base);
+    putCodecParameters(&writer, stream->codecpar);
+    writer.put<int64_t>(stream->start_time);
+    writer.put<int64_t>(stream->duration);
+    putRational(&writer, stream->avg_frame_rate);
+    putRational(&writer, stream->r_frame_rate);
+    // Keyframes only, seeking needs nothing else.
+    std::vector<const AVIndexEntry *> keyFrames;
+    for (int j = 0; j < stream->nb_index_entries; ++j) {
+      if (stream->index_entries[j].flags & AVINDEX_KEYFRAME) {
+        keyFrames.push_back(&stream->index_entries[j]);
+      }
+    }
+    writer.put<uint32_t>(keyFrames.size());
+    for (const AVIndexEntry *entry : keyFrames) {
+      writer.put<int64_t>(entry->pos);
+      writer.put<int64_t>(entry->timestamp);
+    }
+  }
+
+  // Written aside and renamed, a reader never sees half an entry.
+  const std::string path = pathFor(key);
+  const std::string tmpPath = path + ".tmp";
+  int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    ALOGW("cannot create %s: %s", tmpPath.c_str(), strerror(errno));
+    return ERROR_IO;
+  }
+  const std::string &data = writer.data();
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t n = write(fd, data.data() + done, data.size() - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    done += n;
+  }
+  ::close(fd);
+  if (done < data.size() || rename(tmpPath.c_str(), path.c_str()) != 0) {
+    ALOGW("cannot write %s: %s", path.c_str(), strerror(errno));
+    unlink(tmpPath.c_str());
+    return ERROR_IO;
+  }
+  ALOGV("stored %zu bytes for %s", data.size(), key.c_str());
+
+  std::lock_guard<std::mutex> autoLock(mLock);
+  ++mStats.stores;
+  return OK;
+}
+
+ProbeCache::Stats ProbeCache::getStats() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  return mStats;
+}
+
+} // hpc
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+
+#include "Error.h"
+
+struct AVFormatContext;
+
+namespace hpc {
+
+class DataSource;
+
+// What avformat_find_stream_info() worked out about a file, kept on disk so
+// that preparing it again does not decode seconds of it once more: the
+// codec parameters and extradata of every stream, the durations and the
+// keyframes the demuxer had indexed. An entry is keyed by the url and the
+// file's size and mtime, or for a remote resource its size and a hash of
+// its first bytes, so a changed file misses instead of being misdescribed.
+//
+// An entry is only applied to a context that the same demuxer opened with
+// the same streams, types and time bases; anything else is probed as usual.
+// Safe to share between extractors.
+class ProbeCache {
+ public:
+  struct Stats {
+    int64_t hits {0};
+    int64_t misses {0};    // nothing stored, or stored for another layout
+    int64_t stores {0};
+  };
+
+  // Entries go to |directory|, created if missing.
+  explicit ProbeCache(const std::string &directory);
+
+  // The key of |url| read through |source|, nullptr if libavformat opens it
+  // itself. Empty if it cannot tell a changed resource from the same one,
+  // e.g. an https:// url left to FFmpeg.
+  static std::string KeyFor(const char *url, DataSource *source);
+
+  // Fills in the streams of |context|, opened but not probed, from the
+  // entry of |key|. NAME_NOT_FOUND if there is none that fits.
+  status_t apply(const std::string &key, AVFormatContext *context);
+
+  // Stores what |context| knows after probing, replacing an older entry.
+  status_t store(const std::string &key, const AVFormatContext *context);
+
+  Stats getStats() const;
+
+ private:
+  // Bytes of a remote resource its key hashes.
+  static const size_t kHashBytes = 16 * 1024;
+
+  const std::string mDirectory;
+  mutable std::mutex mLock;
+  Stats mStats;
+
+  std::string pathFor(const std::string &key) const;
+};
+
+} // hpc
@@ -0,0 +1,1253 @@
+#include "TsExtractor.h"
+#include "DataSource.h"
+#include "Log.h"
+#include "MediaPacket.h"
+#include "MetaData.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavutil/crc.h"
+#include "libavutil/mathematics.h"
+}
+
+#define LOG_TAG "TsExtractor"
+
+namespace hpc {
+
+static const uint8_t kSyncByte = 0x47;
+// PTS, DTS and the PCR base are 33 bit.
+static const int64_t kTimestampMask = (1LL << 33) - 1;
+// Allocated for the first PES of a stream, later ones take the last size.
+static const size_t kMinPesBytes = 4096;
+
+// |value| modulo 2^33 as the difference nearest to zero.
+static int64_t signExtend33(int64_t value) {
+  value &= kTimestampMask;
+  return value >= (1LL << 32) ? value - (1LL << 33) : value;
+}
+
+// A PTS or DTS in the 5 byte layout of the PES header.
+static int64_t readTimestamp(const uint8_t *p) {
+  return ((int64_t)((p[0] >> 1) & 0x07) << 30) | (p[1] << 22) | ((p[2] >> 1) << 15)
+      | (p[3] << 7) | (p[4] >> 1);
+}
+
+// The byte after the next 00 00 01 start code, |end| if there is none.
+static const uint8_t *findStartCode(const uint8_t *p, const uint8_t *end) {
+  for (; p + 3 <= end; ++p) {
+    if (p[2] > 1) {
+      p += 2;
+    } else if (p[0] == 0 && p[1] == 0 && p[2] == 1) {
+      return p + 3;
+    }
+  }
+  return end;
+}
+
+// Calls |visit| with each NAL unit of an Annex B payload and what follows
+// it, until it returns false. The end of a unit is not searched for, most
+// visits only look at its first bytes.
+template <typename Visit>
+static void forEachNal(const uint8_t *data, size_t size, Visit visit) {
+  const uint8_t *end = data + size;
+  for (const uint8_t *nal = findStartCode(data, end); nal < end;
+       nal = findStartCode(nal, end)) {
+    if (!visit(nal, (size_t)(end - nal))) {
+      return;
+    }
+  }
+}
+
+// Exp-Golomb reads over an RBSP. Reading past the end yields zeros and
+// fails the reader.
+class BitReader {
+ public:
+  BitReader(const uint8_t *data, size_t size) : mData(data), mBits(size * 8) {}
+
+  bool ok() const { return mPos <= mBits; }
+
+  uint32_t bit() {
+    if (mPos >= mBits) {
+      mPos = mBits + 1;
+      return 0;
+    }
+    const uint32_t value = (mData[mPos >> 3] >> (7 - (mPos & 7))) & 1;
+    ++mPos;
+    return value;
+  }
+
+  uint32_t bits(int count) {
+    uint32_t value = 0;
+    while (count-- > 0) {
+      value = (value << 1) | bit();
+    }
+    return value;
+  }
+
+  uint32_t ue() {
+    int zeros = 0;
+    while (bit() == 0 && ok() && zeros < 31) {
+      ++zeros;
+    }
+    return ((1u << zeros) - 1) + bits(zeros);
+  }
+
+  int32_t se() {
+    const uint32_t value = ue();
+    return (value & 1) ? (int32_t)((value + 1) / 2) : -(int32_t)(value / 2);
+  }
+
+ private:
+  const uint8_t *mData;
+  size_t mBits;
+  size_t mPos {0};
+};
+
+// The cropped picture size of an H.264 sequence parameter set, ITU-T H.264
+// 7.3.2.1.1.
+static bool parseH264Sps(const uint8_t *nal, size_t size, int *width, int *height) {
+  std::vector<uint8_t> rbsp;
+  rbsp.reserve(std::min<size_t>(size, 256));
+  int zeros = 0;
+  for (size_t i = 1; i < size && rbsp.size() < 256; ++i) {
+    if (zeros >= 2 && nal[i] == 3) {
+      zeros = 0;
+      continue;
+    }
+    rbsp.push_back(nal[i]);
+    zeros = nal[i] == 0 ? zeros + 1 : 0;
+  }
+  BitReader reader(rbsp.data(), rbsp.size());
+  const uint32_t profile = reader.bits(8);
+  reader.bits(16);  // constraint flags, level
+  reader.ue();      // seq_parameter_set_id
+  uint32_t chromaFormat = 1;
+  bool separateColourPlanes = false;
+  if (profile == 100 || profile == 110 || profile == 122 || profile == 244 || profile == 44
+      || profile == 83 || profile == 86 || profile == 118 || profile == 128 || profile == 138
+      || profile == 139 || profile == 134 || profile == 135) {
+    chromaFormat = reader.ue();
+    if (chromaFormat == 3) {
+      separateColourPlanes = reader.bit();
+    }
+    reader.ue();   // bit_depth_luma_minus8
+    reader.ue();   // bit_depth_chroma_minus8
+    reader.bit();  // qpprime_y_zero_transform_bypass_flag
+    if (reader.bit()) {
+      // scaling lists, skipped
+      for (int i = 0; i < (chromaFormat == 3 ? 12 : 8); ++i) {
+        if (!reader.bit()) {
+          continue;
+        }
+        int last = 8;
+        int next = 8;
+        for (int j = 0; j < (i < 6 ? 16 : 64) && next != 0 && reader.ok(); ++j) {
+          next = (last + reader.se() + 256) % 256;
+          last = next == 0 ? last : next;
+        }
+      }
+    }
+  }
+  reader.ue();  // log2_max_frame_num_minus4
+  const uint32_t pocType = reader.ue();
+  if (pocType == 0) {
+    reader.ue();
+  } else if (pocType == 1) {
+    reader.bit();
+    reader.se();
+    reader.se();
+    const uint32_t cycle = reader.ue();
+    for (uint32_t i = 0; i < cycle && i < 256; ++i) {
+      reader.se();
+    }
+  }
+  reader.ue();   // max_num_ref_frames
+  reader.bit();  // gaps_in_frame_num_value_allowed_flag
+  const uint32_t widthInMbs = reader.ue() + 1;
+  const uint32_t heightInMapUnits = reader.ue() + 1;
+  const uint32_t frameMbsOnly = reader.bit();
+  if (!frameMbsOnly) {
+    reader.bit();  // mb_adaptive_frame_field_flag
+  }
+  reader.bit();  // direct_8x8_inference_flag
+  uint32_t cropLeft = 0, cropRight = 0, cropTop = 0, cropBottom = 0;
+  if (reader.bit()) {
+    cropLeft = reader.ue();
+    cropRight = reader.ue();
+    cropTop = reader.ue();
+    cropBottom = reader.ue();
+  }
+  if (!reader.ok()) {
+    return false;
+  }
+  const bool subsampled = chromaFormat != 0 && !separateColourPlanes;
+  const uint32_t cropUnitX = subsampled && chromaFormat != 3 ? 2 : 1;
+  const uint32_t cropUnitY = (subsampled && chromaFormat == 1 ? 2 : 1) * (2 - frameMbsOnly);
+  *width = (int)(widthInMbs * 16) - (int)(cropUnitX * (cropLeft + cropRight));
+  *height = (int)((2 - frameMbsOnly) * heightInMapUnits * 16)
+      - (int)(cropUnitY * (cropTop + cropBottom));
+  return *width > 0 && *height > 0;
+}
+
+// What a PMT entry of |streamType| carries; |descriptorCodec| from a
+// descriptor for private data, AV_CODEC_ID_NONE if none said.
+static void describeStream(uint8_t streamType, AVCodecID descriptorCodec,
+                           media_track_type *type, AVCodecID *codecId, const char **mime) {
+  *type = MEDIA_TRACK_TYPE_UNKNOWN;
+  *codecId = AV_CODEC_ID_NONE;
+  *mime = nullptr;
+  switch (streamType) {
+    case 0x01:
+    case 0x02:
+      *type = MEDIA_TRACK_TYPE_VIDEO;
+      *codecId = AV_CODEC_ID_MPEG2VIDEO;
+      *mime = "video/mpeg2";
+      break;
+    case 0x10:
+      *type = MEDIA_TRACK_TYPE_VIDEO;
+      *codecId = AV_CODEC_ID_MPEG4;
+      *mime = "video/mp4v-es";
+      break;
+    case 0x1b:
+      *type = MEDIA_TRACK_TYPE_VIDEO;
+      *codecId = AV_CODEC_ID_H264;
+      *mime = "video/avc";
+      break;
+    case 0x24:
+      *type = MEDIA_TRACK_TYPE_VIDEO;
+      *codecId = AV_CODEC_ID_HEVC;
+      *mime = "video/hevc";
+      break;
+    case 0x03:
+    case 0x04:
+      *type = MEDIA_TRACK_TYPE_AUDIO;
+      *codecId = AV_CODEC_ID_MP3;
+      *mime = "audio/mpeg";
+      break;
+    case 0x0f:
+      *type = MEDIA_TRACK_TYPE_AUDIO;
+      *codecId = AV_CODEC_ID_AAC;
+      *mime = "audio/mp4a-latm";
+      break;
+    case 0x81:
+      descriptorCodec = AV_CODEC_ID_AC3;
+      break;
+    case 0x87:
+      descriptorCodec = AV_CODEC_ID_EAC3;
+      break;
+    default:
+      break;
+  }
+  // ATSC types and DVB private data with an AC-3 descriptor
+  if (*codecId == AV_CODEC_ID_NONE && descriptorCodec == AV_CODEC_ID_AC3) {
+    *type = MEDIA_TRACK_TYPE_AUDIO;
+    *codecId = AV_CODEC_ID_AC3;
+    *mime = "audio/ac3";
+  } else if (*codecId == AV_CODEC_ID_NONE && descriptorCodec == AV_CODEC_ID_EAC3) {
+    *type = MEDIA_TRACK_TYPE_AUDIO;
+    *codecId = AV_CODEC_ID_EAC3;
+    *mime = "audio/eac3";
+  }
+}
+
+TsExtractor::TsExtractor()
+    : mMetaData(std::make_shared<MetaData>()) {
+}
+
+TsExtractor::~TsExtractor() {
+  release();
+}
+
+// static
+size_t TsExtractor::FindSyncByte(const uint8_t *data, size_t size) {
+  size_t i = 0;
+#if defined(__ARM_NEON)
+  const uint8x16_t sync = vdupq_n_u8(kSyncByte);
+  for (; i + 16 <= size; i += 16) {
+    const uint8x16_t match = vceqq_u8(vld1q_u8(data + i), sync);
+    // four bits per byte, narrowed into one 64 bit lane
+    const uint64_t mask = vget_lane_u64(
+        vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0);
+    if (mask != 0) {
+      return i + (__builtin_ctzll(mask) >> 2);
+    }
+  }
+#elif defined(__SSE2__)
+  const __m128i sync = _mm_set1_epi8((char)kSyncByte);
+  for (; i + 16 <= size; i += 16) {
+    const __m128i bytes = _mm_loadu_si128((const __m128i *)(data + i));
+    const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, sync));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; i < size; ++i) {
+    if (data[i] == kSyncByte) {
+      return i;
+    }
+  }
+  return size;
+}
+
+// static
+bool TsExtractor::Sniff(DataSource *source) {
+  uint8_t data[4 * kTsPacketSize];
+  if (source == nullptr || source->readAt(0, data, sizeof(data)) != sizeof(data)) {
+    return false;
+  }
+  for (size_t i = FindSyncByte(data, kTsPacketSize); i < kTsPacketSize;
+       i += 1 + FindSyncByte(data + i + 1, kTsPacketSize - i - 1)) {
+    if (data[i + kTsPacketSize] == kSyncByte && data[i + 2 * kTsPacketSize] == kSyncByte) {
+      return true;
+    }
+  }
+  return false;
+}
+
+status_t TsExtractor::init(const char *url) {
+  ALOGD("init");
+  if (mDataSource == nullptr) {
+    return ERROR_UNSUPPORTED;
+  }
+  if (mDataSource->getSize(&mFileSize) != OK) {
+    mFileSize = -1;
+  }
+  mBuffer.resize(kBufferBytes);
+
+  status_t err = probe();
+  if (err != OK) {
+    ALOGW("cannot demux %s natively: %d", url, err);
+    release();
+    return err;
+  }
+  probeDuration();
+  if (mKeyframeIndex != nullptr) {
+    mIndexTrack = mVideoTrack >= 0 ? mVideoTrack : mAudioTrack;
+    char layout[64];
+    snprintf(layout, sizeof(layout), "ts|%d|us", mStreams[mIndexTrack].pid);
+    mKeyframeIndex->open(layout);
+    // probe() read from the start, none of its PES has gone out yet.
+    mIndexing = true;
+  }
+  mInitialized = true;
+  markStartup(StartupTimeline::kProbe);
+  ALOGD("init end, %zu streams, video %d, audio %d, duration %lld us", mStreams.size(),
+        mVideoTrack, mAudioTrack, (long long)mDurationUs);
+  return OK;
+}
+
+// Demuxes until the PMT is in and every stream it lists has given its
+// parameters. The PES read meanwhile stay in mReady.
+status_t TsExtractor::probe() {
+  bool opened = false;
+  for (;;) {
+    status_t err = demuxTsPacket();
+    if (err == ERROR_END_OF_STREAM) {
+      for (Stream &stream : mStreams) {
+        finishPes(&stream);
+      }
+      mEndOfStream = true;
+      break;
+    } else if (err != OK) {
+      return err;
+    }
+    if (mPmtVersion < 0) {
+      if (mBufferOffset + (int64_t)mPos > (int64_t)kMaxProbeBytes) {
+        break;
+      }
+      continue;
+    }
+    if (!opened) {
+      opened = true;
+      markStartup(StartupTimeline::kOpen);
+    }
+    bool probed = true;
+    for (const Stream &stream : mStreams) {
+      probed = probed && (!stream.selected || stream.probed);
+    }
+    if (probed || mBufferOffset + (int64_t)mPos > (int64_t)kMaxProbeBytes) {
+      break;
+    }
+  }
+  if (mPmtVersion < 0) {
+    ALOGE("no PMT");
+    return ERROR_UNSUPPORTED;
+  }
+
+  for (size_t i = 0; i < mStreams.size(); ++i) {
+    const Stream &stream = mStreams[i];
+    if (!stream.selected) {
+      continue;
+    }
+    if (stream.type == MEDIA_TRACK_TYPE_VIDEO && mVideoTrack < 0) {
+      mVideoTrack = (int)i;
+    } else if (stream.type == MEDIA_TRACK_TYPE_AUDIO && mAudioTrack < 0) {
+      mAudioTrack = (int)i;
+    }
+  }
+  if (mVideoTrack < 0 && (mRequiresVideo || mAudioTrack < 0)) {
+    ALOGE("no video stream");
+    return ERROR_UNSUPPORTED;
+  }
+  // Only the first video and audio stream are demuxed on. Streams that
+  // gave no parameters by now are left to the decoder.
+  for (size_t i = 0; i < mStreams.size(); ++i) {
+    mStreams[i].probed = true;
+    if ((int)i != mVideoTrack && (int)i != mAudioTrack) {
+      mStreams[i].selected = false;
+      dropPes(&mStreams[i]);
+    }
+  }
+  mReady.erase(std::remove_if(mReady.begin(), mReady.end(),
+                              [this](const std::unique_ptr<MediaPacket> &packet) {
+                                return !mStreams[packet->trackIndex].selected;
+                              }),
+               mReady.end());
+
+  if (mVideoTrack >= 0) {
+    const Stream &video = mStreams[mVideoTrack];
+    mMetaData->mime = video.mime;
+    mMetaData->width = video.width;
+    mMetaData->height = video.height;
+  }
+  if (mAudioTrack >= 0) {
+    const Stream &audio = mStreams[mAudioTrack];
+    mMetaData->sampleRate = audio.sampleRate;
+    mMetaData->channelCount = audio.channelCount;
+  }
+  return OK;
+}
+
+// The last PCR in the tail of a file of known size, less the first.
+void TsExtractor::probeDuration() {
+  if (mFileSize <= 0 || mPcrPid < 0 || mClockState == kClockNone) {
+    return;
+  }
+  const int64_t start = std::max(mDataOffset, mFileSize - (int64_t)kDurationProbeBytes);
+  std::vector<uint8_t> tail(mFileSize - start);
+  ssize_t n = mDataSource->readAt(start, tail.data(), tail.size());
+  if (n < (ssize_t)(3 * kTsPacketSize)) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    mStats.bytesRead += n;
+  }
+  int64_t lastPcr = -1;
+  for (size_t i = 0; i + kTsPacketSize <= (size_t)n; i += kTsPacketSize) {
+    if (tail[i] != kSyncByte) {
+      // in sync again where three packets in a row are
+      i += FindSyncByte(&tail[i], n - i);
+      while (i + 3 * kTsPacketSize <= (size_t)n && (tail[i + kTsPacketSize] != kSyncByte
+                                                   || tail[i + 2 * kTsPacketSize] != kSyncByte)) {
+        i += 1 + FindSyncByte(&tail[i + 1], n - i - 1);
+      }
+      if (i + 3 * kTsPacketSize > (size_t)n) {
+        break;
+      }
+    }
+    const uint8_t *ts = &tail[i];
+    const int pid = ((ts[1] & 0x1f) << 8) | ts[2];
+    if (pid == mPcrPid && (ts[3] & 0x20) && ts[4] >= 7 && (ts[5] & 0x10)) {
+      lastPcr = ((int64_t)ts[6] << 25) | (ts[7] << 17) | (ts[8] << 9) | (ts[9] << 1) | (ts[10] >> 7);
+    }
+  }
+  if (lastPcr >= 0) {
+    mDurationUs = av_rescale((lastPcr - mOriginRaw) & kTimestampMask, 1000000, 90000);
+  }
+}
+
+// Moves what is left of the buffer to its front and reads behind it.
+// ERROR_END_OF_STREAM once nothing more comes.
+status_t TsExtractor::fillBuffer() {
+  if (mPos > 0) {
+    memmove(mBuffer.data(), mBuffer.data() + mPos, mBufferSize - mPos);
+    mBufferOffset += mPos;
+    mBufferSize -= mPos;
+    mPos = 0;
+  }
+  if (mBufferSize == mBuffer.size()) {
+    return OK;
+  }
+  ssize_t n = mDataSource->readAt(mBufferOffset + mBufferSize, mBuffer.data() + mBufferSize,
+                                  mBuffer.size() - mBufferSize);
+  if (n < 0) {
+    return (status_t)n;
+  } else if (n == 0) {
+    return ERROR_END_OF_STREAM;
+  }
+  mBufferSize += n;
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mStats.bytesRead += n;
+  return OK;
+}
+
+// Drops bytes up to the next position where three packets in a row start
+// with the sync byte. The PES in progress lost data.
+status_t TsExtractor::resync() {
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    ++mStats.resyncs;
+  }
+  for (Stream &stream : mStreams) {
+    stream.pesCorrupt = stream.pes != nullptr;
+    stream.continuity = -1;
+  }
+  ++mPos;
+  for (;;) {
+    if (mBufferSize - mPos <= 2 * kTsPacketSize) {
+      status_t err = fillBuffer();
+      if (err != OK) {
+        return err;
+      }
+      continue;
+    }
+    const size_t end = mBufferSize - 2 * kTsPacketSize;
+    const size_t at = mPos + FindSyncByte(&mBuffer[mPos], end - mPos);
+    if (at == end) {
+      mPos = end;
+    } else if (mBuffer[at + kTsPacketSize] == kSyncByte
+               && mBuffer[at + 2 * kTsPacketSize] == kSyncByte) {
+      mPos = at;
+      return OK;
+    } else {
+      mPos = at + 1;
+    }
+  }
+}
+
+status_t TsExtractor::nextTsPacket(const uint8_t **ts) {
+  for (;;) {
+    while (mBufferSize - mPos < kTsPacketSize) {
+      status_t err = fillBuffer();
+      if (err != OK) {
+        return err;
+      }
+    }
+    // The next packet has to start with the sync byte too, where it is in
+    // the buffer already; a stray 0x47 would cost a packet otherwise.
+    if (mBuffer[mPos] == kSyncByte
+        && (mBufferSize - mPos <= kTsPacketSize || mBuffer[mPos + kTsPacketSize] == kSyncByte)) {
+      if (mDataOffset < 0) {
+        mDataOffset = mBufferOffset + mPos;
+      }
+      *ts = &mBuffer[mPos];
+      mPos += kTsPacketSize;
+      return OK;
+    }
+    status_t err = resync();
+    if (err != OK) {
+      return err;
+    }
+  }
+}
+
+status_t TsExtractor::demuxTsPacket() {
+  const uint8_t *ts;
+  status_t err = nextTsPacket(&ts);
+  if (err != OK) {
+    return err;
+  }
+  if (ts[1] & 0x80) {
+    return OK;  // transport_error_indicator
+  }
+  const bool unitStart = (ts[1] & 0x40) != 0;
+  const int pid = ((ts[1] & 0x1f) << 8) | ts[2];
+  const uint8_t control = (ts[3] >> 4) & 0x3;
+  size_t offset = 4;
+  bool randomAccess = false;
+  if (control & 0x2) {
+    const uint8_t length = ts[4];
+    if (length > kTsPacketSize - 5) {
+      return OK;
+    }
+    if (length > 0) {
+      const uint8_t flags = ts[5];
+      randomAccess = (flags & 0x40) != 0;
+      if ((flags & 0x10) && length >= 7 && pid == mPcrPid) {
+        const int64_t pcr = ((int64_t)ts[6] << 25) | (ts[7] << 17) | (ts[8] << 9)
+            | (ts[9] << 1) | (ts[10] >> 7);
+        onPcr(pcr, (flags & 0x80) != 0);
+      }
+    }
+    offset += 1 + length;
+  }
+  if (!(control & 0x1) || offset >= kTsPacketSize) {
+    return OK;
+  }
+  const uint8_t *payload = ts + offset;
+  const size_t size = kTsPacketSize - offset;
+
+  if (pid == 0) {
+    if (appendSection(&mPatSection, unitStart, payload, size)) {
+      parsePat(mPatSection);
+      mPatSection.clear();
+    }
+  } else if (pid == mPmtPid) {
+    if (appendSection(&mPmtSection, unitStart, payload, size)) {
+      parsePmt(mPmtSection);
+      mPmtSection.clear();
+    }
+  } else {
+    for (Stream &stream : mStreams) {
+      if (stream.pid == pid) {
+        if (stream.selected) {
+          onPesPayload(&stream, unitStart, randomAccess, ts[3] & 0x0f, payload, size);
+        }
+        break;
+      }
+    }
+  }
+  return OK;
+}
+
+void TsExtractor::seedClock(int64_t raw, int64_t base) {
+  mClockRaw = raw;
+  mClockBase = base;
+}
+
+int64_t TsExtractor::unwrap(int64_t raw, int64_t clockBase, int64_t clockRaw) const {
+  return clockBase + signExtend33(raw - clockRaw);
+}
+
+int64_t TsExtractor::ticksToUs(int64_t ticks) const {
+  return av_rescale(ticks - mOrigin, 1000000, 90000);
+}
+
+void TsExtractor::onPcr(int64_t pcr, bool discontinuity) {
+  switch (mClockState) {
+    case kClockNone:
+      mOrigin = pcr;
+      mOriginRaw = pcr;
+      seedClock(pcr, pcr);
+      mClockState = kClockPcr;
+      return;
+    case kClockPts:
+      seedClock(pcr, unwrap(pcr, mClockBase, mClockRaw));
+      mClockState = kClockPcr;
+      return;
+    case kClockPcr:
+      break;
+  }
+  const int64_t delta = signExtend33(pcr - mClockRaw);
+  if (discontinuity || delta < 0 || delta > kMaxPcrGapTicks) {
+    // The new PCR comes a PCR interval after the last one, the timestamps
+    // that follow carry on from there.
+    ALOGI("PCR discontinuity of %lld ticks", (long long)delta);
+    seedClock(pcr, mClockBase + mPcrInterval);
+    for (Stream &stream : mStreams) {
+      stream.discontinuity = true;
+    }
+    std::lock_guard<std::mutex> autoLock(mLock);
+    ++mStats.discontinuities;
+    return;
+  }
+  seedClock(pcr, mClockBase + delta);
+  mPcrInterval = delta;
+}
+
+// Collects a PSI section over the packets of its PID, true once complete.
+bool TsExtractor::appendSection(std::vector<uint8_t> *section, bool unitStart,
+                                const uint8_t *data, size_t size) {
+  if (unitStart) {
+    const size_t pointer = data[0];
+    if (1 + pointer >= size) {
+      section->clear();
+      return false;
+    }
+    section->assign(data + 1 + pointer, data + size);
+  } else if (section->empty()) {
+    return false;
+  } else {
+    section->insert(section->end(), data, data + size);
+  }
+  if (section->size() < 3) {
+    return false;
+  }
+  const size_t length = 3 + ((((*section)[1] & 0x0f) << 8) | (*section)[2]);
+  if (section->size() < length) {
+    return false;
+  }
+  section->resize(length);
+  return true;
+}
+
+static bool checkSection(const std::vector<uint8_t> &section, uint8_t tableId) {
+  return section.size() >= 16 && section[0] == tableId
+      && av_crc(av_crc_get_table(AV_CRC_32_IEEE), UINT32_MAX,
+                section.data(), section.size()) == 0;
+}
+
+void TsExtractor::parsePat(const std::vector<uint8_t> &section) {
+  if (!checkSection(section, 0x00)) {
+    return;
+  }
+  // the first program, 0 is the network PID
+  for (size_t i = 8; i + 4 <= section.size() - 4; i += 4) {
+    const int program = (section[i] << 8) | section[i + 1];
+    const int pid = ((section[i + 2] & 0x1f) << 8) | section[i + 3];
+    if (program != 0) {
+      if (pid != mPmtPid) {
+        mPmtPid = pid;
+        mPmtSection.clear();
+      }
+      return;
+    }
+  }
+}
+
+void TsExtractor::parsePmt(const std::vector<uint8_t> &section) {
+  if (!checkSection(section, 0x02)) {
+    return;
+  }
+  const int version = (section[5] >> 1) & 0x1f;
+  if (version == mPmtVersion) {
+    return;
+  } else if (mPmtVersion >= 0) {
+    // the tracks are the ones the player was prepared with
+    ALOGW("PMT version %d ignored", version);
+    mPmtVersion = version;
+    return;
+  }
+  mPmtVersion = version;
+  mPcrPid = ((section[8] & 0x1f) << 8) | section[9];
+  const size_t end = section.size() - 4;
+  size_t i = 12 + (((section[10] & 0x0f) << 8) | section[11]);
+  while (i + 5 <= end) {
+    Stream stream;
+    stream.streamType = section[i];
+    stream.pid = ((section[i + 1] & 0x1f) << 8) | section[i + 2];
+    const size_t infoEnd = i + 5 + (((section[i + 3] & 0x0f) << 8) | section[i + 4]);
+    if (infoEnd > end) {
+      break;
+    }
+    AVCodecID descriptorCodec = AV_CODEC_ID_NONE;
+    for (size_t j = i + 5; j + 2 <= infoEnd; j += 2 + section[j + 1]) {
+      const uint8_t tag = section[j];
+      const uint8_t length = section[j + 1];
+      if (j + 2 + length > infoEnd) {
+        break;
+      }
+      const uint8_t *body = &section[j + 2];
+      if (tag == 0x0a && length >= 3) {  // ISO 639 language
+        stream.language.assign((const char *)body, 3);
+      } else if (tag == 0x6a) {          // DVB AC-3
+        descriptorCodec = AV_CODEC_ID_AC3;
+      } else if (tag == 0x7a) {          // DVB enhanced AC-3
+        descriptorCodec = AV_CODEC_ID_EAC3;
+      } else if (tag == 0x05 && length >= 4) {  // registration
+        if (memcmp(body, "AC-3", 4) == 0) {
+          descriptorCodec = AV_CODEC_ID_AC3;
+        } else if (memcmp(body, "EAC3", 4) == 0) {
+          descriptorCodec = AV_CODEC_ID_EAC3;
+        }
+      }
+    }
+    i = infoEnd;
+
+    AVCodecID codecId;
+    const char *mime;
+    describeStream(stream.streamType, descriptorCodec, &stream.type, &codecId, &mime);
+    stream.codecId = codecId;
+    if (mime != nullptr) {
+      stream.mime = mime;
+      // every stream is demuxed while probing
+      stream.selected = true;
+    }
+    if (stream.language.empty()) {
+      stream.language = "und";
+    }
+    mStreams.push_back(std::move(stream));
+  }
+}
+
+void TsExtractor::onPesPayload(Stream *stream, bool unitStart, bool randomAccess,
+                               uint8_t continuity, const uint8_t *data, size_t size) {
+  if (stream->continuity >= 0) {
+    if (continuity == stream->continuity) {
+      return;  // a duplicate packet
+    } else if (continuity != ((stream->continuity + 1) & 0x0f)) {
+      stream->pesCorrupt = stream->pes != nullptr;
+      std::lock_guard<std::mutex> autoLock(mLock);
+      ++mStats.continuityErrors;
+    }
+  }
+  stream->continuity = continuity;
+
+  if (unitStart) {
+    finishPes(stream);
+    if (av_buffer_realloc(&stream->pes, std::max(stream->sizeHint, kMinPesBytes)
+                                        + AV_INPUT_BUFFER_PADDING_SIZE) < 0) {
+      dropPes(stream);
+      return;
+    }
+    stream->pesSize = 0;
+    stream->pesExpected = 0;
+    stream->pesRandomAccess = randomAccess;
+    stream->pesCorrupt = false;
+    stream->pesDiscontinuity = stream->discontinuity;
+    stream->discontinuity = false;
+    // the packet nextTsPacket() just passed
+    stream->pesOffset = mBufferOffset + mPos - kTsPacketSize;
+    stream->pesClockValid = mClockState != kClockNone;
+    stream->pesClockBase = mClockBase;
+    stream->pesClockRaw = mClockRaw;
+  } else if (stream->pes == nullptr) {
+    return;  // joined in the middle of a PES
+  }
+
+  const size_t needed = stream->pesSize + size + AV_INPUT_BUFFER_PADDING_SIZE;
+  if ((size_t)stream->pes->size < needed
+      && av_buffer_realloc(&stream->pes, std::max(needed, 2 * (size_t)stream->pes->size)) < 0) {
+    dropPes(stream);
+    return;
+  }
+  memcpy(stream->pes->data + stream->pesSize, data, size);
+  const size_t before = stream->pesSize;
+  stream->pesSize += size;
+  if (before < 6 && stream->pesSize >= 6) {
+    const size_t length = (stream->pes->data[4] << 8) | stream->pes->data[5];
+    stream->pesExpected = length > 0 ? 6 + length : 0;
+  }
+  // Audio PES say how long they are and go out as soon as they are in,
+  // video ones mostly end where the next starts.
+  if (stream->pesExpected > 0 && stream->pesSize >= stream->pesExpected) {
+    finishPes(stream);
+  }
+}
+
+void TsExtractor::dropPes(Stream *stream) {
+  av_buffer_unref(&stream->pes);
+  stream->pesSize = 0;
+  stream->pesExpected = 0;
+}
+
+// Hands the PES over to a packet of its own, payload and buffer as they
+// are.
+void TsExtractor::finishPes(Stream *stream) {
+  if (stream->pes == nullptr) {
+    return;
+  }
+  uint8_t *pes = stream->pes->data;
+  size_t size = stream->pesSize;
+  if (stream->pesExpected > 0) {
+    stream->pesCorrupt = stream->pesCorrupt || size < stream->pesExpected;
+    size = std::min(size, stream->pesExpected);
+  }
+  if (size < 9 || pes[0] != 0 || pes[1] != 0 || pes[2] != 1) {
+    dropPes(stream);
+    return;
+  }
+  const size_t headerSize = 9 + pes[8];
+  if (headerSize >= size) {
+    dropPes(stream);
+    return;
+  }
+  const uint8_t ptsDtsFlags = pes[7] >> 6;
+  const int64_t pts = (ptsDtsFlags & 0x2) && headerSize >= 14 ? readTimestamp(pes + 9) : -1;
+  const int64_t dts = ptsDtsFlags == 0x3 && headerSize >= 19 ? readTimestamp(pes + 14) : pts;
+  uint8_t *payload = pes + headerSize;
+  const size_t payloadSize = size - headerSize;
+  memset(payload + payloadSize, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+  stream->sizeHint = stream->pesSize;
+
+  if (!stream->probed) {
+    probeParameters(stream, payload, payloadSize);
+  }
+  const int index = (int)(stream - mStreams.data());
+  const bool key = stream->type != MEDIA_TRACK_TYPE_VIDEO || stream->pesRandomAccess
+      || isKeyFrame(*stream, payload, payloadSize);
+  if (mWaitForKeyFrame) {
+    // after a seek, nothing goes out before a video key frame.
+    if (index != mVideoTrack || !key) {
+      dropPes(stream);
+      return;
+    }
+    mWaitForKeyFrame = false;
+  }
+
+  if (mClockState == kClockNone && pts >= 0) {
+    // no PCR yet, the first PTS is zero.
+    mOrigin = pts;
+    mOriginRaw = pts;
+    seedClock(pts, pts);
+    mClockState = kClockPts;
+  }
+  if (!stream->pesClockValid) {
+    stream->pesClockBase = mClockBase;
+    stream->pesClockRaw = mClockRaw;
+  }
+  if (mSeekAnchorUs >= 0 && index == mIndexTrack && key && pts >= 0) {
+    // The index says when this key frame is. The clock was seeded for it
+    // assuming no discontinuity on the way, whatever it is off by goes.
+    const int64_t shift = av_rescale(
+        mSeekAnchorUs - ticksToUs(unwrap(pts, stream->pesClockBase, stream->pesClockRaw)),
+        90000, 1000000);
+    mClockBase += shift;
+    for (Stream &other : mStreams) {
+      other.pesClockBase += shift;
+    }
+    mSeekAnchorUs = -1;
+  }
+
+  std::unique_ptr<MediaPacket> packet = std::make_unique<MediaPacket>();
+  packet->setPayload(stream->pes, payload, (int)payloadSize);
+  stream->pes = nullptr;
+  stream->pesSize = 0;
+  stream->pesExpected = 0;
+  packet->trackIndex = index;
+  packet->ptsUs = pts < 0
+      ? -1 : ticksToUs(unwrap(pts, stream->pesClockBase, stream->pesClockRaw));
+  packet->dtsUs = dts < 0
+      ? -1 : ticksToUs(unwrap(dts, stream->pesClockBase, stream->pesClockRaw));
+  packet->discontinuity = stream->pesDiscontinuity;
+  AVPacket *avPacket = packet->avPacket();
+  avPacket->stream_index = index;
+  avPacket->pos = stream->pesOffset;
+  avPacket->pts = packet->ptsUs < 0 ? AV_NOPTS_VALUE : packet->ptsUs;
+  avPacket->dts = packet->dtsUs < 0 ? AV_NOPTS_VALUE : packet->dtsUs;
+  avPacket->flags = (key ? AV_PKT_FLAG_KEY : 0) | (stream->pesCorrupt ? AV_PKT_FLAG_CORRUPT : 0);
+  mReady.push_back(std::move(packet));
+
+  std::lock_guard<std::mutex> autoLock(mLock);
+  ++mStats.pesPackets;
+}
+
+// Picture size out of the SPS, sample rate and channels out of the frame
+// header, what avformat_find_stream_info() decodes for.
+void TsExtractor::probeParameters(Stream *stream, const uint8_t *data, size_t size) {
+  switch (stream->codecId) {
+    case AV_CODEC_ID_H264:
+      forEachNal(data, size, [stream](const uint8_t *nal, size_t nalSize) {
+        if ((nal[0] & 0x1f) == 7) {
+          stream->probed = parseH264Sps(nal, nalSize, &stream->width, &stream->height);
+          return false;
+        }
+        return true;
+      });
+      break;
+    case AV_CODEC_ID_AAC:
+      // ADTS
+      if (size >= 7 && data[0] == 0xff && (data[1] & 0xf0) == 0xf0) {
+        static const int kRates[] = {96000, 88200, 64000, 48000, 44100, 32000, 24000,
+                                     22050, 16000, 12000, 11025, 8000, 7350};
+        const int rateIndex = (data[2] >> 2) & 0x0f;
+        stream->sampleRate = rateIndex < 13 ? kRates[rateIndex] : 0;
+        stream->channelCount = ((data[2] & 0x1) << 2) | (data[3] >> 6);
+        stream->probed = true;
+      }
+      break;
+    case AV_CODEC_ID_MP3:
+      if (size >= 4 && data[0] == 0xff && (data[1] & 0xe0) == 0xe0) {
+        static const int kRates[4][3] = {{11025, 12000, 8000}, {0, 0, 0},
+                                         {22050, 24000, 16000}, {44100, 48000, 32000}};
+        const int version = (data[1] >> 3) & 0x3;
+        const int rateIndex = (data[2] >> 2) & 0x3;
+        stream->sampleRate = rateIndex < 3 ? kRates[version][rateIndex] : 0;
+        stream->channelCount = (data[3] >> 6) == 3 ? 1 : 2;
+        stream->probed = true;
+      }
+      break;
+    case AV_CODEC_ID_AC3:
+      if (size >= 7 && data[0] == 0x0b && data[1] == 0x77) {
+        static const int kRates[] = {48000, 44100, 32000, 0};
+        static const int kChannels[] = {2, 1, 2, 3, 3, 4, 4, 5};
+        stream->sampleRate = kRates[data[4] >> 6];
+        stream->channelCount = kChannels[data[6] >> 5];
+        stream->probed = true;
+      }
+      break;
+    default:
+      // the decoder finds out
+      stream->probed = true;
+      break;
+  }
+}
+
+// A PES starting an IDR or IRAP picture, a GOP or an I-VOP.
+bool TsExtractor::isKeyFrame(const Stream &stream, const uint8_t *data, size_t size) const {
+  bool key = false;
+  switch (stream.codecId) {
+    case AV_CODEC_ID_H264:
+      forEachNal(data, size, [&key](const uint8_t *nal, size_t) {
+        const uint8_t type = nal[0] & 0x1f;
+        key = type == 5;
+        return type < 1 || type > 5;  // up to the first slice
+      });
+      break;
+    case AV_CODEC_ID_HEVC:
+      forEachNal(data, size, [&key](const uint8_t *nal, size_t) {
+        const uint8_t type = (nal[0] >> 1) & 0x3f;
+        key = type >= 16 && type <= 21;
+        return type > 21;
+      });
+      break;
+    case AV_CODEC_ID_MPEG2VIDEO:
+      forEachNal(data, size, [&key](const uint8_t *code, size_t) {
+        key = code[0] == 0xb3 || code[0] == 0xb8;  // sequence or GOP header
+        return !key && code[0] != 0x00;            // up to the first picture
+      });
+      break;
+    case AV_CODEC_ID_MPEG4:
+      forEachNal(data, size, [&key](const uint8_t *code, size_t codeSize) {
+        if (code[0] == 0xb6) {
+          key = codeSize > 1 && (code[1] >> 6) == 0;  // vop_coding_type I
+          return false;
+        }
+        return true;
+      });
+      break;
+    default:
+      break;
+  }
+  return key;
+}
+
+int TsExtractor::read(std::unique_ptr<MediaPacket> &packet, int index) {
+  if (!mInitialized) {
+    return NO_INIT;
+  } else if (index >= (int)mStreams.size()) {
+    return ERROR_OUT_OF_RANGE;
+  }
+  for (;;) {
+    for (auto it = mReady.begin(); it != mReady.end(); ++it) {
+      if (index < 0 || (*it)->trackIndex == index) {
+        packet = std::move(*it);
+        mReady.erase(it);
+        if (packet->trackIndex == mVideoTrack) {
+          markStartup(StartupTimeline::kFirstPacket);
+        }
+        if (mIndexing && packet->trackIndex == mIndexTrack && packet->isKeyFrame()
+            && packet->ptsUs >= 0) {
+          mKeyframeIndex->add(packet->ptsUs, packet->avPacket()->pos);
+        }
+        return OK;
+      }
+    }
+    if (mEndOfStream) {
+      if (mIndexing) {
+        mKeyframeIndex->setComplete();
+      }
+      return ERROR_END_OF_STREAM;
+    }
+    status_t err = demuxTsPacket();
+    if (err == ERROR_END_OF_STREAM) {
+      // the last PES of each stream ends with the stream
+      for (Stream &stream : mStreams) {
+        finishPes(&stream);
+      }
+      mEndOfStream = true;
+    } else if (err != OK) {
+      return err;
+    }
+  }
+}
+
+void TsExtractor::resetDemux(int64_t offset) {
+  mBufferOffset = offset;
+  mBufferSize = 0;
+  mPos = 0;
+  mEndOfStream = false;
+  mReady.clear();
+  mPatSection.clear();
+  mPmtSection.clear();
+  for (Stream &stream : mStreams) {
+    dropPes(&stream);
+    stream.continuity = -1;
+    stream.discontinuity = false;
+  }
+}
+
+status_t TsExtractor::seek(int64_t position, SeekMode mode) {
+  if (!mInitialized) {
+    return NO_INIT;
+  }
+  KeyframeIndex::Entry entry;
+  if (mKeyframeIndex != nullptr && mode != SEEK_NEXT_SYNC
+      && mKeyframeIndex->find(position, &entry) == OK) {
+    resetDemux(entry.offset);
+    const int64_t ticks = av_rescale(entry.timestamp, 90000, 1000000);
+    seedClock((mOriginRaw + ticks) & kTimestampMask, mOrigin + ticks);
+    mClockState = kClockPts;
+    mSeekAnchorUs = entry.timestamp;
+    mWaitForKeyFrame = mVideoTrack >= 0;
+    mIndexing = true;
+    return OK;
+  }
+  mSeekAnchorUs = -1;
+  mIndexing = false;
+  if (mDurationUs <= 0 || mFileSize <= mDataOffset) {
+    return ERROR_UNSUPPORTED;
+  }
+  // A constant bitrate is assumed, the key frame after the estimate starts.
+  int64_t targetUs = mode == SEEK_NEXT_SYNC ? position : position - kSeekPrerollUs;
+  targetUs = std::min(std::max<int64_t>(targetUs, 0), mDurationUs);
+  int64_t offset = mDataOffset + av_rescale(targetUs, mFileSize - mDataOffset, mDurationUs);
+  offset -= (offset - mDataOffset) % kTsPacketSize;
+  resetDemux(offset);
+
+  // Timestamps around |offset| unwrap to near the estimate.
+  const int64_t ticks = av_rescale(targetUs, 90000, 1000000);
+  seedClock((mOriginRaw + ticks) & kTimestampMask, mOrigin + ticks);
+  mClockState = kClockPts;
+  mWaitForKeyFrame = mVideoTrack >= 0;
+  return OK;
+}
+
+void TsExtractor::flush() {
+  // what is dropped is not indexed
+  mIndexing = false;
+  mReady.clear();
+  for (Stream &stream : mStreams) {
+    dropPes(&stream);
+    stream.continuity = -1;
+  }
+}
+
+void TsExtractor::getMetaData(MetaData &meta) {
+  meta = *mMetaData;
+}
+
+void TsExtractor::release() {
+  if (mKeyframeIndex != nullptr) {
+    mKeyframeIndex->store();
+  }
+  mIndexTrack = -1;
+  mSeekAnchorUs = -1;
+  flush();
+  mStreams.clear();
+  mBuffer.clear();
+  mBuffer.shrink_to_fit();
+  mBufferOffset = 0;
+  mBufferSize = 0;
+  mPos = 0;
+  mPmtPid = -1;
+  mPcrPid = -1;
+  mPmtVersion = -1;
+  mVideoTrack = -1;
+  mAudioTrack = -1;
+  mClockState = kClockNone;
+  mInitialized = false;
+}
+
+size_t TsExtractor::getTrackCount() const {
+  return mStreams.size();
+}
+
+status_t TsExtractor::getTrackInfo(size_t index, TrackInfo *info) const {
+  if (index >= mStreams.size()) {
+    return ERROR_OUT_OF_RANGE;
+  }
+  const Stream &stream = mStreams[index];
+  info->type = stream.type;
+  info->mime_type = stream.mime;
+  info->width = stream.width;
+  info->height = stream.height;
+  info->sample_rate = stream.sampleRate;
+  info->channel_count = stream.channelCount;
+  info->language = stream.language;
+  return OK;
+}
+
+status_t TsExtractor::selectTrack(size_t index, bool select) {
+  if (index >= mStreams.size()) {
+    return ERROR_OUT_OF_RANGE;
+  }
+  Stream &stream = mStreams[index];
+  int *selected;
+  if (stream.type == MEDIA_TRACK_TYPE_VIDEO) {
+    selected = &mVideoTrack;
+  } else if (stream.type == MEDIA_TRACK_TYPE_AUDIO) {
+    selected = &mAudioTrack;
+  } else {
+    return ERROR_UNSUPPORTED;
+  }
+  if (stream.mime.empty()) {
+    return ERROR_UNSUPPORTED;
+  }
+
+  auto deselect = [this](int i) {
+    mStreams[i].selected = false;
+    dropPes(&mStreams[i]);
+    mReady.erase(std::remove_if(mReady.begin(), mReady.end(),
+                                [i](const std::unique_ptr<MediaPacket> &packet) {
+                                  return packet->trackIndex == i;
+                                }),
+                 mReady.end());
+  };
+  if (!select) {
+    if (*selected == (int)index) {
+      *selected = -1;
+    }
+    deselect((int)index);
+    return OK;
+  }
+  if (*selected >= 0 && *selected != (int)index) {
+    deselect(*selected);
+  }
+  *selected = (int)index;
+  if (!stream.selected) {
+    // joins at the next PES
+    stream.selected = true;
+    stream.continuity = -1;
+  }
+  if (selected == &mAudioTrack) {
+    mMetaData->sampleRate = stream.sampleRate;
+    mMetaData->channelCount = stream.channelCount;
+  }
+  return OK;
+}
+
+status_t TsExtractor::getCodecParameters(size_t index, AVCodecParameters *params) const {
+  if (index >= mStreams.size()) {
+    return ERROR_OUT_OF_RANGE;
+  }
+  const Stream &stream = mStreams[index];
+  params->codec_type = stream.type == MEDIA_TRACK_TYPE_VIDEO ? AVMEDIA_TYPE_VIDEO
+      : stream.type == MEDIA_TRACK_TYPE_AUDIO ? AVMEDIA_TYPE_AUDIO : AVMEDIA_TYPE_UNKNOWN;
+  params->codec_id = (AVCodecID)stream.codecId;
+  params->width = stream.width;
+  params->height = stream.height;
+  params->sample_rate = stream.sampleRate;
+  params->channels = stream.channelCount;
+  return OK;
+}
+
+void TsExtractor::setDataSource(const std::shared_ptr<DataSource> &source) {
+  mDataSource = source;
+}
+
+void TsExtractor::setRequiresVideo(bool requiresVideo) {
+  mRequiresVideo = requiresVideo;
+}
+
+void TsExtractor::setKeyframeIndex(const std::shared_ptr<KeyframeIndex> &index) {
+  mKeyframeIndex = index;
+}
+
+void TsExtractor::setStartupTimeline(const std::shared_ptr<StartupTimeline> &timeline) {
+  mStartupTimeline = timeline;
+}
+
+void TsExtractor::markStartup(StartupTimeline::Event event) {
+  if (mStartupTimeline != nullptr) {
+    mStartupTimeline->mark(event);
+  }
+}
+
+TsExtractor::Stats TsExtractor::getStats() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  return mStats;
+}
+
+} // hpc
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Extractor.h"
+#include "KeyframeIndex.h"
+#include "StartupTimeline.h"
+
+struct AVBufferRef;
+struct AVCodecParameters;
+
+namespace hpc {
+
+class DataSource;
+class MetaData;
+
+// Demuxes an MPEG-2 transport stream, one program of it, without
+// libavformat. init() only reads until the PMT and the first PES of each
+// elementary stream are in, the codec parameters come out of those, where
+// avformat_find_stream_info() would decode seconds of it; the PES read
+// while probing are returned by read() first.
+//
+// Transport packets are read a buffer at a time and parsed in place. The
+// sync byte is searched for with SIMD, a position counts as in sync when
+// three packets in a row start with it. A PES is assembled straight into
+// the reference-counted buffer its packet then holds.
+//
+// Timestamps are unwrapped and start at zero, at the first PCR. A PCR that
+// jumps backwards or further than kMaxPcrGapTicks ahead, or one marked
+// discontinuous, is a discontinuity: the clock is rebased so timestamps
+// carry on from where they were, and the first packet of every track after
+// it has MediaPacket::discontinuity set.
+//
+// Without an index, seek() goes to a byte offset estimated from the
+// duration and returns from the next video key frame on; streams of
+// unknown size cannot seek. With a KeyframeIndex it goes to the PES of the
+// key frame at or before the position, and the clock is set from the
+// index, discontinuities before it included.
+class TsExtractor : public Extractor {
+ public:
+  struct Stats {
+    int64_t bytesRead {0};
+    int64_t pesPackets {0};
+    int64_t resyncs {0};            // sync lost and searched for
+    int64_t continuityErrors {0};   // packets missing from a PID
+    int64_t discontinuities {0};    // PCR jumps
+  };
+
+  static const size_t kTsPacketSize = 188;
+
+  TsExtractor();
+  ~TsExtractor() override;
+
+  // True if three packets in a row start with the sync byte within the
+  // first packet's length of |source|.
+  static bool Sniff(DataSource *source);
+
+  // Offset of the first 0x47 in |data|, |size| if there is none.
+  static size_t FindSyncByte(const uint8_t *data, size_t size);
+
+  status_t init(const char *url) override;
+  int read(std::unique_ptr<MediaPacket> &packet, int index) override;
+  status_t seek(int64_t position, SeekMode mode = SEEK_PREVIOUS_SYNC) override;
+  void flush() override;
+  void getMetaData(MetaData &meta) override;
+  void release() override;
+
+  size_t getTrackCount() const override;
+  status_t getTrackInfo(size_t index, TrackInfo *info) const override;
+  // Streams not selected are skipped without assembling their PES.
+  status_t selectTrack(size_t index, bool select) override;
+
+  int getVideoStreamIndex() const override { return mVideoTrack; }
+  int getAudioStreamIndex() const override { return mAudioTrack; }
+
+  // Last PCR less first, 0 for a stream of unknown size.
+  int64_t getDurationUs() const override { return mDurationUs; }
+
+  // Codec id, dimensions or sample rate and channels as probed. Parameter
+  // sets travel in band, there is no extradata. Packet timestamps are in
+  // microseconds.
+  status_t getCodecParameters(size_t index, AVCodecParameters *params) const override;
+
+  // Reads through |source|, which init() needs. Set before init().
+  void setDataSource(const std::shared_ptr<DataSource> &source);
+
+  // Lets init() take a stream without video. Set before init().
+  void setRequiresVideo(bool requiresVideo);
+
+  // Seeks with |index|, and adds the key frames of the video track, or the
+  // audio one of a stream without video, as it reads through. Stored at
+  // release(). Set before init().
+  void setKeyframeIndex(const std::shared_ptr<KeyframeIndex> &index);
+  std::shared_ptr<KeyframeIndex> getKeyframeIndex() const { return mKeyframeIndex; }
+
+  // Marks open, probe and first video packet on |timeline|. Set before init().
+  void setStartupTimeline(const std::shared_ptr<StartupTimeline> &timeline);
+
+  Stats getStats() const;
+
+ private:
+  struct Stream {
+    uint16_t pid {0};
+    uint8_t streamType {0};
+    media_track_type type {MEDIA_TRACK_TYPE_UNKNOWN};
+    std::string mime;
+    int codecId {0};           // AVCodecID
+    std::string language;
+    int width {0};
+    int height {0};
+    int sampleRate {0};
+    int channelCount {0};
+    bool probed {false};       // parameters taken from a PES
+    bool selected {false};
+    int continuity {-1};       // last continuity_counter
+
+    // The PES being assembled, header included, and how long it is if its
+    // header says.
+    AVBufferRef *pes {nullptr};
+    size_t pesSize {0};
+    size_t pesExpected {0};
+    size_t sizeHint {0};       // of the last one, to allocate the next
+    bool pesRandomAccess {false};
+    bool pesCorrupt {false};
+    bool pesDiscontinuity {false};
+    int64_t pesOffset {0};     // of its first transport packet
+    // the clock when the PES started, see unwrap()
+    bool pesClockValid {false};
+    int64_t pesClockBase {0};
+    int64_t pesClockRaw {0};
+
+    bool discontinuity {false};  // for the next PES
+  };
+
+  enum ClockState {
+    kClockNone,  // no timestamp seen yet
+    kClockPts,   // seeded from a PTS or a seek, the next PCR re-anchors it
+    kClockPcr,   // follows the PCR
+  };
+
+  // Transport packets read at once.
+  static const size_t kBufferBytes = 512 * kTsPacketSize;
+  // Longest init() reads for the PMT and the parameters of every stream.
+  static const size_t kMaxProbeBytes = 4 * 1024 * 1024;
+  // Tail of a file searched for the last PCR.
+  static const size_t kDurationProbeBytes = 1024 * 1024;
+  // PCRs come at most 100ms apart, a second between two is a jump.
+  static const int64_t kMaxPcrGapTicks = 90000;
+  // Read before the seek position, for a key frame to come by.
+  static const int64_t kSeekPrerollUs = 1000000;
+
+  std::shared_ptr<DataSource> mDataSource;
+  int64_t mFileSize {-1};
+  std::shared_ptr<StartupTimeline> mStartupTimeline;
+  std::shared_ptr<MetaData> mMetaData;
+  bool mRequiresVideo {true};
+  bool mInitialized {false};
+
+  // Transport packets at [mBufferOffset, mBufferOffset + mBufferSize),
+  // mPos is the next one.
+  std::vector<uint8_t> mBuffer;
+  int64_t mBufferOffset {0};
+  size_t mBufferSize {0};
+  size_t mPos {0};
+  bool mEndOfStream {false};
+  int64_t mDataOffset {-1};  // of the first packet in sync
+
+  // PSI sections being assembled
+  std::vector<uint8_t> mPatSection;
+  std::vector<uint8_t> mPmtSection;
+  int mPmtPid {-1};
+  int mPcrPid {-1};
+  int mPmtVersion {-1};
+
+  std::vector<Stream> mStreams;  // in PMT order
+  int mVideoTrack {-1};
+  int mAudioTrack {-1};
+  std::deque<std::unique_ptr<MediaPacket>> mReady;
+  bool mWaitForKeyFrame {false};  // after a seek
+
+  // The clock, 90kHz: raw is the 33 bit stream time of the last reference,
+  // base what it unwrapped to. mOrigin is zero.
+  ClockState mClockState {kClockNone};
+  int64_t mClockBase {0};
+  int64_t mClockRaw {0};
+  int64_t mOrigin {0};
+  int64_t mOriginRaw {0};
+  int64_t mPcrInterval {0};  // between the last two PCRs
+  int64_t mDurationUs {0};
+
+  std::shared_ptr<KeyframeIndex> mKeyframeIndex;
+  int mIndexTrack {-1};
+  bool mIndexing {false};        // read on from an indexed key frame, nothing skipped
+  int64_t mSeekAnchorUs {-1};    // of the key frame an indexed seek went to
+
+  mutable std::mutex mLock;  // for mStats
+  Stats mStats;
+
+  status_t fillBuffer();
+  status_t resync();
+  status_t nextTsPacket(const uint8_t **ts);
+  status_t demuxTsPacket();
+  void onPcr(int64_t pcr, bool discontinuity);
+  void seedClock(int64_t raw, int64_t base);
+  int64_t unwrap(int64_t raw, int64_t clockBase, int64_t clockRaw) const;
+  int64_t ticksToUs(int64_t ticks) const;
+
+  bool appendSection(std::vector<uint8_t> *section, bool unitStart,
+                     const uint8_t *data, size_t size);
+  void parsePat(const std::vector<uint8_t> &section);
+  void parsePmt(const std::vector<uint8_t> &section);
+
+  void onPesPayload(Stream *stream, bool unitStart, bool randomAccess, uint8_t continuity,
+                    const uint8_t *data, size_t size);
+  void finishPes(Stream *stream);
+  void dropPes(Stream *stream);
+  void probeParameters(Stream *stream, const uint8_t *data, size_t size);
+  bool isKeyFrame(const Stream &stream, const uint8_t *data, size_t size) const;
+
+  status_t probe();
+  void probeDuration();
+  void resetDemux(int64_t offset);
+  void markStartup(StartupTimeline::Event event);
+};
+
+} // hpc
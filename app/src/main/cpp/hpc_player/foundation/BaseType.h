@@ -25,6 +25,34 @@ enum media_event_type {
   MEDIA_AUDIO_ROUTING_CHANGED = 10000,
 };
 
+enum media_error_type {
+  MEDIA_ERROR_UNKNOWN = 1,
+};
+
+enum media_info_type {
+  MEDIA_INFO_UNKNOWN           = 1,
+  MEDIA_INFO_RENDERING_START   = 3,
+  MEDIA_INFO_BUFFERING_START   = 701,
+  MEDIA_INFO_BUFFERING_END     = 702,
+  MEDIA_INFO_PLAY_AUDIO_ERROR  = 804,
+  MEDIA_INFO_PLAY_VIDEO_ERROR  = 805,
+  // ext1 carries the GOP time in ms of a newly cached seekbar thumbnail.
+  MEDIA_INFO_PREVIEW_AVAILABLE = 2000,
+  // ext1 carries the time in ms of the frame a step landed on.
+  MEDIA_INFO_FRAME_STEPPED     = 2001,
+  // ext1 carries the latency in ms of an audio track switch.
+  MEDIA_INFO_TRACK_SWITCHED    = 2002,
+};
+
+enum media_track_type {
+  MEDIA_TRACK_TYPE_UNKNOWN = 0,
+  MEDIA_TRACK_TYPE_VIDEO = 1,
+  MEDIA_TRACK_TYPE_AUDIO = 2,
+  MEDIA_TRACK_TYPE_TIMEDTEXT = 3,
+  MEDIA_TRACK_TYPE_SUBTITLE = 4,
+  MEDIA_TRACK_TYPE_METADATA = 5,
+};
+
 enum SeekMode : int32_t {
   SEEK_PREVIOUS_SYNC = 0,
   SEEK_NEXT_SYNC,
@@ -32,4 +60,9 @@ enum SeekMode : int32_t {
   SEEK_CLOSEST,
   SEEK_FRAME_INDEX,
 };
+
+enum PlaybackDirection : int32_t {
+  PLAYBACK_FORWARD = 0,
+  PLAYBACK_REVERSE,
+};
 }
\ No newline at end of file
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace hpc {
+
+// Read-ahead watermarks of a source, per track, in media time waiting in the
+// track's packet queue. Demuxing a track goes on up to mMaxMarkMs and pauses
+// there; it starts again once the decoder drained the queue below
+// mResumePlaybackMarkMs, so reads come in bursts rather than a packet at a
+// time. Until the source is prepared it only fills to mInitialMarkMs, for a
+// quick start. mMaxBytes caps the memory of one track whatever the marks
+// say, e.g. for 4K HEVC, while low-bitrate audio gets the full depth in
+// media time.
+//
+// A streaming source also uses the initial mark to report prepared and the
+// resume mark to end rebuffering.
+struct BufferingSettings {
+  int32_t mInitialMarkMs {1000};
+  int32_t mResumePlaybackMarkMs {2000};
+  int32_t mMaxMarkMs {5000};
+  int64_t mMaxBytes {32 * 1024 * 1024};
+
+  bool isValid() const {
+    return mInitialMarkMs >= 0 && mResumePlaybackMarkMs >= 0
+        && mMaxMarkMs >= mInitialMarkMs && mMaxMarkMs >= mResumePlaybackMarkMs
+        && mMaxBytes > 0;
+  }
+
+  // Whether the read loop goes on demuxing a track that holds |bufferedUs|
+  // and |bytes|. An empty track is always read, however large its packets.
+  bool shouldReadMore(int64_t bufferedUs, size_t bytes, bool preparing) const {
+    if (bytes == 0) {
+      return true;
+    }
+    const int64_t markUs = (preparing ? mInitialMarkMs : mMaxMarkMs) * 1000LL;
+    return bufferedUs < markUs && (int64_t)bytes < mMaxBytes;
+  }
+
+  // Whether a track drained to |bufferedUs| wakes the read loop up again.
+  bool shouldResumeReading(int64_t bufferedUs) const {
+    return bufferedUs < mResumePlaybackMarkMs * 1000LL;
+  }
+};
+
+} // hpc
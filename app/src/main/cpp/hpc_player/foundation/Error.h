@@ -58,6 +58,27 @@ enum {
 #endif
   FDS_NOT_ALLOWED     = 0x80000007,
 };
+enum {
+  MEDIA_ERROR_BASE        = -1000,
+
+  ERROR_CANNOT_CONNECT    = MEDIA_ERROR_BASE - 3,
+  ERROR_IO                = MEDIA_ERROR_BASE - 4,
+  ERROR_CONNECTION_LOST   = MEDIA_ERROR_BASE - 5,
+  ERROR_MALFORMED         = MEDIA_ERROR_BASE - 7,
+  ERROR_OUT_OF_RANGE      = MEDIA_ERROR_BASE - 8,
+  ERROR_BUFFER_TOO_SMALL  = MEDIA_ERROR_BASE - 9,
+  ERROR_UNSUPPORTED       = MEDIA_ERROR_BASE - 10,
+  ERROR_END_OF_STREAM     = MEDIA_ERROR_BASE - 11,
+
+  // Not technically errors.
+  INFO_FORMAT_CHANGED     = MEDIA_ERROR_BASE - 12,
+  INFO_DISCONTINUITY      = MEDIA_ERROR_BASE - 13,
+
+  ERROR_UNKNOWN           = MEDIA_ERROR_BASE - 100,
+  ERROR_INVALID_FORMAT    = MEDIA_ERROR_BASE - 101,
+  ERROR_BUFFER_FULL       = MEDIA_ERROR_BASE - 102,
+};
+
 // Restore define; enumeration is in "android" namespace, so the value defined
 // there won't work for Win32 code in a different namespace.
 #ifdef _WIN32
@@ -36,7 +36,7 @@ struct Handler :public std::enable_shared_from_this<Handler> {
 
  private:
   friend struct Message;      // deliverMessage()
-  friend struct ALooperRoster; // setID()
+  friend struct Looper;       // setID()
 
   Looper::handler_id mID;
   std::weak_ptr<Looper> mLooper;
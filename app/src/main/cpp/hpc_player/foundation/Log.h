@@ -1,14 +1,38 @@
 #pragma once
 
+#ifdef __ANDROID__
+
 #include <android/log.h>
 
 #ifndef ALOG
 #define ALOG(priority, tag, ...) ((void)__android_log_print(ANDROID_##priority, tag, __VA_ARGS__))
+#endif
+
+#else  // host builds, e.g. hpcbench
+
+#include <stdio.h>
+
+// Verbose and debug output is compiled out so it cannot skew benchmarks.
+#define HPC_HOST_LOG_LOG_VERBOSE 0
+#define HPC_HOST_LOG_LOG_DEBUG   0
+#define HPC_HOST_LOG_LOG_INFO    1
+#define HPC_HOST_LOG_LOG_WARN    1
+#define HPC_HOST_LOG_LOG_ERROR   1
 
+#ifndef ALOG
+#define ALOG(priority, tag, ...)                  \
+  ((void)(HPC_HOST_LOG_##priority                 \
+      && fprintf(stderr, "%s: ", tag) >= 0        \
+      && fprintf(stderr, __VA_ARGS__) >= 0        \
+      && fputc('\n', stderr) != EOF))
+#endif
+
+#endif
+
+#ifndef ALOGI
 #define ALOGI(...) ALOG(LOG_INFO, LOG_TAG, __VA_ARGS__)
 #define ALOGV(...) ALOG(LOG_VERBOSE, LOG_TAG, __VA_ARGS__)
 #define ALOGE(...) ALOG(LOG_ERROR, LOG_TAG, __VA_ARGS__)
 #define ALOGD(...) ALOG(LOG_DEBUG, LOG_TAG, __VA_ARGS__)
 #define ALOGW(...) ALOG(LOG_WARN, LOG_TAG, __VA_ARGS__)
-
-#endif
\ No newline at end of file
+#endif
@@ -1,25 +1,30 @@
 
 #define LOG_TAG "Looper"
 
+#include <atomic>
 #include <chrono>
+#include <sys/resource.h>
+#include <unistd.h>
 
 #include "Looper.h"
 #include "Handler.h"
 //#include "ALooperRoster.h"
 #include "Message.h"
 #include "Error.h"
+#include "Log.h"
 
 namespace hpc {
 
 // static
 int64_t Looper::GetNowUs() {
   return std::chrono::duration_cast<std::chrono::microseconds>(
-      std::chrono::system_clock::now().time_since_epoch())
+      std::chrono::steady_clock::now().time_since_epoch())
       .count();
 }
 
 Looper::Looper()
-    : mRunning(false) {
+    : mPriority(PRIORITY_DEFAULT),
+      mRunning(false) {
 }
 
 Looper::~Looper() {
@@ -31,8 +36,18 @@ void Looper::setName(const char *name) {
   mName = name;
 }
 
-int Looper::start() {
+int Looper::start(int32_t priority) {
+  std::lock_guard<std::mutex> lck(mLock);
+  if (mThread != nullptr) {
+    return INVALID_OPERATION;
+  }
+  mPriority = priority;
+  mRunning = true;
   mThread = std::make_unique<std::thread>(std::thread([this]() {
+    if (mPriority != PRIORITY_DEFAULT) {
+      // niceness is per thread on linux, so this only affects the looper thread.
+      setpriority(PRIO_PROCESS, gettid(), mPriority);
+    }
     do {
     } while (loop());
   }));
@@ -40,11 +55,19 @@ int Looper::start() {
 }
 
 int Looper::stop() {
-  if (mThread && !mThread->joinable()) {
-    return ERROR;
+  {
+    std::lock_guard<std::mutex> lck(mLock);
+    if (mThread == nullptr || !mThread->joinable()) {
+      return ERROR;
+    }
+    mRunning = false;
+    mQueueChangedCondition.notify_all();
+  }
+  if (mThread->get_id() != std::this_thread::get_id()) {
+    mThread->join();
+  } else {
+    mThread->detach();
   }
-  mRunning = false;
-  mThread->join();
   return OK;
 }
 
@@ -85,7 +108,7 @@ bool Looper::loop() {
       return false;
     }
     if (mEventQueue.empty()) {
-      mQueueChangedCondition.wait(lck,[this](){return !mEventQueue.empty();});
+      mQueueChangedCondition.wait(lck,[this](){return !mEventQueue.empty() || !mRunning;});
       return true;
     }
     int64_t whenUs = (*mEventQueue.begin()).mWhenUs;
@@ -97,7 +120,7 @@ bool Looper::loop() {
         delayUs = INT64_MAX / 1000;
       }
       auto delayTime = std::chrono::system_clock::now() + std::chrono::microseconds(delayUs) ;
-      mQueueChangedCondition.wait_until(lck,delayTime,[](){return false;});
+      mQueueChangedCondition.wait_until(lck,delayTime,[this](){return !mRunning;});
 
       return true;
     }
@@ -148,8 +171,15 @@ int Looper::postReply(const std::shared_ptr<AReplyToken> &replyToken, const std:
   return err;
 }
 
-Looper::handler_id Looper::registerHandler(enable_shared_from_this <Handler> handler) {
-  return 0;
+Looper::handler_id Looper::registerHandler(const std::shared_ptr<Handler> &handler) {
+  static std::atomic<handler_id> sNextHandlerID(1);
+  if (handler == nullptr || handler->id() != 0) {
+    ALOGW("failed to register handler, it is null or already registered");
+    return INVALID_OPERATION;
+  }
+  handler_id id = sNextHandlerID++;
+  handler->setID(id, weak_from_this());
+  return id;
 }
 void Looper::unregisterHandler(Looper::handler_id handlerID) {
 
@@ -4,6 +4,8 @@
 #include <memory>
 #include <thread>
 #include <list>
+#include <mutex>
+#include <condition_variable>
 
 
 namespace hpc {
@@ -16,16 +18,24 @@ struct Looper : public std::enable_shared_from_this<Looper>{
   typedef int32_t event_id;
   typedef int32_t handler_id;
 
+  // Thread niceness applied to the looper thread in start().
+  enum {
+    PRIORITY_AUDIO      = -16,
+    PRIORITY_DEFAULT    = 0,
+    PRIORITY_BACKGROUND = 10,
+    PRIORITY_LOWEST     = 19,
+  };
+
   Looper();
   virtual ~Looper();
 
   // Takes effect in a subsequent call to start().
   void setName(const char *name);
 
-  handler_id registerHandler(enable_shared_from_this <Handler> handler);
+  handler_id registerHandler(const std::shared_ptr<Handler> &handler);
   void unregisterHandler(handler_id handlerID);
 
-  int start();
+  int start(int32_t priority = PRIORITY_DEFAULT);
 
   int stop();
 
@@ -46,6 +56,8 @@ struct Looper : public std::enable_shared_from_this<Looper>{
   std::mutex mLock;
   std::condition_variable mQueueChangedCondition;
 
+  int32_t mPriority;
+
   std::string mName;
 
   std::list<Event> mEventQueue;
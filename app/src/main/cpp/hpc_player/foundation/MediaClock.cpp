@@ -46,7 +46,7 @@ void MediaClock::reset() {
   std::lock_guard autoLock(mLock);
   auto it = mTimers.begin();
   while (it != mTimers.end()) {
-    it->mNotify->setInt32("reason", TIMER_REASON_RESET);
+    it->mNotify->setInt(TIMER_REASON_RESET);
     it->mNotify->post();
     it = mTimers.erase(it);
   }
@@ -111,7 +111,10 @@ void MediaClock::updateMaxTimeMedia(int64_t maxTimeMediaUs) {
 }
 
 void MediaClock::setPlaybackRate(float rate) {
-  CHECK_GE(rate, 0.0);
+  if (rate < 0.0) {
+    ALOGW("reject negative playback rate %f", rate);
+    return;
+  }
   std::lock_guard autoLock(mLock);
   if (mAnchorTimeRealUs == -1) {
     mPlaybackRate = rate;
@@ -219,11 +222,8 @@ void MediaClock::onMessageReceived(const std::shared_ptr<Message> &msg) {
   switch (msg->what()) {
     case kWhatTimeIsUp:
     {
-      int32_t generation;
-      CHECK(msg->findInt32("generation", &generation));
-
       std::lock_guard autoLock(mLock);
-      if (generation != mGeneration) {
+      if (msg->mArg1 != mGeneration) {
         break;
       }
       processTimers_l();
@@ -276,7 +276,7 @@ void MediaClock::processTimers_l() {
 
   auto itNotify = notifyList.begin();
   while (itNotify != notifyList.end()) {
-    itNotify->second.mNotify->setInt32("reason", TIMER_REASON_REACHED);
+    itNotify->second.mNotify->setInt(TIMER_REASON_REACHED);
     itNotify->second.mNotify->post();
     itNotify = notifyList.erase(itNotify);
   }
@@ -286,8 +286,8 @@ void MediaClock::processTimers_l() {
     return;
   }
 
-  std::shared_ptr<Message> msg = new Message(kWhatTimeIsUp, this);
-  msg->setInt32("generation", mGeneration);
+  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatTimeIsUp, shared_from_this());
+  msg->setInt(mGeneration);
   msg->post(nextLapseRealUs);
 }
 
@@ -311,11 +311,10 @@ void MediaClock::setNotificationMessage(const std::shared_ptr<Message> &msg) {
 void MediaClock::notifyDiscontinuity_l() {
   if (mNotify != nullptr) {
     std::shared_ptr<Message> msg = mNotify->dup();
-    msg->setInt64("anchor-media-us", mAnchorTimeMediaUs);
-    msg->setInt64("anchor-real-us", mAnchorTimeRealUs);
-    msg->setFloat("playback-rate", mPlaybackRate);
+    msg->mArg1 = mAnchorTimeMediaUs;
+    msg->mArg2 = mAnchorTimeRealUs;
     msg->post();
   }
 }
 
-}  // namespace android
+} // hpc
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <list>
+#include <mutex>
 #include "Handler.h"
 #include "Error.h"
 
@@ -15,6 +16,7 @@ struct MediaClock : public Handler {
   };
 
   MediaClock();
+  virtual ~MediaClock();
 
   MediaClock(const MediaClock &) = delete;
   MediaClock &operator=(const MediaClock &) = delete;
@@ -51,13 +53,14 @@ struct MediaClock : public Handler {
   // mediaTimeUs + (adjustRealUs / playbackRate)
   void addTimer(const std::shared_ptr<Message> &notify, int64_t mediaTimeUs, int64_t adjustRealUs = 0);
 
+  // Timers are posted with the TIMER_REASON in mArg1. The notification
+  // message is posted on every anchor change, with the anchor media time in
+  // mArg1 and the anchor real time in mArg2.
   void setNotificationMessage(const std::shared_ptr<Message> &msg);
 
   void reset();
 
  protected:
-  virtual ~MediaClock();
-
   virtual void onMessageReceived(const std::shared_ptr<Message> &msg);
 
  private:
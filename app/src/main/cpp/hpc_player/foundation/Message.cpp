@@ -4,6 +4,7 @@
 #include "Handler.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 #define LOG_TAG "Message"
 
@@ -68,7 +69,7 @@ void Message::setObject(std::string name ,void* ptr) {
 status_t Message::post(int64_t delayUs) {
   std::shared_ptr<Looper> looper = mLooper.lock();
   if (looper == nullptr) {
-    ALOGW("failed to post message as target looper for handler %d is gone.");
+    ALOGW("failed to post message %d as its target looper is gone.", mWhat);
     return -ENOENT;
   }
 
@@ -76,10 +77,20 @@ status_t Message::post(int64_t delayUs) {
   return OK;
 }
 
+void Message::deliver() {
+  std::shared_ptr<Handler> handler = mHandler.lock();
+  if (handler == nullptr) {
+    ALOGW("failed to deliver message as target handler %d is gone.", mWhat);
+    return;
+  }
+
+  handler->deliverMessage(shared_from_this());
+}
+
 status_t Message::postAndAwaitResponse(std::shared_ptr<Message> *response) {
   std::shared_ptr<Looper> looper = mLooper.lock();
   if (looper == nullptr) {
-    ALOGW("failed to post message as target looper for handler %d is gone.");
+    ALOGW("failed to post message %d as its target looper is gone.", mWhat);
     return -ENOENT;
   }
 
@@ -155,9 +166,11 @@ std::shared_ptr<Message> Message::dup() const {
   if (!msg) {
     return nullptr;
   }
+  msg->mLooper = mLooper;
+  msg->mHandler = mHandler;
   msg->mWhat = mWhat;
   msg->mArg1 = mArg1;
-  msg->mArg2 = mArg1;
+  msg->mArg2 = mArg2;
   //msg->mTime = CurrentTimeMs();
   if (mObj1 && mObj1_len > 0) {
     msg->mObj1 = malloc(mObj1_len * sizeof(uint8_t));
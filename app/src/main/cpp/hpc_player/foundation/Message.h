@@ -32,6 +32,9 @@ struct Message : public std::enable_shared_from_this<Message>{
 
   status_t post(int64_t delayUs = 0);
 
+  // Called by Looper to hand the message to its target handler.
+  void deliver();
+
   status_t postAndAwaitResponse(std::shared_ptr<Message> *response);
 
   bool senderAwaitsResponse(std::shared_ptr<AReplyToken> *replyToken);
@@ -6,12 +6,4 @@
 
 namespace hpc {
 
-MetaData::MetaData(const MetaData &from) {
-
-}
-
-MetaData& MetaData::operator = (const MetaData &rhs) {
-  this->height = rhs.height;
-  return *this;
-}
 } // hpc
\ No newline at end of file
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <vector>
 
 namespace hpc {
 
@@ -10,8 +12,8 @@ struct Rect {
 
 struct MetaData {
   MetaData() = default;
-  MetaData(const MetaData &from);
-  MetaData& operator = (const MetaData &);
+  MetaData(const MetaData &from) = default;
+  MetaData& operator = (const MetaData &) = default;
 
   int width {0};
   int height {0};
@@ -24,6 +26,10 @@ struct MetaData {
   int BitRate {0};
   int maxBitRate {0};
   int bitsPerSample {0};
+  int pixelFormat {-1};  // AVPixelFormat of the coded stream, -1 if unknown
+  // Codec configuration the decoder is opened with: an avcC or hvcC record,
+  // an AudioSpecificConfig, as libavcodec takes it for extradata.
+  std::vector<uint8_t> csd;
 };
 
 } // hpc
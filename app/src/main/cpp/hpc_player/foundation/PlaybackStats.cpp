@@ -0,0 +1,190 @@
+#include "PlaybackStats.h"
+#include "Looper.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace hpc {
+
+Histogram::Histogram() {
+  reset();
+}
+
+void Histogram::reset() {
+  for (auto &bucket : mBuckets) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+}
+
+// Magnitudes below kSubBuckets have a bucket each, above that every power of
+// two is split into kSubBuckets equal buckets.
+// static
+int Histogram::MagnitudeBucket(uint64_t magnitude) {
+  magnitude = std::min<uint64_t>(magnitude, (1ULL << kMaxBits) - 1);
+  if (magnitude < (uint64_t)kSubBuckets) {
+    return (int)magnitude;
+  }
+  const int msb = 63 - __builtin_clzll(magnitude);
+  const int shift = msb - kSubBucketBits;
+  return (shift + 1) * kSubBuckets + (int)((magnitude >> shift) & (kSubBuckets - 1));
+}
+
+// Middle of the bucket.
+// static
+int64_t Histogram::MagnitudeValue(int bucket) {
+  if (bucket < kSubBuckets) {
+    return bucket;
+  }
+  const int shift = bucket / kSubBuckets - 1;
+  const int64_t low = (int64_t)(kSubBuckets + bucket % kSubBuckets) << shift;
+  return low + ((1LL << shift) >> 1);
+}
+
+void Histogram::add(int64_t value) {
+  int bucket = value >= 0
+      ? kHalfBuckets + MagnitudeBucket((uint64_t)value)
+      : kHalfBuckets - 1 - MagnitudeBucket(0 - (uint64_t)value);
+  mBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+int64_t Histogram::count() const {
+  int64_t total = 0;
+  for (const auto &bucket : mBuckets) {
+    total += bucket.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+int64_t Histogram::percentile(double p) const {
+  int64_t counts[kNumBuckets];
+  int64_t total = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    counts[i] = mBuckets[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+  if (total == 0) {
+    return -1;
+  }
+
+  int64_t rank = (int64_t)std::ceil(std::min(std::max(p, 0.0), 100.0) / 100.0 * total);
+  rank = std::max<int64_t>(rank, 1);
+  int bucket = 0;
+  for (int64_t seen = 0; bucket < kNumBuckets - 1; ++bucket) {
+    seen += counts[bucket];
+    if (seen >= rank) {
+      break;
+    }
+  }
+  return bucket >= kHalfBuckets
+      ? MagnitudeValue(bucket - kHalfBuckets)
+      : -MagnitudeValue(kHalfBuckets - 1 - bucket);
+}
+
+PlaybackStats::PlaybackStats() {
+  reset();
+}
+
+void PlaybackStats::reset() {
+  mFramesDecoded.store(0, std::memory_order_relaxed);
+  mFramesRendered.store(0, std::memory_order_relaxed);
+  mFramesDroppedLate.store(0, std::memory_order_relaxed);
+  mFramesSkippedByDecoder.store(0, std::memory_order_relaxed);
+  mDecodeUs.reset();
+  mAvSyncUs.reset();
+  for (int audio = 0; audio < 2; ++audio) {
+    mDemuxedBytes[audio].store(0, std::memory_order_relaxed);
+    mDemuxedDurationUs[audio].store(0, std::memory_order_relaxed);
+  }
+  mPayloadBytesCopied.store(0, std::memory_order_relaxed);
+  mRebufferCount.store(0, std::memory_order_relaxed);
+  mRebufferUs.store(0, std::memory_order_relaxed);
+  mRebufferStartUs.store(-1, std::memory_order_relaxed);
+}
+
+void PlaybackStats::onFrameDecoded(int64_t decodeUs) {
+  mFramesDecoded.fetch_add(1, std::memory_order_relaxed);
+  mDecodeUs.add(decodeUs);
+}
+
+void PlaybackStats::onFrameSkippedByDecoder() {
+  mFramesSkippedByDecoder.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PlaybackStats::onFrameRendered() {
+  mFramesRendered.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PlaybackStats::onFrameDroppedLate() {
+  mFramesDroppedLate.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PlaybackStats::onAvSyncOffset(int64_t offsetUs) {
+  mAvSyncUs.add(offsetUs);
+}
+
+void PlaybackStats::onPacketDemuxed(bool audio, size_t bytes, int64_t durationUs) {
+  mDemuxedBytes[audio].fetch_add((int64_t)bytes, std::memory_order_relaxed);
+  if (durationUs > 0) {
+    mDemuxedDurationUs[audio].fetch_add(durationUs, std::memory_order_relaxed);
+  }
+}
+
+void PlaybackStats::onPayloadCopied(size_t bytes) {
+  mPayloadBytesCopied.fetch_add((int64_t)bytes, std::memory_order_relaxed);
+}
+
+void PlaybackStats::onRebufferingStart() {
+  int64_t expected = -1;
+  if (mRebufferStartUs.compare_exchange_strong(
+      expected, Looper::GetNowUs(), std::memory_order_relaxed)) {
+    mRebufferCount.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void PlaybackStats::onRebufferingEnd() {
+  int64_t startUs = mRebufferStartUs.exchange(-1, std::memory_order_relaxed);
+  if (startUs >= 0) {
+    mRebufferUs.fetch_add(Looper::GetNowUs() - startUs, std::memory_order_relaxed);
+  }
+}
+
+// static
+PlaybackStats::Percentiles PlaybackStats::GetPercentiles(const Histogram &histogram) {
+  Percentiles percentiles;
+  percentiles.p50 = histogram.percentile(50);
+  percentiles.p90 = histogram.percentile(90);
+  percentiles.p99 = histogram.percentile(99);
+  return percentiles;
+}
+
+PlaybackStats::Snapshot PlaybackStats::getSnapshot() const {
+  Snapshot snapshot;
+  snapshot.framesDecoded = mFramesDecoded.load(std::memory_order_relaxed);
+  snapshot.framesRendered = mFramesRendered.load(std::memory_order_relaxed);
+  snapshot.framesDroppedLate = mFramesDroppedLate.load(std::memory_order_relaxed);
+  snapshot.framesSkippedByDecoder = mFramesSkippedByDecoder.load(std::memory_order_relaxed);
+  snapshot.decodeUs = GetPercentiles(mDecodeUs);
+  snapshot.avSyncUs = GetPercentiles(mAvSyncUs);
+
+  snapshot.rebufferCount = mRebufferCount.load(std::memory_order_relaxed);
+  snapshot.rebufferUs = mRebufferUs.load(std::memory_order_relaxed);
+  int64_t startUs = mRebufferStartUs.load(std::memory_order_relaxed);
+  if (startUs >= 0) {
+    snapshot.rebufferUs += std::max<int64_t>(Looper::GetNowUs() - startUs, 0);
+  }
+
+  int64_t bitrates[2] = {0, 0};
+  for (int audio = 0; audio < 2; ++audio) {
+    int64_t bytes = mDemuxedBytes[audio].load(std::memory_order_relaxed);
+    int64_t durationUs = mDemuxedDurationUs[audio].load(std::memory_order_relaxed);
+    if (durationUs > 0) {
+      bitrates[audio] = (int64_t)(bytes * 8e6 / durationUs);
+    }
+  }
+  snapshot.videoBitrate = bitrates[0];
+  snapshot.audioBitrate = bitrates[1];
+  snapshot.payloadBytesCopied = mPayloadBytesCopied.load(std::memory_order_relaxed);
+  return snapshot;
+}
+
+} // hpc
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace hpc {
+
+// Lock free histogram for percentiles of latency like values. Buckets are
+// log-linear with eight per power of two, so a percentile is within 1/16 of
+// the true value, on both sides of zero. add() is one relaxed increment and
+// never blocks; percentile() reads every bucket once.
+class Histogram {
+ public:
+  Histogram();
+
+  void add(int64_t value);
+  void reset();
+
+  int64_t count() const;
+  // Value at percentile |p| (0..100), -1 if nothing was added.
+  int64_t percentile(double p) const;
+
+ private:
+  static const int kSubBucketBits = 3;
+  static const int kSubBuckets = 1 << kSubBucketBits;
+  static const int kMaxBits = 40;  // about 12 days in us, larger values are clamped
+  static const int kHalfBuckets = (kMaxBits - kSubBucketBits + 1) * kSubBuckets;
+  // negative values in [0, kHalfBuckets), the rest above, in value order.
+  static const int kNumBuckets = 2 * kHalfBuckets;
+
+  std::atomic<int64_t> mBuckets[kNumBuckets];
+
+  static int MagnitudeBucket(uint64_t magnitude);
+  static int64_t MagnitudeValue(int bucket);
+
+  Histogram(const Histogram &) = delete;
+  Histogram &operator=(const Histogram &) = delete;
+};
+
+// Counters of one playback session. The pipeline threads report into it as
+// things happen, with relaxed atomics only, and getSnapshot() samples it
+// from any thread without stopping the pipeline, cheap enough to poll every
+// second. Counters in a snapshot may be a few events apart from each other.
+//
+// Decoders report decoded and skipped frames and their decode time, the
+// renderer reports rendered and late frames with their A/V offset, the
+// source the packets it demuxes and the player rebuffering. Whoever copies
+// a packet payload, rather than passing its reference on, reports the bytes.
+class PlaybackStats {
+ public:
+  struct Percentiles {
+    int64_t p50 {-1};
+    int64_t p90 {-1};
+    int64_t p99 {-1};
+  };
+
+  struct Snapshot {
+    int64_t framesDecoded {0};
+    int64_t framesRendered {0};
+    int64_t framesDroppedLate {0};       // decoded but too late for the renderer
+    int64_t framesSkippedByDecoder {0};  // never reached the renderer, e.g. seek pre-roll
+    Percentiles decodeUs;
+    // video pts minus the playback clock at render time, positive is early.
+    Percentiles avSyncUs;
+
+    // Filled in by the owner of the packet queues, see HpcPlayerInternal::getStats().
+    int64_t videoQueueUs {0};
+    int64_t videoQueueBytes {0};
+    int64_t audioQueueUs {0};
+    int64_t audioQueueBytes {0};
+
+    int64_t rebufferCount {0};
+    int64_t rebufferUs {0};  // including a rebuffering still in progress
+
+    // Demuxed bits over demuxed media time, per track.
+    int64_t videoBitrate {0};
+    int64_t audioBitrate {0};
+
+    // Payload bytes copied between the demuxer and the codecs.
+    int64_t payloadBytesCopied {0};
+  };
+
+  PlaybackStats();
+
+  // Clears everything, for a new data source.
+  void reset();
+
+  void onFrameDecoded(int64_t decodeUs);
+  void onFrameSkippedByDecoder();
+  void onFrameRendered();
+  void onFrameDroppedLate();
+  // Video pts minus the playback clock when the frame was rendered, for
+  // frames rendered against a running clock.
+  void onAvSyncOffset(int64_t offsetUs);
+
+  void onPacketDemuxed(bool audio, size_t bytes, int64_t durationUs);
+  void onPayloadCopied(size_t bytes);
+
+  void onRebufferingStart();
+  void onRebufferingEnd();
+
+  Snapshot getSnapshot() const;
+
+ private:
+  std::atomic<int64_t> mFramesDecoded;
+  std::atomic<int64_t> mFramesRendered;
+  std::atomic<int64_t> mFramesDroppedLate;
+  std::atomic<int64_t> mFramesSkippedByDecoder;
+  Histogram mDecodeUs;
+  Histogram mAvSyncUs;
+
+  std::atomic<int64_t> mDemuxedBytes[2];       // indexed by audio
+  std::atomic<int64_t> mDemuxedDurationUs[2];
+  std::atomic<int64_t> mPayloadBytesCopied;
+
+  std::atomic<int64_t> mRebufferCount;
+  std::atomic<int64_t> mRebufferUs;
+  std::atomic<int64_t> mRebufferStartUs;  // -1 while not rebuffering
+
+  static Percentiles GetPercentiles(const Histogram &histogram);
+
+  PlaybackStats(const PlaybackStats &) = delete;
+  PlaybackStats &operator=(const PlaybackStats &) = delete;
+};
+
+} // hpc
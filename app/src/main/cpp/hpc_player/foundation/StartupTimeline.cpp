@@ -0,0 +1,65 @@
+#include "StartupTimeline.h"
+#include "Looper.h"
+#include "Log.h"
+
+#define LOG_TAG "StartupTimeline"
+
+namespace hpc {
+
+StartupTimeline::StartupTimeline()
+    : mStartUs(-1) {
+  for (auto &markUs : mMarksUs) {
+    markUs.store(-1, std::memory_order_relaxed);
+  }
+}
+
+void StartupTimeline::start() {
+  for (auto &markUs : mMarksUs) {
+    markUs.store(-1, std::memory_order_relaxed);
+  }
+  mStartUs.store(Looper::GetNowUs(), std::memory_order_release);
+}
+
+void StartupTimeline::mark(Event event) {
+  if (event < 0 || event >= kNumEvents) {
+    return;
+  }
+  int64_t startUs = mStartUs.load(std::memory_order_acquire);
+  if (startUs < 0 || mMarksUs[event].load(std::memory_order_relaxed) >= 0) {
+    return;
+  }
+  int64_t expected = -1;
+  if (mMarksUs[event].compare_exchange_strong(
+      expected, Looper::GetNowUs() - startUs, std::memory_order_relaxed)) {
+    ALOGV("%s at %lld us", EventName(event), (long long)mMarksUs[event].load());
+  }
+}
+
+int64_t StartupTimeline::getUs(Event event) const {
+  if (event < 0 || event >= kNumEvents) {
+    return -1;
+  }
+  return mMarksUs[event].load(std::memory_order_relaxed);
+}
+
+void StartupTimeline::dump() const {
+  ALOGI("startup: open %lld, probe %lld, first packet %lld, "
+        "first decoded %lld, first rendered %lld (us)",
+        (long long)getUs(kOpen), (long long)getUs(kProbe),
+        (long long)getUs(kFirstPacket), (long long)getUs(kFirstDecodedFrame),
+        (long long)getUs(kFirstRenderedFrame));
+}
+
+// static
+const char *StartupTimeline::EventName(Event event) {
+  switch (event) {
+    case kOpen:               return "open";
+    case kProbe:              return "probe";
+    case kFirstPacket:        return "first-packet";
+    case kFirstDecodedFrame:  return "first-decoded-frame";
+    case kFirstRenderedFrame: return "first-rendered-frame";
+    default:                  return "unknown";
+  }
+}
+
+} // hpc
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace hpc {
+
+// Milestones of a prepare/start cycle, relative to the prepare request.
+// Components mark the milestones they own as they pass them; only the first
+// mark per milestone counts, so it is safe to call mark() on every packet or
+// frame. Marks are lock free and can come from any thread.
+class StartupTimeline {
+ public:
+  enum Event {
+    kOpen = 0,            // container opened, header parsed
+    kProbe,               // codec parameters known
+    kFirstPacket,         // first video packet demuxed
+    kFirstDecodedFrame,   // first video frame out of the decoder
+    kFirstRenderedFrame,  // first video frame on screen, i.e. time to first frame
+    kNumEvents,
+  };
+
+  StartupTimeline();
+
+  // Sets the origin and clears all marks.
+  void start();
+  void mark(Event event);
+
+  // Microseconds from start() to |event|, -1 if not reached yet.
+  int64_t getUs(Event event) const;
+
+  void dump() const;
+
+  static const char *EventName(Event event);
+
+ private:
+  std::atomic<int64_t> mStartUs;
+  std::atomic<int64_t> mMarksUs[kNumEvents];
+
+  StartupTimeline(const StartupTimeline &) = delete;
+  StartupTimeline &operator=(const StartupTimeline &) = delete;
+};
+
+} // hpc
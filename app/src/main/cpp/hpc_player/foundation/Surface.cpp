@@ -4,5 +4,77 @@
 
 #include "Surface.h"
 
+extern "C" {
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+}
+
 namespace hpc {
-} // hpc
\ No newline at end of file
+
+#ifdef __ANDROID__
+
+Surface::Surface(ANativeWindow *native_window) {
+  if (native_window) {
+    ANativeWindow_acquire(native_window);
+    mNativeWindow = native_window;
+  }
+}
+
+Surface::~Surface() {
+  if (mSwsContext) {
+    sws_freeContext(mSwsContext);
+    mSwsContext = nullptr;
+  }
+  if (mNativeWindow) {
+    ANativeWindow_release(mNativeWindow);
+    mNativeWindow = nullptr;
+  }
+}
+
+status_t Surface::render(const AVFrame *frame) {
+  if (mNativeWindow == nullptr) {
+    return NO_INIT;
+  }
+  if (frame == nullptr || frame->width <= 0 || frame->height <= 0) {
+    return BAD_VALUE;
+  }
+  if (frame->width != mWidth || frame->height != mHeight) {
+    if (ANativeWindow_setBuffersGeometry(mNativeWindow, frame->width, frame->height,
+                                         WINDOW_FORMAT_RGBA_8888) != 0) {
+      return UNKNOWN_ERROR;
+    }
+    mWidth = frame->width;
+    mHeight = frame->height;
+  }
+  mSwsContext = sws_getCachedContext(mSwsContext, frame->width, frame->height,
+                                     (AVPixelFormat)frame->format, mWidth, mHeight,
+                                     AV_PIX_FMT_RGBA, SWS_BILINEAR, nullptr, nullptr, nullptr);
+  if (mSwsContext == nullptr) {
+    return ERROR_UNSUPPORTED;
+  }
+
+  ANativeWindow_Buffer buffer;
+  if (ANativeWindow_lock(mNativeWindow, &buffer, nullptr) != 0) {
+    return UNKNOWN_ERROR;
+  }
+  uint8_t *dst[4] = {static_cast<uint8_t *>(buffer.bits), nullptr, nullptr, nullptr};
+  int dstStride[4] = {buffer.stride * 4, 0, 0, 0};
+  sws_scale(mSwsContext, frame->data, frame->linesize, 0, frame->height, dst, dstStride);
+  ANativeWindow_unlockAndPost(mNativeWindow);
+  return OK;
+}
+
+#else
+
+Surface::Surface(ANativeWindow * /* native_window */) {
+}
+
+Surface::~Surface() = default;
+
+status_t Surface::render(const AVFrame * /* frame */) {
+  return NO_INIT;
+}
+
+#endif
+
+} // hpc
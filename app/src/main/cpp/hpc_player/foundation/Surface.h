@@ -1,24 +1,29 @@
 #pragma once
 
+#ifdef __ANDROID__
 #include <android/native_window.h>
+#else
+// Host builds, e.g. hpcbench, have no window: a subclass overrides render().
+struct ANativeWindow;
+#endif
+
+#include "Error.h"
+
+struct AVFrame;
+struct SwsContext;
 
 namespace hpc {
 
 class Surface {
  public:
-  explicit Surface(ANativeWindow *native_window) {
-    if (native_window) {
-      ANativeWindow_acquire(native_window);
-      mNativeWindow = native_window;
-    }
-  }
-  ~Surface() {
-    if (mNativeWindow) {
-      ANativeWindow_release(mNativeWindow);
-      mNativeWindow = nullptr;
-    }
-  }
+  explicit Surface(ANativeWindow *native_window);
+  virtual ~Surface();
   ANativeWindow *get() { return mNativeWindow; }
+
+  // Converts |frame| to RGBA into the next window buffer and posts it.
+  // Called on the renderer looper only. NO_INIT without a window.
+  virtual status_t render(const AVFrame *frame);
+
   Surface(const Surface &) = delete;
   Surface &operator=(const Surface &) = delete;
   Surface(Surface &&) = delete;
@@ -26,7 +31,9 @@ class Surface {
 
  private:
   ANativeWindow *mNativeWindow{nullptr};
+  SwsContext *mSwsContext{nullptr};
+  int mWidth{0};
+  int mHeight{0};
 };
 
 } // hpc
-
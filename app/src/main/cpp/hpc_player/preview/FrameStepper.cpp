@@ -0,0 +1,323 @@
+#include "FrameStepper.h"
+#include "FFmpegExtractor.h"
+#include "MediaPacket.h"
+#include "Looper.h"
+#include "Log.h"
+
+#include <algorithm>
+
+extern "C" {
+#include "libavutil/imgutils.h"
+}
+
+#define LOG_TAG "FrameStepper"
+
+namespace hpc {
+
+static const AVRational kMicrosTimeBase = {1, 1000000};
+
+FrameStepper::FrameStepper() {
+}
+
+FrameStepper::~FrameStepper() {
+  release();
+}
+
+status_t FrameStepper::init(const char *url, size_t maxCachedBytes) {
+  if (mExtractor != nullptr) {
+    return INVALID_OPERATION;
+  }
+  mMaxCachedBytes = maxCachedBytes;
+
+  mExtractor = std::make_unique<FFmpegExtractor>();
+  status_t err = mExtractor->init(url);
+  if (err != OK) {
+    ALOGE("failed to open %s for frame stepping: %d", url, err);
+    mExtractor.reset();
+    return err;
+  }
+
+  mVideoIndex = mExtractor->getVideoStreamIndex();
+  AVStream *stream = mExtractor->getStream(mVideoIndex);
+  const AVCodec *codec = avcodec_find_decoder(stream->codecpar->codec_id);
+  if (codec == nullptr) {
+    release();
+    return ERROR_UNSUPPORTED;
+  }
+
+  mCodecContext = avcodec_alloc_context3(codec);
+  if (mCodecContext == nullptr
+      || avcodec_parameters_to_context(mCodecContext, stream->codecpar) < 0) {
+    release();
+    return NO_MEMORY;
+  }
+  mCodecContext->pkt_timebase = stream->time_base;
+  // Frame threading adds a frame of delay per thread to every cold step,
+  // slice threading does not.
+  mCodecContext->thread_type = FF_THREAD_SLICE;
+  if (avcodec_open2(mCodecContext, codec, nullptr) < 0) {
+    release();
+    return ERROR_UNSUPPORTED;
+  }
+
+  std::lock_guard<std::mutex> autoLock(mStatsLock);
+  mStats = Stats();
+  mStats.maxCachedBytes = mMaxCachedBytes;
+  return OK;
+}
+
+void FrameStepper::release() {
+  mFrames.clear();
+  mIndex = 0;
+  mCachedBytes = 0;
+  mCursorUs = -1;
+  if (mCodecContext != nullptr) {
+    avcodec_free_context(&mCodecContext);
+  }
+  if (mExtractor != nullptr) {
+    mExtractor->release();
+    mExtractor.reset();
+  }
+  mPacket.reset();
+}
+
+int64_t FrameStepper::getCurrentTimeUs() const {
+  return mFrames.empty() ? -1 : mFrames[mIndex].timeUs;
+}
+
+FrameStepper::Stats FrameStepper::getStats() const {
+  std::lock_guard<std::mutex> autoLock(mStatsLock);
+  return mStats;
+}
+
+status_t FrameStepper::restartDecodeAt(int64_t timeUs) {
+  status_t err = mExtractor->seek(std::max<int64_t>(timeUs, 0), SEEK_PREVIOUS_SYNC);
+  if (err != OK) {
+    return err;
+  }
+  avcodec_flush_buffers(mCodecContext);
+  mInputEOS = false;
+  mCursorUs = -1;
+  return OK;
+}
+
+status_t FrameStepper::pullFrame(CachedFrame *out) {
+  AVFrame *frame = av_frame_alloc();
+  if (frame == nullptr) {
+    return NO_MEMORY;
+  }
+  std::shared_ptr<AVFrame> holder(frame, [](AVFrame *f) { av_frame_free(&f); });
+
+  for (;;) {
+    int ret = avcodec_receive_frame(mCodecContext, frame);
+    if (ret == 0) {
+      break;
+    } else if (ret == AVERROR_EOF) {
+      return ERROR_END_OF_STREAM;
+    } else if (ret != AVERROR(EAGAIN)) {
+      return ERROR_MALFORMED;
+    }
+
+    status_t err = mInputEOS ? ERROR_END_OF_STREAM : mExtractor->read(mPacket, mVideoIndex);
+    if (err == ERROR_END_OF_STREAM) {
+      if (!mInputEOS) {
+        mInputEOS = true;
+        // drain the reorder queue.
+        avcodec_send_packet(mCodecContext, nullptr);
+        continue;
+      }
+      return ERROR_END_OF_STREAM;
+    } else if (err != OK) {
+      return err;
+    }
+    if (avcodec_send_packet(mCodecContext, mPacket->avPacket()) < 0) {
+      ALOGW("dropping undecodable packet at %lld us", (long long)mPacket->ptsUs);
+    }
+  }
+
+  int64_t pts = frame->best_effort_timestamp;
+  out->timeUs = pts == AV_NOPTS_VALUE
+      ? -1 : av_rescale_q(pts, mCodecContext->pkt_timebase, kMicrosTimeBase);
+  out->isSync = frame->key_frame != 0;
+  int bytes = av_image_get_buffer_size(
+      (AVPixelFormat)frame->format, frame->width, frame->height, 1);
+  out->bytes = bytes > 0 ? (size_t)bytes : 0;
+  out->frame = holder;
+  mCursorUs = out->timeUs;
+  return OK;
+}
+
+void FrameStepper::appendFrame(const CachedFrame &frame) {
+  // A sync sample starts the next GOP, the previous one is not needed for
+  // stepping anymore.
+  if (frame.isSync && !mFrames.empty()) {
+    mFrames.clear();
+    mCachedBytes = 0;
+  }
+  mFrames.push_back(frame);
+  mCachedBytes += frame.bytes;
+  mIndex = mFrames.size() - 1;
+
+  // Going forward, the oldest frames are the least likely to be stepped to.
+  while (mCachedBytes > mMaxCachedBytes && mFrames.size() > 1) {
+    mCachedBytes -= mFrames.front().bytes;
+    mFrames.pop_front();
+    --mIndex;
+  }
+}
+
+// Decodes forward from the sync sample before |timeUs| and puts the frames
+// preceding |timeUs| in front of the cache. That is the previous GOP when the
+// cache starts at a sync sample, otherwise the head of the current GOP that
+// the byte limit evicted.
+status_t FrameStepper::fillBefore(int64_t timeUs) {
+  const bool previousGop = mFrames.front().isSync;
+  status_t err = restartDecodeAt(previousGop ? timeUs - 1 : timeUs);
+  if (err != OK) {
+    return err;
+  }
+
+  std::deque<CachedFrame> frames;
+  size_t bytes = 0;
+  for (;;) {
+    CachedFrame frame;
+    err = pullFrame(&frame);
+    if (err == ERROR_END_OF_STREAM) {
+      break;
+    } else if (err != OK) {
+      return err;
+    }
+    if (frame.timeUs >= timeUs) {
+      break;
+    }
+    frames.push_back(frame);
+    bytes += frame.bytes;
+    // Going backward, keep the frames closest to |timeUs|.
+    while (bytes > mMaxCachedBytes && frames.size() > 1) {
+      bytes -= frames.front().bytes;
+      frames.pop_front();
+    }
+  }
+  if (frames.empty()) {
+    return ERROR_OUT_OF_RANGE;
+  }
+
+  mIndex = frames.size() - 1;
+  mFrames.insert(mFrames.begin(), frames.begin(), frames.end());
+  mCachedBytes += bytes;
+  while (mCachedBytes > mMaxCachedBytes && mFrames.size() > mIndex + 1) {
+    mCachedBytes -= mFrames.back().bytes;
+    mFrames.pop_back();
+  }
+  return OK;
+}
+
+status_t FrameStepper::seekTo(int64_t timeUs, Frame *frame) {
+  if (mCodecContext == nullptr) {
+    return NO_INIT;
+  }
+  int64_t startUs = Looper::GetNowUs();
+  mFrames.clear();
+  mCachedBytes = 0;
+  mIndex = 0;
+
+  status_t err = restartDecodeAt(timeUs);
+  if (err != OK) {
+    return err;
+  }
+  // Everything from the sync sample up to the target goes into the cache,
+  // so the first back steps after a seek are already hits.
+  for (;;) {
+    CachedFrame cached;
+    err = pullFrame(&cached);
+    if (err == ERROR_END_OF_STREAM && !mFrames.empty()) {
+      break;
+    } else if (err != OK) {
+      return err;
+    }
+    appendFrame(cached);
+    if (cached.timeUs >= timeUs) {
+      break;
+    }
+  }
+  finishStep(startUs, false, frame);
+  return OK;
+}
+
+status_t FrameStepper::stepForward(Frame *frame) {
+  if (mFrames.empty()) {
+    return NO_INIT;
+  }
+  int64_t startUs = Looper::GetNowUs();
+  if (mIndex + 1 < mFrames.size()) {
+    ++mIndex;
+    finishStep(startUs, true, frame);
+    return OK;
+  }
+
+  const int64_t currentUs = mFrames[mIndex].timeUs;
+  CachedFrame next;
+  if (mCursorUs != currentUs) {
+    // The decoder was moved by a back step, continue right after the
+    // current frame.
+    status_t err = restartDecodeAt(currentUs);
+    if (err != OK) {
+      return err;
+    }
+  }
+  do {
+    status_t err = pullFrame(&next);
+    if (err != OK) {
+      return err;
+    }
+  } while (next.timeUs <= currentUs);
+
+  appendFrame(next);
+  finishStep(startUs, false, frame);
+  return OK;
+}
+
+status_t FrameStepper::stepBackward(Frame *frame) {
+  if (mFrames.empty()) {
+    return NO_INIT;
+  }
+  int64_t startUs = Looper::GetNowUs();
+  if (mIndex > 0) {
+    --mIndex;
+    finishStep(startUs, true, frame);
+    return OK;
+  }
+
+  status_t err = fillBefore(mFrames.front().timeUs);
+  if (err != OK) {
+    return err;
+  }
+  finishStep(startUs, false, frame);
+  return OK;
+}
+
+void FrameStepper::finishStep(int64_t startUs, bool cacheHit, Frame *frame) {
+  const CachedFrame &current = mFrames[mIndex];
+  if (frame != nullptr) {
+    frame->timeUs = current.timeUs;
+    frame->frame = current.frame;
+  }
+
+  int64_t elapsedUs = Looper::GetNowUs() - startUs;
+  std::lock_guard<std::mutex> autoLock(mStatsLock);
+  ++mStats.steps;
+  if (cacheHit) {
+    ++mStats.cacheHits;
+  }
+  mStats.lastStepUs = elapsedUs;
+  mStats.maxStepUs = std::max(mStats.maxStepUs, elapsedUs);
+  mStats.totalStepUs += elapsedUs;
+  mStats.cachedFrames = mFrames.size();
+  mStats.cachedBytes = mCachedBytes;
+  mStats.peakCachedBytes = std::max(mStats.peakCachedBytes, mCachedBytes);
+  ALOGV("step to %lld us took %lld us (%s), cache %zu frames / %zu bytes",
+        (long long)current.timeUs, (long long)elapsedUs, cacheHit ? "hit" : "decode",
+        mFrames.size(), mCachedBytes);
+}
+
+} // hpc
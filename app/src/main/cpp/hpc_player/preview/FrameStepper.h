@@ -0,0 +1,95 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include "Error.h"
+
+struct AVCodecContext;
+struct AVFrame;
+
+namespace hpc {
+
+class FFmpegExtractor;
+class MediaPacket;
+
+// Frame accurate stepping for a paused player. Decoded frames of the current
+// GOP are kept in a cache bounded by |maxCachedBytes|, filled by decoding
+// forward from the previous sync sample, so consecutive back steps are served
+// from memory instead of re-decoding the GOP for every frame.
+//
+// Not thread safe except for getStats(); HpcPlayerInternal drives it from its
+// frame looper.
+class FrameStepper {
+ public:
+  struct Frame {
+    int64_t timeUs {-1};
+    std::shared_ptr<AVFrame> frame;
+  };
+
+  struct Stats {
+    int64_t steps {0};
+    int64_t cacheHits {0};      // steps answered without decoding
+    int64_t lastStepUs {0};
+    int64_t maxStepUs {0};
+    int64_t totalStepUs {0};
+    size_t cachedFrames {0};
+    size_t cachedBytes {0};
+    size_t peakCachedBytes {0};
+    size_t maxCachedBytes {0};
+  };
+
+  FrameStepper();
+  ~FrameStepper();
+
+  FrameStepper(const FrameStepper &) = delete;
+  FrameStepper &operator=(const FrameStepper &) = delete;
+
+  status_t init(const char *url, size_t maxCachedBytes = 96 * 1024 * 1024);
+
+  // Makes the first frame at or after |timeUs| the current one.
+  status_t seekTo(int64_t timeUs, Frame *frame = nullptr);
+
+  // Returns ERROR_END_OF_STREAM / ERROR_OUT_OF_RANGE at either end of the stream.
+  status_t stepForward(Frame *frame);
+  status_t stepBackward(Frame *frame);
+
+  int64_t getCurrentTimeUs() const;
+  Stats getStats() const;
+
+  void release();
+
+ private:
+  struct CachedFrame {
+    int64_t timeUs;
+    bool isSync;
+    size_t bytes;
+    std::shared_ptr<AVFrame> frame;
+  };
+
+  std::unique_ptr<FFmpegExtractor> mExtractor;
+  std::unique_ptr<MediaPacket> mPacket;
+  AVCodecContext *mCodecContext {nullptr};
+  int mVideoIndex {-1};
+  bool mInputEOS {false};
+
+  std::deque<CachedFrame> mFrames;  // contiguous in presentation order
+  size_t mIndex {0};                // current frame within mFrames
+  size_t mCachedBytes {0};
+  size_t mMaxCachedBytes {0};
+  // pts of the last frame pulled out of the decoder, -1 if unknown. The
+  // next pull continues right after it.
+  int64_t mCursorUs {-1};
+
+  mutable std::mutex mStatsLock;
+  Stats mStats;
+
+  status_t restartDecodeAt(int64_t timeUs);
+  status_t pullFrame(CachedFrame *out);
+  void appendFrame(const CachedFrame &frame);
+  status_t fillBefore(int64_t timeUs);
+  void finishStep(int64_t startUs, bool cacheHit, Frame *frame);
+};
+
+} // hpc
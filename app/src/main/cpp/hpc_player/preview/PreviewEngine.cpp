@@ -0,0 +1,367 @@
+#include "PreviewEngine.h"
+#include "FFmpegExtractor.h"
+#include "MediaPacket.h"
+#include "Looper.h"
+#include "Message.h"
+#include "Log.h"
+
+#include <algorithm>
+
+extern "C" {
+#include "libavutil/mem.h"
+}
+
+#define LOG_TAG "PreviewEngine"
+
+namespace hpc {
+
+PreviewEngine::PreviewEngine(const std::shared_ptr<Message> &notify)
+    : mNotify(notify) {
+}
+
+PreviewEngine::~PreviewEngine() {
+  release();
+}
+
+status_t PreviewEngine::initAsync(const char *url, int32_t maxWidth, size_t maxCachedGops) {
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    if (mState != kStateIdle) {
+      return INVALID_OPERATION;
+    }
+    mState = kStateOpening;
+    mMaxCachedGops = std::max<size_t>(maxCachedGops, 1);
+  }
+  mUrl = url;
+  mMaxWidth = maxWidth;
+
+  mLooper = std::make_shared<Looper>();
+  mLooper->setName("preview");
+  mLooper->start(Looper::PRIORITY_BACKGROUND);
+  mLooper->registerHandler(shared_from_this());
+  std::make_shared<Message>(kWhatInit, shared_from_this())->post();
+  return OK;
+}
+
+void PreviewEngine::onInit() {
+  status_t err = openDecoder();
+  if (err != OK) {
+    freeDecoder();
+    if (mExtractor != nullptr) {
+      mExtractor->release();
+      mExtractor.reset();
+    }
+  }
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mState = err == OK ? kStateReady : kStateError;
+  mInitError = err;
+  if (err == OK && mPendingTimeUs >= 0 && !mDecodePending) {
+    // Asked for while opening.
+    mDecodePending = true;
+    std::make_shared<Message>(kWhatDecode, shared_from_this())->post();
+  }
+}
+
+// On the preview looper.
+status_t PreviewEngine::openDecoder() {
+  mExtractor = std::make_unique<FFmpegExtractor>();
+  status_t err = mExtractor->init(mUrl.c_str());
+  if (err != OK) {
+    ALOGE("failed to open %s for preview: %d", mUrl.c_str(), err);
+    mExtractor.reset();
+    return err;
+  }
+
+  AVStream *stream = mExtractor->getStream(mExtractor->getVideoStreamIndex());
+  const AVCodec *codec = avcodec_find_decoder(stream->codecpar->codec_id);
+  if (codec == nullptr) {
+    return ERROR_UNSUPPORTED;
+  }
+
+  mCodecContext = avcodec_alloc_context3(codec);
+  if (mCodecContext == nullptr
+      || avcodec_parameters_to_context(mCodecContext, stream->codecpar) < 0) {
+    freeDecoder();
+    return NO_MEMORY;
+  }
+  mCodecContext->pkt_timebase = stream->time_base;
+  // Sync samples only, and skip the work that is invisible at thumbnail size.
+  mCodecContext->skip_frame = AVDISCARD_NONKEY;
+  mCodecContext->skip_loop_filter = AVDISCARD_ALL;
+  mCodecContext->flags2 |= AV_CODEC_FLAG2_FAST;
+  // One thread: previews must not compete with the playback decoder.
+  mCodecContext->thread_count = 1;
+  // lowres is only implemented by a few decoders (mjpeg, mpeg1/2/4, ...),
+  // everything else is downscaled by swscale in convertFrame().
+  int lowres = 0;
+  while (lowres < codec->max_lowres
+      && (stream->codecpar->width >> (lowres + 1)) >= mMaxWidth) {
+    ++lowres;
+  }
+  mCodecContext->lowres = lowres;
+
+  if (avcodec_open2(mCodecContext, codec, nullptr) < 0) {
+    freeDecoder();
+    return ERROR_UNSUPPORTED;
+  }
+  mFrame = av_frame_alloc();
+
+  ALOGD("preview ready: %dx%d lowres %d, max width %d",
+        stream->codecpar->width, stream->codecpar->height, lowres, mMaxWidth);
+  return OK;
+}
+
+void PreviewEngine::release() {
+  if (mLooper != nullptr) {
+    mLooper->unregisterHandler(id());
+    mLooper->stop();
+    mLooper.reset();
+  }
+  freeDecoder();
+  if (mExtractor != nullptr) {
+    mExtractor->release();
+    mExtractor.reset();
+  }
+  mPacket.reset();
+
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mEntries.clear();
+  mLru.clear();
+  mDecodePending = false;
+  mState = kStateIdle;
+}
+
+void PreviewEngine::freeDecoder() {
+  if (mCodecContext != nullptr) {
+    avcodec_free_context(&mCodecContext);
+  }
+  if (mFrame != nullptr) {
+    av_frame_free(&mFrame);
+  }
+  if (mSwsContext != nullptr) {
+    sws_freeContext(mSwsContext);
+    mSwsContext = nullptr;
+  }
+}
+
+status_t PreviewEngine::getThumbnail(int64_t timeUs, Thumbnail *thumbnail) {
+  if (thumbnail == nullptr) {
+    return BAD_VALUE;
+  }
+
+  std::lock_guard<std::mutex> autoLock(mLock);
+  switch (mState) {
+    case kStateIdle:
+      return NO_INIT;
+    case kStateOpening:
+      mPendingTimeUs = timeUs;
+      return WOULD_BLOCK;
+    case kStateError:
+      return mInitError;
+    case kStateReady:
+      break;
+  }
+
+  EntryList::iterator it;
+  bool exact = false;
+  bool found = findEntry_l(timeUs, &it, &exact);
+  if (found) {
+    *thumbnail = it->thumbnail;
+    mLru.splice(mLru.begin(), mLru, it);
+  }
+
+  if (!exact) {
+    // Only the latest request matters while scrubbing, so requests are
+    // coalesced into a single pending decode.
+    mPendingTimeUs = timeUs;
+    if (!mDecodePending) {
+      mDecodePending = true;
+      std::make_shared<Message>(kWhatDecode, shared_from_this())->post();
+    }
+  }
+  return found ? OK : NAME_NOT_FOUND;
+}
+
+bool PreviewEngine::findEntry_l(int64_t timeUs, EntryList::iterator *it, bool *exact) {
+  *exact = false;
+  if (mEntries.empty()) {
+    return false;
+  }
+
+  auto next = mEntries.upper_bound(timeUs);
+  if (next != mEntries.begin()) {
+    auto prev = std::prev(next);
+    if (timeUs <= prev->second->coveredUntilUs) {
+      *it = prev->second;
+      *exact = true;
+      return true;
+    }
+    if (next == mEntries.end()
+        || timeUs - prev->first <= next->first - timeUs) {
+      *it = prev->second;
+      return true;
+    }
+  }
+  *it = next->second;
+  return true;
+}
+
+void PreviewEngine::insertEntry_l(
+    int64_t gopTimeUs, int64_t requestTimeUs, const Thumbnail &thumbnail) {
+  auto found = mEntries.find(gopTimeUs);
+  if (found != mEntries.end()) {
+    EntryList::iterator it = found->second;
+    it->coveredUntilUs = std::max(it->coveredUntilUs, requestTimeUs);
+    mLru.splice(mLru.begin(), mLru, it);
+    return;
+  }
+
+  mLru.push_front(Entry{gopTimeUs, std::max(gopTimeUs, requestTimeUs), thumbnail});
+  mEntries[gopTimeUs] = mLru.begin();
+
+  while (mLru.size() > mMaxCachedGops) {
+    mEntries.erase(mLru.back().gopTimeUs);
+    mLru.pop_back();
+  }
+}
+
+void PreviewEngine::onMessageReceived(const std::shared_ptr<Message> &msg) {
+  switch (msg->what()) {
+    case kWhatInit:
+    {
+      onInit();
+      break;
+    }
+
+    case kWhatDecode:
+    {
+      onDecode();
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+void PreviewEngine::onDecode() {
+  int64_t timeUs;
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    mDecodePending = false;
+    timeUs = mPendingTimeUs;
+    EntryList::iterator it;
+    bool exact = false;
+    if (timeUs < 0 || (findEntry_l(timeUs, &it, &exact) && exact)) {
+      return;
+    }
+  }
+
+  // With a container index the GOP is known without decoding; if it is
+  // already cached, only its coverage needs to grow.
+  int64_t syncTimeUs;
+  if (mExtractor->getSyncSampleTimeUs(timeUs, &syncTimeUs) == OK) {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    auto found = mEntries.find(syncTimeUs);
+    if (found != mEntries.end()) {
+      insertEntry_l(syncTimeUs, timeUs, found->second->thumbnail);
+      notifyThumbnailAvailable(syncTimeUs);
+      return;
+    }
+  }
+
+  Thumbnail thumbnail;
+  int64_t startUs = Looper::GetNowUs();
+  status_t err = decodeSyncSample(timeUs, &thumbnail);
+  if (err != OK) {
+    ALOGW("failed to decode preview at %lld us: %d", (long long)timeUs, err);
+    return;
+  }
+  ALOGV("preview for %lld us from sync sample %lld us took %lld us",
+        (long long)timeUs, (long long)thumbnail.timeUs,
+        (long long)(Looper::GetNowUs() - startUs));
+
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    insertEntry_l(thumbnail.timeUs, timeUs, thumbnail);
+  }
+  notifyThumbnailAvailable(thumbnail.timeUs);
+}
+
+void PreviewEngine::notifyThumbnailAvailable(int64_t gopTimeUs) {
+  if (mNotify != nullptr) {
+    std::shared_ptr<Message> notify = mNotify->dup();
+    notify->mArg1 = kWhatThumbnailAvailable;
+    notify->mArg2 = gopTimeUs;
+    notify->post();
+  }
+}
+
+status_t PreviewEngine::decodeSyncSample(int64_t timeUs, Thumbnail *thumbnail) {
+  status_t err = mExtractor->seek(timeUs, SEEK_PREVIOUS_SYNC);
+  if (err != OK) {
+    return err;
+  }
+
+  const int videoIndex = mExtractor->getVideoStreamIndex();
+  do {
+    err = mExtractor->read(mPacket, videoIndex);
+    if (err != OK) {
+      return err;
+    }
+  } while (!mPacket->isKeyFrame());
+
+  // The previous decode left the codec drained, reset it before feeding.
+  avcodec_flush_buffers(mCodecContext);
+  if (avcodec_send_packet(mCodecContext, mPacket->avPacket()) < 0) {
+    return ERROR_MALFORMED;
+  }
+  // Drain right away so decoders with a reorder delay return the picture
+  // without waiting for more input.
+  avcodec_send_packet(mCodecContext, nullptr);
+  if (avcodec_receive_frame(mCodecContext, mFrame) < 0) {
+    return ERROR_MALFORMED;
+  }
+
+  thumbnail->timeUs = mPacket->ptsUs >= 0 ? mPacket->ptsUs : mPacket->dtsUs;
+  err = convertFrame(thumbnail);
+  av_frame_unref(mFrame);
+  return err;
+}
+
+status_t PreviewEngine::convertFrame(Thumbnail *thumbnail) {
+  int32_t width = std::min(mMaxWidth, mFrame->width);
+  int32_t height = (int32_t)((int64_t)mFrame->height * width / mFrame->width) & ~1;
+  if (width <= 0 || height <= 0) {
+    return ERROR_MALFORMED;
+  }
+
+  mSwsContext = sws_getCachedContext(
+      mSwsContext,
+      mFrame->width, mFrame->height, (AVPixelFormat)mFrame->format,
+      width, height, AV_PIX_FMT_RGBA,
+      SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+  if (mSwsContext == nullptr) {
+    return ERROR_UNSUPPORTED;
+  }
+
+  int32_t stride = width * 4;
+  size_t size = (size_t)stride * height;
+  std::shared_ptr<uint8_t> data(static_cast<uint8_t*>(av_malloc(size)), av_free);
+  if (data == nullptr) {
+    return NO_MEMORY;
+  }
+
+  uint8_t *dst[4] = {data.get(), nullptr, nullptr, nullptr};
+  int dstStride[4] = {stride, 0, 0, 0};
+  sws_scale(mSwsContext, mFrame->data, mFrame->linesize, 0, mFrame->height, dst, dstStride);
+
+  thumbnail->width = width;
+  thumbnail->height = height;
+  thumbnail->stride = stride;
+  thumbnail->data = data;
+  thumbnail->size = size;
+  return OK;
+}
+
+} // hpc
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "Handler.h"
+#include "Error.h"
+
+struct AVCodecContext;
+struct AVFrame;
+struct SwsContext;
+
+namespace hpc {
+
+struct Looper;
+struct Message;
+class FFmpegExtractor;
+class MediaPacket;
+
+// Seekbar thumbnails. The engine owns its own extractor and decoder so it
+// never touches the playback pipeline: it decodes sync samples only, at
+// reduced resolution, on a background priority looper, and keeps the results
+// in an LRU keyed by the GOP (sync sample time) they belong to.
+class PreviewEngine : public Handler {
+ public:
+  enum {
+    kWhatThumbnailAvailable = 'thmA',
+  };
+
+  struct Thumbnail {
+    int64_t timeUs {-1};  // time of the sync sample the picture was decoded from
+    int32_t width {0};
+    int32_t height {0};
+    int32_t stride {0};   // RGBA, bytes per row
+    std::shared_ptr<uint8_t> data;
+    size_t size {0};
+  };
+
+  // |notify| is posted with mArg1 = kWhatThumbnailAvailable and
+  // mArg2 = the GOP time whenever a refined thumbnail lands in the cache.
+  explicit PreviewEngine(const std::shared_ptr<Message> &notify);
+  virtual ~PreviewEngine();
+
+  PreviewEngine(const PreviewEngine &) = delete;
+  PreviewEngine &operator=(const PreviewEngine &) = delete;
+
+  // Starts the preview looper and opens |url| and its decoder there, the
+  // caller never waits for the network or the codec.
+  status_t initAsync(const char *url, int32_t maxWidth = 160, size_t maxCachedGops = 64);
+
+  // Returns the cached thumbnail nearest to |timeUs| without blocking. If the
+  // GOP covering |timeUs| is not cached yet, a decode is scheduled and the
+  // client is notified once it is available. Returns NAME_NOT_FOUND when
+  // nothing is cached yet, WOULD_BLOCK while initAsync() is still opening,
+  // the request is served once it is done.
+  status_t getThumbnail(int64_t timeUs, Thumbnail *thumbnail);
+
+  void release();
+
+ protected:
+  void onMessageReceived(const std::shared_ptr<Message> &msg) override;
+
+ private:
+  enum {
+    kWhatInit   = 'init',
+    kWhatDecode = 'deco',
+  };
+
+  enum State {
+    kStateIdle,
+    kStateOpening,
+    kStateReady,
+    kStateError,
+  };
+
+  struct Entry {
+    int64_t gopTimeUs;
+    // largest request time known to resolve to this GOP, used to answer
+    // lookups when the container has no index.
+    int64_t coveredUntilUs;
+    Thumbnail thumbnail;
+  };
+  typedef std::list<Entry> EntryList;
+
+  std::shared_ptr<Message> mNotify;
+  std::shared_ptr<Looper> mLooper;
+  std::string mUrl;
+  std::unique_ptr<FFmpegExtractor> mExtractor;
+  std::unique_ptr<MediaPacket> mPacket;
+  AVCodecContext *mCodecContext {nullptr};
+  AVFrame *mFrame {nullptr};
+  SwsContext *mSwsContext {nullptr};
+  int32_t mMaxWidth {0};
+
+  std::mutex mLock;  // guards everything below.
+  State mState {kStateIdle};
+  status_t mInitError {OK};
+  EntryList mLru;    // most recently used first
+  std::map<int64_t, EntryList::iterator> mEntries;
+  size_t mMaxCachedGops {0};
+  int64_t mPendingTimeUs {-1};
+  bool mDecodePending {false};
+
+  bool findEntry_l(int64_t timeUs, EntryList::iterator *it, bool *exact);
+  void insertEntry_l(int64_t gopTimeUs, int64_t requestTimeUs, const Thumbnail &thumbnail);
+
+  void onInit();
+  status_t openDecoder();
+  void onDecode();
+  void notifyThumbnailAvailable(int64_t gopTimeUs);
+  status_t decodeSyncSample(int64_t timeUs, Thumbnail *thumbnail);
+  status_t convertFrame(Thumbnail *thumbnail);
+  void freeDecoder();
+};
+
+} // hpc
@@ -0,0 +1,380 @@
+#include "ReverseDecoder.h"
+#include "FFmpegExtractor.h"
+#include "MediaPacket.h"
+#include "Looper.h"
+#include "Log.h"
+
+#include <algorithm>
+
+extern "C" {
+#include "libavutil/imgutils.h"
+#include "libswresample/swresample.h"
+}
+
+#define LOG_TAG "ReverseDecoder"
+
+namespace hpc {
+
+static const AVRational kMicrosTimeBase = {1, 1000000};
+
+ReverseDecoder::ReverseDecoder() {
+}
+
+ReverseDecoder::~ReverseDecoder() {
+  release();
+}
+
+status_t ReverseDecoder::init(const char *url, bool reverseAudio,
+                              size_t maxStackBytes, int64_t audioChunkUs) {
+  if (mVideo.extractor != nullptr) {
+    return INVALID_OPERATION;
+  }
+  mMaxStackBytes = maxStackBytes;
+  mAudioChunkUs = audioChunkUs;
+
+  status_t err = openTrack(url, false /* audio */, &mVideo);
+  if (err != OK) {
+    ALOGE("failed to open %s for reverse playback: %d", url, err);
+    release();
+    return err;
+  }
+  if (reverseAudio) {
+    // Audio seeks back and forth on its own schedule, a second extractor
+    // keeps it from moving the video one.
+    err = openTrack(url, true /* audio */, &mAudio);
+    if (err == OK) {
+      const AVCodecContext *context = mAudio.context;
+      int64_t layout = context->channel_layout != 0
+          ? (int64_t)context->channel_layout : av_get_default_channel_layout(context->channels);
+      mSwr = swr_alloc_set_opts(
+          nullptr, layout, AV_SAMPLE_FMT_S16, context->sample_rate,
+          layout, context->sample_fmt, context->sample_rate, 0, nullptr);
+      if (mSwr == nullptr || swr_init(mSwr) < 0) {
+        err = ERROR_UNSUPPORTED;
+      }
+    }
+    if (err != OK) {
+      // Reverse video is still useful, play it muted.
+      ALOGW("cannot reverse audio (%d), muting it", err);
+      swr_free(&mSwr);
+      closeTrack(&mAudio);
+    }
+  }
+
+  std::lock_guard<std::mutex> autoLock(mStatsLock);
+  mStats = Stats();
+  mStats.maxStackBytes = mMaxStackBytes;
+  return OK;
+}
+
+status_t ReverseDecoder::openTrack(const char *url, bool audio, Track *track) {
+  track->extractor = std::make_unique<FFmpegExtractor>();
+  status_t err = track->extractor->init(url);
+  if (err != OK) {
+    return err;
+  }
+  FFmpegExtractor *extractor = track->extractor.get();
+  track->index = audio ? extractor->getAudioStreamIndex() : extractor->getVideoStreamIndex();
+  if (track->index < 0) {
+    return ERROR_UNSUPPORTED;
+  }
+  // The demuxer skips the payload of the other track.
+  int other = audio ? extractor->getVideoStreamIndex() : extractor->getAudioStreamIndex();
+  if (other >= 0) {
+    extractor->selectTrack(other, false);
+  }
+
+  AVStream *stream = extractor->getStream(track->index);
+  const AVCodec *codec = avcodec_find_decoder(stream->codecpar->codec_id);
+  if (codec == nullptr) {
+    return ERROR_UNSUPPORTED;
+  }
+  track->context = avcodec_alloc_context3(codec);
+  if (track->context == nullptr
+      || avcodec_parameters_to_context(track->context, stream->codecpar) < 0) {
+    return NO_MEMORY;
+  }
+  track->context->pkt_timebase = stream->time_base;
+  if (!audio) {
+    // Unlike stepping, reverse playback is bound by throughput: a whole GOP
+    // is decoded in one go, so the delay of frame threading is paid once
+    // per fill, not per frame.
+    track->context->thread_count = 0;
+    track->context->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  }
+  if (avcodec_open2(track->context, codec, nullptr) < 0) {
+    return ERROR_UNSUPPORTED;
+  }
+  return OK;
+}
+
+// static
+void ReverseDecoder::closeTrack(Track *track) {
+  if (track->context != nullptr) {
+    avcodec_free_context(&track->context);
+  }
+  if (track->extractor != nullptr) {
+    track->extractor->release();
+    track->extractor.reset();
+  }
+  track->index = -1;
+  track->inputEOS = false;
+}
+
+void ReverseDecoder::release() {
+  mStack.clear();
+  mStackBytes = 0;
+  mSplit = false;
+  mVideoEndUs = -1;
+  mAudioEndUs = -1;
+  mCurrentUs = -1;
+  swr_free(&mSwr);
+  closeTrack(&mVideo);
+  closeTrack(&mAudio);
+  mPacket.reset();
+}
+
+ReverseDecoder::Stats ReverseDecoder::getStats() const {
+  std::lock_guard<std::mutex> autoLock(mStatsLock);
+  return mStats;
+}
+
+status_t ReverseDecoder::seekTo(int64_t timeUs) {
+  if (mVideo.context == nullptr) {
+    return NO_INIT;
+  }
+  mStack.clear();
+  mStackBytes = 0;
+  mSplit = false;
+  mVideoEndUs = std::max<int64_t>(timeUs, 0) + 1;
+  mAudioEndUs = std::max<int64_t>(timeUs, 0);
+  mCurrentUs = -1;
+  return OK;
+}
+
+status_t ReverseDecoder::restartDecodeAt(Track *track, int64_t timeUs) {
+  status_t err = track->extractor->seek(std::max<int64_t>(timeUs, 0), SEEK_PREVIOUS_SYNC);
+  if (err != OK) {
+    return err;
+  }
+  avcodec_flush_buffers(track->context);
+  track->inputEOS = false;
+  return OK;
+}
+
+status_t ReverseDecoder::pullFrame(Track *track, AVFrame *frame, int64_t *timeUs) {
+  for (;;) {
+    int ret = avcodec_receive_frame(track->context, frame);
+    if (ret == 0) {
+      break;
+    } else if (ret == AVERROR_EOF) {
+      return ERROR_END_OF_STREAM;
+    } else if (ret != AVERROR(EAGAIN)) {
+      return ERROR_MALFORMED;
+    }
+
+    status_t err = track->inputEOS
+        ? ERROR_END_OF_STREAM : track->extractor->read(mPacket, track->index);
+    if (err == ERROR_END_OF_STREAM) {
+      if (!track->inputEOS) {
+        track->inputEOS = true;
+        // drain the reorder queue.
+        avcodec_send_packet(track->context, nullptr);
+        continue;
+      }
+      return ERROR_END_OF_STREAM;
+    } else if (err != OK) {
+      return err;
+    }
+    if (avcodec_send_packet(track->context, mPacket->avPacket()) < 0) {
+      ALOGW("dropping undecodable packet at %lld us", (long long)mPacket->ptsUs);
+    }
+  }
+
+  int64_t pts = frame->best_effort_timestamp;
+  *timeUs = pts == AV_NOPTS_VALUE
+      ? -1 : av_rescale_q(pts, track->context->pkt_timebase, kMicrosTimeBase);
+  return OK;
+}
+
+// Decodes from the sync sample before mVideoEndUs up to it. Only the frames
+// closest to mVideoEndUs that fit in mMaxStackBytes are kept.
+status_t ReverseDecoder::fillStack() {
+  int64_t startUs = Looper::GetNowUs();
+  const bool split = mSplit;
+  int64_t decoded = 0;
+  for (int64_t backoffUs = 0;; backoffUs = backoffUs == 0 ? kSeekBackoffUs : 2 * backoffUs) {
+    const int64_t targetUs = mVideoEndUs - 1 - backoffUs;
+    status_t err = restartDecodeAt(&mVideo, targetUs);
+    if (err != OK) {
+      return err;
+    }
+
+    mSplit = false;
+    for (;;) {
+      AVFrame *frame = av_frame_alloc();
+      if (frame == nullptr) {
+        return NO_MEMORY;
+      }
+      std::shared_ptr<AVFrame> holder(frame, [](AVFrame *f) { av_frame_free(&f); });
+      int64_t timeUs;
+      err = pullFrame(&mVideo, frame, &timeUs);
+      if (err == ERROR_END_OF_STREAM) {
+        break;
+      } else if (err != OK) {
+        return err;
+      }
+      ++decoded;
+      if (timeUs < 0) {
+        continue;
+      }
+      if (timeUs >= mVideoEndUs) {
+        break;
+      }
+
+      int bytes = av_image_get_buffer_size(
+          (AVPixelFormat)frame->format, frame->width, frame->height, 1);
+      mStack.push_back(StackFrame{timeUs, bytes > 0 ? (size_t)bytes : 0, holder});
+      mStackBytes += mStack.back().bytes;
+      while (mStackBytes > mMaxStackBytes && mStack.size() > 1) {
+        mStackBytes -= mStack.front().bytes;
+        mStack.pop_front();
+        mSplit = true;
+      }
+    }
+    if (!mStack.empty() || targetUs <= 0) {
+      break;
+    }
+  }
+  if (mStack.empty()) {
+    return ERROR_END_OF_STREAM;
+  }
+  mVideoEndUs = mStack.front().timeUs;
+
+  int64_t elapsedUs = Looper::GetNowUs() - startUs;
+  std::lock_guard<std::mutex> autoLock(mStatsLock);
+  ++mStats.gopDecodes;
+  if (split) {
+    ++mStats.splitDecodes;
+  }
+  mStats.framesDecoded += decoded;
+  mStats.lastFillUs = elapsedUs;
+  mStats.maxFillUs = std::max(mStats.maxFillUs, elapsedUs);
+  mStats.totalFillUs += elapsedUs;
+  mStats.peakStackBytes = std::max(mStats.peakStackBytes, mStackBytes);
+  ALOGV("filled %zu frames / %zu bytes before %lld us in %lld us (%lld decoded)",
+        mStack.size(), mStackBytes, (long long)mVideoEndUs, (long long)elapsedUs,
+        (long long)decoded);
+  return OK;
+}
+
+status_t ReverseDecoder::nextFrame(Frame *frame) {
+  if (mVideo.context == nullptr || mVideoEndUs < 0) {
+    return NO_INIT;
+  }
+  if (mStack.empty()) {
+    status_t err = fillStack();
+    if (err != OK) {
+      return err;
+    }
+  }
+
+  const StackFrame &top = mStack.back();
+  mCurrentUs = top.timeUs;
+  if (frame != nullptr) {
+    frame->timeUs = top.timeUs;
+    frame->frame = top.frame;
+  }
+  mStackBytes -= top.bytes;
+  mStack.pop_back();
+
+  std::lock_guard<std::mutex> autoLock(mStatsLock);
+  ++mStats.framesOut;
+  mStats.stackFrames = mStack.size();
+  mStats.stackBytes = mStackBytes;
+  return OK;
+}
+
+// Frames are picked by their start time, in [startUs, mAudioEndUs), so
+// consecutive chunks share no frame and leave none out.
+status_t ReverseDecoder::decodeAudioChunk(int64_t startUs, AudioChunk *chunk) {
+  status_t err = restartDecodeAt(&mAudio, startUs);
+  if (err != OK) {
+    return err;
+  }
+  AVFrame *frame = av_frame_alloc();
+  if (frame == nullptr) {
+    return NO_MEMORY;
+  }
+  std::shared_ptr<AVFrame> holder(frame, [](AVFrame *f) { av_frame_free(&f); });
+
+  const int32_t channels = mAudio.context->channels;
+  chunk->sampleRate = mAudio.context->sample_rate;
+  chunk->channels = channels;
+  chunk->samples.clear();
+  chunk->startUs = -1;
+  chunk->endUs = -1;
+  for (;;) {
+    int64_t timeUs;
+    err = pullFrame(&mAudio, frame, &timeUs);
+    if (err == ERROR_END_OF_STREAM) {
+      break;
+    } else if (err != OK) {
+      return err;
+    }
+    if (timeUs >= mAudioEndUs) {
+      break;
+    }
+    if (timeUs < startUs || frame->nb_samples <= 0) {
+      continue;
+    }
+    if (chunk->startUs < 0) {
+      chunk->startUs = timeUs;
+    }
+    chunk->endUs = timeUs + av_rescale(frame->nb_samples, 1000000, chunk->sampleRate);
+
+    size_t offset = chunk->samples.size();
+    chunk->samples.resize(offset + (size_t)frame->nb_samples * channels);
+    uint8_t *out = (uint8_t *)(chunk->samples.data() + offset);
+    int converted = swr_convert(mSwr, &out, frame->nb_samples,
+                                (const uint8_t **)frame->extended_data, frame->nb_samples);
+    chunk->samples.resize(offset + (size_t)std::max(converted, 0) * channels);
+  }
+  return OK;
+}
+
+status_t ReverseDecoder::nextAudioChunk(AudioChunk *chunk) {
+  if (mAudio.context == nullptr) {
+    return INVALID_OPERATION;
+  }
+  if (mAudioEndUs <= 0) {
+    return ERROR_END_OF_STREAM;
+  }
+
+  for (int64_t lengthUs = mAudioChunkUs;; lengthUs *= 2) {
+    const int64_t startUs = std::max<int64_t>(mAudioEndUs - lengthUs, 0);
+    status_t err = decodeAudioChunk(startUs, chunk);
+    if (err != OK) {
+      return err;
+    }
+    if (!chunk->samples.empty()) {
+      break;
+    } else if (startUs == 0) {
+      return ERROR_END_OF_STREAM;
+    }
+  }
+
+  // Reverse whole sample frames, the channels of each stay in order.
+  const size_t channels = (size_t)chunk->channels;
+  for (size_t i = 0, j = chunk->samples.size() - channels; i < j; i += channels, j -= channels) {
+    std::swap_ranges(chunk->samples.begin() + i, chunk->samples.begin() + i + channels,
+                     chunk->samples.begin() + j);
+  }
+  mAudioEndUs = chunk->startUs;
+
+  std::lock_guard<std::mutex> autoLock(mStatsLock);
+  ++mStats.audioChunks;
+  return OK;
+}
+
+} // hpc
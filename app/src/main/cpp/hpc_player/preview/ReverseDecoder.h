@@ -0,0 +1,138 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Error.h"
+
+struct AVCodecContext;
+struct AVFrame;
+struct SwrContext;
+
+namespace hpc {
+
+class FFmpegExtractor;
+class MediaPacket;
+
+// Decoder side of reverse playback. Video is decoded GOP by GOP going
+// backwards: seek to the sync sample before the frames still to be shown,
+// decode forward into a stack, then hand the stack out top first. The stack
+// is bounded by |maxStackBytes|; a GOP larger than that is split, the later
+// part is shown first and the GOP is decoded again, up to where that part
+// started, for the earlier one. So memory stays bounded at the price of
+// re-decoding long GOPs.
+//
+// With |reverseAudio| the audio track is decoded the same way in chunks of
+// about |audioChunkUs|, converted to interleaved S16 and reversed sample by
+// sample. Chunks are cut on audio frame boundaries and tile the track
+// without gaps.
+//
+// Like FrameStepper it owns its extractors and decoders, so the forward
+// pipeline is left alone. Not thread safe except for getStats().
+class ReverseDecoder {
+ public:
+  struct Frame {
+    int64_t timeUs {-1};
+    std::shared_ptr<AVFrame> frame;
+  };
+
+  // Plays from endUs down to startUs: samples[0] is the last sample of the
+  // chunk in stream order.
+  struct AudioChunk {
+    int64_t startUs {-1};
+    int64_t endUs {-1};
+    int32_t sampleRate {0};
+    int32_t channels {0};
+    std::vector<int16_t> samples;  // interleaved
+  };
+
+  struct Stats {
+    int64_t framesOut {0};
+    int64_t framesDecoded {0};   // including the ones decoded again
+    int64_t gopDecodes {0};      // stack fills
+    int64_t splitDecodes {0};    // fills of a GOP split by the byte limit
+    int64_t lastFillUs {0};
+    int64_t maxFillUs {0};
+    int64_t totalFillUs {0};
+    size_t stackFrames {0};
+    size_t stackBytes {0};
+    size_t peakStackBytes {0};
+    size_t maxStackBytes {0};
+    int64_t audioChunks {0};
+  };
+
+  ReverseDecoder();
+  ~ReverseDecoder();
+
+  ReverseDecoder(const ReverseDecoder &) = delete;
+  ReverseDecoder &operator=(const ReverseDecoder &) = delete;
+
+  status_t init(const char *url, bool reverseAudio,
+                size_t maxStackBytes = 96 * 1024 * 1024, int64_t audioChunkUs = 500000);
+
+  // The next frame is the last one at or before |timeUs|, the next audio
+  // chunk ends at |timeUs|.
+  status_t seekTo(int64_t timeUs);
+
+  // Frames in decreasing time order, ERROR_END_OF_STREAM after the first one
+  // of the stream.
+  status_t nextFrame(Frame *frame);
+  // INVALID_OPERATION without |reverseAudio|.
+  status_t nextAudioChunk(AudioChunk *chunk);
+
+  bool hasAudio() const { return mAudio.context != nullptr; }
+  // Time of the last frame returned, -1 if none since the last seek.
+  int64_t getCurrentTimeUs() const { return mCurrentUs; }
+  Stats getStats() const;
+
+  void release();
+
+ private:
+  // Seeking before the frames to decode can land on a sync sample that is
+  // still too late, e.g. with an index keyed by dts. Fills step further back
+  // by this much, doubling every time, until they find something.
+  static const int64_t kSeekBackoffUs = 100000;
+
+  struct StackFrame {
+    int64_t timeUs;
+    size_t bytes;
+    std::shared_ptr<AVFrame> frame;
+  };
+
+  struct Track {
+    std::unique_ptr<FFmpegExtractor> extractor;
+    AVCodecContext *context {nullptr};
+    int index {-1};
+    bool inputEOS {false};
+  };
+
+  Track mVideo;
+  Track mAudio;
+  SwrContext *mSwr {nullptr};
+  std::unique_ptr<MediaPacket> mPacket;
+  int64_t mAudioChunkUs {0};
+
+  std::deque<StackFrame> mStack;  // increasing time, handed out from the back
+  size_t mStackBytes {0};
+  size_t mMaxStackBytes {0};
+  // frames before this time are still to come.
+  int64_t mVideoEndUs {-1};
+  int64_t mAudioEndUs {-1};
+  int64_t mCurrentUs {-1};
+  // the last fill dropped the head of its GOP to stay within the limit.
+  bool mSplit {false};
+
+  mutable std::mutex mStatsLock;
+  Stats mStats;
+
+  status_t openTrack(const char *url, bool audio, Track *track);
+  static void closeTrack(Track *track);
+  status_t restartDecodeAt(Track *track, int64_t timeUs);
+  status_t pullFrame(Track *track, AVFrame *frame, int64_t *timeUs);
+  status_t fillStack();
+  status_t decodeAudioChunk(int64_t startUs, AudioChunk *chunk);
+};
+
+} // hpc
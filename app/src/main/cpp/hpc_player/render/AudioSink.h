@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Error.h"
+
+namespace hpc {
+
+// Where the Renderer writes decoded audio: 16 bit interleaved PCM.
+class AudioSink {
+ public:
+  virtual ~AudioSink() = default;
+
+  virtual status_t Open(int sampleRate, int channels, int format) = 0;
+  // Takes a copy of |size| bytes. WOULD_BLOCK while the sink holds all it
+  // can; the renderer paces its writes on GetPlayedTimeUs() and rarely
+  // gets there.
+  virtual status_t Write(const void *data, size_t size) = 0;
+  virtual status_t Pause() = 0;
+  virtual status_t Resume() = 0;
+  // Drops what was written and not played yet, the played time starts
+  // over.
+  virtual status_t Flush() = 0;
+  virtual status_t Close() = 0;
+  // Audio played out since Open() or the last Flush().
+  virtual int64_t GetPlayedTimeUs() const = 0;
+};
+
+} // hpc
@@ -1,5 +0,0 @@
-//
-// Created by qianjiang on 2025/8/30.
-//
-
-#include "MediaCodecVideoRenderer.h"
@@ -1,5 +1,6 @@
 #include "OpenSLAudioSink.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 
@@ -17,6 +18,10 @@ status_t OpenSLAudioSink::Open(int sampleRate, int channels, int format) {
 
   mSampleRate = sampleRate;
   mChannels = channels;
+  mNextBuffer = 0;
+  mQueuedBuffers = 0;
+  mWrittenFrames = 0;
+  mPaused = false;
   return Initialize(sampleRate, channels, format);
 }
 
@@ -52,7 +57,7 @@ status_t OpenSLAudioSink::Initialize(int sampleRate, int channels, int format) {
 
   // Configure audio player with buffer queue
   SLDataLocator_AndroidSimpleBufferQueue bufferQueue = {
-      SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, 2};  // 2 buffers
+      SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, kNumBuffers};
   SLDataFormat_PCM pcmFormat = {
       SL_DATAFORMAT_PCM,
       static_cast<SLuint32>(channels),
@@ -113,16 +118,21 @@ status_t OpenSLAudioSink::Initialize(int sampleRate, int channels, int format) {
 
 status_t OpenSLAudioSink::Write(const void* data, size_t size) {
   std::lock_guard<std::mutex> lock(mMutex);
-  if (!mInitialized) return ERROR_INVALID_FORMAT;
-
-  // Enqueue buffer to OpenSL ES
-  SLresult result = (*mBufferQueue)->Enqueue(mBufferQueue, data, size);
-  if (result != SL_RESULT_SUCCESS) {
+  if (!mInitialized) return NO_INIT;
+  if (mQueuedBuffers == kNumBuffers) return WOULD_BLOCK;
+
+  // OpenSL ES reads the buffer while it plays, keep a copy until then.
+  std::vector<uint8_t>& buffer = mBuffers[mNextBuffer];
+  buffer.assign(static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+  SLresult result = (*mBufferQueue)->Enqueue(mBufferQueue, buffer.data(), buffer.size());
+  if (result == SL_RESULT_BUFFER_INSUFFICIENT) {
+    return WOULD_BLOCK;
+  } else if (result != SL_RESULT_SUCCESS) {
     return ERROR_UNKNOWN;
   }
-
-  // Update played samples (assuming 16-bit PCM)
-  mPlayedSamples += size / (mChannels * 2);  // 2 bytes per sample
+  mNextBuffer = (mNextBuffer + 1) % kNumBuffers;
+  ++mQueuedBuffers;
+  mWrittenFrames += size / (mChannels * 2);  // 16 bit PCM
   return OK;
 }
 
@@ -131,6 +141,7 @@ status_t OpenSLAudioSink::Pause() {
   if (!mInitialized) return OK;
 
   SLresult result = (*mPlayer)->SetPlayState(mPlayer, SL_PLAYSTATE_PAUSED);
+  mPaused = true;
   return result == SL_RESULT_SUCCESS ? OK : ERROR_UNKNOWN;
 }
 
@@ -139,6 +150,22 @@ status_t OpenSLAudioSink::Resume() {
   if (!mInitialized) return OK;
 
   SLresult result = (*mPlayer)->SetPlayState(mPlayer, SL_PLAYSTATE_PLAYING);
+  mPaused = false;
+  return result == SL_RESULT_SUCCESS ? OK : ERROR_UNKNOWN;
+}
+
+status_t OpenSLAudioSink::Flush() {
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (!mInitialized) return OK;
+
+  // Stopping rewinds the position GetPlayedTimeUs() reads.
+  (*mPlayer)->SetPlayState(mPlayer, SL_PLAYSTATE_STOPPED);
+  (*mBufferQueue)->Clear(mBufferQueue);
+  mNextBuffer = 0;
+  mQueuedBuffers = 0;
+  mWrittenFrames = 0;
+  SLresult result = (*mPlayer)->SetPlayState(
+      mPlayer, mPaused ? SL_PLAYSTATE_PAUSED : SL_PLAYSTATE_PLAYING);
   return result == SL_RESULT_SUCCESS ? OK : ERROR_UNKNOWN;
 }
 
@@ -146,19 +173,32 @@ status_t OpenSLAudioSink::Close() {
   std::lock_guard<std::mutex> lock(mMutex);
   Cleanup();
   mInitialized = false;
-  mPlayedSamples = 0;
+  mQueuedBuffers = 0;
+  mWrittenFrames = 0;
   return OK;
 }
 
 int64_t OpenSLAudioSink::GetPlayedTimeUs() const {
   std::lock_guard<std::mutex> lock(mMutex);
   if (!mInitialized || mSampleRate == 0) return 0;
-  return (mPlayedSamples * 1000000LL) / mSampleRate;
+  SLmillisecond positionMs = 0;
+  if ((*mPlayer)->GetPosition(mPlayer, &positionMs) != SL_RESULT_SUCCESS) {
+    return 0;
+  }
+  // The position may run ahead of what was written while starved.
+  int64_t writtenUs = (mWrittenFrames * 1000000LL) / mSampleRate;
+  return std::min<int64_t>((int64_t)positionMs * 1000, writtenUs);
 }
 
 void OpenSLAudioSink::BufferQueueCallback(SLAndroidSimpleBufferQueueItf bufferQueue, void* context) {
-  // Empty callback; used to signal buffer completion
-  // Actual buffer management handled by AudioRenderer
+  static_cast<OpenSLAudioSink*>(context)->OnBufferDone();
+}
+
+void OpenSLAudioSink::OnBufferDone() {
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (mQueuedBuffers > 0) {
+    --mQueuedBuffers;
+  }
 }
 
 void OpenSLAudioSink::Cleanup() {
@@ -179,4 +219,4 @@ void OpenSLAudioSink::Cleanup() {
   }
 }
 
-}  // namespace hpc
\ No newline at end of file
+}  // namespace hpc
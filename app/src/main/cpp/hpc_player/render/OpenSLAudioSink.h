@@ -1,5 +1,3 @@
-c++
-c++
 #ifndef HPC_PLAYER_OPENSL_AUDIO_SINK_H_
 #define HPC_PLAYER_OPENSL_AUDIO_SINK_H_
 
@@ -8,23 +6,26 @@ extern "C" {
 #include <SLES/OpenSLES_Android.h>
 }
 
-#include <memory>
+#include <cstdint>
 #include <mutex>
+#include <vector>
 
-#include "Rendered.h"
 #include "AudioSink.h"
 
 namespace hpc {
 
+// An OpenSL ES buffer queue player. Write() copies into one of kNumBuffers
+// slots and enqueues it, the callback frees the slot once it played.
 class OpenSLAudioSink : public AudioSink {
  public:
   OpenSLAudioSink();
   ~OpenSLAudioSink() override;
 
-  status_t Open(int sample_rate, int channels, int format) override;
+  status_t Open(int sampleRate, int channels, int format) override;
   status_t Write(const void* data, size_t size) override;
   status_t Pause() override;
   status_t Resume() override;
+  status_t Flush() override;
   status_t Close() override;
   int64_t GetPlayedTimeUs() const override;
 
@@ -32,28 +33,35 @@ class OpenSLAudioSink : public AudioSink {
   OpenSLAudioSink& operator=(const OpenSLAudioSink&) = delete;
 
  private:
-  status_t Initialize(int sample_rate, int channels, int format);
-  static void BufferQueueCallback(SLAndroidSimpleBufferQueueItf buffer_queue,
+  static const size_t kNumBuffers = 16;
+
+  status_t Initialize(int sampleRate, int channels, int format);
+  static void BufferQueueCallback(SLAndroidSimpleBufferQueueItf bufferQueue,
                                   void* context);
+  void OnBufferDone();
   void Cleanup();
 
   // OpenSL ES objects
   SLObjectItf mEngineObject = nullptr;
-  SLEngineItf mEngineEngine = nullptr; // Or mSlEngineInterface
+  SLEngineItf mEngine = nullptr;
   SLObjectItf mOutputMixObject = nullptr;
   SLObjectItf mPlayerObject = nullptr;
-  SLPlayItf mPlayerPlay = nullptr;     // Or mSlPlayInterface
-  SLAndroidSimpleBufferQueueItf mPlayerBufferQueue = nullptr; // Or mSlBufferQueueInterface
+  SLPlayItf mPlayer = nullptr;
+  SLAndroidSimpleBufferQueueItf mBufferQueue = nullptr;
 
   // Audio stream metadata
   int mSampleRate = 0;
   int mChannels = 0;
-  int64_t mPlayedSamples = 0;
 
   mutable std::mutex mMutex;
   bool mInitialized = false;
+  bool mPaused = false;
+  std::vector<uint8_t> mBuffers[kNumBuffers];
+  size_t mNextBuffer = 0;     // slot the next Write() fills
+  size_t mQueuedBuffers = 0;  // enqueued, not played yet
+  int64_t mWrittenFrames = 0; // since Open() or Flush()
 };
 
 }  // namespace hpc
 
-#endif  // HPC_PLAYER_OPENSL_AUDIO_SINK_H_
\ No newline at end of file
+#endif  // HPC_PLAYER_OPENSL_AUDIO_SINK_H_
@@ -0,0 +1,567 @@
+#include "Renderer.h"
+
+#include <algorithm>
+
+#include "AudioSink.h"
+#include "Log.h"
+#include "Looper.h"
+#include "MediaClock.h"
+#include "Surface.h"
+#include "decoder/DecoderBase.h"
+
+#define LOG_TAG "Renderer"
+
+namespace hpc {
+
+Renderer::Renderer(const std::shared_ptr<AudioSink> &sink,
+                   const std::shared_ptr<MediaClock> &mediaClock,
+                   const std::shared_ptr<Message> &notify,
+                   bool freeRunning)
+    : mAudioSink(sink),
+      mMediaClock(mediaClock),
+      mNotify(notify),
+      mFreeRunning(freeRunning) {
+  // paused until resume(), the clock stands still with it
+  mMediaClock->setPlaybackRate(0.0f);
+}
+
+Renderer::~Renderer() {
+  if (mAudioSink != nullptr && mSinkSampleRate > 0) {
+    mAudioSink->Close();
+  }
+}
+
+void Renderer::setSurface(const std::shared_ptr<Surface> &surface) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mSurface = surface;
+}
+
+void Renderer::setPlaybackStats(const std::shared_ptr<PlaybackStats> &stats) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mStats = stats;
+}
+
+void Renderer::queueBuffer(bool audio, const std::shared_ptr<MediaBuffer> &buffer) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (audio && mReverseAudio) {
+    return;
+  }
+  QueueEntry entry;
+  entry.buffer = buffer;
+  mQueue[audio].push_back(std::move(entry));
+  postDrain_l(audio);
+}
+
+void Renderer::queueEOS(bool audio, status_t finalResult) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (audio && mReverseAudio) {
+    return;
+  }
+  QueueEntry entry;
+  entry.finalResult = finalResult;
+  mQueue[audio].push_back(std::move(entry));
+  postDrain_l(audio);
+}
+
+bool Renderer::needsMoreData(bool audio) const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  return mQueue[audio].size() < (audio ? kMaxQueuedAudioBuffers : kMaxQueuedVideoFrames);
+}
+
+void Renderer::flush(bool audio) {
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    // A drain already running sees the generation change and leaves the
+    // queue alone, the ones posted are stale.
+    if (!audio || !mReverseAudio) {
+      mQueue[audio].clear();
+      ++mDrainGeneration[audio];
+      mDrainPending[audio] = false;
+    }
+  }
+  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatFlush, shared_from_this());
+  msg->setInt(audio ? 1 : 0);
+  msg->post();
+}
+
+void Renderer::renderStill(const std::shared_ptr<MediaBuffer> &buffer) {
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    mPendingStill = buffer;
+  }
+  std::make_shared<Message>(kWhatRenderStill, shared_from_this())->post();
+}
+
+void Renderer::setReverseAudio(bool reverse, bool playing) {
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    if (reverse != mReverseAudio) {
+      mReverseAudio = reverse;
+      mQueue[true].clear();
+      ++mDrainGeneration[true];
+      mDrainPending[true] = false;
+      std::make_shared<Message>(kWhatFlushSink, shared_from_this())->post();
+    }
+  }
+  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatSetReverse, shared_from_this());
+  msg->mArg1 = reverse ? 1 : 0;
+  msg->mArg2 = playing ? 1 : 0;
+  msg->post();
+}
+
+void Renderer::queueReverseAudio(const std::shared_ptr<MediaBuffer> &buffer) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (!mReverseAudio) {
+    return;  // playback went forward meanwhile
+  }
+  QueueEntry entry;
+  entry.buffer = buffer;
+  mQueue[true].push_back(std::move(entry));
+  postDrain_l(true /* audio */);
+}
+
+void Renderer::flushReverseAudio() {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (!mReverseAudio) {
+    return;
+  }
+  mQueue[true].clear();
+  ++mDrainGeneration[true];
+  mDrainPending[true] = false;
+  std::make_shared<Message>(kWhatFlushSink, shared_from_this())->post();
+}
+
+void Renderer::pause() {
+  std::make_shared<Message>(kWhatPause, shared_from_this())->post();
+}
+
+void Renderer::resume() {
+  std::make_shared<Message>(kWhatResume, shared_from_this())->post();
+}
+
+void Renderer::setPlaybackRate(float rate) {
+  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatSetRate, shared_from_this());
+  msg->setInt((int64_t)(rate * 1000));
+  msg->post();
+}
+
+void Renderer::postDrain_l(bool audio, int64_t delayUs) {
+  if (mDrainPending[audio]) {
+    return;
+  }
+  mDrainPending[audio] = true;
+  std::shared_ptr<Message> msg =
+      std::make_shared<Message>(audio ? kWhatDrainAudio : kWhatDrainVideo, shared_from_this());
+  msg->setInt(mDrainGeneration[audio]);
+  msg->post(delayUs);
+}
+
+bool Renderer::popEntry(bool audio, int32_t generation) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (generation != mDrainGeneration[audio] || mQueue[audio].empty()) {
+    return false;  // flushed meanwhile
+  }
+  mQueue[audio].pop_front();
+  return true;
+}
+
+void Renderer::onMessageReceived(const std::shared_ptr<Message> &msg) {
+  switch (msg->what()) {
+    case kWhatDrainAudio:
+    case kWhatDrainVideo:
+    {
+      bool audio = msg->what() == kWhatDrainAudio;
+      {
+        std::lock_guard<std::mutex> autoLock(mLock);
+        if (msg->mArg1 != mDrainGeneration[audio]) {
+          break;
+        }
+        mDrainPending[audio] = false;
+      }
+      if (audio) {
+        onDrainAudio();
+      } else {
+        onDrainVideo();
+      }
+      break;
+    }
+
+    case kWhatFlush:
+    {
+      onFlush(msg->mArg1 != 0);
+      break;
+    }
+
+    case kWhatPause:
+    {
+      if (mPaused) {
+        break;
+      }
+      mPaused = true;
+      if (mAudioSink != nullptr && mSinkSampleRate > 0 && !mReverseAudioPlaying) {
+        mAudioSink->Pause();
+      }
+      mMediaClock->setPlaybackRate(0.0f);
+      break;
+    }
+
+    case kWhatResume:
+    {
+      if (!mPaused) {
+        break;
+      }
+      mPaused = false;
+      mMediaRenderingStarted = false;
+      if (mAudioSink != nullptr && mSinkSampleRate > 0) {
+        mAudioSink->Resume();
+      }
+      mMediaClock->setPlaybackRate(mPlaybackRate);
+      std::lock_guard<std::mutex> autoLock(mLock);
+      postDrain_l(true /* audio */);
+      postDrain_l(false /* audio */);
+      break;
+    }
+
+    case kWhatSetRate:
+    {
+      mPlaybackRate = msg->mArg1 / 1000.0f;
+      if (!mPaused) {
+        mMediaClock->setPlaybackRate(mPlaybackRate);
+      }
+      break;
+    }
+
+    case kWhatRenderStill:
+    {
+      onRenderStill();
+      break;
+    }
+
+    case kWhatSetReverse:
+    {
+      onSetReverseAudio(msg->mArg1 != 0, msg->mArg2 != 0);
+      break;
+    }
+
+    case kWhatFlushSink:
+    {
+      flushAudioSink();
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+void Renderer::onFlush(bool audio) {
+  bool reverseAudio;
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    reverseAudio = mReverseAudio;
+  }
+  if (audio && reverseAudio) {
+    // the decoder's audio is not here, the reverse audio stays
+  } else if (audio) {
+    flushAudioSink();
+    mAudioEOS = false;
+    if (!mHasVideo) {
+      mMediaClock->clearAnchor();
+    }
+  } else {
+    // The first frame out of the flushed decoder anchors the clock again,
+    // unless audio does it first.
+    mVideoRenderingStarted = false;
+    mMediaClock->clearAnchor();
+  }
+  notify(kWhatFlushComplete, audio);
+}
+
+void Renderer::flushAudioSink() {
+  if (mAudioSink != nullptr && mSinkSampleRate > 0) {
+    mAudioSink->Flush();
+  }
+  mAudioAnchorMediaUs = -1;
+  mAudioWrittenFrames = 0;
+}
+
+void Renderer::onSetReverseAudio(bool reverse, bool playing) {
+  mReverseAudioPlaying = reverse && playing;
+  if (mAudioSink != nullptr && mSinkSampleRate > 0) {
+    if (mReverseAudioPlaying || (!reverse && !mPaused)) {
+      mAudioSink->Resume();
+    } else {
+      mAudioSink->Pause();
+    }
+  }
+  if (mReverseAudioPlaying) {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    postDrain_l(true /* audio */);
+  }
+}
+
+int64_t Renderer::audioWrittenUs() const {
+  if (mSinkSampleRate <= 0) {
+    return 0;
+  }
+  return mAudioWrittenFrames * 1000000LL / mSinkSampleRate;
+}
+
+void Renderer::updateAudioClock() {
+  if (mAudioAnchorMediaUs < 0 || mAudioEOS || mPlaybackRate != 1.0f || mReverseAudioPlaying) {
+    return;
+  }
+  int64_t nowUs = Looper::GetNowUs();
+  int64_t playedUs = mAudioSink->GetPlayedTimeUs();
+  mMediaClock->updateAnchor(mAudioAnchorMediaUs + playedUs, nowUs,
+                            mAudioAnchorMediaUs + audioWrittenUs());
+}
+
+void Renderer::onDrainAudio() {
+  if (mAudioSink == nullptr) {
+    return;
+  }
+
+  // Reverse audio plays while the renderer is paused for the forward
+  // pipeline.
+  bool waiting = false;
+  while (!mPaused || mReverseAudioPlaying) {
+    QueueEntry entry;
+    int32_t generation;
+    {
+      std::lock_guard<std::mutex> autoLock(mLock);
+      if (mQueue[true].empty()) {
+        break;
+      }
+      entry = mQueue[true].front();
+      generation = mDrainGeneration[true];
+    }
+
+    const std::shared_ptr<MediaBuffer> &buffer = entry.buffer;
+    if (buffer == nullptr) {
+      // EOS once what was written played out
+      if (mAudioAnchorMediaUs >= 0 && mAudioSink->GetPlayedTimeUs() < audioWrittenUs()) {
+        waiting = true;
+        break;
+      }
+      if (!popEntry(true, generation)) {
+        break;
+      }
+      mAudioEOS = true;
+      // video may be longer, the clock runs on without audio
+      mMediaClock->updateMaxTimeMedia(INT64_MAX);
+      notify(kWhatEOS, true, entry.finalResult);
+      continue;
+    }
+
+    if (mPlaybackRate != 1.0f || buffer->size == 0 || buffer->channelCount <= 0) {
+      // not played at this rate
+      popEntry(true, generation);
+      continue;
+    }
+
+    if (buffer->sampleRate != mSinkSampleRate || buffer->channelCount != mSinkChannelCount) {
+      if (mSinkSampleRate > 0) {
+        mAudioSink->Close();
+      }
+      status_t err = mAudioSink->Open(buffer->sampleRate, buffer->channelCount, 16);
+      if (err != OK) {
+        ALOGE("failed to open audio sink %d Hz, %d channels: %d",
+              buffer->sampleRate, buffer->channelCount, err);
+        mSinkSampleRate = 0;
+        mSinkChannelCount = 0;
+        popEntry(true, generation);
+        continue;
+      }
+      mSinkSampleRate = buffer->sampleRate;
+      mSinkChannelCount = buffer->channelCount;
+      mAudioAnchorMediaUs = -1;
+      mAudioWrittenFrames = 0;
+    }
+
+    if (!mFreeRunning && mAudioAnchorMediaUs >= 0
+        && audioWrittenUs() - mAudioSink->GetPlayedTimeUs() >= kMaxAudioAheadUs) {
+      waiting = true;
+      break;
+    }
+
+    status_t err = mAudioSink->Write(buffer->data.get(), buffer->size);
+    if (err == WOULD_BLOCK) {
+      waiting = true;
+      break;
+    }
+    if (!popEntry(true, generation)) {
+      break;
+    }
+    if (err != OK) {
+      ALOGE("audio sink write failed: %d", err);
+      continue;
+    }
+    if (mAudioAnchorMediaUs < 0) {
+      mAudioAnchorMediaUs = buffer->ptsUs;
+    }
+    mAudioWrittenFrames += buffer->size / (2 * buffer->channelCount);
+    notifyRenderingStart();
+  }
+
+  updateAudioClock();
+
+  // The clock follows the sink for as long as written audio plays.
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if ((!mPaused || mReverseAudioPlaying)
+      && (waiting || (mAudioAnchorMediaUs >= 0 && !mAudioEOS))) {
+    postDrain_l(true /* audio */, kPollUs);
+  }
+}
+
+void Renderer::onDrainVideo() {
+  for (;;) {
+    QueueEntry entry;
+    int32_t generation;
+    bool haveNext;
+    {
+      std::lock_guard<std::mutex> autoLock(mLock);
+      if (mQueue[false].empty()) {
+        return;
+      }
+      entry = mQueue[false].front();
+      generation = mDrainGeneration[false];
+      haveNext = mQueue[false].size() > 1;
+    }
+
+    const std::shared_ptr<MediaBuffer> &buffer = entry.buffer;
+    if (buffer == nullptr) {
+      if (popEntry(false, generation)) {
+        notify(kWhatEOS, false, entry.finalResult);
+      }
+      continue;
+    }
+    mHasVideo = true;
+
+    int64_t lateUs = 0;
+    if (!mVideoRenderingStarted) {
+      // The first frame after start, a seek or a flush is shown right away,
+      // paused or not. Without audio it anchors the clock.
+      if (mAudioAnchorMediaUs < 0 || mPlaybackRate != 1.0f) {
+        mMediaClock->updateAnchor(buffer->ptsUs, Looper::GetNowUs());
+      }
+    } else if (mPaused) {
+      return;  // resume() drains again
+    } else if (mFreeRunning) {
+      // Shown as soon as it is decoded; the clock follows the frames unless
+      // audio runs it.
+      if (mAudioAnchorMediaUs < 0 || mPlaybackRate != 1.0f) {
+        mMediaClock->updateAnchor(buffer->ptsUs, Looper::GetNowUs());
+      }
+    } else {
+      int64_t realUs;
+      if (mMediaClock->getRealTimeFor(buffer->ptsUs, &realUs) != OK) {
+        // not anchored yet, audio is about to
+        std::lock_guard<std::mutex> autoLock(mLock);
+        if (generation == mDrainGeneration[false]) {
+          postDrain_l(false /* audio */, kPollUs);
+        }
+        return;
+      }
+      int64_t nowUs = Looper::GetNowUs();
+      if (realUs > nowUs) {
+        std::lock_guard<std::mutex> autoLock(mLock);
+        if (generation == mDrainGeneration[false]) {
+          postDrain_l(false /* audio */, realUs - nowUs);
+        }
+        return;
+      }
+      lateUs = nowUs - realUs;
+      if (lateUs > kMaxVideoLateUs && haveNext) {
+        if (popEntry(false, generation)) {
+          std::shared_ptr<PlaybackStats> stats;
+          {
+            std::lock_guard<std::mutex> autoLock(mLock);
+            stats = mStats;
+          }
+          if (stats != nullptr) {
+            stats->onFrameDroppedLate();
+          }
+        }
+        continue;
+      }
+    }
+
+    if (!popEntry(false, generation)) {
+      return;
+    }
+    renderVideo(buffer, lateUs);
+  }
+}
+
+void Renderer::renderVideo(const std::shared_ptr<MediaBuffer> &buffer, int64_t lateUs) {
+  std::shared_ptr<Surface> surface;
+  std::shared_ptr<PlaybackStats> stats;
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    surface = mSurface;
+    stats = mStats;
+  }
+  if (surface != nullptr && buffer->frame != nullptr) {
+    status_t err = surface->render(buffer->frame.get());
+    if (err != OK) {
+      ALOGW("failed to render video frame at %lld us: %d", (long long)buffer->ptsUs, err);
+    }
+  }
+  if (stats != nullptr) {
+    stats->onFrameRendered();
+    if (mVideoRenderingStarted && !mFreeRunning) {
+      stats->onAvSyncOffset(lateUs);
+    }
+  }
+  if (!mVideoRenderingStarted) {
+    mVideoRenderingStarted = true;
+    notify(kWhatVideoRenderingStart, false);
+  }
+  if (!mPaused) {
+    notifyRenderingStart();
+  }
+}
+
+void Renderer::onRenderStill() {
+  std::shared_ptr<MediaBuffer> buffer;
+  std::shared_ptr<Surface> surface;
+  std::shared_ptr<PlaybackStats> stats;
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    buffer = std::move(mPendingStill);
+    mPendingStill.reset();
+    surface = mSurface;
+    stats = mStats;
+  }
+  if (buffer == nullptr || buffer->frame == nullptr || surface == nullptr) {
+    return;  // shown by an earlier message, or nowhere to show it
+  }
+  status_t err = surface->render(buffer->frame.get());
+  if (err != OK) {
+    ALOGW("failed to render still frame at %lld us: %d", (long long)buffer->ptsUs, err);
+    return;
+  }
+  if (stats != nullptr) {
+    stats->onFrameRendered();
+  }
+}
+
+void Renderer::notifyRenderingStart() {
+  if (!mMediaRenderingStarted) {
+    mMediaRenderingStarted = true;
+    notify(kWhatMediaRenderingStart, mAudioAnchorMediaUs >= 0);
+  }
+}
+
+void Renderer::notify(int32_t what, bool audio, status_t result) {
+  if (mNotify == nullptr) {
+    return;
+  }
+  std::shared_ptr<Message> msg = mNotify->dup();
+  msg->mArg1 = what;
+  msg->mArg2 = ((int64_t)result << 32) | (audio ? 1 : 0);
+  msg->post();
+}
+
+} // hpc
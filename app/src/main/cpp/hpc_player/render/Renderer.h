@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include "../foundation/Error.h"
+#include "../foundation/Handler.h"
+#include "../foundation/Message.h"
+#include "../foundation/PlaybackStats.h"
+
+namespace hpc {
+
+class AudioSink;
+struct MediaBuffer;
+struct MediaClock;
+class Surface;
+
+// Presents what the decoders queue. Audio is written to the AudioSink ahead
+// of time and anchors the MediaClock on what the sink played; video waits
+// for the clock, or anchors it itself while no audio is written, e.g. in
+// trick play. Runs on the looper the player registers it with.
+//
+// Events go to the notify message: the what of it, the event in mArg1 and
+// in mArg2 1 for audio, 0 for video. kWhatEOS has the final result of the
+// track in the upper 32 bits of mArg2.
+class Renderer : public Handler {
+ public:
+  enum {
+    kWhatEOS                 = 'eos ',
+    kWhatFlushComplete       = 'fluC',
+    kWhatVideoRenderingStart = 'vdrd',
+    kWhatMediaRenderingStart = 'mdrd',
+  };
+
+  // Starts paused: the first video frame is shown, nothing plays before
+  // resume(). A |freeRunning| renderer does not pace: video is shown and
+  // audio written as soon as they are queued, for throughput benchmarks.
+  Renderer(const std::shared_ptr<AudioSink> &sink,
+           const std::shared_ptr<MediaClock> &mediaClock,
+           const std::shared_ptr<Message> &notify,
+           bool freeRunning = false);
+  ~Renderer();
+
+  void setSurface(const std::shared_ptr<Surface> &surface);
+  // Rendered and late dropped video frames go to |stats|, along with the
+  // offset of each rendered frame against the playback clock.
+  void setPlaybackStats(const std::shared_ptr<PlaybackStats> &stats);
+
+  // Called by the decoders on their loopers.
+  void queueBuffer(bool audio, const std::shared_ptr<MediaBuffer> &buffer);
+  void queueEOS(bool audio, status_t finalResult);
+  // False while enough is queued, the decoder comes back in a bit.
+  bool needsMoreData(bool audio) const;
+  // Drops what is queued right away; the sink and the clock are reset on
+  // the looper, then kWhatFlushComplete.
+  void flush(bool audio);
+  // Shows |buffer| right away, outside of the video queue and the clock:
+  // frames the player times itself, stepped or played in reverse. Of those
+  // posted faster than the looper runs, only the latest is shown.
+  void renderStill(const std::shared_ptr<MediaBuffer> &buffer);
+
+  // Reverse playback, where the player times the video itself. Switching
+  // it on or off drops the audio queued and written so far. Meanwhile the
+  // decoders' audio is dropped and flush(true) leaves the queue alone; only
+  // audio from queueReverseAudio() is written, paused renderer or not. It
+  // plays while |playing| and never moves the clock.
+  void setReverseAudio(bool reverse, bool playing);
+  void queueReverseAudio(const std::shared_ptr<MediaBuffer> &buffer);
+  // Drops the reverse audio queued and written so far, e.g. at a seek.
+  void flushReverseAudio();
+
+  void pause();
+  void resume();
+  // Audio only plays at 1x, at any other rate it is dropped and video runs
+  // the clock.
+  void setPlaybackRate(float rate);
+
+ protected:
+  void onMessageReceived(const std::shared_ptr<Message> &msg) override;
+
+ private:
+  enum {
+    kWhatDrainAudio  = 'drnA',
+    kWhatDrainVideo  = 'drnV',
+    kWhatFlush       = 'flsh',
+    kWhatPause       = 'paus',
+    kWhatResume      = 'resm',
+    kWhatSetRate     = 'sRat',
+    kWhatRenderStill = 'stil',
+    kWhatSetReverse  = 'sRev',
+    kWhatFlushSink   = 'flsS',
+  };
+
+  struct QueueEntry {
+    std::shared_ptr<MediaBuffer> buffer;  // nullptr for EOS
+    status_t finalResult {OK};
+  };
+
+  // Decoders keep this much ahead of the renderer.
+  static const size_t kMaxQueuedVideoFrames = 4;
+  static const size_t kMaxQueuedAudioBuffers = 16;
+  // Audio written to the sink ahead of what it played.
+  static const int64_t kMaxAudioAheadUs = 200000;
+  // Later than this and another frame is queued, a video frame is dropped.
+  static const int64_t kMaxVideoLateUs = 40000;
+  static const int64_t kPollUs = 10000;
+
+  void postDrain_l(bool audio, int64_t delayUs = 0);
+  void onDrainAudio();
+  void onDrainVideo();
+  void onFlush(bool audio);
+  void flushAudioSink();
+  void onSetReverseAudio(bool reverse, bool playing);
+  void renderVideo(const std::shared_ptr<MediaBuffer> &buffer, int64_t lateUs);
+  void onRenderStill();
+  int64_t audioWrittenUs() const;
+  void updateAudioClock();
+  bool popEntry(bool audio, int32_t generation);
+  void notify(int32_t what, bool audio, status_t result = OK);
+  void notifyRenderingStart();
+
+  const std::shared_ptr<AudioSink> mAudioSink;
+  const std::shared_ptr<MediaClock> mMediaClock;
+  const std::shared_ptr<Message> mNotify;
+  const bool mFreeRunning;
+
+  mutable std::mutex mLock;  // guard the members up to mPaused.
+  std::deque<QueueEntry> mQueue[2];  // [audio]
+  int32_t mDrainGeneration[2] {0, 0};
+  bool mDrainPending[2] {false, false};
+  std::shared_ptr<Surface> mSurface;
+  std::shared_ptr<PlaybackStats> mStats;
+  std::shared_ptr<MediaBuffer> mPendingStill;
+  bool mReverseAudio {false};  // the audio queue holds reverse audio only
+
+  // Looper only from here.
+  bool mPaused {true};
+  float mPlaybackRate {1.0f};
+  bool mHasVideo {false};
+  bool mVideoRenderingStarted {false};  // since the last video flush
+  bool mMediaRenderingStarted {false};  // since the last resume()
+  bool mReverseAudioPlaying {false};
+
+  // The sink is opened for the first buffer and again when the format
+  // changes. Audio media time = mAudioAnchorMediaUs + what the sink played.
+  int32_t mSinkSampleRate {0};
+  int32_t mSinkChannelCount {0};
+  int64_t mAudioAnchorMediaUs {-1};  // -1 until audio is written after a flush
+  int64_t mAudioWrittenFrames {0};
+  bool mAudioEOS {false};
+};
+
+} // hpc
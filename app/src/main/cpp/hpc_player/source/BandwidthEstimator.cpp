@@ -0,0 +1,45 @@
+#include "BandwidthEstimator.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace hpc {
+
+void BandwidthEstimator::Average::add(double weight, double value) {
+  const double alpha = std::pow(0.5, weight / halfLifeS);
+  estimate = value * (1 - alpha) + alpha * estimate;
+  totalWeight += weight;
+}
+
+double BandwidthEstimator::Average::get() const {
+  // Zero-initialized, the first samples are scaled up to make up for it.
+  const double zeroFactor = 1 - std::pow(0.5, totalWeight / halfLifeS);
+  return zeroFactor > 0 ? estimate / zeroFactor : 0.0;
+}
+
+void BandwidthEstimator::addSample(int64_t bytes, int64_t durationUs) {
+  if (bytes <= 0) {
+    return;
+  }
+  // A download served from a buffer somewhere is not faster than a 1 ms one.
+  const double durationS = std::max<int64_t>(durationUs, 1000) / 1e6;
+  const double bps = bytes * 8 / durationS;
+  mFast.add(durationS, bps);
+  mSlow.add(durationS, bps);
+  mTotalBytes += bytes;
+}
+
+int64_t BandwidthEstimator::getEstimate() const {
+  if (mTotalBytes < kMinBytes) {
+    return -1;
+  }
+  return (int64_t)std::min(mFast.get(), mSlow.get());
+}
+
+void BandwidthEstimator::reset() {
+  mFast = Average(kFastHalfLifeS);
+  mSlow = Average(kSlowHalfLifeS);
+  mTotalBytes = 0;
+}
+
+} // hpc
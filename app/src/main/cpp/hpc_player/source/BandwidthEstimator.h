@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+namespace hpc {
+
+// Network throughput from segment downloads, for adaptive bitrate. Two
+// exponentially weighted averages of the download rate, weighted by the
+// time each download took, one quick to follow and one slow; the estimate
+// is the lower of the two, so it drops at once when the network does and
+// only climbs back once the gain lasted.
+class BandwidthEstimator {
+ public:
+  // Half-lives, in seconds of download time.
+  static constexpr double kFastHalfLifeS = 2.0;
+  static constexpr double kSlowHalfLifeS = 8.0;
+  // Below this many bytes in all there is no estimate yet, small downloads
+  // are dominated by the request latency.
+  static const int64_t kMinBytes = 128 * 1024;
+
+  // A download of |bytes| that took |durationUs|, request latency included.
+  void addSample(int64_t bytes, int64_t durationUs);
+
+  // Bits per second, -1 until enough was downloaded.
+  int64_t getEstimate() const;
+
+  void reset();
+
+ private:
+  struct Average {
+    double halfLifeS;
+    double estimate {0.0};
+    double totalWeight {0.0};
+
+    explicit Average(double halfLife) : halfLifeS(halfLife) {}
+    void add(double weight, double value);
+    double get() const;
+  };
+
+  Average mFast {kFastHalfLifeS};
+  Average mSlow {kSlowHalfLifeS};
+  int64_t mTotalBytes {0};
+};
+
+} // hpc
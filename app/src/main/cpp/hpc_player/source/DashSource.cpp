@@ -0,0 +1,678 @@
+#include "DashSource.h"
+#include "Log.h"
+#include "Looper.h"
+#include "Message.h"
+#include "MetaData.h"
+#include "MediaPacket.h"
+#include "PacketQueue.h"
+#include "FFmpegExtractor.h"
+#include "HTTPSource.h"
+#include "MemorySource.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define LOG_TAG "DashSource"
+
+namespace hpc {
+
+DashSource::DashSource(const std::shared_ptr<Message> &notify)
+    : Source(notify) {
+}
+
+DashSource::~DashSource() {
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    mStopping = true;
+  }
+  mCondition.notify_all();
+  // Wakes threads blocked on the network.
+  ++mSeekGeneration;
+  for (std::unique_ptr<Stream> &stream : mStreams) {
+    stream->http->close();
+  }
+  for (std::unique_ptr<Stream> &stream : mStreams) {
+    if (stream->thread.joinable()) {
+      stream->thread.join();
+    }
+  }
+  if (mLooper != nullptr) {
+    mLooper->unregisterHandler(id());
+    mLooper->stop();
+  }
+}
+
+bool DashSource::IsDashUrl(const char *url) {
+  if (!HTTPSource::IsSupported(url)) {
+    return false;
+  }
+  const char *end = strpbrk(url, "?#");
+  const size_t length = end != nullptr ? end - url : strlen(url);
+  return length >= 4 && strncasecmp(url + length - 4, ".mpd", 4) == 0;
+}
+
+status_t DashSource::setDataSource(const char *url) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mUrl = url;
+  mManifestHttp = std::make_shared<HTTPSource>(url);
+  return mManifestHttp->initCheck();
+}
+
+void DashSource::prepareAsync() {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (mLooper == nullptr) {
+    mLooper = std::make_shared<Looper>();
+    mLooper->setName("dash");
+    mLooper->start();
+    mLooper->registerHandler(shared_from_this());
+  }
+  mPreparing = true;
+  mPrepareStartUs = Looper::GetNowUs();
+  std::make_shared<Message>(kWhatPrepare, shared_from_this())->post();
+}
+
+void DashSource::start() {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mStarted = true;
+}
+
+void DashSource::stop() {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mStarted = false;
+}
+
+void DashSource::pause() {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mStarted = false;
+}
+
+void DashSource::resume() {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mStarted = true;
+}
+
+void DashSource::disconnect() {
+  std::vector<std::shared_ptr<HTTPSource>> connections;
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    if (mManifestHttp != nullptr) {
+      connections.push_back(mManifestHttp);
+    }
+    for (const std::unique_ptr<Stream> &stream : mStreams) {
+      connections.push_back(stream->http);
+    }
+  }
+  // Also cancels the downloads in progress between two reads.
+  mDisconnected = true;
+  ++mSeekGeneration;
+  for (const std::shared_ptr<HTTPSource> &http : connections) {
+    http->close();
+  }
+}
+
+// Rebuffering works like in HlsSource: once a queue runs dry while playing,
+// packets are held back until every stream has the resume mark again.
+status_t DashSource::dequeueAccessUnit(bool audio, std::unique_ptr<MediaPacket> *packet) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  Stream *stream = findStream_l(audio);
+  if (!mStarted || mPreparing || mSeeking || mBufferingStartUs >= 0 || stream == nullptr) {
+    return WOULD_BLOCK;
+  }
+  status_t result = stream->packets->dequeuePacket(packet);
+  if (result == WOULD_BLOCK) {
+    mBufferingStartUs = Looper::GetNowUs();
+    ++mStats.rebuffers;
+    mStats.buffering = true;
+    ALOGI("rebuffering (%s ran out)", audio ? "audio" : "video");
+    notifyBuffering(true);
+  }
+  return result;
+}
+
+std::shared_ptr<MetaData> DashSource::getFormatMeta(bool audio) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  Stream *stream = findStream_l(audio);
+  return stream != nullptr ? mMetas[stream->trackIndex] : nullptr;
+}
+
+status_t DashSource::getDuration(int64_t *durationUs) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (mDurationUs < 0) {
+    return INVALID_OPERATION;
+  }
+  *durationUs = mDurationUs;
+  return OK;
+}
+
+size_t DashSource::getTrackCount() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  return mTrackInfos.size();
+}
+
+status_t DashSource::getTrackInfo(size_t trackIndex, Extractor::TrackInfo *info) const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (trackIndex >= mTrackInfos.size()) {
+    return ERROR_OUT_OF_RANGE;
+  }
+  *info = mTrackInfos[trackIndex];
+  return OK;
+}
+
+ssize_t DashSource::getSelectedTrack(media_track_type type) const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (type != MEDIA_TRACK_TYPE_VIDEO && type != MEDIA_TRACK_TYPE_AUDIO) {
+    return -1;
+  }
+  Stream *stream = findStream_l(type == MEDIA_TRACK_TYPE_AUDIO);
+  return stream != nullptr ? (ssize_t)stream->trackIndex : -1;
+}
+
+status_t DashSource::seekTo(int64_t seekTimeUs, SeekMode /* mode */) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (mStreams.empty() || mPreparing) {
+    return INVALID_OPERATION;
+  }
+  // Each fetch thread drops its download and clears its own queue.
+  mSeeking = true;
+  mSeekTimeUs = std::max<int64_t>(seekTimeUs, 0);
+  ++mSeekGeneration;
+  mCondition.notify_all();
+  return OK;
+}
+
+int64_t DashSource::getBufferedDurationUs(bool audio, size_t *bytes) const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  Stream *stream = findStream_l(audio);
+  if (stream == nullptr) {
+    *bytes = 0;
+    return 0;
+  }
+  status_t finalResult;
+  *bytes = stream->packets->getBufferedBytes();
+  return stream->packets->getBufferedDurationUs(&finalResult);
+}
+
+status_t DashSource::setBufferingSettings(const BufferingSettings &settings) {
+  if (!settings.isValid()) {
+    return BAD_VALUE;
+  }
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mBufferingSettings = settings;
+  mCondition.notify_all();
+  return OK;
+}
+
+BufferingSettings DashSource::getBufferingSettings() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  return mBufferingSettings;
+}
+
+status_t DashSource::setTargetBitrate(int64_t bps) {
+  if (bps < 0) {
+    return BAD_VALUE;
+  }
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mTargetBitrate = bps;
+  return OK;
+}
+
+DashSource::Stats DashSource::getStats() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  Stats stats = mStats;
+  if (mBufferingStartUs >= 0) {
+    stats.rebufferUs += Looper::GetNowUs() - mBufferingStartUs;
+  }
+  std::vector<std::shared_ptr<HTTPSource>> connections;
+  if (mManifestHttp != nullptr) {
+    connections.push_back(mManifestHttp);
+  }
+  for (const std::unique_ptr<Stream> &stream : mStreams) {
+    connections.push_back(stream->http);
+  }
+  for (const std::shared_ptr<HTTPSource> &http : connections) {
+    const HTTPSource::Stats httpStats = http->getStats();
+    stats.requests += httpStats.requests;
+    stats.connections += httpStats.connects;
+    stats.bytesFetched += httpStats.bytesFetched;
+  }
+  return stats;
+}
+
+void DashSource::onMessageReceived(const std::shared_ptr<Message> &msg) {
+  switch (msg->what()) {
+    case kWhatPrepare:
+      onPrepare();
+      break;
+
+    default:
+      Source::onMessageReceived(msg);
+      break;
+  }
+}
+
+void DashSource::onPrepare() {
+  std::string url;
+  std::shared_ptr<HTTPSource> http;
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    url = mUrl;
+    http = mManifestHttp;
+  }
+  std::vector<uint8_t> data;
+  status_t err = http != nullptr
+      ? download(http.get(), url, 0, -1, &data, mSeekGeneration) : NO_INIT;
+  MPDParser::Manifest manifest;
+  if (err == OK) {
+    err = MPDParser::Parse(url, std::string(data.begin(), data.end()), &manifest);
+  }
+
+  // The first video and the first audio adaptation set, video first.
+  std::vector<std::unique_ptr<Stream>> streams;
+  for (media_track_type type : { MEDIA_TRACK_TYPE_VIDEO, MEDIA_TRACK_TYPE_AUDIO }) {
+    for (MPDParser::AdaptationSet &adaptationSet : manifest.adaptationSets) {
+      if (adaptationSet.type != type) {
+        continue;
+      }
+      std::unique_ptr<Stream> stream = std::make_unique<Stream>();
+      stream->audio = type == MEDIA_TRACK_TYPE_AUDIO;
+      stream->trackIndex = streams.size();
+      stream->adaptationSet = std::move(adaptationSet);
+      const MPDParser::Representation &rep = stream->adaptationSet.representations[0];
+      stream->http = std::make_shared<HTTPSource>(
+          (rep.initUrl.empty() ? rep.indexUrl : rep.initUrl).c_str());
+      stream->packets = std::make_shared<PacketQueue>();
+      streams.push_back(std::move(stream));
+      break;
+    }
+  }
+  if (err == OK && streams.empty()) {
+    err = ERROR_UNSUPPORTED;
+  }
+
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (err != OK) {
+    ALOGE("cannot open %s: %d", url.c_str(), err);
+    mPreparing = false;
+    notifyPrepared(err);
+    return;
+  }
+  mDurationUs = manifest.durationUs;
+  mTrackInfos.resize(streams.size());
+  mMetas.resize(streams.size());
+  mStreams.swap(streams);
+  ALOGI("%zu streams, %lld us", mStreams.size(), (long long)mDurationUs);
+  // Prepared is notified by the fetch threads once the initial mark is
+  // buffered in every queue.
+  for (std::unique_ptr<Stream> &stream : mStreams) {
+    Stream *fetched = stream.get();
+    stream->thread = std::thread([this, fetched] { fetchLoop(fetched); });
+  }
+}
+
+void DashSource::fetchLoop(Stream *stream) {
+  std::unique_lock<std::mutex> lock(mLock);
+  while (!mStopping) {
+    if (stream->seekGeneration != mSeekGeneration) {
+      // The queue belongs to this thread, its producer.
+      stream->seekGeneration = mSeekGeneration;
+      stream->packets->clear();
+      stream->seekPending = true;
+    }
+    if (mDisconnected || !shouldFetch_l(*stream)) {
+      updateBuffering_l();
+      mCondition.wait_for(lock, std::chrono::microseconds(kPollIntervalUs));
+      continue;
+    }
+
+    const int32_t generation = stream->seekGeneration;
+    const int64_t seekTimeUs = stream->seekPending ? mSeekTimeUs : -1;
+    lock.unlock();
+    status_t err = fetchNext(stream, generation, seekTimeUs);
+    lock.lock();
+
+    if (generation != mSeekGeneration) {
+      // dropped for a seek, which starts over
+      continue;
+    }
+    if (err != OK) {
+      ALOGE("%s stream failed: %d", stream->audio ? "audio" : "video", err);
+      stream->packets->signalEOS(err);
+      if (mPreparing) {
+        mPreparing = false;
+        notifyPrepared(err);
+      }
+    }
+    updateBuffering_l();
+  }
+}
+
+status_t DashSource::fetchNext(Stream *stream, int32_t generation, int64_t seekTimeUs) {
+  status_t finalResult;
+  const int64_t bufferedUs = stream->packets->getBufferedDurationUs(&finalResult);
+  std::vector<MPDParser::Representation> &reps = stream->adaptationSet.representations;
+  const size_t selected = selectRepresentation(*stream, bufferedUs);
+  MPDParser::Representation *rep = &reps[selected];
+  if (rep->needsIndex()) {
+    status_t err = loadIndex(stream, rep, generation);
+    if (err != OK) {
+      return err;
+    }
+  }
+
+  if (seekTimeUs >= 0) {
+    stream->nextSegment = std::max<ssize_t>(rep->findSegment(seekTimeUs), 0);
+    stream->seekPending = false;
+  } else if (selected != stream->representation) {
+    // Segments of an adaptation set line up, the one with the middle of
+    // the next old segment is the next new one.
+    const MPDParser::Representation &old = reps[stream->representation];
+    if (stream->nextSegment < old.segments.size()) {
+      const MPDParser::Segment &next = old.segments[stream->nextSegment];
+      stream->nextSegment = rep->findSegment(next.startUs + next.durationUs / 2);
+    } else {
+      stream->nextSegment = rep->segments.size();
+    }
+  }
+  if (selected != stream->representation) {
+    ALOGI("%s switches from %lld to %lld bps", stream->audio ? "audio" : "video",
+          (long long)reps[stream->representation].bandwidth, (long long)rep->bandwidth);
+    stream->representation = selected;
+    std::lock_guard<std::mutex> autoLock(mLock);
+    ++mStats.switches;
+  }
+
+  if (stream->nextSegment >= rep->segments.size()) {
+    stream->packets->signalEOS(ERROR_END_OF_STREAM);
+    return OK;
+  }
+  const MPDParser::Segment segment = rep->segments[stream->nextSegment];
+
+  if (stream->initRepresentation != (ssize_t)selected) {
+    stream->initRepresentation = -1;
+    if (!rep->initUrl.empty()) {
+      status_t err = download(stream->http.get(), rep->initUrl, rep->initRangeOffset,
+                              rep->initRangeLength, &stream->initSegment, generation);
+      if (err != OK) {
+        return err;
+      }
+    } else {
+      stream->initSegment.clear();
+    }
+    stream->initRepresentation = selected;
+  }
+
+  std::vector<uint8_t> data;
+  const int64_t startUs = Looper::GetNowUs();
+  status_t err = download(stream->http.get(), segment.url, segment.rangeOffset,
+                          segment.rangeLength, &data, generation);
+  if (err != OK) {
+    return err;
+  }
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    mEstimator.addSample(data.size(), Looper::GetNowUs() - startUs);
+    mStats.bandwidthBps = mEstimator.getEstimate();
+    ++mStats.segments;
+    if (!stream->audio) {
+      mStats.videoBps = rep->bandwidth;
+    }
+  }
+
+  data.insert(data.begin(), stream->initSegment.begin(), stream->initSegment.end());
+  err = demuxSegment(stream, segment, std::move(data), generation);
+  if (err == OK) {
+    ++stream->nextSegment;
+  }
+  return err;
+}
+
+// The best representation within a share of the estimate, after what the
+// other stream uses; video also within the target bitrate. Down right
+// away, up only with the resume mark buffered, as in HlsSource.
+size_t DashSource::selectRepresentation(const Stream &stream, int64_t bufferedUs) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  int64_t estimate = mEstimator.getEstimate();
+  if (estimate < 0) {
+    estimate = kInitialBandwidthBps;
+  }
+  int64_t budget = (int64_t)(estimate * kBandwidthFraction);
+  if (!stream.audio) {
+    Stream *audio = findStream_l(true /* audio */);
+    if (audio != nullptr) {
+      // Only read by the audio thread otherwise, a stale value is harmless.
+      budget -= audio->adaptationSet.representations[0].bandwidth;
+    }
+    if (mTargetBitrate > 0) {
+      budget = std::min(budget, mTargetBitrate);
+    }
+  }
+
+  const std::vector<MPDParser::Representation> &reps = stream.adaptationSet.representations;
+  size_t selected = 0;
+  for (size_t i = 0; i < reps.size(); ++i) {
+    if (reps[i].bandwidth <= budget) {
+      selected = i;
+    }
+  }
+  if (stream.configured && selected > stream.representation
+      && bufferedUs < mBufferingSettings.mResumePlaybackMarkMs * 1000LL) {
+    return stream.representation;
+  }
+  return selected;
+}
+
+status_t DashSource::loadIndex(Stream *stream, MPDParser::Representation *rep,
+                               int32_t generation) {
+  std::vector<uint8_t> data;
+  status_t err = download(stream->http.get(), rep->indexUrl, rep->indexRangeOffset,
+                          rep->indexRangeLength, &data, generation);
+  if (err != OK) {
+    return err;
+  }
+  err = MPDParser::ParseSidx(data.data(), data.size(), rep->indexRangeOffset, rep);
+  ALOGV("representation %s: %zu segments in the sidx", rep->id.c_str(), rep->segments.size());
+  return err;
+}
+
+// The fragment's presentation starts where the manifest says its segment
+// does, whatever the timestamps of the encoder, so the earliest timestamp
+// in it is moved there.
+status_t DashSource::demuxSegment(Stream *stream, const MPDParser::Segment &segment,
+                                  std::vector<uint8_t> data, int32_t generation) {
+  FFmpegExtractor extractor;
+  extractor.setRequiresVideo(false);
+  extractor.setDataSource(std::make_shared<MemorySource>(std::move(data)));
+  status_t err = extractor.init(segment.url.c_str());
+  if (err != OK) {
+    return err;
+  }
+  const int index = stream->audio ? extractor.getAudioStreamIndex()
+                                  : extractor.getVideoStreamIndex();
+  if (index < 0) {
+    ALOGE("no %s in %s", stream->audio ? "audio" : "video", segment.url.c_str());
+    return ERROR_MALFORMED;
+  }
+
+  // Representations of one set may differ in more than the bitrate, a new
+  // codec, or new parameter sets in the init segment, needs the decoder
+  // configured again.
+  const AVCodecParameters *params = extractor.getStream(index)->codecpar;
+  std::vector<uint8_t> extradata(params->extradata, params->extradata + params->extradata_size);
+  const bool reconfigure = stream->configured
+      && (params->codec_id != stream->codecId || extradata != stream->extradata
+          || params->sample_rate != stream->sampleRate || params->channels != stream->channelCount);
+  const bool describe = !stream->configured || reconfigure
+      || (!stream->audio && mMetas[stream->trackIndex] != nullptr
+          && (mMetas[stream->trackIndex]->width != params->width
+              || mMetas[stream->trackIndex]->height != params->height));
+  stream->codecId = params->codec_id;
+  stream->extradata.swap(extradata);
+  stream->sampleRate = params->sample_rate;
+  stream->channelCount = params->channels;
+  stream->configured = true;
+  if (describe) {
+    Extractor::TrackInfo info;
+    extractor.getTrackInfo(index, &info);
+    std::shared_ptr<MetaData> meta = std::make_shared<MetaData>();
+    if (stream->audio) {
+      meta->mime = info.mime_type;
+      meta->sampleRate = info.sample_rate;
+      meta->channelCount = info.channel_count;
+    } else {
+      extractor.getMetaData(*meta);
+    }
+    std::lock_guard<std::mutex> autoLock(mLock);
+    mTrackInfos[stream->trackIndex] = info;
+    mMetas[stream->trackIndex] = meta;
+  }
+  if (reconfigure) {
+    ALOGI("%s configuration changes at %lld us", stream->audio ? "audio" : "video",
+          (long long)segment.startUs);
+    stream->packets->queueDiscontinuity();
+  }
+  if (describe && !stream->audio) {
+    notifyVideoSizeChanged();
+  }
+
+  std::vector<std::unique_ptr<MediaPacket>> packets;
+  std::unique_ptr<MediaPacket> packet;
+  int64_t earliestUs = INT64_MAX;
+  while (extractor.read(packet, index) == OK) {
+    if (packet->ptsUs >= 0) {
+      earliestUs = std::min(earliestUs, packet->ptsUs);
+    }
+    packets.push_back(std::move(packet));
+  }
+  const int64_t offsetUs = earliestUs == INT64_MAX ? 0 : segment.startUs - earliestUs;
+
+  for (std::unique_ptr<MediaPacket> &queued : packets) {
+    if (queued->ptsUs >= 0) {
+      queued->ptsUs += offsetUs;
+    }
+    if (queued->dtsUs >= 0) {
+      queued->dtsUs += offsetUs;
+    }
+    queued->trackIndex = (int32_t)stream->trackIndex;
+    if (mPlaybackStats != nullptr) {
+      mPlaybackStats->onPacketDemuxed(stream->audio, queued->size(), queued->durationUs);
+    }
+    while (stream->packets->isFull()) {
+      std::unique_lock<std::mutex> lock(mLock);
+      if (generation != mSeekGeneration || mStopping) {
+        return INFO_DISCONTINUITY;
+      }
+      mCondition.wait_for(lock, std::chrono::microseconds(kPollIntervalUs));
+    }
+    stream->packets->queuePacket(std::move(queued));
+  }
+  return OK;
+}
+
+status_t DashSource::download(HTTPSource *http, const std::string &url, int64_t offset,
+                              int64_t length, std::vector<uint8_t> *data, int32_t generation) {
+  data->clear();
+  status_t err = http->setUrl(url.c_str());
+  if (err != OK) {
+    return err;
+  }
+  while (length < 0 || (int64_t)data->size() < length) {
+    if (generation != mSeekGeneration) {
+      return INFO_DISCONTINUITY;
+    }
+    const size_t size = data->size();
+    size_t chunk = kReadChunkBytes;
+    if (length >= 0) {
+      chunk = std::min<int64_t>(chunk, length - size);
+    }
+    data->resize(size + chunk);
+    ssize_t n = http->readAt(offset + size, data->data() + size, chunk);
+    data->resize(size + std::max<ssize_t>(n, 0));
+    if (n < 0) {
+      return mDisconnected ? DEAD_OBJECT : (status_t)n;
+    } else if (n == 0) {
+      break;
+    }
+  }
+  if (length >= 0 && (int64_t)data->size() < length) {
+    ALOGE("%s: %zu of %lld bytes", url.c_str(), data->size(), (long long)length);
+    return ERROR_IO;
+  }
+  return OK;
+}
+
+DashSource::Stream *DashSource::findStream_l(bool audio) const {
+  for (const std::unique_ptr<Stream> &stream : mStreams) {
+    if (stream->audio == audio) {
+      return stream.get();
+    }
+  }
+  return nullptr;
+}
+
+int64_t DashSource::getMinBufferedUs_l(bool *eos) const {
+  int64_t minUs = -1;
+  int64_t maxUs = 0;
+  for (const std::unique_ptr<Stream> &stream : mStreams) {
+    status_t finalResult;
+    const int64_t bufferedUs = stream->packets->getBufferedDurationUs(&finalResult);
+    maxUs = std::max(maxUs, bufferedUs);
+    if (finalResult == OK) {
+      minUs = minUs < 0 ? bufferedUs : std::min(minUs, bufferedUs);
+    }
+  }
+  *eos = minUs < 0;
+  return minUs < 0 ? maxUs : minUs;
+}
+
+bool DashSource::shouldFetch_l(const Stream &stream) const {
+  if (stream.packets->isFull()) {
+    return false;
+  }
+  status_t finalResult;
+  const int64_t bufferedUs = stream.packets->getBufferedDurationUs(&finalResult);
+  return finalResult == OK
+      && mBufferingSettings.shouldReadMore(bufferedUs, stream.packets->getBufferedBytes(), mPreparing);
+}
+
+// After what a queue holds changed: ends preparing, a seek or rebuffering
+// once every stream has enough to play.
+void DashSource::updateBuffering_l() {
+  bool eos;
+  const int64_t bufferedUs = getMinBufferedUs_l(&eos);
+  if (mPreparing) {
+    bool configured = true;
+    for (const std::unique_ptr<Stream> &stream : mStreams) {
+      configured = configured && mMetas[stream->trackIndex] != nullptr;
+    }
+    if ((configured && bufferedUs >= mBufferingSettings.mInitialMarkMs * 1000LL) || eos) {
+      mPreparing = false;
+      mStats.prepared = true;
+      mStats.startupUs = Looper::GetNowUs() - mPrepareStartUs;
+      ALOGI("prepared in %lld us", (long long)mStats.startupUs);
+      notifyPrepared();
+    }
+    return;
+  }
+  const bool enough = eos || bufferedUs >= mBufferingSettings.mResumePlaybackMarkMs * 1000LL;
+  if (mSeeking && enough) {
+    bool seeked = true;
+    for (const std::unique_ptr<Stream> &stream : mStreams) {
+      seeked = seeked && stream->seekGeneration == mSeekGeneration && !stream->seekPending;
+    }
+    mSeeking = !seeked;
+  }
+  if (mBufferingStartUs >= 0 && enough) {
+    mStats.rebufferUs += Looper::GetNowUs() - mBufferingStartUs;
+    mStats.buffering = false;
+    mBufferingStartUs = -1;
+    notifyBuffering(false);
+  }
+}
+
+void DashSource::notifyBuffering(bool start) {
+  std::shared_ptr<Message> notify = dupNotify();
+  notify->mArg1 = start ? kWhatPauseOnBufferingStart : kWhatResumeOnBufferingEnd;
+  notify->post();
+}
+
+} // hpc
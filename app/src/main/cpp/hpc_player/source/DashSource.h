@@ -0,0 +1,175 @@
+#pragma once
+
+#include "Source.h"
+#include "BandwidthEstimator.h"
+#include "MPDParser.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hpc {
+
+class HTTPSource;
+class MediaPacket;
+class PacketQueue;
+struct Looper;
+
+// MPEG-DASH on demand. The manifest is read on the source's looper; then
+// the video and the audio adaptation set are each fetched by a thread of
+// their own over a connection of their own, so that the two download in
+// parallel and each fills its queue up to the buffering watermarks. Every
+// fragment is demuxed after its representation's init segment straight
+// into the track's packet queue, nothing is remuxed. Segments are where a
+// SegmentTemplate says or, for a SegmentBase, the byte ranges of the SIDX
+// read from the index range before the first one.
+//
+// Video switches representation like HlsSource switches variant, on the
+// estimate of the shared BandwidthEstimator, capped by setTargetBitrate().
+// A new representation brings its own init segment; a discontinuity is
+// queued when its codec configuration differs from the previous one.
+//
+// Track 0 is video, track 1 audio, if there is video.
+class DashSource : public Source {
+ public:
+  struct Stats {
+    int64_t startupUs {-1};       // prepareAsync() to prepared
+    int64_t requests {0};         // HTTP requests, manifest and indexes included
+    int64_t connections {0};
+    int64_t bytesFetched {0};
+    int64_t segments {0};
+    int64_t switches {0};
+    int64_t rebuffers {0};
+    int64_t rebufferUs {0};
+    int64_t bandwidthBps {-1};    // the current estimate
+    int64_t videoBps {0};         // bandwidth of the video representation now
+    bool prepared {false};
+    bool buffering {false};
+  };
+
+  explicit DashSource(const std::shared_ptr<Message> &notify);
+  ~DashSource() override;
+
+  // Whether |url| is a manifest, i.e. an http url whose path ends in .mpd.
+  static bool IsDashUrl(const char *url);
+
+  status_t setDataSource(const char *url);
+
+  void prepareAsync() override;
+
+  void start() override;
+  void stop() override;
+  void pause() override;
+  void resume() override;
+
+  void disconnect() override;
+
+  status_t dequeueAccessUnit(bool audio, std::unique_ptr<MediaPacket> *packet) override;
+
+  std::shared_ptr<MetaData> getFormatMeta(bool audio) override;
+  status_t getDuration(int64_t *durationUs) override;
+  size_t getTrackCount() const override;
+  status_t getTrackInfo(size_t trackIndex, Extractor::TrackInfo *info) const override;
+  ssize_t getSelectedTrack(media_track_type type) const override;
+  // Each stream goes to the start of its segment playing at |seekTimeUs|.
+  status_t seekTo(int64_t seekTimeUs, SeekMode mode = SEEK_PREVIOUS_SYNC) override;
+  int64_t getBufferedDurationUs(bool audio, size_t *bytes) const override;
+  status_t setBufferingSettings(const BufferingSettings &settings) override;
+  BufferingSettings getBufferingSettings() const override;
+  status_t setTargetBitrate(int64_t bps) override;
+
+  bool isStreaming() const override { return true; }
+
+  Stats getStats() const;
+
+ protected:
+  void onMessageReceived(const std::shared_ptr<Message> &msg) override;
+
+ private:
+  enum {
+    kWhatPrepare,
+  };
+
+  // Until the first download the bandwidth is taken to be this.
+  static const int64_t kInitialBandwidthBps = 1000000;
+  // Share of the estimate the representations may use together.
+  static constexpr double kBandwidthFraction = 0.75;
+  // How often a stream with a full buffer or a full queue looks again.
+  static constexpr int64_t kPollIntervalUs = 100000;
+  // Bytes per read of a download, a seek cancels it between two.
+  static const size_t kReadChunkBytes = 64 * 1024;
+
+  // One adaptation set and the thread fetching it. Only that thread touches
+  // the members, but for |packets| whose consumer is the player.
+  struct Stream {
+    bool audio {false};
+    size_t trackIndex {0};
+    MPDParser::AdaptationSet adaptationSet;
+    size_t representation {0};
+    std::shared_ptr<HTTPSource> http;
+    std::shared_ptr<PacketQueue> packets;
+    std::vector<uint8_t> initSegment;
+    ssize_t initRepresentation {-1};  // whose init segment that is
+    size_t nextSegment {0};
+    int32_t seekGeneration {0};       // of the last seek gone to
+    bool seekPending {false};         // the next segment is looked up first
+    // What the decoder is configured for, see demuxSegment().
+    int codecId {0};
+    std::vector<uint8_t> extradata;
+    int sampleRate {0};
+    int channelCount {0};
+    bool configured {false};
+    std::thread thread;
+  };
+
+  mutable std::mutex mLock;
+  std::condition_variable mCondition;  // wakes the fetch threads
+  std::string mUrl;
+  std::shared_ptr<HTTPSource> mManifestHttp;
+  int64_t mPrepareStartUs {-1};
+  // Set up by onPrepare() before the threads start, fixed from then on.
+  std::vector<std::unique_ptr<Stream>> mStreams;  // video first
+  std::vector<Extractor::TrackInfo> mTrackInfos;
+  std::vector<std::shared_ptr<MetaData>> mMetas;  // per track
+  int64_t mDurationUs {-1};
+  BandwidthEstimator mEstimator;
+  BufferingSettings mBufferingSettings;
+  int64_t mTargetBitrate {0};
+  bool mStarted {false};
+  bool mPreparing {false};
+  bool mSeeking {false};  // from seekTo() until the queues are refilled
+  int64_t mSeekTimeUs {0};
+  int64_t mBufferingStartUs {-1};
+  bool mStopping {false};
+  Stats mStats;
+  std::atomic<int32_t> mSeekGeneration {0};
+  std::atomic<bool> mDisconnected {false};
+
+  std::shared_ptr<Looper> mLooper;
+
+  void onPrepare();
+  void fetchLoop(Stream *stream);
+  // Downloads and demuxes the next segment of |stream|.
+  status_t fetchNext(Stream *stream, int32_t generation, int64_t seekTimeUs);
+  // The representation the next segment of |stream| comes from.
+  size_t selectRepresentation(const Stream &stream, int64_t bufferedUs);
+  status_t loadIndex(Stream *stream, MPDParser::Representation *rep, int32_t generation);
+  status_t demuxSegment(Stream *stream, const MPDParser::Segment &segment,
+                        std::vector<uint8_t> data, int32_t generation);
+
+  // Reads [offset, offset + length) of |url|, all of it if |length| is
+  // negative. INFO_DISCONTINUITY if a seek came in meanwhile.
+  status_t download(HTTPSource *http, const std::string &url, int64_t offset, int64_t length,
+                    std::vector<uint8_t> *data, int32_t generation);
+
+  Stream *findStream_l(bool audio) const;
+  // Buffered media time of the emptiest queue, |eos| once all ran out.
+  int64_t getMinBufferedUs_l(bool *eos) const;
+  bool shouldFetch_l(const Stream &stream) const;
+  void updateBuffering_l();
+  void notifyBuffering(bool start);
+};
+
+} // hpc
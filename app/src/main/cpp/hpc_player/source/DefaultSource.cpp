@@ -4,6 +4,23 @@
 #include "MetaData.h"
 #include "Message.h"
 #include "Looper.h"
+#include "MediaPacket.h"
+#include "PacketQueue.h"
+#include "FFmpegExtractor.h"
+#include "Mp4Extractor.h"
+#include "TsExtractor.h"
+#include "ProbeCache.h"
+#include "KeyframeIndex.h"
+#include "KeyframeIndexer.h"
+#include "ConcatExtractor.h"
+#include "CachedSource.h"
+#include "DiskCacheSource.h"
+#include "FileSource.h"
+#include "MmapSource.h"
+#include "UringSource.h"
+#include "HTTPSource.h"
+
+#include <algorithm>
 
 
 #define LOG_TAG "DefaultSource"
@@ -15,34 +32,56 @@ DefaultSource::DefaultSource(const std::shared_ptr<Message> &notify,
                              uid_t uid,
                              const std::shared_ptr<MediaClock> &mediaClock)
     : Source(notify),
-      mMediaClock(mediaClock)
+      mAudioDataGeneration(0),
+      mVideoDataGeneration(0),
+      mMediaClock(mediaClock),
+      mPreparing(false)
 {
 
 }
 
 DefaultSource::~DefaultSource() {
-
+  if (mLooper != nullptr) {
+    mLooper->unregisterHandler(id());
+    mLooper->stop();
+  }
+  if (mKeyframeIndexer != nullptr) {
+    mKeyframeIndexer->stop();
+  }
 }
 
 status_t DefaultSource::setDataSource(const char *url) {
   mUri = url;
+  mSegmentUrls.clear();
   return OK;
 }
 
+status_t DefaultSource::setDataSource(const std::vector<std::string> &urls) {
+  if (urls.empty()) {
+    return BAD_VALUE;
+  }
+  // Every segment gets a source of its own, there is no mUri to open.
+  mUri.clear();
+  mSegmentUrls = urls;
+  return OK;
+}
+
+void DefaultSource::setCacheDirectory(const std::string &dir) {
+  mCacheDirectory = dir;
+}
+
 void DefaultSource::prepareAsync() {
   std::lock_guard _l(mLock);
   ALOGV("prepareAsync: (looper: %d)", (mLooper != NULL));
 
   if (mLooper == NULL) {
-    mLooper = std::make_shared<Looper>;
+    mLooper = std::make_shared<Looper>();
     mLooper->setName("generic");
     mLooper->start();
-
-    //mLooper->registerHandler(enable_shared_from_this());
+    mLooper->registerHandler(shared_from_this());
   }
 
-  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatPrepareAsync);
-  msg->post();
+  std::make_shared<Message>(kWhatPrepareAsync, shared_from_this())->post();
 }
 
 void DefaultSource::start() {
@@ -60,47 +99,39 @@ void DefaultSource::start() {
   mStarted = true;
 }
 
+// Called with or without mLock, from the looper or the decoders: at most
+// one read per track is queued whatever the thread.
 void DefaultSource::postReadBuffer(media_track_type trackType) {
-  if ((mPendingReadBufferTypes & (1 << trackType)) == 0) {
-    mPendingReadBufferTypes |= (1 << trackType);
-    std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatReadBuffer, this);
-    msg->setInt32("trackType", trackType);
+  const uint32_t bit = 1u << trackType;
+  if ((mPendingReadBufferTypes.fetch_or(bit) & bit) == 0) {
+    std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatReadBuffer, shared_from_this());
+    msg->mArg1 = trackType;
     msg->post();
   }
 }
 
 void DefaultSource::onReadBuffer(const std::shared_ptr<Message>& msg) {
-  int32_t tmpType;
-  CHECK(msg->findInt32("trackType", &tmpType));
-  media_track_type trackType = (media_track_type)tmpType;
-  mPendingReadBufferTypes &= ~(1 << trackType);
+  media_track_type trackType = (media_track_type)msg->mArg1;
+  mPendingReadBufferTypes.fetch_and(~(1u << trackType));
   readBuffer(trackType);
 }
 
 void DefaultSource::readBuffer(
-    media_track_type trackType, int64_t seekTimeUs, MediaPlayerSeekMode mode,
+    media_track_type trackType, int64_t seekTimeUs, SeekMode mode,
     int64_t *actualTimeUs, bool formatChange) {
   Track *track;
-  size_t maxBuffers = 1;
   switch (trackType) {
     case MEDIA_TRACK_TYPE_VIDEO:
       track = &mVideoTrack;
-      maxBuffers = 8;  // too large of a number may influence seeks
       break;
     case MEDIA_TRACK_TYPE_AUDIO:
       track = &mAudioTrack;
-      maxBuffers = 64;
-      break;
-    case MEDIA_TRACK_TYPE_SUBTITLE:
-      track = &mSubtitleTrack;
-      break;
-    case MEDIA_TRACK_TYPE_TIMEDTEXT:
-      track = &mTimedTextTrack;
       break;
     default:
+      return;
   }
 
-  if (track->mSource == NULL) {
+  if (track->mExtractor == nullptr) {
     return;
   }
 
@@ -108,109 +139,134 @@ void DefaultSource::readBuffer(
     *actualTimeUs = seekTimeUs;
   }
 
-  MediaSource::ReadOptions options;
-
-  bool seeking = false;
+  // Packets come out of the container interleaved, a read for one track
+  // also fills the queue of the other track sharing the extractor.
+  std::shared_ptr<Extractor> extractor = track->mExtractor;
+  Track *tracks[] = { &mVideoTrack, &mAudioTrack };
   if (seekTimeUs >= 0) {
-    options.setSeekTo(seekTimeUs, mode);
-    seeking = true;
+    extractor->seek(seekTimeUs, mode);
+    for (Track *shared : tracks) {
+      if (shared->mExtractor == extractor) {
+        shared->mPackets->clear();
+      }
+    }
+    mLoopSplicer.onSeek();
+    mTrickPlayNextUs = seekTimeUs;
   }
+  queueDiscontinuityIfNeeded(seekTimeUs >= 0, formatChange, trackType, track);
 
-  const bool couldReadMultiple = (track->mSource->supportReadMultiple());
-
-  if (couldReadMultiple) {
-    options.setNonBlocking();
+  if (mTrickPlaySpeed > 0) {
+    // Audio is muted in trick play.
+    if (trackType == MEDIA_TRACK_TYPE_VIDEO) {
+      readSyncSamples_l(track, kSyncSampleBatch, actualTimeUs);
+    }
+    return;
   }
 
+  // Reads up to the high watermark of the track, see BufferingSettings, but
+  // a slice at a time so that a seek posted meanwhile is not held up.
+  const int64_t sliceEndUs = Looper::GetNowUs() + kReadSliceUs;
+  bool sliceExpired = false;
   int32_t generation = getDataGeneration(trackType);
-  for (size_t numBuffers = 0; numBuffers < maxBuffers; ) {
-    Vector<MediaBufferBase *> mediaBuffers;
-    status_t err = NO_ERROR;
-
-    sp<IMediaSource> source = track->mSource;
-    mLock.unlock();
-    if (couldReadMultiple) {
-      err = source->readMultiple(
-          &mediaBuffers, maxBuffers - numBuffers, &options);
-    } else {
-      MediaBufferBase *mbuf = NULL;
-      err = source->read(&mbuf, &options);
-      if (err == OK && mbuf != NULL) {
-        mediaBuffers.push_back(mbuf);
+  std::unique_ptr<MediaPacket> packet;
+  bool haveActualTime = false;
+  for (size_t numBuffers = 0; shouldReadMore_l(*track); ) {
+    // The packet read could be for either queue, stop while one is full.
+    bool full = false;
+    for (Track *shared : tracks) {
+      if (shared->mExtractor == extractor
+          && (shared->mPackets->isFull()
+              || (int64_t)shared->mPackets->getBufferedBytes() >= mBufferingSettings.mMaxBytes)) {
+        full = true;
       }
     }
-    mLock.lock();
-
-    options.clearNonPersistent();
+    if (full) {
+      break;
+    }
+    if (numBuffers > 0 && Looper::GetNowUs() >= sliceEndUs) {
+      sliceExpired = true;
+      break;
+    }
 
-    size_t id = 0;
-    size_t count = mediaBuffers.size();
+    mLock.unlock();
+    status_t err = extractor->read(packet, -1 /* any selected track */);
+    mLock.lock();
 
     // in case track has been changed since we don't have lock for some time.
     if (generation != getDataGeneration(trackType)) {
-      for (; id < count; ++id) {
-        mediaBuffers[id]->release();
-      }
       break;
     }
 
-    for (; id < count; ++id) {
-      int64_t timeUs;
-      MediaBufferBase *mbuf = mediaBuffers[id];
-      if (!mbuf->meta_data().findInt64(kKeyTime, &timeUs)) {
-        mbuf->meta_data().dumpToLog();
-        track->mPackets->signalEOS(ERROR_MALFORMED);
+    if (err == ERROR_END_OF_STREAM && mLoopSplicer.isEnabled()) {
+      for (Track *shared : tracks) {
+        if (shared->mExtractor == extractor) {
+          mLoopSplicer.onEndOfStream(shared == &mAudioTrack);
+        }
+      }
+      if (!mLoopSplicer.needsWrap()) {
+        // the other extractor is still short of the loop end.
         break;
       }
-      if (trackType == MEDIA_TRACK_TYPE_AUDIO) {
-        mAudioTimeUs = timeUs;
-      } else if (trackType == MEDIA_TRACK_TYPE_VIDEO) {
-        mVideoTimeUs = timeUs;
+      if (mLoopSplicer.wrap()) {
+        wrapLoop_l();
+        continue;
       }
+    }
 
-      queueDiscontinuityIfNeeded(seeking, formatChange, trackType, track);
-
-      sp<ABuffer> buffer = mediaBufferToABuffer(mbuf, trackType);
-      if (numBuffers == 0 && actualTimeUs != nullptr) {
-        *actualTimeUs = timeUs;
-      }
-      if (seeking && buffer != nullptr) {
-        sp<AMessage> meta = buffer->meta();
-        if (meta != nullptr && mode == MediaPlayerSeekMode::SEEK_CLOSEST
-            && seekTimeUs > timeUs) {
-          sp<AMessage> extra = new AMessage;
-          extra->setInt64("resume-at-mediaTimeUs", seekTimeUs);
-          meta->setMessage("extra", extra);
+    if (err != OK) {
+      for (Track *shared : tracks) {
+        if (shared->mExtractor == extractor) {
+          shared->mPackets->signalEOS(err);
         }
       }
+      break;
+    }
 
-      track->mPackets->queueAccessUnit(buffer);
-      formatChange = false;
-      seeking = false;
-      ++numBuffers;
+    Track *target = nullptr;
+    for (Track *shared : tracks) {
+      if (shared->mExtractor == extractor && (int32_t)shared->mIndex == packet->trackIndex) {
+        target = shared;
+      }
     }
-    if (id < count) {
-      // Error, some mediaBuffer doesn't have kKeyTime.
-      for (; id < count; ++id) {
-        mediaBuffers[id]->release();
+    if (target == nullptr) {
+      // An audio track that moved to an extractor of its own, stop
+      // demuxing it here.
+      extractor->selectTrack(packet->trackIndex, false);
+      continue;
+    }
+
+    LoopSplicer::Action action = mLoopSplicer.onPacket(target == &mAudioTrack, packet.get());
+    if (action == LoopSplicer::kDrop) {
+      if (mLoopSplicer.needsWrap() && mLoopSplicer.wrap()) {
+        wrapLoop_l();
       }
-      break;
+      continue;
     }
+    packet->decodeOnly = action == LoopSplicer::kDecodeOnly;
 
-    if (err == WOULD_BLOCK) {
-      break;
-    } else if (err == INFO_FORMAT_CHANGED) {
-#if 0
-      track->mPackets->queueDiscontinuity(
-                    ATSParser::DISCONTINUITY_FORMATCHANGE,
-                    NULL,
-                    false /* discard */);
-#endif
-    } else if (err != OK) {
-      queueDiscontinuityIfNeeded(seeking, formatChange, trackType, track);
-      track->mPackets->signalEOS(err);
-      break;
+    if (packet->discontinuity) {
+      // the extractor has rebased the timestamps, the decoder finds out here
+      target->mPackets->queueDiscontinuity();
+    }
+    if (target == &mAudioTrack) {
+      mAudioTimeUs = packet->ptsUs;
+    } else {
+      mVideoTimeUs = packet->ptsUs;
+      if (mStartupTimeline != nullptr) {
+        mStartupTimeline->mark(StartupTimeline::kFirstPacket);
+      }
+    }
+    if (target == track && !haveActualTime && actualTimeUs != nullptr) {
+      *actualTimeUs = packet->ptsUs;
+      haveActualTime = true;
     }
+    // A packet for the other queue is demuxing work all the same, it counts
+    // toward the slice.
+    ++numBuffers;
+    if (mPlaybackStats != nullptr) {
+      mPlaybackStats->onPacketDemuxed(target == &mAudioTrack, packet->size(), packet->durationUs);
+    }
+    target->mPackets->queuePacket(std::move(packet));
   }
 
   if (mIsStreaming
@@ -226,7 +282,7 @@ void DefaultSource::readBuffer(
       if (mPreparing || mSentPauseOnBuffering) {
         Track *counterTrack =
             (trackType == MEDIA_TRACK_TYPE_VIDEO ? &mAudioTrack : &mVideoTrack);
-        if (counterTrack->mSource != NULL) {
+        if (counterTrack->mExtractor != nullptr) {
           durationUs = counterTrack->mPackets->getBufferedDurationUs(&finalResult);
         }
         if (finalResult == ERROR_END_OF_STREAM || durationUs >= markUs) {
@@ -236,19 +292,181 @@ void DefaultSource::readBuffer(
           } else {
             sendCacheStats();
             mSentPauseOnBuffering = false;
-            sp<AMessage> notify = dupNotify();
-            notify->setInt32("what", kWhatResumeOnBufferingEnd);
+            std::shared_ptr<Message> notify = dupNotify();
+            notify->mArg1 = kWhatResumeOnBufferingEnd;
             notify->post();
           }
         }
       }
-      return;
     }
+  }
 
+  if (sliceExpired) {
     postReadBuffer(trackType);
   }
 }
 
+bool DefaultSource::shouldReadMore_l(const Track &track) const {
+  status_t finalResult;
+  const int64_t bufferedUs = track.mPackets->getBufferedDurationUs(&finalResult);
+  if (finalResult != OK) {
+    return false;
+  }
+  return mBufferingSettings.shouldReadMore(bufferedUs, track.mPackets->getBufferedBytes(), mPreparing);
+}
+
+// The consumer side of the packet queues, on the decoder loopers. It takes
+// no lock, so that a read holding mLock on the looper never stalls a
+// decoder: the queue is the SPSC ring's consumer end and reads are asked
+// for through mPendingReadBufferTypes.
+status_t DefaultSource::dequeueAccessUnit(bool audio, std::unique_ptr<MediaPacket> *packet) {
+  if (!mStarted || mSeeking || (audio && mPendingAudioSwitches > 0)) {
+    return WOULD_BLOCK;
+  }
+
+  Track *track = audio ? &mAudioTrack : &mVideoTrack;
+  media_track_type trackType = audio ? MEDIA_TRACK_TYPE_AUDIO : MEDIA_TRACK_TYPE_VIDEO;
+  std::shared_ptr<PacketQueue> packets = std::atomic_load(&track->mPackets);
+  if (packets == nullptr) {
+    return WOULD_BLOCK;
+  }
+
+  status_t result = packets->dequeuePacket(packet);
+  if (mSeeking) {
+    // seekTo() ran meanwhile, what came out predates the seek.
+    packet->reset();
+    return WOULD_BLOCK;
+  }
+  if (result == WOULD_BLOCK) {
+    postReadBuffer(trackType);
+    return WOULD_BLOCK;
+  } else if (result != OK) {
+    return result;
+  }
+
+  // Below the low watermark the queue is topped up in one go.
+  status_t finalResult;
+  const int64_t bufferedUs = packets->getBufferedDurationUs(&finalResult);
+  if (finalResult == OK && bufferedUs < mResumeReadingMarkUs) {
+    postReadBuffer(trackType);
+  }
+  if (audio) {
+    mAudioLastDequeueTimeUs = (*packet)->ptsUs;
+  } else {
+    mVideoLastDequeueTimeUs = (*packet)->ptsUs;
+  }
+  return OK;
+}
+
+status_t DefaultSource::initFromDataSource() {
+  std::shared_ptr<Extractor> extractor;
+  if (!mSegmentUrls.empty()) {
+    std::shared_ptr<ConcatExtractor> concat = std::make_shared<ConcatExtractor>(mSegmentUrls);
+    status_t err = concat->init(mSegmentUrls.front().c_str());
+    if (err != OK) {
+      return err;
+    }
+    extractor = concat;
+  }
+  const bool local = mDataSource != nullptr
+      && (mDataSource->flags() & DataSource::kIsLocalFileSource) != 0;
+  // Local files without a seek table, TS, Matroska without Cues, ADTS or
+  // MP3, get their key frames indexed and kept in a sidecar.
+  std::shared_ptr<KeyframeIndex> keyframeIndex;
+  if (local && !mCacheDirectory.empty()) {
+    const std::string key = ProbeCache::KeyFor(mUri.c_str(), mDataSource.get());
+    if (!key.empty()) {
+      keyframeIndex = std::make_shared<KeyframeIndex>(mCacheDirectory + "/keyframes", key);
+    }
+  }
+  std::shared_ptr<Extractor> indexer;
+  // Local MP4 is demuxed natively, indexed once at open; whatever it does
+  // not support falls back to FFmpeg.
+  if (local && Mp4Extractor::Sniff(mDataSource.get())) {
+    std::shared_ptr<Mp4Extractor> mp4 = std::make_shared<Mp4Extractor>();
+    mp4->setDataSource(mDataSource);
+    mp4->setStartupTimeline(mStartupTimeline);
+    if (mp4->init(mUri.c_str()) == OK) {
+      extractor = mp4;
+    }
+  }
+  // So is MPEG-TS, local or live, it locks on without probing for seconds.
+  if (extractor == nullptr && mDataSource != nullptr && TsExtractor::Sniff(mDataSource.get())) {
+    std::shared_ptr<TsExtractor> ts = std::make_shared<TsExtractor>();
+    ts->setDataSource(mDataSource);
+    ts->setStartupTimeline(mStartupTimeline);
+    ts->setKeyframeIndex(keyframeIndex);
+    if (ts->init(mUri.c_str()) == OK) {
+      extractor = ts;
+      std::shared_ptr<MmapSource> mapped = keyframeIndex != nullptr && !keyframeIndex->isComplete()
+          ? MmapSource::Create(mUri.c_str()) : nullptr;
+      if (mapped != nullptr && mapped->initCheck() == OK) {
+        std::shared_ptr<TsExtractor> scan = std::make_shared<TsExtractor>();
+        scan->setDataSource(mapped);
+        scan->setRequiresVideo(false);
+        scan->setKeyframeIndex(keyframeIndex);
+        indexer = scan;
+      }
+    }
+  }
+  if (extractor == nullptr) {
+    std::shared_ptr<FFmpegExtractor> ffmpeg = std::make_shared<FFmpegExtractor>();
+    ffmpeg->setStartupTimeline(mStartupTimeline);
+    ffmpeg->setProbeCache(mProbeCache);
+    ffmpeg->setKeyframeIndex(keyframeIndex);
+    if (mDataSource != nullptr) {
+      ffmpeg->setDataSource(mDataSource);
+    }
+    status_t err = ffmpeg->init(mUri.c_str());
+    if (err != OK) {
+      return err;
+    }
+    extractor = ffmpeg;
+    if (ffmpeg->getKeyframeIndex() != nullptr && !ffmpeg->getKeyframeIndex()->isComplete()) {
+      std::shared_ptr<FFmpegExtractor> scan = std::make_shared<FFmpegExtractor>();
+      scan->setRequiresVideo(false);
+      scan->setKeyframeIndex(keyframeIndex);
+      indexer = scan;
+    }
+  }
+
+  std::vector<Extractor::TrackInfo> trackInfos(extractor->getTrackCount());
+  for (size_t i = 0; i < trackInfos.size(); ++i) {
+    extractor->getTrackInfo(i, &trackInfos[i]);
+  }
+
+  std::lock_guard _l(mLock);
+  mDurationUs = extractor->getDurationUs() > 0 ? extractor->getDurationUs() : -1;
+  // Ahead of playback, a seek past where playback has read is exact too
+  // once the indexer got there.
+  if (indexer != nullptr) {
+    mKeyframeIndexer = std::make_unique<KeyframeIndexer>(indexer, mUri);
+    mKeyframeIndexer->start();
+  }
+  mTrackInfos.swap(trackInfos);
+  mExtractor.push_back(extractor);
+  mVideoTrack.mIndex = extractor->getVideoStreamIndex();
+  mVideoTrack.mExtractor = extractor;
+  std::atomic_store(&mVideoTrack.mPackets, std::make_shared<PacketQueue>());
+  if (extractor->getAudioStreamIndex() >= 0) {
+    mAudioTrack.mIndex = extractor->getAudioStreamIndex();
+    mAudioTrack.mExtractor = extractor;
+    std::atomic_store(&mAudioTrack.mPackets, std::make_shared<PacketQueue>());
+  }
+  return OK;
+}
+
+int32_t DefaultSource::getDataGeneration(media_track_type type) const {
+  switch (type) {
+    case MEDIA_TRACK_TYPE_VIDEO:
+      return mVideoDataGeneration;
+    case MEDIA_TRACK_TYPE_AUDIO:
+      return mAudioDataGeneration;
+    default:
+      return -1;
+  }
+}
+
 void DefaultSource::onPrepareAsync() {
   mDisconnectLock.lock();
   ALOGV("onPrepareAsync: mDataSource: %d", (mDataSource != NULL));
@@ -260,51 +478,65 @@ void DefaultSource::onPrepareAsync() {
     mIsSecure = false;
 
     if (!mUri.empty()) {
-      const char* uri = mUri.c_str();
-      String8 contentType;
-
-      //if (!strncasecmp("http://", uri, 7) || !strncasecmp("https://", uri, 8))
-
-      if (property_get_bool("media.stagefright.extractremote", true) &&
-          !PlayerServiceFileSource::requiresDrm(
-              mFd.get(), mOffset, mLength, nullptr /* mime */)) {
-        sp<IBinder> binder =
-            defaultServiceManager()->getService(String16("media.extractor"));
-        if (binder != nullptr) {
-          ALOGD("FileSource remote");
-          sp<IMediaExtractorService> mediaExService(
-              interface_cast<IMediaExtractorService>(binder));
-          sp<IDataSource> source;
-          mediaExService->makeIDataSource(base::unique_fd(dup(mFd.get())), mOffset, mLength, &source);
-          ALOGV("IDataSource(FileSource): %p %d %lld %lld",
-                source.get(), mFd.get(), (long long)mOffset, (long long)mLength);
-          if (source.get() != nullptr) {
-            mDataSource = CreateDataSourceFromIDataSource(source);
+      // Local files are mapped, the kernel reads ahead of the demuxer and
+      // payloads are copied once, out of the page cache. Those that cannot
+      // be mapped are read ahead with io_uring or, where that is filtered,
+      // through the cache, slow storage would stall the demuxer otherwise.
+      // http:// goes through the disk cache when there is a cache directory.
+      // Other schemes, https:// too, are left to FFmpeg's own protocols.
+      std::shared_ptr<DataSource> source;
+      std::shared_ptr<MmapSource> mapped = MmapSource::Create(mUri.c_str());
+      if (mapped != nullptr && mapped->initCheck() == OK) {
+        mDataSource = mapped;
+      } else if (mapped != nullptr) {
+        std::shared_ptr<UringSource> uring = UringSource::Create(mUri.c_str());
+        if (uring->initCheck() == OK && uring->isAsync()) {
+          mDataSource = uring;
+        } else {
+          source = FileSource::Create(mUri.c_str());
+        }
+      } else if (HTTPSource::IsSupported(mUri.c_str())) {
+        mHttpSource = std::make_shared<HTTPSource>(mUri.c_str());
+        source = mHttpSource;
+        if (!mCacheDirectory.empty()) {
+          std::shared_ptr<DataSource> disk = std::make_shared<DiskCacheSource>(
+              mHttpSource, DiskCacheSource::PathFor(mCacheDirectory, mUri));
+          if (disk->initCheck() == OK) {
+            source = disk;
           } else {
-            ALOGW("extractor service cannot make data source");
+            ALOGW("no disk cache for %s", mUri.c_str());
           }
-        } else {
-          ALOGW("extractor service not running");
         }
       }
-
-    if (mDataSource == NULL) {
-      ALOGE("Failed to create data source!");
-      mDisconnectLock.unlock();
-      notifyPreparedAndCleanup(UNKNOWN_ERROR);
-      return;
+      if (source != nullptr) {
+        if (source->initCheck() != OK) {
+          ALOGE("Failed to create data source!");
+          mHttpSource.reset();
+          mDisconnectLock.unlock();
+          notifyPreparedAndCleanup(UNKNOWN_ERROR);
+          return;
+        }
+        mDataSource = std::make_shared<CachedSource>(source);
+      }
     }
   }
 
-  if (mDataSource->flags() & DataSource::kIsCachingDataSource) {
-    mCachedSource = static_cast<NuCachedSource2 *>(mDataSource.get());
+  // Stream info probed once is looked up by later prepares, and by the
+  // extractor opened again for an audio track switch.
+  if (!mCacheDirectory.empty()) {
+    mProbeCache = std::make_shared<ProbeCache>(mCacheDirectory + "/probe");
+  }
+
+  if (mDataSource != nullptr && (mDataSource->flags() & DataSource::kIsCachingDataSource)) {
+    mCachedSource = std::static_pointer_cast<CachedSource>(mDataSource);
   }
 
   mDisconnectLock.unlock();
 
   // For cached streaming cases, we need to wait for enough
   // buffering before reporting prepared.
-  mIsStreaming = (mCachedSource != NULL);
+  mIsStreaming = mCachedSource != nullptr
+      && (mCachedSource->flags() & DataSource::kIsHTTPBasedSource) != 0;
 
   // init extractor from data source
   status_t err = initFromDataSource();
@@ -315,20 +547,12 @@ void DefaultSource::onPrepareAsync() {
     return;
   }
 
-  if (mVideoTrack.mSource != NULL) {
-    sp<MetaData> meta = getFormatMeta_l(false /* audio */);
-    sp<AMessage> msg = new AMessage;
-    err = convertMetaDataToMessage(meta, &msg);
-    if(err != OK) {
-      notifyPreparedAndCleanup(err);
-      return;
-    }
-    notifyVideoSizeChanged(msg);
+  if (mVideoTrack.mExtractor != nullptr) {
+    // the player asks getFormatMeta() for the size
+    notifyVideoSizeChanged();
   }
 
   notifyFlagsChanged(
-      // FLAG_SECURE will be known if/when prepareDrm is called by the app
-      // FLAG_PROTECTED will be known if/when prepareDrm is called by the app
       FLAG_CAN_PAUSE |
           FLAG_CAN_SEEK_BACKWARD |
           FLAG_CAN_SEEK_FORWARD |
@@ -339,15 +563,51 @@ void DefaultSource::onPrepareAsync() {
   ALOGV("onPrepareAsync: Done");
 }
 
-void DefaultSource::postReadBuffer(media_track_type trackType) {
-  if ((mPendingReadBufferTypes & (1 << trackType)) == 0) {
-    mPendingReadBufferTypes |= (1 << trackType);
-    std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatReadBuffer);
-    msg->setInt(trackType);
-    msg->post();
+// A streamed source reports prepared from readBuffer() once the initial
+// mark is buffered, a local one right away.
+void DefaultSource::finishPrepareAsync() {
+  std::lock_guard _l(mLock);
+  if (mIsStreaming) {
+    mPreparing = true;
+  } else {
+    notifyPrepared();
+  }
+  if (mAudioTrack.mExtractor != nullptr) {
+    postReadBuffer(MEDIA_TRACK_TYPE_AUDIO);
+  }
+  if (mVideoTrack.mExtractor != nullptr) {
+    postReadBuffer(MEDIA_TRACK_TYPE_VIDEO);
   }
 }
 
+void DefaultSource::notifyPreparedAndCleanup(status_t err) {
+  if (err != OK) {
+    {
+      std::lock_guard<std::mutex> autoLock(mDisconnectLock);
+      mDataSource.reset();
+      mCachedSource.reset();
+      mHttpSource.reset();
+    }
+    std::lock_guard _l(mLock);
+    mExtractor.clear();
+    mVideoTrack = Track();
+    mAudioTrack = Track();
+    mPreparing = false;
+  }
+  notifyPrepared(err);
+}
+
+void DefaultSource::sendCacheStats() {
+  if (mCachedSource == nullptr) {
+    return;
+  }
+  status_t finalStatus;
+  std::shared_ptr<Message> notify = dupNotify();
+  notify->mArg1 = kWhatCacheStats;
+  notify->mArg2 = (int64_t)mCachedSource->getCachedBytes(&finalStatus);
+  notify->post();
+}
+
 void DefaultSource::stop() {
   std::lock_guard _l(mLock);
   mStarted = false;
@@ -363,47 +623,457 @@ void DefaultSource::resume() {
   mStarted = true;
 }
 void DefaultSource::disconnect() {
-//  sp<DataSource> dataSource, httpSource;
-//  {
-//    Mutex::Autolock _l_d(mDisconnectLock);
-//    dataSource = mDataSource;
-//    httpSource = mHttpSource;
-//    mDisconnected = true;
-//  }
-//
-//  if (dataSource != NULL) {
-//    // disconnect data source
-//    if (dataSource->flags() & DataSource::kIsCachingDataSource) {
-//      static_cast<NuCachedSource2 *>(dataSource.get())->disconnect();
-//    }
-//  } else if (httpSource != NULL) {
-//    static_cast<HTTPBase *>(httpSource.get())->disconnect();
-//  }
+  std::shared_ptr<DataSource> dataSource, httpSource;
+  {
+    std::lock_guard<std::mutex> autoLock(mDisconnectLock);
+    dataSource = mDataSource;
+    httpSource = mHttpSource;
+    mDisconnected = true;
+  }
+
+  // Wakes a prepare or read blocked on the network.
+  if (dataSource != nullptr) {
+    dataSource->close();
+  } else if (httpSource != nullptr) {
+    httpSource->close();
+  }
 }
 
 std::shared_ptr<MetaData> DefaultSource::getFileFormatMeta() const {
   return mFileMeta;
 }
 
+// Reads in progress are dropped by the generations, the queues are cleared
+// and the extractors moved on the looper, the producer's thread.
 status_t DefaultSource::seekTo(int64_t seekTimeUs, SeekMode mode) {
-  return Source::seekTo(seekTimeUs, mode);
+  std::lock_guard _l(mLock);
+  if (mVideoTrack.mExtractor == nullptr && mAudioTrack.mExtractor == nullptr) {
+    return NO_INIT;
+  }
+  ++mVideoDataGeneration;
+  ++mAudioDataGeneration;
+  mSeeking = true;
+  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatSeek, shared_from_this());
+  msg->mArg1 = std::max<int64_t>(seekTimeUs, 0);
+  msg->mArg2 = mode;
+  msg->post();
+  return OK;
+}
+
+void DefaultSource::doSeek(int64_t seekTimeUs, SeekMode mode) {
+  if (mVideoTrack.mExtractor != nullptr) {
+    readBuffer(MEDIA_TRACK_TYPE_VIDEO, seekTimeUs, mode);
+  }
+  // An audio track on an extractor of its own is moved separately, to where
+  // video landed on its sync sample unless the seek is exact.
+  if (mAudioTrack.mExtractor != nullptr
+      && mAudioTrack.mExtractor != mVideoTrack.mExtractor) {
+    const int64_t audioTimeUs =
+        mode == SEEK_CLOSEST || mVideoTimeUs < 0 ? seekTimeUs : mVideoTimeUs;
+    readBuffer(MEDIA_TRACK_TYPE_AUDIO, audioTimeUs, SEEK_PREVIOUS_SYNC);
+  }
+  mAudioLastDequeueTimeUs = seekTimeUs;
+  mVideoLastDequeueTimeUs = seekTimeUs;
+  mSeeking = false;
 }
 
 status_t DefaultSource::getDuration(int64_t *durationUs) {
-  return mFormatContext->duration;
+  std::lock_guard _l(mLock);
+  if (mDurationUs < 0) {
+    return UNKNOWN_ERROR;
+  }
+  *durationUs = mDurationUs;
+  return OK;
 }
 
 size_t DefaultSource::getTrackCount() const {
-  return Source::getTrackCount();
+  std::lock_guard _l(mLock);
+  return mTrackInfos.size();
+}
+
+status_t DefaultSource::getTrackInfo(size_t trackIndex, Extractor::TrackInfo *info) const {
+  std::lock_guard _l(mLock);
+  if (trackIndex >= mTrackInfos.size()) {
+    return ERROR_OUT_OF_RANGE;
+  }
+  *info = mTrackInfos[trackIndex];
+  return OK;
+}
+
+ssize_t DefaultSource::getSelectedTrack(media_track_type type) const {
+  std::lock_guard _l(mLock);
+  switch (type) {
+    case MEDIA_TRACK_TYPE_VIDEO:
+      return mVideoTrack.mExtractor != nullptr ? (ssize_t)mVideoTrack.mIndex : -1;
+    case MEDIA_TRACK_TYPE_AUDIO:
+      return mAudioTrack.mExtractor != nullptr ? (ssize_t)mAudioTrack.mIndex : -1;
+    default:
+      return -1;
+  }
+}
+
+// Readers drop mLock while they are in the extractor, this only waits for
+// queue bookkeeping.
+// Wait-free like the queue's getters, polled by the player while it buffers.
+int64_t DefaultSource::getBufferedDurationUs(bool audio, size_t *bytes) const {
+  const Track &track = audio ? mAudioTrack : mVideoTrack;
+  std::shared_ptr<PacketQueue> packets = std::atomic_load(&track.mPackets);
+  if (packets == nullptr) {
+    *bytes = 0;
+    return 0;
+  }
+  status_t finalResult;
+  *bytes = packets->getBufferedBytes();
+  return packets->getBufferedDurationUs(&finalResult);
+}
+
+status_t DefaultSource::setLoopRange(int64_t startUs, int64_t endUs) {
+  std::lock_guard _l(mLock);
+  mLoopSplicer.setTracks(mVideoTrack.mExtractor != nullptr, mAudioTrack.mExtractor != nullptr);
+  mLoopSplicer.setRange(startUs, endUs);
+  return OK;
+}
+
+int64_t DefaultSource::getStreamTimeUs(int64_t mediaUs) const {
+  std::lock_guard _l(mLock);
+  return mLoopSplicer.getStreamTimeUs(mediaUs);
+}
+
+status_t DefaultSource::setTrickPlaySpeed(float speed) {
+  if (speed < 0) {
+    return BAD_VALUE;
+  }
+  std::lock_guard _l(mLock);
+  mTrickPlaySpeed = speed;
+  mTrickPlayNextUs = std::max<int64_t>(mVideoTimeUs, 0);
+  return OK;
+}
+
+status_t DefaultSource::setBufferingSettings(const BufferingSettings &settings) {
+  if (!settings.isValid()) {
+    return BAD_VALUE;
+  }
+  std::lock_guard _l(mLock);
+  mBufferingSettings = settings;
+  mResumeReadingMarkUs = settings.mResumePlaybackMarkMs * 1000LL;
+  return OK;
+}
+
+BufferingSettings DefaultSource::getBufferingSettings() const {
+  std::lock_guard _l(mLock);
+  return mBufferingSettings;
+}
+
+// One sync sample per kTrickPlayIntervalUs of wall time at the trick play
+// speed. The extractor jumps over everything in between, the decoder only
+// ever sees sync samples.
+void DefaultSource::readSyncSamples_l(Track *track, size_t maxBuffers, int64_t *actualTimeUs) {
+  std::shared_ptr<Extractor> extractor = track->mExtractor;
+  int32_t generation = getDataGeneration(MEDIA_TRACK_TYPE_VIDEO);
+  std::unique_ptr<MediaPacket> packet;
+  for (size_t numBuffers = 0; numBuffers < maxBuffers && !track->mPackets->isFull(); ++numBuffers) {
+    const int64_t minTimeUs = mTrickPlayNextUs;
+    mLock.unlock();
+    status_t err = extractor->readSyncSample(packet, minTimeUs);
+    mLock.lock();
+
+    if (generation != getDataGeneration(MEDIA_TRACK_TYPE_VIDEO)) {
+      break;
+    }
+    if (err != OK) {
+      track->mPackets->signalEOS(err);
+      break;
+    }
+    if (numBuffers == 0 && actualTimeUs != nullptr) {
+      *actualTimeUs = packet->ptsUs;
+    }
+    mVideoTimeUs = packet->ptsUs;
+    mTrickPlayNextUs = packet->ptsUs + (int64_t)(mTrickPlaySpeed * kTrickPlayIntervalUs);
+    if (mPlaybackStats != nullptr) {
+      mPlaybackStats->onPacketDemuxed(false /* audio */, packet->size(), packet->durationUs);
+    }
+    track->mPackets->queuePacket(std::move(packet));
+  }
+}
+
+// A seek has cleared the queue and the decoder is flushed with it. A format
+// change is queued behind the packets of the old format, the decoder gets to
+// it in order.
+void DefaultSource::queueDiscontinuityIfNeeded(
+    bool seeking, bool formatChange, media_track_type trackType, Track *track) {
+  if (!formatChange) {
+    return;
+  }
+  ALOGV("%s format change%s", trackType == MEDIA_TRACK_TYPE_AUDIO ? "audio" : "video",
+        seeking ? " at seek" : "");
+  track->mPackets->queueDiscontinuity();
+}
+
+// Every extractor in use goes back to the loop start. The packets already
+// queued stay, playback runs into the new pass without a flush.
+void DefaultSource::wrapLoop_l() {
+  const int64_t startUs = mLoopSplicer.getStartUs();
+  if (mVideoTrack.mExtractor != nullptr) {
+    mVideoTrack.mExtractor->seek(startUs, SEEK_PREVIOUS_SYNC);
+  }
+  if (mAudioTrack.mExtractor != nullptr && mAudioTrack.mExtractor != mVideoTrack.mExtractor) {
+    mAudioTrack.mExtractor->seek(startUs, SEEK_PREVIOUS_SYNC);
+  }
+  ALOGV("loop %d back to %lld us", mLoopSplicer.getLoopCount(), (long long)startUs);
+}
+
+status_t DefaultSource::selectTrack(size_t trackIndex, bool select, int64_t timeUs) {
+  Extractor::TrackInfo info;
+  status_t err = getTrackInfo(trackIndex, &info);
+  if (err != OK) {
+    return err;
+  }
+  if (info.type != MEDIA_TRACK_TYPE_AUDIO) {
+    ALOGE("only audio tracks can be switched, track %zu has type %d", trackIndex, info.type);
+    return INVALID_OPERATION;
+  }
+  if (!select) {
+    ALOGE("deselecting the audio track is not supported");
+    return INVALID_OPERATION;
+  }
+
+  std::lock_guard _l(mLock);
+  if (mAudioTrack.mExtractor != nullptr && mAudioTrack.mIndex == trackIndex
+      && mPendingAudioSwitches == 0) {
+    return OK;
+  }
+  // The player resumes its audio decoder right after this returns, it must
+  // not get packets of the old track meanwhile.
+  ++mPendingAudioSwitches;
+  // The extractors are only opened and read on the source looper.
+  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatSelectTrack, shared_from_this());
+  msg->mArg1 = (int64_t)trackIndex;
+  msg->mArg2 = timeUs;
+  msg->post();
+  return OK;
+}
+
+// Another extractor of the kind the video is demuxed with, over the same
+// segments or file, so that its track numbers are those of mTrackInfos.
+// On the looper without mLock, opening may take a while.
+std::shared_ptr<Extractor> DefaultSource::reopenExtractor() {
+  const bool local = mDataSource != nullptr
+      && (mDataSource->flags() & DataSource::kIsLocalFileSource) != 0;
+  std::shared_ptr<Extractor> extractor;
+  status_t err;
+  if (std::dynamic_pointer_cast<ConcatExtractor>(mVideoTrack.mExtractor) != nullptr) {
+    std::shared_ptr<ConcatExtractor> concat = std::make_shared<ConcatExtractor>(mSegmentUrls);
+    err = concat->init(mSegmentUrls.front().c_str());
+    extractor = concat;
+  } else if (std::dynamic_pointer_cast<Mp4Extractor>(mVideoTrack.mExtractor) != nullptr) {
+    // Local only, both extractors read the file on this looper.
+    std::shared_ptr<Mp4Extractor> mp4 = std::make_shared<Mp4Extractor>();
+    mp4->setDataSource(mDataSource);
+    err = mp4->init(mUri.c_str());
+    extractor = mp4;
+  } else if (std::dynamic_pointer_cast<TsExtractor>(mVideoTrack.mExtractor) != nullptr) {
+    std::shared_ptr<DataSource> source = mDataSource;
+    if (!local) {
+      // A stream cannot be read at two positions through one connection.
+      source = std::make_shared<CachedSource>(std::make_shared<HTTPSource>(mUri.c_str()));
+    }
+    std::shared_ptr<TsExtractor> ts = std::make_shared<TsExtractor>();
+    ts->setDataSource(source);
+    err = ts->init(mUri.c_str());
+    extractor = ts;
+  } else {
+    std::shared_ptr<FFmpegExtractor> ffmpeg = std::make_shared<FFmpegExtractor>();
+    ffmpeg->setProbeCache(mProbeCache);
+    if (local) {
+      ffmpeg->setDataSource(mDataSource);
+    }
+    err = ffmpeg->init(mUri.c_str());
+    extractor = ffmpeg;
+  }
+  if (err != OK) {
+    ALOGE("cannot open %s again for audio: %d", mUri.c_str(), err);
+    return nullptr;
+  }
+  extractor->selectTrack(extractor->getVideoStreamIndex(), false);
+  return extractor;
+}
+
+void DefaultSource::onSelectTrack(size_t trackIndex, int64_t timeUs) {
+  std::shared_ptr<Extractor> extractor;
+  {
+    std::lock_guard _l(mLock);
+    extractor = mAudioTrack.mExtractor;
+  }
+  // The shared extractor has read past |timeUs| on the new track already.
+  // Opening the source again is the only way to get there without moving
+  // the video read position; later switches reuse this extractor.
+  bool opened = false;
+  if (extractor == nullptr || extractor == mVideoTrack.mExtractor) {
+    extractor = reopenExtractor();
+    opened = extractor != nullptr;
+  }
+
+  std::lock_guard _l(mLock);
+  if (opened) {
+    mExtractor.push_back(extractor);
+  }
+  doSelectTrack(trackIndex, timeUs, extractor);
+  --mPendingAudioSwitches;
+}
+
+void DefaultSource::doSelectTrack(
+    size_t trackIndex, int64_t timeUs, const std::shared_ptr<Extractor> &extractor) {
+  if (extractor == nullptr || extractor == mVideoTrack.mExtractor) {
+    ALOGE("no extractor for audio track %zu", trackIndex);
+    return;
+  }
+
+  // also stops demuxing the previous audio track of a reused extractor
+  status_t err = extractor->selectTrack(trackIndex, true);
+  if (err == OK) {
+    err = extractor->seek(timeUs, SEEK_PREVIOUS_SYNC);
+  }
+  if (err != OK) {
+    ALOGE("cannot switch to audio track %zu: %d", trackIndex, err);
+    return;
+  }
+
+  // Only the audio queue is dropped, video is not touched.
+  ++mAudioDataGeneration;
+  mAudioTrack.mIndex = trackIndex;
+  mAudioTrack.mExtractor = extractor;
+  if (mAudioTrack.mPackets == nullptr) {
+    std::atomic_store(&mAudioTrack.mPackets, std::make_shared<PacketQueue>());
+  }
+  mAudioTrack.mPackets->clear();
+  mAudioLastDequeueTimeUs = timeUs;
+  ALOGI("switched to audio track %zu (%s) at %lld us", trackIndex,
+        mTrackInfos[trackIndex].language.c_str(), (long long)timeUs);
+
+  if (mStarted) {
+    postReadBuffer(MEDIA_TRACK_TYPE_AUDIO);
+  }
 }
 bool DefaultSource::isStreaming() const {
-  return Source::isStreaming();
+  return mIsStreaming;
 }
 void DefaultSource::onMessageReceived(const std::shared_ptr<Message> &msg) {
-  Source::onMessageReceived(msg);
+  switch (msg->what()) {
+    case kWhatPrepareAsync:
+      onPrepareAsync();
+      break;
+
+    case kWhatReadBuffer:
+    {
+      std::lock_guard _l(mLock);
+      onReadBuffer(msg);
+      break;
+    }
+
+    case kWhatSelectTrack:
+    {
+      onSelectTrack((size_t)msg->mArg1, msg->mArg2);
+      break;
+    }
+
+    case kWhatSeek:
+    {
+      std::lock_guard _l(mLock);
+      doSeek(msg->mArg1, (SeekMode)msg->mArg2);
+      break;
+    }
+
+    default:
+      Source::onMessageReceived(msg);
+      break;
+  }
 }
+
 std::shared_ptr<MetaData> DefaultSource::getFormatMeta(bool audio) {
-  return Source::getFormatMeta(audio);
+  std::lock_guard _l(mLock);
+  return getFormatMeta_l(audio);
+}
+
+// The coded pixel format as the codec configuration record states it, for
+// headers read without find_stream_info or by the native extractors, which
+// leave it unknown. It keys DecoderPool, so a 10 bit stream never gets an
+// 8 bit decoder. AV_PIX_FMT_NONE where the record does not tell.
+static int pixelFormatFromExtradata(const AVCodecParameters *params) {
+  const uint8_t *data = params->extradata;
+  const int size = params->extradata_size;
+  int chromaFormat = -1;
+  int bitDepth = -1;
+  if (params->codec_id == AV_CODEC_ID_HEVC && size >= 23 && data[0] == 1) {
+    // hvcC: chromaFormat and bitDepthLumaMinus8 in the low bits of 16, 17.
+    chromaFormat = data[16] & 0x03;
+    bitDepth = (data[17] & 0x07) + 8;
+  } else if (params->codec_id == AV_CODEC_ID_H264 && size >= 7 && data[0] == 1) {
+    // avcC: up to High the profile implies 4:2:0 8 bit, High 10 is 10 bit.
+    switch (data[1]) {
+      case 66: case 77: case 88: case 100:
+        chromaFormat = 1;
+        bitDepth = 8;
+        break;
+      case 110:
+        chromaFormat = 1;
+        bitDepth = 10;
+        break;
+      default:
+        break;
+    }
+  }
+
+  static const struct {
+    int chromaFormat;
+    int bitDepth;
+    AVPixelFormat format;
+  } kFormats[] = {
+    { 0,  8, AV_PIX_FMT_GRAY8 },
+    { 1,  8, AV_PIX_FMT_YUV420P },
+    { 1, 10, AV_PIX_FMT_YUV420P10 },
+    { 2,  8, AV_PIX_FMT_YUV422P },
+    { 2, 10, AV_PIX_FMT_YUV422P10 },
+    { 3,  8, AV_PIX_FMT_YUV444P },
+    { 3, 10, AV_PIX_FMT_YUV444P10 },
+  };
+  for (const auto &entry : kFormats) {
+    if (entry.chromaFormat == chromaFormat && entry.bitDepth == bitDepth) {
+      return entry.format;
+    }
+  }
+  return AV_PIX_FMT_NONE;
+}
+
+std::shared_ptr<MetaData> DefaultSource::getFormatMeta_l(bool audio) {
+  Track *track = audio ? &mAudioTrack : &mVideoTrack;
+  if (track->mExtractor == nullptr) {
+    return nullptr;
+  }
+
+  std::shared_ptr<MetaData> meta = std::make_shared<MetaData>();
+  if (!audio) {
+    track->mExtractor->getMetaData(*meta);
+  } else {
+    // The extractor's meta describes its video, the audio format comes from
+    // the selected track.
+    const Extractor::TrackInfo &info = mTrackInfos[track->mIndex];
+    meta->mime = info.mime_type;
+    meta->sampleRate = info.sample_rate;
+    meta->channelCount = info.channel_count;
+  }
+
+  // The codec configuration record, which the decoder opens with.
+  AVCodecParameters *params = avcodec_parameters_alloc();
+  if (params != nullptr
+      && track->mExtractor->getCodecParameters(track->mIndex, params) == OK
+      && params->extradata_size > 0) {
+    meta->csd.assign(params->extradata, params->extradata + params->extradata_size);
+    if (!audio && meta->pixelFormat < 0) {
+      meta->pixelFormat = pixelFormatFromExtradata(params);
+    }
+  }
+  avcodec_parameters_free(&params);
+  return meta;
 }
 
 }
\ No newline at end of file
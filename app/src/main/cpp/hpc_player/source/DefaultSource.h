@@ -3,19 +3,26 @@
 //#include "../HpcPlayerInternal.h"
 #include "Source.h"
 #include "Error.h"
+#include "LoopSplicer.h"
+
+#include <atomic>
+#include <vector>
 
 namespace hpc {
 
-struct AnotherPacketSource;
+class PacketQueue;
+class MediaPacket;
 struct ARTSPController;
 class DataSource;
 class IDataSource;
 struct IMediaHTTPService;
 struct Extractor;
 class IMediaSource;
-class MediaBuffer;
+struct MediaBuffer;
 class MediaClock;
-struct NuCachedSource2;
+class CachedSource;
+class ProbeCache;
+class KeyframeIndexer;
 struct MetaData;
 
 class DefaultSource : public Source {
@@ -26,6 +33,13 @@ class DefaultSource : public Source {
 
 
   status_t setDataSource(const char *url);
+  // Independently encoded files played back to back as one timeline, see
+  // ConcatExtractor.
+  status_t setDataSource(const std::vector<std::string> &urls);
+  // HTTP(S) urls are cached on disk under |dir|, see DiskCacheSource, and
+  // the stream info of every url under |dir|/probe, see ProbeCache. Before
+  // prepareAsync(); empty, the default, streams without a disk cache.
+  void setCacheDirectory(const std::string &dir);
 
   void prepareAsync() override;
 
@@ -36,15 +50,24 @@ class DefaultSource : public Source {
 
   void disconnect() override;
 
-  std::shared_ptr<MetaData> getFileFormatMeta() const override;
+  std::shared_ptr<MetaData> getFileFormatMeta() const;
 
-  //virtual status_t dequeueAccessUnit(bool audio, std::shared_ptr<ABuffer> *accessUnit);
+  status_t dequeueAccessUnit(bool audio, std::unique_ptr<MediaPacket> *packet) override;
 
-  virtual status_t getDuration(int64_t *durationUs);
+  status_t getDuration(int64_t *durationUs) override;
   virtual size_t getTrackCount() const;
-//  virtual ssize_t getSelectedTrack(media_track_type type) const;
-//  virtual status_t selectTrack(size_t trackIndex, bool select, int64_t timeUs);
+  status_t getTrackInfo(size_t trackIndex, Extractor::TrackInfo *info) const override;
+  ssize_t getSelectedTrack(media_track_type type) const override;
+  // Audio only. The new track gets an extractor of its own, positioned at
+  // |timeUs|, so that video keeps its read position and queued packets.
+  status_t selectTrack(size_t trackIndex, bool select, int64_t timeUs) override;
   virtual status_t seekTo(int64_t seekTimeUs,SeekMode mode = SEEK_PREVIOUS_SYNC) override;
+  int64_t getBufferedDurationUs(bool audio, size_t *bytes) const override;
+  status_t setLoopRange(int64_t startUs, int64_t endUs) override;
+  int64_t getStreamTimeUs(int64_t mediaUs) const override;
+  status_t setTrickPlaySpeed(float speed) override;
+  status_t setBufferingSettings(const BufferingSettings &settings) override;
+  BufferingSettings getBufferingSettings() const override;
 
   virtual bool isStreaming() const;
 
@@ -70,53 +93,85 @@ class DefaultSource : public Source {
     kWhatStart,
     kWhatResume,
     kWhatSecureDecodersInstantiated,
+    kWhatSelectTrack,
   };
 
+  // Wall time between the sync samples trick play reads, i.e. it aims at
+  // 15 fps whatever the speed; longer GOPs give fewer.
+  static const int64_t kTrickPlayIntervalUs = 66667;
+  // Sync samples read per readBuffer() in trick play, each one is a seek.
+  static const size_t kSyncSampleBatch = 8;
+  // Longest a readBuffer() keeps the looper before it posts itself again,
+  // messages such as a seek queue up behind it meanwhile.
+  static const int64_t kReadSliceUs = 20000;
+
   struct Track {
-    size_t mIndex;
+    size_t mIndex {0};
+    // Shared by the tracks of one container until a track is switched.
     std::shared_ptr<Extractor> mExtractor;
+    // Set with std::atomic_store(), dequeueAccessUnit() loads it without
+    // mLock.
+    std::shared_ptr<PacketQueue> mPackets;
   };
 
   //AVFormatContext* mFormatContext;
   std::vector<std::shared_ptr<Extractor> > mExtractor;
   Track mAudioTrack;
-  int64_t mAudioTimeUs;
-  int64_t mAudioLastDequeueTimeUs;
+  int64_t mAudioTimeUs {-1};
+  std::atomic<int64_t> mAudioLastDequeueTimeUs {0};
   Track mVideoTrack;
-  int64_t mVideoTimeUs;
-  int64_t mVideoLastDequeueTimeUs;
+  int64_t mVideoTimeUs {-1};
+  std::atomic<int64_t> mVideoLastDequeueTimeUs {0};
   size_t mSubtitleTrack;
   size_t mTimedTextTrack;
-
-  bool mSentPauseOnBuffering;
+  std::vector<Extractor::TrackInfo> mTrackInfos;  // fixed once prepared
+  // selectTrack() calls the looper has yet to carry out; until then what is
+  // queued belongs to the old track, dequeueAccessUnit() holds audio off.
+  std::atomic<int32_t> mPendingAudioSwitches {0};
+
+  bool mSentPauseOnBuffering {false};
+  BufferingSettings mBufferingSettings;
+  // mBufferingSettings.mResumePlaybackMarkMs, for dequeueAccessUnit().
+  std::atomic<int64_t> mResumeReadingMarkUs {BufferingSettings().mResumePlaybackMarkMs * 1000LL};
+  LoopSplicer mLoopSplicer;
+  float mTrickPlaySpeed {0.0f};
+  int64_t mTrickPlayNextUs {0};  // the next sync sample is read at or after this
 
   int32_t mAudioDataGeneration;
   int32_t mVideoDataGeneration;
   int32_t mFetchSubtitleDataGeneration;
   int32_t mFetchTimedTextDataGeneration;
-  int64_t mDurationUs;
+  int64_t mDurationUs {-1};
   bool mAudioIsVorbis;
   // Secure codec is required.
   bool mIsSecure;
-  bool mIsStreaming;
+  bool mIsStreaming {false};
   bool mUIDValid;
   uid_t mUID;
   const std::shared_ptr<MediaClock> mMediaClock;
   std::string mUri;
+  std::vector<std::string> mSegmentUrls;
+  std::string mCacheDirectory;
+  std::shared_ptr<ProbeCache> mProbeCache;
+  std::unique_ptr<KeyframeIndexer> mKeyframeIndexer;
   //KeyedVector<String8, String8> mUriHeaders;
 //  base::unique_fd mFd;
 //  int64_t mOffset;
 //  int64_t mLength;
 
-  bool mDisconnected;
+  bool mDisconnected {false};
   std::shared_ptr<DataSource> mDataSource;
-  std::shared_ptr<NuCachedSource2> mCachedSource;
+  std::shared_ptr<CachedSource> mCachedSource;
   std::shared_ptr<DataSource> mHttpSource;
   std::shared_ptr<MetaData> mFileMeta;
-  bool mStarted;
+  std::atomic<bool> mStarted {false};
   bool mPreparing;
+  // Between seekTo() and the seek on the looper the queues hold what was
+  // read before it, dequeueAccessUnit() holds off.
+  std::atomic<bool> mSeeking {false};
   int64_t mBitrate;
-  uint32_t mPendingReadBufferTypes;
+  // A kWhatReadBuffer is posted for these track types, bit 1 << type.
+  std::atomic<uint32_t> mPendingReadBufferTypes {0};
 
   mutable std::mutex mLock;
   mutable std::mutex mDisconnectLock; // Protects mDataSource, mHttpSource and mDisconnected
@@ -133,13 +188,16 @@ class DefaultSource : public Source {
   void finishPrepareAsync();
   status_t startSources();
 
-  void onSeek(const std::shared_ptr<AMessage>& msg);
-  status_t doSeek(int64_t seekTimeUs, MediaPlayerSeekMode mode);
+  std::shared_ptr<Extractor> reopenExtractor();
+  void onSelectTrack(size_t trackIndex, int64_t timeUs);
+  void doSelectTrack(size_t trackIndex, int64_t timeUs, const std::shared_ptr<Extractor> &extractor);
+
+  void doSeek(int64_t seekTimeUs, SeekMode mode);
 
   void onPrepareAsync();
 
   void postReadBuffer(media_track_type trackType);
-  void onReadBuffer(const std::shared_ptr<AMessage>& msg);
+  void onReadBuffer(const std::shared_ptr<Message>& msg);
   // When |mode| is MediaPlayerSeekMode::SEEK_CLOSEST, the buffer read shall
   // include an item indicating skipping rendering all buffers with timestamp
   // earlier than |seekTimeUs|.
@@ -148,9 +206,13 @@ class DefaultSource : public Source {
   void readBuffer(
       media_track_type trackType,
       int64_t seekTimeUs = -1ll,
-      MediaPlayerSeekMode mode = MediaPlayerSeekMode::SEEK_PREVIOUS_SYNC,
+      SeekMode mode = SEEK_PREVIOUS_SYNC,
       int64_t *actualTimeUs = NULL, bool formatChange = false);
 
+  void readSyncSamples_l(Track *track, size_t maxBuffers, int64_t *actualTimeUs);
+  // Below the high watermark and the byte cap, and not at EOS.
+  bool shouldReadMore_l(const Track &track) const;
+
   void queueDiscontinuityIfNeeded(
       bool seeking, bool formatChange, media_track_type trackType, Track *track);
 
@@ -162,6 +224,7 @@ class DefaultSource : public Source {
 
   std::shared_ptr<MetaData> getFormatMeta_l(bool audio);
   int32_t getDataGeneration(media_track_type type) const;
+  void wrapLoop_l();
 
 };
 
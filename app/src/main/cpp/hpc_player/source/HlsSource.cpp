@@ -0,0 +1,728 @@
+#include "HlsSource.h"
+#include "Log.h"
+#include "Looper.h"
+#include "Message.h"
+#include "MetaData.h"
+#include "MediaPacket.h"
+#include "PacketQueue.h"
+#include "FFmpegExtractor.h"
+#include "HTTPSource.h"
+#include "MemorySource.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define LOG_TAG "HlsSource"
+
+namespace hpc {
+
+HlsSource::HlsSource(const std::shared_ptr<Message> &notify)
+    : Source(notify) {
+}
+
+HlsSource::~HlsSource() {
+  if (mLooper != nullptr) {
+    mLooper->unregisterHandler(id());
+    mLooper->stop();
+  }
+}
+
+bool HlsSource::IsHlsUrl(const char *url) {
+  if (!HTTPSource::IsSupported(url)) {
+    return false;
+  }
+  const char *end = strpbrk(url, "?#");
+  const size_t length = end != nullptr ? end - url : strlen(url);
+  return length >= 5 && strncasecmp(url + length - 5, ".m3u8", 5) == 0;
+}
+
+status_t HlsSource::setDataSource(const char *url) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mUrl = url;
+  mHttp = std::make_shared<HTTPSource>(url);
+  return mHttp->initCheck();
+}
+
+void HlsSource::prepareAsync() {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (mLooper == nullptr) {
+    mLooper = std::make_shared<Looper>();
+    mLooper->setName("hls");
+    mLooper->start();
+    mLooper->registerHandler(shared_from_this());
+  }
+  mPreparing = true;
+  std::make_shared<Message>(kWhatPrepare, shared_from_this())->post();
+}
+
+void HlsSource::start() {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mStarted = true;
+}
+
+void HlsSource::stop() {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mStarted = false;
+}
+
+void HlsSource::pause() {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mStarted = false;
+}
+
+void HlsSource::resume() {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mStarted = true;
+}
+
+void HlsSource::disconnect() {
+  std::shared_ptr<HTTPSource> http;
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    http = mHttp;
+  }
+  // Also cancels the download in progress between two reads.
+  mDisconnected = true;
+  ++mSeekGeneration;
+  if (http != nullptr) {
+    http->close();
+  }
+}
+
+// A queue that runs dry while playing starts rebuffering; packets are held
+// back from then on until the fetch loop has the resume mark buffered again,
+// so that playback does not stutter along a packet at a time.
+status_t HlsSource::dequeueAccessUnit(bool audio, std::unique_ptr<MediaPacket> *packet) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  const std::shared_ptr<PacketQueue> &queue = audio ? mAudioPackets : mVideoPackets;
+  if (!mStarted || mPreparing || mSeeking || mBufferingStartUs >= 0 || queue == nullptr) {
+    return WOULD_BLOCK;
+  }
+  status_t result = queue->dequeuePacket(packet);
+  if (result == WOULD_BLOCK) {
+    mBufferingStartUs = Looper::GetNowUs();
+    ++mStats.rebuffers;
+    mStats.buffering = true;
+    ALOGI("rebuffering (%s ran out)", audio ? "audio" : "video");
+    notifyBuffering(true);
+  }
+  return result;
+}
+
+std::shared_ptr<MetaData> HlsSource::getFormatMeta(bool audio) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  return audio ? mAudioMeta : mVideoMeta;
+}
+
+status_t HlsSource::getDuration(int64_t *durationUs) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (mDurationUs < 0) {
+    // not prepared, or live
+    return INVALID_OPERATION;
+  }
+  *durationUs = mDurationUs;
+  return OK;
+}
+
+size_t HlsSource::getTrackCount() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  return mTrackInfos.size();
+}
+
+status_t HlsSource::getTrackInfo(size_t trackIndex, Extractor::TrackInfo *info) const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (trackIndex >= mTrackInfos.size()) {
+    return ERROR_OUT_OF_RANGE;
+  }
+  *info = mTrackInfos[trackIndex];
+  return OK;
+}
+
+ssize_t HlsSource::getSelectedTrack(media_track_type type) const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  switch (type) {
+    case MEDIA_TRACK_TYPE_VIDEO:
+      return mVideoPackets != nullptr ? 0 : -1;
+    case MEDIA_TRACK_TYPE_AUDIO:
+      return mAudioPackets != nullptr ? 1 : -1;
+    default:
+      return -1;
+  }
+}
+
+status_t HlsSource::seekTo(int64_t seekTimeUs, SeekMode /* mode */) {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  if (mDurationUs < 0 || mPreparing) {
+    return INVALID_OPERATION;
+  }
+  // The download in progress is dropped, the queues are cleared on the
+  // looper, their producer's thread.
+  mSeeking = true;
+  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatSeek, shared_from_this());
+  msg->mArg1 = std::max<int64_t>(seekTimeUs, 0);
+  msg->mArg2 = ++mSeekGeneration;
+  msg->post();
+  return OK;
+}
+
+int64_t HlsSource::getBufferedDurationUs(bool audio, size_t *bytes) const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  const std::shared_ptr<PacketQueue> &queue = audio ? mAudioPackets : mVideoPackets;
+  if (queue == nullptr) {
+    *bytes = 0;
+    return 0;
+  }
+  status_t finalResult;
+  *bytes = queue->getBufferedBytes();
+  return queue->getBufferedDurationUs(&finalResult);
+}
+
+status_t HlsSource::setBufferingSettings(const BufferingSettings &settings) {
+  if (!settings.isValid()) {
+    return BAD_VALUE;
+  }
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mBufferingSettings = settings;
+  return OK;
+}
+
+BufferingSettings HlsSource::getBufferingSettings() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  return mBufferingSettings;
+}
+
+status_t HlsSource::setTargetBitrate(int64_t bps) {
+  if (bps < 0) {
+    return BAD_VALUE;
+  }
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mTargetBitrate = bps;
+  return OK;
+}
+
+HlsSource::Stats HlsSource::getStats() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  Stats stats = mStats;
+  if (mBufferingStartUs >= 0) {
+    stats.rebufferUs += Looper::GetNowUs() - mBufferingStartUs;
+  }
+  return stats;
+}
+
+void HlsSource::onMessageReceived(const std::shared_ptr<Message> &msg) {
+  switch (msg->what()) {
+    case kWhatPrepare:
+      onPrepare();
+      break;
+
+    case kWhatFetch:
+      if (msg->mArg1 == mFetchGeneration) {
+        onFetch();
+      }
+      break;
+
+    case kWhatSeek:
+      onSeek(msg->mArg1, (int32_t)msg->mArg2);
+      break;
+
+    default:
+      Source::onMessageReceived(msg);
+      break;
+  }
+}
+
+void HlsSource::onPrepare() {
+  std::string url;
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    url = mUrl;
+  }
+  const int32_t generation = mSeekGeneration;
+  std::vector<uint8_t> data;
+  status_t err = mHttp != nullptr ? download(url, 0, -1, &data, generation) : NO_INIT;
+
+  bool isMaster = false;
+  M3UParser::MediaPlaylist media;
+  if (err == OK) {
+    err = M3UParser::Parse(url, std::string(data.begin(), data.end()), &isMaster, &mMaster, &media);
+  }
+  if (err == OK && !isMaster) {
+    // A media playlist on its own is the one variant there is.
+    mMaster.variants.assign(1, M3UParser::Variant());
+    mMaster.variants[0].url = url;
+  }
+  if (err == OK) {
+    mPlaylists.assign(mMaster.variants.size(), M3UParser::MediaPlaylist());
+    mPlaylistLoaded.assign(mMaster.variants.size(), false);
+    if (!isMaster) {
+      mPlaylists[0] = std::move(media);
+      mPlaylistLoaded[0] = true;
+    }
+    mVariant = selectVariant(0);
+    err = loadPlaylist(mVariant, generation);
+  }
+  if (err != OK) {
+    ALOGE("cannot open %s: %d", url.c_str(), err);
+    std::lock_guard<std::mutex> autoLock(mLock);
+    mPreparing = false;
+    notifyPrepared(err);
+    return;
+  }
+
+  // Live streams start a few segments from the end, like other players.
+  const M3UParser::MediaPlaylist &playlist = mPlaylists[mVariant];
+  mNextSequence = playlist.mediaSequence;
+  if (!playlist.ended) {
+    mNextSequence += std::max<int64_t>((int64_t)playlist.segments.size() - 3, 0);
+  }
+  ALOGI("%zu variants, starting with %zu (%lld bps)%s", mMaster.variants.size(), mVariant,
+        (long long)mMaster.variants[mVariant].bandwidth, playlist.ended ? "" : ", live");
+
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    mDurationUs = playlist.ended ? playlist.durationUs() : -1;
+  }
+  // Prepared is notified by the fetch loop once the initial mark is buffered.
+  postFetch();
+}
+
+void HlsSource::postFetch(int64_t delayUs) {
+  std::shared_ptr<Message> msg = std::make_shared<Message>(kWhatFetch, shared_from_this());
+  msg->mArg1 = mFetchGeneration;
+  msg->post(delayUs);
+}
+
+void HlsSource::onFetch() {
+  if (mDisconnected) {
+    return;
+  }
+  const int32_t generation = mSeekGeneration;
+  if (!drainPending()) {
+    postFetch(kPollIntervalUs);
+    return;
+  }
+
+  bool eos = false;
+  const int64_t bufferedUs = getMinBufferedUs(&eos);
+  size_t bytes = 0;
+  bool readMore;
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    updateBuffering_l();
+    for (const std::shared_ptr<PacketQueue> &queue : { mVideoPackets, mAudioPackets }) {
+      if (queue != nullptr) {
+        bytes = std::max(bytes, queue->getBufferedBytes());
+      }
+    }
+    readMore = !eos && mBufferingSettings.shouldReadMore(bufferedUs, bytes, mPreparing);
+  }
+  if (!readMore) {
+    postFetch(kPollIntervalUs);
+    return;
+  }
+
+  const size_t variant = selectVariant(bufferedUs);
+  if (variant != mVariant) {
+    status_t err = loadPlaylist(variant, generation);
+    if (generation != mSeekGeneration) {
+      return;
+    }
+    if (err == OK) {
+      ALOGI("switching from variant %zu (%lld bps) to %zu (%lld bps) at sequence %lld",
+            mVariant, (long long)mMaster.variants[mVariant].bandwidth,
+            variant, (long long)mMaster.variants[variant].bandwidth, (long long)mNextSequence);
+      mVariant = variant;
+      std::lock_guard<std::mutex> autoLock(mLock);
+      ++mStats.switches;
+    } else {
+      ALOGW("cannot load variant %zu: %d", variant, err);
+    }
+  }
+
+  const M3UParser::MediaPlaylist *playlist = &mPlaylists[mVariant];
+  if (mNextSequence < playlist->mediaSequence) {
+    // Live, the segment slid out of the playlist meanwhile.
+    mNextSequence = playlist->mediaSequence;
+  }
+  if (mNextSequence - playlist->mediaSequence >= (int64_t)playlist->segments.size()) {
+    if (playlist->ended) {
+      if (mVideoPackets != nullptr) {
+        mVideoPackets->signalEOS(ERROR_END_OF_STREAM);
+      }
+      if (mAudioPackets != nullptr) {
+        mAudioPackets->signalEOS(ERROR_END_OF_STREAM);
+      }
+      std::lock_guard<std::mutex> autoLock(mLock);
+      updateBuffering_l();
+      return;
+    }
+    // Live, wait for the next segment to be published.
+    loadPlaylist(mVariant, generation);
+    postFetch(std::max<int64_t>(playlist->targetDurationUs / 2, kPollIntervalUs));
+    return;
+  }
+
+  const M3UParser::Segment segment =
+      playlist->segments[mNextSequence - playlist->mediaSequence];
+  status_t err = fetchSegment(segment, generation);
+  if (generation != mSeekGeneration) {
+    // onSeek() starts over.
+    return;
+  }
+  if (err != OK) {
+    ALOGE("segment %lld failed: %d", (long long)segment.sequence, err);
+    if (mVideoPackets != nullptr) {
+      mVideoPackets->signalEOS(err);
+    }
+    if (mAudioPackets != nullptr) {
+      mAudioPackets->signalEOS(err);
+    }
+    std::lock_guard<std::mutex> autoLock(mLock);
+    if (mPreparing) {
+      mPreparing = false;
+      notifyPrepared(err);
+    }
+    return;
+  }
+  ++mNextSequence;
+  postFetch();
+}
+
+void HlsSource::onSeek(int64_t seekTimeUs, int32_t generation) {
+  if (generation != mSeekGeneration) {
+    // a later seek supersedes this one
+    return;
+  }
+  mPending.clear();
+  if (mVideoPackets != nullptr) {
+    mVideoPackets->clear();
+  }
+  if (mAudioPackets != nullptr) {
+    mAudioPackets->clear();
+  }
+  const M3UParser::MediaPlaylist &playlist = mPlaylists[mVariant];
+  mNextSequence = playlist.mediaSequence + std::max<ssize_t>(playlist.findSegment(seekTimeUs), 0);
+  // The first segment fetched maps to its playlist time again.
+  mTimeOffsetValid = false;
+  mClearedGeneration = generation;
+  ALOGV("seek to %lld us, sequence %lld", (long long)seekTimeUs, (long long)mNextSequence);
+
+  ++mFetchGeneration;
+  postFetch();
+}
+
+status_t HlsSource::download(const std::string &url, int64_t offset, int64_t length,
+                             std::vector<uint8_t> *data, int32_t generation) {
+  data->clear();
+  status_t err = mHttp->setUrl(url.c_str());
+  if (err != OK) {
+    return err;
+  }
+  while (length < 0 || (int64_t)data->size() < length) {
+    if (generation != mSeekGeneration) {
+      return INFO_DISCONTINUITY;
+    }
+    const size_t size = data->size();
+    size_t chunk = kReadChunkBytes;
+    if (length >= 0) {
+      chunk = std::min<int64_t>(chunk, length - size);
+    }
+    data->resize(size + chunk);
+    ssize_t n = mHttp->readAt(offset + size, data->data() + size, chunk);
+    data->resize(size + std::max<ssize_t>(n, 0));
+    if (n < 0) {
+      return mDisconnected ? DEAD_OBJECT : (status_t)n;
+    } else if (n == 0) {
+      break;
+    }
+  }
+  if (length >= 0 && (int64_t)data->size() < length) {
+    ALOGE("%s: %zu of %lld bytes", url.c_str(), data->size(), (long long)length);
+    return ERROR_IO;
+  }
+
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mStats.bytesFetched += data->size();
+  return OK;
+}
+
+status_t HlsSource::loadPlaylist(size_t variant, int32_t generation) {
+  if (mPlaylistLoaded[variant] && mPlaylists[variant].ended) {
+    return OK;
+  }
+  const std::string &url = mMaster.variants[variant].url;
+  std::vector<uint8_t> data;
+  status_t err = download(url, 0, -1, &data, generation);
+  if (err != OK) {
+    return err;
+  }
+  bool isMaster;
+  M3UParser::MasterPlaylist master;
+  M3UParser::MediaPlaylist media;
+  err = M3UParser::Parse(url, std::string(data.begin(), data.end()), &isMaster, &master, &media);
+  if (err == OK && isMaster) {
+    ALOGE("%s: a master playlist as a variant", url.c_str());
+    err = ERROR_MALFORMED;
+  }
+  if (err != OK) {
+    return err;
+  }
+  mPlaylists[variant] = std::move(media);
+  mPlaylistLoaded[variant] = true;
+  return OK;
+}
+
+// The best variant within a share of the bandwidth estimate and the target
+// bitrate. Down is taken right away, before the buffer runs dry; up only with
+// the resume mark buffered, so that a short burst of bandwidth does not
+// bring on a segment that then takes too long.
+size_t HlsSource::selectVariant(int64_t bufferedUs) {
+  int64_t estimate = mEstimator.getEstimate();
+  if (estimate < 0) {
+    estimate = kInitialBandwidthBps;
+  }
+  int64_t budget = (int64_t)(estimate * kBandwidthFraction);
+  int64_t upSwitchUs;
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    if (mTargetBitrate > 0) {
+      budget = std::min(budget, mTargetBitrate);
+    }
+    upSwitchUs = mBufferingSettings.mResumePlaybackMarkMs * 1000LL;
+  }
+
+  size_t variant = 0;
+  for (size_t i = 0; i < mMaster.variants.size(); ++i) {
+    if (mMaster.variants[i].bandwidth <= budget) {
+      variant = i;
+    }
+  }
+  if (mCodecConfigValid && variant > mVariant && bufferedUs < upSwitchUs) {
+    return mVariant;
+  }
+  return variant;
+}
+
+status_t HlsSource::fetchSegment(const M3UParser::Segment &segment, int32_t generation) {
+  const M3UParser::MediaPlaylist &playlist = mPlaylists[mVariant];
+  if (!playlist.initUrl.empty()) {
+    // Shared by the segments of a variant, fetched again after a switch.
+    const std::string key = playlist.initUrl + "@" + std::to_string(playlist.initRangeOffset);
+    if (key != mInitSegmentKey) {
+      mInitSegmentKey.clear();
+      status_t err = download(playlist.initUrl, playlist.initRangeOffset,
+                              playlist.initRangeLength, &mInitSegment, generation);
+      if (err != OK) {
+        return err;
+      }
+      mInitSegmentKey = key;
+    }
+  }
+
+  std::vector<uint8_t> data;
+  const int64_t startUs = Looper::GetNowUs();
+  status_t err = download(segment.url, segment.rangeOffset, segment.rangeLength, &data, generation);
+  if (err != OK) {
+    return err;
+  }
+  mEstimator.addSample(data.size(), Looper::GetNowUs() - startUs);
+
+  const int64_t bandwidth = mMaster.variants[mVariant].bandwidth;
+  mSelectedTimeUs += segment.durationUs;
+  mSelectedBitsUs += (double)bandwidth * segment.durationUs;
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    ++mStats.segments;
+    mStats.bandwidthBps = mEstimator.getEstimate();
+    mStats.selectedBps = bandwidth;
+    if (mSelectedTimeUs > 0) {
+      mStats.averageSelectedBps = (int64_t)(mSelectedBitsUs / mSelectedTimeUs);
+    }
+  }
+
+  if (!playlist.initUrl.empty()) {
+    data.insert(data.begin(), mInitSegment.begin(), mInitSegment.end());
+  }
+  return demuxSegment(segment, std::move(data));
+}
+
+status_t HlsSource::demuxSegment(const M3UParser::Segment &segment, std::vector<uint8_t> data) {
+  std::shared_ptr<FFmpegExtractor> extractor = std::make_shared<FFmpegExtractor>();
+  extractor->setDataSource(std::make_shared<MemorySource>(std::move(data)));
+  status_t err = extractor->init(segment.url.c_str());
+  if (err != OK) {
+    return err;
+  }
+  const int videoIndex = extractor->getVideoStreamIndex();
+  const int audioIndex = extractor->getAudioStreamIndex();
+
+  CodecConfig config;
+  const AVCodecParameters *video = extractor->getStream(videoIndex)->codecpar;
+  config.video = video->codec_id;
+  config.videoExtradata.assign(video->extradata, video->extradata + video->extradata_size);
+  if (audioIndex >= 0) {
+    const AVCodecParameters *audio = extractor->getStream(audioIndex)->codecpar;
+    config.audio = audio->codec_id;
+    config.audioExtradata.assign(audio->extradata, audio->extradata + audio->extradata_size);
+    config.sampleRate = audio->sample_rate;
+    config.channelCount = audio->channels;
+  }
+  std::shared_ptr<MetaData> videoMeta = std::make_shared<MetaData>();
+  extractor->getMetaData(*videoMeta);
+
+  bool videoChanged = !mCodecConfigValid || config.video != mCodecConfig.video
+      || config.videoExtradata != mCodecConfig.videoExtradata;
+  bool audioChanged = !mCodecConfigValid || config.audio != mCodecConfig.audio
+      || config.audioExtradata != mCodecConfig.audioExtradata
+      || config.sampleRate != mCodecConfig.sampleRate
+      || config.channelCount != mCodecConfig.channelCount;
+  bool sizeChanged;
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    sizeChanged = mVideoMeta == nullptr || mVideoMeta->width != videoMeta->width
+        || mVideoMeta->height != videoMeta->height;
+    if (!mCodecConfigValid) {
+      // The tracks are those of the first segment.
+      mTrackInfos.resize(audioIndex >= 0 ? 2 : 1);
+      extractor->getTrackInfo(videoIndex, &mTrackInfos[0]);
+      if (audioIndex >= 0) {
+        extractor->getTrackInfo(audioIndex, &mTrackInfos[1]);
+        mAudioPackets = std::make_shared<PacketQueue>();
+      }
+      mVideoPackets = std::make_shared<PacketQueue>();
+    } else {
+      if (videoChanged) {
+        ALOGI("video configuration changes at sequence %lld, codec %d -> %d",
+              (long long)segment.sequence, mCodecConfig.video, config.video);
+        mPending.push_back({false /* audio */, nullptr});
+      }
+      if (audioChanged && mAudioPackets != nullptr) {
+        ALOGI("audio format changes at sequence %lld", (long long)segment.sequence);
+        mPending.push_back({true /* audio */, nullptr});
+      }
+    }
+    mVideoMeta = videoMeta;
+    if (audioIndex >= 0 && (audioChanged || mAudioMeta == nullptr)) {
+      Extractor::TrackInfo info;
+      extractor->getTrackInfo(audioIndex, &info);
+      mAudioMeta = std::make_shared<MetaData>();
+      mAudioMeta->mime = info.mime_type;
+      mAudioMeta->sampleRate = info.sample_rate;
+      mAudioMeta->channelCount = info.channel_count;
+    }
+  }
+  mCodecConfig = std::move(config);
+  mCodecConfigValid = true;
+  if (sizeChanged) {
+    notifyVideoSizeChanged();
+  }
+
+  if (segment.discontinuity) {
+    mTimeOffsetValid = false;
+  }
+  std::unique_ptr<MediaPacket> packet;
+  while (extractor->read(packet, -1 /* any selected track */) == OK) {
+    const bool audio = packet->trackIndex == audioIndex;
+    if (!audio && packet->trackIndex != videoIndex) {
+      continue;
+    }
+    if (audio && mAudioPackets == nullptr) {
+      // the first variant had no audio
+      continue;
+    }
+    if (!mTimeOffsetValid && packet->ptsUs >= 0) {
+      // Segments carry the encoder's timestamps, playback runs on the
+      // playlist's timeline.
+      mTimeOffsetUs = segment.startUs - packet->ptsUs;
+      mTimeOffsetValid = true;
+    }
+    if (packet->ptsUs >= 0) {
+      packet->ptsUs += mTimeOffsetUs;
+    }
+    if (packet->dtsUs >= 0) {
+      packet->dtsUs += mTimeOffsetUs;
+    }
+    packet->trackIndex = audio ? 1 : 0;
+    if (mPlaybackStats != nullptr) {
+      mPlaybackStats->onPacketDemuxed(audio, packet->size(), packet->durationUs);
+    }
+    mPending.push_back({audio, std::move(packet)});
+  }
+  extractor->release();
+
+  drainPending();
+  std::lock_guard<std::mutex> autoLock(mLock);
+  updateBuffering_l();
+  return OK;
+}
+
+bool HlsSource::drainPending() {
+  while (!mPending.empty()) {
+    Pending &pending = mPending.front();
+    const std::shared_ptr<PacketQueue> &queue = pending.audio ? mAudioPackets : mVideoPackets;
+    if (queue->isFull()) {
+      return false;
+    }
+    if (pending.packet == nullptr) {
+      queue->queueDiscontinuity();
+    } else {
+      queue->queuePacket(std::move(pending.packet));
+    }
+    mPending.pop_front();
+  }
+  return true;
+}
+
+int64_t HlsSource::getMinBufferedUs(bool *eos) const {
+  int64_t minUs = -1;
+  int64_t maxUs = 0;
+  for (const std::shared_ptr<PacketQueue> &queue : { mVideoPackets, mAudioPackets }) {
+    if (queue == nullptr) {
+      continue;
+    }
+    status_t finalResult;
+    const int64_t bufferedUs = queue->getBufferedDurationUs(&finalResult);
+    maxUs = std::max(maxUs, bufferedUs);
+    if (finalResult == OK) {
+      minUs = minUs < 0 ? bufferedUs : std::min(minUs, bufferedUs);
+    }
+  }
+  // Until the first segment there are no queues, and nothing buffered.
+  *eos = minUs < 0 && mVideoPackets != nullptr;
+  return minUs < 0 ? maxUs : minUs;
+}
+
+// On the looper, after what the queues hold changed: ends preparing, a seek
+// or rebuffering once there is enough to play.
+void HlsSource::updateBuffering_l() {
+  bool eos;
+  const int64_t bufferedUs = getMinBufferedUs(&eos);
+  if (mPreparing) {
+    if (eos || bufferedUs >= mBufferingSettings.mInitialMarkMs * 1000LL) {
+      mPreparing = false;
+      mStats.prepared = true;
+      ALOGI("prepared with %lld us buffered", (long long)bufferedUs);
+      notifyPrepared();
+    }
+    return;
+  }
+  const bool enough = eos || bufferedUs >= mBufferingSettings.mResumePlaybackMarkMs * 1000LL;
+  if (mSeeking && mClearedGeneration == mSeekGeneration && enough) {
+    mSeeking = false;
+  }
+  if (mBufferingStartUs >= 0 && enough) {
+    mStats.rebufferUs += Looper::GetNowUs() - mBufferingStartUs;
+    mStats.buffering = false;
+    mBufferingStartUs = -1;
+    ALOGI("rebuffered %lld us", (long long)bufferedUs);
+    notifyBuffering(false);
+  }
+}
+
+void HlsSource::notifyBuffering(bool start) {
+  std::shared_ptr<Message> notify = dupNotify();
+  notify->mArg1 = start ? kWhatPauseOnBufferingStart : kWhatResumeOnBufferingEnd;
+  notify->post();
+}
+
+} // hpc
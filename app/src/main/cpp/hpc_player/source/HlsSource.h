@@ -0,0 +1,185 @@
+#pragma once
+
+#include "Source.h"
+#include "BandwidthEstimator.h"
+#include "M3UParser.h"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+}
+
+namespace hpc {
+
+class HTTPSource;
+class MediaPacket;
+class PacketQueue;
+struct Looper;
+
+// HLS with adaptive bitrate. The variants of the master playlist are muxed
+// renditions of one stream at several bitrates. Segments are fetched ahead
+// on the source's own looper, up to the buffering watermarks; every download
+// feeds the BandwidthEstimator and the next segment comes from the best
+// variant the estimate affords, capped by setTargetBitrate(). Variants only
+// change at segment boundaries. While the codecs stay the same the decoders
+// just go on with the new variant's packets, a codec change queues a
+// discontinuity behind the old variant's last packet.
+//
+// Track 0 is video and track 1 audio, whichever variant they come from.
+class HlsSource : public Source {
+ public:
+  struct Stats {
+    int64_t rebuffers {0};        // times a queue ran dry while playing
+    int64_t rebufferUs {0};
+    int64_t switches {0};
+    int64_t segments {0};
+    int64_t bytesFetched {0};
+    int64_t bandwidthBps {-1};    // the current estimate
+    int64_t selectedBps {0};      // bandwidth of the variant fetched now
+    // Variant bandwidth averaged over the media time fetched.
+    int64_t averageSelectedBps {0};
+    bool prepared {false};
+    bool buffering {false};
+  };
+
+  explicit HlsSource(const std::shared_ptr<Message> &notify);
+  ~HlsSource() override;
+
+  // Whether |url| is a playlist, i.e. an http url whose path ends in .m3u8.
+  static bool IsHlsUrl(const char *url);
+
+  status_t setDataSource(const char *url);
+
+  void prepareAsync() override;
+
+  void start() override;
+  void stop() override;
+  void pause() override;
+  void resume() override;
+
+  void disconnect() override;
+
+  status_t dequeueAccessUnit(bool audio, std::unique_ptr<MediaPacket> *packet) override;
+
+  std::shared_ptr<MetaData> getFormatMeta(bool audio) override;
+  status_t getDuration(int64_t *durationUs) override;
+  size_t getTrackCount() const override;
+  status_t getTrackInfo(size_t trackIndex, Extractor::TrackInfo *info) const override;
+  ssize_t getSelectedTrack(media_track_type type) const override;
+  // To the start of the segment playing at |seekTimeUs|.
+  status_t seekTo(int64_t seekTimeUs, SeekMode mode = SEEK_PREVIOUS_SYNC) override;
+  int64_t getBufferedDurationUs(bool audio, size_t *bytes) const override;
+  status_t setBufferingSettings(const BufferingSettings &settings) override;
+  BufferingSettings getBufferingSettings() const override;
+  status_t setTargetBitrate(int64_t bps) override;
+
+  bool isStreaming() const override { return true; }
+
+  Stats getStats() const;
+
+ protected:
+  void onMessageReceived(const std::shared_ptr<Message> &msg) override;
+
+ private:
+  enum {
+    kWhatPrepare,
+    kWhatFetch,
+    kWhatSeek,
+  };
+
+  // Until the first download the bandwidth is taken to be this.
+  static const int64_t kInitialBandwidthBps = 1000000;
+  // Share of the estimate a variant may use, the rest absorbs jitter.
+  static constexpr double kBandwidthFraction = 0.75;
+  // How often a full buffer or a full queue is looked at again.
+  static constexpr int64_t kPollIntervalUs = 100000;
+  // Bytes per read of a download, a seek cancels it between two.
+  static const size_t kReadChunkBytes = 64 * 1024;
+
+  // What the decoders are configured for; a variant with another one needs
+  // a discontinuity. fMP4 renditions of one codec differ in their avcC or
+  // hvcC, the parameter sets in the init segment, which count too.
+  struct CodecConfig {
+    AVCodecID video {AV_CODEC_ID_NONE};
+    std::vector<uint8_t> videoExtradata;
+    AVCodecID audio {AV_CODEC_ID_NONE};
+    std::vector<uint8_t> audioExtradata;
+    int sampleRate {0};
+    int channelCount {0};
+  };
+
+  // A demuxed packet waiting for room in its queue.
+  struct Pending {
+    bool audio;
+    std::unique_ptr<MediaPacket> packet;
+  };
+
+  // Only touched on the looper.
+  M3UParser::MasterPlaylist mMaster;
+  std::vector<M3UParser::MediaPlaylist> mPlaylists;  // per variant, loaded on use
+  std::vector<bool> mPlaylistLoaded;
+  std::vector<uint8_t> mInitSegment;
+  std::string mInitSegmentKey;
+  size_t mVariant {0};
+  int64_t mNextSequence {-1};      // media sequence of the next segment
+  int64_t mTimeOffsetUs {0};       // added to the timestamps of the segments
+  bool mTimeOffsetValid {false};
+  CodecConfig mCodecConfig;
+  bool mCodecConfigValid {false};
+  std::deque<Pending> mPending;
+  int32_t mFetchGeneration {0};    // of the kWhatFetch chain that is current
+  int32_t mClearedGeneration {0};  // of the last seek the queues were cleared for
+  BandwidthEstimator mEstimator;
+  int64_t mSelectedTimeUs {0};     // media time fetched, for the average
+  double mSelectedBitsUs {0};
+
+  // Shared with the player's threads.
+  mutable std::mutex mLock;
+  std::string mUrl;
+  std::shared_ptr<HTTPSource> mHttp;  // read on the looper, closed by disconnect()
+  std::shared_ptr<PacketQueue> mVideoPackets;
+  std::shared_ptr<PacketQueue> mAudioPackets;
+  std::vector<Extractor::TrackInfo> mTrackInfos;
+  std::shared_ptr<MetaData> mVideoMeta;
+  std::shared_ptr<MetaData> mAudioMeta;
+  int64_t mDurationUs {-1};
+  BufferingSettings mBufferingSettings;
+  int64_t mTargetBitrate {0};
+  bool mStarted {false};
+  bool mPreparing {false};
+  bool mSeeking {false};  // from seekTo() until the queues are refilled
+  int64_t mBufferingStartUs {-1};
+  Stats mStats;
+  std::atomic<int32_t> mSeekGeneration {0};
+  std::atomic<bool> mDisconnected {false};
+
+  std::shared_ptr<Looper> mLooper;
+
+  void onPrepare();
+  void onFetch();
+  void onSeek(int64_t seekTimeUs, int32_t generation);
+  void postFetch(int64_t delayUs = 0);
+
+  // Reads |url|, [offset, offset + length) of it or all of it if |length| is
+  // negative. INFO_DISCONTINUITY if a seek came in meanwhile.
+  status_t download(const std::string &url, int64_t offset, int64_t length,
+                    std::vector<uint8_t> *data, int32_t generation);
+  status_t loadPlaylist(size_t variant, int32_t generation);
+  // The variant the next segment comes from, given |bufferedUs| to play.
+  size_t selectVariant(int64_t bufferedUs);
+  status_t fetchSegment(const M3UParser::Segment &segment, int32_t generation);
+  status_t demuxSegment(const M3UParser::Segment &segment, std::vector<uint8_t> data);
+  // Moves pending packets into their queues, false while one is full.
+  bool drainPending();
+
+  // Buffered media time of the emptier queue, |eos| once both ran out.
+  int64_t getMinBufferedUs(bool *eos) const;
+  void updateBuffering_l();
+  void notifyBuffering(bool start);
+};
+
+} // hpc
@@ -0,0 +1,162 @@
+#include "LoopSplicer.h"
+#include "MediaPacket.h"
+#include "Log.h"
+
+#include <algorithm>
+
+#define LOG_TAG "LoopSplicer"
+
+namespace hpc {
+
+LoopSplicer::LoopSplicer()
+    : mStartUs(-1),
+      mEndUs(-1),
+      mOffsetUs(0),
+      mPassEndUs{-1, -1},
+      mAudioEndUs(-1),
+      mAudioShiftUs(0),
+      mAudioResync(false),
+      mLoopCount(0) {
+}
+
+void LoopSplicer::setTracks(bool hasVideo, bool hasAudio) {
+  mTracks[false].enabled = hasVideo;
+  mTracks[true].enabled = hasAudio;
+}
+
+void LoopSplicer::setRange(int64_t startUs, int64_t endUs) {
+  if (startUs < 0 || (endUs >= 0 && endUs <= startUs)) {
+    mStartUs = -1;
+    mEndUs = -1;
+  } else {
+    mStartUs = startUs;
+    mEndUs = endUs;
+  }
+  for (TrackState &track : mTracks) {
+    track.done = false;
+  }
+}
+
+LoopSplicer::Action LoopSplicer::onPacket(bool audio, MediaPacket *packet) {
+  TrackState &track = mTracks[audio];
+  Action action = kQueue;
+  if (isEnabled() && track.enabled) {
+    if (track.done) {
+      return kDrop;
+    }
+    const int64_t ptsUs = packet->ptsUs;
+    if (audio) {
+      // every audio frame is a sync sample, keep the ones mostly inside.
+      const int64_t midUs = ptsUs + packet->durationUs / 2;
+      if (mEndUs >= 0 && midUs >= mEndUs) {
+        track.done = true;
+        return kDrop;
+      }
+      if (mLoopCount > 0 && midUs < mStartUs) {
+        return kDrop;
+      }
+    } else {
+      // Nothing decoded from here on can be shown before the loop end.
+      const int64_t decodeUs = packet->dtsUs != -1 ? packet->dtsUs : ptsUs;
+      if (mEndUs >= 0 && decodeUs >= mEndUs) {
+        track.done = true;
+        return kDrop;
+      }
+      // Past the end but possibly referenced from inside, or pre-roll
+      // between the sync sample and the loop start.
+      if ((mEndUs >= 0 && ptsUs >= mEndUs) || (mLoopCount > 0 && ptsUs < mStartUs)) {
+        action = kDecodeOnly;
+      }
+    }
+    if (action == kQueue) {
+      mPassEndUs[audio] = std::max(mPassEndUs[audio], ptsUs + packet->durationUs);
+    }
+  }
+
+  int64_t shiftUs = mOffsetUs;
+  if (audio && packet->ptsUs != -1) {
+    if (mAudioResync) {
+      mAudioResync = false;
+      mAudioShiftUs = mAudioEndUs >= 0 ? mAudioEndUs - (packet->ptsUs + mOffsetUs) : 0;
+    }
+    shiftUs += mAudioShiftUs;
+    mAudioEndUs = packet->ptsUs + shiftUs + packet->durationUs;
+  }
+  if (packet->ptsUs != -1) {
+    packet->ptsUs += shiftUs;
+  }
+  if (packet->dtsUs != -1) {
+    packet->dtsUs += shiftUs;
+  }
+  return action;
+}
+
+void LoopSplicer::onEndOfStream(bool audio) {
+  mTracks[audio].done = true;
+}
+
+bool LoopSplicer::needsWrap() const {
+  if (!isEnabled() || (!mTracks[false].enabled && !mTracks[true].enabled)) {
+    return false;
+  }
+  for (const TrackState &track : mTracks) {
+    if (track.enabled && !track.done) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool LoopSplicer::wrap() {
+  int64_t endUs = mEndUs;
+  if (endUs < 0) {
+    // End of stream: splice where audio ends, that keeps it gapless.
+    endUs = mTracks[true].enabled && mPassEndUs[true] >= 0 ? mPassEndUs[true] : mPassEndUs[false];
+  }
+  if (endUs <= mStartUs) {
+    // Nothing of the range was queued, another pass would not either.
+    ALOGW("nothing to loop in [%lld, %lld) us, looping stopped",
+          (long long)mStartUs, (long long)mEndUs);
+    setRange(-1, -1);
+    return false;
+  }
+
+  mOffsetUs += endUs - mStartUs;
+  mSplices.push_back(Splice{mStartUs + mOffsetUs, mOffsetUs});
+  if (mSplices.size() > kMaxSplices) {
+    mSplices.pop_front();
+  }
+  for (TrackState &track : mTracks) {
+    track.done = false;
+  }
+  mPassEndUs[false] = mPassEndUs[true] = -1;
+  mAudioResync = true;
+  ++mLoopCount;
+  ALOGV("loop %d: stream %lld us continues at %lld us",
+        mLoopCount, (long long)mStartUs, (long long)(mStartUs + mOffsetUs));
+  return true;
+}
+
+void LoopSplicer::onSeek() {
+  mOffsetUs = 0;
+  mPassEndUs[false] = mPassEndUs[true] = -1;
+  mAudioEndUs = -1;
+  mAudioShiftUs = 0;
+  mAudioResync = false;
+  mLoopCount = 0;
+  mSplices.clear();
+  for (TrackState &track : mTracks) {
+    track.done = false;
+  }
+}
+
+int64_t LoopSplicer::getStreamTimeUs(int64_t mediaUs) const {
+  for (auto it = mSplices.rbegin(); it != mSplices.rend(); ++it) {
+    if (mediaUs >= it->mediaTimeUs) {
+      return mediaUs - it->offsetUs;
+    }
+  }
+  return mediaUs;
+}
+
+} // hpc
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+namespace hpc {
+
+class MediaPacket;
+
+// Seamless looping at the demuxer. Instead of a seek and a flush at the end
+// of the loop, the source seeks its extractor back to the loop start as soon
+// as demuxing passes the loop end and keeps queueing, with timestamps
+// shifted to continue where the previous pass ended. Decoders and MediaClock
+// see one continuous stream, and the loop start is demuxed and decoded ahead
+// of time like any other packet.
+//
+// Cuts are made on packet boundaries. Video frames outside the range that
+// other frames of the range may reference are decoded but not shown. Audio
+// is cut at the frame nearest to each edge and every pass is nudged by less
+// than a frame to start exactly where the previous one ended, so audio is
+// gapless and A/V sync moves by at most that much at a splice. Looping at
+// the end of stream splices at the end of the audio track.
+//
+// Not thread safe, DefaultSource calls it under its lock.
+class LoopSplicer {
+ public:
+  enum Action {
+    kQueue,       // queue the packet, its timestamps are rebased
+    kDecodeOnly,  // queue it, but drop the decoded frame
+    kDrop,        // outside the range
+  };
+
+  LoopSplicer();
+
+  // Tracks the loop waits for before wrapping.
+  void setTracks(bool hasVideo, bool hasAudio);
+
+  // Loops [startUs, endUs). |endUs| < 0 loops at the end of stream, |startUs|
+  // < 0 stops looping; timestamps stay shifted until the next seek.
+  void setRange(int64_t startUs, int64_t endUs);
+  bool isEnabled() const { return mStartUs >= 0; }
+  int64_t getStartUs() const { return mStartUs; }
+
+  // For every demuxed packet, in demux order.
+  Action onPacket(bool audio, MediaPacket *packet);
+  // The extractor of the track ran out.
+  void onEndOfStream(bool audio);
+
+  // True once every track is past the loop end. The caller then calls
+  // wrap() and, unless the range turned out empty and looping stopped,
+  // seeks its extractors to getStartUs() (previous sync).
+  bool needsWrap() const;
+  bool wrap();
+
+  // After a regular seek: timestamps are stream times again.
+  void onSeek();
+
+  // Stream position of continuous media time |mediaUs|.
+  int64_t getStreamTimeUs(int64_t mediaUs) const;
+  int32_t getLoopCount() const { return mLoopCount; }
+
+ private:
+  // Splices further back than this are long played out.
+  static const size_t kMaxSplices = 8;
+
+  struct TrackState {
+    bool enabled {false};
+    bool done {false};  // past the loop end on this pass
+  };
+
+  struct Splice {
+    int64_t mediaTimeUs;  // where the pass starts in media time
+    int64_t offsetUs;     // media time minus stream time from there on
+  };
+
+  int64_t mStartUs;
+  int64_t mEndUs;
+  TrackState mTracks[2];  // indexed by audio
+  int64_t mOffsetUs;
+  // end of the latest packet of this pass per track, stream time
+  int64_t mPassEndUs[2];
+  // audio: media time the last queued frame ends at, and the nudge of this
+  // pass, found on its first frame.
+  int64_t mAudioEndUs;
+  int64_t mAudioShiftUs;
+  bool mAudioResync;
+  int32_t mLoopCount;
+  std::deque<Splice> mSplices;
+};
+
+} // hpc
@@ -0,0 +1,176 @@
+#include "M3UParser.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <sstream>
+
+#define LOG_TAG "M3UParser"
+
+namespace hpc {
+
+namespace {
+
+bool startsWith(const std::string &line, const char *prefix) {
+  return line.compare(0, strlen(prefix), prefix) == 0;
+}
+
+// NAME=value,NAME="quoted, value",... of a tag.
+std::map<std::string, std::string> parseAttributes(const std::string &list) {
+  std::map<std::string, std::string> attributes;
+  size_t pos = 0;
+  while (pos < list.size()) {
+    const size_t equals = list.find('=', pos);
+    if (equals == std::string::npos) {
+      break;
+    }
+    std::string name = list.substr(pos, equals - pos);
+    name.erase(0, name.find_first_not_of(' '));
+    size_t end;
+    std::string value;
+    if (equals + 1 < list.size() && list[equals + 1] == '"') {
+      end = list.find('"', equals + 2);
+      value = list.substr(equals + 2, end == std::string::npos ? end : end - equals - 2);
+      end = end == std::string::npos ? end : list.find(',', end);
+    } else {
+      end = list.find(',', equals + 1);
+      value = list.substr(equals + 1, end == std::string::npos ? end : end - equals - 1);
+    }
+    attributes[name] = value;
+    pos = end == std::string::npos ? list.size() : end + 1;
+  }
+  return attributes;
+}
+
+// <length>[@<offset>]; without an offset the range follows |*nextOffset|.
+void parseByteRange(const std::string &value, int64_t *nextOffset,
+                    int64_t *offset, int64_t *length) {
+  *length = strtoll(value.c_str(), nullptr, 10);
+  const size_t at = value.find('@');
+  *offset = at != std::string::npos ? strtoll(value.c_str() + at + 1, nullptr, 10) : *nextOffset;
+  *nextOffset = *offset + *length;
+}
+
+} // namespace
+
+ssize_t M3UParser::MediaPlaylist::findSegment(int64_t timeUs) const {
+  if (segments.empty()) {
+    return -1;
+  }
+  auto it = std::upper_bound(segments.begin(), segments.end(), timeUs,
+                             [](int64_t t, const Segment &segment) { return t < segment.startUs; });
+  return it == segments.begin() ? 0 : it - segments.begin() - 1;
+}
+
+std::string M3UParser::ResolveUrl(const std::string &baseUrl, const std::string &uri) {
+  if (uri.find("://") != std::string::npos) {
+    return uri;
+  }
+  const size_t scheme = baseUrl.find("://");
+  if (uri[0] == '/') {
+    const size_t path = baseUrl.find('/', scheme == std::string::npos ? 0 : scheme + 3);
+    return baseUrl.substr(0, path) + uri;
+  }
+  const size_t query = baseUrl.find('?');
+  const size_t slash = baseUrl.rfind('/', query == std::string::npos ? query : query - 1);
+  return baseUrl.substr(0, slash == std::string::npos ? 0 : slash + 1) + uri;
+}
+
+status_t M3UParser::Parse(const std::string &url, const std::string &text, bool *isMaster,
+                          MasterPlaylist *master, MediaPlaylist *media) {
+  std::istringstream stream(text);
+  std::string line;
+  if (!std::getline(stream, line) || !startsWith(line, "#EXTM3U")) {
+    ALOGE("%s is not a playlist", url.c_str());
+    return ERROR_MALFORMED;
+  }
+
+  *isMaster = false;
+  *master = MasterPlaylist();
+  *media = MediaPlaylist();
+  Variant variant;
+  bool variantPending = false;
+  Segment segment;
+  bool segmentPending = false;
+  int64_t nextRangeOffset = 0;
+  int64_t timeUs = 0;
+  while (std::getline(stream, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty()) {
+      continue;
+    }
+    if (line[0] != '#') {
+      // A uri, of the variant or segment the tags before it describe.
+      if (variantPending) {
+        variant.url = ResolveUrl(url, line);
+        master->variants.push_back(variant);
+        variant = Variant();
+        variantPending = false;
+      } else if (segmentPending) {
+        segment.url = ResolveUrl(url, line);
+        segment.startUs = timeUs;
+        segment.sequence = media->mediaSequence + (int64_t)media->segments.size();
+        timeUs += segment.durationUs;
+        media->segments.push_back(segment);
+        segment = Segment();
+        segmentPending = false;
+      }
+      continue;
+    }
+
+    const size_t colon = line.find(':');
+    const std::string value = colon == std::string::npos ? std::string() : line.substr(colon + 1);
+    if (startsWith(line, "#EXT-X-STREAM-INF:")) {
+      *isMaster = true;
+      std::map<std::string, std::string> attributes = parseAttributes(value);
+      variant.bandwidth = strtoll(attributes["BANDWIDTH"].c_str(), nullptr, 10);
+      variant.codecs = attributes["CODECS"];
+      sscanf(attributes["RESOLUTION"].c_str(), "%dx%d", &variant.width, &variant.height);
+      variantPending = true;
+    } else if (startsWith(line, "#EXTINF:")) {
+      segment.durationUs = (int64_t)(strtod(value.c_str(), nullptr) * 1000000);
+      segmentPending = true;
+    } else if (startsWith(line, "#EXT-X-BYTERANGE:")) {
+      parseByteRange(value, &nextRangeOffset, &segment.rangeOffset, &segment.rangeLength);
+    } else if (startsWith(line, "#EXT-X-DISCONTINUITY")
+        && !startsWith(line, "#EXT-X-DISCONTINUITY-SEQUENCE")) {
+      segment.discontinuity = true;
+    } else if (startsWith(line, "#EXT-X-TARGETDURATION:")) {
+      media->targetDurationUs = strtoll(value.c_str(), nullptr, 10) * 1000000;
+    } else if (startsWith(line, "#EXT-X-MEDIA-SEQUENCE:")) {
+      media->mediaSequence = strtoll(value.c_str(), nullptr, 10);
+    } else if (startsWith(line, "#EXT-X-ENDLIST")) {
+      media->ended = true;
+    } else if (startsWith(line, "#EXT-X-MAP:")) {
+      std::map<std::string, std::string> attributes = parseAttributes(value);
+      media->initUrl = ResolveUrl(url, attributes["URI"]);
+      if (!attributes["BYTERANGE"].empty()) {
+        int64_t offset = 0;
+        parseByteRange(attributes["BYTERANGE"], &offset,
+                       &media->initRangeOffset, &media->initRangeLength);
+      }
+    } else if (startsWith(line, "#EXT-X-KEY:")) {
+      if (parseAttributes(value)["METHOD"] != "NONE") {
+        ALOGE("%s: encrypted segments are not supported", url.c_str());
+        return ERROR_UNSUPPORTED;
+      }
+    }
+  }
+
+  if (*isMaster) {
+    std::stable_sort(master->variants.begin(), master->variants.end(),
+                     [](const Variant &a, const Variant &b) { return a.bandwidth < b.bandwidth; });
+    if (master->variants.empty()) {
+      return ERROR_MALFORMED;
+    }
+  } else if (media->segments.empty() && media->ended) {
+    return ERROR_MALFORMED;
+  }
+  return OK;
+}
+
+} // hpc
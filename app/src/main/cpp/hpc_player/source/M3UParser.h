@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#include "Error.h"
+
+namespace hpc {
+
+// HLS playlists (RFC 8216): the variants of a master playlist and the
+// segments of a media playlist, with their urls resolved against the
+// playlist's. Only what HlsSource plays is kept: no alternate renditions,
+// no encryption (a media playlist with EXT-X-KEY is ERROR_UNSUPPORTED).
+class M3UParser {
+ public:
+  struct Variant {
+    std::string url;
+    int64_t bandwidth {0};  // bits per second, peak
+    std::string codecs;
+    int32_t width {0};
+    int32_t height {0};
+  };
+
+  struct Segment {
+    std::string url;
+    int64_t startUs {0};     // in the playlist's timeline
+    int64_t durationUs {0};
+    int64_t sequence {0};
+    // EXT-X-BYTERANGE, a length < 0 is the whole resource.
+    int64_t rangeOffset {0};
+    int64_t rangeLength {-1};
+    // EXT-X-DISCONTINUITY, timestamps do not follow on from the previous one.
+    bool discontinuity {false};
+  };
+
+  struct MasterPlaylist {
+    std::vector<Variant> variants;  // by ascending bandwidth
+  };
+
+  struct MediaPlaylist {
+    int64_t targetDurationUs {0};
+    int64_t mediaSequence {0};
+    bool ended {false};  // EXT-X-ENDLIST, otherwise it is live and reloaded
+    // EXT-X-MAP, e.g. the fMP4 init segment every segment is demuxed after.
+    std::string initUrl;
+    int64_t initRangeOffset {0};
+    int64_t initRangeLength {-1};
+    std::vector<Segment> segments;
+
+    int64_t durationUs() const {
+      return segments.empty() ? 0 : segments.back().startUs + segments.back().durationUs;
+    }
+    // The segment playing at |timeUs|, the last one past the end, -1 if none.
+    ssize_t findSegment(int64_t timeUs) const;
+  };
+
+  // Parses |text|, downloaded from |url|, into |master| or |media|,
+  // whichever it is; |isMaster| tells which.
+  static status_t Parse(const std::string &url, const std::string &text, bool *isMaster,
+                        MasterPlaylist *master, MediaPlaylist *media);
+
+  // |uri| from a playlist at |baseUrl| as an absolute url.
+  static std::string ResolveUrl(const std::string &baseUrl, const std::string &uri);
+};
+
+} // hpc
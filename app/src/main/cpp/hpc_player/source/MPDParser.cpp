@@ -0,0 +1,630 @@
+#include "MPDParser.h"
+#include "M3UParser.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+#define LOG_TAG "MPDParser"
+
+namespace hpc {
+
+namespace {
+
+// More segments than this in a representation is a broken manifest.
+const int64_t kMaxSegments = 1000000;
+
+struct XmlElement {
+  std::string name;  // without a namespace prefix
+  std::map<std::string, std::string> attributes;
+  std::string text;
+  std::vector<XmlElement> children;
+
+  const XmlElement *child(const char *childName) const {
+    for (const XmlElement &element : children) {
+      if (element.name == childName) {
+        return &element;
+      }
+    }
+    return nullptr;
+  }
+
+  std::string attribute(const char *attributeName) const {
+    auto it = attributes.find(attributeName);
+    return it != attributes.end() ? it->second : std::string();
+  }
+
+  int64_t intAttribute(const char *attributeName, int64_t defaultValue) const {
+    auto it = attributes.find(attributeName);
+    return it != attributes.end() ? strtoll(it->second.c_str(), nullptr, 10) : defaultValue;
+  }
+};
+
+std::string decodeEntities(const std::string &text) {
+  static const struct { const char *entity; char c; } kEntities[] = {
+    { "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' }, { "&quot;", '"' }, { "&apos;", '\'' },
+  };
+  std::string out;
+  for (size_t i = 0; i < text.size(); ++i) {
+    bool decoded = false;
+    if (text[i] == '&') {
+      for (const auto &entity : kEntities) {
+        if (text.compare(i, strlen(entity.entity), entity.entity) == 0) {
+          out += entity.c;
+          i += strlen(entity.entity) - 1;
+          decoded = true;
+          break;
+        }
+      }
+    }
+    if (!decoded) {
+      out += text[i];
+    }
+  }
+  return out;
+}
+
+// The part of XML manifests use: elements, attributes, text, comments,
+// CDATA and the prolog, nothing of DTDs.
+class XmlReader {
+ public:
+  explicit XmlReader(const std::string &xml) : mXml(xml) {}
+
+  bool parse(XmlElement *root) {
+    skipMisc();
+    return parseElement(root, 0);
+  }
+
+ private:
+  static const int kMaxDepth = 32;
+
+  const std::string &mXml;
+  size_t mPos {0};
+
+  bool at(const char *token) const {
+    return mXml.compare(mPos, strlen(token), token) == 0;
+  }
+
+  bool skipPast(const char *token) {
+    size_t end = mXml.find(token, mPos);
+    mPos = end == std::string::npos ? mXml.size() : end + strlen(token);
+    return end != std::string::npos;
+  }
+
+  void skipSpace() {
+    while (mPos < mXml.size() && isspace((unsigned char)mXml[mPos])) {
+      ++mPos;
+    }
+  }
+
+  // whitespace, comments, <?...?> and <!DOCTYPE ...> around the root
+  void skipMisc() {
+    for (;;) {
+      skipSpace();
+      if (at("<!--")) {
+        skipPast("-->");
+      } else if (at("<?") || at("<!")) {
+        skipPast(">");
+      } else {
+        return;
+      }
+    }
+  }
+
+  std::string readName() {
+    size_t start = mPos;
+    while (mPos < mXml.size() && !isspace((unsigned char)mXml[mPos])
+        && strchr("/>=", mXml[mPos]) == nullptr) {
+      ++mPos;
+    }
+    return mXml.substr(start, mPos - start);
+  }
+
+  bool parseElement(XmlElement *element, int depth) {
+    if (depth > kMaxDepth || !at("<")) {
+      return false;
+    }
+    ++mPos;
+    element->name = readName();
+    const size_t colon = element->name.find(':');
+    if (colon != std::string::npos) {
+      element->name.erase(0, colon + 1);
+    }
+
+    for (;;) {
+      skipSpace();
+      if (mPos >= mXml.size()) {
+        return false;
+      } else if (at("/>")) {
+        mPos += 2;
+        return true;
+      } else if (at(">")) {
+        ++mPos;
+        break;
+      }
+      std::string name = readName();
+      skipSpace();
+      if (name.empty() || !at("=")) {
+        return false;
+      }
+      ++mPos;
+      skipSpace();
+      const char quote = mPos < mXml.size() ? mXml[mPos] : '\0';
+      if (quote != '"' && quote != '\'') {
+        return false;
+      }
+      const size_t end = mXml.find(quote, mPos + 1);
+      if (end == std::string::npos) {
+        return false;
+      }
+      element->attributes[name] = decodeEntities(mXml.substr(mPos + 1, end - mPos - 1));
+      mPos = end + 1;
+    }
+
+    while (mPos < mXml.size()) {
+      if (at("<!--")) {
+        skipPast("-->");
+      } else if (at("<![CDATA[")) {
+        const size_t start = mPos + 9;
+        skipPast("]]>");
+        element->text += mXml.substr(start, mPos - 3 - start);
+      } else if (at("</")) {
+        return skipPast(">");
+      } else if (at("<")) {
+        element->children.emplace_back();
+        if (!parseElement(&element->children.back(), depth + 1)) {
+          return false;
+        }
+      } else {
+        const size_t end = mXml.find('<', mPos);
+        element->text += decodeEntities(mXml.substr(mPos, end == std::string::npos ? end : end - mPos));
+        mPos = end == std::string::npos ? mXml.size() : end;
+      }
+    }
+    return false;
+  }
+};
+
+std::string trim(const std::string &text) {
+  const size_t start = text.find_first_not_of(" \t\r\n");
+  if (start == std::string::npos) {
+    return std::string();
+  }
+  return text.substr(start, text.find_last_not_of(" \t\r\n") - start + 1);
+}
+
+// The BaseURL of |element|, if any, against |base|.
+std::string resolveBase(const std::string &base, const XmlElement &element) {
+  const XmlElement *baseUrl = element.child("BaseURL");
+  if (baseUrl == nullptr || trim(baseUrl->text).empty()) {
+    return base;
+  }
+  return M3UParser::ResolveUrl(base, trim(baseUrl->text));
+}
+
+// xs:duration as manifests write it, P[nD]T[nH][nM][n.nS]; -1 if malformed.
+int64_t parseDurationUs(const std::string &value) {
+  if (value.empty() || value[0] != 'P') {
+    return -1;
+  }
+  double seconds = 0;
+  bool time = false;
+  const char *p = value.c_str() + 1;
+  while (*p != '\0') {
+    if (*p == 'T') {
+      time = true;
+      ++p;
+      continue;
+    }
+    char *end;
+    const double amount = strtod(p, &end);
+    if (end == p) {
+      return -1;
+    }
+    switch (*end) {
+      case 'Y': seconds += amount * 365 * 86400; break;
+      case 'D': seconds += amount * 86400; break;
+      case 'H': seconds += amount * 3600; break;
+      case 'M': seconds += amount * (time ? 60 : 30 * 86400); break;
+      case 'S': seconds += amount; break;
+      default: return -1;
+    }
+    p = end + 1;
+  }
+  return (int64_t)(seconds * 1000000);
+}
+
+// "first-last", both inclusive.
+bool parseRange(const std::string &value, int64_t *offset, int64_t *length) {
+  const size_t dash = value.find('-');
+  if (dash == std::string::npos) {
+    return false;
+  }
+  *offset = strtoll(value.c_str(), nullptr, 10);
+  *length = strtoll(value.c_str() + dash + 1, nullptr, 10) - *offset + 1;
+  return *offset >= 0 && *length > 0;
+}
+
+int64_t toUs(int64_t value, int64_t timescale) {
+  return value / timescale * 1000000 + value % timescale * 1000000 / timescale;
+}
+
+// $RepresentationID$, $Bandwidth$, $Number$ and $Time$, the numbers with an
+// optional %0<width>d format; $$ is a dollar.
+std::string expandTemplate(const std::string &pattern, const MPDParser::Representation &rep,
+                           int64_t number, int64_t time) {
+  std::string out;
+  size_t pos = 0;
+  while (pos < pattern.size()) {
+    const size_t start = pattern.find('$', pos);
+    const size_t end = start == std::string::npos ? start : pattern.find('$', start + 1);
+    if (end == std::string::npos) {
+      out.append(pattern, pos, std::string::npos);
+      break;
+    }
+    out.append(pattern, pos, start - pos);
+    pos = end + 1;
+
+    const std::string token = pattern.substr(start + 1, end - start - 1);
+    const size_t percent = token.find('%');
+    const std::string name = token.substr(0, percent);
+    int width = 0;
+    if (percent != std::string::npos) {
+      // only a width, the format never reaches printf as is.
+      width = atoi(token.c_str() + percent + 1 + (token[percent + 1] == '0' ? 1 : 0));
+    }
+    int64_t value;
+    if (token.empty()) {
+      out += '$';
+      continue;
+    } else if (name == "RepresentationID") {
+      out += rep.id;
+      continue;
+    } else if (name == "Bandwidth") {
+      value = rep.bandwidth;
+    } else if (name == "Number") {
+      value = number;
+    } else if (name == "Time") {
+      value = time;
+    } else {
+      out.append(pattern, start, end - start + 1);
+      continue;
+    }
+    char digits[32];
+    snprintf(digits, sizeof(digits), "%0*lld", std::min(width, 20), (long long)value);
+    out += digits;
+  }
+  return out;
+}
+
+media_track_type trackTypeOf(const XmlElement &element) {
+  const std::string contentType = element.attribute("contentType");
+  const std::string mimeType = element.attribute("mimeType");
+  if (contentType == "video" || mimeType.compare(0, 6, "video/") == 0) {
+    return MEDIA_TRACK_TYPE_VIDEO;
+  } else if (contentType == "audio" || mimeType.compare(0, 6, "audio/") == 0) {
+    return MEDIA_TRACK_TYPE_AUDIO;
+  }
+  return MEDIA_TRACK_TYPE_UNKNOWN;
+}
+
+// The segments of a SegmentTemplate, whose attributes a representation
+// inherits from its adaptation set and may override.
+status_t parseTemplate(const std::string &base, const XmlElement *setTemplate,
+                       const XmlElement *repTemplate, int64_t periodDurationUs,
+                       MPDParser::Representation *rep) {
+  std::map<std::string, std::string> attributes;
+  const XmlElement *timeline = nullptr;
+  for (const XmlElement *segmentTemplate : { setTemplate, repTemplate }) {
+    if (segmentTemplate != nullptr) {
+      for (const auto &attribute : segmentTemplate->attributes) {
+        attributes[attribute.first] = attribute.second;
+      }
+      if (segmentTemplate->child("SegmentTimeline") != nullptr) {
+        timeline = segmentTemplate->child("SegmentTimeline");
+      }
+    }
+  }
+  XmlElement merged;
+  merged.attributes.swap(attributes);
+
+  const std::string media = merged.attribute("media");
+  const int64_t timescale = merged.intAttribute("timescale", 1);
+  const int64_t pto = merged.intAttribute("presentationTimeOffset", 0);
+  int64_t number = merged.intAttribute("startNumber", 1);
+  if (media.empty() || timescale <= 0) {
+    return ERROR_MALFORMED;
+  }
+  rep->timescale = timescale;
+  rep->presentationTimeOffset = pto;
+  if (!merged.attribute("initialization").empty()) {
+    rep->initUrl = M3UParser::ResolveUrl(
+        base, expandTemplate(merged.attribute("initialization"), *rep, 0, 0));
+  }
+
+  auto addSegment = [&](int64_t time, int64_t duration) {
+    MPDParser::Segment segment;
+    segment.url = M3UParser::ResolveUrl(base, expandTemplate(media, *rep, number++, time));
+    segment.startUs = toUs(time - pto, timescale);
+    segment.durationUs = toUs(duration, timescale);
+    rep->segments.push_back(segment);
+  };
+
+  if (timeline != nullptr) {
+    const int64_t periodEnd =
+        periodDurationUs < 0 ? -1 : pto + periodDurationUs / 1000000 * timescale
+            + periodDurationUs % 1000000 * timescale / 1000000;
+    int64_t time = 0;
+    const std::vector<XmlElement> &entries = timeline->children;
+    for (size_t i = 0; i < entries.size(); ++i) {
+      if (entries[i].name != "S") {
+        continue;
+      }
+      time = entries[i].intAttribute("t", time);
+      const int64_t duration = entries[i].intAttribute("d", 0);
+      int64_t repeat = entries[i].intAttribute("r", 0);
+      if (duration <= 0) {
+        return ERROR_MALFORMED;
+      }
+      if (repeat < 0) {
+        // up to the next S with a time, or the end of the period
+        int64_t end = periodEnd;
+        if (i + 1 < entries.size() && entries[i + 1].attributes.count("t") != 0) {
+          end = entries[i + 1].intAttribute("t", 0);
+        }
+        if (end < 0) {
+          return ERROR_UNSUPPORTED;
+        }
+        repeat = (end - time + duration - 1) / duration - 1;
+      }
+      if ((int64_t)rep->segments.size() + repeat >= kMaxSegments) {
+        return ERROR_MALFORMED;
+      }
+      for (int64_t r = 0; r <= repeat; ++r) {
+        addSegment(time, duration);
+        time += duration;
+      }
+    }
+  } else {
+    const int64_t duration = merged.intAttribute("duration", 0);
+    if (duration <= 0) {
+      return ERROR_MALFORMED;
+    }
+    if (periodDurationUs < 0) {
+      return ERROR_UNSUPPORTED;
+    }
+    const int64_t durationUs = std::max<int64_t>(toUs(duration, timescale), 1);
+    const int64_t count = (periodDurationUs + durationUs - 1) / durationUs;
+    if (count >= kMaxSegments) {
+      return ERROR_MALFORMED;
+    }
+    for (int64_t i = 0; i < count; ++i) {
+      addSegment(pto + i * duration, duration);
+    }
+  }
+  return rep->segments.empty() ? ERROR_MALFORMED : (status_t)OK;
+}
+
+// A SegmentBase: one file, indexed by its SIDX.
+status_t parseSegmentBase(const std::string &base, const XmlElement &segmentBase,
+                          MPDParser::Representation *rep) {
+  if (!parseRange(segmentBase.attribute("indexRange"),
+                  &rep->indexRangeOffset, &rep->indexRangeLength)) {
+    ALOGW("representation %s: SegmentBase without an index range", rep->id.c_str());
+    return ERROR_UNSUPPORTED;
+  }
+  rep->indexUrl = base;
+  rep->timescale = std::max<int64_t>(segmentBase.intAttribute("timescale", 1), 1);
+  rep->presentationTimeOffset = segmentBase.intAttribute("presentationTimeOffset", 0);
+
+  // Without a range of its own the moov comes before the index.
+  rep->initUrl = base;
+  rep->initRangeOffset = 0;
+  rep->initRangeLength = rep->indexRangeOffset;
+  const XmlElement *initialization = segmentBase.child("Initialization");
+  if (initialization != nullptr) {
+    if (!initialization->attribute("sourceURL").empty()) {
+      rep->initUrl = M3UParser::ResolveUrl(base, initialization->attribute("sourceURL"));
+      rep->initRangeLength = -1;
+    }
+    parseRange(initialization->attribute("range"), &rep->initRangeOffset, &rep->initRangeLength);
+  }
+  return rep->initRangeLength != 0 ? (status_t)OK : ERROR_MALFORMED;
+}
+
+uint32_t U16_AT(const uint8_t *p) {
+  return p[0] << 8 | p[1];
+}
+
+uint32_t U32_AT(const uint8_t *p) {
+  return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+uint64_t U64_AT(const uint8_t *p) {
+  return (uint64_t)U32_AT(p) << 32 | U32_AT(p + 4);
+}
+
+} // namespace
+
+ssize_t MPDParser::Representation::findSegment(int64_t timeUs) const {
+  if (segments.empty()) {
+    return -1;
+  }
+  auto it = std::upper_bound(segments.begin(), segments.end(), timeUs,
+                             [](int64_t t, const Segment &segment) { return t < segment.startUs; });
+  return it == segments.begin() ? 0 : it - segments.begin() - 1;
+}
+
+status_t MPDParser::Parse(const std::string &url, const std::string &xml, Manifest *manifest) {
+  XmlElement root;
+  if (!XmlReader(xml).parse(&root) || root.name != "MPD") {
+    ALOGE("%s is not an MPD", url.c_str());
+    return ERROR_MALFORMED;
+  }
+  if (root.attribute("type") == "dynamic") {
+    ALOGE("%s: live manifests are not supported", url.c_str());
+    return ERROR_UNSUPPORTED;
+  }
+  const XmlElement *period = root.child("Period");
+  if (period == nullptr) {
+    return ERROR_MALFORMED;
+  }
+
+  *manifest = Manifest();
+  manifest->durationUs = parseDurationUs(root.attribute("mediaPresentationDuration"));
+  int64_t periodDurationUs = parseDurationUs(period->attribute("duration"));
+  if (periodDurationUs < 0) {
+    periodDurationUs = manifest->durationUs;
+  }
+  if (manifest->durationUs < 0) {
+    manifest->durationUs = periodDurationUs;
+  }
+  const std::string periodBase = resolveBase(resolveBase(url, root), *period);
+
+  for (const XmlElement &set : period->children) {
+    if (set.name != "AdaptationSet") {
+      continue;
+    }
+    AdaptationSet adaptationSet;
+    adaptationSet.type = trackTypeOf(set);
+    const std::string setBase = resolveBase(periodBase, set);
+    for (const XmlElement &element : set.children) {
+      if (element.name != "Representation") {
+        continue;
+      }
+      if (adaptationSet.type == MEDIA_TRACK_TYPE_UNKNOWN) {
+        adaptationSet.type = trackTypeOf(element);
+      }
+      Representation rep;
+      rep.id = element.attribute("id");
+      rep.bandwidth = element.intAttribute("bandwidth", 0);
+      rep.codecs = element.attribute("codecs").empty() ? set.attribute("codecs")
+                                                       : element.attribute("codecs");
+      rep.width = (int32_t)element.intAttribute("width", set.intAttribute("width", 0));
+      rep.height = (int32_t)element.intAttribute("height", set.intAttribute("height", 0));
+      const std::string base = resolveBase(setBase, element);
+
+      status_t err;
+      const XmlElement *setTemplate = set.child("SegmentTemplate");
+      const XmlElement *repTemplate = element.child("SegmentTemplate");
+      const XmlElement *segmentBase = element.child("SegmentBase") != nullptr
+          ? element.child("SegmentBase") : set.child("SegmentBase");
+      if (setTemplate != nullptr || repTemplate != nullptr) {
+        err = parseTemplate(base, setTemplate, repTemplate, periodDurationUs, &rep);
+      } else if (segmentBase != nullptr) {
+        err = parseSegmentBase(base, *segmentBase, &rep);
+      } else {
+        // SegmentList, or a plain file without an index.
+        err = ERROR_UNSUPPORTED;
+      }
+      if (err == ERROR_UNSUPPORTED) {
+        ALOGW("representation %s: unsupported segment addressing", rep.id.c_str());
+        continue;
+      } else if (err != OK) {
+        ALOGE("representation %s: malformed segments", rep.id.c_str());
+        return err;
+      }
+      adaptationSet.representations.push_back(std::move(rep));
+    }
+
+    if ((adaptationSet.type == MEDIA_TRACK_TYPE_VIDEO || adaptationSet.type == MEDIA_TRACK_TYPE_AUDIO)
+        && !adaptationSet.representations.empty()) {
+      std::stable_sort(adaptationSet.representations.begin(), adaptationSet.representations.end(),
+                       [](const Representation &a, const Representation &b) {
+                         return a.bandwidth < b.bandwidth;
+                       });
+      manifest->adaptationSets.push_back(std::move(adaptationSet));
+    }
+  }
+  return manifest->adaptationSets.empty() ? ERROR_UNSUPPORTED : (status_t)OK;
+}
+
+status_t MPDParser::ParseSidx(const uint8_t *data, size_t size, int64_t offset,
+                              Representation *rep) {
+  size_t pos = 0;
+  while (pos + 8 <= size) {
+    uint64_t boxSize = U32_AT(data + pos);
+    const uint32_t type = U32_AT(data + pos + 4);
+    size_t header = 8;
+    if (boxSize == 1) {
+      if (pos + 16 > size) {
+        break;
+      }
+      boxSize = U64_AT(data + pos + 8);
+      header = 16;
+    } else if (boxSize == 0) {
+      boxSize = size - pos;
+    }
+    if (boxSize < header) {
+      return ERROR_MALFORMED;
+    }
+    if (type != 'sidx') {
+      pos += boxSize;
+      continue;
+    }
+    if (boxSize > size - pos || boxSize < header + 24) {
+      ALOGE("truncated sidx");
+      return ERROR_MALFORMED;
+    }
+
+    const uint8_t *p = data + pos + header;
+    const uint8_t *end = data + pos + boxSize;
+    const uint8_t version = p[0];
+    const int64_t timescale = U32_AT(p + 8);
+    p += 12;
+    uint64_t earliestTime, firstOffset;
+    if (version == 0) {
+      earliestTime = U32_AT(p);
+      firstOffset = U32_AT(p + 4);
+      p += 8;
+    } else {
+      if (end - p < 16 + 4) {
+        return ERROR_MALFORMED;
+      }
+      earliestTime = U64_AT(p);
+      firstOffset = U64_AT(p + 8);
+      p += 16;
+    }
+    const uint32_t count = U16_AT(p + 2);
+    p += 4;
+    if (timescale == 0 || (size_t)(end - p) < (size_t)count * 12) {
+      return ERROR_MALFORMED;
+    }
+
+    // References follow on from the first byte after the box.
+    int64_t segmentOffset = offset + (int64_t)(pos + boxSize + firstOffset);
+    int64_t time = (int64_t)earliestTime;
+    const int64_t ptoUs = toUs(rep->presentationTimeOffset, rep->timescale);
+    std::vector<Segment> segments;
+    segments.reserve(count);
+    for (uint32_t i = 0; i < count; ++i, p += 12) {
+      const uint32_t reference = U32_AT(p);
+      if (reference & 0x80000000) {
+        ALOGE("hierarchical sidx is not supported");
+        return ERROR_UNSUPPORTED;
+      }
+      const uint32_t duration = U32_AT(p + 4);
+      Segment segment;
+      segment.url = rep->indexUrl;
+      segment.rangeOffset = segmentOffset;
+      segment.rangeLength = reference & 0x7fffffff;
+      segment.startUs = toUs(time, timescale) - ptoUs;
+      segment.durationUs = toUs(duration, timescale);
+      segments.push_back(segment);
+      segmentOffset += segment.rangeLength;
+      time += duration;
+    }
+    if (segments.empty()) {
+      return ERROR_MALFORMED;
+    }
+    rep->segments.swap(segments);
+    return OK;
+  }
+  ALOGE("no sidx in the index range of %s", rep->indexUrl.c_str());
+  return ERROR_MALFORMED;
+}
+
+} // hpc
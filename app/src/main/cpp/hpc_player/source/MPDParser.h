@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#include "BaseType.h"
+#include "Error.h"
+
+namespace hpc {
+
+// MPEG-DASH manifests (ISO/IEC 23009-1), static ones: the first period's
+// audio and video adaptation sets, their representations and where each
+// segment is. Segments come from a SegmentTemplate, with a SegmentTimeline
+// or a fixed duration, or from the SIDX box a SegmentBase points at, see
+// ParseSidx(). SegmentList, multiple periods and live (type="dynamic")
+// manifests are not supported.
+class MPDParser {
+ public:
+  struct Segment {
+    std::string url;
+    // a length < 0 is the whole resource.
+    int64_t rangeOffset {0};
+    int64_t rangeLength {-1};
+    int64_t startUs {0};  // in the presentation timeline
+    int64_t durationUs {0};
+  };
+
+  struct Representation {
+    std::string id;
+    int64_t bandwidth {0};  // bits per second
+    std::string codecs;
+    int32_t width {0};
+    int32_t height {0};
+    // The initialization segment, the fMP4 moov the segments are demuxed after.
+    std::string initUrl;
+    int64_t initRangeOffset {0};
+    int64_t initRangeLength {-1};
+    // SegmentBase: |segments| is empty until the SIDX at the index range of
+    // |indexUrl| is read into it.
+    std::string indexUrl;
+    int64_t indexRangeOffset {0};
+    int64_t indexRangeLength {-1};
+    int64_t presentationTimeOffset {0};  // in |timescale| units
+    int64_t timescale {1};
+    std::vector<Segment> segments;
+
+    bool needsIndex() const { return !indexUrl.empty() && segments.empty(); }
+    // The segment playing at |timeUs|, the last one past the end, -1 if none.
+    ssize_t findSegment(int64_t timeUs) const;
+  };
+
+  struct AdaptationSet {
+    media_track_type type {MEDIA_TRACK_TYPE_UNKNOWN};
+    std::vector<Representation> representations;  // by ascending bandwidth
+  };
+
+  struct Manifest {
+    int64_t durationUs {-1};
+    std::vector<AdaptationSet> adaptationSets;
+  };
+
+  // Parses |xml|, downloaded from |url|, with urls resolved against it.
+  static status_t Parse(const std::string &url, const std::string &xml, Manifest *manifest);
+
+  // Fills the segments of |representation| from the SIDX box in |data|,
+  // which was read at |offset| of the representation's url. Hierarchical
+  // indexes, SIDX referring to SIDX, are ERROR_UNSUPPORTED.
+  static status_t ParseSidx(const uint8_t *data, size_t size, int64_t offset,
+                            Representation *representation);
+};
+
+} // hpc
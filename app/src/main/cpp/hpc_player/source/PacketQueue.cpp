@@ -0,0 +1,167 @@
+#include "PacketQueue.h"
+#include "MediaPacket.h"
+
+#include <algorithm>
+
+namespace hpc {
+
+static size_t roundUpPowerOfTwo(size_t value) {
+  size_t result = 1;
+  while (result < value) {
+    result <<= 1;
+  }
+  return result;
+}
+
+PacketQueue::PacketQueue(size_t capacity)
+    : mSlots(roundUpPowerOfTwo(std::max(capacity, kMarkerSlots * 2))),
+      mMask(mSlots.size() - 1) {
+}
+
+PacketQueue::~PacketQueue() = default;
+
+// Only the owning side writes a set of counters, plain load and store do.
+void PacketQueue::add(Counters *counters, const Slot &slot) {
+  if (slot.packet != nullptr) {
+    counters->packets.store(counters->packets.load(std::memory_order_relaxed) + 1,
+                            std::memory_order_relaxed);
+  }
+  counters->bytes.store(counters->bytes.load(std::memory_order_relaxed) + slot.bytes,
+                        std::memory_order_relaxed);
+  counters->durationUs.store(counters->durationUs.load(std::memory_order_relaxed) + slot.spanUs,
+                             std::memory_order_relaxed);
+}
+
+status_t PacketQueue::push(std::unique_ptr<MediaPacket> packet, status_t marker) {
+  const uint64_t tail = mTail.load(std::memory_order_relaxed);
+  const uint64_t used = tail - mHead.load(std::memory_order_acquire);
+  const uint64_t limit = packet != nullptr ? mSlots.size() - kMarkerSlots : mSlots.size();
+  if (used >= limit) {
+    return ERROR_BUFFER_FULL;
+  }
+
+  Slot &slot = mSlots[tail & mMask];
+  slot.marker = marker;
+  slot.bytes = 0;
+  slot.spanUs = 0;
+  if (packet != nullptr) {
+    // Packets without a duration span up to the next one's dts.
+    slot.bytes = packet->size();
+    if (packet->durationUs > 0) {
+      slot.spanUs = packet->durationUs;
+    } else if (mLastDtsUs >= 0 && packet->dtsUs > mLastDtsUs) {
+      slot.spanUs = packet->dtsUs - mLastDtsUs;
+    }
+    mLastDtsUs = packet->dtsUs;
+  } else {
+    mLastDtsUs = -1;
+  }
+  slot.packet = std::move(packet);
+  add(&mPushed, slot);
+  mTail.store(tail + 1, std::memory_order_release);
+  return OK;
+}
+
+status_t PacketQueue::queuePacket(std::unique_ptr<MediaPacket> packet) {
+  if (mEOSResult.load(std::memory_order_relaxed) != OK) {
+    return OK;
+  }
+  return push(std::move(packet), OK);
+}
+
+status_t PacketQueue::queueDiscontinuity() {
+  if (mEOSResult.load(std::memory_order_relaxed) != OK) {
+    return OK;
+  }
+  return push(nullptr, INFO_DISCONTINUITY);
+}
+
+void PacketQueue::signalEOS(status_t result) {
+  if (mEOSResult.load(std::memory_order_relaxed) != OK) {
+    return;
+  }
+  result = result == OK ? ERROR_END_OF_STREAM : result;
+  // The marker goes first, a drained queue reports EOS only once the
+  // consumer could have reached it.
+  push(nullptr, result);
+  mEOSResult.store(result, std::memory_order_release);
+}
+
+status_t PacketQueue::dequeuePacket(std::unique_ptr<MediaPacket> *packet) {
+  for (;;) {
+    // flushedTo first: the tail loaded after it is at least as far.
+    uint64_t head = mHead.load(std::memory_order_relaxed);
+    const uint64_t flushedTo = mFlushedTo.load(std::memory_order_acquire);
+    const uint64_t tail = mTail.load(std::memory_order_acquire);
+
+    // Slots cleared by the producer since the last dequeue, it cannot free
+    // them itself.
+    while (head < flushedTo) {
+      Slot &slot = mSlots[head & mMask];
+      add(&mPopped, slot);
+      slot.packet.reset();
+      mHead.store(++head, std::memory_order_release);
+    }
+
+    if (head == tail) {
+      status_t result = mEOSResult.load(std::memory_order_acquire);
+      return result != OK ? result : WOULD_BLOCK;
+    }
+
+    Slot &slot = mSlots[head & mMask];
+    add(&mPopped, slot);
+    const status_t marker = slot.marker;
+    std::unique_ptr<MediaPacket> taken = std::move(slot.packet);
+    mHead.store(head + 1, std::memory_order_release);
+
+    // A clear() since flushedTo was loaded dropped this slot too, it is
+    // skipped like the others.
+    if (head < mFlushedTo.load(std::memory_order_acquire)) {
+      continue;
+    }
+    if (taken != nullptr) {
+      *packet = std::move(taken);
+    }
+    return marker;
+  }
+}
+
+void PacketQueue::clear() {
+  mFlushed.packets.store(mPushed.packets.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  mFlushed.bytes.store(mPushed.bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  mFlushed.durationUs.store(mPushed.durationUs.load(std::memory_order_relaxed),
+                            std::memory_order_relaxed);
+  mFlushedTo.store(mTail.load(std::memory_order_relaxed), std::memory_order_release);
+  mEOSResult.store(OK, std::memory_order_release);
+  mLastDtsUs = -1;
+}
+
+// Popped and flushed are loaded before pushed, it is rarely behind them and
+// clamped when it is.
+int64_t PacketQueue::remaining(std::atomic<int64_t> Counters::*field) const {
+  const int64_t popped = (mPopped.*field).load(std::memory_order_relaxed);
+  const int64_t flushed = (mFlushed.*field).load(std::memory_order_relaxed);
+  const int64_t pushed = (mPushed.*field).load(std::memory_order_relaxed);
+  return std::max<int64_t>(pushed - std::max(popped, flushed), 0);
+}
+
+int64_t PacketQueue::getBufferedDurationUs(status_t *finalResult) const {
+  *finalResult = mEOSResult.load(std::memory_order_acquire);
+  return remaining(&Counters::durationUs);
+}
+
+size_t PacketQueue::getBufferedBytes() const {
+  return (size_t)remaining(&Counters::bytes);
+}
+
+size_t PacketQueue::getAvailablePacketCount(status_t *finalResult) const {
+  *finalResult = mEOSResult.load(std::memory_order_acquire);
+  return (size_t)remaining(&Counters::packets);
+}
+
+bool PacketQueue::isFull() const {
+  const uint64_t used = mTail.load(std::memory_order_relaxed) - mHead.load(std::memory_order_acquire);
+  return used >= mSlots.size() - kMarkerSlots;
+}
+
+} // hpc
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "Error.h"
+
+namespace hpc {
+
+class MediaPacket;
+
+// Demuxed packets of one track, between the source's read loop and the
+// decoder. A fixed ring of packet references with a single producer, the
+// thread that demuxes, and a single consumer, the one that dequeues; neither
+// side takes a lock or waits for the other. queuePacket(),
+// queueDiscontinuity(), signalEOS() and clear() belong to the producer,
+// dequeuePacket() to the consumer. The getters are wait-free and may be
+// called from any thread.
+//
+// Discontinuities and EOS travel in the ring, so the consumer sees them in
+// order with the packets around them.
+class PacketQueue {
+ public:
+  static const size_t kDefaultCapacity = 2048;
+
+  // |capacity| is rounded up to a power of two.
+  explicit PacketQueue(size_t capacity = kDefaultCapacity);
+  ~PacketQueue();
+
+  PacketQueue(const PacketQueue &) = delete;
+  PacketQueue &operator=(const PacketQueue &) = delete;
+
+  // ERROR_BUFFER_FULL drops the packet, the producer checks isFull() before
+  // it reads one. Nothing is queued after EOS until clear().
+  status_t queuePacket(std::unique_ptr<MediaPacket> packet);
+  // dequeuePacket() returns INFO_DISCONTINUITY when it gets there.
+  status_t queueDiscontinuity();
+  // Nothing is queued after this until clear().
+  void signalEOS(status_t result);
+
+  // WOULD_BLOCK when empty, the EOS result once drained.
+  status_t dequeuePacket(std::unique_ptr<MediaPacket> *packet);
+
+  // Drops all queued packets and the EOS, e.g. on seek or track switch. The
+  // counters drop them right away, the consumer skips their slots on its
+  // next dequeue.
+  void clear();
+
+  // Span of the queued packets, |finalResult| is OK until EOS. While both
+  // sides run the counters can be a packet apart.
+  int64_t getBufferedDurationUs(status_t *finalResult) const;
+  size_t getBufferedBytes() const;
+  size_t getAvailablePacketCount(status_t *finalResult) const;
+
+  // A few slots stay free for markers.
+  bool isFull() const;
+  size_t capacity() const { return mSlots.size(); }
+
+ private:
+  static const size_t kMarkerSlots = 2;
+
+  struct Slot {
+    std::unique_ptr<MediaPacket> packet;  // null for a marker
+    status_t marker {OK};                 // INFO_DISCONTINUITY or the EOS result
+    int64_t spanUs {0};
+    int64_t bytes {0};
+  };
+
+  // Running totals, only ever growing. What is buffered is what was pushed
+  // less what was popped or flushed, whichever is further along.
+  struct Counters {
+    std::atomic<int64_t> packets {0};
+    std::atomic<int64_t> bytes {0};
+    std::atomic<int64_t> durationUs {0};
+  };
+
+  std::vector<Slot> mSlots;
+  const uint64_t mMask;
+
+  // written by the producer
+  std::atomic<uint64_t> mTail {0};
+  std::atomic<uint64_t> mFlushedTo {0};
+  std::atomic<status_t> mEOSResult {OK};
+  Counters mPushed;
+  Counters mFlushed;
+  int64_t mLastDtsUs {-1};
+
+  // written by the consumer, a cache line away from the producer's half.
+  alignas(64) std::atomic<uint64_t> mHead {0};
+  Counters mPopped;
+
+  status_t push(std::unique_ptr<MediaPacket> packet, status_t marker);
+  static void add(Counters *counters, const Slot &slot);
+  int64_t remaining(std::atomic<int64_t> Counters::*field) const;
+};
+
+} // hpc
@@ -12,30 +12,31 @@ namespace hpc {
 
 void Source::notifyFlagsChanged(uint32_t flags) const {
   std::shared_ptr<Message> notify = dupNotify();
-  notify->mWhat = kWhatFlagsChanged;
-  notify->mArg1 = flags;
+  notify->mArg1 = kWhatFlagsChanged;
+  notify->mArg2 = flags;
   notify->post();
 }
 
 void Source::notifyVideoSizeChanged(const std::shared_ptr<Message> &format) const {
   std::shared_ptr<Message> notify = dupNotify();
-  notify->mWhat = kWhatVideoSizeChanged;
-  notify->mObj1 = format.get();
+  // the receiver asks getFormat() for the format, mObj1 would be freed
+  // along with the message.
+  notify->mArg1 = kWhatVideoSizeChanged;
   notify->post();
 }
 
 void Source::notifyPrepared(status_t err) const {
   ALOGV("Source::notifyPrepared %d", err);
   std::shared_ptr<Message> notify = dupNotify();
-  notify->mWhat = kWhatPrepared;
-  notify->mArg1 = err;
+  notify->mArg1 = kWhatPrepared;
+  notify->mArg2 = err;
   notify->post();
 }
 
 
 void Source::notifyInstantiateSecureDecoders(const std::shared_ptr<Message> &reply) {
   std::shared_ptr<Message> notify = dupNotify();
-  notify->mWhat = kWhatInstantiateSecureDecoders;
+  notify->mArg1 = kWhatInstantiateSecureDecoders;
   notify->mObj1 = reply.get();
   notify->post();
 }
@@ -3,21 +3,19 @@
 #include "../HpcPlayer.h"
 #include "Handler.h"
 #include "Error.h"
+#include "StartupTimeline.h"
+#include "PlaybackStats.h"
+#include "BufferingSettings.h"
+#include "Extractor.h"
 
 namespace hpc {
 
 struct Message;
 struct MetaData;
+class MediaPacket;
 
-enum media_track_type {
-  MEDIA_TRACK_TYPE_UNKNOWN = 0,
-  MEDIA_TRACK_TYPE_VIDEO = 1,
-  MEDIA_TRACK_TYPE_AUDIO = 2,
-  MEDIA_TRACK_TYPE_TIMEDTEXT = 3,
-  MEDIA_TRACK_TYPE_SUBTITLE = 4,
-  MEDIA_TRACK_TYPE_METADATA = 5,
-};
-
+// Source notifications keep the what of the notify message, the event is in
+// mArg1 and its payload, if any, in mArg2.
 enum {
   kWhatPrepared,
   kWhatFlagsChanged,
@@ -35,6 +33,15 @@ enum {
 
 class Source : public Handler {
  public:
+  // What kWhatFlagsChanged carries.
+  enum Flags {
+    FLAG_CAN_PAUSE          = 1,
+    FLAG_CAN_SEEK_BACKWARD  = 2,  // the "10 sec back button"
+    FLAG_CAN_SEEK_FORWARD   = 4,  // the "10 sec forward button"
+    FLAG_CAN_SEEK           = 8,  // the "seek bar"
+    FLAG_DYNAMIC_DURATION   = 16,
+  };
+
   // The provides message is used to notify the player about various
   // events.
   explicit Source(const std::shared_ptr <Message> &notify)
@@ -57,8 +64,11 @@ class Source : public Handler {
   virtual std::shared_ptr<Message> getFormat(bool audio);
   virtual std::shared_ptr<MetaData> getFormatMeta(bool /* audio */) { return nullptr; }
 
-//  virtual status_t dequeueAccessUnit(
-//      bool audio, std::shared_ptr<ABuffer> *accessUnit) = 0;
+  // WOULD_BLOCK while the track's queue is empty, INFO_DISCONTINUITY at a
+  // format change, the EOS result once it ran out.
+  virtual status_t dequeueAccessUnit(bool /* audio */, std::unique_ptr<MediaPacket> * /* packet */) {
+    return INVALID_OPERATION;
+  }
 
   virtual status_t getDuration(int64_t * /* durationUs */) {
     return INVALID_OPERATION;
@@ -68,8 +78,17 @@ class Source : public Handler {
     return 0;
   }
 
-  virtual std::shared_ptr<Message> getTrackInfo(size_t /* trackIndex */) const {
-    return nullptr;
+  virtual status_t getTrackInfo(size_t /* trackIndex */, Extractor::TrackInfo * /* info */) const {
+    return INVALID_OPERATION;
+  }
+
+  virtual ssize_t getSelectedTrack(media_track_type /* type */) const {
+    return INVALID_OPERATION;
+  }
+
+  // Switches to |trackIndex|, resuming it at |timeUs|.
+  virtual status_t selectTrack(size_t /* trackIndex */, bool /* select */, int64_t /* timeUs */) {
+    return INVALID_OPERATION;
   }
 
   virtual status_t seekTo(
@@ -78,6 +97,47 @@ class Source : public Handler {
     return INVALID_OPERATION;
   }
 
+  // Media time and bytes waiting in the packet queue of the audio or video
+  // track. Polled for stats, so it must not wait for reads in progress.
+  virtual int64_t getBufferedDurationUs(bool /* audio */, size_t *bytes) const {
+    *bytes = 0;
+    return 0;
+  }
+
+  // Loops [startUs, endUs) without a flush, see LoopSplicer. |endUs| < 0
+  // loops at the end of stream, |startUs| < 0 stops looping.
+  virtual status_t setLoopRange(int64_t /* startUs */, int64_t /* endUs */) {
+    return INVALID_OPERATION;
+  }
+
+  // Keyframe-only reads for trick play at |speed|, see
+  // Extractor::readSyncSample(); 0 reads every packet again. Audio is not
+  // read meanwhile. Applies from the next seek on, which flushes what the
+  // queues hold.
+  virtual status_t setTrickPlaySpeed(float /* speed */) {
+    return INVALID_OPERATION;
+  }
+
+  // Caps the bitrate of an adaptive stream at |bps|, 0 lets the bandwidth
+  // estimate decide alone. Applies from the next segment on.
+  virtual status_t setTargetBitrate(int64_t /* bps */) {
+    return INVALID_OPERATION;
+  }
+
+  // Read-ahead watermarks, see BufferingSettings. BAD_VALUE unless
+  // isValid(); applies from the next read on.
+  virtual status_t setBufferingSettings(const BufferingSettings & /* settings */) {
+    return INVALID_OPERATION;
+  }
+  virtual BufferingSettings getBufferingSettings() const {
+    return BufferingSettings();
+  }
+
+  // Position in the stream of |mediaUs|, which keeps running across loops.
+  virtual int64_t getStreamTimeUs(int64_t mediaUs) const {
+    return mediaUs;
+  }
+
   virtual bool isRealTime() const {
     return false;
   }
@@ -87,6 +147,16 @@ class Source : public Handler {
   }
 
 
+  // Set before prepareAsync(); the source marks the milestones it owns.
+  void setStartupTimeline(const std::shared_ptr<StartupTimeline> &timeline) {
+    mStartupTimeline = timeline;
+  }
+
+  // Set before prepareAsync(); demuxed packets are reported for the bitrate.
+  void setPlaybackStats(const std::shared_ptr<PlaybackStats> &stats) {
+    mPlaybackStats = stats;
+  }
+
   std::shared_ptr<Message> dupNotify() const;
   void onMessageReceived(const std::shared_ptr<Message> &msg) override;
   void notifyFlagsChanged(uint32_t flags) const;
@@ -94,6 +164,10 @@ class Source : public Handler {
   void notifyInstantiateSecureDecoders(const std::shared_ptr<Message> &reply);
   void notifyPrepared(status_t err = OK) const;
 
+ protected:
+  std::shared_ptr<StartupTimeline> mStartupTimeline;
+  std::shared_ptr<PlaybackStats> mPlaybackStats;
+
  private:
   std::shared_ptr<Message> mNotify;
 };
@@ -0,0 +1,161 @@
+#include "BenchMode.h"
+#include "BitstreamConverter.h"
+#include "FFmpegExtractor.h"
+#include "JsonWriter.h"
+#include "Log.h"
+#include "Looper.h"
+#include "MediaPacket.h"
+#include "MmapSource.h"
+
+#include <algorithm>
+#include <cstring>
+
+extern "C" {
+#include "libavcodec/bsf.h"
+}
+
+#define LOG_TAG "AnnexBBench"
+
+namespace hpc {
+
+// A packet with a payload of its own, writable, as a demuxer hands it out.
+static std::unique_ptr<MediaPacket> copyOf(const MediaPacket &packet) {
+  std::unique_ptr<MediaPacket> copy = std::make_unique<MediaPacket>();
+  AVBufferRef *buffer = av_buffer_alloc(packet.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+  if (buffer == nullptr) {
+    return nullptr;
+  }
+  memcpy(buffer->data, packet.data(), packet.size());
+  memset(buffer->data + packet.size(), 0, AV_INPUT_BUFFER_PADDING_SIZE);
+  copy->setPayload(buffer, buffer->data, packet.size());
+  copy->avPacket()->flags = packet.flags();
+  return copy;
+}
+
+static int64_t megabytesPerS(int64_t bytes, int64_t us) {
+  return us > 0 ? bytes / us : 0;  // bytes per us
+}
+
+// Length-prefixed to Annex-B throughput of BitstreamConverter against
+// FFmpeg's h264_mp4toannexb or hevc_mp4toannexb, over the video packets of
+// an MP4 or Matroska --url held in memory, --iterations runs of each. MB/s
+// are of input bytes. in_place is what MediaCodecDecoder does to four byte
+// lengths in the codec's input buffer, copy what it does to shorter ones.
+// The filter also inserts parameter sets ahead of each IDR frame, work the
+// converter leaves to csd-0 and csd-1.
+static status_t runAnnexB(const BenchOptions &options, JsonWriter *json) {
+  const int iterations = (int)options.getInt("iterations", 5);
+  const int64_t maxBytes = options.getInt("max-mb", 256) * 1024 * 1024;
+
+  std::shared_ptr<MmapSource> source = MmapSource::Create(options.url.c_str());
+  if (source == nullptr || source->initCheck() != OK) {
+    ALOGE("cannot map %s", options.url.c_str());
+    return ERROR_IO;
+  }
+  FFmpegExtractor extractor;
+  extractor.setDataSource(source);
+  if (extractor.init(options.url.c_str()) != OK || extractor.getVideoStreamIndex() < 0) {
+    ALOGE("cannot open %s", options.url.c_str());
+    return ERROR_IO;
+  }
+  const int track = extractor.getVideoStreamIndex();
+  const AVCodecParameters *params = extractor.getStream(track)->codecpar;
+  const char *mime = params->codec_id == AV_CODEC_ID_H264 ? "video/avc"
+      : params->codec_id == AV_CODEC_ID_HEVC ? "video/hevc" : nullptr;
+  if (mime == nullptr) {
+    ALOGE("%s is not H.264 or HEVC", options.url.c_str());
+    return ERROR_UNSUPPORTED;
+  }
+
+  BitstreamConverter converter;
+  status_t err = converter.configure(mime, params->extradata, params->extradata_size);
+  if (err != OK) {
+    return err;
+  }
+  if (converter.isPassThrough()) {
+    ALOGE("%s is Annex-B already", options.url.c_str());
+    return ERROR_UNSUPPORTED;
+  }
+
+  std::vector<std::unique_ptr<MediaPacket>> packets;
+  int64_t bytes = 0;
+  size_t maxConverted = 0;
+  std::unique_ptr<MediaPacket> packet;
+  while (bytes < maxBytes && extractor.read(packet, track) == OK) {
+    bytes += packet->size();
+    maxConverted = std::max(maxConverted, converter.convertedSize(packet->data(), packet->size()));
+    packets.push_back(copyOf(*packet));
+    if (packets.back() == nullptr) {
+      return NO_MEMORY;
+    }
+  }
+
+  Samples inPlace;
+  Samples copied;
+  Samples bsf;
+  std::vector<uint8_t> out(maxConverted);
+  for (int i = 0; i < iterations; ++i) {
+    // Writable copies for the in-place run, made outside the clock.
+    std::vector<std::unique_ptr<MediaPacket>> copies;
+    for (const std::unique_ptr<MediaPacket> &p : packets) {
+      copies.push_back(copyOf(*p));
+    }
+    int64_t startUs = Looper::GetNowUs();
+    for (std::unique_ptr<MediaPacket> &p : copies) {
+      converter.convert(p.get());
+    }
+    inPlace.add(megabytesPerS(bytes, Looper::GetNowUs() - startUs));
+
+    startUs = Looper::GetNowUs();
+    for (const std::unique_ptr<MediaPacket> &p : packets) {
+      size_t outSize = 0;
+      converter.convert(p->data(), p->size(), out.data(), out.size(), &outSize);
+    }
+    copied.add(megabytesPerS(bytes, Looper::GetNowUs() - startUs));
+
+    const AVBitStreamFilter *filter = av_bsf_get_by_name(
+        params->codec_id == AV_CODEC_ID_H264 ? "h264_mp4toannexb" : "hevc_mp4toannexb");
+    AVBSFContext *context = nullptr;
+    if (filter == nullptr || av_bsf_alloc(filter, &context) < 0) {
+      ALOGE("no mp4toannexb filter");
+      return ERROR_UNSUPPORTED;
+    }
+    avcodec_parameters_copy(context->par_in, params);
+    context->time_base_in = extractor.getStream(track)->time_base;
+    if (av_bsf_init(context) < 0) {
+      av_bsf_free(&context);
+      return ERROR_UNSUPPORTED;
+    }
+    AVPacket *in = av_packet_alloc();
+    startUs = Looper::GetNowUs();
+    for (const std::unique_ptr<MediaPacket> &p : packets) {
+      av_packet_ref(in, p->avPacket());
+      if (av_bsf_send_packet(context, in) < 0) {
+        av_packet_unref(in);
+        continue;
+      }
+      while (av_bsf_receive_packet(context, in) == 0) {
+        av_packet_unref(in);
+      }
+    }
+    bsf.add(megabytesPerS(bytes, Looper::GetNowUs() - startUs));
+    av_packet_free(&in);
+    av_bsf_free(&context);
+  }
+
+  const BitstreamConverter::Stats stats = converter.getStats();
+  json->write("codec", mime);
+  json->write("packets", (int64_t)packets.size());
+  json->write("bytes", bytes);
+  json->write("csd0_bytes", (int64_t)converter.getCsd0().size());
+  json->write("csd1_bytes", (int64_t)converter.getCsd1().size());
+  json->write("converted_in_place", stats.inPlace);
+  inPlace.writeJson(json, "in_place_mb_per_s");
+  copied.writeJson(json, "copy_mb_per_s");
+  bsf.writeJson(json, "bsf_mb_per_s");
+  return OK;
+}
+
+HPCBENCH_MODE("annexb", "[--iterations=N] [--max-mb=N]", runAnnexB);
+
+} // hpc
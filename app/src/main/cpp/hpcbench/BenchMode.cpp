@@ -0,0 +1,54 @@
+#include "BenchMode.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace hpc {
+
+bool BenchOptions::has(const std::string &key) const {
+  return args.find(key) != args.end();
+}
+
+int64_t BenchOptions::getInt(const std::string &key, int64_t defaultValue) const {
+  auto it = args.find(key);
+  if (it == args.end() || it->second.empty()) {
+    return defaultValue;
+  }
+  return strtoll(it->second.c_str(), nullptr, 0);
+}
+
+std::string BenchOptions::getString(const std::string &key, const std::string &defaultValue) const {
+  auto it = args.find(key);
+  return it == args.end() ? defaultValue : it->second;
+}
+
+// Function local so registration from static initializers in other
+// translation units does not depend on initialization order.
+static std::vector<BenchMode> &modes() {
+  static std::vector<BenchMode> sModes;
+  return sModes;
+}
+
+// static
+void BenchRegistry::Add(const BenchMode &mode) {
+  modes().push_back(mode);
+  std::sort(modes().begin(), modes().end(),
+            [](const BenchMode &a, const BenchMode &b) { return std::string(a.name) < b.name; });
+}
+
+// static
+const BenchMode *BenchRegistry::Find(const std::string &name) {
+  for (const BenchMode &mode : modes()) {
+    if (name == mode.name) {
+      return &mode;
+    }
+  }
+  return nullptr;
+}
+
+// static
+const std::vector<BenchMode> &BenchRegistry::Modes() {
+  return modes();
+}
+
+} // hpc
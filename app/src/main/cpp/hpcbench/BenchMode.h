@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Error.h"
+
+namespace hpc {
+
+class JsonWriter;
+
+struct BenchOptions {
+  std::string url;
+  // --key=value arguments, a bare --flag is stored as "1".
+  std::map<std::string, std::string> args;
+
+  bool has(const std::string &key) const;
+  int64_t getInt(const std::string &key, int64_t defaultValue) const;
+  std::string getString(const std::string &key, const std::string &defaultValue) const;
+};
+
+// A benchmark writes its results as members of the "results" object.
+typedef status_t (*BenchFunc)(const BenchOptions &options, JsonWriter *json);
+
+struct BenchMode {
+  const char *name;
+  const char *usage;  // one line, listing the mode's own options
+  BenchFunc run;
+};
+
+// Modes register themselves from their own translation unit, see
+// HPCBENCH_MODE, so adding a benchmark does not touch the driver.
+class BenchRegistry {
+ public:
+  static void Add(const BenchMode &mode);
+  static const BenchMode *Find(const std::string &name);
+  static const std::vector<BenchMode> &Modes();
+};
+
+struct BenchModeRegistrar {
+  BenchModeRegistrar(const char *name, const char *usage, BenchFunc run) {
+    BenchRegistry::Add(BenchMode{name, usage, run});
+  }
+};
+
+#define HPCBENCH_MODE(name, usage, run) \
+    static ::hpc::BenchModeRegistrar sBenchModeRegistrar_##run(name, usage, run)
+
+} // hpc
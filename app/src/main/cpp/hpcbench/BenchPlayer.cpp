@@ -0,0 +1,277 @@
+#include "BenchPlayer.h"
+#include "HpcPlayer.h"
+#include "Looper.h"
+#include "Log.h"
+
+#include <chrono>
+
+#define LOG_TAG "BenchPlayer"
+
+namespace hpc {
+
+// A seek to a position shows the frame at it or the next one, SEEK_CLOSEST
+// rounds by up to a tick of the stream time base.
+static const int64_t kSeekToleranceUs = 1000;
+// Frames further than this past the target were queued before the seek.
+static const int64_t kMaxSeekOvershootUs = 1000000;
+static const int64_t kPollUs = 10000;
+
+static int64_t eventKey(int msg, int ext1) {
+  return ((int64_t)msg << 32) | (uint32_t)(msg == MEDIA_INFO ? ext1 : 0);
+}
+
+BenchPlayer::BenchPlayer(const Config &config)
+    : mConfig(config),
+      mVideoSink(std::make_shared<NullVideoSink>()) {
+  if (mConfig.audio) {
+    mAudioSink = std::make_shared<NullAudioSink>(!mConfig.freeRunning);
+  }
+}
+
+BenchPlayer::~BenchPlayer() {
+  if (mPlayer != nullptr) {
+    // Puts the video decoder back to DecoderPool.
+    mPlayer->release();
+    mPlayer->setListener(nullptr);
+  }
+}
+
+status_t BenchPlayer::open(const std::string &url) {
+  mPlayer = HpcPlayer::Create();
+  mPlayer->setListener([this](int msg, int ext1, int ext2) {
+    onEvent(msg, ext1, ext2);
+  });
+  // nullptr too, it replaces OpenSL ES on Android.
+  status_t err = mPlayer->setAudioSink(mAudioSink);
+  if (err == OK) {
+    err = mPlayer->setFreeRunning(mConfig.freeRunning);
+  }
+  if (err == OK) {
+    err = mPlayer->setBufferingSettings(mConfig.buffering);
+  }
+  if (err == OK) {
+    err = mPlayer->setSurface(mVideoSink);
+  }
+  if (err == OK) {
+    err = mPlayer->setDataSource(url.c_str());
+  }
+  if (err == OK) {
+    err = mPlayer->prepare();
+  }
+  if (err != OK) {
+    ALOGE("cannot open %s: %d", url.c_str(), err);
+  }
+  return err;
+}
+
+void BenchPlayer::onEvent(int msg, int ext1, int ext2) {
+  std::lock_guard<std::mutex> lock(mLock);
+  ++mEvents[eventKey(msg, ext1)];
+  switch (msg) {
+    case MEDIA_SET_VIDEO_SIZE:
+      mWidth = ext1;
+      mHeight = ext2;
+      break;
+
+    case MEDIA_PLAYBACK_COMPLETE:
+      mEOS = true;
+      break;
+
+    case MEDIA_ERROR:
+      ALOGE("player error %d", ext2);
+      mError = ext2 != OK ? ext2 : UNKNOWN_ERROR;
+      break;
+
+    case MEDIA_INFO:
+      if (ext1 == MEDIA_INFO_TRACK_SWITCHED && mTrackSwitchStartUs >= 0) {
+        mTrackSwitchLatency.add(Looper::GetNowUs() - mTrackSwitchStartUs);
+        mTrackSwitchStartUs = -1;
+      }
+      break;
+
+    default:
+      break;
+  }
+  mCondition.notify_all();
+}
+
+int64_t BenchPlayer::eventCount(int msg, int ext1) const {
+  std::lock_guard<std::mutex> lock(mLock);
+  auto it = mEvents.find(eventKey(msg, ext1));
+  return it != mEvents.end() ? it->second : 0;
+}
+
+status_t BenchPlayer::waitFor(int msg, int ext1, int64_t count, int64_t timeoutUs) {
+  std::unique_lock<std::mutex> lock(mLock);
+  const int64_t key = eventKey(msg, ext1);
+  bool reached = mCondition.wait_for(lock, std::chrono::microseconds(timeoutUs), [&]() {
+    return mError != OK || mEvents[key] >= count;
+  });
+  if (mError != OK) {
+    return mError;
+  }
+  return reached ? OK : TIMED_OUT;
+}
+
+bool BenchPlayer::isEOS() const {
+  std::lock_guard<std::mutex> lock(mLock);
+  return mEOS;
+}
+
+status_t BenchPlayer::play(int64_t durationUs) {
+  const int64_t startUs = Looper::GetNowUs();
+  status_t err = OK;
+  if (!mStarted) {
+    err = mPlayer->start();
+    mStarted = err == OK;
+  }
+
+  int64_t firstPtsUs = -1;
+  int64_t rendered = mVideoSink->rendered();
+  int64_t progressUs = startUs;
+  while (err == OK && !isEOS()) {
+    {
+      std::unique_lock<std::mutex> lock(mLock);
+      mCondition.wait_for(lock, std::chrono::microseconds(kPollUs));
+      err = mError;
+    }
+    const int64_t nowUs = Looper::GetNowUs();
+    if (mVideoSink->rendered() != rendered) {
+      rendered = mVideoSink->rendered();
+      progressUs = nowUs;
+    } else if (nowUs - progressUs > kStallTimeoutUs) {
+      ALOGE("nothing shown for %lld us", (long long)(nowUs - progressUs));
+      err = TIMED_OUT;
+      break;
+    }
+    const int64_t ptsUs = mVideoSink->lastPtsUs();
+    if (durationUs >= 0 && ptsUs >= 0) {
+      if (firstPtsUs < 0) {
+        firstPtsUs = ptsUs;
+      } else if (ptsUs >= firstPtsUs + durationUs) {
+        break;
+      }
+    }
+  }
+  mWallUs += Looper::GetNowUs() - startUs;
+  return err;
+}
+
+status_t BenchPlayer::seekTo(int64_t timeUs, int64_t *latencyUs) {
+  const int64_t startUs = Looper::GetNowUs();
+  int64_t seeks;
+  {
+    std::lock_guard<std::mutex> lock(mLock);
+    seeks = mEvents[eventKey(MEDIA_SEEK_COMPLETE, 0)];
+    mEOS = false;
+  }
+  const int64_t renderedBefore = mVideoSink->rendered();
+  mVideoSink->flush();
+  status_t err = mPlayer->seekTo(timeUs, SEEK_CLOSEST, true /* needNotify */);
+  if (err == OK) {
+    err = waitFor(MEDIA_SEEK_COMPLETE, 0, seeks + 1, kStallTimeoutUs);
+  }
+  // The frame at the target is shown once the decoders resumed, paused or
+  // not.
+  while (err == OK) {
+    const int64_t ptsUs = mVideoSink->lastPtsUs();
+    if (mVideoSink->rendered() > renderedBefore
+        && ptsUs >= timeUs - kSeekToleranceUs && ptsUs < timeUs + kMaxSeekOvershootUs) {
+      break;
+    }
+    if (isEOS()) {
+      return ERROR_END_OF_STREAM;
+    }
+    std::unique_lock<std::mutex> lock(mLock);
+    mCondition.wait_for(lock, std::chrono::microseconds(1000));
+    if (mError != OK) {
+      err = mError;
+    } else if (Looper::GetNowUs() - startUs > kStallTimeoutUs) {
+      err = TIMED_OUT;
+    }
+  }
+  if (err == OK && latencyUs != nullptr) {
+    *latencyUs = Looper::GetNowUs() - startUs;
+  }
+  return err;
+}
+
+status_t BenchPlayer::step(bool forward, int64_t *latencyUs) {
+  const int64_t startUs = Looper::GetNowUs();
+  const int64_t steps = eventCount(MEDIA_INFO, MEDIA_INFO_FRAME_STEPPED);
+  const int64_t renderedBefore = mVideoSink->rendered();
+  status_t err = forward ? mPlayer->stepForward() : mPlayer->stepBackward();
+  if (err == OK) {
+    err = waitFor(MEDIA_INFO, MEDIA_INFO_FRAME_STEPPED, steps + 1, kStallTimeoutUs);
+  }
+  // Reported on the player's looper, shown on the renderer's.
+  while (err == OK && mVideoSink->rendered() == renderedBefore) {
+    std::unique_lock<std::mutex> lock(mLock);
+    mCondition.wait_for(lock, std::chrono::microseconds(1000));
+    if (mError != OK) {
+      err = mError;
+    } else if (Looper::GetNowUs() - startUs > kStallTimeoutUs) {
+      err = TIMED_OUT;
+    }
+  }
+  if (err == OK) {
+    mStarted = false;  // stepping pauses, play() starts again
+    if (latencyUs != nullptr) {
+      *latencyUs = Looper::GetNowUs() - startUs;
+    }
+  }
+  return err;
+}
+
+status_t BenchPlayer::selectAudioTrack(size_t trackIndex) {
+  {
+    std::lock_guard<std::mutex> lock(mLock);
+    mTrackSwitchStartUs = Looper::GetNowUs();
+  }
+  status_t err = mPlayer->selectTrack(trackIndex, true);
+  if (err != OK) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mTrackSwitchStartUs = -1;
+  }
+  return err;
+}
+
+bool BenchPlayer::isTrackSwitchPending() const {
+  std::lock_guard<std::mutex> lock(mLock);
+  return mTrackSwitchStartUs >= 0;
+}
+
+Samples BenchPlayer::trackSwitchLatency() const {
+  std::lock_guard<std::mutex> lock(mLock);
+  return mTrackSwitchLatency;
+}
+
+int64_t BenchPlayer::getDurationUs() const {
+  int64_t durationMs = -1;
+  if (mPlayer == nullptr || mPlayer->getDuration(&durationMs) != OK) {
+    return -1;
+  }
+  return durationMs * 1000;
+}
+
+int32_t BenchPlayer::width() const {
+  std::lock_guard<std::mutex> lock(mLock);
+  return mWidth;
+}
+
+int32_t BenchPlayer::height() const {
+  std::lock_guard<std::mutex> lock(mLock);
+  return mHeight;
+}
+
+std::shared_ptr<const StartupTimeline> BenchPlayer::startupTimeline() const {
+  return mPlayer->getStartupTimeline();
+}
+
+PlaybackStats::Snapshot BenchPlayer::stats() const {
+  PlaybackStats::Snapshot snapshot;
+  mPlayer->getStats(&snapshot);
+  return snapshot;
+}
+
+} // hpc
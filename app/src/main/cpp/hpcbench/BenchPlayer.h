@@ -0,0 +1,104 @@
+#pragma once
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "BufferingSettings.h"
+#include "Error.h"
+#include "PlaybackStats.h"
+#include "StartupTimeline.h"
+#include "JsonWriter.h"
+#include "NullSinks.h"
+
+namespace hpc {
+
+class HpcPlayer;
+
+// HpcPlayer as the app drives it, with the null sinks in place of OpenSL ES
+// and the window: source, decoders, DecoderPool and renderer are the
+// player's own, running on their own loopers in real time. The calls block
+// the bench until the player reported what they wait for.
+class BenchPlayer {
+ public:
+  struct Config {
+    bool audio {true};
+    // Frames go out as fast as they are decoded, see
+    // HpcPlayer::setFreeRunning(); the audio sink does not block either.
+    bool freeRunning {false};
+    BufferingSettings buffering;
+  };
+
+  explicit BenchPlayer(const Config &config);
+  ~BenchPlayer();
+
+  BenchPlayer(const BenchPlayer &) = delete;
+  BenchPlayer &operator=(const BenchPlayer &) = delete;
+
+  // setDataSource() and a synchronous prepare() with Config::buffering.
+  status_t open(const std::string &url);
+
+  // Plays |durationUs| of media from the current position, starting the
+  // player if needed, or up to the end of stream if |durationUs| is
+  // negative. Media time is that of the frames shown, a loop keeps
+  // counting up.
+  status_t play(int64_t durationUs);
+
+  // Accurate seek, returns once the frame at |timeUs| has been shown.
+  // |latencyUs| is the time from request to that frame.
+  status_t seekTo(int64_t timeUs, int64_t *latencyUs);
+
+  // One frame step, returns once the stepped frame has been shown.
+  // |latencyUs| is the time from request to that frame.
+  status_t step(bool forward, int64_t *latencyUs);
+
+  // Returns right away, MEDIA_INFO_TRACK_SWITCHED completes the switch and
+  // adds its latency to trackSwitchLatency().
+  status_t selectAudioTrack(size_t trackIndex);
+  bool isTrackSwitchPending() const;
+  Samples trackSwitchLatency() const;
+
+  // Waits for the |count|th |msg| (and |ext1| for MEDIA_INFO) since open().
+  status_t waitFor(int msg, int ext1, int64_t count, int64_t timeoutUs);
+  int64_t eventCount(int msg, int ext1 = 0) const;
+
+  HpcPlayer *player() const { return mPlayer.get(); }
+  bool isEOS() const;
+  int64_t getDurationUs() const;
+  int32_t width() const;
+  int32_t height() const;
+  int64_t wallUs() const { return mWallUs; }
+
+  std::shared_ptr<const StartupTimeline> startupTimeline() const;
+  PlaybackStats::Snapshot stats() const;
+  const NullVideoSink &videoSink() const { return *mVideoSink; }
+  // nullptr without audio.
+  const NullAudioSink *audioSink() const { return mAudioSink.get(); }
+
+ private:
+  // A stream that shows nothing for this long has stalled.
+  static const int64_t kStallTimeoutUs = 10000000;
+
+  const Config mConfig;
+  std::shared_ptr<HpcPlayer> mPlayer;
+  const std::shared_ptr<NullVideoSink> mVideoSink;
+  std::shared_ptr<NullAudioSink> mAudioSink;
+  bool mStarted {false};
+  int64_t mWallUs {0};
+
+  mutable std::mutex mLock;
+  std::condition_variable mCondition;
+  std::map<int64_t, int64_t> mEvents;  // (msg, ext1) to count
+  status_t mError {OK};
+  bool mEOS {false};  // until the next seek
+  int32_t mWidth {0};
+  int32_t mHeight {0};
+  int64_t mTrackSwitchStartUs {-1};
+  Samples mTrackSwitchLatency;
+
+  void onEvent(int msg, int ext1, int ext2);
+};
+
+} // hpc
@@ -0,0 +1,260 @@
+#include "BenchMode.h"
+#include "CachedSource.h"
+#include "FFmpegExtractor.h"
+#include "FileSource.h"
+#include "JsonWriter.h"
+#include "Log.h"
+#include "Looper.h"
+#include "MediaPacket.h"
+#include "UringSource.h"
+
+#include <atomic>
+#include <fcntl.h>
+#include <strings.h>
+#include <unistd.h>
+
+#define LOG_TAG "CacheBench"
+
+namespace hpc {
+
+// A packet read later than this after it was due stalls playback.
+static const int64_t kLateUs = 40000;
+
+// Slow storage: every read costs |latencyUs| plus the transfer at |bps|.
+class ThrottledSource : public DataSource {
+ public:
+  ThrottledSource(const std::shared_ptr<DataSource> &source, int64_t bps, int64_t latencyUs)
+      : mSource(source), mBps(bps), mLatencyUs(latencyUs) {}
+
+  status_t initCheck() const override { return mSource->initCheck(); }
+  status_t getSize(int64_t *size) override { return mSource->getSize(size); }
+
+  ssize_t readAt(int64_t offset, void *data, size_t size) override {
+    ssize_t n = mSource->readAt(offset, data, size);
+    int64_t delayUs = mLatencyUs;
+    if (n > 0 && mBps > 0) {
+      delayUs += n * 8 * 1000000 / mBps;
+    }
+    if (delayUs > 0) {
+      usleep(delayUs);
+    }
+    ++mReads;
+    mBytes += n > 0 ? n : 0;
+    return n;
+  }
+
+  int64_t reads() const { return mReads; }
+  int64_t bytes() const { return mBytes; }
+
+ private:
+  const std::shared_ptr<DataSource> mSource;
+  const int64_t mBps;
+  const int64_t mLatencyUs;
+  std::atomic<int64_t> mReads {0};
+  std::atomic<int64_t> mBytes {0};
+};
+
+// Demuxes --seconds of the stream, paced like playback unless --fast, and
+// goes back --seek-back-ms every --seek-every-s the way a user scrubbing
+// back would.
+static status_t demux(const BenchOptions &options, const std::shared_ptr<DataSource> &source,
+                      JsonWriter *json) {
+  const bool fast = options.has("fast");
+  const int64_t playUs = options.getInt("seconds", 20) * 1000000;
+  const int64_t seekEveryUs = options.getInt("seek-every-s", 5) * 1000000;
+  const int64_t seekBackUs = options.getInt("seek-back-ms", 2000) * 1000;
+
+  FFmpegExtractor extractor;
+  extractor.setDataSource(source);
+  int64_t startUs = Looper::GetNowUs();
+  status_t err = extractor.init(options.url.c_str());
+  if (err != OK) {
+    ALOGE("cannot open %s: %d", options.url.c_str(), err);
+    return err;
+  }
+  const int64_t openUs = Looper::GetNowUs() - startUs;
+
+  Samples readUs;
+  Samples seekUs;
+  int64_t late = 0;
+  int64_t lateUs = 0;
+  int64_t bytes = 0;
+  int64_t playedUs = 0;
+  int64_t nextSeekUs = seekEveryUs;
+  // wall time the packet at |anchorMediaUs| was due.
+  int64_t anchorRealUs = -1;
+  int64_t anchorMediaUs = 0;
+  int64_t lastMediaUs = 0;
+  std::unique_ptr<MediaPacket> packet;
+  startUs = Looper::GetNowUs();
+  while (playedUs < playUs) {
+    if (seekEveryUs > 0 && playedUs >= nextSeekUs) {
+      nextSeekUs += seekEveryUs;
+      const int64_t beforeUs = Looper::GetNowUs();
+      extractor.seek(std::max<int64_t>(lastMediaUs - seekBackUs, 0));
+      seekUs.add(Looper::GetNowUs() - beforeUs);
+      anchorRealUs = -1;
+    }
+
+    const int64_t beforeUs = Looper::GetNowUs();
+    err = extractor.read(packet, -1 /* any selected track */);
+    const int64_t afterUs = Looper::GetNowUs();
+    if (err != OK) {
+      break;
+    }
+    readUs.add(afterUs - beforeUs);
+    bytes += packet->size();
+    if (packet->dtsUs < 0) {
+      continue;
+    }
+    if (anchorRealUs < 0) {
+      anchorRealUs = afterUs;
+      anchorMediaUs = packet->dtsUs;
+    }
+    const int64_t dueUs = anchorRealUs + packet->dtsUs - anchorMediaUs;
+    if (afterUs > dueUs + kLateUs) {
+      ++late;
+      lateUs += afterUs - dueUs;
+      // playback stalled, it carries on from here.
+      anchorRealUs += afterUs - dueUs;
+    } else if (!fast && dueUs > afterUs) {
+      usleep(dueUs - afterUs);
+    }
+    if (packet->dtsUs > lastMediaUs) {
+      playedUs += std::min<int64_t>(packet->dtsUs - lastMediaUs, 1000000);
+    }
+    lastMediaUs = packet->dtsUs;
+  }
+  const int64_t wallUs = Looper::GetNowUs() - startUs;
+
+  json->write("open_ms", openUs / 1000);
+  json->write("wall_ms", wallUs / 1000);
+  json->write("mb_per_sec", wallUs > 0 ? bytes / (double)wallUs : 0.0);
+  readUs.writeJson(json, "read_us");
+  seekUs.writeJson(json, "seek_us");
+  json->write("late_packets", late);
+  json->write("late_ms", lateUs / 1000);
+  return OK;
+}
+
+// Demuxing straight from slow storage against the same storage behind a
+// CachedSource. Storage is simulated by a reader throttled to --kbps with
+// --latency-ms per read.
+static status_t runCache(const BenchOptions &options, JsonWriter *json) {
+  const int64_t bps = options.getInt("kbps", 16000) * 1000;
+  const int64_t latencyUs = options.getInt("latency-ms", 8) * 1000;
+  std::shared_ptr<FileSource> file = FileSource::Create(options.url.c_str());
+  if (file == nullptr || file->initCheck() != OK) {
+    ALOGE("%s is not a local file", options.url.c_str());
+    return ERROR_UNSUPPORTED;
+  }
+  json->write("kbps", bps / 1000);
+  json->write("latency_ms", latencyUs / 1000);
+
+  std::shared_ptr<ThrottledSource> storage = std::make_shared<ThrottledSource>(file, bps, latencyUs);
+  json->beginObject("direct");
+  status_t err = demux(options, storage, json);
+  json->write("upstream_reads", storage->reads());
+  json->write("upstream_bytes", storage->bytes());
+  json->endObject();
+  if (err != OK) {
+    return err;
+  }
+
+  storage = std::make_shared<ThrottledSource>(file, bps, latencyUs);
+  CachedSource::Config config;
+  config.capacity = (size_t)options.getInt("cache-mb", 16) * 1024 * 1024;
+  config.highWatermark = config.capacity * 3 / 4;
+  config.lowWatermark = config.capacity / 4;
+  config.keepBehind = config.capacity / 8;
+  std::shared_ptr<CachedSource> cache = std::make_shared<CachedSource>(storage, config);
+  json->beginObject("cached");
+  err = demux(options, cache, json);
+  CachedSource::Stats stats = cache->getStats();
+  json->write("upstream_reads", storage->reads());
+  json->write("upstream_bytes", storage->bytes());
+  json->write("hit_rate", stats.hitRate());
+  json->write("hits", stats.hits);
+  json->write("misses", stats.misses);
+  json->write("window_moves", stats.windowMoves);
+  json->write("max_wait_us", stats.maxWaitUs);
+  json->write("cached_bytes", (uint64_t)stats.cachedBytes);
+  json->endObject();
+  return err;
+}
+
+// Drops the file's pages from the page cache, so that every run reads it
+// from storage.
+static void evict(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd >= 0) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+}
+
+// Real storage rather than a simulated one: a file on a throttled loop
+// device, or in tmpfs for what the reads cost in CPU alone, demuxed with a
+// pread() per read, through a CachedSource and with io_uring read-ahead.
+// The file is evicted from the page cache before each.
+static status_t runUring(const BenchOptions &options, JsonWriter *json) {
+  std::shared_ptr<FileSource> file = FileSource::Create(options.url.c_str());
+  if (file == nullptr || file->initCheck() != OK) {
+    ALOGE("%s is not a local file", options.url.c_str());
+    return ERROR_UNSUPPORTED;
+  }
+  const char *path = strncasecmp(options.url.c_str(), "file://", 7) == 0
+      ? options.url.c_str() + 7 : options.url.c_str();
+
+  evict(path);
+  json->beginObject("pread");
+  status_t err = demux(options, file, json);
+  json->endObject();
+  if (err != OK) {
+    return err;
+  }
+
+  evict(path);
+  std::shared_ptr<CachedSource> cache = std::make_shared<CachedSource>(file);
+  json->beginObject("cached");
+  err = demux(options, cache, json);
+  const CachedSource::Stats cacheStats = cache->getStats();
+  json->write("hit_rate", cacheStats.hitRate());
+  json->write("max_wait_us", cacheStats.maxWaitUs);
+  json->endObject();
+  cache.reset();
+  if (err != OK) {
+    return err;
+  }
+
+  evict(path);
+  UringSource::Config config;
+  config.chunkSize = (size_t)options.getInt("chunk-kb", 256) * 1024;
+  config.depth = (size_t)options.getInt("depth", 8);
+  std::shared_ptr<UringSource> uring = std::make_shared<UringSource>(path, config);
+  json->beginObject("uring");
+  json->write("async", uring->isAsync());
+  err = demux(options, uring, json);
+  const UringSource::Stats uringStats = uring->getStats();
+  json->write("hits", uringStats.hits);
+  json->write("waits", uringStats.waits);
+  json->write("wait_ms", uringStats.waitUs / 1000);
+  json->write("max_wait_us", uringStats.maxWaitUs);
+  json->write("submitted", uringStats.submitted);
+  json->write("dropped", uringStats.dropped);
+  json->write("sync_reads", uringStats.syncReads);
+  json->endObject();
+  return err;
+}
+
+HPCBENCH_MODE("cache",
+              "[--fast] [--kbps=N] [--latency-ms=N] [--cache-mb=N] [--seconds=N] "
+              "[--seek-every-s=N] [--seek-back-ms=N]",
+              runCache);
+
+HPCBENCH_MODE("uring",
+              "[--fast] [--depth=N] [--chunk-kb=N] [--seconds=N] [--seek-every-s=N] "
+              "[--seek-back-ms=N]",
+              runUring);
+
+} // hpc
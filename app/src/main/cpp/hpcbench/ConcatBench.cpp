@@ -0,0 +1,121 @@
+#include "BenchMode.h"
+#include "ConcatExtractor.h"
+#include "JsonWriter.h"
+#include "Log.h"
+#include "Looper.h"
+#include "MediaPacket.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <unistd.h>
+
+#define LOG_TAG "ConcatBench"
+
+namespace hpc {
+
+static std::vector<std::string> split(const std::string &list) {
+  std::vector<std::string> urls;
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    if (end > start) {
+      urls.push_back(list.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+  return urls;
+}
+
+// Reads the concatenation through at --speed times real time, as a player
+// keeping its queues topped up would, and reports what each boundary cost.
+static status_t play(const std::vector<std::string> &urls, const std::string &name,
+                     bool openAhead, int64_t speed, JsonWriter *json) {
+  ConcatExtractor extractor(urls);
+  extractor.setOpenAhead(openAhead);
+  status_t err = extractor.init(name.c_str());
+  if (err != OK) {
+    return err;
+  }
+  int64_t packets = 0;
+  int64_t maxGapUs = 0;
+  int64_t lastEndUs = -1;
+  // Audio timestamps follow on from one packet to the next, video ones
+  // only in decode order.
+  const int lead = extractor.getAudioStreamIndex() >= 0
+      ? extractor.getAudioStreamIndex() : extractor.getVideoStreamIndex();
+  std::unique_ptr<MediaPacket> packet;
+  const int64_t startUs = Looper::GetNowUs();
+  int64_t firstUs = -1;
+  while (extractor.read(packet, -1) == OK) {
+    ++packets;
+    if (packet->ptsUs == -1) {
+      continue;
+    }
+    if (firstUs < 0) {
+      firstUs = packet->ptsUs;
+    }
+    const int64_t dueUs = startUs + (packet->ptsUs - firstUs) / speed;
+    const int64_t nowUs = Looper::GetNowUs();
+    if (dueUs > nowUs) {
+      usleep(dueUs - nowUs);
+    }
+    if (packet->trackIndex == lead) {
+      if (lastEndUs >= 0) {
+        maxGapUs = std::max(maxGapUs, std::abs(packet->ptsUs - lastEndUs));
+      }
+      lastEndUs = packet->ptsUs + packet->durationUs;
+    }
+  }
+
+  const ConcatExtractor::Stats stats = extractor.getStats();
+  Samples stallUs;
+  for (int64_t us : stats.stallsUs) {
+    stallUs.add(us);
+  }
+  json->beginObject(openAhead ? "open_ahead" : "open_on_demand");
+  json->write("packets", packets);
+  json->write("duration_ms", extractor.getDurationUs() / 1000);
+  json->write("boundaries", stats.boundaries);
+  json->write("opened_ahead", stats.openedAhead);
+  json->write("reconfigures", stats.reconfigures);
+  json->write("new_extradata", stats.newExtradata);
+  json->write("failed", stats.failed);
+  json->write("max_gap_us", maxGapUs);
+  stallUs.writeJson(json, "stall_us");
+  json->endObject();
+  return OK;
+}
+
+// Stall at each segment boundary of --url, a comma separated list of
+// files played as one, --copies times over, with the next segment opened
+// ahead and opened when it is needed. Reads are paced at --speed times real
+// time; the stall is the time read() spent from the end of a segment to the
+// first packet of the next. max_gap_us is the largest jump in audio
+// timestamps, a measure of how well they were rebased.
+static status_t runConcat(const BenchOptions &options, JsonWriter *json) {
+  const int64_t copies = std::max<int64_t>(options.getInt("copies", 1), 1);
+  const int64_t speed = std::max<int64_t>(options.getInt("speed", 8), 1);
+  const std::vector<std::string> list = split(options.url);
+  std::vector<std::string> urls;
+  for (int64_t i = 0; i < copies; ++i) {
+    urls.insert(urls.end(), list.begin(), list.end());
+  }
+  if (urls.size() < 2) {
+    ALOGE("nothing to concatenate in %s", options.url.c_str());
+    return BAD_VALUE;
+  }
+  json->write("segments", (int64_t)urls.size());
+  json->write("speed", speed);
+  status_t err = play(urls, options.url, true, speed, json);
+  if (err != OK) {
+    return err;
+  }
+  return play(urls, options.url, false, speed, json);
+}
+
+HPCBENCH_MODE("concat", "[--copies=N] [--speed=N]", runConcat);
+
+} // hpc
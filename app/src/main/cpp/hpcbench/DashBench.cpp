@@ -0,0 +1,145 @@
+#include "BenchMode.h"
+#include "DashSource.h"
+#include "HTTPSource.h"
+#include "JsonWriter.h"
+#include "LocalHttpServer.h"
+#include "Log.h"
+#include "Looper.h"
+#include "Message.h"
+#include "StreamingConsumer.h"
+
+#include <unistd.h>
+
+#define LOG_TAG "DashBench"
+
+namespace hpc {
+
+// Opens a DASH manifest and plays it in real time like HlsBench does. The
+// startup is what this is about: the time to prepared and the requests
+// and connections it took, the manifest, indexes, init segments and the
+// first fragments of both adaptation sets. A local manifest is served with
+// its directory by a LocalHttpServer at --kbps (a list steps through it
+// every --switch-every-s) and --latency-ms per request, so that requests
+// cost what they do on a network; an http:// url is played as is.
+static status_t runDash(const BenchOptions &options, JsonWriter *json) {
+  const std::vector<int64_t> schedule = parseKbpsList(options.getString("kbps", "5000"));
+  const int64_t switchEveryUs = options.getInt("switch-every-s", 15) * 1000000;
+  const int64_t playUs = options.getInt("seconds", 30) * 1000000;
+
+  std::unique_ptr<LocalHttpServer> server;
+  std::string url = options.url;
+  if (!HTTPSource::IsSupported(url.c_str())) {
+    if (schedule.empty()) {
+      ALOGE("no bandwidth in --kbps");
+      return BAD_VALUE;
+    }
+    const size_t slash = url.rfind('/');
+    server = std::make_unique<LocalHttpServer>();
+    status_t err = server->start(slash == std::string::npos ? "." : url.substr(0, slash),
+                                 schedule[0] * 1000, options.getInt("latency-ms", 30) * 1000);
+    if (err != OK) {
+      return err;
+    }
+    url = server->url(url.substr(slash + 1));
+    json->write("latency_ms", options.getInt("latency-ms", 30));
+  }
+
+  std::shared_ptr<Looper> looper = std::make_shared<Looper>();
+  looper->setName("dashbench");
+  looper->start();
+  std::shared_ptr<SourceListener> listener = std::make_shared<SourceListener>();
+  looper->registerHandler(listener);
+
+  std::shared_ptr<DashSource> source =
+      std::make_shared<DashSource>(std::make_shared<Message>(0, listener));
+  status_t err = source->setDataSource(url.c_str());
+  if (err == OK && options.has("target-kbps")) {
+    err = source->setTargetBitrate(options.getInt("target-kbps", 0) * 1000);
+  }
+  const int64_t startUs = Looper::GetNowUs();
+  if (err == OK) {
+    source->prepareAsync();
+    while (!listener->prepared && Looper::GetNowUs() - startUs < 30000000) {
+      usleep(1000);
+    }
+    err = listener->prepared ? (status_t)listener->prepareResult : TIMED_OUT;
+  }
+  if (err != OK) {
+    ALOGE("cannot prepare %s: %d", url.c_str(), err);
+  } else {
+    const DashSource::Stats startup = source->getStats();
+    json->write("startup_ms", (Looper::GetNowUs() - startUs) / 1000);
+    json->write("source_startup_ms", startup.startupUs / 1000);
+    json->write("startup_requests", startup.requests);
+    json->write("startup_connections", startup.connections);
+    json->write("startup_bytes", startup.bytesFetched);
+    json->write("startup_segments", startup.segments);
+    int64_t durationUs;
+    if (source->getDuration(&durationUs) == OK) {
+      json->write("duration_ms", durationUs / 1000);
+    }
+
+    source->start();
+    TrackConsumer tracks[] = { {false /* audio */}, {true /* audio */} };
+    const bool hasVideo = source->getSelectedTrack(MEDIA_TRACK_TYPE_VIDEO) >= 0;
+    const bool hasAudio = source->getSelectedTrack(MEDIA_TRACK_TYPE_AUDIO) >= 0;
+    const int64_t playStartUs = Looper::GetNowUs();
+    int64_t playedUs = 0;
+    int64_t lastTickUs = playStartUs;
+    size_t step = 0;
+    while (playedUs < playUs
+           && !((tracks[0].ended || !hasVideo) && (tracks[1].ended || !hasAudio))) {
+      usleep(10000);
+      const int64_t nowUs = Looper::GetNowUs();
+      if (!listener->buffering) {
+        playedUs += nowUs - lastTickUs;
+      }
+      lastTickUs = nowUs;
+      if (server != nullptr && switchEveryUs > 0 && schedule.size() > 1) {
+        const size_t next = (size_t)((nowUs - playStartUs) / switchEveryUs) % schedule.size();
+        if (next != step) {
+          step = next;
+          server->setBandwidth(schedule[step] * 1000);
+          ALOGI("bandwidth now %lld kbps", (long long)schedule[step]);
+        }
+      }
+      for (TrackConsumer &track : tracks) {
+        if (track.audio ? hasAudio : hasVideo) {
+          track.consume(source.get(), playedUs);
+        }
+      }
+    }
+    json->write("played_ms", playedUs / 1000);
+    json->write("wall_ms", (Looper::GetNowUs() - playStartUs) / 1000);
+
+    const DashSource::Stats stats = source->getStats();
+    json->write("requests", stats.requests);
+    json->write("connections", stats.connections);
+    json->write("bytes_fetched", stats.bytesFetched);
+    json->write("segments", stats.segments);
+    json->write("switches", stats.switches);
+    json->write("rebuffers", stats.rebuffers);
+    json->write("rebuffer_ms", stats.rebufferUs / 1000);
+    json->write("video_kbps", stats.videoBps / 1000);
+    json->write("estimate_kbps", stats.bandwidthBps / 1000);
+    if (server != nullptr) {
+      // What reached the server, to check the client's own counts.
+      const LocalHttpServer::Stats serverStats = server->getStats();
+      json->write("server_requests", serverStats.requests);
+      json->write("server_connections", serverStats.connections);
+    }
+  }
+
+  source->disconnect();
+  source.reset();
+  looper->unregisterHandler(listener->id());
+  looper->stop();
+  return err;
+}
+
+HPCBENCH_MODE("dash",
+              "[--kbps=N,N,...] [--switch-every-s=N] [--latency-ms=N] [--seconds=N] "
+              "[--target-kbps=N]",
+              runDash);
+
+} // hpc
@@ -0,0 +1,128 @@
+#include "BenchMode.h"
+#include "HlsSource.h"
+#include "HTTPSource.h"
+#include "JsonWriter.h"
+#include "LocalHttpServer.h"
+#include "Log.h"
+#include "Looper.h"
+#include "Message.h"
+#include "StreamingConsumer.h"
+
+#include <unistd.h>
+
+#define LOG_TAG "HlsBench"
+
+namespace hpc {
+
+// Plays an HLS stream in real time the way the player consumes it, the
+// playhead stopping while the source rebuffers. A local master playlist is
+// served with its segments by a LocalHttpServer whose bandwidth steps
+// through --kbps every --switch-every-s, so the variant selection has
+// something to follow; an http:// url is played as is.
+static status_t runHls(const BenchOptions &options, JsonWriter *json) {
+  const std::vector<int64_t> schedule = parseKbpsList(options.getString("kbps", "5000,1000,5000"));
+  const int64_t switchEveryUs = options.getInt("switch-every-s", 15) * 1000000;
+  const int64_t playUs = options.getInt("seconds", 60) * 1000000;
+
+  std::unique_ptr<LocalHttpServer> server;
+  std::string url = options.url;
+  if (!HTTPSource::IsSupported(url.c_str())) {
+    if (schedule.empty()) {
+      ALOGE("no bandwidth in --kbps");
+      return BAD_VALUE;
+    }
+    const size_t slash = url.rfind('/');
+    server = std::make_unique<LocalHttpServer>();
+    status_t err = server->start(slash == std::string::npos ? "." : url.substr(0, slash),
+                                 schedule[0] * 1000, options.getInt("latency-ms", 30) * 1000);
+    if (err != OK) {
+      return err;
+    }
+    url = server->url(url.substr(slash + 1));
+    json->write("latency_ms", options.getInt("latency-ms", 30));
+  }
+
+  std::shared_ptr<Looper> looper = std::make_shared<Looper>();
+  looper->setName("hlsbench");
+  looper->start();
+  std::shared_ptr<SourceListener> listener = std::make_shared<SourceListener>();
+  looper->registerHandler(listener);
+
+  std::shared_ptr<HlsSource> source =
+      std::make_shared<HlsSource>(std::make_shared<Message>(0, listener));
+  status_t err = source->setDataSource(url.c_str());
+  if (err == OK && options.has("target-kbps")) {
+    err = source->setTargetBitrate(options.getInt("target-kbps", 0) * 1000);
+  }
+  const int64_t startUs = Looper::GetNowUs();
+  if (err == OK) {
+    source->prepareAsync();
+    while (!listener->prepared && Looper::GetNowUs() - startUs < 30000000) {
+      usleep(5000);
+    }
+    err = listener->prepared ? (status_t)listener->prepareResult : TIMED_OUT;
+  }
+  if (err != OK) {
+    ALOGE("cannot prepare %s: %d", url.c_str(), err);
+  } else {
+    json->write("startup_ms", (Looper::GetNowUs() - startUs) / 1000);
+    int64_t durationUs;
+    if (source->getDuration(&durationUs) == OK) {
+      json->write("duration_ms", durationUs / 1000);
+    }
+
+    source->start();
+    TrackConsumer tracks[] = { {false /* audio */}, {true /* audio */} };
+    const bool hasAudio = source->getSelectedTrack(MEDIA_TRACK_TYPE_AUDIO) >= 0;
+    const int64_t playStartUs = Looper::GetNowUs();
+    int64_t playedUs = 0;
+    int64_t lastTickUs = playStartUs;
+    size_t step = 0;
+    while (playedUs < playUs && !(tracks[0].ended && (tracks[1].ended || !hasAudio))) {
+      usleep(10000);
+      const int64_t nowUs = Looper::GetNowUs();
+      if (!listener->buffering) {
+        playedUs += nowUs - lastTickUs;
+      }
+      lastTickUs = nowUs;
+      if (server != nullptr && switchEveryUs > 0) {
+        const size_t next = (size_t)((nowUs - playStartUs) / switchEveryUs) % schedule.size();
+        if (next != step) {
+          step = next;
+          server->setBandwidth(schedule[step] * 1000);
+          ALOGI("bandwidth now %lld kbps", (long long)schedule[step]);
+        }
+      }
+      for (TrackConsumer &track : tracks) {
+        if (!track.audio || hasAudio) {
+          track.consume(source.get(), playedUs);
+        }
+      }
+    }
+    json->write("played_ms", playedUs / 1000);
+    json->write("wall_ms", (Looper::GetNowUs() - playStartUs) / 1000);
+
+    const HlsSource::Stats stats = source->getStats();
+    json->write("rebuffers", stats.rebuffers);
+    json->write("rebuffer_ms", stats.rebufferUs / 1000);
+    json->write("average_selected_kbps", stats.averageSelectedBps / 1000);
+    json->write("last_selected_kbps", stats.selectedBps / 1000);
+    json->write("estimate_kbps", stats.bandwidthBps / 1000);
+    json->write("switches", stats.switches);
+    json->write("segments", stats.segments);
+    json->write("bytes_fetched", stats.bytesFetched);
+  }
+
+  source->disconnect();
+  source.reset();
+  looper->unregisterHandler(listener->id());
+  looper->stop();
+  return err;
+}
+
+HPCBENCH_MODE("hls",
+              "[--kbps=N,N,...] [--switch-every-s=N] [--latency-ms=N] [--seconds=N] "
+              "[--target-kbps=N]",
+              runHls);
+
+} // hpc
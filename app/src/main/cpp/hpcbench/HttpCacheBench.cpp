@@ -0,0 +1,148 @@
+#include "BenchMode.h"
+#include "CachedSource.h"
+#include "DiskCacheSource.h"
+#include "FFmpegExtractor.h"
+#include "HTTPSource.h"
+#include "JsonWriter.h"
+#include "LocalHttpServer.h"
+#include "Log.h"
+#include "Looper.h"
+#include "MediaPacket.h"
+
+#include <algorithm>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOG_TAG "HttpCacheBench"
+
+namespace hpc {
+
+// Plays the url the way DefaultSource streams it, HTTPSource behind a
+// DiskCacheSource and a CachedSource: opens it, demuxes --seconds of media
+// as fast as it comes and seeks to the middle and back, the way a viewer
+// skipping around would.
+static status_t play(const BenchOptions &options, const std::string &url,
+                     const std::string &cacheDir, LocalHttpServer *server, JsonWriter *json) {
+  if (server != nullptr) {
+    server->resetStats();
+  }
+  std::shared_ptr<HTTPSource> http = std::make_shared<HTTPSource>(url.c_str());
+  std::shared_ptr<DiskCacheSource> disk =
+      std::make_shared<DiskCacheSource>(http, DiskCacheSource::PathFor(cacheDir, url));
+  if (disk->initCheck() != OK) {
+    ALOGE("no disk cache in %s", cacheDir.c_str());
+    return NO_INIT;
+  }
+  std::shared_ptr<CachedSource> cache = std::make_shared<CachedSource>(disk);
+
+  const int64_t playUs = options.getInt("seconds", 20) * 1000000;
+  const int64_t startUs = Looper::GetNowUs();
+  {
+    FFmpegExtractor extractor;
+    extractor.setDataSource(cache);
+    status_t err = extractor.init(url.c_str());
+    if (err != OK) {
+      ALOGE("cannot open %s: %d", url.c_str(), err);
+      return err;
+    }
+    const int64_t openUs = Looper::GetNowUs() - startUs;
+
+    std::unique_ptr<MediaPacket> packet;
+    int64_t firstPacketUs = -1;
+    int64_t firstDtsUs = -1;
+    int64_t lastDtsUs = 0;
+    bool seeked = false;
+    while ((err = extractor.read(packet, -1 /* any selected track */)) == OK) {
+      if (firstPacketUs < 0) {
+        firstPacketUs = Looper::GetNowUs() - startUs;
+      }
+      if (packet->dtsUs < 0) {
+        continue;
+      }
+      if (firstDtsUs < 0) {
+        firstDtsUs = packet->dtsUs;
+      }
+      lastDtsUs = packet->dtsUs;
+      if (!seeked && lastDtsUs - firstDtsUs >= playUs / 2) {
+        // out to twice as far and back to where it was.
+        seeked = true;
+        extractor.seek(lastDtsUs * 2);
+        extractor.read(packet, -1);
+        extractor.seek(lastDtsUs);
+        continue;
+      }
+      if (lastDtsUs - firstDtsUs >= playUs) {
+        break;
+      }
+    }
+    json->write("open_ms", openUs / 1000);
+    json->write("startup_ms", firstPacketUs / 1000);
+  }
+  json->write("wall_ms", (Looper::GetNowUs() - startUs) / 1000);
+
+  // What a destructed source left in flight is counted too.
+  cache.reset();
+  const HTTPSource::Stats httpStats = http->getStats();
+  const DiskCacheSource::Stats diskStats = disk->getStats();
+  if (server != nullptr) {
+    const LocalHttpServer::Stats serverStats = server->getStats();
+    json->write("bytes_fetched", serverStats.bytesServed);
+    json->write("connections", serverStats.connections);
+    json->write("requests", serverStats.requests);
+  } else {
+    json->write("bytes_fetched", httpStats.bytesFetched);
+    json->write("connections", httpStats.connects);
+    json->write("requests", httpStats.requests);
+  }
+  json->write("first_response_ms", httpStats.connectUs / 1000);
+  json->write("disk_bytes", diskStats.diskBytes);
+  json->write("upstream_bytes", diskStats.upstreamBytes);
+  json->write("cached_bytes", diskStats.cachedBytes);
+  return OK;
+}
+
+// Two plays of the same url from an empty disk cache: what the second one
+// still fetches and how much sooner it starts. A local file is served by a
+// LocalHttpServer throttled to --kbps and --latency-ms per request, an
+// http:// url is played as is.
+static status_t runHttpCache(const BenchOptions &options, JsonWriter *json) {
+  const std::string cacheDir = options.getString("cache-dir", "/tmp/hpcbench-http-cache");
+  mkdir(cacheDir.c_str(), 0700);
+
+  std::unique_ptr<LocalHttpServer> server;
+  std::string url = options.url;
+  if (!HTTPSource::IsSupported(url.c_str())) {
+    const size_t slash = url.rfind('/');
+    server = std::make_unique<LocalHttpServer>();
+    status_t err = server->start(slash == std::string::npos ? "." : url.substr(0, slash),
+                                 options.getInt("kbps", 20000) * 1000,
+                                 options.getInt("latency-ms", 30) * 1000);
+    if (err != OK) {
+      return err;
+    }
+    url = server->url(url.substr(slash + 1));
+    json->write("kbps", options.getInt("kbps", 20000));
+    json->write("latency_ms", options.getInt("latency-ms", 30));
+  }
+
+  const std::string path = DiskCacheSource::PathFor(cacheDir, url);
+  unlink(path.c_str());
+  unlink((path + ".idx").c_str());
+
+  json->beginObject("first_play");
+  status_t err = play(options, url, cacheDir, server.get(), json);
+  json->endObject();
+  if (err != OK) {
+    return err;
+  }
+  json->beginObject("second_play");
+  err = play(options, url, cacheDir, server.get(), json);
+  json->endObject();
+  return err;
+}
+
+HPCBENCH_MODE("httpcache",
+              "[--cache-dir=DIR] [--kbps=N] [--latency-ms=N] [--seconds=N]",
+              runHttpCache);
+
+} // hpc
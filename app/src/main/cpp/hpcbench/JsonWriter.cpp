@@ -0,0 +1,127 @@
+#include "JsonWriter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace hpc {
+
+void JsonWriter::prefix(const char *key) {
+  if (!mFirst.empty()) {
+    if (!mFirst.back()) {
+      mOut += ',';
+    }
+    mFirst.back() = false;
+  }
+  if (key != nullptr) {
+    appendString(key);
+    mOut += ':';
+  }
+}
+
+void JsonWriter::appendString(const std::string &value) {
+  mOut += '"';
+  for (char c : value) {
+    switch (c) {
+      case '"':  mOut += "\\\""; break;
+      case '\\': mOut += "\\\\"; break;
+      case '\n': mOut += "\\n";  break;
+      case '\t': mOut += "\\t";  break;
+      default:
+        if ((unsigned char)c < 0x20) {
+          char escaped[8];
+          snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          mOut += escaped;
+        } else {
+          mOut += c;
+        }
+        break;
+    }
+  }
+  mOut += '"';
+}
+
+void JsonWriter::beginObject(const char *key) {
+  prefix(key);
+  mOut += '{';
+  mFirst.push_back(true);
+}
+
+void JsonWriter::endObject() {
+  mOut += '}';
+  mFirst.pop_back();
+}
+
+void JsonWriter::beginArray(const char *key) {
+  prefix(key);
+  mOut += '[';
+  mFirst.push_back(true);
+}
+
+void JsonWriter::endArray() {
+  mOut += ']';
+  mFirst.pop_back();
+}
+
+void JsonWriter::write(const char *key, int64_t value) {
+  prefix(key);
+  mOut += std::to_string(value);
+}
+
+void JsonWriter::write(const char *key, double value) {
+  prefix(key);
+  if (!std::isfinite(value)) {
+    mOut += "null";
+    return;
+  }
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.3f", value);
+  mOut += buf;
+}
+
+void JsonWriter::write(const char *key, bool value) {
+  prefix(key);
+  mOut += value ? "true" : "false";
+}
+
+void JsonWriter::write(const char *key, const std::string &value) {
+  prefix(key);
+  appendString(value);
+}
+
+int64_t Samples::percentile(double p) const {
+  if (mValues.empty()) {
+    return -1;
+  }
+  std::vector<int64_t> sorted(mValues);
+  std::sort(sorted.begin(), sorted.end());
+  size_t index = (size_t)std::min<double>(sorted.size() - 1, p / 100.0 * sorted.size());
+  return sorted[index];
+}
+
+double Samples::mean() const {
+  if (mValues.empty()) {
+    return 0;
+  }
+  double sum = 0;
+  for (int64_t value : mValues) {
+    sum += value;
+  }
+  return sum / mValues.size();
+}
+
+void Samples::writeJson(JsonWriter *json, const char *key) const {
+  json->beginObject(key);
+  json->write("count", (int64_t)mValues.size());
+  if (!mValues.empty()) {
+    json->write("min", percentile(0));
+    json->write("p50", percentile(50));
+    json->write("p90", percentile(90));
+    json->write("p99", percentile(99));
+    json->write("max", *std::max_element(mValues.begin(), mValues.end()));
+    json->write("mean", mean());
+  }
+  json->endObject();
+}
+
+} // hpc
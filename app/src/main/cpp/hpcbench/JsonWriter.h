@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace hpc {
+
+// Minimal streaming JSON writer for benchmark reports. Keys are only
+// meaningful inside objects; inside arrays pass nullptr.
+class JsonWriter {
+ public:
+  JsonWriter() = default;
+
+  void beginObject(const char *key = nullptr);
+  void endObject();
+  void beginArray(const char *key = nullptr);
+  void endArray();
+
+  void write(const char *key, int64_t value);
+  void write(const char *key, double value);
+  void write(const char *key, bool value);
+  void write(const char *key, const std::string &value);
+  void write(const char *key, const char *value) { write(key, std::string(value)); }
+  void write(const char *key, int32_t value) { write(key, (int64_t)value); }
+  void write(const char *key, uint64_t value) { write(key, (int64_t)value); }
+
+  const std::string &str() const { return mOut; }
+
+ private:
+  std::string mOut;
+  std::vector<bool> mFirst;  // per open scope: nothing written yet
+
+  void prefix(const char *key);
+  void appendString(const std::string &value);
+};
+
+// Latency samples reported as count/min/p50/p90/p99/max/mean.
+class Samples {
+ public:
+  void add(int64_t value) { mValues.push_back(value); }
+  size_t count() const { return mValues.size(); }
+  int64_t percentile(double p) const;
+  double mean() const;
+
+  void writeJson(JsonWriter *json, const char *key) const;
+
+ private:
+  std::vector<int64_t> mValues;
+};
+
+} // hpc
@@ -0,0 +1,183 @@
+#include "BenchMode.h"
+#include "FFmpegExtractor.h"
+#include "JsonWriter.h"
+#include "KeyframeIndex.h"
+#include "KeyframeIndexer.h"
+#include "Log.h"
+#include "Looper.h"
+#include "MediaPacket.h"
+#include "MmapSource.h"
+#include "ProbeCache.h"
+#include "TsExtractor.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOG_TAG "KeyframeBench"
+
+namespace hpc {
+
+// The extractor DefaultSource would take for --url, mapped, with |index|
+// if not nullptr.
+static std::shared_ptr<Extractor> create(const std::string &url,
+                                         const std::shared_ptr<KeyframeIndex> &index) {
+  std::shared_ptr<MmapSource> source = MmapSource::Create(url.c_str());
+  if (source == nullptr || source->initCheck() != OK) {
+    return nullptr;
+  }
+  if (TsExtractor::Sniff(source.get())) {
+    std::shared_ptr<TsExtractor> ts = std::make_shared<TsExtractor>();
+    ts->setDataSource(source);
+    ts->setRequiresVideo(false);
+    ts->setKeyframeIndex(index);
+    return ts;
+  }
+  std::shared_ptr<FFmpegExtractor> ffmpeg = std::make_shared<FFmpegExtractor>();
+  ffmpeg->setDataSource(source);
+  ffmpeg->setRequiresVideo(false);
+  ffmpeg->setKeyframeIndex(index);
+  return ffmpeg;
+}
+
+static int leadTrack(Extractor *extractor) {
+  return extractor->getVideoStreamIndex() >= 0
+      ? extractor->getVideoStreamIndex() : extractor->getAudioStreamIndex();
+}
+
+// Seeks to each of |positionsUs| and reads the first packet of the lead
+// track; the time that takes, and how often it is not the key frame at or
+// before the position in |keyFramesUs|.
+static void seekAll(Extractor *extractor, const std::vector<int64_t> &positionsUs,
+                    const std::vector<int64_t> &keyFramesUs, Samples *seekUs,
+                    int64_t *inexact) {
+  const int track = leadTrack(extractor);
+  std::unique_ptr<MediaPacket> packet;
+  for (int64_t positionUs : positionsUs) {
+    const int64_t startUs = Looper::GetNowUs();
+    status_t err = extractor->seek(positionUs, SEEK_PREVIOUS_SYNC);
+    if (err == OK) {
+      err = extractor->read(packet, track);
+    }
+    seekUs->add(Looper::GetNowUs() - startUs);
+    auto it = std::upper_bound(keyFramesUs.begin(), keyFramesUs.end(), positionUs);
+    const int64_t expectedUs = it == keyFramesUs.begin() ? keyFramesUs.front() : *(it - 1);
+    if (err != OK || packet->ptsUs != expectedUs) {
+      ALOGV("seek to %lld us landed at %lld us, not %lld us", (long long)positionUs,
+            err == OK ? (long long)packet->ptsUs : -1LL, (long long)expectedUs);
+      ++*inexact;
+    }
+  }
+}
+
+// Seek latency and accuracy on a file without a seek table, TS, Matroska
+// without Cues, ADTS or MP3, before and after its key frames are indexed.
+// A first pass reads the lead track through, for the key frames a seek
+// should land on and a warm page cache. --seeks seeks spread over the
+// duration go to the container's own seek first, then the file is indexed
+// on demand and the same seeks go through the sidecar as a later open
+// loads it.
+static status_t runKeyframes(const BenchOptions &options, JsonWriter *json) {
+  const int seeks = (int)options.getInt("seeks", 50);
+  std::vector<int64_t> keyFramesUs;
+  int64_t durationUs = 0;
+  {
+    std::shared_ptr<Extractor> extractor = create(options.url, nullptr);
+    if (extractor == nullptr || extractor->init(options.url.c_str()) != OK) {
+      ALOGE("cannot open %s", options.url.c_str());
+      return ERROR_IO;
+    }
+    const int track = leadTrack(extractor.get());
+    std::unique_ptr<MediaPacket> packet;
+    while (extractor->read(packet, track) == OK) {
+      if (packet->isKeyFrame() && packet->ptsUs >= 0) {
+        keyFramesUs.push_back(packet->ptsUs);
+      }
+      durationUs = std::max(durationUs, packet->ptsUs);
+    }
+  }
+  std::sort(keyFramesUs.begin(), keyFramesUs.end());
+  if (keyFramesUs.empty()) {
+    return ERROR_UNSUPPORTED;
+  }
+  // the same pseudo-random positions every run
+  std::vector<int64_t> positionsUs;
+  uint32_t seed = 1;
+  for (int i = 0; i < seeks && durationUs > 0; ++i) {
+    seed = seed * 1103515245 + 12345;
+    positionsUs.push_back((int64_t)(seed >> 8) % durationUs);
+  }
+
+  Samples beforeUs;
+  int64_t inexactBefore = 0;
+  {
+    std::shared_ptr<Extractor> extractor = create(options.url, nullptr);
+    if (extractor->init(options.url.c_str()) != OK) {
+      return ERROR_IO;
+    }
+    seekAll(extractor.get(), positionsUs, keyFramesUs, &beforeUs, &inexactBefore);
+  }
+
+  char dirTemplate[] = "/tmp/hpcbench-keyframes-XXXXXX";
+  if (mkdtemp(dirTemplate) == nullptr) {
+    ALOGE("cannot create a sidecar directory");
+    return ERROR_IO;
+  }
+  const std::string directory = dirTemplate;
+  std::string key;
+  {
+    std::shared_ptr<MmapSource> source = MmapSource::Create(options.url.c_str());
+    key = ProbeCache::KeyFor(options.url.c_str(), source.get());
+  }
+  std::shared_ptr<KeyframeIndex> index = std::make_shared<KeyframeIndex>(directory, key);
+  KeyframeIndexer indexer(create(options.url, index), options.url);
+  const status_t scanned = indexer.run();
+  const KeyframeIndexer::Stats scan = indexer.getStats();
+
+  // A later open, with the index loaded from the sidecar.
+  Samples afterUs;
+  int64_t inexactAfter = 0;
+  std::shared_ptr<KeyframeIndex> loaded = std::make_shared<KeyframeIndex>(directory, key);
+  {
+    std::shared_ptr<Extractor> extractor = create(options.url, loaded);
+    if (extractor->init(options.url.c_str()) != OK) {
+      return ERROR_IO;
+    }
+    seekAll(extractor.get(), positionsUs, keyFramesUs, &afterUs, &inexactAfter);
+  }
+
+  int64_t sidecarBytes = 0;
+  // The sidecar goes with the run.
+  if (DIR *dir = opendir(directory.c_str())) {
+    while (struct dirent *entry = readdir(dir)) {
+      const std::string file = directory + "/" + entry->d_name;
+      struct stat st;
+      if (entry->d_name[0] != '.' && stat(file.c_str(), &st) == 0) {
+        sidecarBytes += st.st_size;
+        unlink(file.c_str());
+      }
+    }
+    closedir(dir);
+  }
+  rmdir(directory.c_str());
+
+  json->write("key_frames", (int64_t)keyFramesUs.size());
+  json->write("duration_ms", durationUs / 1000);
+  beforeUs.writeJson(json, "seek_before_us");
+  json->write("inexact_before", inexactBefore);
+  json->write("scan_ms", scan.scanUs / 1000);
+  json->write("scan_packets", scan.packets);
+  json->write("scan_complete", scanned == ERROR_END_OF_STREAM && index->isComplete());
+  json->write("index_entries", (int64_t)loaded->size());
+  json->write("sidecar_bytes", sidecarBytes);
+  afterUs.writeJson(json, "seek_after_us");
+  json->write("inexact_after", inexactAfter);
+  json->write("index_hits", loaded->getStats().hits);
+  return OK;
+}
+
+HPCBENCH_MODE("keyframes", "[--seeks=N]", runKeyframes);
+
+} // hpc
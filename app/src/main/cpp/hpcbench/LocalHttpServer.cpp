@@ -0,0 +1,261 @@
+#include "LocalHttpServer.h"
+#include "Log.h"
+#include "Looper.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <strings.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOG_TAG "LocalHttpServer"
+
+namespace hpc {
+
+namespace {
+
+std::string headerValue(const std::string &headers, const char *name) {
+  const size_t length = strlen(name);
+  for (size_t line = headers.find("\r\n"); line != std::string::npos;
+       line = headers.find("\r\n", line + 2)) {
+    if (strncasecmp(headers.c_str() + line + 2, name, length) == 0
+        && headers[line + 2 + length] == ':') {
+      size_t value = line + 3 + length;
+      while (value < headers.size() && headers[value] == ' ') {
+        ++value;
+      }
+      return headers.substr(value, headers.find("\r\n", value) - value);
+    }
+  }
+  return std::string();
+}
+
+bool sendAll(int fd, const void *data, size_t size) {
+  const char *p = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+} // namespace
+
+LocalHttpServer::~LocalHttpServer() {
+  stop();
+}
+
+status_t LocalHttpServer::start(const std::string &root, int64_t bps, int64_t latencyUs) {
+  mRoot = root;
+  mBps = bps;
+  mLatencyUs = latencyUs;
+  mListenSocket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (mListenSocket < 0) {
+    return ERROR_IO;
+  }
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  if (bind(mListenSocket, (struct sockaddr *)&address, sizeof(address)) != 0
+      || listen(mListenSocket, 16) != 0
+      || getsockname(mListenSocket, (struct sockaddr *)&address, &length) != 0) {
+    ALOGE("cannot listen: %s", strerror(errno));
+    ::close(mListenSocket);
+    mListenSocket = -1;
+    return ERROR_IO;
+  }
+  mPort = ntohs(address.sin_port);
+  mAcceptThread = std::thread(&LocalHttpServer::acceptLoop, this);
+  return OK;
+}
+
+void LocalHttpServer::stop() {
+  if (mListenSocket < 0 || mStopped.exchange(true)) {
+    return;
+  }
+  shutdown(mListenSocket, SHUT_RDWR);
+  mAcceptThread.join();
+  ::close(mListenSocket);
+
+  std::vector<std::thread> threads;
+  {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    for (int fd : mClients) {
+      shutdown(fd, SHUT_RDWR);
+    }
+    threads.swap(mClientThreads);
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+}
+
+std::string LocalHttpServer::url(const std::string &path) const {
+  return "http://127.0.0.1:" + std::to_string(mPort) + (path[0] == '/' ? "" : "/") + path;
+}
+
+LocalHttpServer::Stats LocalHttpServer::getStats() const {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  return mStats;
+}
+
+void LocalHttpServer::resetStats() {
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mStats = Stats();
+}
+
+void LocalHttpServer::acceptLoop() {
+  while (!mStopped) {
+    int fd = accept4(mListenSocket, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    std::lock_guard<std::mutex> autoLock(mLock);
+    if (mStopped) {
+      ::close(fd);
+      break;
+    }
+    ++mStats.connections;
+    mClients.push_back(fd);
+    mClientThreads.emplace_back(&LocalHttpServer::serve, this, fd);
+  }
+}
+
+// Serves requests on |fd| until the client closes it or asks to.
+void LocalHttpServer::serve(int fd) {
+  std::string buffer;
+  bool keepAlive = true;
+  while (keepAlive && !mStopped) {
+    size_t end;
+    while ((end = buffer.find("\r\n\r\n")) == std::string::npos) {
+      char data[4096];
+      ssize_t n = recv(fd, data, sizeof(data), 0);
+      if (n <= 0) {
+        keepAlive = false;
+        break;
+      }
+      buffer.append(data, n);
+    }
+    if (!keepAlive) {
+      break;
+    }
+    const std::string headers = buffer.substr(0, end + 2);
+    buffer.erase(0, end + 4);
+
+    char method[16] = {}, target[1024] = {};
+    int major = 1, minor = 1;
+    sscanf(headers.c_str(), "%15s %1023s HTTP/%d.%d", method, target, &major, &minor);
+    const std::string connection = headerValue(headers, "Connection");
+    keepAlive = (major == 1 && minor >= 1) ? strcasecmp(connection.c_str(), "close") != 0
+                                           : strcasecmp(connection.c_str(), "keep-alive") == 0;
+    std::string path(target);
+    path = path.substr(0, path.find('?'));
+    {
+      std::lock_guard<std::mutex> autoLock(mLock);
+      ++mStats.requests;
+    }
+    if (mLatencyUs > 0) {
+      usleep(mLatencyUs);
+    }
+
+    int file = -1;
+    struct stat st;
+    if (strcmp(method, "GET") == 0 && path.find("..") == std::string::npos) {
+      file = open((mRoot + path).c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (file < 0 || fstat(file, &st) != 0 || !S_ISREG(st.st_mode)) {
+      if (file >= 0) {
+        ::close(file);
+      }
+      static const char kNotFound[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+      keepAlive = keepAlive && sendAll(fd, kNotFound, sizeof(kNotFound) - 1);
+      continue;
+    }
+
+    const int64_t size = st.st_size;
+    int64_t first = 0;
+    int64_t last = size - 1;
+    const std::string range = headerValue(headers, "Range");
+    long long rangeFirst = 0, rangeLast = -1;
+    const int fields = sscanf(range.c_str(), "bytes=%lld-%lld", &rangeFirst, &rangeLast);
+    char response[256];
+    if (fields >= 1 && rangeFirst >= size) {
+      snprintf(response, sizeof(response),
+               "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%lld\r\n"
+               "Content-Length: 0\r\n\r\n", (long long)size);
+      keepAlive = keepAlive && sendAll(fd, response, strlen(response));
+      ::close(file);
+      continue;
+    }
+    if (fields >= 1) {
+      first = rangeFirst;
+      if (fields == 2) {
+        last = std::min<int64_t>(rangeLast, size - 1);
+      }
+      snprintf(response, sizeof(response),
+               "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %lld-%lld/%lld\r\n"
+               "Content-Length: %lld\r\nAccept-Ranges: bytes\r\n%s\r\n",
+               (long long)first, (long long)last, (long long)size,
+               (long long)(last - first + 1), keepAlive ? "" : "Connection: close\r\n");
+    } else {
+      snprintf(response, sizeof(response),
+               "HTTP/1.1 200 OK\r\nContent-Length: %lld\r\nAccept-Ranges: bytes\r\n%s\r\n",
+               (long long)size, keepAlive ? "" : "Connection: close\r\n");
+    }
+    keepAlive = sendAll(fd, response, strlen(response))
+        && sendBody(fd, file, first, last - first + 1) && keepAlive;
+    ::close(file);
+  }
+
+  std::lock_guard<std::mutex> autoLock(mLock);
+  mClients.erase(std::find(mClients.begin(), mClients.end(), fd));
+  ::close(fd);
+}
+
+// Sends |length| bytes of |file| at |offset|, paced at mBps.
+bool LocalHttpServer::sendBody(int fd, int file, int64_t offset, int64_t length) {
+  int64_t dueUs = Looper::GetNowUs();
+  int64_t sent = 0;
+  char data[16 * 1024];
+  while (sent < length && !mStopped) {
+    ssize_t n = pread(file, data, (size_t)std::min<int64_t>(sizeof(data), length - sent),
+                      offset + sent);
+    if (n <= 0 || !sendAll(fd, data, n)) {
+      return false;
+    }
+    sent += n;
+    {
+      std::lock_guard<std::mutex> autoLock(mLock);
+      mStats.bytesServed += n;
+    }
+    // Chunk by chunk, so that setBandwidth() takes effect mid-response.
+    const int64_t bps = mBps;
+    if (bps > 0) {
+      dueUs += n * 8 * 1000000 / bps;
+      const int64_t nowUs = Looper::GetNowUs();
+      if (dueUs > nowUs) {
+        usleep(dueUs - nowUs);
+      }
+    }
+  }
+  return sent == length;
+}
+
+} // hpc
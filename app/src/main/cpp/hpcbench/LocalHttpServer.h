@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Error.h"
+
+namespace hpc {
+
+// Minimal HTTP/1.1 file server on 127.0.0.1 for the network benchmarks:
+// GET with byte ranges and keep-alive, nothing else. Bandwidth and
+// per-request latency can be throttled to look like a real network, and
+// what was served is counted on the server side.
+class LocalHttpServer {
+ public:
+  struct Stats {
+    int64_t connections {0};
+    int64_t requests {0};
+    int64_t bytesServed {0};  // response bodies
+  };
+
+  LocalHttpServer() = default;
+  ~LocalHttpServer();
+
+  LocalHttpServer(const LocalHttpServer &) = delete;
+  LocalHttpServer &operator=(const LocalHttpServer &) = delete;
+
+  // Serves the files under |root| at |bps|, 0 for unthrottled, answering
+  // every request |latencyUs| late.
+  status_t start(const std::string &root, int64_t bps = 0, int64_t latencyUs = 0);
+  void stop();
+
+  // Throttles to |bps| from now on, responses in progress included.
+  void setBandwidth(int64_t bps) { mBps = bps; }
+
+  // The url of |path|, relative to the root.
+  std::string url(const std::string &path) const;
+
+  Stats getStats() const;
+  void resetStats();
+
+ private:
+  std::string mRoot;
+  std::atomic<int64_t> mBps {0};
+  int64_t mLatencyUs {0};
+  int mListenSocket {-1};
+  int mPort {0};
+  std::atomic<bool> mStopped {false};
+  std::thread mAcceptThread;
+
+  mutable std::mutex mLock;
+  std::vector<int> mClients;
+  std::vector<std::thread> mClientThreads;
+  Stats mStats;
+
+  void acceptLoop();
+  void serve(int fd);
+  bool sendBody(int fd, int file, int64_t offset, int64_t length);
+};
+
+} // hpc
@@ -0,0 +1,88 @@
+#include "BenchMode.h"
+#include "BenchPlayer.h"
+#include "HpcPlayer.h"
+#include "JsonWriter.h"
+#include "Log.h"
+
+#define LOG_TAG "LoopBench"
+
+namespace hpc {
+
+// Loops a range, the whole stream by default, through HpcPlayer and checks
+// every splice with the detectors of the null sinks: audio must not run dry,
+// video must neither freeze nor go backwards. With --seek it loops the old
+// way, seeking and flushing at the end of each pass, for comparison.
+static status_t runLoop(const BenchOptions &options, JsonWriter *json) {
+  const bool seekLoop = options.has("seek");
+  const int64_t loops = options.getInt("loops", 3);
+  const int64_t startUs = options.getInt("start-ms", 0) * 1000;
+  const int64_t endUs = options.has("end-ms") ? options.getInt("end-ms", 0) * 1000 : -1;
+
+  BenchPlayer player(BenchPlayer::Config{});
+  status_t err = player.open(options.url);
+  if (err != OK) {
+    return err;
+  }
+  const int64_t passUs = (endUs >= 0 ? endUs : player.getDurationUs()) - startUs;
+  if (passUs <= 0) {
+    ALOGE("empty loop range, stream is %lld us", (long long)player.getDurationUs());
+    return ERROR_UNSUPPORTED;
+  }
+  if (startUs > 0) {
+    err = player.seekTo(startUs, nullptr);
+    if (err != OK) {
+      return err;
+    }
+  }
+
+  Samples stallUs;
+  int64_t passes = 0;
+  if (seekLoop) {
+    for (; passes < loops && err == OK; ++passes) {
+      err = player.play(endUs >= 0 ? passUs : -1);
+      int64_t latencyUs = 0;
+      if (err == OK) {
+        err = player.seekTo(startUs, &latencyUs);
+        stallUs.add(latencyUs);
+      }
+    }
+  } else {
+    err = player.player()->setLoopRange(startUs, endUs);
+    if (err == OK) {
+      err = player.play(passUs * (loops + 1));
+    }
+    // Spliced passes keep the timestamps going up, see LoopSplicer.
+    const int64_t lastPtsUs = player.videoSink().lastPtsUs();
+    passes = lastPtsUs > startUs ? (lastPtsUs - startUs) / passUs : 0;
+  }
+  if (err != OK) {
+    return err;
+  }
+
+  const PlaybackStats::Snapshot stats = player.stats();
+  json->write("seamless", !seekLoop);
+  json->write("pass_ms", passUs / 1000);
+  json->write("loops", passes);
+  json->write("wall_ms", player.wallUs() / 1000);
+
+  json->beginObject("video");
+  json->write("rendered", player.videoSink().rendered());
+  json->write("dropped", stats.framesDroppedLate);
+  json->write("max_frame_interval_us", player.videoSink().maxIntervalUs());
+  json->write("backwards", player.videoSink().backwards());
+  json->endObject();
+
+  if (player.audioSink() != nullptr) {
+    json->beginObject("audio");
+    json->write("underruns", player.audioSink()->underruns());
+    json->endObject();
+  }
+  if (seekLoop) {
+    stallUs.writeJson(json, "splice_stall_us");
+  }
+  return OK;
+}
+
+HPCBENCH_MODE("loop", "[--seek] [--loops=N] [--start-ms=N] [--end-ms=N]", runLoop);
+
+} // hpc
@@ -0,0 +1,141 @@
+#include "BenchMode.h"
+#include "CachedSource.h"
+#include "FFmpegExtractor.h"
+#include "FileSource.h"
+#include "JsonWriter.h"
+#include "Log.h"
+#include "Looper.h"
+#include "MediaPacket.h"
+#include "MmapSource.h"
+
+#include <sys/resource.h>
+#include <vector>
+
+#define LOG_TAG "MmapBench"
+
+namespace hpc {
+
+struct Usage {
+  int64_t cpuUs {0};
+  int64_t minorFaults {0};
+  int64_t majorFaults {0};
+};
+
+static Usage getUsage() {
+  Usage usage;
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) == 0) {
+    usage.cpuUs = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL
+        + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+    usage.minorFaults = ru.ru_minflt;
+    usage.majorFaults = ru.ru_majflt;
+  }
+  return usage;
+}
+
+// Demuxes --seconds of media as fast as it goes through |source|, or
+// libavformat's own file protocol without one, and reports the CPU it took
+// per second of media.
+static status_t demux(const BenchOptions &options, const std::shared_ptr<DataSource> &source,
+                      JsonWriter *json, int64_t *bytesRead) {
+  const int64_t playUs = options.getInt("seconds", 30) * 1000000;
+  const Usage before = getUsage();
+  const int64_t startUs = Looper::GetNowUs();
+
+  FFmpegExtractor extractor;
+  if (source != nullptr) {
+    extractor.setDataSource(source);
+  }
+  status_t err = extractor.init(options.url.c_str());
+  if (err != OK) {
+    ALOGE("cannot open %s: %d", options.url.c_str(), err);
+    return err;
+  }
+  std::unique_ptr<MediaPacket> packet;
+  int64_t packets = 0;
+  int64_t bytes = 0;
+  int64_t firstUs = -1;
+  int64_t lastUs = 0;
+  while (lastUs - firstUs < playUs && extractor.read(packet, -1 /* any selected track */) == OK) {
+    ++packets;
+    bytes += packet->size();
+    if (packet->dtsUs >= 0) {
+      firstUs = firstUs < 0 ? packet->dtsUs : std::min(firstUs, packet->dtsUs);
+      lastUs = std::max(lastUs, packet->dtsUs);
+    }
+  }
+  *bytesRead = extractor.getBytesRead();
+  extractor.release();
+
+  const Usage after = getUsage();
+  const int64_t mediaUs = firstUs >= 0 ? lastUs - firstUs : 0;
+  const int64_t cpuUs = after.cpuUs - before.cpuUs;
+  json->write("media_ms", mediaUs / 1000);
+  json->write("wall_ms", (Looper::GetNowUs() - startUs) / 1000);
+  json->write("cpu_ms", cpuUs / 1000);
+  json->write("cpu_ms_per_media_s", mediaUs > 0 ? cpuUs * 1000.0 / mediaUs : 0.0);
+  json->write("packets", packets);
+  json->write("payload_bytes", bytes);
+  json->write("minor_faults", after.minorFaults - before.minorFaults);
+  json->write("major_faults", after.majorFaults - before.majorFaults);
+  return OK;
+}
+
+// The same local file demuxed three ways: libavformat's file protocol,
+// FileSource behind a CachedSource, and MmapSource. bytes_copied is what
+// the I/O layer copied before the demuxer had the bytes: one copy out of
+// the kernel per byte read for the protocol, the pread into the ring and
+// the copy out of it for the cache, the copy out of the mapping for mmap.
+// Copies inside libavformat, from its AVIO buffer into packets, are not
+// counted; the mapped source's small buffer leaves next to none. The page
+// cache is warmed first so that storage does not decide the result.
+static status_t runMmap(const BenchOptions &options, JsonWriter *json) {
+  std::shared_ptr<FileSource> file = FileSource::Create(options.url.c_str());
+  if (file == nullptr || file->initCheck() != OK) {
+    ALOGE("%s is not a local file", options.url.c_str());
+    return ERROR_UNSUPPORTED;
+  }
+  std::vector<uint8_t> buffer(1024 * 1024);
+  int64_t offset = 0;
+  for (ssize_t n; (n = file->readAt(offset, buffer.data(), buffer.size())) > 0; offset += n) {
+  }
+  json->write("file_bytes", offset);
+
+  int64_t bytesRead = 0;
+  json->beginObject("protocol");
+  status_t err = demux(options, nullptr, json, &bytesRead);
+  json->write("bytes_copied", bytesRead);
+  json->endObject();
+  if (err != OK) {
+    return err;
+  }
+
+  std::shared_ptr<CachedSource> cache = std::make_shared<CachedSource>(file);
+  json->beginObject("cached");
+  err = demux(options, cache, json, &bytesRead);
+  const CachedSource::Stats cacheStats = cache->getStats();
+  json->write("bytes_copied", cacheStats.bytesFetched + cacheStats.bytesRead);
+  json->endObject();
+  cache.reset();
+  if (err != OK) {
+    return err;
+  }
+
+  std::shared_ptr<MmapSource> mapped = MmapSource::Create(options.url.c_str());
+  if (mapped->initCheck() != OK) {
+    ALOGE("cannot map %s", options.url.c_str());
+    return NO_INIT;
+  }
+  json->beginObject("mmap");
+  err = demux(options, mapped, json, &bytesRead);
+  const MmapSource::Stats mapStats = mapped->getStats();
+  json->write("bytes_copied", mapStats.bytesCopied);
+  json->write("reads", mapStats.reads);
+  json->write("read_aheads", mapStats.readAheads);
+  json->endObject();
+  return err;
+}
+
+HPCBENCH_MODE("mmap", "[--seconds=N]", runMmap);
+
+} // hpc
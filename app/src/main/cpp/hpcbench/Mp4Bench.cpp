@@ -0,0 +1,157 @@
+#include "BenchMode.h"
+#include "FFmpegExtractor.h"
+#include "JsonWriter.h"
+#include "Log.h"
+#include "Looper.h"
+#include "MediaPacket.h"
+#include "MmapSource.h"
+#include "Mp4Extractor.h"
+
+#include <map>
+
+#define LOG_TAG "Mp4Bench"
+
+namespace hpc {
+
+// Opens --url through a mapping, as DefaultSource does a local file.
+template <typename T>
+static status_t open(const std::string &url, T *extractor, int64_t *openUs) {
+  const int64_t startUs = Looper::GetNowUs();
+  std::shared_ptr<MmapSource> source = MmapSource::Create(url.c_str());
+  if (source == nullptr || source->initCheck() != OK) {
+    return ERROR_IO;
+  }
+  extractor->setDataSource(source);
+  extractor->setRequiresVideo(false);
+  status_t err = extractor->init(url.c_str());
+  *openUs = Looper::GetNowUs() - startUs;
+  return err;
+}
+
+// Seeks to each of |positionsUs| and reads the first packet of the lead
+// track; the time that takes and where it lands.
+static void seekAll(Extractor *extractor, const std::vector<int64_t> &positionsUs,
+                    Samples *seekUs, std::vector<int64_t> *landedUs) {
+  const int track = extractor->getVideoStreamIndex() >= 0
+      ? extractor->getVideoStreamIndex() : extractor->getAudioStreamIndex();
+  std::unique_ptr<MediaPacket> packet;
+  for (int64_t positionUs : positionsUs) {
+    const int64_t startUs = Looper::GetNowUs();
+    status_t err = extractor->seek(positionUs, SEEK_PREVIOUS_SYNC);
+    if (err == OK) {
+      err = extractor->read(packet, track);
+    }
+    seekUs->add(Looper::GetNowUs() - startUs);
+    landedUs->push_back(err == OK ? packet->ptsUs : -1);
+  }
+}
+
+// Packets and payload bytes per track, to the end.
+static void demuxAll(Extractor *extractor, std::map<int, std::pair<int64_t, int64_t>> *tracks) {
+  extractor->seek(0, SEEK_PREVIOUS_SYNC);
+  std::unique_ptr<MediaPacket> packet;
+  while (extractor->read(packet, -1) == OK) {
+    std::pair<int64_t, int64_t> &track = (*tracks)[packet->trackIndex];
+    ++track.first;
+    track.second += packet->size();
+  }
+}
+
+// Open and seek time of the native MP4 extractor against FFmpeg's on the
+// same mapped file, --iterations opens each and --seeks seeks spread over
+// the duration. The seeks land on the same sync sample with both, or
+// "seek_mismatches" counts them. --verify also demuxes the whole file with
+// both and compares packets and bytes per track.
+static status_t runMp4(const BenchOptions &options, JsonWriter *json) {
+  const int iterations = (int)options.getInt("iterations", 10);
+  const int seeks = (int)options.getInt("seeks", 50);
+
+  Samples nativeOpenUs;
+  Samples ffmpegOpenUs;
+  for (int i = 0; i < iterations; ++i) {
+    Mp4Extractor native;
+    FFmpegExtractor ffmpeg;
+    int64_t nativeUs;
+    int64_t ffmpegUs;
+    status_t err = open(options.url, &native, &nativeUs);
+    if (err != OK) {
+      ALOGE("%s is not demuxed natively: %d", options.url.c_str(), err);
+      return err;
+    }
+    err = open(options.url, &ffmpeg, &ffmpegUs);
+    if (err != OK) {
+      ALOGE("cannot open %s: %d", options.url.c_str(), err);
+      return err;
+    }
+    nativeOpenUs.add(nativeUs);
+    ffmpegOpenUs.add(ffmpegUs);
+  }
+
+  Mp4Extractor native;
+  FFmpegExtractor ffmpeg;
+  int64_t discardUs;
+  if (open(options.url, &native, &discardUs) != OK
+      || open(options.url, &ffmpeg, &discardUs) != OK) {
+    return ERROR_UNSUPPORTED;
+  }
+  // the same pseudo-random positions every run
+  const int64_t durationUs = native.getDurationUs();
+  std::vector<int64_t> positionsUs;
+  uint32_t seed = 1;
+  for (int i = 0; i < seeks && durationUs > 0; ++i) {
+    seed = seed * 1103515245 + 12345;
+    positionsUs.push_back((int64_t)(seed >> 8) % durationUs);
+  }
+  Samples nativeSeekUs;
+  Samples ffmpegSeekUs;
+  std::vector<int64_t> nativeLandedUs;
+  std::vector<int64_t> ffmpegLandedUs;
+  seekAll(&native, positionsUs, &nativeSeekUs, &nativeLandedUs);
+  seekAll(&ffmpeg, positionsUs, &ffmpegSeekUs, &ffmpegLandedUs);
+  int64_t mismatches = 0;
+  for (size_t i = 0; i < positionsUs.size(); ++i) {
+    if (nativeLandedUs[i] != ffmpegLandedUs[i]) {
+      ALOGW("seek to %lld us: native %lld us, ffmpeg %lld us", (long long)positionsUs[i],
+            (long long)nativeLandedUs[i], (long long)ffmpegLandedUs[i]);
+      ++mismatches;
+    }
+  }
+
+  json->write("tracks", (int64_t)native.getTrackCount());
+  json->write("duration_ms", durationUs / 1000);
+  nativeOpenUs.writeJson(json, "native_open_us");
+  ffmpegOpenUs.writeJson(json, "ffmpeg_open_us");
+  nativeSeekUs.writeJson(json, "native_seek_us");
+  ffmpegSeekUs.writeJson(json, "ffmpeg_seek_us");
+  json->write("seek_mismatches", mismatches);
+
+  const Mp4Extractor::Stats stats = native.getStats();
+  json->write("native_reads", stats.reads);
+  json->write("native_bytes_read", stats.bytesRead);
+  json->write("native_samples_referenced", stats.samplesReferenced);
+  json->write("native_samples_read", stats.samplesRead);
+
+  if (options.has("verify")) {
+    std::map<int, std::pair<int64_t, int64_t>> nativeTracks;
+    std::map<int, std::pair<int64_t, int64_t>> ffmpegTracks;
+    demuxAll(&native, &nativeTracks);
+    demuxAll(&ffmpeg, &ffmpegTracks);
+    json->beginArray("verify");
+    for (const auto &track : nativeTracks) {
+      const std::pair<int64_t, int64_t> &other = ffmpegTracks[track.first];
+      json->beginObject();
+      json->write("track", (int64_t)track.first);
+      json->write("native_packets", track.second.first);
+      json->write("ffmpeg_packets", other.first);
+      json->write("native_bytes", track.second.second);
+      json->write("ffmpeg_bytes", other.second);
+      json->endObject();
+    }
+    json->endArray();
+  }
+  return OK;
+}
+
+HPCBENCH_MODE("mp4", "[--iterations=N] [--seeks=N] [--verify]", runMp4);
+
+} // hpc
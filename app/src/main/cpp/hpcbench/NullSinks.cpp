@@ -0,0 +1,155 @@
+#include "NullSinks.h"
+#include "Looper.h"
+
+#include <algorithm>
+
+extern "C" {
+#include "libavutil/frame.h"
+}
+
+namespace hpc {
+
+status_t NullAudioSink::Open(int sampleRate, int channels, int /* format */) {
+  if (sampleRate <= 0 || channels <= 0) {
+    return BAD_VALUE;
+  }
+  std::lock_guard<std::mutex> lock(mLock);
+  mSampleRate = sampleRate;
+  mChannelCount = channels;
+  mPaused = false;
+  mWrittenUs = 0;
+  mPlayedBaseUs = 0;
+  mAnchorRealUs = -1;
+  return OK;
+}
+
+int64_t NullAudioSink::playedUs_l() const {
+  if (!mRealTime) {
+    return mWrittenUs;
+  }
+  int64_t playedUs = mPlayedBaseUs;
+  if (mAnchorRealUs >= 0) {
+    playedUs += Looper::GetNowUs() - mAnchorRealUs;
+  }
+  return std::min(playedUs, mWrittenUs);
+}
+
+status_t NullAudioSink::Write(const void * /* data */, size_t size) {
+  std::lock_guard<std::mutex> lock(mLock);
+  if (mSampleRate <= 0) {
+    return NO_INIT;
+  }
+  const int64_t playedUs = playedUs_l();
+  if (mWrittenUs - playedUs >= kMaxQueuedUs) {
+    return WOULD_BLOCK;
+  }
+  if (mRealTime && !mPaused) {
+    if (mAnchorRealUs < 0) {
+      mAnchorRealUs = Looper::GetNowUs();
+    } else if (playedUs >= mWrittenUs) {
+      // Ran dry: playback resumes with this buffer, the gap is an underrun.
+      ++mUnderruns;
+      mPlayedBaseUs = mWrittenUs;
+      mAnchorRealUs = Looper::GetNowUs();
+    }
+  }
+  const int64_t frames = size / (2 * mChannelCount);
+  mWrittenUs += frames * 1000000LL / mSampleRate;
+  mFramesWritten += frames;
+  return OK;
+}
+
+status_t NullAudioSink::Pause() {
+  std::lock_guard<std::mutex> lock(mLock);
+  mPlayedBaseUs = playedUs_l();
+  mAnchorRealUs = -1;
+  mPaused = true;
+  return OK;
+}
+
+status_t NullAudioSink::Resume() {
+  std::lock_guard<std::mutex> lock(mLock);
+  if (mPaused && mWrittenUs > 0) {
+    mAnchorRealUs = Looper::GetNowUs();
+  }
+  mPaused = false;
+  return OK;
+}
+
+status_t NullAudioSink::Flush() {
+  std::lock_guard<std::mutex> lock(mLock);
+  mWrittenUs = 0;
+  mPlayedBaseUs = 0;
+  mAnchorRealUs = -1;
+  return OK;
+}
+
+status_t NullAudioSink::Close() {
+  std::lock_guard<std::mutex> lock(mLock);
+  mSampleRate = 0;
+  mChannelCount = 0;
+  mWrittenUs = 0;
+  mPlayedBaseUs = 0;
+  mAnchorRealUs = -1;
+  return OK;
+}
+
+int64_t NullAudioSink::GetPlayedTimeUs() const {
+  std::lock_guard<std::mutex> lock(mLock);
+  return playedUs_l();
+}
+
+int64_t NullAudioSink::underruns() const {
+  std::lock_guard<std::mutex> lock(mLock);
+  return mUnderruns;
+}
+
+int64_t NullAudioSink::framesWritten() const {
+  std::lock_guard<std::mutex> lock(mLock);
+  return mFramesWritten;
+}
+
+NullVideoSink::NullVideoSink() : Surface(nullptr) {
+}
+
+status_t NullVideoSink::render(const AVFrame *frame) {
+  const int64_t ptsUs = frame->best_effort_timestamp != AV_NOPTS_VALUE
+      ? frame->best_effort_timestamp : frame->pts;
+  std::lock_guard<std::mutex> lock(mLock);
+  ++mRendered;
+  if (mLastPtsUs >= 0) {
+    if (ptsUs <= mLastPtsUs) {
+      ++mBackwards;
+    }
+    mMaxIntervalUs = std::max(mMaxIntervalUs, ptsUs - mLastPtsUs);
+  }
+  mLastPtsUs = ptsUs;
+  return OK;
+}
+
+int64_t NullVideoSink::rendered() const {
+  std::lock_guard<std::mutex> lock(mLock);
+  return mRendered;
+}
+
+int64_t NullVideoSink::maxIntervalUs() const {
+  std::lock_guard<std::mutex> lock(mLock);
+  return mMaxIntervalUs;
+}
+
+int64_t NullVideoSink::backwards() const {
+  std::lock_guard<std::mutex> lock(mLock);
+  return mBackwards;
+}
+
+int64_t NullVideoSink::lastPtsUs() const {
+  std::lock_guard<std::mutex> lock(mLock);
+  return mLastPtsUs;
+}
+
+void NullVideoSink::flush() {
+  std::lock_guard<std::mutex> lock(mLock);
+  mLastPtsUs = -1;
+}
+
+} // hpc
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+
+#include "AudioSink.h"
+#include "Surface.h"
+
+namespace hpc {
+
+// Stands in for OpenSLAudioSink: written PCM plays out at real-time speed,
+// what the renderer anchors MediaClock on. Like the hardware it holds
+// kMaxQueuedUs at most. A write after everything played out is an underrun,
+// an audible gap. Called on the renderer looper, read from the bench.
+//
+// Unless |realTime|: then a write plays out right away and never blocks,
+// for a free running player.
+class NullAudioSink : public AudioSink {
+ public:
+  explicit NullAudioSink(bool realTime = true) : mRealTime(realTime) {}
+
+  status_t Open(int sampleRate, int channels, int format) override;
+  status_t Write(const void *data, size_t size) override;
+  status_t Pause() override;
+  status_t Resume() override;
+  status_t Flush() override;
+  status_t Close() override;
+  int64_t GetPlayedTimeUs() const override;
+
+  int64_t underruns() const;
+  int64_t framesWritten() const;
+
+ private:
+  static const int64_t kMaxQueuedUs = 200000;
+
+  const bool mRealTime;
+  mutable std::mutex mLock;
+  int32_t mSampleRate {0};
+  int32_t mChannelCount {0};
+  bool mPaused {false};
+  int64_t mWrittenUs {0};      // since Open() or Flush()
+  int64_t mPlayedBaseUs {0};   // played before mAnchorRealUs
+  int64_t mAnchorRealUs {-1};  // -1 while paused or before the first write
+  int64_t mUnderruns {0};
+  int64_t mFramesWritten {0};
+
+  int64_t playedUs_l() const;
+};
+
+// Stands in for the window. Counts what the renderer puts on screen and the
+// interval between consecutive frames, to spot freezes and frames going
+// backwards. Timestamps are those of the frames, in microseconds as the
+// player's decoders set them.
+class NullVideoSink : public Surface {
+ public:
+  NullVideoSink();
+
+  status_t render(const AVFrame *frame) override;
+
+  int64_t rendered() const;
+  int64_t maxIntervalUs() const;
+  int64_t backwards() const;
+  // -1 before the first frame.
+  int64_t lastPtsUs() const;
+
+  // After a seek the next frame starts a new sequence.
+  void flush();
+
+ private:
+  mutable std::mutex mLock;
+  int64_t mRendered {0};
+  int64_t mLastPtsUs {-1};
+  int64_t mMaxIntervalUs {0};
+  int64_t mBackwards {0};
+};
+
+} // hpc
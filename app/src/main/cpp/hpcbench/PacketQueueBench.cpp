@@ -0,0 +1,183 @@
+#include "BenchMode.h"
+#include "FFmpegExtractor.h"
+#include "JsonWriter.h"
+#include "Log.h"
+#include "Looper.h"
+#include "MediaPacket.h"
+#include "PacketQueue.h"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#define LOG_TAG "PacketQueueBench"
+
+namespace hpc {
+
+// The queue as it was before the ring, one lock around a deque, to compare
+// against.
+class LockedPacketQueue {
+ public:
+  status_t queuePacket(std::unique_ptr<MediaPacket> packet) {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    mBytes += packet->size();
+    mPackets.push_back(std::move(packet));
+    return OK;
+  }
+
+  status_t dequeuePacket(std::unique_ptr<MediaPacket> *packet) {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    if (mPackets.empty()) {
+      return WOULD_BLOCK;
+    }
+    *packet = std::move(mPackets.front());
+    mPackets.pop_front();
+    mBytes -= (*packet)->size();
+    return OK;
+  }
+
+  int64_t getBufferedDurationUs(status_t *finalResult) const {
+    std::lock_guard<std::mutex> autoLock(mLock);
+    *finalResult = OK;
+    if (mPackets.empty()) {
+      return 0;
+    }
+    return mPackets.back()->dtsUs - mPackets.front()->dtsUs + mPackets.back()->durationUs;
+  }
+
+ private:
+  mutable std::mutex mLock;
+  std::deque<std::unique_ptr<MediaPacket>> mPackets;
+  size_t mBytes {0};
+};
+
+// Moves |transfers| packets from a producer thread to a consumer thread
+// through |forward|; the consumer hands them back through |back|, so a small
+// pool of real packets cycles without allocating. A third thread polls the
+// buffered duration the whole time, as the buffering logic and the stats do.
+template <typename Queue>
+static void runQueue(const char *name, std::vector<std::unique_ptr<MediaPacket>> *pool,
+                     int64_t transfers, Queue *forward, Queue *back, JsonWriter *json) {
+  for (std::unique_ptr<MediaPacket> &packet : *pool) {
+    back->queuePacket(std::move(packet));
+  }
+
+  std::atomic<bool> done {false};
+  int64_t producerWaits = 0;
+  int64_t consumerWaits = 0;
+  int64_t outOfOrder = 0;
+  int64_t polls = 0;
+  int64_t maxBufferedUs = 0;
+  int64_t pollUs = 0;
+
+  const int64_t startUs = Looper::GetNowUs();
+  std::thread producer([&] {
+    std::unique_ptr<MediaPacket> packet;
+    for (int64_t i = 0; i < transfers; ) {
+      if (back->dequeuePacket(&packet) != OK) {
+        ++producerWaits;
+        std::this_thread::yield();
+        continue;
+      }
+      packet->dtsUs = i;
+      if (forward->queuePacket(std::move(packet)) == OK) {
+        ++i;
+      }
+    }
+  });
+  std::thread poller([&] {
+    const int64_t beforeUs = Looper::GetNowUs();
+    while (!done.load(std::memory_order_relaxed)) {
+      status_t finalResult;
+      maxBufferedUs = std::max(maxBufferedUs, forward->getBufferedDurationUs(&finalResult));
+      ++polls;
+    }
+    pollUs = Looper::GetNowUs() - beforeUs;
+  });
+
+  std::unique_ptr<MediaPacket> packet;
+  for (int64_t i = 0; i < transfers; ) {
+    if (forward->dequeuePacket(&packet) != OK) {
+      ++consumerWaits;
+      std::this_thread::yield();
+      continue;
+    }
+    if (packet->dtsUs != i) {
+      ++outOfOrder;
+    }
+    ++i;
+    back->queuePacket(std::move(packet));
+  }
+  const int64_t wallUs = Looper::GetNowUs() - startUs;
+  producer.join();
+  done.store(true);
+  poller.join();
+
+  status_t finalResult;
+  const int64_t leftUs = forward->getBufferedDurationUs(&finalResult);
+  pool->clear();
+  while (back->dequeuePacket(&packet) == OK) {
+    pool->push_back(std::move(packet));
+  }
+
+  json->beginObject(name);
+  json->write("wall_ms", wallUs / 1000);
+  json->write("packets_per_sec", wallUs > 0 ? transfers * 1e6 / wallUs : 0.0);
+  json->write("ns_per_packet", transfers > 0 ? wallUs * 1e3 / transfers : 0.0);
+  json->write("producer_waits", producerWaits);
+  json->write("consumer_waits", consumerWaits);
+  json->write("out_of_order", outOfOrder);
+  json->write("polls", polls);
+  json->write("ns_per_poll", polls > 0 ? pollUs * 1e3 / polls : 0.0);
+  json->write("max_buffered_us", maxBufferedUs);
+  json->write("left_buffered_us", leftUs);
+  json->endObject();
+}
+
+// Throughput of the demuxer to decoder queue, the lock-free ring against the
+// locked deque it replaced, with real packets of the stream as payload.
+static status_t runPacketQueue(const BenchOptions &options, JsonWriter *json) {
+  const int64_t transfers = options.getInt("transfers", 2000000);
+  const size_t poolSize = (size_t)options.getInt("pool", 256);
+
+  FFmpegExtractor extractor;
+  status_t err = extractor.init(options.url.c_str());
+  if (err != OK) {
+    ALOGE("cannot open %s: %d", options.url.c_str(), err);
+    return err;
+  }
+  std::vector<std::unique_ptr<MediaPacket>> pool;
+  int64_t poolBytes = 0;
+  while (pool.size() < poolSize) {
+    std::unique_ptr<MediaPacket> packet;
+    if (extractor.read(packet, -1 /* any selected track */) != OK) {
+      break;
+    }
+    poolBytes += packet->size();
+    pool.push_back(std::move(packet));
+  }
+  extractor.release();
+  if (pool.empty()) {
+    return ERROR_END_OF_STREAM;
+  }
+
+  json->write("transfers", transfers);
+  json->write("pool", (int64_t)pool.size());
+  json->write("pool_bytes", poolBytes);
+
+  // Room for the whole pool, neither side ever finds its queue full.
+  const size_t capacity = pool.size() + PacketQueue::kDefaultCapacity;
+  PacketQueue forward(capacity);
+  PacketQueue back(capacity);
+  runQueue("ring", &pool, transfers, &forward, &back, json);
+
+  LockedPacketQueue lockedForward;
+  LockedPacketQueue lockedBack;
+  runQueue("locked", &pool, transfers, &lockedForward, &lockedBack, json);
+  return OK;
+}
+
+HPCBENCH_MODE("packetqueue", "[--transfers=N] [--pool=N]", runPacketQueue);
+
+} // hpc
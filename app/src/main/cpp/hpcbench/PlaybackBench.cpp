@@ -0,0 +1,131 @@
+#include "BenchMode.h"
+#include "BenchPlayer.h"
+#include "HpcPlayer.h"
+#include "JsonWriter.h"
+#include "Looper.h"
+#include "Log.h"
+
+#define LOG_TAG "PlaybackBench"
+
+namespace hpc {
+
+static void writeStartup(const StartupTimeline &timeline, JsonWriter *json) {
+  json->beginObject("startup_us");
+  for (int i = 0; i < StartupTimeline::kNumEvents; ++i) {
+    StartupTimeline::Event event = (StartupTimeline::Event)i;
+    json->write(StartupTimeline::EventName(event), timeline.getUs(event));
+  }
+  json->endObject();
+}
+
+static void writePercentiles(const char *key, const PlaybackStats::Percentiles &percentiles,
+                             JsonWriter *json) {
+  json->beginObject(key);
+  json->write("p50", percentiles.p50);
+  json->write("p90", percentiles.p90);
+  json->write("p99", percentiles.p99);
+  json->endObject();
+}
+
+// What HpcPlayer::getStats() reports, and what taking it costs.
+static void writeStats(const BenchPlayer &player, JsonWriter *json) {
+  const int kPolls = 1000;
+  int64_t startUs = Looper::GetNowUs();
+  PlaybackStats::Snapshot snapshot;
+  for (int i = 0; i < kPolls; ++i) {
+    snapshot = player.stats();
+  }
+  int64_t pollNs = (Looper::GetNowUs() - startUs) * 1000 / kPolls;
+
+  json->beginObject("stats");
+  json->write("snapshot_ns", pollNs);
+  json->write("frames_decoded", snapshot.framesDecoded);
+  json->write("frames_rendered", snapshot.framesRendered);
+  json->write("frames_dropped_late", snapshot.framesDroppedLate);
+  json->write("frames_skipped_by_decoder", snapshot.framesSkippedByDecoder);
+  writePercentiles("decode_us", snapshot.decodeUs, json);
+  writePercentiles("av_sync_us", snapshot.avSyncUs, json);
+  json->write("video_bitrate", snapshot.videoBitrate);
+  json->write("audio_bitrate", snapshot.audioBitrate);
+  json->write("payload_bytes_copied", snapshot.payloadBytesCopied);
+  json->endObject();
+}
+
+// Plays the stream through HpcPlayer into the null sinks and then seeks
+// around in it. With --free-run the player presents as fast as it decodes,
+// which measures decode throughput; seek latency is left to real time.
+static status_t runPlayback(const BenchOptions &options, JsonWriter *json) {
+  BenchPlayer::Config config;
+  config.audio = !options.has("no-audio");
+  config.freeRunning = options.has("free-run");
+  const int64_t durationUs = options.getInt("duration-ms", 10000) * 1000;
+  const int64_t seeks = config.freeRunning ? 0 : options.getInt("seeks", 5);
+
+  BenchPlayer player(config);
+  status_t err = player.open(options.url);
+  if (err != OK) {
+    return err;
+  }
+  err = player.play(durationUs < 0 ? -1 : durationUs);
+  if (err != OK) {
+    return err;
+  }
+
+  std::string mime;
+  std::vector<Extractor::TrackInfo> tracks;
+  const ssize_t videoTrack = player.player()->getSelectedTrack(MEDIA_TRACK_TYPE_VIDEO);
+  if (player.player()->getTrackInfo(&tracks) == OK
+      && videoTrack >= 0 && (size_t)videoTrack < tracks.size()) {
+    mime = tracks[videoTrack].mime_type;
+  }
+  const PlaybackStats::Snapshot snapshot = player.stats();
+  const int64_t decoded = snapshot.framesDecoded;
+  json->write("codec", mime);
+  json->write("width", player.width());
+  json->write("height", player.height());
+  json->write("wall_ms", player.wallUs() / 1000);
+
+  json->beginObject("video");
+  json->write("decoded", decoded);
+  json->write("rendered", player.videoSink().rendered());
+  json->write("dropped", snapshot.framesDroppedLate);
+  const double throughputFps = player.wallUs() > 0 ? decoded * 1e6 / player.wallUs() : 0.0;
+  json->write("throughput_fps", throughputFps);
+  if (config.freeRunning) {
+    // Nothing waited for the clock, what the pipeline decoded per second
+    // is what it can sustain.
+    json->write("decode_fps", throughputFps);
+  }
+  json->endObject();
+
+  if (player.audioSink() != nullptr) {
+    json->beginObject("audio");
+    json->write("frames", player.audioSink()->framesWritten());
+    json->write("underruns", player.audioSink()->underruns());
+    json->endObject();
+  }
+
+  writeStartup(*player.startupTimeline(), json);
+
+  // Seeks spread evenly over the stream, each to a non-sync position.
+  Samples seekLatency;
+  const int64_t streamUs = player.getDurationUs();
+  for (int64_t i = 0; i < seeks && streamUs > 0; ++i) {
+    int64_t targetUs = streamUs * (2 * i + 1) / (2 * seeks);
+    int64_t latencyUs = 0;
+    err = player.seekTo(targetUs, &latencyUs);
+    if (err != OK) {
+      ALOGW("seek to %lld us failed: %d", (long long)targetUs, err);
+      continue;
+    }
+    seekLatency.add(latencyUs);
+  }
+  seekLatency.writeJson(json, "seek_latency_us");
+  writeStats(player, json);
+  return OK;
+}
+
+HPCBENCH_MODE("playback", "[--no-audio] [--free-run] [--duration-ms=N] [--seeks=N]",
+              runPlayback);
+
+} // hpc
@@ -0,0 +1,112 @@
+#include "BenchMode.h"
+#include "FFmpegExtractor.h"
+#include "JsonWriter.h"
+#include "Log.h"
+#include "Looper.h"
+#include "MmapSource.h"
+#include "ProbeCache.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOG_TAG "ProbeBench"
+
+namespace hpc {
+
+// The regular files in |path| if it is a directory, |path| otherwise.
+static std::vector<std::string> listCorpus(const std::string &path) {
+  std::vector<std::string> files;
+  DIR *dir = opendir(path.c_str());
+  if (dir == nullptr) {
+    files.push_back(path);
+    return files;
+  }
+  while (struct dirent *entry = readdir(dir)) {
+    const std::string file = path + "/" + entry->d_name;
+    struct stat st;
+    if (entry->d_name[0] != '.' && stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      files.push_back(file);
+    }
+  }
+  closedir(dir);
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+// Opens |path| the way DefaultSource does, through a mapping, and probes
+// it or takes the stream info from |cache|; the time to a usable extractor.
+static status_t prepare(const std::string &path, const std::shared_ptr<ProbeCache> &cache,
+                        int64_t *prepareUs) {
+  const int64_t startUs = Looper::GetNowUs();
+  FFmpegExtractor extractor;
+  std::shared_ptr<MmapSource> source = MmapSource::Create(path.c_str());
+  if (source != nullptr && source->initCheck() == OK) {
+    extractor.setDataSource(source);
+  }
+  extractor.setRequiresVideo(false);
+  extractor.setProbeCache(cache);
+  status_t err = extractor.init(path.c_str());
+  *prepareUs = Looper::GetNowUs() - startUs;
+  return err;
+}
+
+// Prepare time of every file of a corpus, --url a directory or one file,
+// cold with an empty probe cache and then warm. The page cache is warmed
+// by an uncounted prepare first, so only probing makes the difference.
+// Containers whose header describes the streams fully, MP4 and Matroska,
+// skip probing either way and show about none.
+static status_t runProbe(const BenchOptions &options, JsonWriter *json) {
+  const std::vector<std::string> files = listCorpus(options.url);
+  char dirTemplate[] = "/tmp/hpcbench-probe-XXXXXX";
+  if (mkdtemp(dirTemplate) == nullptr) {
+    ALOGE("cannot create a cache directory");
+    return ERROR_IO;
+  }
+  const std::string directory = dirTemplate;
+  std::shared_ptr<ProbeCache> cache = std::make_shared<ProbeCache>(directory);
+
+  Samples coldUs;
+  Samples warmUs;
+  int64_t failed = 0;
+  json->beginArray("files");
+  for (const std::string &file : files) {
+    int64_t discardUs;
+    int64_t cold;
+    int64_t warm;
+    if (prepare(file, nullptr, &discardUs) != OK
+        || prepare(file, cache, &cold) != OK || prepare(file, cache, &warm) != OK) {
+      ++failed;
+      continue;
+    }
+    coldUs.add(cold);
+    warmUs.add(warm);
+    json->beginObject();
+    json->write("file", file.substr(file.rfind('/') + 1));
+    json->write("cold_us", cold);
+    json->write("warm_us", warm);
+    json->endObject();
+  }
+  json->endArray();
+
+  const ProbeCache::Stats stats = cache->getStats();
+  json->write("failed", failed);
+  json->write("stores", stats.stores);
+  json->write("hits", stats.hits);
+  json->write("misses", stats.misses);
+  coldUs.writeJson(json, "cold_us");
+  warmUs.writeJson(json, "warm_us");
+
+  // The entries go with the run.
+  for (const std::string &entry : listCorpus(directory)) {
+    unlink(entry.c_str());
+  }
+  rmdir(directory.c_str());
+  return coldUs.count() > 0 ? (status_t)OK : ERROR_UNSUPPORTED;
+}
+
+HPCBENCH_MODE("probe", "(--url is a directory of files or one file)", runProbe);
+
+} // hpc
@@ -0,0 +1,177 @@
+#include "BenchMode.h"
+#include "BenchPlayer.h"
+#include "BufferingSettings.h"
+#include "HTTPSource.h"
+#include "JsonWriter.h"
+#include "LocalHttpServer.h"
+#include "Log.h"
+#include "Looper.h"
+#include "StreamingConsumer.h"
+
+#include <algorithm>
+#include <fstream>
+
+#define LOG_TAG "ReadAheadBench"
+
+namespace hpc {
+
+// Media time played between two samples of the packet queues.
+static const int64_t kSampleUs = 250000;
+
+struct QueueFootprint {
+  int64_t peakBytes {0};
+  int64_t peakBufferedUs {0};
+  double byteUs {0};  // integral of the queued bytes over wall time
+
+  void add(int64_t bytes, int64_t bufferedUs, int64_t wallUs) {
+    peakBytes = std::max(peakBytes, bytes);
+    peakBufferedUs = std::max(peakBufferedUs, bufferedUs);
+    byteUs += (double)bytes * wallUs;
+  }
+
+  void writeJson(JsonWriter *json, const char *name, int64_t wallUs) const {
+    json->beginObject(name);
+    json->write("peak_bytes", peakBytes);
+    json->write("mean_bytes", wallUs > 0 ? (int64_t)(byteUs / wallUs) : (int64_t)0);
+    json->write("peak_buffered_ms", peakBufferedUs / 1000);
+    json->endObject();
+  }
+};
+
+// Plays |url| with |settings| through the player's own DefaultSource, so
+// readBuffer() and its slices are what is measured. A local file is served
+// by a LocalHttpServer whose bandwidth steps through |schedule| every
+// |switchEveryUs|, the queues are sampled from the player's stats.
+static status_t runStream(const std::string &url, const BufferingSettings &settings,
+                          const std::vector<int64_t> &schedule, int64_t switchEveryUs,
+                          int64_t latencyUs, int64_t playUs, JsonWriter *json) {
+  json->beginObject();
+  json->write("url", url);
+
+  std::unique_ptr<LocalHttpServer> server;
+  std::string playUrl = url;
+  if (!HTTPSource::IsSupported(url.c_str())) {
+    const size_t slash = url.rfind('/');
+    server = std::make_unique<LocalHttpServer>();
+    status_t err = server->start(slash == std::string::npos ? "." : url.substr(0, slash),
+                                 schedule[0] * 1000, latencyUs);
+    if (err != OK) {
+      json->endObject();
+      return err;
+    }
+    playUrl = server->url(slash == std::string::npos ? url : url.substr(slash + 1));
+  }
+
+  BenchPlayer::Config config;
+  config.buffering = settings;
+  BenchPlayer player(config);
+  status_t err = player.open(playUrl);
+  if (err != OK) {
+    json->endObject();
+    return err;
+  }
+
+  QueueFootprint video, audio;
+  int64_t playedUs = 0;
+  size_t step = 0;
+  const int64_t startUs = Looper::GetNowUs();
+  int64_t lastSampleUs = startUs;
+  while (err == OK && playedUs < playUs && !player.isEOS()) {
+    const int64_t chunkUs = std::min(kSampleUs, playUs - playedUs);
+    err = player.play(chunkUs);
+    playedUs += chunkUs;
+
+    const int64_t nowUs = Looper::GetNowUs();
+    const PlaybackStats::Snapshot stats = player.stats();
+    video.add(stats.videoQueueBytes, stats.videoQueueUs, nowUs - lastSampleUs);
+    audio.add(stats.audioQueueBytes, stats.audioQueueUs, nowUs - lastSampleUs);
+    lastSampleUs = nowUs;
+
+    if (server != nullptr && switchEveryUs > 0 && schedule.size() > 1) {
+      const size_t next = (size_t)((nowUs - startUs) / switchEveryUs) % schedule.size();
+      if (next != step) {
+        step = next;
+        server->setBandwidth(schedule[step] * 1000);
+      }
+    }
+  }
+  if (err == OK) {
+    const int64_t wallUs = Looper::GetNowUs() - startUs;
+    const PlaybackStats::Snapshot stats = player.stats();
+    json->write("startup_ms",
+                player.startupTimeline()->getUs(StartupTimeline::kFirstRenderedFrame) / 1000);
+    json->write("played_ms", playedUs / 1000);
+    json->write("wall_ms", wallUs / 1000);
+    json->write("rebuffers", stats.rebufferCount);
+    json->write("rebuffer_ms", stats.rebufferUs / 1000);
+    json->write("rebuffers_per_min", playedUs > 0 ? stats.rebufferCount * 60e6 / playedUs : 0.0);
+    if (server != nullptr) {
+      const LocalHttpServer::Stats serverStats = server->getStats();
+      json->write("read_kbps", wallUs > 0 ? serverStats.bytesServed * 8000 / wallUs : (int64_t)0);
+      json->write("requests", serverStats.requests);
+    }
+    video.writeJson(json, "video", wallUs);
+    audio.writeJson(json, "audio", wallUs);
+  }
+  json->endObject();
+  return err;
+}
+
+// Memory footprint and rebuffer rate of the player's read-ahead with the
+// given watermarks, over a throttled local server. With --list the url names
+// a file with one url per line, e.g. a corpus from low to high bitrate.
+static status_t runReadAhead(const BenchOptions &options, JsonWriter *json) {
+  BufferingSettings settings;
+  settings.mInitialMarkMs = (int32_t)options.getInt("initial-ms", settings.mInitialMarkMs);
+  settings.mResumePlaybackMarkMs = (int32_t)options.getInt("resume-ms", settings.mResumePlaybackMarkMs);
+  settings.mMaxMarkMs = (int32_t)options.getInt("max-ms", settings.mMaxMarkMs);
+  settings.mMaxBytes = options.getInt("max-mb", settings.mMaxBytes / (1024 * 1024)) * 1024 * 1024;
+  if (!settings.isValid()) {
+    ALOGE("invalid marks");
+    return BAD_VALUE;
+  }
+  const std::vector<int64_t> schedule = parseKbpsList(options.getString("kbps", "0"));
+  if (schedule.empty()) {
+    ALOGE("no bandwidth in --kbps");
+    return BAD_VALUE;
+  }
+  const int64_t switchEveryUs = options.getInt("switch-every-s", 15) * 1000000;
+  const int64_t latencyUs = options.getInt("latency-ms", 0) * 1000;
+  const int64_t playUs = options.getInt("seconds", 120) * 1000000;
+
+  std::vector<std::string> urls;
+  if (options.has("list")) {
+    std::ifstream list(options.url);
+    std::string line;
+    while (std::getline(list, line)) {
+      if (!line.empty() && line[0] != '#') {
+        urls.push_back(line);
+      }
+    }
+  } else {
+    urls.push_back(options.url);
+  }
+
+  json->write("initial_ms", (int64_t)settings.mInitialMarkMs);
+  json->write("resume_ms", (int64_t)settings.mResumePlaybackMarkMs);
+  json->write("max_ms", (int64_t)settings.mMaxMarkMs);
+  json->write("max_bytes", settings.mMaxBytes);
+  json->write("kbps", options.getString("kbps", "0"));
+  json->beginArray("streams");
+  status_t err = OK;
+  for (const std::string &url : urls) {
+    err = runStream(url, settings, schedule, switchEveryUs, latencyUs, playUs, json);
+    if (err != OK) {
+      break;
+    }
+  }
+  json->endArray();
+  return err;
+}
+
+HPCBENCH_MODE("readahead",
+              "[--list] [--kbps=N[,N...]] [--switch-every-s=N] [--latency-ms=N] [--seconds=N] "
+              "[--initial-ms=N] [--resume-ms=N] [--max-ms=N] [--max-mb=N]",
+              runReadAhead);
+
+} // hpc
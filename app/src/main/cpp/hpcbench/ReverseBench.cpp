@@ -0,0 +1,137 @@
+#include "BenchMode.h"
+#include "FFmpegExtractor.h"
+#include "JsonWriter.h"
+#include "Log.h"
+#include "Looper.h"
+#include "ReverseDecoder.h"
+
+#include <cstdlib>
+
+extern "C" {
+#include "libavutil/imgutils.h"
+}
+
+#define LOG_TAG "ReverseBench"
+
+namespace hpc {
+
+// Decodes backwards from the end, or --from-ms, as fast as it goes and
+// reports the sustained reverse frame rate against the stream's, with the
+// memory the frame stack took. The per frame latency shows the stall at
+// every GOP boundary, --stack-mb trades it for re-decoding.
+static status_t runReverse(const BenchOptions &options, JsonWriter *json) {
+  const int64_t maxFrames = options.getInt("frames", 300);
+  const size_t maxStackBytes = (size_t)options.getInt("stack-mb", 96) * 1024 * 1024;
+  const bool reverseAudio = options.has("audio");
+
+  FFmpegExtractor probe;
+  status_t err = probe.init(options.url.c_str());
+  if (err != OK) {
+    ALOGE("cannot open %s: %d", options.url.c_str(), err);
+    return err;
+  }
+  const AVStream *stream = probe.getStream(probe.getVideoStreamIndex());
+  if (stream == nullptr) {
+    return ERROR_UNSUPPORTED;
+  }
+  const AVRational frameRate = stream->avg_frame_rate;
+  const int width = stream->codecpar->width;
+  const int height = stream->codecpar->height;
+  const int frameBytes = av_image_get_buffer_size(
+      (AVPixelFormat)stream->codecpar->format, width, height, 1);
+  int64_t fromUs = options.getInt("from-ms", -1) * 1000;
+  if (fromUs < 0) {
+    fromUs = stream->duration == AV_NOPTS_VALUE
+        ? 0 : av_rescale_q(stream->duration, stream->time_base, AVRational{1, 1000000});
+  }
+  probe.release();
+
+  ReverseDecoder decoder;
+  err = decoder.init(options.url.c_str(), reverseAudio, maxStackBytes);
+  if (err == OK) {
+    err = decoder.seekTo(fromUs);
+  }
+  if (err != OK) {
+    return err;
+  }
+
+  Samples frameUs;
+  int64_t frames = 0;
+  int64_t outOfOrder = 0;
+  int64_t lastUs = -1;
+  int64_t audioGaps = 0;
+  int64_t audioEndUs = -1;
+  int64_t audioSamples = 0;
+  const int64_t startUs = Looper::GetNowUs();
+  while (frames < maxFrames) {
+    int64_t beforeUs = Looper::GetNowUs();
+    ReverseDecoder::Frame frame;
+    err = decoder.nextFrame(&frame);
+    if (err == ERROR_END_OF_STREAM) {
+      break;
+    } else if (err != OK) {
+      return err;
+    }
+    frameUs.add(Looper::GetNowUs() - beforeUs);
+    if (lastUs >= 0 && frame.timeUs >= lastUs) {
+      ++outOfOrder;
+    }
+    lastUs = frame.timeUs;
+    ++frames;
+
+    // Keep audio a chunk ahead of video, as the player does.
+    while (decoder.hasAudio() && audioEndUs != 0 && (audioEndUs < 0 || audioEndUs > frame.timeUs)) {
+      ReverseDecoder::AudioChunk chunk;
+      if (decoder.nextAudioChunk(&chunk) != OK) {
+        audioEndUs = 0;
+        break;
+      }
+      // chunks have to tile the track, each one ends where the next played
+      // one starts.
+      if (audioEndUs > 0 && std::llabs(chunk.endUs - audioEndUs) > 1000) {
+        ++audioGaps;
+      }
+      audioSamples += (int64_t)chunk.samples.size() / chunk.channels;
+      audioEndUs = chunk.startUs;
+    }
+  }
+  const int64_t wallUs = Looper::GetNowUs() - startUs;
+
+  ReverseDecoder::Stats stats = decoder.getStats();
+  const double fps = wallUs > 0 ? frames * 1e6 / wallUs : 0.0;
+  const double streamFps = frameRate.num > 0 ? av_q2d(frameRate) : 0.0;
+  json->write("from_ms", fromUs / 1000);
+  json->write("width", (int64_t)width);
+  json->write("height", (int64_t)height);
+  json->write("frames", frames);
+  json->write("wall_ms", wallUs / 1000);
+  json->write("fps", fps);
+  json->write("stream_fps", streamFps);
+  json->write("realtime", streamFps > 0 && fps >= streamFps);
+  json->write("out_of_order", outOfOrder);
+  frameUs.writeJson(json, "frame_us");
+
+  json->beginObject("stack");
+  json->write("max_bytes", (uint64_t)stats.maxStackBytes);
+  json->write("peak_bytes", (uint64_t)stats.peakStackBytes);
+  json->write("peak_frames", frameBytes > 0 ? (int64_t)(stats.peakStackBytes / frameBytes) : (int64_t)-1);
+  json->write("gop_decodes", stats.gopDecodes);
+  json->write("split_decodes", stats.splitDecodes);
+  json->write("frames_decoded", stats.framesDecoded);
+  json->write("decode_ratio", frames > 0 ? (double)stats.framesDecoded / frames : 0.0);
+  json->write("max_fill_ms", stats.maxFillUs / 1000);
+  json->endObject();
+
+  if (decoder.hasAudio()) {
+    json->beginObject("audio");
+    json->write("chunks", stats.audioChunks);
+    json->write("samples", audioSamples);
+    json->write("gaps", audioGaps);
+    json->endObject();
+  }
+  return OK;
+}
+
+HPCBENCH_MODE("reverse", "[--from-ms=N] [--frames=N] [--stack-mb=N] [--audio]", runReverse);
+
+} // hpc
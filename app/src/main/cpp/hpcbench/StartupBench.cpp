@@ -0,0 +1,81 @@
+#include "BaseType.h"
+#include "BenchMode.h"
+#include "BenchPlayer.h"
+#include "DecoderPool.h"
+#include "JsonWriter.h"
+#include "StartupTimeline.h"
+#include "Log.h"
+
+#define LOG_TAG "StartupBench"
+
+namespace hpc {
+
+// Longest a prepare may take to show its first frame.
+static const int64_t kFirstFrameTimeoutUs = 10000000;
+
+// One player from prepare to its first frame, released afterwards, which
+// hands its video decoder to DecoderPool. |warm| tells whether it took one
+// from there.
+static status_t runOnce(const std::string &url, bool *warm, int64_t *ttffUs,
+                        JsonWriter *json) {
+  const int64_t hitsBefore = DecoderPool::Instance().getStats().hits;
+  BenchPlayer player(BenchPlayer::Config{});
+  status_t err = player.open(url);
+  if (err != OK) {
+    return err;
+  }
+  // The first frame is decoded and shown at prepare, before start().
+  err = player.waitFor(MEDIA_INFO, MEDIA_INFO_RENDERING_START, 1, kFirstFrameTimeoutUs);
+  if (err != OK) {
+    ALOGE("no first frame: %d", err);
+    return err;
+  }
+  *warm = DecoderPool::Instance().getStats().hits > hitsBefore;
+
+  std::shared_ptr<const StartupTimeline> timeline = player.startupTimeline();
+  *ttffUs = timeline->getUs(StartupTimeline::kFirstRenderedFrame);
+  json->beginObject();
+  json->write("warm", *warm);
+  for (int e = 0; e < StartupTimeline::kNumEvents; ++e) {
+    StartupTimeline::Event event = (StartupTimeline::Event)e;
+    json->write(StartupTimeline::EventName(event), timeline->getUs(event));
+  }
+  json->endObject();
+  return OK;
+}
+
+// Time to first frame of repeated opens, the first cold and the rest with a
+// pooled decoder unless --no-pool is given.
+static status_t runStartup(const BenchOptions &options, JsonWriter *json) {
+  const int64_t iterations = options.getInt("iterations", 10);
+  const bool pooled = !options.has("no-pool");
+
+  DecoderPool::Instance().clear();
+  Samples coldTtff, warmTtff;
+  json->beginArray("runs");
+  for (int64_t i = 0; i < iterations; ++i) {
+    if (!pooled) {
+      DecoderPool::Instance().clear();
+    }
+    bool warm = false;
+    int64_t ttffUs = -1;
+    status_t err = runOnce(options.url, &warm, &ttffUs, json);
+    if (err != OK) {
+      json->endArray();
+      return err;
+    }
+    (warm ? warmTtff : coldTtff).add(ttffUs);
+  }
+  json->endArray();
+
+  const DecoderPool::Stats stats = DecoderPool::Instance().getStats();
+  coldTtff.writeJson(json, "cold_ttff_us");
+  warmTtff.writeJson(json, "warm_ttff_us");
+  json->write("pool_hits", stats.hits);
+  json->write("pool_misses", stats.misses);
+  return OK;
+}
+
+HPCBENCH_MODE("startup", "[--iterations=N] [--no-pool]", runStartup);
+
+} // hpc
@@ -0,0 +1,57 @@
+#include "BenchMode.h"
+#include "BenchPlayer.h"
+#include "JsonWriter.h"
+#include "Log.h"
+
+#define LOG_TAG "StepBench"
+
+namespace hpc {
+
+// Steps forward and then back across GOP boundaries from a position, the
+// usage pattern of a paused player's frame stepping. Each step is timed from
+// the request to its frame on the surface.
+static status_t runStep(const BenchOptions &options, JsonWriter *json) {
+  const int64_t steps = options.getInt("steps", 60);
+
+  BenchPlayer player(BenchPlayer::Config{});
+  status_t err = player.open(options.url);
+  if (err != OK) {
+    return err;
+  }
+  int64_t seekUs = 0;
+  err = player.seekTo(options.getInt("at-ms", 0) * 1000, &seekUs);
+  if (err != OK) {
+    return err;
+  }
+
+  const int64_t renderedBefore = player.stats().framesRendered;
+  Samples forward;
+  int64_t latencyUs = 0;
+  for (int64_t i = 0; i < steps; ++i) {
+    err = player.step(true /* forward */, &latencyUs);
+    if (err != OK) {
+      break;  // the last frame, the player reports nothing
+    }
+    forward.add(latencyUs);
+  }
+  // Twice as far back as forward, so the previous GOPs are decoded too.
+  Samples backward;
+  for (int64_t i = 0; i < 2 * steps && player.videoSink().lastPtsUs() > 0; ++i) {
+    err = player.step(false /* forward */, &latencyUs);
+    if (err != OK) {
+      break;
+    }
+    backward.add(latencyUs);
+  }
+
+  json->write("seek_us", seekUs);
+  forward.writeJson(json, "forward_step_us");
+  backward.writeJson(json, "backward_step_us");
+  json->write("steps", (int64_t)(forward.count() + backward.count()));
+  json->write("frames_rendered", player.stats().framesRendered - renderedBefore);
+  return OK;
+}
+
+HPCBENCH_MODE("step", "[--at-ms=N] [--steps=N]", runStep);
+
+} // hpc
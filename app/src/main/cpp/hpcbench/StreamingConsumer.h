@@ -0,0 +1,88 @@
+#pragma once
+
+#include "Handler.h"
+#include "MediaPacket.h"
+#include "Message.h"
+#include "Source.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace hpc {
+
+// Takes a streaming source's notifications the way the player does.
+struct SourceListener : public Handler {
+  std::atomic<bool> prepared {false};
+  std::atomic<int32_t> prepareResult {OK};
+  std::atomic<bool> buffering {false};
+
+ protected:
+  void onMessageReceived(const std::shared_ptr<Message> &msg) override {
+    switch (msg->mArg1) {
+      case kWhatPrepared:
+        prepareResult = (int32_t)msg->mArg2;
+        prepared = true;
+        break;
+      case kWhatPauseOnBufferingStart:
+        buffering = true;
+        break;
+      case kWhatResumeOnBufferingEnd:
+        buffering = false;
+        break;
+      default:
+        break;
+    }
+  }
+};
+
+// A track played in real time: packets are taken once the playhead reaches
+// them, one is held until then.
+struct TrackConsumer {
+  bool audio;
+  std::unique_ptr<MediaPacket> held;
+  bool ended {false};
+
+  // Plays up to |playheadUs| or until the queue waits for data.
+  void consume(Source *source, int64_t playheadUs) {
+    while (!ended) {
+      if (held == nullptr) {
+        status_t err = source->dequeueAccessUnit(audio, &held);
+        if (err == WOULD_BLOCK || err == INFO_DISCONTINUITY) {
+          held.reset();
+          if (err == WOULD_BLOCK) {
+            return;
+          }
+          continue;
+        }
+        if (err != OK) {
+          ended = true;
+          return;
+        }
+      }
+      if (held->ptsUs > playheadUs) {
+        return;
+      }
+      held.reset();
+    }
+  }
+};
+
+// "4000,800,4000" in kbps.
+inline std::vector<int64_t> parseKbpsList(const std::string &list) {
+  std::vector<int64_t> kbps;
+  const char *p = list.c_str();
+  while (*p != '\0') {
+    char *end;
+    const int64_t value = strtoll(p, &end, 10);
+    if (end == p) {
+      break;
+    }
+    kbps.push_back(value);
+    p = *end == ',' ? end + 1 : end;
+  }
+  return kbps;
+}
+
+} // hpc
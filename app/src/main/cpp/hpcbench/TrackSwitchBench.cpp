@@ -0,0 +1,76 @@
+#include "BenchMode.h"
+#include "BenchPlayer.h"
+#include "HpcPlayer.h"
+#include "JsonWriter.h"
+#include "Log.h"
+
+#include <vector>
+
+#define LOG_TAG "TrackSwitchBench"
+
+namespace hpc {
+
+// Plays and cycles through the audio tracks with HpcPlayer::selectTrack(),
+// measuring how long each switch takes to be heard and whether video kept
+// going meanwhile.
+static status_t runTrackSwitch(const BenchOptions &options, JsonWriter *json) {
+  const int64_t switches = options.getInt("switches", 6);
+  const int64_t intervalUs = options.getInt("interval-ms", 2000) * 1000;
+
+  BenchPlayer player(BenchPlayer::Config{});
+  status_t err = player.open(options.url);
+  if (err != OK) {
+    return err;
+  }
+
+  std::vector<Extractor::TrackInfo> tracks;
+  err = player.player()->getTrackInfo(&tracks);
+  if (err != OK) {
+    return err;
+  }
+  std::vector<size_t> audioTracks;
+  json->beginArray("audio_tracks");
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    if (tracks[i].type != MEDIA_TRACK_TYPE_AUDIO) {
+      continue;
+    }
+    audioTracks.push_back(i);
+    json->beginObject();
+    json->write("index", (int64_t)i);
+    json->write("mime", tracks[i].mime_type);
+    json->write("language", tracks[i].language);
+    json->endObject();
+  }
+  json->endArray();
+  if (audioTracks.size() < 2) {
+    ALOGE("need at least two audio tracks, %s has %zu", options.url.c_str(), audioTracks.size());
+    return ERROR_UNSUPPORTED;
+  }
+
+  err = player.play(intervalUs);
+  const int64_t droppedBefore = player.stats().framesDroppedLate;
+  size_t next = 0;
+  for (int64_t i = 0; i < switches && err == OK && !player.isEOS(); ++i) {
+    next = (next + 1) % audioTracks.size();
+    if ((ssize_t)audioTracks[next] == player.player()->getSelectedTrack(MEDIA_TRACK_TYPE_AUDIO)) {
+      next = (next + 1) % audioTracks.size();
+    }
+    err = player.selectAudioTrack(audioTracks[next]);
+    if (err == OK) {
+      err = player.play(intervalUs);
+    }
+  }
+  if (err != OK) {
+    return err;
+  }
+
+  player.trackSwitchLatency().writeJson(json, "switch_latency_us");
+  json->write("video_dropped", player.stats().framesDroppedLate - droppedBefore);
+  json->write("video_rendered", player.videoSink().rendered());
+  json->write("audio_underruns", player.audioSink()->underruns());
+  return OK;
+}
+
+HPCBENCH_MODE("track-switch", "[--switches=N] [--interval-ms=N]", runTrackSwitch);
+
+} // hpc
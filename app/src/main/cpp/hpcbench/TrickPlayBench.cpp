@@ -0,0 +1,101 @@
+#include "BenchMode.h"
+#include "BenchPlayer.h"
+#include "HpcPlayer.h"
+#include "JsonWriter.h"
+#include "Log.h"
+
+#include <cstdlib>
+#include <sstream>
+#include <sys/resource.h>
+
+#define LOG_TAG "TrickPlayBench"
+
+namespace hpc {
+
+static int64_t cpuTimeUs() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return -1;
+  }
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL
+      + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+// Plays |wallUs| worth of keyframe-only fast forward at |speed| through
+// HpcPlayer::setTrickPlay() and reports what it cost and what reached the
+// screen.
+static status_t runAtSpeed(const BenchOptions &options, float speed, int64_t wallUs,
+                           JsonWriter *json) {
+  BenchPlayer::Config config;
+  config.audio = false;
+  BenchPlayer player(config);
+  status_t err = player.open(options.url);
+  if (err != OK) {
+    return err;
+  }
+  const int64_t atUs = options.getInt("at-ms", 0) * 1000;
+  if (atUs > 0) {
+    err = player.seekTo(atUs, nullptr);
+    if (err != OK) {
+      return err;
+    }
+  }
+  err = player.player()->setTrickPlay(speed);
+  if (err != OK) {
+    return err;
+  }
+
+  const int64_t renderedBefore = player.videoSink().rendered();
+  const PlaybackStats::Snapshot before = player.stats();
+  const int64_t cpuBeforeUs = cpuTimeUs();
+  err = player.play((int64_t)(speed * wallUs));
+  if (err != OK) {
+    return err;
+  }
+  const int64_t cpuUs = cpuTimeUs() - cpuBeforeUs;
+  const int64_t playedUs = player.wallUs();
+  const int64_t rendered = player.videoSink().rendered() - renderedBefore;
+  const PlaybackStats::Snapshot after = player.stats();
+
+  json->beginObject("keyframes");
+  json->write("wall_ms", playedUs / 1000);
+  // of one core, all player threads included.
+  json->write("cpu_pct", playedUs > 0 ? 100.0 * cpuUs / playedUs : 0.0);
+  json->write("fps", playedUs > 0 ? rendered * 1e6 / playedUs : 0.0);
+  json->write("rendered", rendered);
+  json->write("dropped", after.framesDroppedLate - before.framesDroppedLate);
+  json->write("decoded", after.framesDecoded - before.framesDecoded);
+  json->write("max_frame_interval_us", player.videoSink().maxIntervalUs());
+  json->write("eos", player.isEOS());
+  json->endObject();
+  return OK;
+}
+
+// Keyframe-only fast forward at each of --speeds, 2x to 32x.
+static status_t runTrickPlay(const BenchOptions &options, JsonWriter *json) {
+  const int64_t wallUs = options.getInt("seconds", 5) * 1000000;
+  std::istringstream speeds(options.getString("speeds", "4,8,16,32"));
+
+  json->beginArray("speeds");
+  std::string token;
+  while (std::getline(speeds, token, ',')) {
+    const float speed = std::strtof(token.c_str(), nullptr);
+    if (speed <= 1.0f) {
+      continue;
+    }
+    json->beginObject();
+    json->write("speed", (double)speed);
+    status_t err = runAtSpeed(options, speed, wallUs, json);
+    json->endObject();
+    if (err != OK) {
+      json->endArray();
+      return err;
+    }
+  }
+  json->endArray();
+  return OK;
+}
+
+HPCBENCH_MODE("trickplay", "[--speeds=4,8,16,32] [--seconds=N] [--at-ms=N]", runTrickPlay);
+
+} // hpc
@@ -0,0 +1,129 @@
+#include "BenchMode.h"
+#include "FFmpegExtractor.h"
+#include "JsonWriter.h"
+#include "Log.h"
+#include "Looper.h"
+#include "MediaPacket.h"
+#include "MmapSource.h"
+#include "TsExtractor.h"
+
+#include <sys/resource.h>
+
+#define LOG_TAG "TsBench"
+
+namespace hpc {
+
+static int64_t cpuTimeUs() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return -1;
+  }
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL
+      + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+// Opens --url through a mapping and demuxes all of it, the time to lock
+// on, i.e. to a usable extractor, and the throughput after.
+template <typename T>
+static status_t demux(const BenchOptions &options, const char *name, JsonWriter *json) {
+  const int iterations = (int)options.getInt("iterations", 3);
+  Samples openUs;
+  Samples megabytesPerS;
+  int64_t packets = 0;
+  int64_t bytes = 0;
+  int64_t cpuUs = 0;
+  int64_t wallUs = 0;
+  for (int i = 0; i < iterations; ++i) {
+    std::shared_ptr<MmapSource> source = MmapSource::Create(options.url.c_str());
+    if (source == nullptr || source->initCheck() != OK) {
+      ALOGE("cannot map %s", options.url.c_str());
+      return ERROR_IO;
+    }
+    int64_t size = 0;
+    source->getSize(&size);
+    T extractor;
+    extractor.setDataSource(source);
+    extractor.setRequiresVideo(false);
+    const int64_t cpuBeforeUs = cpuTimeUs();
+    const int64_t startUs = Looper::GetNowUs();
+    status_t err = extractor.init(options.url.c_str());
+    if (err != OK) {
+      ALOGE("%s cannot open %s: %d", name, options.url.c_str(), err);
+      return err;
+    }
+    openUs.add(Looper::GetNowUs() - startUs);
+    packets = 0;
+    std::unique_ptr<MediaPacket> packet;
+    while (extractor.read(packet, -1) == OK) {
+      ++packets;
+    }
+    const int64_t runUs = Looper::GetNowUs() - startUs;
+    wallUs += runUs;
+    cpuUs += cpuTimeUs() - cpuBeforeUs;
+    bytes += size;
+    megabytesPerS.add(runUs > 0 ? size / runUs : 0);  // bytes per us
+  }
+
+  json->beginObject(name);
+  json->write("packets", packets);
+  openUs.writeJson(json, "open_us");
+  megabytesPerS.writeJson(json, "mb_per_s");
+  json->write("cpu_ms", cpuUs / 1000);
+  json->write("cpu_us_per_mb", bytes > 0 ? (int64_t)(cpuUs * 1e6 / bytes) : 0);
+  json->write("wall_ms", wallUs / 1000);
+  json->endObject();
+  return OK;
+}
+
+// How fast FindSyncByte() goes over the file, every sync byte in it.
+static void scanSync(const BenchOptions &options, JsonWriter *json) {
+  std::shared_ptr<MmapSource> source = MmapSource::Create(options.url.c_str());
+  if (source == nullptr || source->initCheck() != OK) {
+    return;
+  }
+  const uint8_t *data = source->data();
+  const size_t size = source->size();
+  int64_t matches = 0;
+  const int64_t startUs = Looper::GetNowUs();
+  for (size_t i = TsExtractor::FindSyncByte(data, size); i < size;
+       i += 1 + TsExtractor::FindSyncByte(data + i + 1, size - i - 1)) {
+    ++matches;
+  }
+  const int64_t scanUs = Looper::GetNowUs() - startUs;
+  json->beginObject("sync_scan");
+  json->write("sync_bytes", matches);
+  json->write("mb_per_s", scanUs > 0 ? (int64_t)(size / scanUs) : 0);
+  json->endObject();
+}
+
+// Demux throughput of the native transport stream extractor against
+// FFmpeg's on a recorded stream, --iterations runs of each. MB/s are per
+// run, open included; open_us is the time to lock on.
+static status_t runTs(const BenchOptions &options, JsonWriter *json) {
+  status_t err = demux<TsExtractor>(options, "native", json);
+  if (err != OK) {
+    return err;
+  }
+  {
+    TsExtractor extractor;
+    std::shared_ptr<MmapSource> source = MmapSource::Create(options.url.c_str());
+    extractor.setDataSource(source);
+    extractor.setRequiresVideo(false);
+    if (extractor.init(options.url.c_str()) == OK) {
+      std::unique_ptr<MediaPacket> packet;
+      while (extractor.read(packet, -1) == OK) {
+      }
+      const TsExtractor::Stats stats = extractor.getStats();
+      json->write("pes_packets", stats.pesPackets);
+      json->write("resyncs", stats.resyncs);
+      json->write("continuity_errors", stats.continuityErrors);
+      json->write("discontinuities", stats.discontinuities);
+    }
+  }
+  scanSync(options, json);
+  return demux<FFmpegExtractor>(options, "ffmpeg", json);
+}
+
+HPCBENCH_MODE("ts", "[--iterations=N]", runTs);
+
+} // hpc
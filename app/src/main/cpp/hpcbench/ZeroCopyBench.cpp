@@ -0,0 +1,132 @@
+#include "BenchMode.h"
+#include "FFmpegExtractor.h"
+#include "FFmpegVideoDecoder.h"
+#include "JsonWriter.h"
+#include "Log.h"
+#include "Looper.h"
+#include "MediaPacket.h"
+#include "MetaData.h"
+#include "PlaybackStats.h"
+
+#include <cstring>
+#include <sys/resource.h>
+
+#define LOG_TAG "ZeroCopyBench"
+
+namespace hpc {
+
+static int64_t cpuTimeUs() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return -1;
+  }
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL
+      + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+// Demuxes and decodes --seconds of video with the player's
+// FFmpegVideoDecoder. With |copy| every payload takes the way of a
+// MediaBuffer: copied into a buffer of its own, which libavcodec cannot
+// reference and copies again. Otherwise the decoder gets the demuxer's
+// MediaPacket by reference as the player's decoders do now.
+static status_t decode(const BenchOptions &options, bool copy, JsonWriter *json) {
+  const int64_t playUs = options.getInt("seconds", 30) * 1000000;
+  FFmpegExtractor extractor;
+  status_t err = extractor.init(options.url.c_str());
+  if (err != OK) {
+    ALOGE("cannot open %s: %d", options.url.c_str(), err);
+    return err;
+  }
+  const int track = extractor.getVideoStreamIndex();
+  if (extractor.getStream(track) == nullptr) {
+    return ERROR_UNSUPPORTED;
+  }
+  MetaData meta;
+  extractor.getMetaData(meta);
+  const AVCodecParameters *params = extractor.getStream(track)->codecpar;
+  meta.csd.assign(params->extradata, params->extradata + params->extradata_size);
+
+  // Called on this thread only, it is never configure()d onto a looper.
+  std::shared_ptr<FFmpegVideoDecoder> decoder = std::make_shared<FFmpegVideoDecoder>();
+  std::shared_ptr<PlaybackStats> stats = std::make_shared<PlaybackStats>();
+  decoder->setPlaybackStats(stats);
+  err = decoder->init(meta);
+  if (err != OK) {
+    return err;
+  }
+
+  std::unique_ptr<MediaPacket> packet;
+  std::shared_ptr<MediaBuffer> frame;
+  int64_t packets = 0;
+  int64_t frames = 0;
+  int64_t payloadBytes = 0;
+  int64_t copiedBytes = 0;
+  int64_t firstUs = -1;
+  auto drain = [&]() {
+    while (decoder->output(frame) == OK) {
+      if (frame != nullptr) {
+        ++frames;
+      }
+      frame.reset();
+    }
+  };
+  const int64_t cpuBeforeUs = cpuTimeUs();
+  const int64_t startUs = Looper::GetNowUs();
+  while (extractor.read(packet, track) == OK
+      && (firstUs < 0 || packet->dtsUs - firstUs < playUs)) {
+    if (firstUs < 0) {
+      firstUs = packet->dtsUs;
+    }
+    ++packets;
+    payloadBytes += packet->size();
+    if (copy) {
+      std::shared_ptr<MediaBuffer> buffer = std::make_shared<MediaBuffer>();
+      buffer->data = std::shared_ptr<uint8_t>(new uint8_t[packet->size()],
+                                              std::default_delete<uint8_t[]>());
+      memcpy(buffer->data.get(), packet->data(), packet->size());
+      buffer->size = packet->size();
+      buffer->ptsUs = packet->ptsUs;
+      buffer->isKeyFrame = packet->flags() & AV_PKT_FLAG_KEY;
+      copiedBytes += packet->size();
+      while ((err = decoder->input(buffer)) == WOULD_BLOCK || err == ERROR_BUFFER_FULL) {
+        drain();
+      }
+    } else {
+      while ((err = decoder->input(*packet)) == WOULD_BLOCK || err == ERROR_BUFFER_FULL) {
+        drain();
+      }
+    }
+    drain();
+    err = OK;
+  }
+  const int64_t wallUs = Looper::GetNowUs() - startUs;
+  const int64_t cpuUs = cpuTimeUs() - cpuBeforeUs;
+  // what the decoder copied on input, and the demuxer on reading
+  copiedBytes += stats->getSnapshot().payloadBytesCopied + extractor.getBytesCopied();
+  decoder->release();
+
+  json->beginObject(copy ? "copy" : "reference");
+  json->write("packets", packets);
+  json->write("frames", frames);
+  json->write("wall_ms", wallUs / 1000);
+  json->write("cpu_ms", cpuUs / 1000);
+  json->write("payload_bytes", payloadBytes);
+  json->write("bytes_copied", copiedBytes);
+  json->write("bytes_copied_per_s", wallUs > 0 ? (int64_t)(copiedBytes * 1e6 / wallUs) : 0);
+  json->endObject();
+  return err;
+}
+
+// Payload bytes copied between the demuxer and the video decoder, the old
+// MediaBuffer way and by reference.
+static status_t runZeroCopy(const BenchOptions &options, JsonWriter *json) {
+  status_t err = decode(options, true /* copy */, json);
+  if (err != OK) {
+    return err;
+  }
+  return decode(options, false /* copy */, json);
+}
+
+HPCBENCH_MODE("zerocopy", "[--seconds=N]", runZeroCopy);
+
+} // hpc
@@ -0,0 +1,68 @@
+#include "BenchMode.h"
+#include "JsonWriter.h"
+
+#include <stdio.h>
+#include <string.h>
+
+extern "C" {
+#include "libavutil/log.h"
+}
+
+using namespace hpc;
+
+static void usage() {
+  fprintf(stderr, "usage: hpcbench <mode> [--option[=value]...] <url>\n\nmodes:\n");
+  for (const BenchMode &mode : BenchRegistry::Modes()) {
+    fprintf(stderr, "  %-10s %s\n", mode.name, mode.usage);
+  }
+}
+
+// hpcbench <mode> [--key=value...] <url>
+// Runs one benchmark and prints its report as a single JSON object on stdout,
+// diagnostics go to stderr.
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    usage();
+    return 2;
+  }
+  const BenchMode *mode = BenchRegistry::Find(argv[1]);
+  if (mode == nullptr) {
+    fprintf(stderr, "unknown mode '%s'\n", argv[1]);
+    usage();
+    return 2;
+  }
+
+  BenchOptions options;
+  for (int i = 2; i < argc; ++i) {
+    if (strncmp(argv[i], "--", 2) != 0) {
+      options.url = argv[i];
+      continue;
+    }
+    std::string arg(argv[i] + 2);
+    size_t eq = arg.find('=');
+    if (eq == std::string::npos) {
+      options.args[arg] = "1";
+    } else {
+      options.args[arg.substr(0, eq)] = arg.substr(eq + 1);
+    }
+  }
+  if (options.url.empty()) {
+    usage();
+    return 2;
+  }
+  if (!options.has("verbose")) {
+    av_log_set_level(AV_LOG_ERROR);
+  }
+
+  JsonWriter json;
+  json.beginObject();
+  json.write("mode", mode->name);
+  json.write("url", options.url);
+  json.beginObject("results");
+  status_t err = mode->run(options, &json);
+  json.endObject();
+  json.write("status", (int32_t)err);
+  json.endObject();
+  printf("%s\n", json.str().c_str());
+  return err == OK ? 0 : 1;
+}
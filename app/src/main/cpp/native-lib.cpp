@@ -3,23 +3,30 @@
 #include <android/native_window.h>
 #include <android/native_window_jni.h>
 #include "hpc_player/HpcPlayer.h"
+#include "hpc_player/foundation/Surface.h"
 
 using namespace hpc;
 
 extern "C" {
 
-HpcPlayer* getPlayer(JNIEnv *env, jobject thiz) {
+// nativePlayerPtr holds a heap allocated shared_ptr, the player is only ever
+// owned that way.
+static std::shared_ptr<HpcPlayer> *getHolder(JNIEnv *env, jobject thiz) {
     jclass clazz = env->GetObjectClass(thiz);
     jfieldID fieldId = env->GetFieldID(clazz, "nativePlayerPtr", "J");
-    return reinterpret_cast<HpcPlayer*>(env->GetLongField(thiz, fieldId));
+    return reinterpret_cast<std::shared_ptr<HpcPlayer> *>(env->GetLongField(thiz, fieldId));
+}
+
+HpcPlayer* getPlayer(JNIEnv *env, jobject thiz) {
+    return getHolder(env, thiz)->get();
 }
 
 JNIEXPORT void JNICALL
 Java_com_example_hpcplayer_HpcPlayer_nativeInit(JNIEnv *env, jobject thiz) {
-    auto *player = new HpcPlayer();
+    auto *holder = new std::shared_ptr<HpcPlayer>(HpcPlayer::Create());
     jclass clazz = env->GetObjectClass(thiz);
     jfieldID fieldId = env->GetFieldID(clazz, "nativePlayerPtr", "J");
-    env->SetLongField(thiz, fieldId, reinterpret_cast<jlong>(player));
+    env->SetLongField(thiz, fieldId, reinterpret_cast<jlong>(holder));
 }
 
 JNIEXPORT void JNICALL
@@ -36,7 +43,9 @@ Java_com_example_hpcplayer_HpcPlayer_nativeSetSurface(
         JNIEnv *env, jobject thiz, jobject surface) {
     auto *player = getPlayer(env, thiz);
     ANativeWindow *window = ANativeWindow_fromSurface(env, surface);
-    player->setSurface(reinterpret_cast<NativeWindow *>(window));
+    // Surface takes a reference of its own.
+    player->setSurface(std::make_shared<Surface>(window));
+    ANativeWindow_release(window);
 }
 
 JNIEXPORT void JNICALL
@@ -67,21 +76,25 @@ JNIEXPORT void JNICALL
 Java_com_example_hpcplayer_HpcPlayer_nativeSeekTo(
         JNIEnv *env, jobject thiz, jlong position) {
     auto *player = getPlayer(env, thiz);
-    player->seekTo(static_cast<long>(position));
+    player->seekTo(static_cast<int64_t>(position) * 1000);
 }
 
 JNIEXPORT jlong JNICALL
 Java_com_example_hpcplayer_HpcPlayer_nativeGetCurrentPosition(
         JNIEnv *env, jobject thiz) {
     auto *player = getPlayer(env, thiz);
-    return player->getCurrentPosition();
+    int64_t positionMs = 0;
+    player->getCurrentPosition(&positionMs);
+    return positionMs;
 }
 
 JNIEXPORT jlong JNICALL
 Java_com_example_hpcplayer_HpcPlayer_nativeGetDuration(
         JNIEnv *env, jobject thiz) {
     auto *player = getPlayer(env, thiz);
-    return player->getDuration();
+    int64_t durationMs = -1;
+    player->getDuration(&durationMs);
+    return durationMs;
 }
 
 JNIEXPORT jboolean JNICALL
@@ -91,11 +104,16 @@ Java_com_example_hpcplayer_HpcPlayer_nativeIsPlaying(
     return player->isPlaying();
 }
 
+JNIEXPORT void JNICALL
+Java_com_example_hpcplayer_HpcPlayer_nativeTrimMemory(JNIEnv *env, jclass clazz, jint level) {
+    HpcPlayer::TrimMemory(level);
+}
+
 JNIEXPORT void JNICALL
 Java_com_example_hpcplayer_HpcPlayer_nativeRelease(JNIEnv *env, jobject thiz) {
-    auto *player = getPlayer(env, thiz);
-    player->release();
-    delete player;
+    auto *holder = getHolder(env, thiz);
+    (*holder)->release();
+    delete holder;
 
     jclass clazz = env->GetObjectClass(thiz);
     jfieldID fieldId = env->GetFieldID(clazz, "nativePlayerPtr", "J");
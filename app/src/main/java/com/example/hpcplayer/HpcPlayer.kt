@@ -77,5 +77,8 @@ class HpcPlayer(context: Context) {
         init {
             System.loadLibrary("hpcplayer")
         }
+
+        // 在 Application/Activity 的 onTrimMemory() 中调用, 释放解码器池中空闲的解码器
+        @JvmStatic external fun nativeTrimMemory(level: Int)
     }
 }
\ No newline at end of file